@@ -0,0 +1,265 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Aggregate.hpp
+*
+* @summary:   Mergeable aggregate snapshot definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "TopK.hpp"
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+//
+// 'VAGG'
+//
+#define AGGREGATE_SNAPSHOT_MAGIC 0x47474156
+#define AGGREGATE_SNAPSHOT_VERSION 2
+#define AGGREGATE_SNAPSHOT_EXTENSION L".vagg"
+
+//
+// Latencies (nanoseconds) are kept in log-linear buckets: four per power
+// of two, so any bucket is within 25% of the values in it.
+//
+#define AGGREGATE_LATENCY_SUB_BUCKET_BITS 2
+#define AGGREGATE_LATENCY_BUCKETS (64 << AGGREGATE_LATENCY_SUB_BUCKET_BITS)
+
+//
+// Secure calls printed in a report.
+//
+#define AGGREGATE_REPORT_SECURE_CALLS 20
+
+//
+// File layout (all strings are UTF-8, referred to by index):
+//
+//   AGGREGATE_SNAPSHOT_HEADER
+//   StringCount x (uint32_t length + bytes)
+//   SecureCallCount x (AGGREGATE_SECURE_CALL_RECORD + BucketCount x AGGREGATE_BUCKET_RECORD)
+//   TrackerCount x (AGGREGATE_TOP_K_RECORD + EntryCount x (AGGREGATE_TOP_K_ENTRY_RECORD + IdentityLength x uint32_t))
+//
+// Nothing refers to a raw address. Secure calls are identified by name and
+// stacks by their symbolized frames, so snapshots from different hosts (and
+// Windows builds) line up when merged.
+//
+// ExposureSeconds is the event time the counts were collected over, and is
+// what rates are per. It is summed when snapshots are merged, so hosts
+// traced at the same time count once each. FirstTime and LastTime are for
+// information only.
+//
+typedef struct _AGGREGATE_SNAPSHOT_HEADER
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Snapshots;
+    uint64_t FirstTime;
+    uint64_t LastTime;
+    uint64_t Events;
+    double ExposureSeconds;
+    uint32_t StringCount;
+    uint32_t SecureCallCount;
+    uint32_t TrackerCount;
+    uint32_t Reserved;
+} AGGREGATE_SNAPSHOT_HEADER, *PAGGREGATE_SNAPSHOT_HEADER;
+
+typedef struct _AGGREGATE_SECURE_CALL_RECORD
+{
+    uint32_t NameId;
+    uint32_t Number;
+    uint64_t Count;
+    uint64_t Latencies;
+    uint64_t LatencySum;
+    uint64_t LatencyMax;
+    uint32_t BucketCount;
+    uint32_t Reserved;
+} AGGREGATE_SECURE_CALL_RECORD, *PAGGREGATE_SECURE_CALL_RECORD;
+
+//
+// Only non-empty buckets are written.
+//
+typedef struct _AGGREGATE_BUCKET_RECORD
+{
+    uint32_t Index;
+    uint32_t Reserved;
+    uint64_t Count;
+} AGGREGATE_BUCKET_RECORD, *PAGGREGATE_BUCKET_RECORD;
+
+typedef struct _AGGREGATE_TOP_K_RECORD
+{
+    uint32_t Type;
+    uint32_t Capacity;
+    uint64_t Total;
+    uint64_t MinimumCount;
+    uint32_t EntryCount;
+    uint32_t Reserved;
+} AGGREGATE_TOP_K_RECORD, *PAGGREGATE_TOP_K_RECORD;
+
+//
+// The identity is string IDs: the secure call then the frames for a
+// stack, the process then the secure call, or the caller frame.
+//
+typedef struct _AGGREGATE_TOP_K_ENTRY_RECORD
+{
+    uint64_t Count;
+    uint64_t Error;
+    uint32_t IdentityLength;
+    uint32_t Reserved;
+} AGGREGATE_TOP_K_ENTRY_RECORD, *PAGGREGATE_TOP_K_ENTRY_RECORD;
+
+//
+// A secure call's count and latency distribution (nanoseconds).
+//
+typedef struct _AGGREGATE_SECURE_CALL
+{
+    uint32_t NameId;
+    uint32_t Number;
+    uint64_t Count;
+    uint64_t Latencies;
+    uint64_t LatencySum;
+    uint64_t LatencyMax;
+    std::vector<uint64_t> Buckets;
+} AGGREGATE_SECURE_CALL, *PAGGREGATE_SECURE_CALL;
+
+typedef struct _AGGREGATE_TOP_K_ENTRY
+{
+    uint64_t Key;
+    uint64_t Count;
+    uint64_t Error;
+    std::vector<uint32_t> Identity;
+} AGGREGATE_TOP_K_ENTRY, *PAGGREGATE_TOP_K_ENTRY;
+
+//
+// A top-K sketch in mergeable form. MinimumCount is the most any key
+// without an entry can have been seen (0 if nothing was ever dropped).
+//
+typedef struct _AGGREGATE_TOP_K
+{
+    uint32_t Capacity;
+    uint64_t Total;
+    uint64_t MinimumCount;
+    std::vector<AGGREGATE_TOP_K_ENTRY> Entries;
+    std::unordered_map<uint64_t, size_t> Index;
+} AGGREGATE_TOP_K, *PAGGREGATE_TOP_K;
+
+//
+// An aggregate: one snapshot, or any number merged together.
+//
+typedef struct _AGGREGATE
+{
+    std::vector<std::string> Strings;
+    std::vector<uint64_t> StringHashes;
+    std::unordered_map<std::string, uint32_t> StringIds;
+
+    uint64_t Snapshots;
+    uint64_t FirstTime;
+    uint64_t LastTime;
+    uint64_t Events;
+    double ExposureSeconds;
+
+    //
+    // By name ID.
+    //
+    std::unordered_map<uint32_t, AGGREGATE_SECURE_CALL> SecureCalls;
+
+    AGGREGATE_TOP_K TopK[TopKTrackerCount];
+} AGGREGATE, *PAGGREGATE;
+
+//
+// Function definitions
+//
+void
+InitializeAggregate (
+    _Out_ PAGGREGATE Aggregate
+    );
+
+uint32_t
+InternAggregateString (
+    _Inout_ PAGGREGATE Aggregate,
+    _In_ const std::string& String
+    );
+
+uint32_t
+InternAggregateSecureCallName (
+    _Inout_ PAGGREGATE Aggregate,
+    _In_opt_ const char* Name,
+    _In_ ULONG SecureCallNumber
+    );
+
+ULONG
+GetAggregateLatencyBucket (
+    _In_ uint64_t Latency
+    );
+
+uint64_t
+GetAggregateLatencyPercentile (
+    _In_ const AGGREGATE_SECURE_CALL* SecureCall,
+    _In_ double Percentile
+    );
+
+void
+CountAggregateIdentity (
+    _Inout_ PAGGREGATE Aggregate,
+    _In_ TOP_K_TRACKER_TYPE Type,
+    _In_ const std::vector<uint32_t>& Identity,
+    _In_ uint64_t Count
+    );
+
+bool
+LoadAggregateSnapshot (
+    _In_ const wchar_t* FilePath,
+    _Out_ PAGGREGATE Aggregate
+    );
+
+bool
+SaveAggregateSnapshot (
+    _In_ const AGGREGATE* Aggregate,
+    _In_ const wchar_t* FilePath
+    );
+
+void
+MergeAggregate (
+    _Inout_ PAGGREGATE Target,
+    _In_ const AGGREGATE* Source
+    );
+
+void
+PrintAggregateReport (
+    _In_ const AGGREGATE* Aggregate
+    );
+
+void
+SetAggregateSnapshot (
+    _In_ const wchar_t* FilePath
+    );
+
+bool
+IsAggregationEnabled ();
+
+void
+RecordAggregateSecureCall (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG SecureCallNumber
+    );
+
+void
+RecordAggregateLatency (
+    _In_ ULONG SecureCallNumber,
+    _In_ ULONGLONG Latency
+    );
+
+void
+WriteAggregateSnapshot ();
+
+bool
+MergeAggregateSnapshots (
+    _In_ const wchar_t* OutputPath,
+    _In_ const std::vector<std::wstring>& InputPaths,
+    _In_ ULONG ThreadCount
+    );
\ No newline at end of file
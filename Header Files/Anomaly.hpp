@@ -0,0 +1,196 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Anomaly.hpp
+*
+* @summary:   Streaming secure call rate anomaly detection definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <vector>
+
+//
+// (process, secure call) baselines kept. Memory is fixed at this many
+// no matter how many pairs the trace produces.
+//
+#define ANOMALY_DEFAULT_CAPACITY 4096
+
+//
+// Rates are counted per interval (of event time, so replay behaves the
+// same as live) and every baseline is evaluated when one ends.
+//
+#define ANOMALY_DEFAULT_INTERVAL_MS 1000
+
+//
+// Alert when an interval's count is this many standard deviations above
+// the baseline...
+//
+#define ANOMALY_DEFAULT_SCORE 6.0
+
+//
+// ...is at least this many calls...
+//
+#define ANOMALY_MIN_EVENTS 50
+
+//
+// ...and the baseline has seen this many intervals.
+//
+#define ANOMALY_WARMUP_INTERVALS 10
+
+//
+// EWMA weight of the newest interval (about a 20 interval memory).
+//
+#define ANOMALY_SMOOTHING 0.1
+
+//
+// Empty intervals folded into the baselines after an idle stretch. After
+// this many, every baseline has decayed to nothing (0.9^100 is 3e-5).
+//
+#define ANOMALY_MAX_IDLE_INTERVALS 100
+
+//
+// A pair which keeps alerting is quiet for this many intervals after each alert.
+//
+#define ANOMALY_HOLDOFF_INTERVALS 30
+
+//
+// Baselines which have decayed below this (and saw nothing this interval)
+// are dropped to make room.
+//
+#define ANOMALY_IDLE_MEAN 0.05
+
+//
+// Stacks kept per pair (the interval's heaviest), and frames per stack.
+//
+#define ANOMALY_STACKS 3
+#define ANOMALY_STACK_FRAMES 16
+
+//
+// A stack seen this interval. Count over-estimates by at most Error.
+//
+typedef struct _ANOMALY_STACK
+{
+    uint64_t Key;
+    uint64_t Count;
+    uint64_t Error;
+    uint32_t NumberOfFrames;
+    uint64_t Frames[ANOMALY_STACK_FRAMES];
+} ANOMALY_STACK, *PANOMALY_STACK;
+
+//
+// A (process, secure call) baseline: an EWMA of its per-interval count
+// and of the variance around it.
+//
+typedef struct _ANOMALY_ENTRY
+{
+    bool InUse;
+    uint64_t Key;
+    uint32_t ProcessId;
+    uint64_t Count;
+    double Mean;
+    double Variance;
+    uint64_t Intervals;
+    uint64_t LastAlert;
+    ANOMALY_STACK Stacks[ANOMALY_STACKS];
+} ANOMALY_ENTRY, *PANOMALY_ENTRY;
+
+//
+// An alert, copied out of its entry.
+//
+typedef struct _ANOMALY_ALERT
+{
+    uint64_t Key;
+    uint32_t ProcessId;
+    uint64_t Count;
+    double Mean;
+    double StandardDeviation;
+    double Score;
+    ANOMALY_STACK Stacks[ANOMALY_STACKS];
+} ANOMALY_ALERT, *PANOMALY_ALERT;
+
+//
+// The detector: an open-addressed table (twice Capacity slots, so probes
+// stay short) of baselines.
+//
+typedef struct _ANOMALY_DETECTOR
+{
+    std::vector<ANOMALY_ENTRY> Slots;
+    uint32_t Capacity;
+    uint32_t Used;
+    double Score;
+    uint64_t Interval;
+    uint64_t Events;
+    uint64_t Untracked;
+    uint64_t Dropped;
+    uint64_t Alerts;
+} ANOMALY_DETECTOR, *PANOMALY_DETECTOR;
+
+//
+// Function definitions
+//
+void
+InitializeAnomalyDetector (
+    _Out_ PANOMALY_DETECTOR Detector,
+    _In_ uint32_t Capacity,
+    _In_ double Score
+    );
+
+void
+CountAnomalyEvent (
+    _Inout_ PANOMALY_DETECTOR Detector,
+    _In_ uint64_t Key,
+    _In_ uint32_t ProcessId,
+    _In_ uint64_t StackKey,
+    _In_ const uint64_t* Frames,
+    _In_ uint32_t NumberOfFrames
+    );
+
+void
+EvaluateAnomalyDetector (
+    _Inout_ PANOMALY_DETECTOR Detector,
+    _Out_ std::vector<ANOMALY_ALERT>& Alerts
+    );
+
+void
+SkipAnomalyIntervals (
+    _Inout_ PANOMALY_DETECTOR Detector,
+    _In_ uint64_t Intervals
+    );
+
+#ifdef _WIN32
+#include "Nodes.hpp"
+
+//
+// Function definitions
+//
+bool
+SetAnomalyDetection (
+    _In_ ULONG IntervalMs,
+    _In_ double Score,
+    _In_opt_ const wchar_t* LogPath
+    );
+
+void
+SetAnomalyQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    );
+
+bool
+IsAnomalyDetectionEnabled ();
+
+void
+TrackAnomalyEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    );
+
+void
+StopAnomalyDetection ();
+#endif
\ No newline at end of file
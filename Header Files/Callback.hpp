@@ -13,6 +13,7 @@
 --*/
 #pragma once
 #include "Trace.hpp"
+#include "EventViews.hpp"
 
 //
 // Image load events do not seem to give a DCEnd event.
@@ -32,36 +33,20 @@ static bool k_ImageRunDownComplete = false;
 #define VTL1_EXIT_OPCODE 0x4A
 
 //
-// Data for the secure system call event
+// An in-flight secure call, by thread, for timing it (VTL 1 enter to exit).
 //
-typedef struct _SECURE_CALL_EVENT_DATA
+typedef struct _VTL1_CALL_START
 {
-    unsigned __int16 Operation;
+    ULONGLONG TimeStamp;
+    ULONG ProcessId;
     unsigned __int16 SecureCallNumber;
-} SECURE_CALL_EVENT_DATA, *PSECURE_CALL_EVENT_DATA;
-
-#define VTL1_ENTER_EXIT_EVENT_SIZE sizeof(SECURE_CALL_EVENT_DATA)
+} VTL1_CALL_START, *PVTL1_CALL_START;
 
 //
 // Stack walks
 //
 #define STACK_WALK_OPCODE 32
 
-typedef struct _STACK_WALK_EVENT_DATA
-{
-    ULONGLONG EventTimeStamp;
-    ULONG StackProcess;
-    ULONG StackThread;
-
-    //
-    // The stack is _in_ the event,
-    // we do not get a pointer to it.
-    //
-    ULONG_PTR Stack;
-} STACK_WALK_EVENT_DATA, *PSTACK_WALK_EVENT_DATA;
-
-#define STACK_WALK_EVENT_SIZE sizeof(STACK_WALK_EVENT_DATA)
-
 //
 // Image loads
 //
@@ -69,31 +54,86 @@ typedef struct _STACK_WALK_EVENT_DATA
 #define IMAGE_LOADED_UNLOAD 2
 #define IMAGE_LOADED_RUNDOWN_OPCODE 3
 
-typedef struct _IMAGE_LOAD_EVENT_DATA
+//
+// Processes (Process_TypeGroup1, version 4 - see PROCESS_EVENT_MIN_VERSION)
+//
+#define PROCESS_START_OPCODE 1
+#define PROCESS_END_OPCODE 2
+#define PROCESS_DC_START_OPCODE 3
+#define PROCESS_DC_END_OPCODE 4
+
+//
+// Threads (Thread_TypeGroup1). These share the thread provider GUID
+// with the VTL 1 enter/exit events.
+//
+#define THREAD_START_OPCODE 1
+#define THREAD_END_OPCODE 2
+#define THREAD_DC_START_OPCODE 3
+#define THREAD_DC_END_OPCODE 4
+#define THREAD_SET_NAME_OPCODE 72
+
+//
+// Table-driven event dispatch
+//
+
+//
+// Typed event handler. Each handler is registered for exactly one
+// (provider, opcode) pair, so it does not need to check either again.
+//
+typedef
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+(*PEVENT_HANDLER) (
+    _In_ PEVENT_RECORD EventRecord
+    );
+
+//
+// GUID.Data1 of every provider we consume. These must match the
+// DEFINE_GUIDs in Trace.hpp - they are what the dispatch table is
+// generated from, since the GUIDs themselves are not constexpr.
+//
+#define THREAD_PROVIDER_DATA1 0x3d6fa8d1
+#define PROCESS_PROVIDER_DATA1 0x3d6fa8d0
+#define STACK_WALK_PROVIDER_DATA1 0xdef2fe46
+#define IMAGE_LOAD_PROVIDER_DATA1 0x2cb15d1d
+
+//
+// Providers are hashed into slots by the low bits of GUID.Data1.
+// Collisions are caught at compile time.
+//
+#define EVENT_PROVIDER_SLOT_COUNT 8
+#define EVENT_PROVIDER_SLOT(Data1) ((Data1) & (EVENT_PROVIDER_SLOT_COUNT - 1))
+
+#define EVENT_OPCODE_COUNT 256
+
+typedef struct _EVENT_HANDLER_ENTRY
 {
-    ULONG_PTR ImageBase;
-    ULONG_PTR ImageSize;
-    ULONG ProcessId;
-    ULONG ImageChecksum;
-    ULONG TimeDateStamp;
-    ULONG Reserved0;
-    ULONG_PTR DefaultBase;
-    ULONG Reserved1;
-    ULONG Reserved2;
-    ULONG Reserved3;
-    ULONG Reserved4;
+    const GUID* ProviderGuid;
+    ULONG ProviderData1;
+    UCHAR Opcode;
+    PEVENT_HANDLER Handler;
+} EVENT_HANDLER_ENTRY, *PEVENT_HANDLER_ENTRY;
 
-    //
-    // The name is _in_ the event,
-    // we do not get a pointer to it.
-    //
-    wchar_t FileName;
-} IMAGE_LOAD_EVENT_DATA, *PIMAGE_LOAD_EVENT_DATA;
+typedef struct _EVENT_PROVIDER_DISPATCH
+{
+    const GUID* ProviderGuid;
+    PEVENT_HANDLER Handlers[EVENT_OPCODE_COUNT];
+} EVENT_PROVIDER_DISPATCH, *PEVENT_PROVIDER_DISPATCH;
 
+typedef struct _EVENT_DISPATCH_TABLE
+{
+    EVENT_PROVIDER_DISPATCH Providers[EVENT_PROVIDER_SLOT_COUNT];
+} EVENT_DISPATCH_TABLE, *PEVENT_DISPATCH_TABLE;
 
 //
 // Function definitions
 //
+PEVENT_HANDLER
+LookupEventHandler (
+    _In_ const GUID& ProviderId,
+    _In_ UCHAR Opcode
+    );
+
 _Function_class_(PEVENT_RECORD_CALLBACK)
 void
 EtwEventCallback (
@@ -0,0 +1,88 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Clock.hpp
+*
+* @summary:   Session clock (raw QPC timestamp to wall-clock time) definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+
+//
+// FILETIME units (100ns) per second
+//
+#define CLOCK_FILETIME_SECOND 10000000ULL
+
+//
+// QPC/system time pairs read at session start. The one read the fastest
+// (the least likely to have been preempted) anchors the clock.
+//
+#define CLOCK_CALIBRATION_ROUNDS 64
+
+//
+// Maps the session's raw (QPC) event timestamps to UTC FILETIMEs:
+// AnchorTimeStamp was read at AnchorTime, give or take Uncertainty ticks.
+//
+typedef struct _SESSION_CLOCK
+{
+    uint64_t QpcFrequency;
+    uint64_t AnchorTimeStamp;
+    uint64_t AnchorTime;
+    uint64_t Uncertainty;
+} SESSION_CLOCK, *PSESSION_CLOCK;
+
+//
+// Function definitions
+//
+bool
+IsClockValid (
+    _In_ const SESSION_CLOCK* Clock
+    );
+
+uint64_t
+GetClockTime (
+    _In_ const SESSION_CLOCK* Clock,
+    _In_ uint64_t TimeStamp
+    );
+
+uint64_t
+GetClockTimeStamp (
+    _In_ const SESSION_CLOCK* Clock,
+    _In_ uint64_t Time
+    );
+
+void
+ConvertClockTimeStamps (
+    _In_ const SESSION_CLOCK* Clock,
+    _In_ const uint64_t* TimeStamps,
+    _Out_ uint64_t* Times,
+    _In_ size_t Count
+    );
+
+#ifdef _WIN32
+//
+// Function definitions
+//
+void
+CalibrateSessionClock ();
+
+void
+SetSessionClockFromTrace (
+    _In_ uint64_t QpcFrequency,
+    _In_ uint64_t StartTime
+    );
+
+void
+NoteSessionClockEvent (
+    _In_ uint64_t TimeStamp
+    );
+
+const SESSION_CLOCK*
+GetSessionClock ();
+#endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/CompressedOutput.hpp
+*
+* @summary:   Compressed (LZ4 frame) output stream definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Lz4.hpp"
+#include <Windows.h>
+#include <vector>
+#include <memory>
+
+//
+// Blocks in flight between the writer and the compression thread. The
+// writer only waits when all of them are queued (compression fell behind).
+//
+#define COMPRESSED_OUTPUT_BLOCK_COUNT 4
+
+//
+// An uncompressed block, filled by the writer.
+//
+typedef struct _COMPRESSED_OUTPUT_BLOCK
+{
+    std::vector<uint8_t> Data;
+    SIZE_T Length;
+} COMPRESSED_OUTPUT_BLOCK, *PCOMPRESSED_OUTPUT_BLOCK;
+
+//
+// Compression statistics. BytesIn and StallTicks belong to the writer,
+// the rest to the compression thread.
+//
+typedef struct _COMPRESSED_OUTPUT_STATISTICS
+{
+    ULONGLONG BytesIn;
+    ULONGLONG BytesOut;
+    ULONGLONG Blocks;
+    ULONGLONG StoredBlocks;
+    ULONGLONG CompressTicks;
+    ULONGLONG StallTicks;
+    ULONGLONG WriteFailures;
+
+    //
+    // Compression thread CPU time, in 100ns units.
+    //
+    ULONGLONG CpuTime;
+} COMPRESSED_OUTPUT_STATISTICS, *PCOMPRESSED_OUTPUT_STATISTICS;
+
+//
+// A compressed output stream. One thread writes, the compression thread
+// compresses and writes to disk. Blocks are written as soon as they are
+// compressed, so a file cut short is readable up to its last block.
+//
+typedef struct _COMPRESSED_OUTPUT
+{
+    HANDLE FileHandle;
+    HANDLE ThreadHandle;
+    SRWLOCK Lock;
+    CONDITION_VARIABLE BlockQueued;
+    CONDITION_VARIABLE BlockWritten;
+    COMPRESSED_OUTPUT_BLOCK Blocks[COMPRESSED_OUTPUT_BLOCK_COUNT];
+    ULONGLONG BlocksQueued;
+    ULONGLONG BlocksWritten;
+    bool Stopping;
+
+    //
+    // Compression thread only.
+    //
+    std::unique_ptr<LZ4_STATE> State;
+    std::vector<uint8_t> Frame;
+
+    COMPRESSED_OUTPUT_STATISTICS Statistics;
+} COMPRESSED_OUTPUT, *PCOMPRESSED_OUTPUT;
+
+//
+// Function definitions
+//
+void
+SetOutputCompression (
+    _In_ bool Compress
+    );
+
+bool
+IsOutputCompressionEnabled ();
+
+bool
+StartCompressedOutput (
+    _Inout_ PCOMPRESSED_OUTPUT Output,
+    _In_ HANDLE FileHandle
+    );
+
+bool
+IsCompressedOutputStarted (
+    _In_ const COMPRESSED_OUTPUT* Output
+    );
+
+void
+WriteCompressedOutput (
+    _Inout_ PCOMPRESSED_OUTPUT Output,
+    _In_ const void* Data,
+    _In_ SIZE_T Length
+    );
+
+void
+StopCompressedOutput (
+    _Inout_ PCOMPRESSED_OUTPUT Output
+    );
+
+void
+AddCompressedOutputStatistics (
+    _Inout_ PCOMPRESSED_OUTPUT_STATISTICS Total,
+    _In_ const COMPRESSED_OUTPUT_STATISTICS* Statistics
+    );
+
+void
+PrintCompressedOutputStatistics (
+    _In_ const COMPRESSED_OUTPUT_STATISTICS* Statistics
+    );
\ No newline at end of file
@@ -0,0 +1,106 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Diff.hpp
+*
+* @summary:   Capture/snapshot comparison ("diff" command) definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Aggregate.hpp"
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+//
+// A change is only reported if it is this many standard deviations (of
+// the counts, taken as Poisson) beyond any sketch error...
+//
+#define DIFF_DEFAULT_SCORE 3.0
+
+//
+// ...and the rate moved by at least this much.
+//
+#define DIFF_DEFAULT_MIN_CHANGE_PERCENT 10.0
+
+//
+// Latency histogram buckets are up to 25% wide, so smaller percentile
+// moves are not real. Both sides need this many timed calls.
+//
+#define DIFF_LATENCY_RESOLUTION_PERCENT 25.0
+#define DIFF_MIN_LATENCY_SAMPLES 30
+
+//
+// Changes printed per section, largest first.
+//
+#define DIFF_REPORT_SECURE_CALLS 20
+#define DIFF_REPORT_STACKS 10
+#define DIFF_REPORT_STACK_FRAMES 8
+
+//
+// One side of a comparison: a raw capture (counted exactly) or an
+// aggregate snapshot. Rates are per second of event time (a snapshot's
+// exposure) when both sides know it, otherwise per correlated event.
+//
+typedef struct _DIFF_INPUT
+{
+    const wchar_t* Path;
+    bool Snapshot;
+    AGGREGATE Aggregate;
+    double Seconds;
+    LONGLONG LoadTicks;
+} DIFF_INPUT, *PDIFF_INPUT;
+
+//
+// A compared secure call or top-K entry. Either side is NULL if it does
+// not have it.
+//
+typedef struct _DIFF_CHANGE
+{
+    const AGGREGATE_SECURE_CALL* BaselineCall;
+    const AGGREGATE_SECURE_CALL* ComparisonCall;
+    const AGGREGATE_TOP_K_ENTRY* BaselineEntry;
+    const AGGREGATE_TOP_K_ENTRY* ComparisonEntry;
+    double BaselineRate;
+    double ComparisonRate;
+    double Score;
+    bool RateChanged;
+    bool LatencyChanged;
+} DIFF_CHANGE, *PDIFF_CHANGE;
+
+//
+// "diff" command options
+//
+typedef struct _DIFF_OPTIONS
+{
+    const wchar_t* SymbolStore;
+    ULONG ThreadCount;
+    double Score;
+    double MinChangePercent;
+    const wchar_t* FoldedPath;
+} DIFF_OPTIONS, *PDIFF_OPTIONS;
+
+//
+// Function definitions
+//
+double
+GetDiffScore (
+    _In_ uint64_t BaselineCount,
+    _In_ uint64_t BaselineError,
+    _In_ double BaselineExposure,
+    _In_ uint64_t ComparisonCount,
+    _In_ uint64_t ComparisonError,
+    _In_ double ComparisonExposure
+    );
+
+bool
+DiffCaptures (
+    _In_ const wchar_t* BaselinePath,
+    _In_ const wchar_t* ComparisonPath,
+    _In_ const DIFF_OPTIONS* Options
+    );
\ No newline at end of file
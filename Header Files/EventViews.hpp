@@ -0,0 +1,588 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/EventViews.hpp
+*
+* @summary:   ETW event payload layouts and bounds-checked, zero-copy views
+*             over them. Portable, so that the parsing is tested off Windows.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+
+#ifdef _WIN32
+#include <evntcons.h>
+#endif
+
+//
+// Pointer-sized payload fields, and the UTF-16 names in payloads. These are
+// the Windows types on Windows, so views hand the ETW callbacks exactly
+// what they pass on.
+//
+#ifdef _WIN32
+typedef ULONG_PTR EVENT_POINTER;
+typedef wchar_t EVENT_WCHAR;
+#else
+typedef uintptr_t EVENT_POINTER;
+typedef char16_t EVENT_WCHAR;
+#endif
+
+//
+// VTL 1 enter/exit
+//
+typedef struct _SECURE_CALL_EVENT_DATA
+{
+    uint16_t Operation;
+    uint16_t SecureCallNumber;
+} SECURE_CALL_EVENT_DATA, *PSECURE_CALL_EVENT_DATA;
+
+#define VTL1_ENTER_EXIT_EVENT_SIZE sizeof(SECURE_CALL_EVENT_DATA)
+
+//
+// Stack walks
+//
+typedef struct _STACK_WALK_EVENT_DATA
+{
+    uint64_t EventTimeStamp;
+    uint32_t StackProcess;
+    uint32_t StackThread;
+
+    //
+    // The stack is _in_ the event,
+    // we do not get a pointer to it.
+    //
+    EVENT_POINTER Stack;
+} STACK_WALK_EVENT_DATA, *PSTACK_WALK_EVENT_DATA;
+
+#define STACK_WALK_EVENT_SIZE sizeof(STACK_WALK_EVENT_DATA)
+
+//
+// Image loads
+//
+typedef struct _IMAGE_LOAD_EVENT_DATA
+{
+    EVENT_POINTER ImageBase;
+    EVENT_POINTER ImageSize;
+    uint32_t ProcessId;
+    uint32_t ImageChecksum;
+    uint32_t TimeDateStamp;
+    uint32_t Reserved0;
+    EVENT_POINTER DefaultBase;
+    uint32_t Reserved1;
+    uint32_t Reserved2;
+    uint32_t Reserved3;
+    uint32_t Reserved4;
+
+    //
+    // The name is _in_ the event,
+    // we do not get a pointer to it.
+    //
+    EVENT_WCHAR FileName;
+} IMAGE_LOAD_EVENT_DATA, *PIMAGE_LOAD_EVENT_DATA;
+
+//
+// Processes (Process_TypeGroup1, version 4)
+//
+#define PROCESS_EVENT_MIN_VERSION 4
+
+typedef struct _PROCESS_EVENT_DATA
+{
+    EVENT_POINTER UniqueProcessKey;
+    uint32_t ProcessId;
+    uint32_t ParentId;
+    uint32_t SessionId;
+    int32_t ExitStatus;
+    EVENT_POINTER DirectoryTableBase;
+    uint32_t Flags;
+
+    //
+    // Variable-length data follows: the user SID (a TOKEN_USER followed
+    // by the SID, or a single zero ULONG if there is no SID) and then
+    // the ANSI image file name.
+    //
+    uint8_t UserSid;
+} PROCESS_EVENT_DATA, *PPROCESS_EVENT_DATA;
+
+//
+// Threads (Thread_TypeGroup1)
+//
+typedef struct _THREAD_EVENT_DATA
+{
+    uint32_t ProcessId;
+    uint32_t ThreadId;
+} THREAD_EVENT_DATA, *PTHREAD_EVENT_DATA;
+
+typedef struct _THREAD_SET_NAME_EVENT_DATA
+{
+    uint32_t ProcessId;
+    uint32_t ThreadId;
+
+    //
+    // The name is _in_ the event,
+    // we do not get a pointer to it.
+    //
+    EVENT_WCHAR ThreadName;
+} THREAD_SET_NAME_EVENT_DATA, *PTHREAD_SET_NAME_EVENT_DATA;
+
+//
+// A view is parsed once from (UserData, UserDataLength). Parse validates
+// the whole payload up front - the fixed header, the trailing array and
+// the (NULL-terminated) trailing name - so after a successful Parse every
+// accessor is safe without any further length checks. Nothing is copied:
+// all accessors point into the original event buffer, so a view must not
+// outlive its EVENT_RECORD.
+//
+// Each schema describes one payload layout:
+//
+//   Header    - The fixed-size payload structure.
+//   Element   - Element type of the trailing array (uint8_t if there is none).
+//   NameChar  - Character type of the trailing name (char if there is none).
+//   FixedSize - Number of bytes of Header which must be present.
+//   ParseTail - Validates everything after FixedSize and locates the
+//               trailing array and/or name.
+//
+
+//
+// What a schema found after the fixed part of the payload.
+//
+template <typename ELEMENT, typename NAME_CHAR>
+struct EVENT_TAIL
+{
+    const ELEMENT* Elements;
+    uint32_t ElementCount;
+    const NAME_CHAR* Name;
+    size_t NameLength;
+};
+
+template <typename SCHEMA>
+class EVENT_VIEW
+{
+public:
+    typedef typename SCHEMA::Header HEADER;
+    typedef typename SCHEMA::Element ELEMENT;
+    typedef typename SCHEMA::NameChar NAME_CHAR;
+
+    EVENT_VIEW () :
+        m_Header(NULL),
+        m_Tail()
+    {
+    }
+
+    /**
+    *
+    * @brief        Validates a raw payload and, on success, binds the view to it.
+    * @param[in]    UserData - The event payload.
+    * @param[in]    UserDataLength - The size, in bytes, of the payload.
+    * @return       true if the payload is well-formed, otherwise false.
+    *
+    */
+    bool
+    Parse (
+        _In_opt_ const void* UserData,
+        _In_ size_t UserDataLength
+        )
+    {
+        m_Header = NULL;
+        m_Tail = {};
+
+        if ((UserData == NULL) ||
+            (UserDataLength < SCHEMA::FixedSize))
+        {
+            return false;
+        }
+
+        if (!SCHEMA::ParseTail((static_cast<const uint8_t*>(UserData) + SCHEMA::FixedSize),
+                               (UserDataLength - SCHEMA::FixedSize),
+                               &m_Tail))
+        {
+            m_Tail = {};
+            return false;
+        }
+
+        m_Header = static_cast<const HEADER*>(UserData);
+        return true;
+    }
+
+#ifdef _WIN32
+    /**
+    *
+    * @brief        Validates an event record's payload and binds the view to it.
+    * @param[in]    EventRecord - Associated ETW event record.
+    * @return       true if the payload is well-formed, otherwise false.
+    *
+    */
+    bool
+    Parse (
+        _In_ const EVENT_RECORD* EventRecord
+        )
+    {
+        return Parse(EventRecord->UserData,
+                     EventRecord->UserDataLength);
+    }
+#endif
+
+    const HEADER*
+    operator-> () const
+    {
+        return m_Header;
+    }
+
+    const ELEMENT*
+    Elements () const
+    {
+        return m_Tail.Elements;
+    }
+
+    uint32_t
+    ElementCount () const
+    {
+        return m_Tail.ElementCount;
+    }
+
+    //
+    // Always NULL-terminated at Name()[NameLength()].
+    //
+    const NAME_CHAR*
+    Name () const
+    {
+        return m_Tail.Name;
+    }
+
+    size_t
+    NameLength () const
+    {
+        return m_Tail.NameLength;
+    }
+
+private:
+    const HEADER* m_Header;
+    EVENT_TAIL<ELEMENT, NAME_CHAR> m_Tail;
+};
+
+//
+// Common tail parsers
+//
+
+/**
+*
+* @brief        Tail parser for payloads which are exactly FixedSize bytes.
+*
+*/
+template <typename ELEMENT, typename NAME_CHAR>
+inline
+bool
+ParseNoTail (
+    _In_ const uint8_t* Tail,
+    _In_ size_t TailLength,
+    _Out_ EVENT_TAIL<ELEMENT, NAME_CHAR>* Result
+    )
+{
+    return (TailLength == 0);
+}
+
+/**
+*
+* @brief        Tail parser for payloads which may carry (and ignore) extra
+*               trailing fields added by newer event versions.
+*
+*/
+template <typename ELEMENT, typename NAME_CHAR>
+inline
+bool
+ParseIgnoredTail (
+    _In_ const uint8_t* Tail,
+    _In_ size_t TailLength,
+    _Out_ EVENT_TAIL<ELEMENT, NAME_CHAR>* Result
+    )
+{
+    return true;
+}
+
+/**
+*
+* @brief        Tail parser for a trailing array of at least one element.
+*
+*/
+template <typename ELEMENT, typename NAME_CHAR>
+inline
+bool
+ParseArrayTail (
+    _In_ const uint8_t* Tail,
+    _In_ size_t TailLength,
+    _Out_ EVENT_TAIL<ELEMENT, NAME_CHAR>* Result
+    )
+{
+    if ((TailLength < sizeof(ELEMENT)) ||
+        ((TailLength % sizeof(ELEMENT)) != 0))
+    {
+        return false;
+    }
+
+    Result->Elements = reinterpret_cast<const ELEMENT*>(Tail);
+    Result->ElementCount = static_cast<uint32_t>(TailLength / sizeof(ELEMENT));
+
+    return true;
+}
+
+/**
+*
+* @brief        Locates a NULL-terminated string inside a bounded buffer.
+* @param[in]    Buffer - Start of the string.
+* @param[in]    BufferLength - Bytes available at Buffer.
+* @param[out]   Name - Receives the start of the string.
+* @param[out]   NameLength - Receives the length, in characters.
+* @return       The number of bytes consumed (including the terminator),
+*               or 0 if the string is not terminated inside the buffer.
+*
+*/
+template <typename NAME_CHAR>
+inline
+size_t
+LocateBoundedString (
+    _In_ const uint8_t* Buffer,
+    _In_ size_t BufferLength,
+    _Out_ const NAME_CHAR** Name,
+    _Out_ size_t* NameLength
+    )
+{
+    const NAME_CHAR* name;
+    size_t maxLength;
+    size_t length;
+
+    *Name = NULL;
+    *NameLength = 0;
+
+    name = reinterpret_cast<const NAME_CHAR*>(Buffer);
+    maxLength = (BufferLength / sizeof(NAME_CHAR));
+
+    for (length = 0; length < maxLength; length++)
+    {
+        if (name[length] == 0)
+        {
+            *Name = name;
+            *NameLength = length;
+
+            return ((length + 1) * sizeof(NAME_CHAR));
+        }
+    }
+
+    return 0;
+}
+
+/**
+*
+* @brief        Tail parser for a trailing NULL-terminated name.
+*
+*/
+template <typename ELEMENT, typename NAME_CHAR>
+inline
+bool
+ParseStringTail (
+    _In_ const uint8_t* Tail,
+    _In_ size_t TailLength,
+    _Out_ EVENT_TAIL<ELEMENT, NAME_CHAR>* Result
+    )
+{
+    return (LocateBoundedString(Tail,
+                                TailLength,
+                                &Result->Name,
+                                &Result->NameLength) != 0);
+}
+
+//
+// Function definitions
+//
+bool
+ParseProcessEventTail (
+    _In_ const uint8_t* Tail,
+    _In_ size_t TailLength,
+    _Out_ const char** ImageName,
+    _Out_ size_t* ImageNameLength
+    );
+
+//
+// Schemas
+//
+
+//
+// VTL 1 enter/exit: exactly one SECURE_CALL_EVENT_DATA.
+//
+struct SECURE_CALL_SCHEMA
+{
+    typedef SECURE_CALL_EVENT_DATA Header;
+    typedef uint8_t Element;
+    typedef char NameChar;
+
+    static constexpr size_t FixedSize = sizeof(SECURE_CALL_EVENT_DATA);
+
+    static
+    bool
+    ParseTail (
+        _In_ const uint8_t* Tail,
+        _In_ size_t TailLength,
+        _Out_ EVENT_TAIL<Element, NameChar>* Result
+        )
+    {
+        return ParseNoTail(Tail, TailLength, Result);
+    }
+};
+
+//
+// Stack walk: fixed header followed by at least one frame.
+//
+struct STACK_WALK_SCHEMA
+{
+    typedef STACK_WALK_EVENT_DATA Header;
+    typedef EVENT_POINTER Element;
+    typedef char NameChar;
+
+    static constexpr size_t FixedSize = offsetof(STACK_WALK_EVENT_DATA, Stack);
+
+    static
+    bool
+    ParseTail (
+        _In_ const uint8_t* Tail,
+        _In_ size_t TailLength,
+        _Out_ EVENT_TAIL<Element, NameChar>* Result
+        )
+    {
+        return ParseArrayTail(Tail, TailLength, Result);
+    }
+};
+
+//
+// Image load: fixed header followed by a NULL-terminated NT path.
+//
+struct IMAGE_LOAD_SCHEMA
+{
+    typedef IMAGE_LOAD_EVENT_DATA Header;
+    typedef uint8_t Element;
+    typedef EVENT_WCHAR NameChar;
+
+    static constexpr size_t FixedSize = offsetof(IMAGE_LOAD_EVENT_DATA, FileName);
+
+    static
+    bool
+    ParseTail (
+        _In_ const uint8_t* Tail,
+        _In_ size_t TailLength,
+        _Out_ EVENT_TAIL<Element, NameChar>* Result
+        )
+    {
+        return ParseStringTail(Tail, TailLength, Result);
+    }
+};
+
+//
+// Thread start/end: only the process and thread IDs are used. Newer
+// versions append more fields, which are ignored.
+//
+struct THREAD_SCHEMA
+{
+    typedef THREAD_EVENT_DATA Header;
+    typedef uint8_t Element;
+    typedef char NameChar;
+
+    static constexpr size_t FixedSize = sizeof(THREAD_EVENT_DATA);
+
+    static
+    bool
+    ParseTail (
+        _In_ const uint8_t* Tail,
+        _In_ size_t TailLength,
+        _Out_ EVENT_TAIL<Element, NameChar>* Result
+        )
+    {
+        return ParseIgnoredTail(Tail, TailLength, Result);
+    }
+};
+
+//
+// Thread name: process and thread IDs followed by a NULL-terminated name.
+//
+struct THREAD_SET_NAME_SCHEMA
+{
+    typedef THREAD_SET_NAME_EVENT_DATA Header;
+    typedef uint8_t Element;
+    typedef EVENT_WCHAR NameChar;
+
+    static constexpr size_t FixedSize = offsetof(THREAD_SET_NAME_EVENT_DATA, ThreadName);
+
+    static
+    bool
+    ParseTail (
+        _In_ const uint8_t* Tail,
+        _In_ size_t TailLength,
+        _Out_ EVENT_TAIL<Element, NameChar>* Result
+        )
+    {
+        return ParseStringTail(Tail, TailLength, Result);
+    }
+};
+
+//
+// Process start/end (version 4+): fixed header, the variable-length
+// user SID and then the NULL-terminated ANSI image name. Everything
+// after the image name (command line, package name, ...) is ignored.
+//
+struct PROCESS_SCHEMA
+{
+    typedef PROCESS_EVENT_DATA Header;
+    typedef uint8_t Element;
+    typedef char NameChar;
+
+    static constexpr size_t FixedSize = offsetof(PROCESS_EVENT_DATA, UserSid);
+
+    static
+    bool
+    ParseTail (
+        _In_ const uint8_t* Tail,
+        _In_ size_t TailLength,
+        _Out_ EVENT_TAIL<Element, NameChar>* Result
+        )
+    {
+        return ParseProcessEventTail(Tail,
+                                     TailLength,
+                                     &Result->Name,
+                                     &Result->NameLength);
+    }
+};
+
+//
+// Process end only needs the process ID, which is inside the fixed part.
+//
+struct PROCESS_END_SCHEMA
+{
+    typedef PROCESS_EVENT_DATA Header;
+    typedef uint8_t Element;
+    typedef char NameChar;
+
+    static constexpr size_t FixedSize = offsetof(PROCESS_EVENT_DATA, ParentId);
+
+    static
+    bool
+    ParseTail (
+        _In_ const uint8_t* Tail,
+        _In_ size_t TailLength,
+        _Out_ EVENT_TAIL<Element, NameChar>* Result
+        )
+    {
+        return ParseIgnoredTail(Tail, TailLength, Result);
+    }
+};
+
+//
+// View types
+//
+typedef EVENT_VIEW<SECURE_CALL_SCHEMA> SECURE_CALL_EVENT_VIEW;
+typedef EVENT_VIEW<STACK_WALK_SCHEMA> STACK_WALK_EVENT_VIEW;
+typedef EVENT_VIEW<IMAGE_LOAD_SCHEMA> IMAGE_LOAD_EVENT_VIEW;
+typedef EVENT_VIEW<THREAD_SCHEMA> THREAD_EVENT_VIEW;
+typedef EVENT_VIEW<THREAD_SET_NAME_SCHEMA> THREAD_SET_NAME_EVENT_VIEW;
+typedef EVENT_VIEW<PROCESS_SCHEMA> PROCESS_EVENT_VIEW;
+typedef EVENT_VIEW<PROCESS_END_SCHEMA> PROCESS_END_EVENT_VIEW;
\ No newline at end of file
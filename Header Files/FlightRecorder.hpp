@@ -0,0 +1,194 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/FlightRecorder.hpp
+*
+* @summary:   Flight recorder (in-memory ring with triggered dumps) definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "RawCapture.hpp"
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+//
+// Ring size when only a window is given.
+//
+#define FLIGHT_RECORDER_DEFAULT_RING_MB 64
+
+//
+// Set this (from anywhere on the machine) to dump the ring.
+//
+#define FLIGHT_RECORDER_DEFAULT_TRIGGER_EVENT L"Global\\Vtl1MonFlightTrigger"
+
+//
+// How long to keep recording after a trigger before dumping. Stack walks
+// arrive late (see the correlation watermark), so the event which tripped
+// the trigger is not in the ring yet when it fires.
+//
+#define FLIGHT_RECORDER_POST_TRIGGER_MS 2000
+
+//
+// Triggers are ignored for this long after a dump, so a sustained
+// condition does not turn into back-to-back dumps.
+//
+#define FLIGHT_RECORDER_HOLDOFF_MS 10000
+
+//
+// Dumps are symbolized in-process while tracing continues - keep it
+// from taking over the machine during an incident.
+//
+#define FLIGHT_RECORDER_SYMBOLIZE_THREADS 2
+
+//
+// Dumps are "<stem>.<sequence>.vraw", symbolized to "<stem>.<sequence>.csv".
+//
+#define FLIGHT_RECORDER_DUMP_FORMAT L"%s.%06lu%s"
+#define FLIGHT_RECORDER_CAPTURE_EXTENSION L".vraw"
+#define FLIGHT_RECORDER_OUTPUT_EXTENSION L".csv"
+
+typedef enum _FLIGHT_TRIGGER
+{
+    FlightTriggerNone = 0,
+    FlightTriggerRate,
+    FlightTriggerLatency,
+    FlightTriggerSignal,
+    FlightTriggerEvent,
+    FlightTriggerCount
+} FLIGHT_TRIGGER;
+
+//
+// Flight recorder statistics. The event counters, RecordTicks and
+// LongestCallTicks belong to the ETW processing thread, the rest to
+// the dump thread.
+//
+typedef struct _FLIGHT_RECORDER_STATISTICS
+{
+    ULONGLONG EventsRecorded;
+    ULONGLONG EventsEvicted;
+    ULONGLONG EventsDropped;
+    ULONGLONG RecordTicks;
+    ULONGLONG LongestCallTicks;
+    ULONGLONG Triggers[FlightTriggerCount];
+    ULONGLONG Dumps;
+    ULONGLONG DumpFailures;
+    ULONGLONG EventsDumped;
+    ULONGLONG DumpTicks;
+    ULONGLONG SymbolizeTicks;
+} FLIGHT_RECORDER_STATISTICS, *PFLIGHT_RECORDER_STATISTICS;
+
+//
+// The flight recorder. Correlated events are kept as raw capture records
+// (unsymbolized frames) in a fixed-size ring - the oldest are overwritten.
+// Nothing touches the disk until a trigger fires, then the dump thread
+// writes the window out as a raw capture and symbolizes it.
+//
+typedef struct _FLIGHT_RECORDER
+{
+    //
+    // The ring, under Lock. Records run from Head to Tail or, when Wrapped,
+    // from Head to End and then from the start of the ring to Tail.
+    //
+    SRWLOCK Lock;
+    std::vector<UCHAR> Ring;
+    SIZE_T Head;
+    SIZE_T Tail;
+    SIZE_T End;
+    bool Wrapped;
+    ULONGLONG Records;
+    ULONGLONG LastTimeStamp;
+
+    //
+    // Interned names by ID (the strings never move or change) and every
+    // module record so far, also under Lock.
+    //
+    std::vector<const char*> Names;
+    std::vector<UCHAR> ModuleRecords;
+
+    //
+    // Trigger state. ETW processing thread only.
+    //
+    ULONGLONG RateWindowStart;
+    ULONG RateCount;
+
+    //
+    // Dump thread.
+    //
+    HANDLE ThreadHandle;
+    HANDLE StopEvent;
+    HANDLE TriggerEvent;
+    HANDLE NamedTriggerEvent;
+    volatile LONG PendingTrigger;
+    std::wstring Stem;
+    ULONG NextSequence;
+
+    FLIGHT_RECORDER_STATISTICS Statistics;
+} FLIGHT_RECORDER, *PFLIGHT_RECORDER;
+
+//
+// Function definitions
+//
+void
+SetFlightRecorder (
+    _In_ ULONGLONG RingBytes,
+    _In_ ULONG WindowSeconds
+    );
+
+void
+SetFlightRecorderTriggers (
+    _In_ ULONG CallsPerSecond,
+    _In_ ULONG LatencyMicroseconds,
+    _In_opt_ const wchar_t* EventName
+    );
+
+void
+SetFlightRecorderQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    );
+
+bool
+StartFlightRecorder (
+    _In_ const wchar_t* OutputPath
+    );
+
+bool
+IsFlightRecorderEnabled ();
+
+void
+RecordFlightRecorderModule (
+    _In_ ULONG_PTR ImageBase,
+    _In_ ULONG ImageSize,
+    _In_ ULONG TimeDateStamp,
+    _In_ ULONG ImageChecksum,
+    _In_ ULONG ProcessId,
+    _In_ const wchar_t* ImagePath
+    );
+
+void
+RecordFlightRecorderEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    );
+
+void
+NoteFlightRecorderSecureCall (
+    _In_ ULONGLONG TimeStamp
+    );
+
+bool
+IsFlightRecorderTimingSecureCalls ();
+
+void
+NoteFlightRecorderSecureCallLatency (
+    _In_ ULONGLONG Latency
+    );
+
+void
+StopFlightRecorder ();
\ No newline at end of file
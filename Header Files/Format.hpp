@@ -0,0 +1,146 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Format.hpp
+*
+* @summary:   Output formatting definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <vector>
+
+//
+// Initial size of a format buffer, in bytes. Buffers only ever grow,
+// so a reused buffer stops allocating after the first few (long) rows.
+//
+#define FORMAT_BUFFER_INITIAL_SIZE (64 * 1024)
+
+//
+// What a formatted frame ends with: the CSV's frame separator, or
+// nothing, for a frame which is interned or printed on its own.
+//
+#define FORMAT_FRAME_SEPARATOR '|'
+#define FORMAT_NO_SEPARATOR '\0'
+
+//
+// A reusable (UTF-8) output buffer. Rows are formatted straight into it
+// and written out from it - nothing is allocated per frame or per row.
+//
+typedef struct _FORMAT_BUFFER
+{
+    std::vector<char> Data;
+    size_t Length;
+} FORMAT_BUFFER, *PFORMAT_BUFFER;
+
+//
+// Function definitions
+//
+void
+SetFormatDecimalAddresses (
+    _In_ bool DecimalAddresses
+    );
+
+void
+SetFormatWallClockTimes (
+    _In_ bool WallClockTimes
+    );
+
+bool
+IsFormatWallClockTimes ();
+
+void
+ResetFormatBuffer (
+    _Inout_ PFORMAT_BUFFER Buffer
+    );
+
+char*
+ReserveFormatBuffer (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ size_t Count
+    );
+
+void
+FormatAppend (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* String,
+    _In_ size_t Length
+    );
+
+void
+FormatAppendString (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* String
+    );
+
+void
+FormatAppendCsvField (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* String
+    );
+
+void
+FormatAppendChar (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ char Character
+    );
+
+void
+FormatAppendPrintf (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* Format,
+    ...
+    );
+
+void
+FormatAppendDecimal (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Value
+    );
+
+void
+FormatAppendTime (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Time
+    );
+
+void
+FormatAppendHex (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Value
+    );
+
+void
+FormatAppendAddress (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Value
+    );
+
+void
+FormatUnknownFrame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Address,
+    _In_ char Separator
+    );
+
+void
+FormatImageFrame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* ImageName,
+    _In_ uint64_t Offset,
+    _In_ char Separator
+    );
+
+void
+FormatSymbolFrame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* ImageName,
+    _In_ const char* SymbolName,
+    _In_ uint64_t Displacement,
+    _In_ char Separator
+    );
\ No newline at end of file
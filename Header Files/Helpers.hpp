@@ -13,18 +13,11 @@
 --*/
 #pragma once
 #include "Nodes.hpp"
+#include "Format.hpp"
 #include <Windows.h>
 #include <stdio.h>
-
-//
-// Output file handle
-//
-static HANDLE k_OutputFileHandle = NULL;
-
-//
-// One-time init to get our secure system call values.
-//
-static bool k_SecureCallNamesInitialized = false;
+#include <string>
+#include <vector>
 
 //
 // Gates writing to disk
@@ -318,7 +311,7 @@ EXTERN_C_END
 void
 ConstructCallStackStringAndPublishData (
     _In_ PVTL1_ENTER_NODE Vtl1Data,
-    _In_ ULONG_PTR* CallStack,
+    _In_ const ULONG_PTR* CallStack,
     _In_ ULONG NumberOfFrames
     );
 
@@ -327,11 +320,53 @@ CreateOutputFile (
     _In_ const wchar_t* FilePath
     );
 
+void
+FormatVtl1CsvFields (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ ULONGLONG TimeStamp,
+    _In_ const char* SecureCallName,
+    _In_ ULONG SecureCallNumber,
+    _In_ ULONG ProcessId,
+    _In_ const char* ProcessName,
+    _In_ ULONG ThreadId,
+    _In_ const char* ThreadName
+    );
+
+void
+FinishVtl1CsvLine (
+    _Inout_ PFORMAT_BUFFER Buffer
+    );
+
+void
+FormatVtl1Frame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ ULONG_PTR Address,
+    _In_ char Separator
+    );
+
 void
 WriteVtl1DataAndCallStackToFile (
-    _In_ PVTL1_ENTER_NODE Vtl1Data,
-    _In_ const wchar_t* CallStack
+    _In_ const FORMAT_BUFFER* Line,
+    _In_ ULONGLONG TimeStamp
     );
 
+bool
+WriteOutputBuffer (
+    _In_ const void* Buffer,
+    _In_ ULONG Length
+    );
+
+void
+CloseOutputFile ();
+
+bool
+RunWorkerThreads (
+    _In_ LPTHREAD_START_ROUTINE Routine,
+    _In_ const std::vector<PVOID>& Parameters
+    );
+
+void
+ApplySessionClock ();
+
 void
 CleanupVtl1MonResources ();
\ No newline at end of file
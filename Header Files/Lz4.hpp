@@ -0,0 +1,127 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Lz4.hpp
+*
+* @summary:   LZ4 block compression and LZ4 frame format definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <vector>
+
+//
+// LZ4 frame format (readable by the lz4 tool and every LZ4 library):
+//
+//   Magic, FLG, BD, header checksum
+//   (block size, block data, block checksum), repeated
+//   End mark (a zero block size)
+//
+// Blocks are independent and carry their own checksum, so every complete
+// block in a cut-short file can still be decoded and checked.
+//
+#define LZ4_FRAME_MAGIC 0x184D2204
+#define LZ4_FRAME_HEADER_SIZE 7
+#define LZ4_FRAME_FLG_VERSION 0x40
+#define LZ4_FRAME_FLG_BLOCK_INDEPENDENCE 0x20
+#define LZ4_FRAME_FLG_BLOCK_CHECKSUM 0x10
+#define LZ4_FRAME_FLG_CONTENT_SIZE 0x08
+#define LZ4_FRAME_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FRAME_FLG_DICTIONARY_ID 0x01
+#define LZ4_FRAME_BLOCK_UNCOMPRESSED 0x80000000
+#define LZ4_FRAME_END_MARK 0
+
+//
+// 1 MB blocks (BD block maximum size ID 6).
+//
+#define LZ4_FRAME_BLOCK_SIZE_ID 6
+#define LZ4_FRAME_BLOCK_SIZE (1024 * 1024)
+
+//
+// Block format limits.
+//
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_FIND_LIMIT 12
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_LOG 16
+
+//
+// Compressor state. Reused from block to block.
+//
+typedef struct _LZ4_STATE
+{
+    uint32_t HashTable[1 << LZ4_HASH_LOG];
+} LZ4_STATE, *PLZ4_STATE;
+
+//
+// Function definitions
+//
+uint32_t
+XxHash32 (
+    _In_ const void* Data,
+    _In_ size_t Length,
+    _In_ uint32_t Seed
+    );
+
+size_t
+Lz4CompressBound (
+    _In_ size_t Length
+    );
+
+size_t
+Lz4CompressBlock (
+    _Inout_ PLZ4_STATE State,
+    _In_ const uint8_t* Source,
+    _In_ size_t Length,
+    _Out_ uint8_t* Destination
+    );
+
+bool
+Lz4DecompressBlock (
+    _In_ const uint8_t* Source,
+    _In_ size_t Length,
+    _Inout_ std::vector<uint8_t>& Output
+    );
+
+size_t
+Lz4WriteFrameHeader (
+    _Out_ uint8_t* Destination
+    );
+
+size_t
+Lz4FrameBlockBound (
+    _In_ size_t Length
+    );
+
+size_t
+Lz4WriteFrameBlock (
+    _Inout_ PLZ4_STATE State,
+    _In_ const uint8_t* Source,
+    _In_ size_t Length,
+    _Out_ uint8_t* Destination
+    );
+
+size_t
+Lz4WriteFrameEnd (
+    _Out_ uint8_t* Destination
+    );
+
+bool
+IsLz4Frame (
+    _In_ const uint8_t* Data,
+    _In_ size_t Length
+    );
+
+bool
+Lz4DecompressFrame (
+    _In_ const uint8_t* Data,
+    _In_ size_t Length,
+    _Out_ std::vector<uint8_t>& Output,
+    _Out_ bool* Complete
+    );
\ No newline at end of file
@@ -14,14 +14,16 @@
 #pragma once
 #include <Windows.h>
 #include <unordered_map>
+#include <map>
 
 //
-// Image data structure
+// Image data structure. The name is kept in UTF-8 (the output encoding),
+// transcoded once when the image is inserted.
 //
 typedef struct _IMAGE_NODE
 {
     ULONG_PTR ImageBase;
-    wchar_t* ImageName;
+    char* ImageName;
     ULONG ImageSize;
 } IMAGE_NODE, * PIMAGE_NODE;
 
@@ -34,17 +36,59 @@ typedef struct _VTL1_ENTER_NODE
     ULONG ProcessId;
     ULONG ThreadId;
     unsigned __int16 SecureCallNumber;
+
+    //
+    // Interned names, resolved when the enter event arrives so
+    // that a later process exit (or PID reuse) does not matter.
+    //
+    ULONG ProcessNameId;
+    ULONG ThreadNameId;
 } VTL1_ENTER_NODE, *PVTL1_ENTER_NODE;
 
+//
+// A stack walk which arrived before its VTL 1 enter event.
+//
+typedef struct _PENDING_STACK_NODE
+{
+    ULONG_PTR* CallStack;
+    ULONG NumberOfFrames;
+} PENDING_STACK_NODE, *PPENDING_STACK_NODE;
+
+//
+// Reorder stage statistics
+//
+typedef struct _CORRELATION_STATISTICS
+{
+    ULONGLONG EntersSeen;
+    ULONGLONG StacksSeen;
+    ULONGLONG Correlated;
+    ULONGLONG CorrelatedStackFirst;
+    ULONGLONG EntersExpired;
+    ULONGLONG StacksExpired;
+} CORRELATION_STATISTICS, *PCORRELATION_STATISTICS;
+
+//
+// How long (in event time) an unmatched enter or stack is held
+// before it is given up on.
+//
+#define DEFAULT_CORRELATION_WATERMARK_MS 250
+
 //
 // Image map
 //
 static std::unordered_map<ULONG_PTR, IMAGE_NODE> k_ImageMap;
 
 //
-// Completed VTL 1 enter map
+// VTL 1 enter events waiting for their stack walk. Ordered by
+// timestamp so expired entries are always at the front.
 //
-static std::unordered_map<ULONGLONG, VTL1_ENTER_NODE> k_VtlEnterMap;
+static std::map<ULONGLONG, VTL1_ENTER_NODE> k_VtlEnterMap;
+
+//
+// Stack walks waiting for their VTL 1 enter event (delivered
+// out of order, e.g. across buffers). Also ordered by timestamp.
+//
+static std::map<ULONGLONG, PENDING_STACK_NODE> k_PendingStackMap;
 
 //
 // Function definitions
@@ -53,7 +97,7 @@ bool
 InsertImage (
     _In_ ULONG_PTR ImageBase,
     _In_ ULONG ImageSize,
-    _In_ wchar_t* ImageName
+    _In_ const wchar_t* ImageName
     );
 
 bool
@@ -73,6 +117,19 @@ InsertVtl1EnterEventData (
 void
 CorrelateVtl1EnterCallStack (
     _In_ ULONGLONG TimeStamp,
-    _In_ ULONG_PTR* CallStack,
+    _In_ const ULONG_PTR* CallStack,
     _In_ ULONG NumberOfFrames
-    );
\ No newline at end of file
+    );
+
+void
+SetCorrelationWatermark (
+    _In_ ULONG WatermarkMs
+    );
+
+void
+SetCorrelationQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    );
+
+void
+FlushAndReportCorrelation ();
\ No newline at end of file
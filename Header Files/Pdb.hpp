@@ -0,0 +1,87 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Pdb.hpp
+*
+* @summary:   Native PDB (MSF 7.0) public symbol reader definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <vector>
+#include <string>
+
+//
+// A public symbol, sorted by RVA.
+//
+typedef struct _PDB_SYMBOL
+{
+    uint32_t Rva;
+    uint32_t NameOffset;
+} PDB_SYMBOL, *PPDB_SYMBOL;
+
+//
+// A code section contribution (one compiland's chunk of a section).
+// Used to keep an address from resolving to a public in another chunk.
+//
+typedef struct _PDB_CONTRIBUTION
+{
+    uint32_t Rva;
+    uint32_t Size;
+} PDB_CONTRIBUTION, *PPDB_CONTRIBUTION;
+
+//
+// A module's public symbols. Immutable once loaded, so any number of
+// threads can search it without a lock.
+//
+typedef struct _PDB_SYMBOL_TABLE
+{
+    //
+    // From the PDB info stream - must match the image's CodeView record.
+    //
+    uint8_t Guid[16];
+    uint32_t Age;
+
+    std::vector<PDB_SYMBOL> Symbols;
+    std::vector<PDB_CONTRIBUTION> Contributions;
+
+    //
+    // NULL-terminated names, as stored in the PDB (decorated - see
+    // UndecoratePdbName).
+    //
+    std::vector<char> Names;
+} PDB_SYMBOL_TABLE, *PPDB_SYMBOL_TABLE;
+
+//
+// Function definitions
+//
+bool
+ParsePdb (
+    _In_ const uint8_t* Data,
+    _In_ size_t Length,
+    _Out_ PPDB_SYMBOL_TABLE Table
+    );
+
+bool
+LoadPdb (
+    _In_ const PATH_CHAR* PdbPath,
+    _Out_ PPDB_SYMBOL_TABLE Table
+    );
+
+const char*
+LookupPdbSymbol (
+    _In_ const PDB_SYMBOL_TABLE* Table,
+    _In_ uint32_t Rva,
+    _Out_ uint32_t* Displacement
+    );
+
+bool
+UndecoratePdbName (
+    _In_ const char* Name,
+    _Out_ std::string& Undecorated
+    );
\ No newline at end of file
@@ -0,0 +1,112 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/PeExports.hpp
+*
+* @summary:   Portable PE export table symbolizer definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include "SymbolBatch.hpp"
+#include <vector>
+#include <string>
+
+//
+// An exported function, sorted by RVA.
+//
+typedef struct _PE_EXPORT
+{
+    uint32_t Rva;
+    uint32_t NameOffset;
+} PE_EXPORT, *PPE_EXPORT;
+
+//
+// An executable section. Exports only resolve addresses inside the
+// section they live in.
+//
+typedef struct _PE_CODE_SECTION
+{
+    uint32_t VirtualAddress;
+    uint32_t VirtualSize;
+} PE_CODE_SECTION, *PPE_CODE_SECTION;
+
+//
+// A module's exports. Immutable once loaded, so any number of threads
+// can search it without a lock.
+//
+typedef struct _PE_EXPORT_TABLE
+{
+    uint32_t TimeDateStamp;
+    uint32_t CheckSum;
+    uint32_t SizeOfImage;
+    std::vector<PE_EXPORT> Exports;
+    std::vector<PE_CODE_SECTION> CodeSections;
+
+    //
+    // NULL-terminated ASCII names. Unnamed exports are "Ordinal<n>".
+    //
+    std::vector<char> Names;
+} PE_EXPORT_TABLE, *PPE_EXPORT_TABLE;
+
+//
+// A module's CodeView (RSDS) debug record - which PDB matches the image.
+//
+typedef struct _PE_CODEVIEW
+{
+    uint8_t Guid[16];
+    uint32_t Age;
+
+    //
+    // The PDB path the linker recorded (often just a file name).
+    //
+    std::string PdbPath;
+} PE_CODEVIEW, *PPE_CODEVIEW;
+
+//
+// Function definitions
+//
+bool
+ParsePeExports (
+    _In_ const uint8_t* Image,
+    _In_ size_t ImageLength,
+    _Out_ PPE_EXPORT_TABLE Table
+    );
+
+bool
+LoadPeExports (
+    _In_ const PATH_CHAR* ImagePath,
+    _Out_ PPE_EXPORT_TABLE Table
+    );
+
+const char*
+LookupPeExport (
+    _In_ const PE_EXPORT_TABLE* Table,
+    _In_ uint32_t Rva,
+    _Out_ uint32_t* Displacement
+    );
+
+void
+LookupPeExportBatch (
+    _In_ const PE_EXPORT_TABLE* Table,
+    _Inout_ PSYMBOL_BATCH_ENTRY Batch,
+    _In_ size_t Count
+    );
+
+bool
+ParsePeCodeView (
+    _In_ const uint8_t* Image,
+    _In_ size_t ImageLength,
+    _Out_ PPE_CODEVIEW CodeView
+    );
+
+bool
+LoadPeCodeView (
+    _In_ const PATH_CHAR* ImagePath,
+    _Out_ PPE_CODEVIEW CodeView
+    );
\ No newline at end of file
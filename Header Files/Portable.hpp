@@ -0,0 +1,152 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Portable.hpp
+*
+* @summary:   Minimal platform layer for the code which also builds on Linux
+*             (PE exports, PDB reader, offline symbolization, the shared
+*             memory export ring). Everything else in Vtl1Mon is Windows-only.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+
+//
+// Paths are whatever the platform's file APIs take.
+//
+typedef wchar_t PATH_CHAR;
+
+//
+// wprintf conversion for a narrow (UTF-8) string.
+//
+#define PRINTF_NARROW_STRING L"%hs"
+#else
+typedef char PATH_CHAR;
+
+#define PRINTF_NARROW_STRING L"%s"
+
+//
+// SAL is MSVC-only.
+//
+#ifndef _In_
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#endif
+#endif
+
+//
+// Longest shared mapping name, including the platform prefix.
+//
+#define SHARED_MAPPING_MAX_NAME 128
+
+//
+// A read-only view of a whole file.
+//
+typedef struct _MAPPED_FILE
+{
+    const uint8_t* Data;
+    size_t Length;
+#ifdef _WIN32
+    HANDLE MappingHandle;
+#endif
+} MAPPED_FILE, *PMAPPED_FILE;
+
+//
+// A named shared memory region (a pagefile-backed section on Windows, a
+// POSIX shared memory object elsewhere). The creator removes the name
+// when it closes; views already mapped stay valid.
+//
+typedef struct _SHARED_MAPPING
+{
+    uint8_t* Data;
+    size_t Length;
+    bool Owner;
+#ifdef _WIN32
+    HANDLE MappingHandle;
+#else
+    char Name[SHARED_MAPPING_MAX_NAME];
+#endif
+} SHARED_MAPPING, *PSHARED_MAPPING;
+
+//
+// Little-endian field readers for on-disk formats (PE, PDB). These do not
+// care about alignment; bounds are the caller's job.
+//
+inline
+uint16_t
+ReadLe16 (
+    _In_ const uint8_t* Data
+    )
+{
+    return static_cast<uint16_t>(Data[0] | (Data[1] << 8));
+}
+
+inline
+uint32_t
+ReadLe32 (
+    _In_ const uint8_t* Data
+    )
+{
+    return (static_cast<uint32_t>(Data[0]) |
+            (static_cast<uint32_t>(Data[1]) << 8) |
+            (static_cast<uint32_t>(Data[2]) << 16) |
+            (static_cast<uint32_t>(Data[3]) << 24));
+}
+
+//
+// Function definitions
+//
+bool
+MapFileReadOnly (
+    _In_ const PATH_CHAR* FilePath,
+    _Out_ PMAPPED_FILE MappedFile
+    );
+
+void
+UnmapMappedFile (
+    _Inout_ PMAPPED_FILE MappedFile
+    );
+
+bool
+CreateSharedMapping (
+    _In_ const PATH_CHAR* Name,
+    _In_ size_t Length,
+    _Out_ PSHARED_MAPPING Mapping
+    );
+
+bool
+OpenSharedMapping (
+    _In_ const PATH_CHAR* Name,
+    _Out_ PSHARED_MAPPING Mapping
+    );
+
+void
+CloseSharedMapping (
+    _Inout_ PSHARED_MAPPING Mapping
+    );
+
+uint64_t
+GetMonotonicNanoseconds ();
+
+void
+SleepMilliseconds (
+    _In_ uint32_t Milliseconds
+    );
+
+bool
+IsProcessRunning (
+    _In_ uint32_t ProcessId
+    );
\ No newline at end of file
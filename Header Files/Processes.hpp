@@ -0,0 +1,114 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Processes.hpp
+*
+* @summary:   Process and thread name cache definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include <Windows.h>
+
+//
+// Interned name ID used when a process or thread name is not known.
+// Index 0 of the name table is always "Unknown".
+//
+#define UNKNOWN_NAME_ID 0
+
+//
+// Names interned at most. Name IDs are stored in records, top-K entries
+// and output name tables, so names are never released; past this, new
+// names (usually per-thread descriptions) resolve to "Unknown".
+//
+#define NAME_TABLE_MAX_NAMES 65536
+
+//
+// Process cache entry. Keyed by process ID, removed on process exit
+// so that a reused process ID never resolves to a stale image name.
+//
+typedef struct _PROCESS_NODE
+{
+    //
+    // Raw (QPC) timestamp of the process start event. 0 for
+    // processes which were already running when the trace started
+    // (we only learn about those from the rundown). Events older
+    // than this belong to an earlier process with the same ID.
+    //
+    ULONGLONG StartTime;
+    ULONG ImageNameId;
+} PROCESS_NODE, *PPROCESS_NODE;
+
+//
+// Thread cache entry. Keyed by thread ID.
+//
+typedef struct _THREAD_NODE
+{
+    ULONG ProcessId;
+    ULONG ThreadNameId;
+} THREAD_NODE, *PTHREAD_NODE;
+
+//
+// Function definitions
+//
+ULONG
+InternName (
+    _In_ const wchar_t* Name,
+    _In_ SIZE_T NameLength
+    );
+
+const char*
+GetInternedName (
+    _In_ ULONG NameId
+    );
+
+void
+InsertProcess (
+    _In_ ULONG ProcessId,
+    _In_ ULONGLONG StartTime,
+    _In_ const char* ImageName,
+    _In_ SIZE_T ImageNameLength
+    );
+
+void
+RemoveProcess (
+    _In_ ULONG ProcessId,
+    _In_ ULONGLONG EndTime
+    );
+
+void
+InsertThread (
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId
+    );
+
+void
+RemoveThread (
+    _In_ ULONG ThreadId
+    );
+
+void
+SetThreadName (
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId,
+    _In_ const wchar_t* ThreadName,
+    _In_ SIZE_T ThreadNameLength
+    );
+
+ULONG
+GetProcessNameId (
+    _In_ ULONG ProcessId,
+    _In_ ULONGLONG TimeStamp
+    );
+
+ULONG
+GetThreadNameId (
+    _In_ ULONG ThreadId
+    );
+
+void
+DestroyProcessCache ();
\ No newline at end of file
@@ -0,0 +1,174 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/RawCapture.hpp
+*
+* @summary:   Raw (unsymbolized) capture file definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+
+//
+// 'VRAW'. Version 2 writes names as UTF-8 (version 1 wrote UTF-16).
+//
+#define RAW_CAPTURE_MAGIC 0x57415256
+#define RAW_CAPTURE_VERSION 2
+#define RAW_CAPTURE_VERSION_UTF16_NAMES 1
+
+//
+// Events are buffered and written in chunks of this size.
+//
+#define RAW_CAPTURE_BUFFER_SIZE (1024 * 1024)
+
+//
+// Name IDs are interned (dense). Anything larger is a corrupt capture.
+//
+#define RAW_CAPTURE_MAX_NAME_ID 0x100000
+
+//
+// Every record starts on an 8-byte boundary.
+//
+#define RAW_RECORD_ALIGNMENT 8
+
+//
+// File layout:
+//
+//   RAW_CAPTURE_HEADER
+//   RAW_RECORD_HEADER + payload, repeated until the end of the file
+//
+// Names and modules are always written before the first event which
+// refers to them. The clock record, if the session clock is known, is
+// written before the first event.
+//
+typedef struct _RAW_CAPTURE_HEADER
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t QpcFrequency;
+} RAW_CAPTURE_HEADER, *PRAW_CAPTURE_HEADER;
+
+typedef enum _RAW_RECORD_TYPE
+{
+    RawRecordModule = 1,
+    RawRecordName,
+    RawRecordSecureCallName,
+    RawRecordEvent,
+    RawRecordClock
+} RAW_RECORD_TYPE;
+
+//
+// Size includes the header and any padding.
+//
+typedef struct _RAW_RECORD_HEADER
+{
+    uint16_t Type;
+    uint16_t Reserved;
+    uint32_t Size;
+} RAW_RECORD_HEADER, *PRAW_RECORD_HEADER;
+
+//
+// An image load. Followed by the NULL-terminated UTF-16 NT path.
+//
+typedef struct _RAW_MODULE_RECORD
+{
+    uint64_t ImageBase;
+    uint32_t ImageSize;
+    uint32_t TimeDateStamp;
+    uint32_t ImageChecksum;
+    uint32_t ProcessId;
+} RAW_MODULE_RECORD, *PRAW_MODULE_RECORD;
+
+//
+// A process or thread name (RawRecordName), or an nt!_SKSERVICE name
+// (RawRecordSecureCallName). Followed by the NULL-terminated UTF-8 name.
+//
+typedef struct _RAW_NAME_RECORD
+{
+    uint32_t Id;
+    uint32_t Reserved;
+} RAW_NAME_RECORD, *PRAW_NAME_RECORD;
+
+//
+// The session clock: event timestamps are QPC ticks at QpcFrequency, and
+// AnchorTimeStamp was read at AnchorTime (a UTC FILETIME), give or take
+// Uncertainty ticks. Readers which predate it skip it.
+//
+typedef struct _RAW_CLOCK_RECORD
+{
+    uint64_t QpcFrequency;
+    uint64_t AnchorTimeStamp;
+    uint64_t AnchorTime;
+    uint64_t Uncertainty;
+} RAW_CLOCK_RECORD, *PRAW_CLOCK_RECORD;
+
+//
+// A correlated VTL 1 enter. Followed by NumberOfFrames frame addresses.
+//
+typedef struct _RAW_EVENT_RECORD
+{
+    uint64_t TimeStamp;
+    uint32_t ProcessId;
+    uint32_t ThreadId;
+    uint32_t ProcessNameId;
+    uint32_t ThreadNameId;
+    uint16_t SecureCallNumber;
+    uint16_t NumberOfFrames;
+    uint32_t Reserved;
+} RAW_EVENT_RECORD, *PRAW_EVENT_RECORD;
+
+#ifdef _WIN32
+#include "Nodes.hpp"
+
+//
+// Raw capture writer statistics
+//
+typedef struct _RAW_CAPTURE_STATISTICS
+{
+    ULONGLONG EventsWritten;
+    ULONGLONG FramesWritten;
+    ULONGLONG ModulesWritten;
+    ULONGLONG NamesWritten;
+    ULONGLONG BytesWritten;
+    ULONGLONG WriteFailures;
+} RAW_CAPTURE_STATISTICS, *PRAW_CAPTURE_STATISTICS;
+
+//
+// Function definitions
+//
+bool
+CreateRawCaptureFile (
+    _In_ const wchar_t* FilePath
+    );
+
+void
+StartRawCapture ();
+
+bool
+IsRawCaptureEnabled ();
+
+void
+WriteRawCaptureModule (
+    _In_ ULONG_PTR ImageBase,
+    _In_ ULONG ImageSize,
+    _In_ ULONG TimeDateStamp,
+    _In_ ULONG ImageChecksum,
+    _In_ ULONG ProcessId,
+    _In_ const wchar_t* ImagePath
+    );
+
+void
+WriteRawCaptureEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    );
+
+void
+CloseRawCaptureFile ();
+#endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Replay.hpp
+*
+* @summary:   Offline trace (ETL) replay definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Trace.hpp"
+
+//
+// Number of passes the dispatch benchmark makes over the replayed events.
+//
+#define REPLAY_DISPATCH_BENCHMARK_PASSES 16
+
+//
+// Events the dispatch benchmark keeps, sampled uniformly (reservoir
+// sampling) from the whole trace, so a long trace costs no more memory.
+//
+#define REPLAY_DISPATCH_SAMPLE_EVENTS 65536
+
+//
+// Number of rows (and frames per row) the format benchmark writes.
+//
+#define REPLAY_FORMAT_BENCHMARK_ROWS 100000
+#define REPLAY_FORMAT_BENCHMARK_FRAMES 32
+
+//
+// The part of each replayed event the dispatch benchmark needs.
+//
+typedef struct _REPLAY_EVENT_KEY
+{
+    GUID ProviderId;
+    UCHAR Opcode;
+} REPLAY_EVENT_KEY, *PREPLAY_EVENT_KEY;
+
+//
+// Function definitions
+//
+bool
+ReplayTraceFile (
+    _In_ const wchar_t* TraceFilePath
+    );
\ No newline at end of file
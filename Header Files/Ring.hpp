@@ -0,0 +1,276 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Ring.hpp
+*
+* @summary:   Shared memory export ring definitions (layout and producer).
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include "Clock.hpp"
+#include <atomic>
+#include <vector>
+
+//
+// 'VRNG'. Consumers check all of the header's sizes, not just the version.
+//
+#define RING_MAGIC 0x474E5256
+#define RING_VERSION 2
+
+//
+// Frames kept per record. Deeper stacks keep their innermost frames and
+// record how many there were.
+//
+#define RING_MAX_FRAMES 32
+
+//
+// Records in the ring (a power of two), and the string table's size.
+//
+#define RING_DEFAULT_RECORDS 32768
+#define RING_MIN_RECORDS 1024
+#define RING_MAX_RECORDS (16 * 1024 * 1024)
+#define RING_DEFAULT_STRINGS_SIZE (8 * 1024 * 1024)
+
+//
+// Frame names the live export remembers (a power of two). Each (process,
+// address) can use one of a pair of slots; a miss takes over the one used
+// least recently.
+//
+#define RING_FRAME_CACHE_SLOTS 65536
+
+//
+// Addresses below this are user mode, and name different code in
+// different processes.
+//
+#define RING_USER_ADDRESS_LIMIT 0x0000800000000000ULL
+
+//
+// How long a tail waits for its ring to be created by default.
+//
+#define RING_TAIL_DEFAULT_WAIT_SECONDS 10
+
+//
+// The header has a page to itself, so the records start page aligned.
+//
+#define RING_HEADER_REGION_SIZE 4096
+
+//
+// Region layout:
+//
+//   RING_HEADER            (RING_HEADER_REGION_SIZE bytes)
+//   RING_RECORD            x RecordCount, at RecordsOffset
+//   String table           StringsSize bytes, at StringsOffset
+//
+// There is one producer and any number of read-only consumers, which
+// never write to the region and never wait on the producer.
+//
+// The producer publishes record N in slot (N & (RecordCount - 1)): it
+// zeroes the slot's Sequence, fills it in, sets Sequence to N + 1 and then
+// WriteSequence to N + 1 (both release). A consumer reads Sequence
+// (acquire), copies the record, and reads Sequence again after an acquire
+// fence. If either read is not N + 1, the producer lapped it and record N
+// is lost.
+//
+// The string table holds NULL-terminated UTF-8 strings, referred to by
+// their offset in the table. Offset 0 is the empty string (unknown).
+// The table is two halves, filled in turn: string generation G appends to
+// half (G & 1), and every record names the generation its strings are in.
+// When the half fills, the producer sets StringGeneration to G + 1 and
+// starts over in the other half, overwriting generation G - 1. A record's
+// strings are therefore intact while StringGeneration is at most its
+// generation + 1; a consumer checks that again after using them (see
+// IsRingRecordStringsValid). The last byte of each half is never written,
+// so even a string being overwritten stays terminated.
+//
+typedef struct _RING_HEADER
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t HeaderSize;
+    uint32_t RecordSize;
+    uint32_t MaxFrames;
+    uint32_t ProducerId;
+    uint64_t RecordCount;
+    uint64_t RecordsOffset;
+    uint64_t StringsOffset;
+    uint64_t StringsSize;
+    uint64_t Reserved;
+
+    //
+    // The session clock (see Clock.hpp), set before the first record is
+    // published if the producer has one. QpcFrequency is 0 if not.
+    //
+    uint64_t QpcFrequency;
+    uint64_t AnchorTimeStamp;
+    uint64_t AnchorTime;
+    uint64_t Uncertainty;
+    uint8_t Padding0[32];
+
+    //
+    // Producer-written counters, each on its own cache line.
+    //
+    std::atomic<uint64_t> WriteSequence;
+    uint8_t Padding1[56];
+    std::atomic<uint64_t> StringsUsed;
+    std::atomic<uint32_t> Closed;
+    std::atomic<uint32_t> StringGeneration;
+} RING_HEADER, *PRING_HEADER;
+
+//
+// A correlated VTL 1 enter. Names are string table offsets. Frames are
+// innermost first; FrameNames are their symbolized names (0 if the
+// producer had none, e.g. replaying a raw capture).
+//
+typedef struct alignas(64) _RING_RECORD
+{
+    std::atomic<uint64_t> Sequence;
+    uint64_t TimeStamp;
+    uint32_t ProcessId;
+    uint32_t ThreadId;
+    uint32_t ProcessName;
+    uint32_t ThreadName;
+    uint32_t SecureCallName;
+    uint16_t SecureCallNumber;
+    uint16_t NumberOfFrames;
+    uint16_t TotalFrames;
+    uint16_t Reserved;
+    uint32_t StringGeneration;
+    uint64_t Frames[RING_MAX_FRAMES];
+    uint32_t FrameNames[RING_MAX_FRAMES];
+} RING_RECORD, *PRING_RECORD;
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "Shared counters must be plain 64-bit words.");
+static_assert(sizeof(RING_HEADER) <= RING_HEADER_REGION_SIZE, "The ring header outgrew its page.");
+static_assert(sizeof(RING_RECORD) == 448, "The ring record layout changed.");
+
+//
+// The producer's side of a ring, and its statistics.
+//
+typedef struct _RING_PRODUCER
+{
+    SHARED_MAPPING Mapping;
+    PRING_HEADER Header;
+    uint8_t* Records;
+    char* Strings;
+    uint64_t Mask;
+    uint64_t Sequence;
+    uint64_t HalfSize;
+    uint64_t StringsUsed;
+    uint32_t StringGeneration;
+    bool StringsFull;
+    uint64_t StringBytes;
+    uint64_t StringsDropped;
+    uint64_t StringGenerations;
+    uint64_t TruncatedStacks;
+} RING_PRODUCER, *PRING_PRODUCER;
+
+//
+// A string the producer has added, and the generation it was added in.
+// Only good for records of the same generation.
+//
+typedef struct _RING_STRING_REF
+{
+    uint32_t Offset;
+    uint32_t Generation;
+} RING_STRING_REF, *PRING_STRING_REF;
+
+//
+// Function definitions
+//
+bool
+CreateRingProducer (
+    _Out_ PRING_PRODUCER Producer,
+    _In_ const PATH_CHAR* Name,
+    _In_ uint32_t RecordCount,
+    _In_ uint32_t StringsSize
+    );
+
+void
+SetRingClock (
+    _Inout_ PRING_PRODUCER Producer,
+    _In_ const SESSION_CLOCK* Clock
+    );
+
+uint32_t
+AddRingString (
+    _Inout_ PRING_PRODUCER Producer,
+    _In_ const char* String,
+    _In_ size_t Length
+    );
+
+uint32_t
+GetRingStringRef (
+    _Inout_ PRING_PRODUCER Producer,
+    _Inout_ PRING_STRING_REF Ref,
+    _In_ const char* String,
+    _In_ size_t Length
+    );
+
+void
+StartRingStringGeneration (
+    _Inout_ PRING_PRODUCER Producer
+    );
+
+PRING_RECORD
+BeginRingRecord (
+    _Inout_ PRING_PRODUCER Producer
+    );
+
+void
+CommitRingRecord (
+    _Inout_ PRING_PRODUCER Producer,
+    _Inout_ PRING_RECORD Record
+    );
+
+void
+CloseRingProducer (
+    _Inout_ PRING_PRODUCER Producer
+    );
+
+bool
+ReplayRawCaptureToRing (
+    _In_ const PATH_CHAR* CapturePath,
+    _In_ const PATH_CHAR* Name,
+    _In_ uint32_t RecordCount,
+    _In_ uint32_t Loops,
+    _In_ bool Paced
+    );
+
+bool
+TailRing (
+    _In_ const PATH_CHAR* Name,
+    _In_ bool Print,
+    _In_ uint32_t WaitSeconds
+    );
+
+#ifdef _WIN32
+#include "Nodes.hpp"
+
+//
+// Function definitions
+//
+bool
+SetExportRing (
+    _In_ const wchar_t* Name,
+    _In_ ULONG RecordCount
+    );
+
+bool
+IsExportRingEnabled ();
+
+void
+PublishExportRingEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    );
+
+void
+StopExportRing ();
+#endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/RingClient.hpp
+*
+* @summary:   Shared memory export ring client library definitions. Builds on
+*             Windows and Linux with Portable.cpp and RingClient.cpp.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Ring.hpp"
+
+typedef enum _RING_READ_STATUS
+{
+    RingReadEmpty = 0,
+    RingReadRecord,
+    RingReadClosed
+} RING_READ_STATUS;
+
+//
+// A consumer's read-only view of a ring and its position in it. Readers
+// share nothing, so any number of them can follow the same ring.
+//
+typedef struct _RING_READER
+{
+    SHARED_MAPPING Mapping;
+    const RING_HEADER* Header;
+    const uint8_t* Records;
+    const char* Strings;
+    uint64_t StringsSize;
+    uint64_t Mask;
+    uint64_t Next;
+    uint64_t Read;
+    uint64_t Lost;
+} RING_READER, *PRING_READER;
+
+//
+// Function definitions
+//
+bool
+OpenRingReader (
+    _Out_ PRING_READER Reader,
+    _In_ const PATH_CHAR* Name
+    );
+
+void
+SeekRingReaderToOldest (
+    _Inout_ PRING_READER Reader
+    );
+
+RING_READ_STATUS
+ReadRingRecord (
+    _Inout_ PRING_READER Reader,
+    _Out_ PRING_RECORD Record
+    );
+
+const char*
+GetRingString (
+    _In_ const RING_READER* Reader,
+    _In_ const RING_RECORD* Record,
+    _In_ uint32_t Offset
+    );
+
+bool
+IsRingRecordStringsValid (
+    _In_ const RING_READER* Reader,
+    _In_ const RING_RECORD* Record
+    );
+
+bool
+GetRingClock (
+    _In_ const RING_READER* Reader,
+    _Out_ PSESSION_CLOCK Clock
+    );
+
+void
+CloseRingReader (
+    _Inout_ PRING_READER Reader
+    );
\ No newline at end of file
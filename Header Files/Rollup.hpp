@@ -0,0 +1,162 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Rollup.hpp
+*
+* @summary:   Time-series rollup (1s/10s/60s) definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Aggregate.hpp"
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+//
+// 'VTSR'
+//
+#define ROLLUP_MAGIC 0x52535456
+#define ROLLUP_VERSION 1
+
+//
+// Bucket widths, in seconds. Each is a multiple of the one before, and
+// buckets are aligned to the wall clock (a 60 second bucket is a minute).
+//
+#define ROLLUP_RESOLUTIONS 3
+
+static const ULONG k_RollupResolutions[ROLLUP_RESOLUTIONS] = { 1, 10, 60 };
+
+//
+// The Prometheus textfile is rewritten when a bucket of this resolution
+// (10 seconds) closes, empty or not. Its quantiles are that bucket's.
+//
+#define ROLLUP_PROMETHEUS_RESOLUTION 1
+
+//
+// How often the timer closes buckets secure calls stopped arriving for,
+// and how long after a bucket ends it waits for late events first.
+//
+#define ROLLUP_TIMER_MS 1000
+#define ROLLUP_TIMER_LAG_SECONDS 2
+
+//
+// Series (secure call, or process and secure call) per bucket. Anything
+// past this is counted against the secure call's "other" process series,
+// so per secure call totals stay exact.
+//
+#define ROLLUP_MAX_SERIES 2048
+
+//
+// Process name IDs for series which are not per process.
+//
+#define ROLLUP_ALL_PROCESSES 0xFFFFFFFF
+#define ROLLUP_OTHER_PROCESSES 0xFFFFFFFE
+
+//
+// File layout:
+//
+//   ROLLUP_FILE_HEADER
+//   Any number of (ROLLUP_RECORD_HEADER + payload):
+//     RollupRecordProcessName     uint32_t process name ID + UTF-8 name
+//     RollupRecordSecureCallName  uint32_t secure call number + UTF-8 name
+//     RollupRecordBucket          ROLLUP_BUCKET_RECORD + RowCount x ROLLUP_ROW_RECORD
+//
+// A name record comes before the first row which uses it. Buckets of every
+// resolution are interleaved, each written when it closes; seconds with no
+// secure calls have no bucket. Latencies are in nanoseconds.
+//
+typedef struct _ROLLUP_FILE_HEADER
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t Resolutions[ROLLUP_RESOLUTIONS];
+    uint32_t PerProcess;
+} ROLLUP_FILE_HEADER, *PROLLUP_FILE_HEADER;
+
+typedef enum _ROLLUP_RECORD_TYPE
+{
+    RollupRecordProcessName = 1,
+    RollupRecordSecureCallName = 2,
+    RollupRecordBucket = 3
+} ROLLUP_RECORD_TYPE;
+
+typedef struct _ROLLUP_RECORD_HEADER
+{
+    uint32_t Type;
+    uint32_t Length;
+} ROLLUP_RECORD_HEADER, *PROLLUP_RECORD_HEADER;
+
+//
+// StartTime is a FILETIME (UTC).
+//
+typedef struct _ROLLUP_BUCKET_RECORD
+{
+    uint64_t StartTime;
+    uint32_t Seconds;
+    uint32_t RowCount;
+} ROLLUP_BUCKET_RECORD, *PROLLUP_BUCKET_RECORD;
+
+typedef struct _ROLLUP_ROW_RECORD
+{
+    uint32_t SecureCallNumber;
+    uint32_t ProcessNameId;
+    uint64_t Count;
+    uint64_t Latencies;
+    uint64_t LatencySum;
+    uint64_t LatencyMax;
+    uint64_t LatencyP50;
+    uint64_t LatencyP99;
+} ROLLUP_ROW_RECORD, *PROLLUP_ROW_RECORD;
+
+//
+// One resolution's open bucket. Cells are keyed by process name ID (high
+// half) and secure call number (low half), and keep the process name ID
+// in NameId.
+//
+typedef struct _ROLLUP_SERIES
+{
+    ULONGLONG Index;
+    std::unordered_map<uint64_t, AGGREGATE_SECURE_CALL> Cells;
+    ULONGLONG Buckets;
+    ULONGLONG Rows;
+} ROLLUP_SERIES, *PROLLUP_SERIES;
+
+//
+// Function definitions
+//
+bool
+SetRollups (
+    _In_opt_ const wchar_t* FilePath,
+    _In_opt_ const wchar_t* PrometheusPath,
+    _In_ bool PerProcess
+    );
+
+void
+StartRollupTimer ();
+
+bool
+IsRollupEnabled ();
+
+void
+RecordRollupSecureCall (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG ProcessId,
+    _In_ ULONG SecureCallNumber
+    );
+
+void
+RecordRollupLatency (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG ProcessId,
+    _In_ ULONG SecureCallNumber,
+    _In_ ULONGLONG Latency
+    );
+
+void
+StopRollups ();
\ No newline at end of file
@@ -0,0 +1,202 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/SegmentedOutput.hpp
+*
+* @summary:   Output file (plain, compressed and/or rotated) definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "CompressedOutput.hpp"
+#include <Windows.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+
+//
+// A segment is written as "<final name>.partial" and renamed to its final
+// name once it is complete, so anything without the suffix is finished.
+//
+#define SEGMENT_PARTIAL_SUFFIX L".partial"
+
+//
+// Segments are "<stem>.<sequence>.<extension>", next to the index
+// "<stem>.index.csv".
+//
+#define SEGMENT_SEQUENCE_FORMAT L".%06lu"
+#define SEGMENT_INDEX_SUFFIX L".index.csv"
+
+//
+// How often the closer thread checks for a segment past its time limit
+// while no records are being written, in milliseconds.
+//
+#define SEGMENT_IDLE_CHECK_INTERVAL_MS 1000
+
+//
+// One output file. Without rotation there is only ever one, written
+// in place.
+//
+typedef struct _OUTPUT_SEGMENT
+{
+    HANDLE FileHandle;
+    std::unique_ptr<COMPRESSED_OUTPUT> Compressed;
+    std::wstring PartialPath;
+    std::wstring FinalPath;
+    ULONG Sequence;
+
+    //
+    // Uncompressed bytes, correlated events and their (QPC) time range.
+    //
+    ULONGLONG Bytes;
+    ULONGLONG Events;
+    ULONGLONG FirstTimeStamp;
+    ULONGLONG LastTimeStamp;
+
+    ULONGLONG OpenTickCount;
+    FILETIME OpenTime;
+    FILETIME CloseTime;
+} OUTPUT_SEGMENT, *POUTPUT_SEGMENT;
+
+//
+// A finished segment, as listed in the index.
+//
+typedef struct _OUTPUT_SEGMENT_INDEX_ENTRY
+{
+    std::wstring FileName;
+    ULONGLONG Bytes;
+    ULONGLONG Events;
+    ULONGLONG FirstTimeStamp;
+    ULONGLONG LastTimeStamp;
+    FILETIME OpenTime;
+    FILETIME CloseTime;
+} OUTPUT_SEGMENT_INDEX_ENTRY, *POUTPUT_SEGMENT_INDEX_ENTRY;
+
+//
+// Rotation statistics. RotateTicks, OpenFailures and IdleRotations belong
+// to the writer, the rest to the closer thread.
+//
+typedef struct _SEGMENTED_OUTPUT_STATISTICS
+{
+    ULONGLONG Segments;
+    ULONGLONG RotateTicks;
+    ULONGLONG OpenFailures;
+    ULONGLONG IdleRotations;
+    ULONGLONG RenameFailures;
+    ULONGLONG IndexFailures;
+    COMPRESSED_OUTPUT_STATISTICS Compression;
+} SEGMENTED_OUTPUT_STATISTICS, *PSEGMENTED_OUTPUT_STATISTICS;
+
+//
+// Rotates an output on behalf of its owner: flushes anything the owner
+// buffers, calls RotateSegmentedOutput and starts the new segment (headings
+// and the like). Called with the output acquired.
+//
+typedef void (*PSEGMENT_ROTATE_ROUTINE) (
+    _Inout_ struct _SEGMENTED_OUTPUT* Output
+    );
+
+//
+// An output file. One thread writes. When rotating, finished segments are
+// handed to a closer thread which drains their compressor, closes and
+// renames them and rewrites the index - the writer only opens the next.
+// The closer thread also rotates a segment which has gone past its time
+// limit with nothing written, so the writer holds the output (see
+// AcquireSegmentedOutput) for each record.
+//
+typedef struct _SEGMENTED_OUTPUT
+{
+    std::wstring Path;
+    std::wstring Stem;
+    std::wstring Extension;
+    bool Rotating;
+    ULONG NextSequence;
+    std::unique_ptr<OUTPUT_SEGMENT> Segment;
+    PSEGMENT_ROTATE_ROUTINE RotateRoutine;
+
+    //
+    // Segment closer (rotation only). WriterLock guards Segment, Lock the
+    // queue - taken in that order.
+    //
+    HANDLE CloserThreadHandle;
+    SRWLOCK WriterLock;
+    SRWLOCK Lock;
+    CONDITION_VARIABLE SegmentQueued;
+    std::deque<std::unique_ptr<OUTPUT_SEGMENT>> ClosingSegments;
+    bool Stopping;
+
+    //
+    // Closer thread only (the writer's, once the closer has stopped).
+    //
+    std::vector<OUTPUT_SEGMENT_INDEX_ENTRY> Index;
+
+    SEGMENTED_OUTPUT_STATISTICS Statistics;
+} SEGMENTED_OUTPUT, *PSEGMENTED_OUTPUT;
+
+//
+// Function definitions
+//
+void
+SetOutputRotation (
+    _In_ ULONGLONG MaximumSegmentBytes,
+    _In_ ULONG MaximumSegmentSeconds
+    );
+
+bool
+IsOutputRotationEnabled ();
+
+bool
+OpenSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _In_ const wchar_t* FilePath,
+    _In_ PSEGMENT_ROTATE_ROUTINE RotateRoutine
+    );
+
+bool
+IsSegmentedOutputOpen (
+    _In_ const SEGMENTED_OUTPUT* Output
+    );
+
+void
+AcquireSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    );
+
+void
+ReleaseSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    );
+
+bool
+WriteSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _In_ const void* Data,
+    _In_ SIZE_T Length
+    );
+
+void
+NoteSegmentedOutputEvent (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _In_ ULONGLONG TimeStamp
+    );
+
+bool
+IsSegmentRotationDue (
+    _In_ const SEGMENTED_OUTPUT* Output,
+    _In_ SIZE_T PendingBytes
+    );
+
+bool
+RotateSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    );
+
+void
+CloseSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    );
\ No newline at end of file
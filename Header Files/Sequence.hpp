@@ -0,0 +1,137 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Sequence.hpp
+*
+* @summary:   Per thread secure call sequence (n-gram) mining definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "TopK.hpp"
+
+//
+// Sequences of 2, 3 and 4 secure calls. Secure call numbers are 16 bits,
+// so a sequence packs into a 64-bit key, first call in the high bits.
+//
+#define SEQUENCE_MIN_LENGTH 2
+#define SEQUENCE_MAX_LENGTH 4
+#define SEQUENCE_LENGTHS ((SEQUENCE_MAX_LENGTH - SEQUENCE_MIN_LENGTH) + 1)
+
+//
+// A thread's calls only form a sequence if each follows the one before
+// within this long.
+//
+#define SEQUENCE_DEFAULT_GAP_MS 10
+
+//
+// Threads with a history at once (a power of two). Each thread can use
+// one of a pair of slots; a thread finding both taken takes over the one
+// used least recently, and that thread's history is lost.
+//
+#define SEQUENCE_THREAD_SLOTS 4096
+
+//
+// A thread's last few secure calls (oldest first). The sequences its last
+// call completed which still need an example stack wait in Pending until
+// that call's stack is correlated.
+//
+typedef struct _SEQUENCE_THREAD
+{
+    uint32_t ThreadId;
+    uint16_t Length;
+    uint16_t Calls[SEQUENCE_MAX_LENGTH - 1];
+    uint64_t LastTimeStamp;
+    uint64_t PendingTimeStamp;
+    uint64_t PendingKeys[SEQUENCE_LENGTHS];
+    PTOP_K_ENTRY PendingEntries[SEQUENCE_LENGTHS];
+} SEQUENCE_THREAD, *PSEQUENCE_THREAD;
+
+//
+// A Space-Saving tracker per sequence length, and the thread histories.
+// All of the memory is allocated up front.
+//
+typedef struct _SEQUENCE_MINER
+{
+    std::vector<SEQUENCE_THREAD> Threads;
+    TOP_K_TRACKER Trackers[SEQUENCE_LENGTHS];
+    uint64_t GapTicks;
+    uint64_t Calls;
+    uint64_t Gaps;
+    uint64_t Evictions;
+} SEQUENCE_MINER, *PSEQUENCE_MINER;
+
+//
+// Function definitions
+//
+void
+InitializeSequenceMiner (
+    _Inout_ PSEQUENCE_MINER Miner,
+    _In_ uint32_t Capacity,
+    _In_ uint64_t GapTicks
+    );
+
+void
+CountSequenceCall (
+    _Inout_ PSEQUENCE_MINER Miner,
+    _In_ uint32_t ThreadId,
+    _In_ uint64_t TimeStamp,
+    _In_ uint16_t SecureCallNumber
+    );
+
+uint32_t
+TakeSequencePending (
+    _Inout_ PSEQUENCE_MINER Miner,
+    _In_ uint32_t ThreadId,
+    _In_ uint64_t TimeStamp,
+    _Out_ PTOP_K_ENTRY* Entries
+    );
+
+uint16_t
+GetSequenceCall (
+    _In_ uint64_t Key,
+    _In_ uint32_t Length,
+    _In_ uint32_t Index
+    );
+
+#ifdef _WIN32
+#include "Nodes.hpp"
+
+//
+// Function definitions
+//
+void
+SetSequenceMining (
+    _In_ uint32_t Capacity,
+    _In_ ULONG GapMs
+    );
+
+void
+SetSequenceQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    );
+
+bool
+IsSequenceMiningEnabled ();
+
+void
+RecordSequenceSecureCall (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG ThreadId,
+    _In_ ULONG SecureCallNumber
+    );
+
+void
+TrackSequenceEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    );
+
+void
+StopSequenceMining ();
+#endif
\ No newline at end of file
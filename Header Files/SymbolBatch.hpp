@@ -0,0 +1,102 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/SymbolBatch.hpp
+*
+* @summary:   Batched symbol lookup definitions. Shared by every table which
+*             is sorted by RVA (symbol tables and PE exports).
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <algorithm>
+
+//
+// NameOffset of an RVA which no symbol covers.
+//
+#define SYMBOL_BATCH_UNRESOLVED 0xFFFFFFFF
+
+//
+// One address in a batch, all from the same module. The caller fills in
+// Rva and Slot (where the result belongs - e.g. a frame index), the lookup
+// fills in the rest.
+//
+typedef struct _SYMBOL_BATCH_ENTRY
+{
+    uint32_t Rva;
+    uint32_t Slot;
+    uint32_t NameOffset;
+    uint32_t Displacement;
+} SYMBOL_BATCH_ENTRY, *PSYMBOL_BATCH_ENTRY;
+
+/**
+*
+* @brief        Sorts a batch by RVA, so one forward sweep over a table resolves it.
+* @param[in]    Batch - The batch.
+* @param[in]    Count - The number of entries in the batch.
+*
+*/
+inline
+void
+SortSymbolBatch (
+    _Inout_ PSYMBOL_BATCH_ENTRY Batch,
+    _In_ size_t Count
+    )
+{
+    std::sort(Batch,
+              Batch + Count,
+              [](const SYMBOL_BATCH_ENTRY& Left, const SYMBOL_BATCH_ENTRY& Right)
+              {
+                  return Left.Rva < Right.Rva;
+              });
+}
+
+/**
+*
+* @brief        Finds the first table entry above an RVA, searching forward from a
+*               cursor. Every entry before the cursor must be at or below the RVA
+*               (true when a sorted batch is swept in order). Gallops, then binary
+*               searches, so a sparse batch over a large table does not degrade to
+*               a linear walk and a dense one stays close to a merge.
+* @param[in]    Cursor - Where the previous (smaller) RVA's search ended.
+* @param[in]    Last - The end of the table.
+* @param[in]    Rva - The RVA.
+* @return       The first entry above the RVA, or Last.
+*
+*/
+template <typename ENTRY>
+inline
+const ENTRY*
+SweepSymbolTable (
+    _In_ const ENTRY* Cursor,
+    _In_ const ENTRY* Last,
+    _In_ uint32_t Rva
+    )
+{
+    const ENTRY* bound;
+    size_t step;
+
+    bound = Cursor;
+    step = 1;
+
+    while ((bound < Last) &&
+           (bound->Rva <= Rva))
+    {
+        Cursor = (bound + 1);
+        bound = ((static_cast<size_t>(Last - bound) > step) ? (bound + step) : Last);
+        step <<= 1;
+    }
+
+    return std::upper_bound(Cursor,
+                            bound,
+                            Rva,
+                            [](uint32_t Value, const ENTRY& Entry)
+                            {
+                                return Value < Entry.Rva;
+                            });
+}
\ No newline at end of file
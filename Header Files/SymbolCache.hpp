@@ -0,0 +1,125 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/SymbolCache.hpp
+*
+* @summary:   On-disk symbol table cache definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include <Windows.h>
+#include "SymbolBatch.hpp"
+#include <vector>
+#include <string>
+
+//
+// Where symbol tables are cached (next to the symbol server cache).
+//
+#define SYMBOL_CACHE_DIRECTORY L"C:\\Symbols\\Vtl1Mon"
+
+//
+// 'VSYM'. Version 2 stores names as UTF-8 (version 1 was UTF-16). Version 3
+// names are undecorated however the table was built (version 2 tables
+// built from a local PDB kept them decorated).
+//
+#define SYMBOL_TABLE_MAGIC 0x4D595356
+#define SYMBOL_TABLE_VERSION 3
+
+//
+// A module's identity, as reported by the image load event. A table is
+// only ever used for the exact image it was built from.
+//
+typedef struct _SYMBOL_TABLE_KEY
+{
+    const wchar_t* ImageName;
+    ULONG TimeDateStamp;
+    ULONG ImageChecksum;
+    ULONG ImageSize;
+} SYMBOL_TABLE_KEY, *PSYMBOL_TABLE_KEY;
+
+//
+// On-disk layout:
+//
+//   SYMBOL_TABLE_HEADER
+//   SYMBOL_TABLE_ENTRY[SymbolCount] (sorted by RVA, unique)
+//   NULL-terminated UTF-8 names (StringTableSize bytes)
+//
+typedef struct _SYMBOL_TABLE_HEADER
+{
+    ULONG Magic;
+    ULONG Version;
+    ULONG TimeDateStamp;
+    ULONG ImageChecksum;
+    ULONG ImageSize;
+    ULONG SymbolCount;
+    ULONG StringTableSize;
+    ULONG Reserved;
+} SYMBOL_TABLE_HEADER, *PSYMBOL_TABLE_HEADER;
+
+typedef struct _SYMBOL_TABLE_ENTRY
+{
+    ULONG Rva;
+    ULONG NameOffset;
+} SYMBOL_TABLE_ENTRY, *PSYMBOL_TABLE_ENTRY;
+
+//
+// A symbol collected while building a table. The name is UTF-8 - names
+// are transcoded once, when the table is built.
+//
+typedef struct _SYMBOL_TABLE_RECORD
+{
+    ULONG Rva;
+    std::string Name;
+} SYMBOL_TABLE_RECORD, *PSYMBOL_TABLE_RECORD;
+
+//
+// A mapped (read-only) symbol table. Lookups never write to it,
+// so any number of threads can search it without a lock.
+//
+typedef struct _SYMBOL_TABLE
+{
+    HANDLE MappingHandle;
+    const SYMBOL_TABLE_HEADER* Header;
+    const SYMBOL_TABLE_ENTRY* Entries;
+    const char* Strings;
+    ULONG StringCount;
+} SYMBOL_TABLE, *PSYMBOL_TABLE;
+
+//
+// Function definitions
+//
+bool
+OpenSymbolTable (
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Out_ PSYMBOL_TABLE Table
+    );
+
+bool
+WriteSymbolTable (
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Inout_ std::vector<SYMBOL_TABLE_RECORD>& Records
+    );
+
+const char*
+LookupSymbolTable (
+    _In_ const SYMBOL_TABLE* Table,
+    _In_ ULONG Rva,
+    _Out_ ULONG* Displacement
+    );
+
+void
+LookupSymbolTableBatch (
+    _In_ const SYMBOL_TABLE* Table,
+    _Inout_ PSYMBOL_BATCH_ENTRY Batch,
+    _In_ SIZE_T Count
+    );
+
+void
+CloseSymbolTable (
+    _Inout_ PSYMBOL_TABLE Table
+    );
\ No newline at end of file
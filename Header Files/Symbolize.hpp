@@ -0,0 +1,253 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Symbolize.hpp
+*
+* @summary:   Offline ("symbolize" command) definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include <Windows.h>
+#include "RawCapture.hpp"
+#include "SymbolCache.hpp"
+#include "PeExports.hpp"
+#include "Format.hpp"
+#include "Aggregate.hpp"
+#include "Clock.hpp"
+#include <vector>
+#include <string>
+#include <map>
+
+//
+// Events are resolved (in parallel) and written in batches of this many.
+//
+#define SYMBOLIZE_BATCH_EVENTS 65536
+
+//
+// Images which only dbghelp can resolve are loaded at made-up, non-overlapping
+// bases - two processes may well have had different images at the same address.
+//
+#define SYMBOLIZE_DBGHELP_BASE 0x10000000ULL
+#define SYMBOLIZE_DBGHELP_ALIGNMENT 0x10000ULL
+
+//
+// Where an image's symbols came from.
+//
+typedef enum _SYMBOLIZE_SOURCE
+{
+    SymbolizeSourceNone = 0,
+    SymbolizeSourceCache,
+    SymbolizeSourcePdb,
+    SymbolizeSourceDbgHelp,
+    SymbolizeSourceExports
+} SYMBOLIZE_SOURCE;
+
+//
+// An image, by identity. Shared by every process which loaded it, so
+// its symbols are only loaded once.
+//
+typedef struct _SYMBOLIZE_IMAGE
+{
+    //
+    // The NT path as captured (and in UTF-8, for the output), and the file
+    // name (the symbol table cache key).
+    //
+    std::wstring ImagePath;
+    std::string ImagePathUtf8;
+    std::wstring ImageName;
+    ULONG ImageSize;
+    ULONG TimeDateStamp;
+    ULONG ImageChecksum;
+
+    //
+    // Only images at least one frame lands in are loaded.
+    //
+    bool Referenced;
+
+    //
+    // Where the image was found on this machine, if anywhere.
+    //
+    std::wstring LocalPath;
+
+    SYMBOLIZE_SOURCE Source;
+    SYMBOL_TABLE Table;
+    PE_EXPORT_TABLE Exports;
+} SYMBOLIZE_IMAGE, *PSYMBOLIZE_IMAGE;
+
+//
+// An image load in a process.
+//
+typedef struct _SYMBOLIZE_MODULE
+{
+    ULONGLONG ImageBase;
+    ULONG ImageSize;
+    ULONG ImageIndex;
+} SYMBOLIZE_MODULE, *PSYMBOLIZE_MODULE;
+
+//
+// Per-process module maps, keyed by base address.
+//
+typedef std::map<ULONGLONG, SYMBOLIZE_MODULE> SYMBOLIZE_MODULE_MAP;
+
+//
+// Everything read from a raw capture. Read-only once loaded, so the
+// resolve workers share it without a lock.
+//
+typedef struct _SYMBOLIZE_CONTEXT
+{
+    MAPPED_FILE Capture;
+
+    //
+    // The capture itself: the mapping, or a compressed capture
+    // (-compress) decompressed into memory.
+    //
+    std::vector<uint8_t> DecompressedCapture;
+    const uint8_t* CaptureData;
+    SIZE_T CaptureLength;
+
+    const wchar_t* SymbolStore;
+    std::vector<SYMBOLIZE_IMAGE> Images;
+    std::map<ULONG, SYMBOLIZE_MODULE_MAP> ProcessModules;
+
+    //
+    // Every module, first load wins. Same view the live image map has.
+    //
+    SYMBOLIZE_MODULE_MAP AllModules;
+
+    //
+    // UTF-8, like the output.
+    //
+    std::vector<std::string> Names;
+    std::vector<std::string> SecureCallNames;
+    std::vector<const uint8_t*> Events;
+
+    //
+    // The capture's clock (RawRecordClock), zeroed if it has none.
+    //
+    SESSION_CLOCK Clock;
+} SYMBOLIZE_CONTEXT, *PSYMBOLIZE_CONTEXT;
+
+//
+// An image load worker. Workers claim images until none are left.
+//
+typedef struct _SYMBOLIZE_LOAD_WORKER
+{
+    PSYMBOLIZE_CONTEXT Context;
+    volatile LONG* NextImage;
+} SYMBOLIZE_LOAD_WORKER, *PSYMBOLIZE_LOAD_WORKER;
+
+//
+// A frame, once resolved. Image is NULL if no image covers the address,
+// SymbolName (a symbol or an export, UTF-8) is NULL if nothing covers it.
+//
+typedef struct _SYMBOLIZE_FRAME
+{
+    ULONGLONG Address;
+    const SYMBOLIZE_IMAGE* Image;
+    ULONG Rva;
+    const char* SymbolName;
+    ULONG Displacement;
+} SYMBOLIZE_FRAME, *PSYMBOLIZE_FRAME;
+
+//
+// A resolve worker's slice of a batch.
+//
+typedef struct _SYMBOLIZE_RESOLVE_WORKER
+{
+    const SYMBOLIZE_CONTEXT* Context;
+    SIZE_T FirstEvent;
+    SIZE_T EventCount;
+    FORMAT_BUFFER Output;
+    ULONGLONG Frames;
+    ULONGLONG FramesResolved;
+
+    //
+    // Every frame in the slice, and the slice's frames grouped by image
+    // (indexed by image). Kept from batch to batch so they are only
+    // allocated once.
+    //
+    std::vector<SYMBOLIZE_FRAME> SliceFrames;
+    std::vector<std::vector<SYMBOL_BATCH_ENTRY>> ImageBatches;
+    std::vector<ULONG> BatchedImages;
+
+    //
+    // The slice's timestamps, converted to FILETIMEs in one pass (-walltime).
+    //
+    std::vector<uint64_t> Times;
+
+    //
+    // Time spent finding modules and symbols, and time spent formatting
+    // the slice's rows (and how much was formatted).
+    //
+    LONGLONG LookupTicks;
+    LONGLONG FormatTicks;
+    ULONGLONG FormatBytes;
+} SYMBOLIZE_RESOLVE_WORKER, *PSYMBOLIZE_RESOLVE_WORKER;
+
+//
+// A worker counting a raw capture into an aggregate (for diff). Frames
+// are resolved as for the CSV, then counted by their formatted identity.
+//
+typedef struct _SYMBOLIZE_AGGREGATE_WORKER
+{
+    SYMBOLIZE_RESOLVE_WORKER Resolve;
+    AGGREGATE Aggregate;
+
+    //
+    // String IDs already looked up: frames by (image, RVA) or by address
+    // when no image covers them, secure calls by number, names by name ID.
+    //
+    std::unordered_map<uint64_t, uint32_t> FrameIds;
+    std::unordered_map<uint64_t, uint32_t> UnknownFrameIds;
+    std::vector<uint32_t> SecureCallIds;
+    std::vector<uint32_t> NameIds;
+
+    std::vector<uint32_t> Identity;
+    FORMAT_BUFFER Frame;
+    uint64_t FirstTimeStamp;
+    uint64_t LastTimeStamp;
+} SYMBOLIZE_AGGREGATE_WORKER, *PSYMBOLIZE_AGGREGATE_WORKER;
+
+//
+// "symbolize" command statistics
+//
+typedef struct _SYMBOLIZE_STATISTICS
+{
+    ULONGLONG Events;
+    ULONGLONG Frames;
+    ULONGLONG FramesResolved;
+    ULONGLONG ImagesReferenced;
+    ULONGLONG ImagesBySource[SymbolizeSourceExports + 1];
+    ULONG Threads;
+    LONGLONG LoadTicks;
+    LONGLONG ResolveTicks;
+    LONGLONG LookupTicks;
+    LONGLONG FormatTicks;
+    ULONGLONG FormatBytes;
+} SYMBOLIZE_STATISTICS, *PSYMBOLIZE_STATISTICS;
+
+//
+// Function definitions
+//
+bool
+SymbolizeRawCapture (
+    _In_ const wchar_t* RawCapturePath,
+    _In_ const wchar_t* OutputPath,
+    _In_ const wchar_t* SymbolStore,
+    _In_ ULONG ThreadCount,
+    _In_ bool UseDbgHelp
+    );
+
+bool
+AggregateRawCapture (
+    _In_ const wchar_t* RawCapturePath,
+    _In_ const wchar_t* SymbolStore,
+    _In_ ULONG ThreadCount,
+    _Out_ PAGGREGATE Aggregate,
+    _Out_ double* Seconds
+    );
\ No newline at end of file
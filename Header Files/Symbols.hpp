@@ -15,6 +15,60 @@
 #include <Windows.h>
 #include <dbghelp.h>
 #include <stdio.h>
+#include <string>
+#include "SymbolCache.hpp"
+#include "PeExports.hpp"
+#include "Pdb.hpp"
+#include "Format.hpp"
+#include "Unicode.hpp"
+
+//
+// The local symbol store (the downstream store of the symbol path).
+//
+#define SYMBOL_STORE_DIRECTORY L"C:\\Symbols"
+
+//
+// A module seen in an image load (or rundown) event. Symbols for
+// the module are only loaded the first time a frame lands in it.
+//
+typedef struct _SYMBOL_MODULE
+{
+    std::wstring ImagePath;
+    ULONG Size;
+    ULONG TimeDateStamp;
+    ULONG ImageChecksum;
+    bool LoadAttempted;
+    bool Loaded;
+
+    //
+    // Set when the module's symbols come from a cached table. dbghelp
+    // is only used for modules without one.
+    //
+    bool TableMapped;
+    SYMBOL_TABLE Table;
+
+    //
+    // Set when there is no PDB and the module's own export
+    // directory is used instead.
+    //
+    bool ExportsLoaded;
+    PE_EXPORT_TABLE Exports;
+} SYMBOL_MODULE, *PSYMBOL_MODULE;
+
+//
+// On-demand module load statistics
+//
+typedef struct _SYMBOL_LOAD_STATISTICS
+{
+    ULONGLONG ModulesRegistered;
+    ULONGLONG ModulesLoaded;
+    ULONGLONG ModuleLoadFailures;
+    ULONGLONG TableCacheHits;
+    ULONGLONG TablesBuilt;
+    ULONGLONG PdbTablesBuilt;
+    ULONGLONG ExportTablesLoaded;
+    LONGLONG LoadTicks;
+} SYMBOL_LOAD_STATISTICS, *PSYMBOL_LOAD_STATISTICS;
 
 //
 // Function prototypes
@@ -81,6 +135,16 @@ BOOL
     _Inout_ PSYMBOL_INFOW Symbol
     );
 
+typedef
+BOOL
+(*SymEnumSymbolsW_T) (
+    _In_ HANDLE hProcess,
+    _In_ ULONG64 BaseOfDll,
+    _In_opt_ PCWSTR Mask,
+    _In_ PSYM_ENUMERATESYMBOLS_CALLBACKW EnumSymbolsCallback,
+    _In_opt_ PVOID UserContext
+    );
+
 typedef
 BOOL
 (*SymGetTypeInfo_T) (
@@ -97,23 +161,48 @@ BOOL
 bool
 InitializeSymbols ();
 
+std::wstring
+GetSymbolImagePath (
+    _In_ const wchar_t* ImagePath
+    );
+
+bool
+BuildSymbolTableFromLocalPdb (
+    _In_ const wchar_t* ImagePath,
+    _In_ const wchar_t* SymbolStore,
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Out_ PSYMBOL_TABLE Table
+    );
+
+bool
+BuildSymbolTableWithDbgHelp (
+    _In_ const wchar_t* ImagePath,
+    _In_ ULONG_PTR BaseAddress,
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Out_ PSYMBOL_TABLE Table
+    );
+
 bool
 CaptureModuleForSymbols (
     _In_ ULONG_PTR BaseAddress,
-    _In_ wchar_t* ImagePath,
-    _In_ ULONG Size
+    _In_ const wchar_t* ImagePath,
+    _In_ ULONG Size,
+    _In_ ULONG TimeDateStamp,
+    _In_ ULONG ImageChecksum
     );
 
-wchar_t*
-ConvertAddressToFrameStringWithSymbol (
+bool
+FormatFrameWithSymbol (
+    _Inout_ PFORMAT_BUFFER Buffer,
     _In_ ULONG_PTR TargetAddress,
-    _In_ wchar_t* ImageName
+    _In_ const char* ImageName,
+    _In_ char Separator
     );
 
 void
 CreateListOfValidSecureCalls ();
 
-wchar_t*
+const char*
 GetSecureCallName (
     _In_ ULONG SecureCallValue
     );
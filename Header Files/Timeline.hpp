@@ -0,0 +1,63 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Timeline.hpp
+*
+* @summary:   Timeline (Perfetto trace) export definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include <Windows.h>
+#include "Nodes.hpp"
+#include <vector>
+#include <unordered_map>
+
+//
+// Packets are buffered and written in chunks of about this size.
+//
+#define TIMELINE_FLUSH_BYTES (1024 * 1024)
+
+//
+// A process or thread track, and the name it was last described with
+// (so a renamed thread is described again).
+//
+typedef struct _TIMELINE_TRACK
+{
+    uint64_t Uuid;
+    ULONG NameId;
+} TIMELINE_TRACK, *PTIMELINE_TRACK;
+
+//
+// Function definitions
+//
+bool
+SetTimeline (
+    _In_ const wchar_t* FilePath
+    );
+
+bool
+IsTimelineEnabled ();
+
+void
+RecordTimelineSlice (
+    _In_ ULONGLONG EnterTime,
+    _In_ ULONGLONG ExitTime,
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId,
+    _In_ ULONG SecureCallNumber
+    );
+
+void
+RecordTimelineStack (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    );
+
+void
+StopTimeline ();
\ No newline at end of file
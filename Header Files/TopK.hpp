@@ -0,0 +1,163 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/TopK.hpp
+*
+* @summary:   Streaming top-K (heavy hitter) tracker definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <vector>
+
+//
+// Counters per tracker. Memory is fixed at this many entries no matter
+// how many distinct keys the trace produces.
+//
+#define TOP_K_DEFAULT_CAPACITY 1024
+
+//
+// Entries printed per tracker in a report.
+//
+#define TOP_K_REPORT_ENTRIES 10
+
+//
+// Frames kept with an entry, to show what the key was.
+//
+#define TOP_K_MAX_SAMPLE_FRAMES 32
+
+//
+// User-mode addresses are below this (x64 canonical lower half).
+//
+#define TOP_K_USER_ADDRESS_LIMIT 0x0000800000000000ULL
+
+typedef enum _TOP_K_TRACKER_TYPE
+{
+    TopKStacks = 0,
+    TopKProcesses,
+    TopKCallers,
+    TopKTrackerCount
+} TOP_K_TRACKER_TYPE;
+
+//
+// An example of an entry's key - the event which (re)claimed the counter.
+//
+typedef struct _TOP_K_SAMPLE
+{
+    uint32_t ProcessId;
+    uint32_t ProcessNameId;
+    uint16_t SecureCallNumber;
+    uint16_t NumberOfFrames;
+    uint64_t Frames[TOP_K_MAX_SAMPLE_FRAMES];
+} TOP_K_SAMPLE, *PTOP_K_SAMPLE;
+
+//
+// A counter. Count over-estimates the key's true count by at most Error
+// (the count of the key it replaced).
+//
+typedef struct _TOP_K_ENTRY
+{
+    uint64_t Key;
+    uint64_t Count;
+    uint64_t Error;
+    uint32_t HeapIndex;
+    TOP_K_SAMPLE Sample;
+} TOP_K_ENTRY, *PTOP_K_ENTRY;
+
+//
+// Space-Saving: a fixed set of counters. A key without a counter takes
+// over the smallest one (a min-heap) and inherits its count as error.
+// Keys are found through an open-addressed index of entry numbers.
+// Every key with more than Total / Capacity events is guaranteed to
+// have a counter.
+//
+typedef struct _TOP_K_TRACKER
+{
+    std::vector<TOP_K_ENTRY> Entries;
+    std::vector<uint32_t> Heap;
+    std::vector<uint32_t> Slots;
+    uint32_t Capacity;
+    uint64_t Total;
+    uint64_t Replacements;
+} TOP_K_TRACKER, *PTOP_K_TRACKER;
+
+//
+// Function definitions
+//
+uint64_t
+HashTopKKey (
+    _In_ uint64_t Hash,
+    _In_ uint64_t Value
+    );
+
+void
+InitializeTopKTracker (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ uint32_t Capacity
+    );
+
+PTOP_K_ENTRY
+OfferTopKKey (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ uint64_t Key,
+    _In_ uint64_t Count,
+    _Out_ bool* Claimed
+    );
+
+void
+GetTopKEntries (
+    _In_ const TOP_K_TRACKER* Tracker,
+    _In_ size_t Count,
+    _Out_ std::vector<const TOP_K_ENTRY*>& Entries
+    );
+
+uint64_t
+GetTopKMinimumCount (
+    _In_ const TOP_K_TRACKER* Tracker
+    );
+
+const wchar_t*
+GetTopKTrackerName (
+    _In_ TOP_K_TRACKER_TYPE Type
+    );
+
+#ifdef _WIN32
+#include "Nodes.hpp"
+
+//
+// Function definitions
+//
+void
+SetTopKTracking (
+    _In_ uint32_t Capacity,
+    _In_ ULONG ReportSeconds
+    );
+
+void
+SetTopKQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    );
+
+bool
+IsTopKTrackingEnabled ();
+
+void
+TrackTopKEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    );
+
+const TOP_K_TRACKER*
+GetTopKTracker (
+    _In_ TOP_K_TRACKER_TYPE Type
+    );
+
+void
+StopTopKTracking ();
+#endif
\ No newline at end of file
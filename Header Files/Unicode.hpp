@@ -0,0 +1,43 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Unicode.hpp
+*
+* @summary:   UTF-16 to UTF-8 transcoding definitions.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <string>
+
+//
+// The most UTF-8 bytes a single wchar_t can turn into. A UTF-16 code unit
+// is at most 3 bytes (a surrogate pair is 4 bytes for 2 units).
+//
+#define UTF8_MAX_BYTES_PER_WCHAR ((sizeof(wchar_t) == 2) ? 3 : 4)
+
+//
+// Function definitions
+//
+size_t
+TranscodeUtf16ToUtf8 (
+    _In_ const wchar_t* Source,
+    _In_ size_t Length,
+    _Out_ char* Destination
+    );
+
+std::string
+ConvertToUtf8 (
+    _In_ const wchar_t* Source,
+    _In_ size_t Length
+    );
+
+std::string
+ConvertToUtf8 (
+    _In_ const wchar_t* Source
+    );
\ No newline at end of file
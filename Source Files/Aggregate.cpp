@@ -0,0 +1,1507 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Aggregate.cpp
+*
+* @summary:   Mergeable aggregate snapshots. The live tool writes its aggregates
+*             (per secure call counts and latency histograms, the top-K sketches)
+*             keyed by symbolized identity, and the "merge" command combines any
+*             number of them - from a whole fleet - in parallel.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Aggregate.hpp"
+#include "Helpers.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Clock.hpp"
+#include <intrin.h>
+#include <algorithm>
+
+//
+// Live aggregation state. Only the ETW processing thread touches it.
+//
+static bool k_AggregationEnabled = false;
+static std::wstring k_AggregateSnapshotPath;
+static std::unordered_map<ULONG, AGGREGATE_SECURE_CALL> k_LiveSecureCalls;
+
+//
+// The first and last event, as raw (QPC) timestamps. The snapshot covers
+// event time, not how long Vtl1Mon ran.
+//
+static ULONGLONG k_AggregateFirstTimeStamp = 0;
+static ULONGLONG k_AggregateLastTimeStamp = 0;
+
+//
+// A parallel merge worker.
+//
+typedef struct _AGGREGATE_MERGE_WORKER
+{
+    const std::vector<std::wstring>* Paths;
+    volatile LONG* NextPath;
+    AGGREGATE Aggregate;
+    ULONGLONG Failures;
+} AGGREGATE_MERGE_WORKER, *PAGGREGATE_MERGE_WORKER;
+
+/**
+*
+* @brief        Hashes a string (FNV-1a).
+* @param[in]    String - The string.
+* @return       The hash.
+*
+*/
+static
+uint64_t
+HashAggregateString (
+    _In_ const std::string& String
+    )
+{
+    uint64_t hash;
+
+    hash = 0xCBF29CE484222325ULL;
+
+    for (char character : String)
+    {
+        hash ^= static_cast<uint8_t>(character);
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+/**
+*
+* @brief        Computes the key of a top-K identity - from the strings, not
+*               their IDs, so it is the same in every aggregate.
+* @param[in]    Aggregate - The aggregate the identity's string IDs belong to.
+* @param[in]    Identity - The identity.
+* @return       The key.
+*
+*/
+static
+uint64_t
+GetAggregateIdentityKey (
+    _In_ const AGGREGATE* Aggregate,
+    _In_ const std::vector<uint32_t>& Identity
+    )
+{
+    uint64_t key;
+
+    key = 0;
+
+    for (uint32_t stringId : Identity)
+    {
+        key = HashTopKKey(key, Aggregate->StringHashes[stringId]);
+    }
+
+    return key;
+}
+
+/**
+*
+* @brief        Empties an aggregate.
+* @param[out]   Aggregate - The aggregate.
+*
+*/
+void
+InitializeAggregate (
+    _Out_ PAGGREGATE Aggregate
+    )
+{
+    Aggregate->Strings.clear();
+    Aggregate->StringHashes.clear();
+    Aggregate->StringIds.clear();
+    Aggregate->Snapshots = 0;
+    Aggregate->FirstTime = 0;
+    Aggregate->LastTime = 0;
+    Aggregate->Events = 0;
+    Aggregate->ExposureSeconds = 0;
+    Aggregate->SecureCalls.clear();
+
+    for (auto& topK : Aggregate->TopK)
+    {
+        topK.Capacity = 0;
+        topK.Total = 0;
+        topK.MinimumCount = 0;
+        topK.Entries.clear();
+        topK.Index.clear();
+    }
+}
+
+/**
+*
+* @brief        Gets the ID of a string, adding it if it is new.
+* @param[in]    Aggregate - The aggregate.
+* @param[in]    String - The (UTF-8) string.
+* @return       The string ID.
+*
+*/
+uint32_t
+InternAggregateString (
+    _Inout_ PAGGREGATE Aggregate,
+    _In_ const std::string& String
+    )
+{
+    uint32_t stringId;
+
+    //
+    // Loaded snapshots skip the lookup table - their strings are
+    // already unique. Build it the first time one is added to.
+    //
+    if (Aggregate->StringIds.size() != Aggregate->Strings.size())
+    {
+        Aggregate->StringIds.clear();
+
+        for (uint32_t i = 0; i < Aggregate->Strings.size(); i++)
+        {
+            Aggregate->StringIds.emplace(Aggregate->Strings[i], i);
+        }
+    }
+
+    auto existing = Aggregate->StringIds.find(String);
+    if (existing != Aggregate->StringIds.end())
+    {
+        return existing->second;
+    }
+
+    stringId = static_cast<uint32_t>(Aggregate->Strings.size());
+
+    Aggregate->Strings.push_back(String);
+    Aggregate->StringHashes.push_back(HashAggregateString(String));
+    Aggregate->StringIds.emplace(String, stringId);
+
+    return stringId;
+}
+
+/**
+*
+* @brief        Gets the ID of a secure call's name. Secure calls are matched by
+*               name across snapshots, so unnamed ones keep their number.
+* @param[in]    Aggregate - The aggregate.
+* @param[in]    Name - The secure call name, or NULL/"Unknown" if it has none.
+* @param[in]    SecureCallNumber - The secure call number.
+* @return       The string ID.
+*
+*/
+uint32_t
+InternAggregateSecureCallName (
+    _Inout_ PAGGREGATE Aggregate,
+    _In_opt_ const char* Name,
+    _In_ ULONG SecureCallNumber
+    )
+{
+    char unknownName[32];
+
+    if ((Name == NULL) ||
+        (Name[0] == '\0') ||
+        (strcmp(Name, "Unknown") == 0))
+    {
+        snprintf(unknownName, ARRAYSIZE(unknownName), "Unknown (%lu)", SecureCallNumber);
+        Name = unknownName;
+    }
+
+    return InternAggregateString(Aggregate, Name);
+}
+
+/**
+*
+* @brief        Gets the histogram bucket of a latency. Values below four get
+*               their own bucket, then there are four per power of two.
+* @param[in]    Latency - The latency, in nanoseconds.
+* @return       The bucket.
+*
+*/
+ULONG
+GetAggregateLatencyBucket (
+    _In_ uint64_t Latency
+    )
+{
+    unsigned long exponent;
+
+    if (Latency < (1ULL << AGGREGATE_LATENCY_SUB_BUCKET_BITS))
+    {
+        return static_cast<ULONG>(Latency);
+    }
+
+    _BitScanReverse64(&exponent, Latency);
+
+    return (((exponent - AGGREGATE_LATENCY_SUB_BUCKET_BITS + 1) << AGGREGATE_LATENCY_SUB_BUCKET_BITS) |
+            static_cast<ULONG>((Latency >> (exponent - AGGREGATE_LATENCY_SUB_BUCKET_BITS)) &
+                               ((1 << AGGREGATE_LATENCY_SUB_BUCKET_BITS) - 1)));
+}
+
+/**
+*
+* @brief        Gets the value in the middle of a histogram bucket.
+* @param[in]    Bucket - The bucket.
+* @return       The latency, in nanoseconds.
+*
+*/
+static
+uint64_t
+GetAggregateLatencyBucketValue (
+    _In_ ULONG Bucket
+    )
+{
+    ULONG exponent;
+    uint64_t width;
+
+    if (Bucket < (1 << AGGREGATE_LATENCY_SUB_BUCKET_BITS))
+    {
+        return Bucket;
+    }
+
+    exponent = ((Bucket >> AGGREGATE_LATENCY_SUB_BUCKET_BITS) + AGGREGATE_LATENCY_SUB_BUCKET_BITS - 1);
+    width = (1ULL << (exponent - AGGREGATE_LATENCY_SUB_BUCKET_BITS));
+
+    return ((1ULL << exponent) + ((Bucket & ((1 << AGGREGATE_LATENCY_SUB_BUCKET_BITS) - 1)) * width) + (width / 2));
+}
+
+/**
+*
+* @brief        Estimates a latency percentile from a secure call's histogram.
+* @param[in]    SecureCall - The secure call.
+* @param[in]    Percentile - The percentile (0 - 100).
+* @return       The latency, in nanoseconds. 0 if none were timed.
+*
+*/
+uint64_t
+GetAggregateLatencyPercentile (
+    _In_ const AGGREGATE_SECURE_CALL* SecureCall,
+    _In_ double Percentile
+    )
+{
+    uint64_t rank;
+    uint64_t seen;
+
+    if (SecureCall->Latencies == 0)
+    {
+        return 0;
+    }
+
+    rank = static_cast<uint64_t>((Percentile / 100.0) * (SecureCall->Latencies - 1)) + 1;
+    seen = 0;
+
+    for (ULONG i = 0; i < SecureCall->Buckets.size(); i++)
+    {
+        seen += SecureCall->Buckets[i];
+
+        if (seen >= rank)
+        {
+            return (std::min)(GetAggregateLatencyBucketValue(i), SecureCall->LatencyMax);
+        }
+    }
+
+    return SecureCall->LatencyMax;
+}
+
+/**
+*
+* @brief        Rebuilds a top-K sketch's lookup table.
+* @param[in]    TopK - The sketch.
+*
+*/
+static
+void
+IndexAggregateTopK (
+    _Inout_ PAGGREGATE_TOP_K TopK
+    )
+{
+    TopK->Index.clear();
+    TopK->Index.reserve(TopK->Entries.size());
+
+    for (size_t i = 0; i < TopK->Entries.size(); i++)
+    {
+        TopK->Index.emplace(TopK->Entries[i].Key, i);
+    }
+}
+
+/**
+*
+* @brief        Adds an entry to a top-K sketch, or to the entry with the same identity.
+* @param[in]    TopK - The sketch.
+* @param[in]    Entry - The entry.
+*
+*/
+static
+void
+AddAggregateTopKEntry (
+    _Inout_ PAGGREGATE_TOP_K TopK,
+    _In_ AGGREGATE_TOP_K_ENTRY&& Entry
+    )
+{
+    auto existing = TopK->Index.find(Entry.Key);
+    if (existing != TopK->Index.end())
+    {
+        TopK->Entries[existing->second].Count += Entry.Count;
+        TopK->Entries[existing->second].Error += Entry.Error;
+        return;
+    }
+
+    TopK->Index.emplace(Entry.Key, TopK->Entries.size());
+    TopK->Entries.push_back(std::move(Entry));
+}
+
+/**
+*
+* @brief        Counts an identity exactly, in an aggregate built from every event
+*               rather than from a sketch (so it has no error).
+* @param[in]    Aggregate - The aggregate.
+* @param[in]    Type - The top-K sketch to count in.
+* @param[in]    Identity - The identity (string IDs).
+* @param[in]    Count - The count to add.
+*
+*/
+void
+CountAggregateIdentity (
+    _Inout_ PAGGREGATE Aggregate,
+    _In_ TOP_K_TRACKER_TYPE Type,
+    _In_ const std::vector<uint32_t>& Identity,
+    _In_ uint64_t Count
+    )
+{
+    PAGGREGATE_TOP_K topK;
+    uint64_t key;
+
+    topK = &Aggregate->TopK[Type];
+    key = GetAggregateIdentityKey(Aggregate, Identity);
+
+    topK->Total += Count;
+
+    auto existing = topK->Index.find(key);
+    if (existing != topK->Index.end())
+    {
+        topK->Entries[existing->second].Count += Count;
+        return;
+    }
+
+    topK->Index.emplace(key, topK->Entries.size());
+    topK->Entries.push_back({ key, Count, 0, Identity });
+}
+
+/**
+*
+* @brief        Loads a snapshot.
+* @param[in]    FilePath - The snapshot.
+* @param[out]   Aggregate - Receives the snapshot.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+LoadAggregateSnapshot (
+    _In_ const wchar_t* FilePath,
+    _Out_ PAGGREGATE Aggregate
+    )
+{
+    bool result;
+    MAPPED_FILE snapshot;
+    AGGREGATE_SNAPSHOT_HEADER header;
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+
+    result = false;
+
+    InitializeAggregate(Aggregate);
+
+    if (!MapFileReadOnly(FilePath, &snapshot))
+    {
+        wprintf(L"[-] Error! Unable to open %s in LoadAggregateSnapshot. (GLE: %d)\n", FilePath, GetLastError());
+        return false;
+    }
+
+    data = snapshot.Data;
+    length = snapshot.Length;
+
+    if (length < sizeof(header))
+    {
+        goto Exit;
+    }
+
+    RtlCopyMemory(&header, data, sizeof(header));
+
+    if ((header.Magic != AGGREGATE_SNAPSHOT_MAGIC) ||
+        (header.Version != AGGREGATE_SNAPSHOT_VERSION))
+    {
+        goto Exit;
+    }
+
+    Aggregate->Snapshots = header.Snapshots;
+    Aggregate->FirstTime = header.FirstTime;
+    Aggregate->LastTime = header.LastTime;
+    Aggregate->Events = header.Events;
+    Aggregate->ExposureSeconds = header.ExposureSeconds;
+
+    offset = sizeof(header);
+
+    //
+    // Every count in the file is bounded by what is left of it.
+    //
+    if (header.StringCount > ((length - offset) / sizeof(uint32_t)))
+    {
+        goto Exit;
+    }
+
+    Aggregate->Strings.reserve(header.StringCount);
+    Aggregate->StringHashes.reserve(header.StringCount);
+
+    for (uint32_t i = 0; i < header.StringCount; i++)
+    {
+        uint32_t stringLength;
+
+        if ((length - offset) < sizeof(stringLength))
+        {
+            goto Exit;
+        }
+
+        RtlCopyMemory(&stringLength, data + offset, sizeof(stringLength));
+
+        offset += sizeof(stringLength);
+
+        if ((length - offset) < stringLength)
+        {
+            goto Exit;
+        }
+
+        Aggregate->Strings.emplace_back(reinterpret_cast<const char*>(data + offset), stringLength);
+        Aggregate->StringHashes.push_back(HashAggregateString(Aggregate->Strings.back()));
+
+        offset += stringLength;
+    }
+
+    for (uint32_t i = 0; i < header.SecureCallCount; i++)
+    {
+        AGGREGATE_SECURE_CALL_RECORD callRecord;
+        AGGREGATE_SECURE_CALL secureCall;
+
+        if ((length - offset) < sizeof(callRecord))
+        {
+            goto Exit;
+        }
+
+        RtlCopyMemory(&callRecord, data + offset, sizeof(callRecord));
+
+        offset += sizeof(callRecord);
+
+        if ((callRecord.NameId >= header.StringCount) ||
+            (callRecord.BucketCount > ((length - offset) / sizeof(AGGREGATE_BUCKET_RECORD))))
+        {
+            goto Exit;
+        }
+
+        secureCall.NameId = callRecord.NameId;
+        secureCall.Number = callRecord.Number;
+        secureCall.Count = callRecord.Count;
+        secureCall.Latencies = callRecord.Latencies;
+        secureCall.LatencySum = callRecord.LatencySum;
+        secureCall.LatencyMax = callRecord.LatencyMax;
+
+        if (callRecord.BucketCount != 0)
+        {
+            secureCall.Buckets.assign(AGGREGATE_LATENCY_BUCKETS, 0);
+        }
+
+        for (uint32_t j = 0; j < callRecord.BucketCount; j++)
+        {
+            AGGREGATE_BUCKET_RECORD bucketRecord;
+
+            RtlCopyMemory(&bucketRecord, data + offset, sizeof(bucketRecord));
+
+            offset += sizeof(bucketRecord);
+
+            if (bucketRecord.Index >= AGGREGATE_LATENCY_BUCKETS)
+            {
+                goto Exit;
+            }
+
+            secureCall.Buckets[bucketRecord.Index] += bucketRecord.Count;
+        }
+
+        Aggregate->SecureCalls[callRecord.NameId] = std::move(secureCall);
+    }
+
+    for (uint32_t i = 0; i < header.TrackerCount; i++)
+    {
+        AGGREGATE_TOP_K_RECORD topKRecord;
+        PAGGREGATE_TOP_K topK;
+
+        if ((length - offset) < sizeof(topKRecord))
+        {
+            goto Exit;
+        }
+
+        RtlCopyMemory(&topKRecord, data + offset, sizeof(topKRecord));
+
+        offset += sizeof(topKRecord);
+
+        if ((topKRecord.Type >= TopKTrackerCount) ||
+            (topKRecord.EntryCount > ((length - offset) / sizeof(AGGREGATE_TOP_K_ENTRY_RECORD))))
+        {
+            goto Exit;
+        }
+
+        topK = &Aggregate->TopK[topKRecord.Type];
+        topK->Capacity = topKRecord.Capacity;
+        topK->Total = topKRecord.Total;
+        topK->MinimumCount = topKRecord.MinimumCount;
+        topK->Entries.resize(topKRecord.EntryCount);
+
+        for (auto& entry : topK->Entries)
+        {
+            AGGREGATE_TOP_K_ENTRY_RECORD entryRecord;
+
+            if ((length - offset) < sizeof(entryRecord))
+            {
+                goto Exit;
+            }
+
+            RtlCopyMemory(&entryRecord, data + offset, sizeof(entryRecord));
+
+            offset += sizeof(entryRecord);
+
+            if (entryRecord.IdentityLength > ((length - offset) / sizeof(uint32_t)))
+            {
+                goto Exit;
+            }
+
+            entry.Count = entryRecord.Count;
+            entry.Error = entryRecord.Error;
+            entry.Identity.resize(entryRecord.IdentityLength);
+
+            RtlCopyMemory(entry.Identity.data(), data + offset, (entryRecord.IdentityLength * sizeof(uint32_t)));
+
+            offset += (entryRecord.IdentityLength * sizeof(uint32_t));
+
+            for (uint32_t stringId : entry.Identity)
+            {
+                if (stringId >= header.StringCount)
+                {
+                    goto Exit;
+                }
+            }
+
+            entry.Key = GetAggregateIdentityKey(Aggregate, entry.Identity);
+        }
+
+        IndexAggregateTopK(topK);
+    }
+
+    result = true;
+
+Exit:
+    UnmapMappedFile(&snapshot);
+
+    if (!result)
+    {
+        wprintf(L"[-] Error! %s is not a valid aggregate snapshot.\n", FilePath);
+        InitializeAggregate(Aggregate);
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Appends a value to a snapshot being built.
+* @param[in]    Snapshot - The snapshot.
+* @param[in]    Data - The value.
+* @param[in]    Length - The length of the value, in bytes.
+*
+*/
+static
+void
+AppendAggregateSnapshot (
+    _Inout_ std::vector<uint8_t>& Snapshot,
+    _In_ const void* Data,
+    _In_ size_t Length
+    )
+{
+    Snapshot.insert(Snapshot.end(),
+                    static_cast<const uint8_t*>(Data),
+                    static_cast<const uint8_t*>(Data) + Length);
+}
+
+/**
+*
+* @brief        Writes an aggregate to a snapshot file.
+* @param[in]    Aggregate - The aggregate.
+* @param[in]    FilePath - The snapshot.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+SaveAggregateSnapshot (
+    _In_ const AGGREGATE* Aggregate,
+    _In_ const wchar_t* FilePath
+    )
+{
+    bool result;
+    std::vector<uint8_t> snapshot;
+    AGGREGATE_SNAPSHOT_HEADER header;
+    HANDLE fileHandle;
+    DWORD bytesWritten;
+
+    result = false;
+    fileHandle = INVALID_HANDLE_VALUE;
+
+    header.Magic = AGGREGATE_SNAPSHOT_MAGIC;
+    header.Version = AGGREGATE_SNAPSHOT_VERSION;
+    header.Snapshots = Aggregate->Snapshots;
+    header.FirstTime = Aggregate->FirstTime;
+    header.LastTime = Aggregate->LastTime;
+    header.Events = Aggregate->Events;
+    header.ExposureSeconds = Aggregate->ExposureSeconds;
+    header.StringCount = static_cast<uint32_t>(Aggregate->Strings.size());
+    header.SecureCallCount = static_cast<uint32_t>(Aggregate->SecureCalls.size());
+    header.TrackerCount = TopKTrackerCount;
+    header.Reserved = 0;
+
+    AppendAggregateSnapshot(snapshot, &header, sizeof(header));
+
+    for (const auto& string : Aggregate->Strings)
+    {
+        uint32_t stringLength;
+
+        stringLength = static_cast<uint32_t>(string.size());
+
+        AppendAggregateSnapshot(snapshot, &stringLength, sizeof(stringLength));
+        AppendAggregateSnapshot(snapshot, string.data(), stringLength);
+    }
+
+    for (const auto& secureCall : Aggregate->SecureCalls)
+    {
+        AGGREGATE_SECURE_CALL_RECORD callRecord;
+
+        callRecord.NameId = secureCall.second.NameId;
+        callRecord.Number = secureCall.second.Number;
+        callRecord.Count = secureCall.second.Count;
+        callRecord.Latencies = secureCall.second.Latencies;
+        callRecord.LatencySum = secureCall.second.LatencySum;
+        callRecord.LatencyMax = secureCall.second.LatencyMax;
+        callRecord.BucketCount = static_cast<uint32_t>(std::count_if(secureCall.second.Buckets.begin(),
+                                                                     secureCall.second.Buckets.end(),
+                                                                     [](uint64_t Count) { return (Count != 0); }));
+        callRecord.Reserved = 0;
+
+        AppendAggregateSnapshot(snapshot, &callRecord, sizeof(callRecord));
+
+        for (uint32_t i = 0; i < secureCall.second.Buckets.size(); i++)
+        {
+            AGGREGATE_BUCKET_RECORD bucketRecord;
+
+            if (secureCall.second.Buckets[i] == 0)
+            {
+                continue;
+            }
+
+            bucketRecord.Index = i;
+            bucketRecord.Reserved = 0;
+            bucketRecord.Count = secureCall.second.Buckets[i];
+
+            AppendAggregateSnapshot(snapshot, &bucketRecord, sizeof(bucketRecord));
+        }
+    }
+
+    for (uint32_t type = 0; type < TopKTrackerCount; type++)
+    {
+        const AGGREGATE_TOP_K* topK;
+        AGGREGATE_TOP_K_RECORD topKRecord;
+
+        topK = &Aggregate->TopK[type];
+
+        topKRecord.Type = type;
+        topKRecord.Capacity = topK->Capacity;
+        topKRecord.Total = topK->Total;
+        topKRecord.MinimumCount = topK->MinimumCount;
+        topKRecord.EntryCount = static_cast<uint32_t>(topK->Entries.size());
+        topKRecord.Reserved = 0;
+
+        AppendAggregateSnapshot(snapshot, &topKRecord, sizeof(topKRecord));
+
+        for (const auto& entry : topK->Entries)
+        {
+            AGGREGATE_TOP_K_ENTRY_RECORD entryRecord;
+
+            entryRecord.Count = entry.Count;
+            entryRecord.Error = entry.Error;
+            entryRecord.IdentityLength = static_cast<uint32_t>(entry.Identity.size());
+            entryRecord.Reserved = 0;
+
+            AppendAggregateSnapshot(snapshot, &entryRecord, sizeof(entryRecord));
+            AppendAggregateSnapshot(snapshot, entry.Identity.data(), (entry.Identity.size() * sizeof(uint32_t)));
+        }
+    }
+
+    fileHandle = CreateFileW(FilePath,
+                             GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             0,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in SaveAggregateSnapshot. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    if ((WriteFile(fileHandle,
+                   snapshot.data(),
+                   static_cast<DWORD>(snapshot.size()),
+                   &bytesWritten,
+                   NULL) == FALSE) ||
+        (bytesWritten != snapshot.size()))
+    {
+        wprintf(L"[-] Error! WriteFile failed in SaveAggregateSnapshot. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    result = true;
+
+Exit:
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Merges one top-K sketch into another. A key missing from a sketch
+*               may still have been seen up to that sketch's minimum count, so
+*               that is added to its count and error. The result keeps the
+*               largest Capacity entries; its error bound is the sum of both.
+* @param[in]    Target - The sketch merged into.
+* @param[in]    Source - The sketch to merge.
+* @param[in]    TargetAggregate - The aggregate Target belongs to.
+* @param[in]    Remap - Source string IDs to Target string IDs.
+*
+*/
+static
+void
+MergeAggregateTopK (
+    _Inout_ PAGGREGATE_TOP_K Target,
+    _In_ const AGGREGATE_TOP_K* Source,
+    _In_ const AGGREGATE* TargetAggregate,
+    _In_ const std::vector<uint32_t>& Remap
+    )
+{
+    std::vector<bool> inSource;
+    size_t targetEntries;
+    uint64_t minimumCount;
+
+    targetEntries = Target->Entries.size();
+    inSource.assign(targetEntries, false);
+
+    for (const auto& sourceEntry : Source->Entries)
+    {
+        AGGREGATE_TOP_K_ENTRY entry;
+
+        entry.Identity.reserve(sourceEntry.Identity.size());
+
+        for (uint32_t stringId : sourceEntry.Identity)
+        {
+            entry.Identity.push_back(Remap[stringId]);
+        }
+
+        entry.Key = GetAggregateIdentityKey(TargetAggregate, entry.Identity);
+
+        auto existing = Target->Index.find(entry.Key);
+        if (existing != Target->Index.end())
+        {
+            Target->Entries[existing->second].Count += sourceEntry.Count;
+            Target->Entries[existing->second].Error += sourceEntry.Error;
+
+            if (existing->second < targetEntries)
+            {
+                inSource[existing->second] = true;
+            }
+
+            continue;
+        }
+
+        entry.Count = (sourceEntry.Count + Target->MinimumCount);
+        entry.Error = (sourceEntry.Error + Target->MinimumCount);
+
+        Target->Index.emplace(entry.Key, Target->Entries.size());
+        Target->Entries.push_back(std::move(entry));
+    }
+
+    for (size_t i = 0; i < targetEntries; i++)
+    {
+        if (!inSource[i])
+        {
+            Target->Entries[i].Count += Source->MinimumCount;
+            Target->Entries[i].Error += Source->MinimumCount;
+        }
+    }
+
+    minimumCount = (Target->MinimumCount + Source->MinimumCount);
+
+    Target->Capacity = (std::max)(Target->Capacity, Source->Capacity);
+    Target->Total += Source->Total;
+
+    //
+    // Keep the largest. Anything dropped could have been seen as many
+    // times as its count.
+    //
+    if (Target->Entries.size() > Target->Capacity)
+    {
+        std::nth_element(Target->Entries.begin(),
+                         Target->Entries.begin() + Target->Capacity,
+                         Target->Entries.end(),
+                         [](const AGGREGATE_TOP_K_ENTRY& Left, const AGGREGATE_TOP_K_ENTRY& Right)
+                         {
+                             return (Left.Count > Right.Count);
+                         });
+
+        for (size_t i = Target->Capacity; i < Target->Entries.size(); i++)
+        {
+            minimumCount = (std::max)(minimumCount, Target->Entries[i].Count);
+        }
+
+        Target->Entries.resize(Target->Capacity);
+
+        IndexAggregateTopK(Target);
+    }
+
+    Target->MinimumCount = minimumCount;
+}
+
+/**
+*
+* @brief        Merges one aggregate into another. Strings are matched by content,
+*               so the two need not share anything.
+* @param[in]    Target - The aggregate merged into.
+* @param[in]    Source - The aggregate to merge.
+*
+*/
+void
+MergeAggregate (
+    _Inout_ PAGGREGATE Target,
+    _In_ const AGGREGATE* Source
+    )
+{
+    std::vector<uint32_t> remap;
+
+    remap.reserve(Source->Strings.size());
+
+    for (const auto& string : Source->Strings)
+    {
+        remap.push_back(InternAggregateString(Target, string));
+    }
+
+    if (Source->FirstTime != 0)
+    {
+        Target->FirstTime = ((Target->FirstTime == 0) ? Source->FirstTime : (std::min)(Target->FirstTime, Source->FirstTime));
+    }
+
+    Target->LastTime = (std::max)(Target->LastTime, Source->LastTime);
+    Target->Snapshots += Source->Snapshots;
+    Target->Events += Source->Events;
+    Target->ExposureSeconds += Source->ExposureSeconds;
+
+    for (const auto& sourceCall : Source->SecureCalls)
+    {
+        PAGGREGATE_SECURE_CALL secureCall;
+
+        secureCall = &Target->SecureCalls[remap[sourceCall.first]];
+
+        if (secureCall->Count == 0)
+        {
+            secureCall->NameId = remap[sourceCall.first];
+            secureCall->Number = sourceCall.second.Number;
+        }
+
+        secureCall->Count += sourceCall.second.Count;
+        secureCall->Latencies += sourceCall.second.Latencies;
+        secureCall->LatencySum += sourceCall.second.LatencySum;
+        secureCall->LatencyMax = (std::max)(secureCall->LatencyMax, sourceCall.second.LatencyMax);
+
+        if (sourceCall.second.Buckets.empty())
+        {
+            continue;
+        }
+
+        if (secureCall->Buckets.empty())
+        {
+            secureCall->Buckets.assign(AGGREGATE_LATENCY_BUCKETS, 0);
+        }
+
+        for (size_t i = 0; i < AGGREGATE_LATENCY_BUCKETS; i++)
+        {
+            secureCall->Buckets[i] += sourceCall.second.Buckets[i];
+        }
+    }
+
+    for (ULONG type = 0; type < TopKTrackerCount; type++)
+    {
+        MergeAggregateTopK(&Target->TopK[type], &Source->TopK[type], Target, remap);
+    }
+}
+
+/**
+*
+* @brief        Prints an aggregate: the busiest secure calls with their latency,
+*               then the largest entries of every top-K sketch.
+* @param[in]    Aggregate - The aggregate.
+*
+*/
+void
+PrintAggregateReport (
+    _In_ const AGGREGATE* Aggregate
+    )
+{
+    std::vector<const AGGREGATE_SECURE_CALL*> secureCalls;
+
+    for (const auto& secureCall : Aggregate->SecureCalls)
+    {
+        secureCalls.push_back(&secureCall.second);
+    }
+
+    std::sort(secureCalls.begin(),
+              secureCalls.end(),
+              [](const AGGREGATE_SECURE_CALL* Left, const AGGREGATE_SECURE_CALL* Right)
+              {
+                  return (Left->Count > Right->Count);
+              });
+
+    secureCalls.resize((std::min)(secureCalls.size(), static_cast<size_t>(AGGREGATE_REPORT_SECURE_CALLS)));
+
+    wprintf(L"[+] Aggregate of %llu snapshot(s): %llu correlated events over %.1f s, %zu secure calls\n",
+            Aggregate->Snapshots,
+            Aggregate->Events,
+            Aggregate->ExposureSeconds,
+            Aggregate->SecureCalls.size());
+
+    for (const AGGREGATE_SECURE_CALL* secureCall : secureCalls)
+    {
+        wprintf(L"  [>] %hs (%u): %llu calls",
+                Aggregate->Strings[secureCall->NameId].c_str(),
+                secureCall->Number,
+                secureCall->Count);
+
+        if (secureCall->Latencies != 0)
+        {
+            wprintf(L", p50 %.1f us, p99 %.1f us, max %.1f us",
+                    (GetAggregateLatencyPercentile(secureCall, 50) / 1e3),
+                    (GetAggregateLatencyPercentile(secureCall, 99) / 1e3),
+                    (secureCall->LatencyMax / 1e3));
+        }
+
+        wprintf(L"\n");
+    }
+
+    for (ULONG type = 0; type < TopKTrackerCount; type++)
+    {
+        const AGGREGATE_TOP_K* topK;
+        std::vector<const AGGREGATE_TOP_K_ENTRY*> entries;
+        size_t count;
+
+        topK = &Aggregate->TopK[type];
+
+        for (const auto& entry : topK->Entries)
+        {
+            entries.push_back(&entry);
+        }
+
+        count = (std::min)(entries.size(), static_cast<size_t>(TOP_K_REPORT_ENTRIES));
+
+        std::partial_sort(entries.begin(),
+                          entries.begin() + count,
+                          entries.end(),
+                          [](const AGGREGATE_TOP_K_ENTRY* Left, const AGGREGATE_TOP_K_ENTRY* Right)
+                          {
+                              return (Left->Count > Right->Count);
+                          });
+
+        wprintf(L"[+] Top %s (%llu events, %lu counters, unlisted <= %llu):\n",
+                GetTopKTrackerName(static_cast<TOP_K_TRACKER_TYPE>(type)),
+                topK->Total,
+                topK->Capacity,
+                topK->MinimumCount);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const AGGREGATE_TOP_K_ENTRY* entry;
+
+            entry = entries[i];
+
+            wprintf(L"  [>] %llu (+/- %llu)", entry->Count, entry->Error);
+
+            if (type == TopKStacks)
+            {
+                wprintf(L" %hs\n", Aggregate->Strings[entry->Identity[0]].c_str());
+
+                for (size_t j = 1; j < entry->Identity.size(); j++)
+                {
+                    wprintf(L"        %hs\n", Aggregate->Strings[entry->Identity[j]].c_str());
+                }
+
+                continue;
+            }
+
+            for (size_t j = 0; j < entry->Identity.size(); j++)
+            {
+                wprintf(L"%s%hs", ((j == 0) ? L" " : L" - "), Aggregate->Strings[entry->Identity[j]].c_str());
+            }
+
+            wprintf(L"\n");
+        }
+    }
+}
+
+/**
+*
+* @brief        Turns on live aggregation. The snapshot is written on exit.
+* @param[in]    FilePath - The snapshot to write.
+*
+*/
+void
+SetAggregateSnapshot (
+    _In_ const wchar_t* FilePath
+    )
+{
+    k_AggregateSnapshotPath = FilePath;
+    k_AggregationEnabled = true;
+}
+
+/**
+*
+* @brief        Determines if live aggregation is on.
+* @return       true if it is, otherwise false.
+*
+*/
+bool
+IsAggregationEnabled ()
+{
+    return k_AggregationEnabled;
+}
+
+/**
+*
+* @brief        Counts a secure call. Called for every VTL 1 enter.
+* @param[in]    TimeStamp - The event's raw (QPC) timestamp.
+* @param[in]    SecureCallNumber - The secure call number.
+*
+*/
+void
+RecordAggregateSecureCall (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG SecureCallNumber
+    )
+{
+    if (!k_AggregationEnabled)
+    {
+        return;
+    }
+
+    //
+    // Events from different processors may arrive slightly out of order.
+    //
+    if ((k_AggregateFirstTimeStamp == 0) ||
+        (TimeStamp < k_AggregateFirstTimeStamp))
+    {
+        k_AggregateFirstTimeStamp = TimeStamp;
+    }
+
+    k_AggregateLastTimeStamp = (std::max)(k_AggregateLastTimeStamp, TimeStamp);
+
+    k_LiveSecureCalls[SecureCallNumber].Count++;
+}
+
+/**
+*
+* @brief        Adds a timed secure call to its latency histogram.
+* @param[in]    SecureCallNumber - The secure call number.
+* @param[in]    Latency - The secure call's latency, in QPC ticks.
+*
+*/
+void
+RecordAggregateLatency (
+    _In_ ULONG SecureCallNumber,
+    _In_ ULONGLONG Latency
+    )
+{
+    PAGGREGATE_SECURE_CALL secureCall;
+    uint64_t qpcFrequency;
+    uint64_t nanoseconds;
+
+    if (!k_AggregationEnabled)
+    {
+        return;
+    }
+
+    //
+    // Snapshots are in nanoseconds - QPC frequencies differ between hosts,
+    // and a replayed trace's is not ours.
+    //
+    qpcFrequency = GetSessionClock()->QpcFrequency;
+
+    nanoseconds = (((Latency / qpcFrequency) * 1000000000ULL) +
+                   (((Latency % qpcFrequency) * 1000000000ULL) / qpcFrequency));
+
+    secureCall = &k_LiveSecureCalls[SecureCallNumber];
+
+    if (secureCall->Buckets.empty())
+    {
+        secureCall->Buckets.assign(AGGREGATE_LATENCY_BUCKETS, 0);
+    }
+
+    secureCall->Latencies++;
+    secureCall->LatencySum += nanoseconds;
+    secureCall->LatencyMax = (std::max)(secureCall->LatencyMax, nanoseconds);
+    secureCall->Buckets[GetAggregateLatencyBucket(nanoseconds)]++;
+}
+
+/**
+*
+* @brief        Gets the aggregate name of a live secure call.
+* @param[in]    Aggregate - The aggregate.
+* @param[in]    SecureCallNumber - The secure call number.
+* @return       The string ID.
+*
+*/
+static
+uint32_t
+InternAggregateSecureCall (
+    _Inout_ PAGGREGATE Aggregate,
+    _In_ ULONG SecureCallNumber
+    )
+{
+    return InternAggregateSecureCallName(Aggregate, GetSecureCallName(SecureCallNumber), SecureCallNumber);
+}
+
+/**
+*
+* @brief        Symbolizes a live frame into an aggregate string.
+* @param[in]    Aggregate - The aggregate.
+* @param[in]    Buffer - Scratch buffer.
+* @param[in]    Address - The frame address.
+* @return       The string ID.
+*
+*/
+static
+uint32_t
+InternAggregateFrame (
+    _Inout_ PAGGREGATE Aggregate,
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Address
+    )
+{
+    ResetFormatBuffer(Buffer);
+
+    FormatVtl1Frame(Buffer, static_cast<ULONG_PTR>(Address), FORMAT_NO_SEPARATOR);
+
+    return InternAggregateString(Aggregate, std::string(Buffer->Data.data(), Buffer->Length));
+}
+
+/**
+*
+* @brief        Writes the live aggregates to the snapshot. Called on Vtl1Mon exit,
+*               while symbols, names and the top-K trackers are still around.
+*
+*/
+void
+WriteAggregateSnapshot ()
+{
+    AGGREGATE aggregate;
+    FORMAT_BUFFER buffer;
+
+    if (!k_AggregationEnabled)
+    {
+        return;
+    }
+
+    k_AggregationEnabled = false;
+
+    InitializeAggregate(&aggregate);
+
+    aggregate.Snapshots = 1;
+
+    if (k_AggregateFirstTimeStamp != 0)
+    {
+        aggregate.FirstTime = GetClockTime(GetSessionClock(), k_AggregateFirstTimeStamp);
+        aggregate.LastTime = GetClockTime(GetSessionClock(), k_AggregateLastTimeStamp);
+        aggregate.ExposureSeconds = (static_cast<double>(k_AggregateLastTimeStamp - k_AggregateFirstTimeStamp) /
+                                     GetSessionClock()->QpcFrequency);
+    }
+
+    for (auto& liveCall : k_LiveSecureCalls)
+    {
+        uint32_t nameId;
+
+        nameId = InternAggregateSecureCall(&aggregate, liveCall.first);
+
+        liveCall.second.NameId = nameId;
+        liveCall.second.Number = liveCall.first;
+
+        aggregate.SecureCalls[nameId] = std::move(liveCall.second);
+    }
+
+    //
+    // Entries are keyed by their symbolized identity. Stacks which only
+    // differed by raw address (say, relocated images) become one.
+    //
+    for (ULONG type = 0; type < TopKTrackerCount; type++)
+    {
+        const TOP_K_TRACKER* tracker;
+        PAGGREGATE_TOP_K topK;
+
+        tracker = GetTopKTracker(static_cast<TOP_K_TRACKER_TYPE>(type));
+        topK = &aggregate.TopK[type];
+
+        topK->Capacity = tracker->Capacity;
+        topK->Total = tracker->Total;
+        topK->MinimumCount = GetTopKMinimumCount(tracker);
+
+        for (const auto& trackerEntry : tracker->Entries)
+        {
+            AGGREGATE_TOP_K_ENTRY entry;
+            const TOP_K_SAMPLE* sample;
+
+            sample = &trackerEntry.Sample;
+
+            switch (type)
+            {
+                case TopKStacks:
+                    entry.Identity.push_back(InternAggregateSecureCall(&aggregate, sample->SecureCallNumber));
+
+                    for (ULONG i = 0; i < sample->NumberOfFrames; i++)
+                    {
+                        entry.Identity.push_back(InternAggregateFrame(&aggregate, &buffer, sample->Frames[i]));
+                    }
+                    break;
+
+                case TopKProcesses:
+                    entry.Identity.push_back(InternAggregateString(&aggregate, GetInternedName(sample->ProcessNameId)));
+                    entry.Identity.push_back(InternAggregateSecureCall(&aggregate, sample->SecureCallNumber));
+                    break;
+
+                default:
+                    entry.Identity.push_back(InternAggregateFrame(&aggregate, &buffer, sample->Frames[0]));
+                    break;
+            }
+
+            entry.Key = GetAggregateIdentityKey(&aggregate, entry.Identity);
+            entry.Count = trackerEntry.Count;
+            entry.Error = trackerEntry.Error;
+
+            AddAggregateTopKEntry(topK, std::move(entry));
+        }
+    }
+
+    aggregate.Events = aggregate.TopK[TopKStacks].Total;
+
+    if (SaveAggregateSnapshot(&aggregate, k_AggregateSnapshotPath.c_str()))
+    {
+        wprintf(L"[+] Wrote the aggregate snapshot to %s\n", k_AggregateSnapshotPath.c_str());
+    }
+
+    k_LiveSecureCalls.clear();
+}
+
+/**
+*
+* @brief        Merge worker. Loads snapshots until there are none left and merges
+*               them into its own aggregate.
+* @param[in]    Parameter - The worker (PAGGREGATE_MERGE_WORKER).
+* @return       0.
+*
+*/
+static
+DWORD
+WINAPI
+AggregateMergeWorker (
+    _In_ LPVOID Parameter
+    )
+{
+    PAGGREGATE_MERGE_WORKER worker;
+    AGGREGATE snapshot;
+    LONG index;
+
+    worker = static_cast<PAGGREGATE_MERGE_WORKER>(Parameter);
+
+    for (;;)
+    {
+        index = (_InterlockedIncrement(worker->NextPath) - 1);
+
+        if (index >= static_cast<LONG>(worker->Paths->size()))
+        {
+            break;
+        }
+
+        if (!LoadAggregateSnapshot((*worker->Paths)[index].c_str(), &snapshot))
+        {
+            worker->Failures++;
+            continue;
+        }
+
+        MergeAggregate(&worker->Aggregate, &snapshot);
+    }
+
+    return 0;
+}
+
+/**
+*
+* @brief        Expands the merge inputs: files as-is, directories to the snapshots in them.
+* @param[in]    InputPaths - The user-provided paths.
+* @param[out]   Paths - Receives the snapshot paths.
+*
+*/
+static
+void
+ExpandAggregateInputs (
+    _In_ const std::vector<std::wstring>& InputPaths,
+    _Out_ std::vector<std::wstring>& Paths
+    )
+{
+    Paths.clear();
+
+    for (const auto& inputPath : InputPaths)
+    {
+        DWORD attributes;
+        WIN32_FIND_DATAW findData;
+        HANDLE findHandle;
+
+        attributes = GetFileAttributesW(inputPath.c_str());
+
+        if ((attributes == INVALID_FILE_ATTRIBUTES) ||
+            ((attributes & FILE_ATTRIBUTE_DIRECTORY) == 0))
+        {
+            Paths.push_back(inputPath);
+            continue;
+        }
+
+        findHandle = FindFirstFileW((inputPath + L"\\*" AGGREGATE_SNAPSHOT_EXTENSION).c_str(), &findData);
+        if (findHandle == INVALID_HANDLE_VALUE)
+        {
+            continue;
+        }
+
+        do
+        {
+            if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            {
+                Paths.push_back(inputPath + L"\\" + findData.cFileName);
+            }
+        } while (FindNextFileW(findHandle, &findData) != FALSE);
+
+        FindClose(findHandle);
+    }
+}
+
+/**
+*
+* @brief        Runs the "merge" command: merges snapshots (in parallel) into one.
+* @param[in]    OutputPath - The merged snapshot to write.
+* @param[in]    InputPaths - Snapshots, or directories of them.
+* @param[in]    ThreadCount - The number of worker threads. 0 for one per processor.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+MergeAggregateSnapshots (
+    _In_ const wchar_t* OutputPath,
+    _In_ const std::vector<std::wstring>& InputPaths,
+    _In_ ULONG ThreadCount
+    )
+{
+    bool result;
+    std::vector<std::wstring> paths;
+    std::vector<AGGREGATE_MERGE_WORKER> workers;
+    std::vector<PVOID> parameters;
+    volatile LONG nextPath;
+    SYSTEM_INFO systemInfo;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONGLONG failures;
+    double elapsedMs;
+
+    result = false;
+    nextPath = 0;
+    failures = 0;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    ExpandAggregateInputs(InputPaths, paths);
+
+    if (paths.empty())
+    {
+        wprintf(L"[-] Error! No snapshots to merge.\n");
+        goto Exit;
+    }
+
+    if (ThreadCount == 0)
+    {
+        GetSystemInfo(&systemInfo);
+        ThreadCount = systemInfo.dwNumberOfProcessors;
+    }
+
+    ThreadCount = (std::max)(static_cast<ULONG>(1), (std::min)(ThreadCount, static_cast<ULONG>(MAXIMUM_WAIT_OBJECTS)));
+    ThreadCount = (std::min)(ThreadCount, static_cast<ULONG>(paths.size()));
+
+    workers.resize(ThreadCount);
+
+    for (auto& worker : workers)
+    {
+        worker.Paths = &paths;
+        worker.NextPath = &nextPath;
+        worker.Failures = 0;
+
+        InitializeAggregate(&worker.Aggregate);
+
+        parameters.push_back(&worker);
+    }
+
+    if (!RunWorkerThreads(AggregateMergeWorker, parameters))
+    {
+        goto Exit;
+    }
+
+    //
+    // Fold the workers' aggregates into the first.
+    //
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        failures += workers[i].Failures;
+
+        if (i != 0)
+        {
+            MergeAggregate(&workers[0].Aggregate, &workers[i].Aggregate);
+        }
+    }
+
+    if (!SaveAggregateSnapshot(&workers[0].Aggregate, OutputPath))
+    {
+        goto Exit;
+    }
+
+    QueryPerformanceCounter(&end);
+
+    elapsedMs = (static_cast<double>(end.QuadPart - start.QuadPart) * 1e3 / frequency.QuadPart);
+
+    PrintAggregateReport(&workers[0].Aggregate);
+
+    wprintf(L"[+] Merge statistics:\n");
+    wprintf(L"  [>] Snapshots merged: %llu of %zu (%llu failed)\n", (paths.size() - failures), paths.size(), failures);
+    wprintf(L"  [>] Threads: %lu\n", ThreadCount);
+    wprintf(L"  [>] Strings: %zu\n", workers[0].Aggregate.Strings.size());
+    wprintf(L"  [>] Time: %.2f ms (%.0f snapshots/s)\n",
+            elapsedMs,
+            ((elapsedMs > 0) ? (paths.size() * 1e3 / elapsedMs) : 0.0));
+
+    result = (failures == 0);
+
+Exit:
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,637 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Anomaly.cpp
+*
+* @summary:   Streaming secure call rate anomaly detection. Every (process, secure
+*             call) pair has a baseline - an EWMA of its per-interval count and
+*             variance - in a fixed-size table, updated from the correlation path.
+*             An interval well above its baseline raises an alert with the
+*             stacks which made the calls.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Anomaly.hpp"
+#include "TopK.hpp"
+#include <math.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include "Helpers.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Clock.hpp"
+#include <stdio.h>
+#endif
+
+/**
+*
+* @brief        Finds the slot holding a key.
+* @param[in]    Detector - The detector.
+* @param[in]    Key - The key.
+* @return       The slot, or the empty slot where the key would go.
+*
+*/
+static
+size_t
+FindAnomalySlot (
+    _In_ const ANOMALY_DETECTOR* Detector,
+    _In_ uint64_t Key
+    )
+{
+    size_t slot;
+    size_t mask;
+
+    mask = (Detector->Slots.size() - 1);
+    slot = static_cast<size_t>(HashTopKKey(0, Key) & mask);
+
+    //
+    // The table is at most half full, so there is always an empty slot.
+    //
+    while ((Detector->Slots[slot].InUse) &&
+           (Detector->Slots[slot].Key != Key))
+    {
+        slot = ((slot + 1) & mask);
+    }
+
+    return slot;
+}
+
+/**
+*
+* @brief        Sets up a detector.
+* @param[out]   Detector - The detector.
+* @param[in]    Capacity - The most (process, secure call) pairs to keep baselines for.
+* @param[in]    Score - Standard deviations above the baseline which raise an alert.
+*
+*/
+void
+InitializeAnomalyDetector (
+    _Out_ PANOMALY_DETECTOR Detector,
+    _In_ uint32_t Capacity,
+    _In_ double Score
+    )
+{
+    size_t slots;
+
+    slots = 1;
+
+    while (slots < (static_cast<size_t>(Capacity) * 2))
+    {
+        slots <<= 1;
+    }
+
+    Detector->Slots.assign(slots, ANOMALY_ENTRY());
+    Detector->Capacity = Capacity;
+    Detector->Used = 0;
+    Detector->Score = Score;
+    Detector->Interval = 0;
+    Detector->Events = 0;
+    Detector->Untracked = 0;
+    Detector->Dropped = 0;
+    Detector->Alerts = 0;
+}
+
+/**
+*
+* @brief        Counts an event against its (process, secure call) pair, and its
+*               stack against the pair's heaviest stacks this interval.
+* @param[in]    Detector - The detector.
+* @param[in]    Key - The (process, secure call) pair.
+* @param[in]    ProcessId - The process (for the alert).
+* @param[in]    StackKey - The stack's hash.
+* @param[in]    Frames - The stack (kept if it claims a counter).
+* @param[in]    NumberOfFrames - The number of frames.
+*
+*/
+void
+CountAnomalyEvent (
+    _Inout_ PANOMALY_DETECTOR Detector,
+    _In_ uint64_t Key,
+    _In_ uint32_t ProcessId,
+    _In_ uint64_t StackKey,
+    _In_ const uint64_t* Frames,
+    _In_ uint32_t NumberOfFrames
+    )
+{
+    PANOMALY_ENTRY entry;
+    PANOMALY_STACK smallest;
+
+    Detector->Events++;
+
+    entry = &Detector->Slots[FindAnomalySlot(Detector, Key)];
+
+    if (!entry->InUse)
+    {
+        if (Detector->Used >= Detector->Capacity)
+        {
+            Detector->Untracked++;
+            return;
+        }
+
+        *entry = ANOMALY_ENTRY();
+        entry->InUse = true;
+        entry->Key = Key;
+
+        Detector->Used++;
+    }
+
+    entry->Count++;
+    entry->ProcessId = ProcessId;
+
+    //
+    // Space-Saving over a handful of counters: the heaviest stacks of the
+    // interval keep theirs.
+    //
+    smallest = &entry->Stacks[0];
+
+    for (auto& stack : entry->Stacks)
+    {
+        if ((stack.Count != 0) &&
+            (stack.Key == StackKey))
+        {
+            stack.Count++;
+            return;
+        }
+
+        if (stack.Count < smallest->Count)
+        {
+            smallest = &stack;
+        }
+    }
+
+    NumberOfFrames = (std::min)(NumberOfFrames, static_cast<uint32_t>(ANOMALY_STACK_FRAMES));
+
+    smallest->Key = StackKey;
+    smallest->Error = smallest->Count;
+    smallest->Count++;
+    smallest->NumberOfFrames = NumberOfFrames;
+
+    for (uint32_t i = 0; i < NumberOfFrames; i++)
+    {
+        smallest->Frames[i] = Frames[i];
+    }
+}
+
+/**
+*
+* @brief        Ends an interval: checks every baseline against the interval's
+*               count, then folds the count into it. Baselines which have gone
+*               idle are dropped.
+* @param[in]    Detector - The detector.
+* @param[out]   Alerts - Receives the alerts.
+*
+*/
+void
+EvaluateAnomalyDetector (
+    _Inout_ PANOMALY_DETECTOR Detector,
+    _Out_ std::vector<ANOMALY_ALERT>& Alerts
+    )
+{
+    std::vector<ANOMALY_ENTRY> kept;
+    bool dropped;
+
+    Alerts.clear();
+
+    dropped = false;
+
+    Detector->Interval++;
+
+    for (auto& entry : Detector->Slots)
+    {
+        double count;
+        double difference;
+        double increment;
+
+        if (!entry.InUse)
+        {
+            continue;
+        }
+
+        count = static_cast<double>(entry.Count);
+
+        if (entry.Intervals >= ANOMALY_WARMUP_INTERVALS)
+        {
+            double standardDeviation;
+            double score;
+
+            //
+            // Counts are at least Poisson noisy, however steady the baseline.
+            //
+            standardDeviation = sqrt((std::max)(entry.Variance, (std::max)(entry.Mean, 1.0)));
+            score = ((count - entry.Mean) / standardDeviation);
+
+            if ((score >= Detector->Score) &&
+                (entry.Count >= ANOMALY_MIN_EVENTS) &&
+                ((entry.LastAlert == 0) ||
+                 ((Detector->Interval - entry.LastAlert) >= ANOMALY_HOLDOFF_INTERVALS)))
+            {
+                ANOMALY_ALERT alert;
+
+                alert.Key = entry.Key;
+                alert.ProcessId = entry.ProcessId;
+                alert.Count = entry.Count;
+                alert.Mean = entry.Mean;
+                alert.StandardDeviation = standardDeviation;
+                alert.Score = score;
+
+                for (size_t i = 0; i < ANOMALY_STACKS; i++)
+                {
+                    alert.Stacks[i] = entry.Stacks[i];
+                }
+
+                Alerts.push_back(alert);
+
+                entry.LastAlert = Detector->Interval;
+                Detector->Alerts++;
+            }
+        }
+
+        //
+        // EWMA of the count and of the variance around it.
+        //
+        if (entry.Intervals == 0)
+        {
+            entry.Mean = count;
+        }
+        else
+        {
+            difference = (count - entry.Mean);
+            increment = (ANOMALY_SMOOTHING * difference);
+
+            entry.Mean += increment;
+            entry.Variance = ((1.0 - ANOMALY_SMOOTHING) * (entry.Variance + (difference * increment)));
+        }
+
+        entry.Intervals++;
+
+        if ((entry.Count == 0) &&
+            (entry.Mean < ANOMALY_IDLE_MEAN))
+        {
+            entry.InUse = false;
+            dropped = true;
+
+            Detector->Used--;
+            Detector->Dropped++;
+        }
+
+        entry.Count = 0;
+
+        for (auto& stack : entry.Stacks)
+        {
+            stack.Count = 0;
+            stack.Error = 0;
+        }
+    }
+
+    //
+    // Dropping breaks probe chains - put the survivors back.
+    //
+    if (!dropped)
+    {
+        return;
+    }
+
+    for (auto& entry : Detector->Slots)
+    {
+        if (entry.InUse)
+        {
+            kept.push_back(entry);
+            entry.InUse = false;
+        }
+    }
+
+    for (const auto& entry : kept)
+    {
+        Detector->Slots[FindAnomalySlot(Detector, entry.Key)] = entry;
+    }
+}
+
+/**
+*
+* @brief        Folds intervals in which nothing happened into the baselines, so
+*               an idle stretch decays them as much as its length says. Empty
+*               intervals cannot alert.
+* @param[in]    Detector - The detector.
+* @param[in]    Intervals - The number of empty intervals. At most
+*               ANOMALY_MAX_IDLE_INTERVALS are folded in.
+*
+*/
+void
+SkipAnomalyIntervals (
+    _Inout_ PANOMALY_DETECTOR Detector,
+    _In_ uint64_t Intervals
+    )
+{
+    std::vector<ANOMALY_ALERT> alerts;
+
+    Intervals = (std::min)(Intervals, static_cast<uint64_t>(ANOMALY_MAX_IDLE_INTERVALS));
+
+    for (uint64_t i = 0; i < Intervals; i++)
+    {
+        if (Detector->Used == 0)
+        {
+            break;
+        }
+
+        EvaluateAnomalyDetector(Detector, alerts);
+    }
+}
+
+#ifdef _WIN32
+//
+// The live detector. Only the ETW processing thread touches it.
+//
+static ANOMALY_DETECTOR k_AnomalyDetector;
+static bool k_AnomalyDetectionEnabled = false;
+static ULONG k_AnomalyIntervalMs = 0;
+static ULONGLONG k_AnomalyIntervalTicks = 0;
+static ULONGLONG k_AnomalyIntervalStart = 0;
+static ULONGLONG k_AnomalyEvaluateTicks = 0;
+static HANDLE k_AnomalyLogHandle = INVALID_HANDLE_VALUE;
+static std::vector<ANOMALY_ALERT> k_AnomalyAlerts;
+static FORMAT_BUFFER k_AnomalyBuffer;
+
+/**
+*
+* @brief        Turns on anomaly detection.
+* @param[in]    IntervalMs - The interval rates are counted over.
+* @param[in]    Score - Standard deviations above the baseline which raise an alert.
+* @param[in]    LogPath - A file to append alerts to as well as printing them. Optional.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+SetAnomalyDetection (
+    _In_ ULONG IntervalMs,
+    _In_ double Score,
+    _In_opt_ const wchar_t* LogPath
+    )
+{
+    if (LogPath != NULL)
+    {
+        k_AnomalyLogHandle = CreateFileW(LogPath,
+                                         FILE_APPEND_DATA,
+                                         FILE_SHARE_READ,
+                                         NULL,
+                                         OPEN_ALWAYS,
+                                         0,
+                                         NULL);
+        if (k_AnomalyLogHandle == INVALID_HANDLE_VALUE)
+        {
+            wprintf(L"[-] Error! CreateFileW failed in SetAnomalyDetection. (GLE: %d)\n", GetLastError());
+            return false;
+        }
+    }
+
+    IntervalMs = (std::max)(IntervalMs, static_cast<ULONG>(1));
+
+    k_AnomalyIntervalMs = IntervalMs;
+    k_AnomalyIntervalTicks = 0;
+    k_AnomalyIntervalStart = 0;
+    k_AnomalyEvaluateTicks = 0;
+
+    InitializeAnomalyDetector(&k_AnomalyDetector, ANOMALY_DEFAULT_CAPACITY, Score);
+
+    k_AnomalyDetectionEnabled = true;
+
+    return true;
+}
+
+/**
+*
+* @brief        Converts the interval to ticks of the event timestamps.
+* @param[in]    QpcFrequency - The session clock's QPC frequency.
+*
+*/
+void
+SetAnomalyQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    )
+{
+    k_AnomalyIntervalTicks = ((static_cast<ULONGLONG>(k_AnomalyIntervalMs) * QpcFrequency) / 1000);
+}
+
+/**
+*
+* @brief        Determines if anomaly detection is on.
+* @return       true if it is, otherwise false.
+*
+*/
+bool
+IsAnomalyDetectionEnabled ()
+{
+    return k_AnomalyDetectionEnabled;
+}
+
+/**
+*
+* @brief        Prints (and logs) the alerts of an interval, each with the
+*               stacks which made the most calls.
+* @param[in]    TimeStamp - The raw (QPC) timestamp the interval started at.
+*
+*/
+static
+void
+ReportAnomalies (
+    _In_ ULONGLONG TimeStamp
+    )
+{
+    DWORD bytesWritten;
+
+    if (k_AnomalyAlerts.empty())
+    {
+        return;
+    }
+
+    ResetFormatBuffer(&k_AnomalyBuffer);
+
+    for (const auto& alert : k_AnomalyAlerts)
+    {
+        //
+        // Stamped with when the interval happened, not when it was noticed
+        // (a replay can be years later).
+        //
+        FormatAppend(&k_AnomalyBuffer, "[!] ", 4);
+        FormatAppendTime(&k_AnomalyBuffer, GetClockTime(GetSessionClock(), TimeStamp));
+        FormatAppendPrintf(&k_AnomalyBuffer, " Anomaly: %s (PID %u) - %s (%u): %llu calls in %lu ms, baseline %.1f +/- %.1f (score %.1f)\n",
+                           GetInternedName(static_cast<ULONG>(alert.Key >> 16)),
+                           alert.ProcessId,
+                           GetSecureCallName(static_cast<ULONG>(alert.Key & 0xFFFF)),
+                           static_cast<ULONG>(alert.Key & 0xFFFF),
+                           alert.Count,
+                           k_AnomalyIntervalMs,
+                           alert.Mean,
+                           alert.StandardDeviation,
+                           alert.Score);
+
+        for (const auto& stack : alert.Stacks)
+        {
+            if (stack.Count == 0)
+            {
+                continue;
+            }
+
+            FormatAppendPrintf(&k_AnomalyBuffer, "    %llu (+/- %llu) calls from:\n", stack.Count, stack.Error);
+
+            for (uint32_t i = 0; i < stack.NumberOfFrames; i++)
+            {
+                FormatAppend(&k_AnomalyBuffer, "        ", 8);
+
+                FormatVtl1Frame(&k_AnomalyBuffer, static_cast<ULONG_PTR>(stack.Frames[i]), '\n');
+            }
+        }
+    }
+
+    if ((k_AnomalyLogHandle != INVALID_HANDLE_VALUE) &&
+        ((WriteFile(k_AnomalyLogHandle,
+                    k_AnomalyBuffer.Data.data(),
+                    static_cast<DWORD>(k_AnomalyBuffer.Length),
+                    &bytesWritten,
+                    NULL) == FALSE) ||
+         (bytesWritten != k_AnomalyBuffer.Length)))
+    {
+        wprintf(L"[-] Error! WriteFile failed in ReportAnomalies. (GLE: %d)\n", GetLastError());
+    }
+
+    FormatAppendChar(&k_AnomalyBuffer, '\0');
+
+    wprintf(L"%hs", k_AnomalyBuffer.Data.data());
+}
+
+/**
+*
+* @brief        Counts a correlated event. Evaluates the baselines first if the
+*               event starts a new interval.
+* @param[in]    Vtl1Data - The "primal" VTL 1 enter event data.
+* @param[in]    CallStack - The raw list of stack frame addresses.
+* @param[in]    NumberOfFrames - The number of stack frames.
+*
+*/
+void
+TrackAnomalyEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    ULONGLONG timeStamp;
+    uint64_t stackKey;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    static_assert(sizeof(ULONG_PTR) == sizeof(uint64_t), "Frames are kept as 64-bit addresses.");
+
+    timeStamp = static_cast<ULONGLONG>(Vtl1Data->Vtl1EnterTime);
+
+    //
+    // Intervals are in event time. The intervals of an idle stretch are
+    // each folded in as empty.
+    //
+    if (k_AnomalyIntervalStart == 0)
+    {
+        k_AnomalyIntervalStart = timeStamp;
+    }
+    else if ((timeStamp > k_AnomalyIntervalStart) &&
+             ((timeStamp - k_AnomalyIntervalStart) >= k_AnomalyIntervalTicks))
+    {
+        ULONGLONG elapsed;
+
+        elapsed = ((timeStamp - k_AnomalyIntervalStart) / k_AnomalyIntervalTicks);
+
+        QueryPerformanceCounter(&start);
+
+        EvaluateAnomalyDetector(&k_AnomalyDetector, k_AnomalyAlerts);
+
+        SkipAnomalyIntervals(&k_AnomalyDetector, (elapsed - 1));
+
+        QueryPerformanceCounter(&end);
+
+        k_AnomalyEvaluateTicks += (end.QuadPart - start.QuadPart);
+
+        ReportAnomalies(k_AnomalyIntervalStart);
+
+        k_AnomalyIntervalStart += (elapsed * k_AnomalyIntervalTicks);
+    }
+
+    NumberOfFrames = (std::min)(NumberOfFrames, static_cast<ULONG>(ANOMALY_STACK_FRAMES));
+
+    stackKey = HashTopKKey(0, Vtl1Data->SecureCallNumber);
+
+    for (ULONG i = 0; i < NumberOfFrames; i++)
+    {
+        stackKey = HashTopKKey(stackKey, CallStack[i]);
+    }
+
+    //
+    // By process name, so PID reuse does not split (or merge) baselines.
+    //
+    CountAnomalyEvent(&k_AnomalyDetector,
+                      ((static_cast<uint64_t>(Vtl1Data->ProcessNameId) << 16) | Vtl1Data->SecureCallNumber),
+                      Vtl1Data->ProcessId,
+                      stackKey,
+                      reinterpret_cast<const uint64_t*>(CallStack),
+                      NumberOfFrames);
+}
+
+/**
+*
+* @brief        Prints the detector statistics and frees it. Called on Vtl1Mon exit.
+*
+*/
+void
+StopAnomalyDetection ()
+{
+    LARGE_INTEGER frequency;
+
+    if (!k_AnomalyDetectionEnabled)
+    {
+        return;
+    }
+
+    k_AnomalyDetectionEnabled = false;
+
+    //
+    // The interval still open when the trace ended is evaluated as it
+    // stands, so a burst right before exit is not lost.
+    //
+    if (k_AnomalyIntervalStart != 0)
+    {
+        EvaluateAnomalyDetector(&k_AnomalyDetector, k_AnomalyAlerts);
+
+        ReportAnomalies(k_AnomalyIntervalStart);
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    wprintf(L"[+] Anomaly detection statistics:\n");
+    wprintf(L"  [>] Events: %llu (%llu untracked, the baseline table was full)\n",
+            k_AnomalyDetector.Events,
+            k_AnomalyDetector.Untracked);
+    wprintf(L"  [>] Baselines: %lu of %lu (%zu KB), %llu dropped when idle\n",
+            k_AnomalyDetector.Used,
+            k_AnomalyDetector.Capacity,
+            ((k_AnomalyDetector.Slots.size() * sizeof(ANOMALY_ENTRY)) / 1024),
+            k_AnomalyDetector.Dropped);
+    wprintf(L"  [>] Intervals evaluated: %llu (%.1f us each)\n",
+            k_AnomalyDetector.Interval,
+            ((k_AnomalyDetector.Interval != 0) ?
+             ((static_cast<double>(k_AnomalyEvaluateTicks) * 1e6 / frequency.QuadPart) / k_AnomalyDetector.Interval) :
+             0.0));
+    wprintf(L"  [>] Alerts: %llu\n", k_AnomalyDetector.Alerts);
+
+    if (k_AnomalyLogHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(k_AnomalyLogHandle);
+        k_AnomalyLogHandle = INVALID_HANDLE_VALUE;
+    }
+
+    k_AnomalyDetector.Slots.clear();
+    k_AnomalyDetector.Slots.shrink_to_fit();
+    k_AnomalyAlerts.clear();
+}
+#endif
\ No newline at end of file
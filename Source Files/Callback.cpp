@@ -12,10 +12,19 @@
 *
 --*/
 #include "Callback.hpp"
+#include "EventViews.hpp"
 #include "Nodes.hpp"
 #include "Helpers.hpp"
 #include "Symbols.hpp"
+#include "Processes.hpp"
+#include "RawCapture.hpp"
+#include "FlightRecorder.hpp"
+#include "Aggregate.hpp"
+#include "Rollup.hpp"
+#include "Timeline.hpp"
+#include "Sequence.hpp"
 #include <stdio.h>
+#include <unordered_map>
 
 //
 // From Trace.cpp
@@ -32,50 +41,125 @@ volatile LONG g_ContinueTracing = TRUE;
 //
 ULONGLONG g_TotalEventsSeen = 0;
 
+//
+// Secure calls being timed, by thread. Only kept when something
+// (the flight recorder latency trigger, aggregation, rollups, the timeline)
+// wants latencies.
+//
+static std::unordered_map<ULONG, VTL1_CALL_START> k_Vtl1CallStarts;
+
 /**
 *
-* @brief        VTL 1 enter/exit ETW callback.
+* @brief        VTL 1 enter ETW handler.
 * @param[in]    EventRecord - Associated ETW event record.
 *
 */
 static
 _Function_class_(PEVENT_RECORD_CALLBACK)
 void
-HandleVtl1EnterExitEvents (
+HandleVtl1EnterEvent (
     _In_ PEVENT_RECORD EventRecord
     )
 {
-    PSECURE_CALL_EVENT_DATA secureCallEventData;
-
-    secureCallEventData = NULL;
+    SECURE_CALL_EVENT_VIEW secureCallEvent;
 
     if (EventRecord->EventHeader.ProcessId == GetCurrentProcessId())
     {
         goto Exit;
     }
 
-    if (EventRecord->UserDataLength != VTL1_ENTER_EXIT_EVENT_SIZE)
+    if (!secureCallEvent.Parse(EventRecord))
     {
         goto Exit;
     }
 
-    secureCallEventData = reinterpret_cast<PSECURE_CALL_EVENT_DATA>(EventRecord->UserData);
-    if (secureCallEventData == NULL)
+    g_TotalEventsSeen++;
+
+    //
+    // Before correlation, which may hand the call's stack straight back.
+    //
+    RecordSequenceSecureCall(static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart),
+                             EventRecord->EventHeader.ThreadId,
+                             secureCallEvent->SecureCallNumber);
+
+    InsertVtl1EnterEventData(static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart),
+                             EventRecord->EventHeader.ProcessId,
+                             EventRecord->EventHeader.ThreadId,
+                             secureCallEvent->SecureCallNumber);
+
+    NoteFlightRecorderSecureCall(static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart));
+
+    RecordAggregateSecureCall(static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart),
+                              secureCallEvent->SecureCallNumber);
+
+    RecordRollupSecureCall(static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart),
+                           EventRecord->EventHeader.ProcessId,
+                           secureCallEvent->SecureCallNumber);
+
+    if ((IsFlightRecorderTimingSecureCalls()) ||
+        (IsAggregationEnabled()) ||
+        (IsRollupEnabled()) ||
+        (IsTimelineEnabled()))
+    {
+        PVTL1_CALL_START callStart;
+
+        callStart = &k_Vtl1CallStarts[EventRecord->EventHeader.ThreadId];
+        callStart->TimeStamp = static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart);
+        callStart->ProcessId = EventRecord->EventHeader.ProcessId;
+        callStart->SecureCallNumber = secureCallEvent->SecureCallNumber;
+    }
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        VTL 1 exit ETW handler. Times the secure call the thread made.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+static
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+HandleVtl1ExitEvent (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    std::unordered_map<ULONG, VTL1_CALL_START>::iterator callStart;
+    ULONGLONG timeStamp;
+    ULONGLONG latency;
+
+    if (EventRecord->EventHeader.ProcessId == GetCurrentProcessId())
     {
         goto Exit;
     }
 
-    if (EventRecord->EventHeader.EventDescriptor.Opcode != VTL1_ENTER_OPCODE)
+    callStart = k_Vtl1CallStarts.find(EventRecord->EventHeader.ThreadId);
+    if (callStart == k_Vtl1CallStarts.end())
     {
         goto Exit;
     }
 
-    g_TotalEventsSeen++;
+    timeStamp = static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart);
+    latency = ((timeStamp > callStart->second.TimeStamp) ? (timeStamp - callStart->second.TimeStamp) : 0);
 
-    InsertVtl1EnterEventData(static_cast<ULONGLONG>(EventRecord->EventHeader.TimeStamp.QuadPart),
-                             EventRecord->EventHeader.ProcessId,
-                             EventRecord->EventHeader.ThreadId,
-                             secureCallEventData->SecureCallNumber);
+    NoteFlightRecorderSecureCallLatency(latency);
+
+    RecordAggregateLatency(callStart->second.SecureCallNumber, latency);
+
+    RecordRollupLatency(timeStamp,
+                        callStart->second.ProcessId,
+                        callStart->second.SecureCallNumber,
+                        latency);
+
+    RecordTimelineSlice(callStart->second.TimeStamp,
+                        timeStamp,
+                        callStart->second.ProcessId,
+                        callStart->first,
+                        callStart->second.SecureCallNumber);
+
+    k_Vtl1CallStarts.erase(callStart);
 
 Exit:
     return;
@@ -83,26 +167,23 @@ Exit:
 
 /**
 *
-* @brief        VTL 1 enter/exit stack walk ETW callback.
+* @brief        VTL 1 enter/exit stack walk ETW handler.
 * @param[in]    EventRecord - Associated ETW event record.
 *
 */
 static
 _Function_class_(PEVENT_RECORD_CALLBACK)
 void
-HandleStackWalkEvents (
+HandleStackWalkEvent (
     _In_ PEVENT_RECORD EventRecord
     )
 {
-    PSTACK_WALK_EVENT_DATA stackWalkEvent;
-    ULONG_PTR* stack;
-    ULONG numberOfFrames;
-
-    stackWalkEvent = reinterpret_cast<PSTACK_WALK_EVENT_DATA>(EventRecord->UserData);
-    numberOfFrames = ((EventRecord->UserDataLength -
-                       FIELD_OFFSET(STACK_WALK_EVENT_DATA, Stack)) / sizeof(ULONG_PTR));
+    STACK_WALK_EVENT_VIEW stackWalkEvent;
 
-    if (numberOfFrames == 0)
+    //
+    // Rejects records without at least one whole frame.
+    //
+    if (!stackWalkEvent.Parse(EventRecord))
     {
         goto Exit;
     }
@@ -112,11 +193,9 @@ HandleStackWalkEvents (
         goto Exit;
     }
 
-    stack = &stackWalkEvent->Stack;
-
     CorrelateVtl1EnterCallStack(stackWalkEvent->EventTimeStamp,
-                                stack,
-                                numberOfFrames);
+                                stackWalkEvent.Elements(),
+                                stackWalkEvent.ElementCount());
 
 Exit:
     return;
@@ -124,56 +203,52 @@ Exit:
 
 /**
 *
-* @brief        Image load ETW callback.
+* @brief        Image load (and image load rundown) ETW handler.
 * @param[in]    EventRecord - Associated ETW event record.
 *
 */
 static
 _Function_class_(PEVENT_RECORD_CALLBACK)
 void
-HandleImageLoadEvents (
+HandleImageLoadEvent (
     _In_ PEVENT_RECORD EventRecord
     )
 {
-    PIMAGE_LOAD_EVENT_DATA imageLoadEvent;
-    UCHAR opcode;
-
-    imageLoadEvent = reinterpret_cast<PIMAGE_LOAD_EVENT_DATA>(EventRecord->UserData);
+    IMAGE_LOAD_EVENT_VIEW imageLoadEvent;
 
-    opcode = EventRecord->EventHeader.EventDescriptor.Opcode;
-    if ((opcode != IMAGE_LOADED_RUNDOWN_OPCODE) &&
-        (opcode != IMAGE_LOADED_OPCODE))
+    //
+    // Rejects records whose file name is not terminated inside the payload.
+    //
+    if (!imageLoadEvent.Parse(EventRecord))
     {
-        //
-        // We do not get a rundown "end" event with image loads.
-        // So we use a "hack" here. The first image unload event
-        // we get indicates that the rundown must be over.
-        //
-        if (opcode == IMAGE_LOADED_UNLOAD)
-        {
-            //
-            // One-time init
-            //
-            if (!k_ImageRunDownComplete)
-            {
-                k_ImageRunDownComplete = true;
-
-                //
-                // Set the event
-                //
-                SetEvent(g_EnableVtl1EnterExitEvent);
-            }
-        }
-
         goto Exit;
     }
 
+    //
+    // Deferred symbolization (raw capture or flight recorder) needs every
+    // load, per process - including the ones the image map below treats
+    // as duplicates.
+    //
+    WriteRawCaptureModule(imageLoadEvent->ImageBase,
+                          static_cast<ULONG>(imageLoadEvent->ImageSize),
+                          imageLoadEvent->TimeDateStamp,
+                          imageLoadEvent->ImageChecksum,
+                          imageLoadEvent->ProcessId,
+                          imageLoadEvent.Name());
+
+    RecordFlightRecorderModule(imageLoadEvent->ImageBase,
+                               static_cast<ULONG>(imageLoadEvent->ImageSize),
+                               imageLoadEvent->TimeDateStamp,
+                               imageLoadEvent->ImageChecksum,
+                               imageLoadEvent->ProcessId,
+                               imageLoadEvent.Name());
+
     //
     // Insert the image
     //
     if (!InsertImage(imageLoadEvent->ImageBase,
                      static_cast<ULONG>(imageLoadEvent->ImageSize),
-                     &imageLoadEvent->FileName))
+                     imageLoadEvent.Name()))
     {
         //
         // We had an error or a duplicate. Do not send to symbols.
@@ -185,8 +260,10 @@ HandleImageLoadEvents (
     // Capture the symbols
     //
     if (!CaptureModuleForSymbols(imageLoadEvent->ImageBase,
-                                 &imageLoadEvent->FileName,
-                                 static_cast<ULONG>(imageLoadEvent->ImageSize)))
+                                 imageLoadEvent.Name(),
+                                 static_cast<ULONG>(imageLoadEvent->ImageSize),
+                                 imageLoadEvent->TimeDateStamp,
+                                 imageLoadEvent->ImageChecksum))
     {
         goto Exit;
     }
@@ -197,47 +274,360 @@ Exit:
 
 /**
 *
-* @brief        Main ETW callback. Invokes "lower-level callbacks" based on
-*               provider GUID.
+* @brief        Image unload ETW handler.
 * @param[in]    EventRecord - Associated ETW event record.
 *
 */
+static
 _Function_class_(PEVENT_RECORD_CALLBACK)
 void
-EtwEventCallback (
+HandleImageUnloadEvent (
     _In_ PEVENT_RECORD EventRecord
     )
 {
+    UNREFERENCED_PARAMETER(EventRecord);
+
     //
-    // VTL 1 enter/exit events
-    // 
-    // For whatever reason these come in on the Thread GUID
-    // and not the PerfInfo GUID!
+    // We do not get a rundown "end" event with image loads.
+    // So we use a "hack" here. The first image unload event
+    // we get indicates that the rundown must be over.
     //
-    if (IsEqualGUID(ThreadGuid,
-                    EventRecord->EventHeader.ProviderId) == TRUE)
+    if (!k_ImageRunDownComplete)
+    {
+        k_ImageRunDownComplete = true;
+
+        //
+        // Set the event
+        //
+        SetEvent(g_EnableVtl1EnterExitEvent);
+    }
+}
+
+/**
+*
+* @brief        Process start (and process rundown) ETW handler.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+static
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+HandleProcessStartEvent (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    PROCESS_EVENT_VIEW processEvent;
+    ULONGLONG startTime;
+
+    startTime = 0;
+
+    //
+    // Older layouts do not carry the flags field.
+    //
+    if (EventRecord->EventHeader.EventDescriptor.Version < PROCESS_EVENT_MIN_VERSION)
+    {
+        goto Exit;
+    }
+
+    //
+    // Walks the SID and rejects records without a terminated image name.
+    //
+    if (!processEvent.Parse(EventRecord))
+    {
+        goto Exit;
+    }
+
+    //
+    // Rundown events describe processes which started before the trace.
+    //
+    if (EventRecord->EventHeader.EventDescriptor.Opcode == PROCESS_START_OPCODE)
+    {
+        startTime = EventRecord->EventHeader.TimeStamp.QuadPart;
+    }
+
+    InsertProcess(processEvent->ProcessId,
+                  startTime,
+                  processEvent.Name(),
+                  processEvent.NameLength());
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        Process end ETW handler.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+static
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+HandleProcessEndEvent (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    PROCESS_END_EVENT_VIEW processEvent;
+
+    if (!processEvent.Parse(EventRecord))
+    {
+        goto Exit;
+    }
+
+    //
+    // Drop exited processes so a reused PID never resolves to the old image.
+    //
+    RemoveProcess(processEvent->ProcessId,
+                  EventRecord->EventHeader.TimeStamp.QuadPart);
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        Thread start (and thread rundown) ETW handler.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+static
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+HandleThreadStartEvent (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    THREAD_EVENT_VIEW threadEvent;
+
+    if (!threadEvent.Parse(EventRecord))
+    {
+        goto Exit;
+    }
+
+    InsertThread(threadEvent->ProcessId,
+                 threadEvent->ThreadId);
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        Thread end ETW handler.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+static
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+HandleThreadEndEvent (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    THREAD_EVENT_VIEW threadEvent;
+
+    if (!threadEvent.Parse(EventRecord))
     {
-        HandleVtl1EnterExitEvents(EventRecord);
+        goto Exit;
     }
 
+    RemoveThread(threadEvent->ThreadId);
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        Thread name (SetThreadDescription) ETW handler.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+static
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+HandleThreadSetNameEvent (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    THREAD_SET_NAME_EVENT_VIEW setNameEvent;
+
+    if (!setNameEvent.Parse(EventRecord))
+    {
+        goto Exit;
+    }
+
+    SetThreadName(setNameEvent->ProcessId,
+                  setNameEvent->ThreadId,
+                  setNameEvent.Name(),
+                  setNameEvent.NameLength());
+
+Exit:
+    return;
+}
+
+//
+// Every (provider, opcode) we consume. To handle a new event, write a
+// handler above and add a row here - the dispatch table is generated
+// from this list at compile time.
+//
+static constexpr EVENT_HANDLER_ENTRY k_EventHandlers[] =
+{
+    //
+    // VTL 1 enter/exit events. For whatever reason these come in
+    // on the Thread GUID and not the PerfInfo GUID!
+    //
+    { &ThreadGuid, THREAD_PROVIDER_DATA1, VTL1_ENTER_OPCODE, HandleVtl1EnterEvent },
+    { &ThreadGuid, THREAD_PROVIDER_DATA1, VTL1_EXIT_OPCODE, HandleVtl1ExitEvent },
+
+    //
+    // Thread name cache
+    //
+    { &ThreadGuid, THREAD_PROVIDER_DATA1, THREAD_START_OPCODE, HandleThreadStartEvent },
+    { &ThreadGuid, THREAD_PROVIDER_DATA1, THREAD_DC_START_OPCODE, HandleThreadStartEvent },
+    { &ThreadGuid, THREAD_PROVIDER_DATA1, THREAD_END_OPCODE, HandleThreadEndEvent },
+    { &ThreadGuid, THREAD_PROVIDER_DATA1, THREAD_SET_NAME_OPCODE, HandleThreadSetNameEvent },
+
+    //
+    // Process name cache
+    //
+    { &ProcessGuid, PROCESS_PROVIDER_DATA1, PROCESS_START_OPCODE, HandleProcessStartEvent },
+    { &ProcessGuid, PROCESS_PROVIDER_DATA1, PROCESS_DC_START_OPCODE, HandleProcessStartEvent },
+    { &ProcessGuid, PROCESS_PROVIDER_DATA1, PROCESS_END_OPCODE, HandleProcessEndEvent },
+
     //
     // Stack walks
     //
-    else if (IsEqualGUID(StackWalkGuid,
-                         EventRecord->EventHeader.ProviderId) == TRUE)
+    { &StackWalkGuid, STACK_WALK_PROVIDER_DATA1, STACK_WALK_OPCODE, HandleStackWalkEvent },
+
+    //
+    // Image loads
+    //
+    { &ImageLoadGuid, IMAGE_LOAD_PROVIDER_DATA1, IMAGE_LOADED_OPCODE, HandleImageLoadEvent },
+    { &ImageLoadGuid, IMAGE_LOAD_PROVIDER_DATA1, IMAGE_LOADED_RUNDOWN_OPCODE, HandleImageLoadEvent },
+    { &ImageLoadGuid, IMAGE_LOAD_PROVIDER_DATA1, IMAGE_LOADED_UNLOAD, HandleImageUnloadEvent },
+};
+
+/**
+*
+* @brief        Builds the provider/opcode dispatch table from k_EventHandlers.
+* @return       The dispatch table.
+*
+*/
+static
+constexpr
+EVENT_DISPATCH_TABLE
+BuildEventDispatchTable ()
+{
+    EVENT_DISPATCH_TABLE table = {};
+
+    for (const auto& entry : k_EventHandlers)
     {
-        HandleStackWalkEvents(EventRecord);
+        PEVENT_PROVIDER_DISPATCH provider = &table.Providers[EVENT_PROVIDER_SLOT(entry.ProviderData1)];
+
+        provider->ProviderGuid = entry.ProviderGuid;
+        provider->Handlers[entry.Opcode] = entry.Handler;
+    }
+
+    return table;
+}
+
+/**
+*
+* @brief        Validates that no two providers share a dispatch slot and that
+*               no (provider, opcode) pair is registered twice.
+* @return       true if the table is collision-free, otherwise false.
+*
+*/
+static
+constexpr
+bool
+IsEventDispatchTableValid ()
+{
+    for (SIZE_T i = 0; i < ARRAYSIZE(k_EventHandlers); i++)
+    {
+        for (SIZE_T j = (i + 1); j < ARRAYSIZE(k_EventHandlers); j++)
+        {
+            if ((k_EventHandlers[i].ProviderData1 != k_EventHandlers[j].ProviderData1) &&
+                (EVENT_PROVIDER_SLOT(k_EventHandlers[i].ProviderData1) ==
+                 EVENT_PROVIDER_SLOT(k_EventHandlers[j].ProviderData1)))
+            {
+                return false;
+            }
+
+            if ((k_EventHandlers[i].ProviderData1 == k_EventHandlers[j].ProviderData1) &&
+                (k_EventHandlers[i].Opcode == k_EventHandlers[j].Opcode))
+            {
+                return false;
+            }
+        }
     }
 
+    return true;
+}
+
+static_assert(IsEventDispatchTableValid(),
+              "Two providers share a dispatch slot (or an opcode is registered twice). "
+              "Grow EVENT_PROVIDER_SLOT_COUNT.");
+
+static constexpr EVENT_DISPATCH_TABLE k_EventDispatchTable = BuildEventDispatchTable();
+
+/**
+*
+* @brief        Looks up the handler for a given provider and opcode.
+* @param[in]    ProviderId - The provider GUID of the event.
+* @param[in]    Opcode - The opcode of the event.
+* @return       The handler, or NULL if we do not consume this event.
+*
+*/
+PEVENT_HANDLER
+LookupEventHandler (
+    _In_ const GUID& ProviderId,
+    _In_ UCHAR Opcode
+    )
+{
+    const EVENT_PROVIDER_DISPATCH* provider;
+
+    provider = &k_EventDispatchTable.Providers[EVENT_PROVIDER_SLOT(ProviderId.Data1)];
+
     //
-    // Image load events
+    // The slot only tells us the low bits of Data1 matched. Confirm
+    // this is really our provider.
     //
-    else if (IsEqualGUID(ImageLoadGuid,
-                         EventRecord->EventHeader.ProviderId) == TRUE)
+    if ((provider->ProviderGuid == NULL) ||
+        (IsEqualGUID(*provider->ProviderGuid, ProviderId) == FALSE))
     {
-        HandleImageLoadEvents(EventRecord);
+        return NULL;
     }
 
+    return provider->Handlers[Opcode];
+}
+
+/**
+*
+* @brief        Main ETW callback. Invokes the typed handler registered for
+*               the event's provider GUID and opcode.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+EtwEventCallback (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    PEVENT_HANDLER handler;
+
+    handler = LookupEventHandler(EventRecord->EventHeader.ProviderId,
+                                 EventRecord->EventHeader.EventDescriptor.Opcode);
+    if (handler == NULL)
+    {
+        goto Exit;
+    }
+
+    handler(EventRecord);
+
+Exit:
     return;
 }
 
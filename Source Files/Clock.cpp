@@ -0,0 +1,261 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Clock.cpp
+*
+* @summary:   Session clock. Events carry raw QPC timestamps, which only mean
+*             something next to the QPC frequency and a QPC/wall-clock pair.
+*             Both are taken when the session starts (or read from the trace
+*             being replayed), stored in the outputs which keep raw timestamps,
+*             and applied in batches when output is formatted.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Clock.hpp"
+
+#ifdef _WIN32
+#include <stdio.h>
+#endif
+
+/**
+*
+* @brief        Determines if a clock has been anchored.
+* @param[in]    Clock - The clock.
+* @return       true if it has, otherwise false.
+*
+*/
+bool
+IsClockValid (
+    _In_ const SESSION_CLOCK* Clock
+    )
+{
+    return ((Clock->QpcFrequency != 0) &&
+            (Clock->AnchorTimeStamp != 0) &&
+            (Clock->AnchorTime != 0));
+}
+
+/**
+*
+* @brief        Converts one raw (QPC) timestamp to a FILETIME, exactly.
+* @param[in]    Clock - The clock.
+* @param[in]    TimeStamp - The timestamp.
+* @return       The time.
+*
+*/
+uint64_t
+GetClockTime (
+    _In_ const SESSION_CLOCK* Clock,
+    _In_ uint64_t TimeStamp
+    )
+{
+    uint64_t delta;
+    uint64_t offset;
+
+    delta = ((TimeStamp >= Clock->AnchorTimeStamp) ?
+             (TimeStamp - Clock->AnchorTimeStamp) :
+             (Clock->AnchorTimeStamp - TimeStamp));
+
+    offset = (((delta / Clock->QpcFrequency) * CLOCK_FILETIME_SECOND) +
+              (((delta % Clock->QpcFrequency) * CLOCK_FILETIME_SECOND) / Clock->QpcFrequency));
+
+    if (TimeStamp >= Clock->AnchorTimeStamp)
+    {
+        return (Clock->AnchorTime + offset);
+    }
+
+    return ((offset < Clock->AnchorTime) ? (Clock->AnchorTime - offset) : 0);
+}
+
+/**
+*
+* @brief        Converts a FILETIME to the first raw (QPC) timestamp at or after it.
+* @param[in]    Clock - The clock.
+* @param[in]    Time - The time.
+* @return       The timestamp.
+*
+*/
+uint64_t
+GetClockTimeStamp (
+    _In_ const SESSION_CLOCK* Clock,
+    _In_ uint64_t Time
+    )
+{
+    uint64_t delta;
+    uint64_t ticks;
+
+    if (Time >= Clock->AnchorTime)
+    {
+        delta = (Time - Clock->AnchorTime);
+        ticks = (((delta / CLOCK_FILETIME_SECOND) * Clock->QpcFrequency) +
+                 ((((delta % CLOCK_FILETIME_SECOND) * Clock->QpcFrequency) + (CLOCK_FILETIME_SECOND - 1)) / CLOCK_FILETIME_SECOND));
+
+        return (Clock->AnchorTimeStamp + ticks);
+    }
+
+    delta = (Clock->AnchorTime - Time);
+    ticks = (((delta / CLOCK_FILETIME_SECOND) * Clock->QpcFrequency) +
+             (((delta % CLOCK_FILETIME_SECOND) * Clock->QpcFrequency) / CLOCK_FILETIME_SECOND));
+
+    return ((ticks < Clock->AnchorTimeStamp) ? (Clock->AnchorTimeStamp - ticks) : 0);
+}
+
+/**
+*
+* @brief        Converts a batch of raw (QPC) timestamps to FILETIMEs, exactly as
+*               GetClockTime would one at a time.
+* @param[in]    Clock - The clock.
+* @param[in]    TimeStamps - The timestamps.
+* @param[out]   Times - Receives the times (may be TimeStamps).
+* @param[in]    Count - The number of timestamps.
+*
+*/
+void
+ConvertClockTimeStamps (
+    _In_ const SESSION_CLOCK* Clock,
+    _In_ const uint64_t* TimeStamps,
+    _Out_ uint64_t* Times,
+    _In_ size_t Count
+    )
+{
+    uint64_t offset;
+
+    //
+    // A 10MHz QPC (most current Windows) already counts in FILETIME units:
+    // conversion is one add, which the compiler vectorizes.
+    //
+    if ((Clock->QpcFrequency == CLOCK_FILETIME_SECOND) &&
+        (Clock->AnchorTime >= Clock->AnchorTimeStamp))
+    {
+        offset = (Clock->AnchorTime - Clock->AnchorTimeStamp);
+
+        for (size_t i = 0; i < Count; i++)
+        {
+            Times[i] = (TimeStamps[i] + offset);
+        }
+
+        return;
+    }
+
+    //
+    // Otherwise the same whole seconds and remainder split as GetClockTime,
+    // so live and offline output agree to the 100ns. Dividing by the same
+    // frequency throughout is cheap next to formatting the rows.
+    //
+    for (size_t i = 0; i < Count; i++)
+    {
+        Times[i] = GetClockTime(Clock, TimeStamps[i]);
+    }
+}
+
+#ifdef _WIN32
+//
+// The live (or replayed) session's clock. Anchored before the first event
+// is delivered and read-only after.
+//
+static SESSION_CLOCK k_SessionClock = { 0 };
+
+/**
+*
+* @brief        Anchors the session clock to the system time. Called when the
+*               live session starts.
+*
+*/
+void
+CalibrateSessionClock ()
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER before;
+    LARGE_INTEGER after;
+    FILETIME fileTime;
+    ULARGE_INTEGER time;
+    uint64_t narrowest;
+
+    narrowest = MAXULONGLONG;
+
+    QueryPerformanceFrequency(&frequency);
+
+    k_SessionClock.QpcFrequency = static_cast<uint64_t>(frequency.QuadPart);
+
+    //
+    // The system time was read somewhere between the two QPC reads. Take
+    // the narrowest bracket and anchor at its middle.
+    //
+    for (ULONG i = 0; i < CLOCK_CALIBRATION_ROUNDS; i++)
+    {
+        QueryPerformanceCounter(&before);
+        GetSystemTimePreciseAsFileTime(&fileTime);
+        QueryPerformanceCounter(&after);
+
+        if (static_cast<uint64_t>(after.QuadPart - before.QuadPart) < narrowest)
+        {
+            narrowest = static_cast<uint64_t>(after.QuadPart - before.QuadPart);
+
+            time.LowPart = fileTime.dwLowDateTime;
+            time.HighPart = fileTime.dwHighDateTime;
+
+            k_SessionClock.AnchorTimeStamp = (static_cast<uint64_t>(before.QuadPart) + (narrowest / 2));
+            k_SessionClock.AnchorTime = time.QuadPart;
+        }
+    }
+
+    k_SessionClock.Uncertainty = ((narrowest + 1) / 2);
+
+    wprintf(L"[+] Session clock: QPC at %llu Hz, anchored to the system time within %llu ns.\n",
+            k_SessionClock.QpcFrequency,
+            ((k_SessionClock.Uncertainty * 1000000000ULL) / k_SessionClock.QpcFrequency));
+}
+
+/**
+*
+* @brief        Sets the session clock from a trace being replayed. The anchor
+*               is the trace's first event (its header), which was logged at
+*               the trace's start time.
+* @param[in]    QpcFrequency - The trace's QPC frequency.
+* @param[in]    StartTime - The trace's start time (FILETIME).
+*
+*/
+void
+SetSessionClockFromTrace (
+    _In_ uint64_t QpcFrequency,
+    _In_ uint64_t StartTime
+    )
+{
+    k_SessionClock.QpcFrequency = QpcFrequency;
+    k_SessionClock.AnchorTimeStamp = 0;
+    k_SessionClock.AnchorTime = StartTime;
+    k_SessionClock.Uncertainty = 0;
+}
+
+/**
+*
+* @brief        Anchors a replayed trace's clock on its first event.
+* @param[in]    TimeStamp - The event's raw (QPC) timestamp.
+*
+*/
+void
+NoteSessionClockEvent (
+    _In_ uint64_t TimeStamp
+    )
+{
+    if (k_SessionClock.AnchorTimeStamp == 0)
+    {
+        k_SessionClock.AnchorTimeStamp = TimeStamp;
+    }
+}
+
+/**
+*
+* @brief        Gets the session clock.
+* @return       The clock. Check IsClockValid before the first event.
+*
+*/
+const SESSION_CLOCK*
+GetSessionClock ()
+{
+    return &k_SessionClock;
+}
+#endif
\ No newline at end of file
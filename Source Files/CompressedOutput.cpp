@@ -0,0 +1,476 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/CompressedOutput.cpp
+*
+* @summary:   Compressed output stream (-compress). Output is gathered into
+*             1 MB blocks which a separate thread compresses into an LZ4
+*             frame, so compression is off the event ingestion path.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "CompressedOutput.hpp"
+#include <stdio.h>
+#include <algorithm>
+
+//
+// Set once, before any output file is created.
+//
+static bool k_OutputCompression = false;
+
+/**
+*
+* @brief        Turns compression of output files on or off.
+* @param[in]    Compress - true to write LZ4 frames.
+*
+*/
+void
+SetOutputCompression (
+    _In_ bool Compress
+    )
+{
+    k_OutputCompression = Compress;
+}
+
+/**
+*
+* @brief        Determines if output files are compressed.
+* @return       true if they are, otherwise false.
+*
+*/
+bool
+IsOutputCompressionEnabled ()
+{
+    return k_OutputCompression;
+}
+
+/**
+*
+* @brief        Writes to the output file, counting the bytes.
+* @param[in]    Output - The stream.
+* @param[in]    Data - The data.
+* @param[in]    Length - The number of bytes.
+*
+*/
+static
+void
+WriteCompressedOutputFile (
+    _Inout_ PCOMPRESSED_OUTPUT Output,
+    _In_ const void* Data,
+    _In_ SIZE_T Length
+    )
+{
+    if (WriteFile(Output->FileHandle,
+                  Data,
+                  static_cast<DWORD>(Length),
+                  NULL,
+                  NULL) == FALSE)
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteCompressedOutputFile. (GLE: %d)\n", GetLastError());
+        Output->Statistics.WriteFailures++;
+        return;
+    }
+
+    Output->Statistics.BytesOut += Length;
+}
+
+/**
+*
+* @brief        Compression thread. Compresses and writes queued blocks, in
+*               order, until the stream is stopped and the queue is empty.
+* @param[in]    Parameter - The stream.
+* @return       ERROR_SUCCESS.
+*
+*/
+static
+DWORD
+WINAPI
+CompressedOutputThreadProc (
+    _In_ LPVOID Parameter
+    )
+{
+    PCOMPRESSED_OUTPUT output;
+    PCOMPRESSED_OUTPUT_BLOCK block;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    SIZE_T frameLength;
+
+    output = static_cast<PCOMPRESSED_OUTPUT>(Parameter);
+
+    output->State.reset(new LZ4_STATE);
+    output->Frame.resize(Lz4FrameBlockBound(LZ4_FRAME_BLOCK_SIZE));
+
+    for (;;)
+    {
+        AcquireSRWLockExclusive(&output->Lock);
+
+        while ((output->BlocksWritten == output->BlocksQueued) &&
+               (!output->Stopping))
+        {
+            SleepConditionVariableSRW(&output->BlockQueued, &output->Lock, INFINITE, 0);
+        }
+
+        if (output->BlocksWritten == output->BlocksQueued)
+        {
+            ReleaseSRWLockExclusive(&output->Lock);
+            break;
+        }
+
+        block = &output->Blocks[output->BlocksWritten % COMPRESSED_OUTPUT_BLOCK_COUNT];
+
+        ReleaseSRWLockExclusive(&output->Lock);
+
+        QueryPerformanceCounter(&start);
+
+        frameLength = Lz4WriteFrameBlock(output->State.get(),
+                                         block->Data.data(),
+                                         block->Length,
+                                         output->Frame.data());
+
+        QueryPerformanceCounter(&end);
+
+        output->Statistics.CompressTicks += (end.QuadPart - start.QuadPart);
+        output->Statistics.Blocks++;
+
+        if (ReadLe32(output->Frame.data()) & LZ4_FRAME_BLOCK_UNCOMPRESSED)
+        {
+            output->Statistics.StoredBlocks++;
+        }
+
+        WriteCompressedOutputFile(output, output->Frame.data(), frameLength);
+
+        //
+        // Hand the block back to the writer.
+        //
+        AcquireSRWLockExclusive(&output->Lock);
+
+        block->Length = 0;
+        output->BlocksWritten++;
+
+        ReleaseSRWLockExclusive(&output->Lock);
+
+        WakeConditionVariable(&output->BlockWritten);
+    }
+
+    return ERROR_SUCCESS;
+}
+
+/**
+*
+* @brief        Queues the writer's current block and moves on to the next,
+*               waiting only if every block is still queued.
+* @param[in]    Output - The stream.
+*
+*/
+static
+void
+QueueCompressedOutputBlock (
+    _Inout_ PCOMPRESSED_OUTPUT Output
+    )
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    AcquireSRWLockExclusive(&Output->Lock);
+
+    Output->BlocksQueued++;
+
+    WakeConditionVariable(&Output->BlockQueued);
+
+    if ((Output->BlocksQueued - Output->BlocksWritten) == COMPRESSED_OUTPUT_BLOCK_COUNT)
+    {
+        QueryPerformanceCounter(&start);
+
+        while ((Output->BlocksQueued - Output->BlocksWritten) == COMPRESSED_OUTPUT_BLOCK_COUNT)
+        {
+            SleepConditionVariableSRW(&Output->BlockWritten, &Output->Lock, INFINITE, 0);
+        }
+
+        QueryPerformanceCounter(&end);
+
+        Output->Statistics.StallTicks += (end.QuadPart - start.QuadPart);
+    }
+
+    ReleaseSRWLockExclusive(&Output->Lock);
+}
+
+/**
+*
+* @brief        Starts compressing to an (empty, just created) output file.
+* @param[in]    Output - The stream.
+* @param[in]    FileHandle - The output file. Still owned by the caller, and
+*                            must stay open until StopCompressedOutput.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+StartCompressedOutput (
+    _Inout_ PCOMPRESSED_OUTPUT Output,
+    _In_ HANDLE FileHandle
+    )
+{
+    bool result;
+    uint8_t frameHeader[LZ4_FRAME_HEADER_SIZE];
+
+    result = false;
+
+    Output->FileHandle = FileHandle;
+    Output->ThreadHandle = NULL;
+    Output->BlocksQueued = 0;
+    Output->BlocksWritten = 0;
+    Output->Stopping = false;
+
+    RtlZeroMemory(&Output->Statistics, sizeof(Output->Statistics));
+
+    InitializeSRWLock(&Output->Lock);
+    InitializeConditionVariable(&Output->BlockQueued);
+    InitializeConditionVariable(&Output->BlockWritten);
+
+    //
+    // Blocks are allocated as they are first filled and the compression
+    // thread allocates its own buffers, so starting a stream (every
+    // segment, when rotating) is cheap for the writer.
+    //
+    for (auto& block : Output->Blocks)
+    {
+        block.Length = 0;
+    }
+
+    Lz4WriteFrameHeader(frameHeader);
+
+    if (WriteFile(FileHandle,
+                  frameHeader,
+                  sizeof(frameHeader),
+                  NULL,
+                  NULL) == FALSE)
+    {
+        wprintf(L"[-] Error! WriteFile failed in StartCompressedOutput. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    Output->Statistics.BytesOut += sizeof(frameHeader);
+
+    Output->ThreadHandle = CreateThread(NULL,
+                                        0,
+                                        CompressedOutputThreadProc,
+                                        Output,
+                                        0,
+                                        NULL);
+    if (Output->ThreadHandle == NULL)
+    {
+        wprintf(L"[-] Error! CreateThread failed in StartCompressedOutput. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    result = true;
+
+Exit:
+    if (!result)
+    {
+        Output->FileHandle = NULL;
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Determines if a stream is running.
+* @param[in]    Output - The stream.
+* @return       true if StartCompressedOutput succeeded and the stream has
+*               not been stopped, otherwise false.
+*
+*/
+bool
+IsCompressedOutputStarted (
+    _In_ const COMPRESSED_OUTPUT* Output
+    )
+{
+    return (Output->FileHandle != NULL);
+}
+
+/**
+*
+* @brief        Writes to a compressed stream. Only copies, unless a block
+*               fills up.
+* @param[in]    Output - The stream.
+* @param[in]    Data - The data.
+* @param[in]    Length - The number of bytes.
+*
+*/
+void
+WriteCompressedOutput (
+    _Inout_ PCOMPRESSED_OUTPUT Output,
+    _In_ const void* Data,
+    _In_ SIZE_T Length
+    )
+{
+    const uint8_t* current;
+    PCOMPRESSED_OUTPUT_BLOCK block;
+    SIZE_T copyLength;
+
+    current = static_cast<const uint8_t*>(Data);
+
+    Output->Statistics.BytesIn += Length;
+
+    while (Length != 0)
+    {
+        //
+        // The writer's block is always free: QueueCompressedOutputBlock does
+        // not return until it is.
+        //
+        block = &Output->Blocks[Output->BlocksQueued % COMPRESSED_OUTPUT_BLOCK_COUNT];
+
+        if (block->Data.empty())
+        {
+            block->Data.resize(LZ4_FRAME_BLOCK_SIZE);
+        }
+
+        copyLength = (std::min)(Length, (LZ4_FRAME_BLOCK_SIZE - block->Length));
+
+        RtlCopyMemory(block->Data.data() + block->Length, current, copyLength);
+
+        block->Length += copyLength;
+        current += copyLength;
+        Length -= copyLength;
+
+        if (block->Length == LZ4_FRAME_BLOCK_SIZE)
+        {
+            QueueCompressedOutputBlock(Output);
+        }
+    }
+}
+
+/**
+*
+* @brief        Compresses whatever is left, ends the frame and stops the
+*               compression thread. Does not close the file.
+* @param[in]    Output - The stream. Its statistics are final afterwards.
+*
+*/
+void
+StopCompressedOutput (
+    _Inout_ PCOMPRESSED_OUTPUT Output
+    )
+{
+    uint8_t endMark[sizeof(uint32_t)];
+    FILETIME creationTime;
+    FILETIME exitTime;
+    FILETIME kernelTime;
+    FILETIME userTime;
+    ULARGE_INTEGER kernel;
+    ULARGE_INTEGER user;
+
+    if (!IsCompressedOutputStarted(Output))
+    {
+        return;
+    }
+
+    if (Output->Blocks[Output->BlocksQueued % COMPRESSED_OUTPUT_BLOCK_COUNT].Length != 0)
+    {
+        QueueCompressedOutputBlock(Output);
+    }
+
+    AcquireSRWLockExclusive(&Output->Lock);
+    Output->Stopping = true;
+    ReleaseSRWLockExclusive(&Output->Lock);
+
+    WakeConditionVariable(&Output->BlockQueued);
+
+    WaitForSingleObject(Output->ThreadHandle, INFINITE);
+
+    if (GetThreadTimes(Output->ThreadHandle,
+                       &creationTime,
+                       &exitTime,
+                       &kernelTime,
+                       &userTime) != FALSE)
+    {
+        kernel.LowPart = kernelTime.dwLowDateTime;
+        kernel.HighPart = kernelTime.dwHighDateTime;
+        user.LowPart = userTime.dwLowDateTime;
+        user.HighPart = userTime.dwHighDateTime;
+
+        Output->Statistics.CpuTime = (kernel.QuadPart + user.QuadPart);
+    }
+
+    CloseHandle(Output->ThreadHandle);
+    Output->ThreadHandle = NULL;
+
+    WriteCompressedOutputFile(Output, endMark, Lz4WriteFrameEnd(endMark));
+
+    Output->FileHandle = NULL;
+
+    for (auto& block : Output->Blocks)
+    {
+        block.Data.clear();
+        block.Data.shrink_to_fit();
+    }
+
+    Output->State.reset();
+    Output->Frame.clear();
+    Output->Frame.shrink_to_fit();
+}
+
+/**
+*
+* @brief        Adds one stream's statistics to a running total (one per
+*               segment, when the output rotates).
+* @param[inout] Total - The total.
+* @param[in]    Statistics - The stream's statistics.
+*
+*/
+void
+AddCompressedOutputStatistics (
+    _Inout_ PCOMPRESSED_OUTPUT_STATISTICS Total,
+    _In_ const COMPRESSED_OUTPUT_STATISTICS* Statistics
+    )
+{
+    Total->BytesIn += Statistics->BytesIn;
+    Total->BytesOut += Statistics->BytesOut;
+    Total->Blocks += Statistics->Blocks;
+    Total->StoredBlocks += Statistics->StoredBlocks;
+    Total->CompressTicks += Statistics->CompressTicks;
+    Total->StallTicks += Statistics->StallTicks;
+    Total->WriteFailures += Statistics->WriteFailures;
+    Total->CpuTime += Statistics->CpuTime;
+}
+
+/**
+*
+* @brief        Prints compression statistics.
+* @param[in]    Statistics - The statistics.
+*
+*/
+void
+PrintCompressedOutputStatistics (
+    _In_ const COMPRESSED_OUTPUT_STATISTICS* Statistics
+    )
+{
+    LARGE_INTEGER frequency;
+    double compressSeconds;
+
+    QueryPerformanceFrequency(&frequency);
+
+    compressSeconds = (static_cast<double>(Statistics->CompressTicks) / frequency.QuadPart);
+
+    wprintf(L"[+] Compression statistics:\n");
+    wprintf(L"  [>] Bytes in: %llu\n", Statistics->BytesIn);
+    wprintf(L"  [>] Bytes out: %llu (ratio: %.2fx)\n",
+            Statistics->BytesOut,
+            ((Statistics->BytesOut != 0) ? (static_cast<double>(Statistics->BytesIn) / Statistics->BytesOut) : 0.0));
+    wprintf(L"  [>] Blocks: %llu (%llu stored uncompressed)\n", Statistics->Blocks, Statistics->StoredBlocks);
+    wprintf(L"  [>] Compression time: %.2f ms (%.1f MB/s)\n",
+            (compressSeconds * 1e3),
+            ((compressSeconds != 0) ? ((Statistics->BytesIn / (1024.0 * 1024.0)) / compressSeconds) : 0.0));
+
+    //
+    // FILETIME units (100ns).
+    //
+    wprintf(L"  [>] Compression thread CPU time: %.2f ms\n", (static_cast<double>(Statistics->CpuTime) / 1e4));
+    wprintf(L"  [>] Writer stall time: %.2f ms\n", (static_cast<double>(Statistics->StallTicks) * 1e3 / frequency.QuadPart));
+    wprintf(L"  [>] Write failures: %llu\n", Statistics->WriteFailures);
+}
\ No newline at end of file
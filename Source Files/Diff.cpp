@@ -0,0 +1,836 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Diff.cpp
+*
+* @summary:   Capture comparison ("diff" command). Compares two raw captures or
+*             aggregate snapshots (say, before and after a Windows update) and
+*             reports the secure calls and stacks whose rate or latency moved,
+*             plus a differential folded-stack file for a flame graph.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Diff.hpp"
+#include "Symbolize.hpp"
+#include "Format.hpp"
+#include <math.h>
+#include <algorithm>
+
+/**
+*
+* @brief        Scores the difference between two counts: how many standard
+*               deviations apart the rates are (counts taken as Poisson), after
+*               giving away whatever the sketches may have over-counted.
+* @param[in]    BaselineCount - The baseline count.
+* @param[in]    BaselineError - How much the baseline count may be over.
+* @param[in]    BaselineExposure - What the baseline count is per (seconds or events).
+* @param[in]    ComparisonCount - The comparison count.
+* @param[in]    ComparisonError - How much the comparison count may be over.
+* @param[in]    ComparisonExposure - What the comparison count is per.
+* @return       The score. Positive if the rate went up, 0 if it is within error.
+*
+*/
+double
+GetDiffScore (
+    _In_ uint64_t BaselineCount,
+    _In_ uint64_t BaselineError,
+    _In_ double BaselineExposure,
+    _In_ uint64_t ComparisonCount,
+    _In_ uint64_t ComparisonError,
+    _In_ double ComparisonExposure
+    )
+{
+    double delta;
+    double bound;
+    double variance;
+
+    if ((BaselineExposure <= 0) ||
+        (ComparisonExposure <= 0))
+    {
+        return 0;
+    }
+
+    delta = ((ComparisonCount / ComparisonExposure) - (BaselineCount / BaselineExposure));
+    bound = ((BaselineError / BaselineExposure) + (ComparisonError / ComparisonExposure));
+
+    //
+    // A count of zero still has the variance of a count of one.
+    //
+    variance = (((std::max)(BaselineCount, static_cast<uint64_t>(1)) / (BaselineExposure * BaselineExposure)) +
+                ((std::max)(ComparisonCount, static_cast<uint64_t>(1)) / (ComparisonExposure * ComparisonExposure)));
+
+    if (fabs(delta) <= bound)
+    {
+        return 0;
+    }
+
+    return (((delta > 0) ? (delta - bound) : (delta + bound)) / sqrt(variance));
+}
+
+/**
+*
+* @brief        Determines if a file is an aggregate snapshot (otherwise it is
+*               taken to be a raw capture, compressed or not).
+* @param[in]    FilePath - The file.
+* @return       true if it is a snapshot, otherwise false.
+*
+*/
+static
+bool
+IsAggregateSnapshotFile (
+    _In_ const wchar_t* FilePath
+    )
+{
+    MAPPED_FILE file;
+    uint32_t magic;
+    bool snapshot;
+
+    snapshot = false;
+
+    if (!MapFileReadOnly(FilePath, &file))
+    {
+        return false;
+    }
+
+    if (file.Length >= sizeof(magic))
+    {
+        RtlCopyMemory(&magic, file.Data, sizeof(magic));
+
+        snapshot = (magic == AGGREGATE_SNAPSHOT_MAGIC);
+    }
+
+    UnmapMappedFile(&file);
+
+    return snapshot;
+}
+
+/**
+*
+* @brief        Loads one side of a comparison.
+* @param[in]    Options - The diff options.
+* @param[inout] Input - The input, with Path set.
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+LoadDiffInput (
+    _In_ const DIFF_OPTIONS* Options,
+    _Inout_ PDIFF_INPUT Input
+    )
+{
+    bool result;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    QueryPerformanceCounter(&start);
+
+    Input->Seconds = 0;
+    Input->Snapshot = IsAggregateSnapshotFile(Input->Path);
+
+    if (Input->Snapshot)
+    {
+        result = LoadAggregateSnapshot(Input->Path, &Input->Aggregate);
+
+        //
+        // Summed over merged snapshots, unlike the span from FirstTime to
+        // LastTime, which undercounts hosts traced side by side.
+        //
+        if (result)
+        {
+            Input->Seconds = Input->Aggregate.ExposureSeconds;
+        }
+    }
+    else
+    {
+        result = AggregateRawCapture(Input->Path,
+                                     Options->SymbolStore,
+                                     Options->ThreadCount,
+                                     &Input->Aggregate,
+                                     &Input->Seconds);
+    }
+
+    QueryPerformanceCounter(&end);
+
+    Input->LoadTicks = (end.QuadPart - start.QuadPart);
+
+    return result;
+}
+
+/**
+*
+* @brief        Formats a rate change as a percentage.
+* @param[in]    Change - The change.
+* @param[out]   Buffer - Receives the text.
+* @param[in]    BufferCount - The size of Buffer, in characters.
+*
+*/
+static
+void
+FormatDiffPercent (
+    _In_ const DIFF_CHANGE* Change,
+    _Out_ wchar_t* Buffer,
+    _In_ size_t BufferCount
+    )
+{
+    if (Change->BaselineRate == 0)
+    {
+        swprintf(Buffer, BufferCount, L"new");
+        return;
+    }
+
+    swprintf(Buffer,
+             BufferCount,
+             L"%+.1f%%",
+             (((Change->ComparisonRate - Change->BaselineRate) * 100.0) / Change->BaselineRate));
+}
+
+/**
+*
+* @brief        Decides if a change is significant: far enough beyond noise and
+*               sketch error, and large enough to matter.
+* @param[inout] Change - The change, with the rates and score set.
+* @param[in]    Options - The diff options.
+*
+*/
+static
+void
+ClassifyDiffChange (
+    _Inout_ PDIFF_CHANGE Change,
+    _In_ const DIFF_OPTIONS* Options
+    )
+{
+    double changePercent;
+
+    changePercent = ((Change->BaselineRate == 0) ?
+                     HUGE_VAL :
+                     ((fabs(Change->ComparisonRate - Change->BaselineRate) * 100.0) / Change->BaselineRate));
+
+    Change->RateChanged = ((fabs(Change->Score) >= Options->Score) &&
+                           (changePercent >= Options->MinChangePercent));
+}
+
+/**
+*
+* @brief        Compares a secure call's latency percentiles.
+* @param[inout] Change - The change.
+* @param[in]    Options - The diff options.
+*
+*/
+static
+void
+ClassifyDiffLatency (
+    _Inout_ PDIFF_CHANGE Change,
+    _In_ const DIFF_OPTIONS* Options
+    )
+{
+    double threshold;
+
+    Change->LatencyChanged = false;
+
+    if ((Change->BaselineCall == NULL) ||
+        (Change->ComparisonCall == NULL) ||
+        (Change->BaselineCall->Latencies < DIFF_MIN_LATENCY_SAMPLES) ||
+        (Change->ComparisonCall->Latencies < DIFF_MIN_LATENCY_SAMPLES))
+    {
+        return;
+    }
+
+    threshold = (std::max)(Options->MinChangePercent, static_cast<double>(DIFF_LATENCY_RESOLUTION_PERCENT));
+
+    for (double percentile : { 50.0, 99.0 })
+    {
+        double baseline;
+        double comparison;
+
+        baseline = static_cast<double>(GetAggregateLatencyPercentile(Change->BaselineCall, percentile));
+        comparison = static_cast<double>(GetAggregateLatencyPercentile(Change->ComparisonCall, percentile));
+
+        if ((baseline != 0) &&
+            ((fabs(comparison - baseline) * 100.0 / baseline) >= threshold))
+        {
+            Change->LatencyChanged = true;
+        }
+    }
+}
+
+/**
+*
+* @brief        Orders changes, largest score first.
+* @param[inout] Changes - The changes.
+*
+*/
+static
+void
+SortDiffChanges (
+    _Inout_ std::vector<DIFF_CHANGE>& Changes
+    )
+{
+    std::sort(Changes.begin(),
+              Changes.end(),
+              [](const DIFF_CHANGE& Left, const DIFF_CHANGE& Right)
+              {
+                  return (fabs(Left.Score) > fabs(Right.Score));
+              });
+}
+
+/**
+*
+* @brief        Compares the secure calls of two inputs and prints what changed.
+* @param[in]    Baseline - The baseline.
+* @param[in]    Comparison - The comparison.
+* @param[in]    BaselineExposure - What baseline rates are per.
+* @param[in]    ComparisonExposure - What comparison rates are per.
+* @param[in]    RateScale - Multiplier for printed rates.
+* @param[in]    RateUnits - Units of printed rates.
+* @param[in]    Options - The diff options.
+* @return       The number of significant changes.
+*
+*/
+static
+size_t
+DiffSecureCalls (
+    _In_ const DIFF_INPUT* Baseline,
+    _In_ const DIFF_INPUT* Comparison,
+    _In_ double BaselineExposure,
+    _In_ double ComparisonExposure,
+    _In_ double RateScale,
+    _In_ const wchar_t* RateUnits,
+    _In_ const DIFF_OPTIONS* Options
+    )
+{
+    std::unordered_map<std::string, const AGGREGATE_SECURE_CALL*> comparisonCalls;
+    std::vector<DIFF_CHANGE> changes;
+    size_t significant;
+    wchar_t percent[32];
+
+    //
+    // Secure calls are matched by name.
+    //
+    for (const auto& secureCall : Comparison->Aggregate.SecureCalls)
+    {
+        comparisonCalls.emplace(Comparison->Aggregate.Strings[secureCall.first], &secureCall.second);
+    }
+
+    for (const auto& secureCall : Baseline->Aggregate.SecureCalls)
+    {
+        DIFF_CHANGE change;
+
+        RtlZeroMemory(&change, sizeof(change));
+
+        change.BaselineCall = &secureCall.second;
+
+        auto existing = comparisonCalls.find(Baseline->Aggregate.Strings[secureCall.first]);
+        if (existing != comparisonCalls.end())
+        {
+            change.ComparisonCall = existing->second;
+
+            comparisonCalls.erase(existing);
+        }
+
+        changes.push_back(change);
+    }
+
+    for (const auto& secureCall : comparisonCalls)
+    {
+        DIFF_CHANGE change;
+
+        RtlZeroMemory(&change, sizeof(change));
+
+        change.ComparisonCall = secureCall.second;
+
+        changes.push_back(change);
+    }
+
+    for (auto& change : changes)
+    {
+        uint64_t baselineCount;
+        uint64_t comparisonCount;
+
+        baselineCount = ((change.BaselineCall != NULL) ? change.BaselineCall->Count : 0);
+        comparisonCount = ((change.ComparisonCall != NULL) ? change.ComparisonCall->Count : 0);
+
+        change.BaselineRate = (baselineCount / BaselineExposure);
+        change.ComparisonRate = (comparisonCount / ComparisonExposure);
+        change.Score = GetDiffScore(baselineCount, 0, BaselineExposure, comparisonCount, 0, ComparisonExposure);
+
+        ClassifyDiffChange(&change, Options);
+        ClassifyDiffLatency(&change, Options);
+    }
+
+    changes.erase(std::remove_if(changes.begin(),
+                                 changes.end(),
+                                 [](const DIFF_CHANGE& Change)
+                                 {
+                                     return ((!Change.RateChanged) && (!Change.LatencyChanged));
+                                 }),
+                  changes.end());
+
+    SortDiffChanges(changes);
+
+    significant = changes.size();
+
+    wprintf(L"[+] Secure calls which changed: %zu of %zu\n",
+            significant,
+            (Baseline->Aggregate.SecureCalls.size() + comparisonCalls.size()));
+
+    for (size_t i = 0; i < (std::min)(changes.size(), static_cast<size_t>(DIFF_REPORT_SECURE_CALLS)); i++)
+    {
+        const DIFF_CHANGE* change;
+        const AGGREGATE_SECURE_CALL* secureCall;
+        const AGGREGATE* aggregate;
+
+        change = &changes[i];
+
+        if (change->BaselineCall != NULL)
+        {
+            secureCall = change->BaselineCall;
+            aggregate = &Baseline->Aggregate;
+        }
+        else
+        {
+            secureCall = change->ComparisonCall;
+            aggregate = &Comparison->Aggregate;
+        }
+
+        FormatDiffPercent(change, percent, ARRAYSIZE(percent));
+
+        wprintf(L"  [>] %hs (%u): %.2f -> %.2f %s (%s, score %.1f)\n",
+                aggregate->Strings[secureCall->NameId].c_str(),
+                secureCall->Number,
+                (change->BaselineRate * RateScale),
+                (change->ComparisonRate * RateScale),
+                RateUnits,
+                percent,
+                change->Score);
+
+        if ((change->BaselineCall != NULL) &&
+            (change->ComparisonCall != NULL) &&
+            (change->BaselineCall->Latencies != 0) &&
+            (change->ComparisonCall->Latencies != 0))
+        {
+            wprintf(L"        latency p50 %.1f -> %.1f us, p99 %.1f -> %.1f us, mean %.1f -> %.1f us%s\n",
+                    (GetAggregateLatencyPercentile(change->BaselineCall, 50) / 1e3),
+                    (GetAggregateLatencyPercentile(change->ComparisonCall, 50) / 1e3),
+                    (GetAggregateLatencyPercentile(change->BaselineCall, 99) / 1e3),
+                    (GetAggregateLatencyPercentile(change->ComparisonCall, 99) / 1e3),
+                    ((static_cast<double>(change->BaselineCall->LatencySum) / change->BaselineCall->Latencies) / 1e3),
+                    ((static_cast<double>(change->ComparisonCall->LatencySum) / change->ComparisonCall->Latencies) / 1e3),
+                    (change->LatencyChanged ? L" (changed)" : L""));
+        }
+    }
+
+    return significant;
+}
+
+/**
+*
+* @brief        Compares one top-K sketch of two inputs and prints what changed.
+*               Entries are matched by identity key (the same in every aggregate).
+* @param[in]    Type - The sketch.
+* @param[in]    Baseline - The baseline.
+* @param[in]    Comparison - The comparison.
+* @param[in]    BaselineExposure - What baseline rates are per.
+* @param[in]    ComparisonExposure - What comparison rates are per.
+* @param[in]    RateScale - Multiplier for printed rates.
+* @param[in]    RateUnits - Units of printed rates.
+* @param[in]    Options - The diff options.
+* @param[out]   Changes - Receives every compared entry (significant or not).
+* @return       The number of significant changes.
+*
+*/
+static
+size_t
+DiffTopK (
+    _In_ TOP_K_TRACKER_TYPE Type,
+    _In_ const DIFF_INPUT* Baseline,
+    _In_ const DIFF_INPUT* Comparison,
+    _In_ double BaselineExposure,
+    _In_ double ComparisonExposure,
+    _In_ double RateScale,
+    _In_ const wchar_t* RateUnits,
+    _In_ const DIFF_OPTIONS* Options,
+    _Out_ std::vector<DIFF_CHANGE>& Changes
+    )
+{
+    const AGGREGATE_TOP_K* baselineTopK;
+    const AGGREGATE_TOP_K* comparisonTopK;
+    std::vector<const DIFF_CHANGE*> significant;
+    wchar_t percent[32];
+
+    baselineTopK = &Baseline->Aggregate.TopK[Type];
+    comparisonTopK = &Comparison->Aggregate.TopK[Type];
+
+    Changes.clear();
+    Changes.reserve(baselineTopK->Entries.size() + comparisonTopK->Entries.size());
+
+    for (const auto& entry : baselineTopK->Entries)
+    {
+        DIFF_CHANGE change;
+
+        RtlZeroMemory(&change, sizeof(change));
+
+        change.BaselineEntry = &entry;
+
+        auto existing = comparisonTopK->Index.find(entry.Key);
+        if (existing != comparisonTopK->Index.end())
+        {
+            change.ComparisonEntry = &comparisonTopK->Entries[existing->second];
+        }
+
+        Changes.push_back(change);
+    }
+
+    for (const auto& entry : comparisonTopK->Entries)
+    {
+        DIFF_CHANGE change;
+
+        if (baselineTopK->Index.find(entry.Key) != baselineTopK->Index.end())
+        {
+            continue;
+        }
+
+        RtlZeroMemory(&change, sizeof(change));
+
+        change.ComparisonEntry = &entry;
+
+        Changes.push_back(change);
+    }
+
+    for (auto& change : Changes)
+    {
+        uint64_t baselineCount;
+        uint64_t baselineError;
+        uint64_t comparisonCount;
+        uint64_t comparisonError;
+
+        //
+        // An entry missing from a sketch may still have been seen up to
+        // that sketch's minimum count.
+        //
+        baselineCount = ((change.BaselineEntry != NULL) ? change.BaselineEntry->Count : 0);
+        baselineError = ((change.BaselineEntry != NULL) ? change.BaselineEntry->Error : baselineTopK->MinimumCount);
+        comparisonCount = ((change.ComparisonEntry != NULL) ? change.ComparisonEntry->Count : 0);
+        comparisonError = ((change.ComparisonEntry != NULL) ? change.ComparisonEntry->Error : comparisonTopK->MinimumCount);
+
+        change.BaselineRate = (baselineCount / BaselineExposure);
+        change.ComparisonRate = (comparisonCount / ComparisonExposure);
+        change.Score = GetDiffScore(baselineCount,
+                                    baselineError,
+                                    BaselineExposure,
+                                    comparisonCount,
+                                    comparisonError,
+                                    ComparisonExposure);
+
+        ClassifyDiffChange(&change, Options);
+
+        if (change.RateChanged)
+        {
+            significant.push_back(&change);
+        }
+    }
+
+    std::sort(significant.begin(),
+              significant.end(),
+              [](const DIFF_CHANGE* Left, const DIFF_CHANGE* Right)
+              {
+                  return (fabs(Left->Score) > fabs(Right->Score));
+              });
+
+    wprintf(L"[+] Top-K %s which changed: %zu of %zu\n",
+            GetTopKTrackerName(Type),
+            significant.size(),
+            Changes.size());
+
+    for (size_t i = 0; i < (std::min)(significant.size(), static_cast<size_t>(DIFF_REPORT_STACKS)); i++)
+    {
+        const DIFF_CHANGE* change;
+        const AGGREGATE_TOP_K_ENTRY* entry;
+        const AGGREGATE* aggregate;
+        size_t frames;
+
+        change = significant[i];
+
+        if (change->BaselineEntry != NULL)
+        {
+            entry = change->BaselineEntry;
+            aggregate = &Baseline->Aggregate;
+        }
+        else
+        {
+            entry = change->ComparisonEntry;
+            aggregate = &Comparison->Aggregate;
+        }
+
+        FormatDiffPercent(change, percent, ARRAYSIZE(percent));
+
+        wprintf(L"  [>] %.2f -> %.2f %s (%s, score %.1f)",
+                (change->BaselineRate * RateScale),
+                (change->ComparisonRate * RateScale),
+                RateUnits,
+                percent,
+                change->Score);
+
+        if (Type != TopKStacks)
+        {
+            for (size_t j = 0; j < entry->Identity.size(); j++)
+            {
+                wprintf(L"%s%hs", ((j == 0) ? L" " : L" - "), aggregate->Strings[entry->Identity[j]].c_str());
+            }
+
+            wprintf(L"\n");
+            continue;
+        }
+
+        wprintf(L" %hs\n", aggregate->Strings[entry->Identity[0]].c_str());
+
+        frames = (std::min)((entry->Identity.size() - 1), static_cast<size_t>(DIFF_REPORT_STACK_FRAMES));
+
+        for (size_t j = 1; j <= frames; j++)
+        {
+            wprintf(L"        %hs\n", aggregate->Strings[entry->Identity[j]].c_str());
+        }
+
+        if ((entry->Identity.size() - 1) > frames)
+        {
+            wprintf(L"        ... (%zu more)\n", ((entry->Identity.size() - 1) - frames));
+        }
+    }
+
+    return significant.size();
+}
+
+/**
+*
+* @brief        Writes the compared stacks as a differential folded-stack file:
+*               "root;...;leaf;secure call <baseline count> <comparison count>"
+*               per line, as difffolded.pl writes and flamegraph.pl reads.
+* @param[in]    FilePath - The file to write.
+* @param[in]    Baseline - The baseline.
+* @param[in]    Comparison - The comparison.
+* @param[in]    Changes - Every compared stack.
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+WriteDiffFoldedStacks (
+    _In_ const wchar_t* FilePath,
+    _In_ const DIFF_INPUT* Baseline,
+    _In_ const DIFF_INPUT* Comparison,
+    _In_ const std::vector<DIFF_CHANGE>& Changes
+    )
+{
+    bool result;
+    HANDLE fileHandle;
+    FORMAT_BUFFER buffer;
+    DWORD bytesWritten;
+
+    result = false;
+    fileHandle = INVALID_HANDLE_VALUE;
+
+    ResetFormatBuffer(&buffer);
+
+    for (const auto& change : Changes)
+    {
+        const AGGREGATE_TOP_K_ENTRY* entry;
+        const AGGREGATE* aggregate;
+
+        if (change.BaselineEntry != NULL)
+        {
+            entry = change.BaselineEntry;
+            aggregate = &Baseline->Aggregate;
+        }
+        else
+        {
+            entry = change.ComparisonEntry;
+            aggregate = &Comparison->Aggregate;
+        }
+
+        //
+        // Frames are innermost first - folded stacks are outermost first,
+        // with the secure call as the leaf.
+        //
+        for (size_t j = (entry->Identity.size() - 1); j >= 1; j--)
+        {
+            FormatAppendString(&buffer, aggregate->Strings[entry->Identity[j]].c_str());
+            FormatAppendChar(&buffer, ';');
+        }
+
+        FormatAppendString(&buffer, aggregate->Strings[entry->Identity[0]].c_str());
+        FormatAppendChar(&buffer, ' ');
+        FormatAppendDecimal(&buffer, ((change.BaselineEntry != NULL) ? change.BaselineEntry->Count : 0));
+        FormatAppendChar(&buffer, ' ');
+        FormatAppendDecimal(&buffer, ((change.ComparisonEntry != NULL) ? change.ComparisonEntry->Count : 0));
+        FormatAppendChar(&buffer, '\n');
+    }
+
+    fileHandle = CreateFileW(FilePath,
+                             GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             0,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in WriteDiffFoldedStacks. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    if ((WriteFile(fileHandle,
+                   buffer.Data.data(),
+                   static_cast<DWORD>(buffer.Length),
+                   &bytesWritten,
+                   NULL) == FALSE) ||
+        (bytesWritten != buffer.Length))
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteDiffFoldedStacks. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    result = true;
+
+Exit:
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Runs the "diff" command: compares a baseline capture or snapshot
+*               with a comparison one.
+* @param[in]    BaselinePath - The baseline (raw capture or aggregate snapshot).
+* @param[in]    ComparisonPath - The comparison (raw capture or aggregate snapshot).
+* @param[in]    Options - The diff options.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+DiffCaptures (
+    _In_ const wchar_t* BaselinePath,
+    _In_ const wchar_t* ComparisonPath,
+    _In_ const DIFF_OPTIONS* Options
+    )
+{
+    bool result;
+    DIFF_INPUT baseline;
+    DIFF_INPUT comparison;
+    std::vector<DIFF_CHANGE> changes;
+    std::vector<DIFF_CHANGE> stackChanges;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    double baselineExposure;
+    double comparisonExposure;
+    double rateScale;
+    const wchar_t* rateUnits;
+    size_t significant;
+
+    result = false;
+    significant = 0;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    baseline.Path = BaselinePath;
+    comparison.Path = ComparisonPath;
+
+    if ((!LoadDiffInput(Options, &baseline)) ||
+        (!LoadDiffInput(Options, &comparison)))
+    {
+        goto Exit;
+    }
+
+    //
+    // Per second if both sides know how long they ran, otherwise the
+    // best we can do is per correlated event.
+    //
+    if ((baseline.Seconds > 0) &&
+        (comparison.Seconds > 0))
+    {
+        baselineExposure = baseline.Seconds;
+        comparisonExposure = comparison.Seconds;
+        rateScale = 1;
+        rateUnits = L"/s";
+    }
+    else
+    {
+        baselineExposure = static_cast<double>((std::max)(baseline.Aggregate.Events, static_cast<uint64_t>(1)));
+        comparisonExposure = static_cast<double>((std::max)(comparison.Aggregate.Events, static_cast<uint64_t>(1)));
+        rateScale = 1000;
+        rateUnits = L"/1k events";
+    }
+
+    for (const DIFF_INPUT* input : { &baseline, &comparison })
+    {
+        wprintf(L"[+] %s: %s (%s, %llu correlated events over %.1f s)\n",
+                ((input == &baseline) ? L"Baseline" : L"Comparison"),
+                input->Path,
+                (input->Snapshot ? L"snapshot" : L"raw capture"),
+                input->Aggregate.Events,
+                input->Seconds);
+    }
+
+    wprintf(L"[+] Reporting changes with a score of at least %.1f and a rate change of at least %.1f%%\n",
+            Options->Score,
+            Options->MinChangePercent);
+
+    significant += DiffSecureCalls(&baseline,
+                                   &comparison,
+                                   baselineExposure,
+                                   comparisonExposure,
+                                   rateScale,
+                                   rateUnits,
+                                   Options);
+
+    for (ULONG type = 0; type < TopKTrackerCount; type++)
+    {
+        significant += DiffTopK(static_cast<TOP_K_TRACKER_TYPE>(type),
+                                &baseline,
+                                &comparison,
+                                baselineExposure,
+                                comparisonExposure,
+                                rateScale,
+                                rateUnits,
+                                Options,
+                                changes);
+
+        if (type == TopKStacks)
+        {
+            stackChanges.swap(changes);
+        }
+    }
+
+    if ((Options->FoldedPath != NULL) &&
+        (!WriteDiffFoldedStacks(Options->FoldedPath, &baseline, &comparison, stackChanges)))
+    {
+        goto Exit;
+    }
+
+    QueryPerformanceCounter(&end);
+
+    wprintf(L"[+] Diff statistics:\n");
+    wprintf(L"  [>] Significant changes: %zu\n", significant);
+    wprintf(L"  [>] Baseline load time: %.2f ms\n", (static_cast<double>(baseline.LoadTicks) * 1e3 / frequency.QuadPart));
+    wprintf(L"  [>] Comparison load time: %.2f ms\n", (static_cast<double>(comparison.LoadTicks) * 1e3 / frequency.QuadPart));
+    wprintf(L"  [>] Total time: %.2f ms\n", (static_cast<double>(end.QuadPart - start.QuadPart) * 1e3 / frequency.QuadPart));
+
+    if (Options->FoldedPath != NULL)
+    {
+        wprintf(L"  [>] Wrote %zu differential folded stacks to %s\n", stackChanges.size(), Options->FoldedPath);
+    }
+
+    result = true;
+
+Exit:
+    return result;
+}
\ No newline at end of file
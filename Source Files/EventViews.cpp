@@ -0,0 +1,84 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/EventViews.cpp
+*
+* @summary:   ETW event payload parsing which is not generic over the views.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "EventViews.hpp"
+
+/**
+*
+* @brief        Walks the user SID after a process event's fixed fields and
+*               locates the NULL-terminated ANSI image name which follows it.
+*               Everything after the image name (command line, package name,
+*               ...) is ignored.
+* @param[in]    Tail - The payload after the fixed fields.
+* @param[in]    TailLength - The size, in bytes, of Tail.
+* @param[out]   ImageName - Receives the image name.
+* @param[out]   ImageNameLength - Receives the length, in characters, of the image name.
+* @return       true if the SID and a terminated image name fit in Tail, otherwise false.
+*
+*/
+bool
+ParseProcessEventTail (
+    _In_ const uint8_t* Tail,
+    _In_ size_t TailLength,
+    _Out_ const char** ImageName,
+    _Out_ size_t* ImageNameLength
+    )
+{
+    uint32_t sidHeader;
+    size_t sidLength;
+
+    *ImageName = NULL;
+    *ImageNameLength = 0;
+
+    sidHeader = 0;
+
+    if (TailLength < sizeof(sidHeader))
+    {
+        return false;
+    }
+
+    memcpy(&sidHeader,
+           Tail,
+           sizeof(sidHeader));
+
+    if (sidHeader == 0)
+    {
+        //
+        // No SID, just the zero ULONG.
+        //
+        sidLength = sizeof(sidHeader);
+    }
+    else
+    {
+        //
+        // TOKEN_USER, then the SID (8 bytes + 4 bytes per sub-authority).
+        //
+        sidLength = (2 * sizeof(EVENT_POINTER));
+        if ((sidLength + 8) > TailLength)
+        {
+            return false;
+        }
+
+        sidLength += (8 + (Tail[sidLength + 1] * sizeof(uint32_t)));
+    }
+
+    if (sidLength >= TailLength)
+    {
+        return false;
+    }
+
+    return (LocateBoundedString((Tail + sidLength),
+                                (TailLength - sidLength),
+                                ImageName,
+                                ImageNameLength) != 0);
+}
\ No newline at end of file
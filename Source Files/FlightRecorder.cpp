@@ -0,0 +1,1154 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/FlightRecorder.cpp
+*
+* @summary:   Flight recorder. Correlated events are kept in memory, unsymbolized,
+*             in a fixed-size ring. When a trigger fires (a secure call rate or
+*             latency threshold, Ctrl+Break or a named event) the window is
+*             dumped as a raw capture and symbolized - so disk and symbol costs
+*             are only paid during incidents.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "FlightRecorder.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Symbolize.hpp"
+#include "Clock.hpp"
+#include <algorithm>
+
+static FLIGHT_RECORDER k_FlightRecorder;
+static bool k_FlightRecorderEnabled = false;
+
+//
+// Configuration (set before the trace starts).
+//
+static ULONGLONG k_FlightRecorderRingBytes = 0;
+static ULONG k_FlightRecorderWindowSeconds = 0;
+static ULONG k_TriggerCallsPerSecond = 0;
+static ULONG k_TriggerLatencyMicroseconds = 0;
+static const wchar_t* k_TriggerEventName = FLIGHT_RECORDER_DEFAULT_TRIGGER_EVENT;
+
+//
+// In ticks of the event timestamps, once the session clock is set.
+//
+static ULONGLONG k_FlightRecorderWindowTicks = 0;
+static ULONGLONG k_TriggerRateWindowTicks = 0;
+static ULONGLONG k_TriggerLatencyTicks = 0;
+
+static const wchar_t* k_FlightTriggerNames[FlightTriggerCount] =
+{
+    L"none",
+    L"secure call rate",
+    L"secure call latency",
+    L"Ctrl+Break",
+    L"named event"
+};
+
+/**
+*
+* @brief        Sets the flight recorder up. Events are then recorded to the ring
+*               instead of the CSV or a raw capture.
+* @param[in]    RingBytes - The size of the ring. 0 for the default.
+* @param[in]    WindowSeconds - How much of the ring a dump covers. 0 for all of it.
+*
+*/
+void
+SetFlightRecorder (
+    _In_ ULONGLONG RingBytes,
+    _In_ ULONG WindowSeconds
+    )
+{
+    k_FlightRecorderRingBytes = ((RingBytes != 0) ? RingBytes : (static_cast<ULONGLONG>(FLIGHT_RECORDER_DEFAULT_RING_MB) * 1024 * 1024));
+    k_FlightRecorderWindowSeconds = WindowSeconds;
+}
+
+/**
+*
+* @brief        Sets the flight recorder triggers. Ctrl+Break always triggers a dump.
+* @param[in]    CallsPerSecond - Dump when more secure calls than this are made in a second. 0 for none.
+* @param[in]    LatencyMicroseconds - Dump when a secure call takes longer than this. 0 for none.
+* @param[in]    EventName - The named event which triggers a dump. NULL for the default.
+*
+*/
+void
+SetFlightRecorderTriggers (
+    _In_ ULONG CallsPerSecond,
+    _In_ ULONG LatencyMicroseconds,
+    _In_opt_ const wchar_t* EventName
+    )
+{
+    k_TriggerCallsPerSecond = CallsPerSecond;
+    k_TriggerLatencyMicroseconds = LatencyMicroseconds;
+
+    if (EventName != NULL)
+    {
+        k_TriggerEventName = EventName;
+    }
+}
+
+/**
+*
+* @brief        Converts the window and triggers to ticks of the event timestamps.
+* @param[in]    QpcFrequency - The session clock's QPC frequency.
+*
+*/
+void
+SetFlightRecorderQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    )
+{
+    k_FlightRecorderWindowTicks = (static_cast<ULONGLONG>(k_FlightRecorderWindowSeconds) * QpcFrequency);
+    k_TriggerRateWindowTicks = QpcFrequency;
+    k_TriggerLatencyTicks = (std::max)(((static_cast<ULONGLONG>(k_TriggerLatencyMicroseconds) * QpcFrequency) / 1000000),
+                                       static_cast<ULONGLONG>(1));
+}
+
+/**
+*
+* @brief        Asks the dump thread for a dump. Anything asked for while a dump
+*               is pending (or during the holdoff after one) is dropped.
+* @param[in]    Trigger - Why.
+*
+*/
+static
+void
+RequestFlightRecorderDump (
+    _In_ FLIGHT_TRIGGER Trigger
+    )
+{
+    if (_InterlockedCompareExchange(&k_FlightRecorder.PendingTrigger, Trigger, FlightTriggerNone) == FlightTriggerNone)
+    {
+        SetEvent(k_FlightRecorder.TriggerEvent);
+    }
+}
+
+/**
+*
+* @brief        Console control handler. Ctrl+Break dumps the ring and keeps tracing.
+* @param[in]    CtrlType - The control signal.
+* @return       TRUE if handled, otherwise FALSE.
+*
+*/
+static
+BOOL
+WINAPI
+FlightRecorderConsoleHandler (
+    _In_ DWORD CtrlType
+    )
+{
+    if (CtrlType != CTRL_BREAK_EVENT)
+    {
+        return FALSE;
+    }
+
+    RequestFlightRecorderDump(FlightTriggerSignal);
+
+    return TRUE;
+}
+
+/**
+*
+* @brief        Drops the oldest record from the ring. The caller holds the lock.
+*
+*/
+static
+void
+EvictOldestFlightRecord ()
+{
+    RAW_RECORD_HEADER header;
+
+    RtlCopyMemory(&header, &k_FlightRecorder.Ring[k_FlightRecorder.Head], sizeof(header));
+
+    k_FlightRecorder.Head += header.Size;
+    k_FlightRecorder.Records--;
+    k_FlightRecorder.Statistics.EventsEvicted++;
+
+    if ((k_FlightRecorder.Wrapped) &&
+        (k_FlightRecorder.Head == k_FlightRecorder.End))
+    {
+        k_FlightRecorder.Head = 0;
+        k_FlightRecorder.Wrapped = false;
+    }
+}
+
+/**
+*
+* @brief        Makes room for a record at the end of the ring, overwriting the
+*               oldest as needed. The caller holds the lock.
+* @param[in]    RecordSize - The size of the record (aligned).
+* @return       The record, or NULL if it can never fit.
+*
+*/
+static
+UCHAR*
+ReserveFlightRecord (
+    _In_ SIZE_T RecordSize
+    )
+{
+    UCHAR* record;
+
+    record = NULL;
+
+    if (RecordSize > k_FlightRecorder.Ring.size())
+    {
+        goto Exit;
+    }
+
+    for (;;)
+    {
+        if (k_FlightRecorder.Records == 0)
+        {
+            k_FlightRecorder.Head = 0;
+            k_FlightRecorder.Tail = 0;
+            k_FlightRecorder.Wrapped = false;
+        }
+
+        if (!k_FlightRecorder.Wrapped)
+        {
+            if ((k_FlightRecorder.Ring.size() - k_FlightRecorder.Tail) >= RecordSize)
+            {
+                break;
+            }
+
+            //
+            // No room before the end of the ring - start again from the
+            // beginning once the oldest records have made room there.
+            //
+            if (k_FlightRecorder.Head >= RecordSize)
+            {
+                k_FlightRecorder.End = k_FlightRecorder.Tail;
+                k_FlightRecorder.Tail = 0;
+                k_FlightRecorder.Wrapped = true;
+                continue;
+            }
+        }
+        else if ((k_FlightRecorder.Head - k_FlightRecorder.Tail) >= RecordSize)
+        {
+            break;
+        }
+
+        EvictOldestFlightRecord();
+    }
+
+    record = &k_FlightRecorder.Ring[k_FlightRecorder.Tail];
+
+    k_FlightRecorder.Tail += RecordSize;
+    k_FlightRecorder.Records++;
+
+Exit:
+    return record;
+}
+
+/**
+*
+* @brief        Remembers an interned name so a dump can write it. The caller holds the lock.
+* @param[in]    NameId - The interned name ID.
+*
+*/
+static
+void
+NoteFlightRecorderName (
+    _In_ ULONG NameId
+    )
+{
+    if (NameId >= k_FlightRecorder.Names.size())
+    {
+        k_FlightRecorder.Names.resize(NameId + 1, NULL);
+    }
+
+    if (k_FlightRecorder.Names[NameId] == NULL)
+    {
+        k_FlightRecorder.Names[NameId] = GetInternedName(NameId);
+    }
+}
+
+/**
+*
+* @brief        Appends a name record to a capture.
+* @param[in]    Capture - The capture.
+* @param[in]    Type - RawRecordName or RawRecordSecureCallName.
+* @param[in]    Id - The name ID (or secure call number).
+* @param[in]    Name - The (UTF-8) name.
+*
+*/
+static
+void
+AppendFlightRecorderName (
+    _Inout_ std::vector<UCHAR>& Capture,
+    _In_ RAW_RECORD_TYPE Type,
+    _In_ ULONG Id,
+    _In_ const char* Name
+    )
+{
+    RAW_RECORD_HEADER header;
+    RAW_NAME_RECORD nameRecord;
+    SIZE_T nameSize;
+    SIZE_T offset;
+
+    nameSize = (strlen(Name) + 1);
+
+    header.Type = static_cast<uint16_t>(Type);
+    header.Reserved = 0;
+    header.Size = static_cast<uint32_t>(sizeof(header) + sizeof(nameRecord) + nameSize);
+    header.Size = ((header.Size + (RAW_RECORD_ALIGNMENT - 1)) & ~static_cast<uint32_t>(RAW_RECORD_ALIGNMENT - 1));
+
+    nameRecord.Id = Id;
+    nameRecord.Reserved = 0;
+
+    offset = Capture.size();
+
+    //
+    // Zero-filled, which also takes care of the padding.
+    //
+    Capture.resize(offset + header.Size);
+
+    RtlCopyMemory(&Capture[offset], &header, sizeof(header));
+    RtlCopyMemory(&Capture[offset + sizeof(header)], &nameRecord, sizeof(nameRecord));
+    RtlCopyMemory(&Capture[offset + sizeof(header) + sizeof(nameRecord)], Name, nameSize);
+}
+
+/**
+*
+* @brief        Builds a raw capture from the ring: the module table, the names
+*               the events refer to, then every event in the window.
+* @param[in]    Capture - Receives the capture.
+* @param[out]   Events - Receives the number of events in the capture.
+*
+*/
+static
+void
+SnapshotFlightRecorder (
+    _Inout_ std::vector<UCHAR>& Capture,
+    _Out_ ULONGLONG* Events
+    )
+{
+    RAW_CAPTURE_HEADER captureHeader;
+    std::vector<UCHAR> ring;
+    std::vector<UCHAR> moduleRecords;
+    std::vector<const char*> nameTable;
+    std::vector<UCHAR> eventRecords;
+    std::vector<bool> namesUsed;
+    std::vector<bool> secureCallsUsed;
+    std::vector<std::pair<ULONG, const char*>> names;
+    ULONGLONG lastTimeStamp;
+    ULONGLONG windowStart;
+    SIZE_T ranges[2][2];
+    SIZE_T ringLength;
+    ULONG rangeCount;
+
+    *Events = 0;
+
+    captureHeader.Magic = RAW_CAPTURE_MAGIC;
+    captureHeader.Version = RAW_CAPTURE_VERSION;
+    captureHeader.QpcFrequency = GetSessionClock()->QpcFrequency;
+
+    Capture.assign(reinterpret_cast<const UCHAR*>(&captureHeader),
+                   reinterpret_cast<const UCHAR*>(&captureHeader) + sizeof(captureHeader));
+
+    if (IsClockValid(GetSessionClock()))
+    {
+        RAW_RECORD_HEADER clockHeader;
+        RAW_CLOCK_RECORD clockRecord;
+        const SESSION_CLOCK* clock;
+
+        clock = GetSessionClock();
+
+        clockHeader.Type = RawRecordClock;
+        clockHeader.Reserved = 0;
+        clockHeader.Size = static_cast<uint32_t>(sizeof(clockHeader) + sizeof(clockRecord));
+
+        clockRecord.QpcFrequency = clock->QpcFrequency;
+        clockRecord.AnchorTimeStamp = clock->AnchorTimeStamp;
+        clockRecord.AnchorTime = clock->AnchorTime;
+        clockRecord.Uncertainty = clock->Uncertainty;
+
+        Capture.insert(Capture.end(),
+                       reinterpret_cast<const UCHAR*>(&clockHeader),
+                       reinterpret_cast<const UCHAR*>(&clockHeader) + sizeof(clockHeader));
+        Capture.insert(Capture.end(),
+                       reinterpret_cast<const UCHAR*>(&clockRecord),
+                       reinterpret_cast<const UCHAR*>(&clockRecord) + sizeof(clockRecord));
+    }
+
+    //
+    // Copy the raw records out and get off the lock - the ETW processing
+    // thread is waiting on it. Filtering happens on the copy. Names are
+    // pointers into the name table, which never move.
+    //
+    AcquireSRWLockExclusive(&k_FlightRecorder.Lock);
+
+    lastTimeStamp = k_FlightRecorder.LastTimeStamp;
+
+    if (k_FlightRecorder.Wrapped)
+    {
+        ranges[0][0] = k_FlightRecorder.Head;
+        ranges[0][1] = k_FlightRecorder.End;
+        ranges[1][0] = 0;
+        ranges[1][1] = k_FlightRecorder.Tail;
+        rangeCount = 2;
+    }
+    else
+    {
+        ranges[0][0] = k_FlightRecorder.Head;
+        ranges[0][1] = k_FlightRecorder.Tail;
+        rangeCount = ((k_FlightRecorder.Records != 0) ? 1 : 0);
+    }
+
+    ringLength = 0;
+
+    for (ULONG i = 0; i < rangeCount; i++)
+    {
+        ringLength += (ranges[i][1] - ranges[i][0]);
+    }
+
+    ring.reserve(ringLength);
+
+    for (ULONG i = 0; i < rangeCount; i++)
+    {
+        ring.insert(ring.end(),
+                    (k_FlightRecorder.Ring.data() + ranges[i][0]),
+                    (k_FlightRecorder.Ring.data() + ranges[i][1]));
+    }
+
+    moduleRecords.assign(k_FlightRecorder.ModuleRecords.begin(),
+                         k_FlightRecorder.ModuleRecords.end());
+
+    nameTable.assign(k_FlightRecorder.Names.begin(),
+                     k_FlightRecorder.Names.end());
+
+    ReleaseSRWLockExclusive(&k_FlightRecorder.Lock);
+
+    windowStart = 0;
+
+    if ((k_FlightRecorderWindowTicks != 0) &&
+        (lastTimeStamp > k_FlightRecorderWindowTicks))
+    {
+        windowStart = (lastTimeStamp - k_FlightRecorderWindowTicks);
+    }
+
+    secureCallsUsed.assign(MAXUSHORT + 1, false);
+    namesUsed.assign(nameTable.size(), false);
+    eventRecords.reserve(ring.size());
+
+    for (SIZE_T offset = 0; offset < ring.size(); )
+    {
+        RAW_RECORD_HEADER header;
+        RAW_EVENT_RECORD eventRecord;
+        const UCHAR* record;
+
+        record = &ring[offset];
+
+        RtlCopyMemory(&header, record, sizeof(header));
+        RtlCopyMemory(&eventRecord, record + sizeof(header), sizeof(eventRecord));
+
+        offset += header.Size;
+
+        if (eventRecord.TimeStamp < windowStart)
+        {
+            continue;
+        }
+
+        if (!namesUsed[eventRecord.ProcessNameId])
+        {
+            namesUsed[eventRecord.ProcessNameId] = true;
+            names.emplace_back(eventRecord.ProcessNameId, nameTable[eventRecord.ProcessNameId]);
+        }
+
+        if (!namesUsed[eventRecord.ThreadNameId])
+        {
+            namesUsed[eventRecord.ThreadNameId] = true;
+            names.emplace_back(eventRecord.ThreadNameId, nameTable[eventRecord.ThreadNameId]);
+        }
+
+        secureCallsUsed[eventRecord.SecureCallNumber] = true;
+
+        eventRecords.insert(eventRecords.end(), record, record + header.Size);
+
+        (*Events)++;
+    }
+
+    Capture.insert(Capture.end(),
+                   moduleRecords.begin(),
+                   moduleRecords.end());
+
+    //
+    // Names come before the events which refer to them.
+    //
+    for (const auto& name : names)
+    {
+        AppendFlightRecorderName(Capture, RawRecordName, name.first, name.second);
+    }
+
+    for (ULONG i = 0; i <= MAXUSHORT; i++)
+    {
+        if (secureCallsUsed[i])
+        {
+            AppendFlightRecorderName(Capture, RawRecordSecureCallName, i, GetSecureCallName(i));
+        }
+    }
+
+    Capture.insert(Capture.end(),
+                   eventRecords.begin(),
+                   eventRecords.end());
+}
+
+/**
+*
+* @brief        Writes a buffer to a new file.
+* @param[in]    FilePath - The file.
+* @param[in]    Data - The data.
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+WriteFlightRecorderFile (
+    _In_ const wchar_t* FilePath,
+    _In_ const std::vector<UCHAR>& Data
+    )
+{
+    bool result;
+    HANDLE fileHandle;
+    DWORD bytesWritten;
+
+    result = false;
+
+    fileHandle = CreateFileW(FilePath,
+                             GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             0,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in WriteFlightRecorderFile. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    if ((WriteFile(fileHandle,
+                   Data.data(),
+                   static_cast<DWORD>(Data.size()),
+                   &bytesWritten,
+                   NULL) == FALSE) ||
+        (bytesWritten != Data.size()))
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteFlightRecorderFile. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    result = true;
+
+Exit:
+    if ((fileHandle != NULL) &&
+        (fileHandle != INVALID_HANDLE_VALUE))
+    {
+        CloseHandle(fileHandle);
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Dumps the window to "<stem>.<sequence>.vraw" and symbolizes it to
+*               "<stem>.<sequence>.csv". Dump thread only.
+* @param[in]    Trigger - Why.
+*
+*/
+static
+void
+DumpFlightRecorder (
+    _In_ FLIGHT_TRIGGER Trigger
+    )
+{
+    std::vector<UCHAR> capture;
+    ULONGLONG events;
+    wchar_t capturePath[MAX_PATH];
+    wchar_t outputPath[MAX_PATH];
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    QueryPerformanceCounter(&start);
+
+    SnapshotFlightRecorder(capture, &events);
+
+    swprintf(capturePath,
+             ARRAYSIZE(capturePath),
+             FLIGHT_RECORDER_DUMP_FORMAT,
+             k_FlightRecorder.Stem.c_str(),
+             k_FlightRecorder.NextSequence,
+             FLIGHT_RECORDER_CAPTURE_EXTENSION);
+
+    swprintf(outputPath,
+             ARRAYSIZE(outputPath),
+             FLIGHT_RECORDER_DUMP_FORMAT,
+             k_FlightRecorder.Stem.c_str(),
+             k_FlightRecorder.NextSequence,
+             FLIGHT_RECORDER_OUTPUT_EXTENSION);
+
+    k_FlightRecorder.NextSequence++;
+
+    if (!WriteFlightRecorderFile(capturePath, capture))
+    {
+        k_FlightRecorder.Statistics.DumpFailures++;
+        goto Exit;
+    }
+
+    QueryPerformanceCounter(&end);
+
+    k_FlightRecorder.Statistics.DumpTicks += (end.QuadPart - start.QuadPart);
+    k_FlightRecorder.Statistics.Dumps++;
+    k_FlightRecorder.Statistics.EventsDumped += events;
+
+    wprintf(L"[+] Flight recorder: %s trigger. Dumped %llu events to %s\n",
+            k_FlightTriggerNames[Trigger],
+            events,
+            capturePath);
+
+    //
+    // dbghelp belongs to the ETW processing thread (image loads), so
+    // this is PDBs and exports only. The capture is kept either way.
+    //
+    QueryPerformanceCounter(&start);
+
+    if (!SymbolizeRawCapture(capturePath,
+                             outputPath,
+                             SYMBOL_STORE_DIRECTORY,
+                             FLIGHT_RECORDER_SYMBOLIZE_THREADS,
+                             false))
+    {
+        k_FlightRecorder.Statistics.DumpFailures++;
+    }
+
+    QueryPerformanceCounter(&end);
+
+    k_FlightRecorder.Statistics.SymbolizeTicks += (end.QuadPart - start.QuadPart);
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        Dump thread. Waits for a trigger, lets the incident finish landing
+*               in the ring, dumps and then ignores triggers for a while.
+* @param[in]    Parameter - Unused.
+* @return       0.
+*
+*/
+static
+DWORD
+WINAPI
+FlightRecorderThreadProc (
+    _In_ LPVOID Parameter
+    )
+{
+    HANDLE waitHandles[3];
+    DWORD waitResult;
+    FLIGHT_TRIGGER trigger;
+
+    UNREFERENCED_PARAMETER(Parameter);
+
+    waitHandles[0] = k_FlightRecorder.StopEvent;
+    waitHandles[1] = k_FlightRecorder.TriggerEvent;
+    waitHandles[2] = k_FlightRecorder.NamedTriggerEvent;
+
+    for (;;)
+    {
+        waitResult = WaitForMultipleObjects(((waitHandles[2] != NULL) ? 3 : 2),
+                                            waitHandles,
+                                            FALSE,
+                                            INFINITE);
+        if ((waitResult != (WAIT_OBJECT_0 + 1)) &&
+            (waitResult != (WAIT_OBJECT_0 + 2)))
+        {
+            break;
+        }
+
+        //
+        // Hold off the internal triggers until this dump is done.
+        //
+        if (waitResult == (WAIT_OBJECT_0 + 2))
+        {
+            _InterlockedCompareExchange(&k_FlightRecorder.PendingTrigger, FlightTriggerEvent, FlightTriggerNone);
+            trigger = FlightTriggerEvent;
+        }
+        else
+        {
+            trigger = static_cast<FLIGHT_TRIGGER>(k_FlightRecorder.PendingTrigger);
+        }
+
+        k_FlightRecorder.Statistics.Triggers[trigger]++;
+
+        //
+        // Stopping during the wait still dumps - the trigger fired.
+        //
+        waitResult = WaitForSingleObject(k_FlightRecorder.StopEvent, FLIGHT_RECORDER_POST_TRIGGER_MS);
+
+        DumpFlightRecorder(trigger);
+
+        if ((waitResult == WAIT_OBJECT_0) ||
+            (WaitForSingleObject(k_FlightRecorder.StopEvent, FLIGHT_RECORDER_HOLDOFF_MS) == WAIT_OBJECT_0))
+        {
+            break;
+        }
+
+        ResetEvent(k_FlightRecorder.TriggerEvent);
+        _InterlockedExchange(&k_FlightRecorder.PendingTrigger, FlightTriggerNone);
+    }
+
+    return 0;
+}
+
+/**
+*
+* @brief        Allocates the ring and starts the dump thread.
+* @param[in]    OutputPath - The user-provided path. Dumps are numbered after its stem.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+StartFlightRecorder (
+    _In_ const wchar_t* OutputPath
+    )
+{
+    bool result;
+    const wchar_t* fileName;
+    const wchar_t* extension;
+
+    result = false;
+
+    InitializeSRWLock(&k_FlightRecorder.Lock);
+
+    //
+    // Commit the whole ring now. Steady state never allocates.
+    //
+    k_FlightRecorder.Ring.assign(static_cast<SIZE_T>(k_FlightRecorderRingBytes), 0);
+    k_FlightRecorder.Head = 0;
+    k_FlightRecorder.Tail = 0;
+    k_FlightRecorder.End = 0;
+    k_FlightRecorder.Wrapped = false;
+    k_FlightRecorder.Records = 0;
+    k_FlightRecorder.LastTimeStamp = 0;
+    k_FlightRecorder.RateWindowStart = 0;
+    k_FlightRecorder.RateCount = 0;
+    k_FlightRecorder.PendingTrigger = FlightTriggerNone;
+    k_FlightRecorder.NextSequence = 1;
+
+    RtlZeroMemory(&k_FlightRecorder.Statistics, sizeof(k_FlightRecorder.Statistics));
+
+    //
+    // "C:\Out\Incident.csv" dumps to "C:\Out\Incident.000001.vraw" and so on.
+    //
+    fileName = wcsrchr(OutputPath, L'\\');
+    fileName = ((fileName != NULL) ? (fileName + 1) : OutputPath);
+
+    extension = wcsrchr(fileName, L'.');
+    extension = ((extension != NULL) ? extension : (fileName + wcslen(fileName)));
+
+    k_FlightRecorder.Stem.assign(OutputPath, extension);
+
+    k_FlightRecorder.StopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    k_FlightRecorder.TriggerEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if ((k_FlightRecorder.StopEvent == NULL) ||
+        (k_FlightRecorder.TriggerEvent == NULL))
+    {
+        wprintf(L"[-] Error! CreateEventW failed in StartFlightRecorder. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    //
+    // The named event is a convenience - carry on without it.
+    //
+    k_FlightRecorder.NamedTriggerEvent = CreateEventW(NULL, FALSE, FALSE, k_TriggerEventName);
+    if (k_FlightRecorder.NamedTriggerEvent == NULL)
+    {
+        wprintf(L"[-] Warning! Unable to create the trigger event %s. (GLE: %d)\n", k_TriggerEventName, GetLastError());
+    }
+
+    k_FlightRecorder.ThreadHandle = CreateThread(NULL,
+                                                 0,
+                                                 FlightRecorderThreadProc,
+                                                 NULL,
+                                                 0,
+                                                 NULL);
+    if (k_FlightRecorder.ThreadHandle == NULL)
+    {
+        wprintf(L"[-] Error! CreateThread failed in StartFlightRecorder. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    SetConsoleCtrlHandler(FlightRecorderConsoleHandler, TRUE);
+
+    k_FlightRecorderEnabled = true;
+
+    wprintf(L"[+] Flight recorder: %llu MB ring", (k_FlightRecorderRingBytes / (1024 * 1024)));
+
+    if (k_FlightRecorderWindowSeconds != 0)
+    {
+        wprintf(L", dumping the last %lu seconds of it", k_FlightRecorderWindowSeconds);
+    }
+
+    wprintf(L" to %s.<n>%s\n", k_FlightRecorder.Stem.c_str(), FLIGHT_RECORDER_CAPTURE_EXTENSION);
+
+    wprintf(L"[+] Flight recorder triggers: Ctrl+Break");
+
+    if (k_FlightRecorder.NamedTriggerEvent != NULL)
+    {
+        wprintf(L", event %s", k_TriggerEventName);
+    }
+
+    if (k_TriggerCallsPerSecond != 0)
+    {
+        wprintf(L", over %lu secure calls/s", k_TriggerCallsPerSecond);
+    }
+
+    if (k_TriggerLatencyMicroseconds != 0)
+    {
+        wprintf(L", a secure call over %lu us", k_TriggerLatencyMicroseconds);
+    }
+
+    wprintf(L"\n");
+
+    result = true;
+
+Exit:
+    if (!result)
+    {
+        if (k_FlightRecorder.StopEvent != NULL)
+        {
+            CloseHandle(k_FlightRecorder.StopEvent);
+            k_FlightRecorder.StopEvent = NULL;
+        }
+
+        if (k_FlightRecorder.TriggerEvent != NULL)
+        {
+            CloseHandle(k_FlightRecorder.TriggerEvent);
+            k_FlightRecorder.TriggerEvent = NULL;
+        }
+
+        if (k_FlightRecorder.NamedTriggerEvent != NULL)
+        {
+            CloseHandle(k_FlightRecorder.NamedTriggerEvent);
+            k_FlightRecorder.NamedTriggerEvent = NULL;
+        }
+
+        k_FlightRecorder.Ring.clear();
+        k_FlightRecorder.Ring.shrink_to_fit();
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Determines if events go to the flight recorder.
+* @return       true if the flight recorder is running, otherwise false.
+*
+*/
+bool
+IsFlightRecorderEnabled ()
+{
+    return k_FlightRecorderEnabled;
+}
+
+/**
+*
+* @brief        Adds an image load to the flight recorder's module table.
+* @param[in]    ImageBase - The base address of the image.
+* @param[in]    ImageSize - The size of the image.
+* @param[in]    TimeDateStamp - The image's PE TimeDateStamp.
+* @param[in]    ImageChecksum - The image's PE checksum.
+* @param[in]    ProcessId - The process the image was loaded into.
+* @param[in]    ImagePath - The NT path of the image.
+*
+*/
+void
+RecordFlightRecorderModule (
+    _In_ ULONG_PTR ImageBase,
+    _In_ ULONG ImageSize,
+    _In_ ULONG TimeDateStamp,
+    _In_ ULONG ImageChecksum,
+    _In_ ULONG ProcessId,
+    _In_ const wchar_t* ImagePath
+    )
+{
+    RAW_RECORD_HEADER header;
+    RAW_MODULE_RECORD moduleRecord;
+    SIZE_T pathSize;
+    SIZE_T offset;
+
+    if (!k_FlightRecorderEnabled)
+    {
+        return;
+    }
+
+    pathSize = ((wcslen(ImagePath) + 1) * sizeof(wchar_t));
+
+    header.Type = RawRecordModule;
+    header.Reserved = 0;
+    header.Size = static_cast<uint32_t>(sizeof(header) + sizeof(moduleRecord) + pathSize);
+    header.Size = ((header.Size + (RAW_RECORD_ALIGNMENT - 1)) & ~static_cast<uint32_t>(RAW_RECORD_ALIGNMENT - 1));
+
+    moduleRecord.ImageBase = ImageBase;
+    moduleRecord.ImageSize = ImageSize;
+    moduleRecord.TimeDateStamp = TimeDateStamp;
+    moduleRecord.ImageChecksum = ImageChecksum;
+    moduleRecord.ProcessId = ProcessId;
+
+    AcquireSRWLockExclusive(&k_FlightRecorder.Lock);
+
+    offset = k_FlightRecorder.ModuleRecords.size();
+
+    k_FlightRecorder.ModuleRecords.resize(offset + header.Size);
+
+    RtlCopyMemory(&k_FlightRecorder.ModuleRecords[offset], &header, sizeof(header));
+    RtlCopyMemory(&k_FlightRecorder.ModuleRecords[offset + sizeof(header)], &moduleRecord, sizeof(moduleRecord));
+    RtlCopyMemory(&k_FlightRecorder.ModuleRecords[offset + sizeof(header) + sizeof(moduleRecord)], ImagePath, pathSize);
+
+    ReleaseSRWLockExclusive(&k_FlightRecorder.Lock);
+}
+
+/**
+*
+* @brief        Records a correlated event and its raw frame addresses in the ring.
+*               This is the whole per-event cost in flight recorder mode.
+* @param[in]    Vtl1Data - The "primal" VTL 1 enter event data.
+* @param[in]    CallStack - The raw list of stack frame addresses.
+* @param[in]    NumberOfFrames - The number of stack frames.
+*
+*/
+void
+RecordFlightRecorderEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    RAW_RECORD_HEADER header;
+    RAW_EVENT_RECORD eventRecord;
+    SIZE_T recordLength;
+    UCHAR* record;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    QueryPerformanceCounter(&start);
+
+    //
+    // The frame count is 16 bits on disk. ETW stacks are far shorter.
+    //
+    NumberOfFrames = (std::min)(NumberOfFrames, static_cast<ULONG>(MAXUSHORT));
+
+    recordLength = (sizeof(header) + sizeof(eventRecord) + (NumberOfFrames * sizeof(uint64_t)));
+
+    header.Type = RawRecordEvent;
+    header.Reserved = 0;
+    header.Size = static_cast<uint32_t>((recordLength + (RAW_RECORD_ALIGNMENT - 1)) & ~static_cast<SIZE_T>(RAW_RECORD_ALIGNMENT - 1));
+
+    eventRecord.TimeStamp = Vtl1Data->Vtl1EnterTime;
+    eventRecord.ProcessId = Vtl1Data->ProcessId;
+    eventRecord.ThreadId = Vtl1Data->ThreadId;
+    eventRecord.ProcessNameId = Vtl1Data->ProcessNameId;
+    eventRecord.ThreadNameId = Vtl1Data->ThreadNameId;
+    eventRecord.SecureCallNumber = Vtl1Data->SecureCallNumber;
+    eventRecord.NumberOfFrames = static_cast<uint16_t>(NumberOfFrames);
+    eventRecord.Reserved = 0;
+
+    AcquireSRWLockExclusive(&k_FlightRecorder.Lock);
+
+    record = ReserveFlightRecord(header.Size);
+    if (record == NULL)
+    {
+        k_FlightRecorder.Statistics.EventsDropped++;
+        goto Exit;
+    }
+
+    RtlCopyMemory(record, &header, sizeof(header));
+    RtlCopyMemory(record + sizeof(header), &eventRecord, sizeof(eventRecord));
+
+    //
+    // Frames are always 64 bits, as on disk.
+    //
+    for (ULONG i = 0; i < NumberOfFrames; i++)
+    {
+        uint64_t frame;
+
+        frame = CallStack[i];
+
+        RtlCopyMemory(record + sizeof(header) + sizeof(eventRecord) + (i * sizeof(uint64_t)), &frame, sizeof(frame));
+    }
+
+    RtlZeroMemory(record + recordLength, (header.Size - recordLength));
+
+    NoteFlightRecorderName(Vtl1Data->ProcessNameId);
+    NoteFlightRecorderName(Vtl1Data->ThreadNameId);
+
+    k_FlightRecorder.LastTimeStamp = (std::max)(k_FlightRecorder.LastTimeStamp, static_cast<ULONGLONG>(Vtl1Data->Vtl1EnterTime));
+    k_FlightRecorder.Statistics.EventsRecorded++;
+
+Exit:
+    ReleaseSRWLockExclusive(&k_FlightRecorder.Lock);
+
+    QueryPerformanceCounter(&end);
+
+    k_FlightRecorder.Statistics.RecordTicks += (end.QuadPart - start.QuadPart);
+}
+
+/**
+*
+* @brief        Checks the secure call rate trigger. Called for every VTL 1 enter.
+* @param[in]    TimeStamp - The VTL 1 enter timestamp.
+*
+*/
+void
+NoteFlightRecorderSecureCall (
+    _In_ ULONGLONG TimeStamp
+    )
+{
+    if ((!k_FlightRecorderEnabled) ||
+        (k_TriggerCallsPerSecond == 0))
+    {
+        return;
+    }
+
+    //
+    // Fixed one second windows, from the first call in each.
+    //
+    if ((TimeStamp - k_FlightRecorder.RateWindowStart) >= k_TriggerRateWindowTicks)
+    {
+        k_FlightRecorder.RateWindowStart = TimeStamp;
+        k_FlightRecorder.RateCount = 0;
+    }
+
+    if (++k_FlightRecorder.RateCount == (k_TriggerCallsPerSecond + 1))
+    {
+        RequestFlightRecorderDump(FlightTriggerRate);
+    }
+}
+
+/**
+*
+* @brief        Determines if the flight recorder needs secure calls timed.
+* @return       true if the latency trigger is on, otherwise false.
+*
+*/
+bool
+IsFlightRecorderTimingSecureCalls ()
+{
+    return ((k_FlightRecorderEnabled) &&
+            (k_TriggerLatencyMicroseconds != 0));
+}
+
+/**
+*
+* @brief        Checks the secure call latency trigger. Called for every timed
+*               secure call (VTL 1 enter to exit on the same thread).
+* @param[in]    Latency - The secure call's latency, in QPC ticks.
+*
+*/
+void
+NoteFlightRecorderSecureCallLatency (
+    _In_ ULONGLONG Latency
+    )
+{
+    if (!IsFlightRecorderTimingSecureCalls())
+    {
+        return;
+    }
+
+    k_FlightRecorder.Statistics.LongestCallTicks = (std::max)(k_FlightRecorder.Statistics.LongestCallTicks, Latency);
+
+    if (Latency >= k_TriggerLatencyTicks)
+    {
+        RequestFlightRecorderDump(FlightTriggerLatency);
+    }
+}
+
+/**
+*
+* @brief        Stops the dump thread (finishing a pending dump) and frees the ring.
+*               Called on Vtl1Mon exit, after the trace has stopped delivering events.
+*
+*/
+void
+StopFlightRecorder ()
+{
+    const FLIGHT_RECORDER_STATISTICS* statistics;
+    LARGE_INTEGER localFrequency;
+    double frequency;
+
+    if (!k_FlightRecorderEnabled)
+    {
+        return;
+    }
+
+    SetConsoleCtrlHandler(FlightRecorderConsoleHandler, FALSE);
+
+    SetEvent(k_FlightRecorder.StopEvent);
+
+    WaitForSingleObject(k_FlightRecorder.ThreadHandle, INFINITE);
+
+    CloseHandle(k_FlightRecorder.ThreadHandle);
+    CloseHandle(k_FlightRecorder.StopEvent);
+    CloseHandle(k_FlightRecorder.TriggerEvent);
+
+    if (k_FlightRecorder.NamedTriggerEvent != NULL)
+    {
+        CloseHandle(k_FlightRecorder.NamedTriggerEvent);
+    }
+
+    k_FlightRecorder.ThreadHandle = NULL;
+    k_FlightRecorder.StopEvent = NULL;
+    k_FlightRecorder.TriggerEvent = NULL;
+    k_FlightRecorder.NamedTriggerEvent = NULL;
+
+    k_FlightRecorderEnabled = false;
+
+    statistics = &k_FlightRecorder.Statistics;
+
+    //
+    // Record and dump times are our own QPC reads, not event time.
+    //
+    QueryPerformanceFrequency(&localFrequency);
+
+    frequency = static_cast<double>(localFrequency.QuadPart);
+
+    wprintf(L"[+] Flight recorder statistics:\n");
+    wprintf(L"  [>] Events recorded: %llu (overwritten: %llu, dropped: %llu, in the ring: %llu)\n",
+            statistics->EventsRecorded,
+            statistics->EventsEvicted,
+            statistics->EventsDropped,
+            k_FlightRecorder.Records);
+    wprintf(L"  [>] Average record time: %.1f ns\n",
+            ((statistics->EventsRecorded != 0) ? ((statistics->RecordTicks * 1e9 / frequency) / statistics->EventsRecorded) : 0.0));
+    wprintf(L"  [>] Triggers: %llu rate, %llu latency, %llu Ctrl+Break, %llu event\n",
+            statistics->Triggers[FlightTriggerRate],
+            statistics->Triggers[FlightTriggerLatency],
+            statistics->Triggers[FlightTriggerSignal],
+            statistics->Triggers[FlightTriggerEvent]);
+
+    if (k_TriggerLatencyMicroseconds != 0)
+    {
+        wprintf(L"  [>] Longest secure call: %.1f us\n", (statistics->LongestCallTicks * 1e6 / GetSessionClock()->QpcFrequency));
+    }
+
+    wprintf(L"  [>] Dumps: %llu (%llu events, %llu failures)\n",
+            statistics->Dumps,
+            statistics->EventsDumped,
+            statistics->DumpFailures);
+    wprintf(L"  [>] Dump time: %.2f ms (symbolization: %.2f ms)\n",
+            (statistics->DumpTicks * 1e3 / frequency),
+            (statistics->SymbolizeTicks * 1e3 / frequency));
+
+    k_FlightRecorder.Ring.clear();
+    k_FlightRecorder.Ring.shrink_to_fit();
+    k_FlightRecorder.Names.clear();
+    k_FlightRecorder.ModuleRecords.clear();
+}
\ No newline at end of file
@@ -0,0 +1,550 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Format.cpp
+*
+* @summary:   Output formatting. Appends straight into a reusable buffer with
+*             hand-rolled integer conversion, instead of building temporary
+*             strings (std::to_wstring) for every field and frame.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Format.hpp"
+#include <stdio.h>
+#include <stdarg.h>
+#include <algorithm>
+
+//
+// Addresses and offsets are hex (0x...) unless asked otherwise. Set once,
+// before any formatting starts.
+//
+static bool k_DecimalAddresses = false;
+
+//
+// Timestamps are raw (QPC) unless asked for wall-clock times. Set once,
+// before any formatting starts.
+//
+static bool k_WallClockTimes = false;
+
+//
+// "00" through "99", so decimal conversion does two digits per division.
+//
+static const char k_DecimalDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char k_HexDigits[] = "0123456789abcdef";
+
+/**
+*
+* @brief        Chooses between hex (the default) and decimal addresses and offsets.
+* @param[in]    DecimalAddresses - true for decimal (the original output format).
+*
+*/
+void
+SetFormatDecimalAddresses (
+    _In_ bool DecimalAddresses
+    )
+{
+    k_DecimalAddresses = DecimalAddresses;
+}
+
+/**
+*
+* @brief        Chooses between raw (QPC) timestamps (the default) and wall-clock
+*               (UTC) times in the CSV.
+* @param[in]    WallClockTimes - true for wall-clock times.
+*
+*/
+void
+SetFormatWallClockTimes (
+    _In_ bool WallClockTimes
+    )
+{
+    k_WallClockTimes = WallClockTimes;
+}
+
+/**
+*
+* @brief        Determines if the CSV has wall-clock times.
+* @return       true if it does, otherwise false.
+*
+*/
+bool
+IsFormatWallClockTimes ()
+{
+    return k_WallClockTimes;
+}
+
+/**
+*
+* @brief        Empties a format buffer without giving back its memory.
+* @param[in]    Buffer - The buffer.
+*
+*/
+void
+ResetFormatBuffer (
+    _Inout_ PFORMAT_BUFFER Buffer
+    )
+{
+    if (Buffer->Data.empty())
+    {
+        Buffer->Data.resize(FORMAT_BUFFER_INITIAL_SIZE);
+    }
+
+    Buffer->Length = 0;
+}
+
+/**
+*
+* @brief        Makes room at the end of a format buffer. Does not change the
+*               buffer's length.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Count - The number of bytes needed.
+* @return       Where the bytes go.
+*
+*/
+char*
+ReserveFormatBuffer (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ size_t Count
+    )
+{
+    if ((Buffer->Length + Count) > Buffer->Data.size())
+    {
+        Buffer->Data.resize((std::max)(Buffer->Data.size() * 2,
+                                       (std::max)(Buffer->Length + Count, static_cast<size_t>(FORMAT_BUFFER_INITIAL_SIZE))));
+    }
+
+    return (Buffer->Data.data() + Buffer->Length);
+}
+
+/**
+*
+* @brief        Appends UTF-8 bytes.
+* @param[in]    Buffer - The buffer.
+* @param[in]    String - The bytes.
+* @param[in]    Length - The number of bytes.
+*
+*/
+void
+FormatAppend (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* String,
+    _In_ size_t Length
+    )
+{
+    char* destination;
+
+    destination = ReserveFormatBuffer(Buffer, Length);
+
+    memcpy(destination, String, Length);
+
+    Buffer->Length += Length;
+}
+
+/**
+*
+* @brief        Appends a NULL-terminated UTF-8 string. Names are transcoded once,
+*               when they are first seen, so rows only ever copy UTF-8.
+* @param[in]    Buffer - The buffer.
+* @param[in]    String - The string.
+*
+*/
+void
+FormatAppendString (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* String
+    )
+{
+    FormatAppend(Buffer, String, strlen(String));
+}
+
+/**
+*
+* @brief        Appends a NULL-terminated UTF-8 string as one CSV field (RFC
+*               4180): quoted, with quotes doubled, if it holds a comma, a quote
+*               or a line break, otherwise as-is.
+* @param[in]    Buffer - The buffer.
+* @param[in]    String - The string.
+*
+*/
+void
+FormatAppendCsvField (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* String
+    )
+{
+    size_t length;
+
+    length = strcspn(String, ",\"\r\n");
+
+    if (String[length] == '\0')
+    {
+        FormatAppend(Buffer, String, length);
+        return;
+    }
+
+    FormatAppendChar(Buffer, '"');
+
+    for (; *String != '\0'; String++)
+    {
+        if (*String == '"')
+        {
+            FormatAppendChar(Buffer, '"');
+        }
+
+        FormatAppendChar(Buffer, *String);
+    }
+
+    FormatAppendChar(Buffer, '"');
+}
+
+/**
+*
+* @brief        Appends one character.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Character - The character.
+*
+*/
+void
+FormatAppendChar (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ char Character
+    )
+{
+    *ReserveFormatBuffer(Buffer, 1) = Character;
+
+    Buffer->Length++;
+}
+
+/**
+*
+* @brief        Appends printf-style formatted text. For reports and other rare
+*               output only - rows use the appenders above.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Format - The format.
+*
+*/
+void
+FormatAppendPrintf (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* Format,
+    ...
+    )
+{
+    va_list arguments;
+    int length;
+
+    va_start(arguments, Format);
+    length = vsnprintf(NULL, 0, Format, arguments);
+    va_end(arguments);
+
+    if (length <= 0)
+    {
+        return;
+    }
+
+    //
+    // Room for the terminator vsnprintf always writes.
+    //
+    va_start(arguments, Format);
+    vsnprintf(ReserveFormatBuffer(Buffer, (static_cast<size_t>(length) + 1)), (static_cast<size_t>(length) + 1), Format, arguments);
+    va_end(arguments);
+
+    Buffer->Length += length;
+}
+
+/**
+*
+* @brief        Appends an unsigned integer in decimal.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Value - The value.
+*
+*/
+void
+FormatAppendDecimal (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Value
+    )
+{
+    char digits[20];
+    size_t position;
+
+    //
+    // Back to front, two digits at a time.
+    //
+    position = (sizeof(digits) / sizeof(digits[0]));
+
+    while (Value >= 100)
+    {
+        size_t pair;
+
+        pair = static_cast<size_t>((Value % 100) * 2);
+        Value /= 100;
+
+        digits[--position] = k_DecimalDigitPairs[pair + 1];
+        digits[--position] = k_DecimalDigitPairs[pair];
+    }
+
+    if (Value >= 10)
+    {
+        digits[--position] = k_DecimalDigitPairs[(Value * 2) + 1];
+        digits[--position] = k_DecimalDigitPairs[Value * 2];
+    }
+    else
+    {
+        digits[--position] = static_cast<char>('0' + Value);
+    }
+
+    FormatAppend(Buffer, digits + position, ((sizeof(digits) / sizeof(digits[0])) - position));
+}
+
+/**
+*
+* @brief        Appends an unsigned integer zero-padded to a fixed number of digits.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Value - The value (must fit).
+* @param[in]    Digits - The number of digits.
+*
+*/
+static
+void
+FormatAppendFixedDecimal (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Value,
+    _In_ size_t Digits
+    )
+{
+    char* destination;
+
+    destination = ReserveFormatBuffer(Buffer, Digits);
+
+    for (size_t i = Digits; i != 0; i--)
+    {
+        destination[i - 1] = static_cast<char>('0' + (Value % 10));
+        Value /= 10;
+    }
+
+    Buffer->Length += Digits;
+}
+
+/**
+*
+* @brief        Appends a FILETIME as an ISO 8601 UTC time, to the 100ns
+*               (2025-01-31T23:59:59.1234567Z).
+* @param[in]    Buffer - The buffer.
+* @param[in]    Time - The time.
+*
+*/
+void
+FormatAppendTime (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Time
+    )
+{
+    uint64_t seconds;
+    uint64_t secondOfDay;
+    int64_t days;
+    int64_t era;
+    uint64_t dayOfEra;
+    uint64_t yearOfEra;
+    uint64_t dayOfYear;
+    uint64_t monthIndex;
+    uint64_t day;
+    uint64_t month;
+    int64_t year;
+
+    seconds = (Time / 10000000ULL);
+    secondOfDay = (seconds % 86400);
+
+    //
+    // Days since 0000-03-01 (FILETIMEs count from 1601-01-01), then the
+    // civil date in 400-year eras.
+    //
+    days = (static_cast<int64_t>(seconds / 86400) + 584694);
+    era = (days / 146097);
+    dayOfEra = static_cast<uint64_t>(days - (era * 146097));
+    yearOfEra = ((dayOfEra - (dayOfEra / 1460) + (dayOfEra / 36524) - (dayOfEra / 146096)) / 365);
+    dayOfYear = (dayOfEra - ((365 * yearOfEra) + (yearOfEra / 4) - (yearOfEra / 100)));
+    monthIndex = (((5 * dayOfYear) + 2) / 153);
+    day = (dayOfYear - (((153 * monthIndex) + 2) / 5) + 1);
+    month = ((monthIndex < 10) ? (monthIndex + 3) : (monthIndex - 9));
+    year = (static_cast<int64_t>(yearOfEra) + (era * 400) + ((month <= 2) ? 1 : 0));
+
+    FormatAppendFixedDecimal(Buffer, static_cast<uint64_t>(year), 4);
+    FormatAppendChar(Buffer, '-');
+    FormatAppendFixedDecimal(Buffer, month, 2);
+    FormatAppendChar(Buffer, '-');
+    FormatAppendFixedDecimal(Buffer, day, 2);
+    FormatAppendChar(Buffer, 'T');
+    FormatAppendFixedDecimal(Buffer, (secondOfDay / 3600), 2);
+    FormatAppendChar(Buffer, ':');
+    FormatAppendFixedDecimal(Buffer, ((secondOfDay / 60) % 60), 2);
+    FormatAppendChar(Buffer, ':');
+    FormatAppendFixedDecimal(Buffer, (secondOfDay % 60), 2);
+    FormatAppendChar(Buffer, '.');
+    FormatAppendFixedDecimal(Buffer, (Time % 10000000ULL), 7);
+    FormatAppendChar(Buffer, 'Z');
+}
+
+/**
+*
+* @brief        Appends an unsigned integer in hex, with a 0x prefix and no padding.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Value - The value.
+*
+*/
+void
+FormatAppendHex (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Value
+    )
+{
+    char* destination;
+    size_t nibbles;
+
+    nibbles = 1;
+
+    while ((nibbles < 16) &&
+           ((Value >> (nibbles * 4)) != 0))
+    {
+        nibbles++;
+    }
+
+    destination = ReserveFormatBuffer(Buffer, nibbles + 2);
+
+    destination[0] = '0';
+    destination[1] = 'x';
+
+    for (size_t i = 0; i < nibbles; i++)
+    {
+        destination[2 + i] = k_HexDigits[(Value >> ((nibbles - 1 - i) * 4)) & 0xF];
+    }
+
+    Buffer->Length += (nibbles + 2);
+}
+
+/**
+*
+* @brief        Appends an address or offset, in the selected base.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Value - The value.
+*
+*/
+void
+FormatAppendAddress (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Value
+    )
+{
+    if (k_DecimalAddresses)
+    {
+        FormatAppendDecimal(Buffer, Value);
+    }
+    else
+    {
+        FormatAppendHex(Buffer, Value);
+    }
+}
+
+/**
+*
+* @brief        Ends a frame.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Separator - The separator, or FORMAT_NO_SEPARATOR.
+*
+*/
+static
+void
+FormatFrameSeparator (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ char Separator
+    )
+{
+    if (Separator != FORMAT_NO_SEPARATOR)
+    {
+        FormatAppendChar(Buffer, Separator);
+    }
+}
+
+/**
+*
+* @brief        Appends a frame no image covers: "<address>".
+* @param[in]    Buffer - The buffer.
+* @param[in]    Address - The frame address.
+* @param[in]    Separator - Appended after the frame, or FORMAT_NO_SEPARATOR.
+*
+*/
+void
+FormatUnknownFrame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ uint64_t Address,
+    _In_ char Separator
+    )
+{
+    FormatAppendAddress(Buffer, Address);
+    FormatFrameSeparator(Buffer, Separator);
+}
+
+/**
+*
+* @brief        Appends a frame in an image without symbols: "<image> + <offset>".
+* @param[in]    Buffer - The buffer.
+* @param[in]    ImageName - The image (UTF-8).
+* @param[in]    Offset - The offset of the frame from the image base.
+* @param[in]    Separator - Appended after the frame, or FORMAT_NO_SEPARATOR.
+*
+*/
+void
+FormatImageFrame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* ImageName,
+    _In_ uint64_t Offset,
+    _In_ char Separator
+    )
+{
+    FormatAppendString(Buffer, ImageName);
+    FormatAppend(Buffer, " + ", 3);
+    FormatAppendAddress(Buffer, Offset);
+    FormatFrameSeparator(Buffer, Separator);
+}
+
+/**
+*
+* @brief        Appends a symbolized frame: "<image>!<symbol> + <displacement>".
+* @param[in]    Buffer - The buffer.
+* @param[in]    ImageName - The image (UTF-8).
+* @param[in]    SymbolName - The symbol or export (UTF-8).
+* @param[in]    Displacement - The offset of the frame from the symbol.
+* @param[in]    Separator - Appended after the frame, or FORMAT_NO_SEPARATOR.
+*
+*/
+void
+FormatSymbolFrame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const char* ImageName,
+    _In_ const char* SymbolName,
+    _In_ uint64_t Displacement,
+    _In_ char Separator
+    )
+{
+    FormatAppendString(Buffer, ImageName);
+    FormatAppendChar(Buffer, '!');
+    FormatAppendString(Buffer, SymbolName);
+    FormatAppend(Buffer, " + ", 3);
+    FormatAppendAddress(Buffer, Displacement);
+    FormatFrameSeparator(Buffer, Separator);
+}
\ No newline at end of file
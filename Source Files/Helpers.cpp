@@ -15,7 +15,34 @@
 #include "Nodes.hpp"
 #include "Symbols.hpp"
 #include "Trace.hpp"
-#include <string>
+#include "Processes.hpp"
+#include "RawCapture.hpp"
+#include "FlightRecorder.hpp"
+#include "TopK.hpp"
+#include "Aggregate.hpp"
+#include "Anomaly.hpp"
+#include "Rollup.hpp"
+#include "Timeline.hpp"
+#include "Sequence.hpp"
+#include "Ring.hpp"
+#include "SegmentedOutput.hpp"
+#include "Clock.hpp"
+
+//
+// Rows are formatted into a per-thread buffer which is reused, so steady
+// state formatting does not touch the heap.
+//
+static thread_local FORMAT_BUFFER k_RowBuffer;
+
+//
+// The CSV output (compressed and rotated as configured).
+//
+static SEGMENTED_OUTPUT k_OutputFile;
+
+//
+// Every segment starts with the headings (UTF-8, like every row).
+//
+static const char k_CsvHeadings[] = "TIMESTAMP,SECURE CALL NUMBER,PROCESS ID,PROCESS NAME,THREAD ID,THREAD NAME,CALL STACK\n";
 
 /**
 *
@@ -29,76 +56,117 @@
 void
 ConstructCallStackStringAndPublishData (
     _In_ PVTL1_ENTER_NODE Vtl1Data,
-    _In_ ULONG_PTR* CallStack,
+    _In_ const ULONG_PTR* CallStack,
     _In_ ULONG NumberOfFrames
     )
 {
-    IMAGE_NODE imageNode;
-    ULONG_PTR offset;
-    std::wstring stackAsString;
-    wchar_t* frameString;
+    //
+    // Heavy hitters are counted whatever the output is.
+    //
+    if (IsTopKTrackingEnabled())
+    {
+        TrackTopKEvent(Vtl1Data, CallStack, NumberOfFrames);
+    }
 
-    offset = 0;
-    frameString = NULL;
+    //
+    // So are secure call rates, against their baselines.
+    //
+    if (IsAnomalyDetectionEnabled())
+    {
+        TrackAnomalyEvent(Vtl1Data, CallStack, NumberOfFrames);
+    }
 
-    RtlZeroMemory(&imageNode, sizeof(imageNode));
+    //
+    // Sequences take an example stack when they first get a counter.
+    //
+    if (IsSequenceMiningEnabled())
+    {
+        TrackSequenceEvent(Vtl1Data, CallStack, NumberOfFrames);
+    }
 
-    for (ULONG i = 0; i < NumberOfFrames; i++)
+    //
+    // And the timeline gets the stack at the start of the call's slice.
+    //
+    if (IsTimelineEnabled())
     {
-        if (!GetImageDataFromAddress(CallStack[i], &imageNode))
-        {
-            //
-            // Unknown
-            //
-            stackAsString += std::to_wstring(CallStack[i]);
-            stackAsString += L"|";
-            continue;
-        }
+        RecordTimelineStack(Vtl1Data, CallStack, NumberOfFrames);
+    }
 
-        frameString = ConvertAddressToFrameStringWithSymbol(CallStack[i],
-                                                            imageNode.ImageName);
-        if (frameString == NULL)
-        {
-            //
-            // Unknown
-            // We do not have symbols, but we _do_ have image data!
-            //
-            offset = (CallStack[i] - imageNode.ImageBase);
-
-            //
-            // Compute the string.
-            //
-            stackAsString += imageNode.ImageName;
-            stackAsString += L" + ";
-            stackAsString += std::to_wstring(offset);
-            stackAsString += L"|";
-            continue;
-        }
+    //
+    // Other tools on the host follow the export ring.
+    //
+    if (IsExportRingEnabled())
+    {
+        PublishExportRingEvent(Vtl1Data, CallStack, NumberOfFrames);
+    }
 
-        //
-        // Immediately append the string so we can free the return
-        // value from ConvertAddressToFrameStringWithSymbol.
-        //
-        stackAsString.append(frameString);
+    //
+    // Flight recorder: the addresses go to the in-memory ring and are
+    // only symbolized if a trigger dumps them.
+    //
+    if (IsFlightRecorderEnabled())
+    {
+        RecordFlightRecorderEvent(Vtl1Data, CallStack, NumberOfFrames);
+        return;
+    }
+
+    //
+    // Deferred symbolization: the addresses go to disk as-is and the
+    // "symbolize" command resolves them later, somewhere else.
+    //
+    if (IsRawCaptureEnabled())
+    {
+        WriteRawCaptureEvent(Vtl1Data, CallStack, NumberOfFrames);
+        return;
+    }
 
-        free(frameString);
+    ResetFormatBuffer(&k_RowBuffer);
 
-        //
-        // Reset the current in-scope frame string and offset.
-        //
-        frameString = NULL;
-        offset = 0;
+    FormatVtl1CsvFields(&k_RowBuffer,
+                        (IsFormatWallClockTimes() ?
+                         GetClockTime(GetSessionClock(), Vtl1Data->Vtl1EnterTime) :
+                         Vtl1Data->Vtl1EnterTime),
+                        GetSecureCallName(Vtl1Data->SecureCallNumber),
+                        Vtl1Data->SecureCallNumber,
+                        Vtl1Data->ProcessId,
+                        GetInternedName(Vtl1Data->ProcessNameId),
+                        Vtl1Data->ThreadId,
+                        GetInternedName(Vtl1Data->ThreadNameId));
+
+    for (ULONG i = 0; i < NumberOfFrames; i++)
+    {
+        FormatVtl1Frame(&k_RowBuffer, CallStack[i], FORMAT_FRAME_SEPARATOR);
     }
 
+    FinishVtl1CsvLine(&k_RowBuffer);
+
     //
     // Write it to the file
     //
-    WriteVtl1DataAndCallStackToFile(Vtl1Data,
-                                    stackAsString.c_str());
+    WriteVtl1DataAndCallStackToFile(&k_RowBuffer, Vtl1Data->Vtl1EnterTime);
 
     return;
 }
 
+/**
+*
+* @brief        Rotates the CSV output. The new segment gets its own headings.
+* @param[in]    Output - The output.
+*
+*/
+static
+void
+RotateCsvOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    if ((RotateSegmentedOutput(Output)) &&
+        (!WriteSegmentedOutput(Output, k_CsvHeadings, (sizeof(k_CsvHeadings) - sizeof(char)))))
+    {
+        wprintf(L"[-] Error! WriteFile failed in RotateCsvOutput. (GLE: %d)\n", GetLastError());
+    }
+}
+
 /**
 *
 * @brief        Creates the CSV output file.
@@ -112,31 +180,20 @@ CreateOutputFile (
     )
 {
     bool result;
-    const wchar_t csvHeadings[] = L"TIMESTAMP,SECURE CALL NUMBER,PROCESS ID,THREAD ID, CALL STACK\n";
 
     result = false;
 
-    k_OutputFileHandle = CreateFileW(FilePath,
-                                     GENERIC_READ | GENERIC_WRITE,
-                                     0,
-                                     NULL,
-                                     CREATE_ALWAYS,
-                                     0,
-                                     NULL);
-    if (k_OutputFileHandle == INVALID_HANDLE_VALUE)
+    if (!OpenSegmentedOutput(&k_OutputFile, FilePath, RotateCsvOutput))
     {
-        wprintf(L"[-] Error! CreateFileW failed in CreateOutputFile. (GLE: %d)\n", GetLastError());
         goto Exit;
     }
 
     //
-    // Write the headings.
+    // Write the headings
     //
-    if (WriteFile(k_OutputFileHandle,
-                  csvHeadings,
-                  sizeof(csvHeadings),
-                  NULL,
-                  NULL) == FALSE)
+    if (!WriteSegmentedOutput(&k_OutputFile,
+                              k_CsvHeadings,
+                              (sizeof(k_CsvHeadings) - sizeof(char))))
     {
         wprintf(L"[-] Error! WriteFile failed in CreateOutputFile. (GLE: %d)\n", GetLastError());
         goto Exit;
@@ -150,66 +207,286 @@ Exit:
 
 /**
 *
-* @brief        Write the final correlated event to the user-specified CSV file.
-* @param[in]    Vtl1Data - The "primal" event data.
-* @param[in]    CallStack - The "string-ified" call stack.
+* @brief        Formats the leading fields of a correlated event's CSV line. The
+*               call stack frames follow, then FinishVtl1CsvLine.
+* @param[in]    Buffer - Receives the fields (appended).
+* @param[in]    TimeStamp - The VTL 1 enter timestamp (a FILETIME with -walltime).
+* @param[in]    SecureCallName - The nt!_SKSERVICE name of the secure call (UTF-8).
+* @param[in]    SecureCallNumber - The secure call number.
+* @param[in]    ProcessId - The process ID.
+* @param[in]    ProcessName - The process name (UTF-8). Quoted if it needs to be.
+* @param[in]    ThreadId - The thread ID.
+* @param[in]    ThreadName - The thread name (UTF-8). Quoted if it needs to be.
 *
 */
 void
-WriteVtl1DataAndCallStackToFile (
-    _In_ PVTL1_ENTER_NODE Vtl1Data,
-    _In_ const wchar_t* CallStack
+FormatVtl1CsvFields (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ ULONGLONG TimeStamp,
+    _In_ const char* SecureCallName,
+    _In_ ULONG SecureCallNumber,
+    _In_ ULONG ProcessId,
+    _In_ const char* ProcessName,
+    _In_ ULONG ThreadId,
+    _In_ const char* ThreadName
+    )
+{
+    if (IsFormatWallClockTimes())
+    {
+        FormatAppendTime(Buffer, TimeStamp);
+    }
+    else
+    {
+        FormatAppendDecimal(Buffer, TimeStamp);
+    }
+
+    FormatAppendChar(Buffer, ',');
+    FormatAppendString(Buffer, SecureCallName);
+    FormatAppend(Buffer, " (", 2);
+    FormatAppendDecimal(Buffer, SecureCallNumber);
+    FormatAppend(Buffer, "),", 2);
+    FormatAppendDecimal(Buffer, ProcessId);
+    FormatAppendChar(Buffer, ',');
+    FormatAppendCsvField(Buffer, ProcessName);
+    FormatAppendChar(Buffer, ',');
+    FormatAppendDecimal(Buffer, ThreadId);
+    FormatAppendChar(Buffer, ',');
+    FormatAppendCsvField(Buffer, ThreadName);
+    FormatAppendChar(Buffer, ',');
+}
+
+/**
+*
+* @brief        Ends a CSV line.
+* @param[in]    Buffer - The line.
+*
+*/
+void
+FinishVtl1CsvLine (
+    _Inout_ PFORMAT_BUFFER Buffer
+    )
+{
+    FormatAppendChar(Buffer, '\n');
+}
+
+/**
+*
+* @brief        Formats a live stack frame: symbolized if we can, else relative
+*               to its image, else the bare address.
+* @param[in]    Buffer - Receives the frame (appended).
+* @param[in]    Address - The frame address.
+* @param[in]    Separator - Appended after the frame, or FORMAT_NO_SEPARATOR.
+*
+*/
+void
+FormatVtl1Frame (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ ULONG_PTR Address,
+    _In_ char Separator
     )
 {
-    std::wstring csvString;
-    SIZE_T stringSize;
-    wchar_t secureCallName[MAX_SYM_NAME];
+    IMAGE_NODE imageNode;
+
+    RtlZeroMemory(&imageNode, sizeof(imageNode));
+
+    if (!GetImageDataFromAddress(Address, &imageNode))
+    {
+        //
+        // Unknown
+        //
+        FormatUnknownFrame(Buffer, Address, Separator);
+        return;
+    }
 
-    RtlZeroMemory(&secureCallName, sizeof(secureCallName));
+    if (!FormatFrameWithSymbol(Buffer,
+                               Address,
+                               imageNode.ImageName,
+                               Separator))
+    {
+        //
+        // Unknown
+        // We do not have symbols, but we _do_ have image data!
+        //
+        FormatImageFrame(Buffer,
+                         imageNode.ImageName,
+                         (Address - imageNode.ImageBase),
+                         Separator);
+    }
+}
 
+/**
+*
+* @brief        Write the final correlated event to the user-specified CSV file.
+* @param[in]    Line - The formatted CSV line.
+* @param[in]    TimeStamp - The event's timestamp (for the segment index).
+*
+*/
+void
+WriteVtl1DataAndCallStackToFile (
+    _In_ const FORMAT_BUFFER* Line,
+    _In_ ULONGLONG TimeStamp
+    )
+{
     if (_InterlockedCompareExchange(&k_CanWriteToFile, TRUE, TRUE) == FALSE)
     {
         goto Exit;
     }
 
+    AcquireSegmentedOutput(&k_OutputFile);
+
     //
-    // First, convert the secure call value to the appropriate nt!_SKSERVICE
-    // enum value.
+    // Rotate between rows, never inside one.
     //
-    if (!k_SecureCallNamesInitialized)
+    if (IsSegmentRotationDue(&k_OutputFile, Line->Length))
     {
-        CreateListOfValidSecureCalls();
-        k_SecureCallNamesInitialized = true;
+        RotateCsvOutput(&k_OutputFile);
     }
 
-    csvString.append(std::to_wstring(Vtl1Data->Vtl1EnterTime));
-    csvString.append(L",");
-    csvString.append(GetSecureCallName(Vtl1Data->SecureCallNumber));
-    csvString.append(L" (");
-    csvString.append(std::to_wstring(Vtl1Data->SecureCallNumber));
-    csvString.append(L")");
-    csvString.append(L",");
-    csvString.append(std::to_wstring(Vtl1Data->ProcessId));
-    csvString.append(L",");
-    csvString.append(std::to_wstring(Vtl1Data->ThreadId));
-    csvString.append(L",");
-    csvString.append(CallStack);
-    csvString.append(L"\n");
+    if (WriteSegmentedOutput(&k_OutputFile,
+                             Line->Data.data(),
+                             Line->Length))
+    {
+        NoteSegmentedOutputEvent(&k_OutputFile, TimeStamp);
+    }
+    else
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteVtl1DataAndCallStackToFile. (GLE: %d)\n", GetLastError());
+    }
+
+    ReleaseSegmentedOutput(&k_OutputFile);
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        Writes already formatted data to the output file.
+* @param[in]    Buffer - The data.
+* @param[in]    Length - The length of the data, in bytes.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+WriteOutputBuffer (
+    _In_ const void* Buffer,
+    _In_ ULONG Length
+    )
+{
+    bool result;
+
+    result = false;
 
-    stringSize = (csvString.length() * sizeof(wchar_t) + sizeof(UNICODE_NULL));
+    AcquireSegmentedOutput(&k_OutputFile);
 
-    if (WriteFile(k_OutputFileHandle,
-                  csvString.data(),
-                  static_cast<DWORD>(stringSize),
-                  NULL,
-                  NULL) == FALSE)
+    if (!WriteSegmentedOutput(&k_OutputFile, Buffer, Length))
     {
-        wprintf(L"[-] Error! WriteFile failed in WriteVtl1DataAndCallStackToFile. (GLE: %d)\n", GetLastError());
+        wprintf(L"[-] Error! WriteFile failed in WriteOutputBuffer. (GLE: %d)\n", GetLastError());
         goto Exit;
     }
 
+    result = true;
+
 Exit:
-    return;
+    ReleaseSegmentedOutput(&k_OutputFile);
+
+    return result;
+}
+
+/**
+*
+* @brief        Closes the output file.
+*
+*/
+void
+CloseOutputFile ()
+{
+    CloseSegmentedOutput(&k_OutputFile);
+}
+
+/**
+*
+* @brief        Runs a worker routine on several threads and waits for all of them.
+* @param[in]    Routine - The worker routine.
+* @param[in]    Parameters - One parameter per thread.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+RunWorkerThreads (
+    _In_ LPTHREAD_START_ROUTINE Routine,
+    _In_ const std::vector<PVOID>& Parameters
+    )
+{
+    bool result;
+    std::vector<HANDLE> threads;
+
+    result = false;
+
+    for (PVOID parameter : Parameters)
+    {
+        HANDLE thread;
+
+        thread = CreateThread(NULL,
+                              0,
+                              Routine,
+                              parameter,
+                              0,
+                              NULL);
+        if (thread == NULL)
+        {
+            wprintf(L"[-] Error! CreateThread failed in RunWorkerThreads. (GLE: %d)\n", GetLastError());
+            goto Exit;
+        }
+
+        threads.push_back(thread);
+    }
+
+    result = true;
+
+Exit:
+    //
+    // Always wait for whatever did start.
+    //
+    if (!threads.empty())
+    {
+        WaitForMultipleObjects(static_cast<DWORD>(threads.size()),
+                               threads.data(),
+                               TRUE,
+                               INFINITE);
+    }
+
+    for (HANDLE thread : threads)
+    {
+        CloseHandle(thread);
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Converts the event-time settings (watermark, intervals, gaps and
+*               triggers) to ticks of the session clock, and starts the raw
+*               capture. Called once the clock is set - calibrated live, or a
+*               replayed trace's - and before the first event, since the trace
+*               may be from another machine.
+*
+*/
+void
+ApplySessionClock ()
+{
+    ULONGLONG qpcFrequency;
+
+    qpcFrequency = GetSessionClock()->QpcFrequency;
+
+    SetCorrelationQpcFrequency(qpcFrequency);
+    SetTopKQpcFrequency(qpcFrequency);
+    SetAnomalyQpcFrequency(qpcFrequency);
+    SetSequenceQpcFrequency(qpcFrequency);
+    SetFlightRecorderQpcFrequency(qpcFrequency);
+
+    StartRawCapture();
 }
 
 /**
@@ -225,21 +502,60 @@ CleanupVtl1MonResources ()
     //
     StopAndCleanupVtl1EnterExitTrace();
 
+    //
+    // Give up on anything still waiting in the reorder stage
+    //
+    FlushAndReportCorrelation();
+
+    //
+    // Aggregate snapshot, then the final heavy hitter report (both need
+    // symbols, the name caches and the top-K trackers)
+    //
+    WriteAggregateSnapshot();
+
+    StopTopKTracking();
+
+    StopAnomalyDetection();
+
+    StopSequenceMining();
+
+    StopRollups();
+
+    StopTimeline();
+
+    StopExportRing();
+
     //
     // Stop writing.
     //
     _InterlockedExchange(&k_CanWriteToFile, FALSE);
 
     //
-    // Close the file handle
+    // Close the output (flight recorder, CSV or raw capture)
     //
-    CloseHandle(k_OutputFileHandle);
+    if (IsFlightRecorderEnabled())
+    {
+        StopFlightRecorder();
+    }
+    else if (IsRawCaptureEnabled())
+    {
+        CloseRawCaptureFile();
+    }
+    else
+    {
+        CloseOutputFile();
+    }
 
     //
     // Destroy the vector of secure call names
     //
     DestroySecureCallNameVector();
 
+    //
+    // Destroy the process and thread name caches
+    //
+    DestroyProcessCache();
+
     //
     // Symbol cleanup
     //
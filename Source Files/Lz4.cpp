@@ -0,0 +1,769 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Lz4.cpp
+*
+* @summary:   A small, self-contained LZ4 block compressor and decompressor,
+*             plus the LZ4 frame format around it. Output files compressed
+*             with -compress are ordinary .lz4 files.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Lz4.hpp"
+#include <algorithm>
+
+#define XXHASH32_PRIME1 2654435761U
+#define XXHASH32_PRIME2 2246822519U
+#define XXHASH32_PRIME3 3266489917U
+#define XXHASH32_PRIME4 668265263U
+#define XXHASH32_PRIME5 374761393U
+
+//
+// Token nibbles saturate at 15; the rest of the length follows in bytes.
+//
+#define LZ4_TOKEN_MAX_LENGTH 15
+
+static
+inline
+uint32_t
+RotateLeft32 (
+    _In_ uint32_t Value,
+    _In_ uint32_t Count
+    )
+{
+    return ((Value << Count) | (Value >> (32 - Count)));
+}
+
+static
+inline
+uint32_t
+LoadUint32 (
+    _In_ const uint8_t* Data
+    )
+{
+    uint32_t value;
+
+    memcpy(&value, Data, sizeof(value));
+
+    return value;
+}
+
+static
+inline
+uint64_t
+LoadUint64 (
+    _In_ const uint8_t* Data
+    )
+{
+    uint64_t value;
+
+    memcpy(&value, Data, sizeof(value));
+
+    return value;
+}
+
+static
+inline
+void
+WriteLe32 (
+    _Out_ uint8_t* Data,
+    _In_ uint32_t Value
+    )
+{
+    Data[0] = static_cast<uint8_t>(Value);
+    Data[1] = static_cast<uint8_t>(Value >> 8);
+    Data[2] = static_cast<uint8_t>(Value >> 16);
+    Data[3] = static_cast<uint8_t>(Value >> 24);
+}
+
+/**
+*
+* @brief        Computes the xxHash32 of a buffer (the LZ4 frame checksum).
+* @param[in]    Data - The data.
+* @param[in]    Length - The number of bytes.
+* @param[in]    Seed - The seed.
+* @return       The hash.
+*
+*/
+uint32_t
+XxHash32 (
+    _In_ const void* Data,
+    _In_ size_t Length,
+    _In_ uint32_t Seed
+    )
+{
+    const uint8_t* current;
+    const uint8_t* end;
+    uint32_t hash;
+
+    current = static_cast<const uint8_t*>(Data);
+    end = current + Length;
+
+    if (Length >= 16)
+    {
+        uint32_t lanes[4];
+
+        lanes[0] = Seed + XXHASH32_PRIME1 + XXHASH32_PRIME2;
+        lanes[1] = Seed + XXHASH32_PRIME2;
+        lanes[2] = Seed;
+        lanes[3] = Seed - XXHASH32_PRIME1;
+
+        while ((end - current) >= 16)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                lanes[i] = RotateLeft32(lanes[i] + (ReadLe32(current) * XXHASH32_PRIME2), 13) * XXHASH32_PRIME1;
+                current += 4;
+            }
+        }
+
+        hash = (RotateLeft32(lanes[0], 1) +
+                RotateLeft32(lanes[1], 7) +
+                RotateLeft32(lanes[2], 12) +
+                RotateLeft32(lanes[3], 18));
+    }
+    else
+    {
+        hash = Seed + XXHASH32_PRIME5;
+    }
+
+    hash += static_cast<uint32_t>(Length);
+
+    while ((end - current) >= 4)
+    {
+        hash = RotateLeft32(hash + (ReadLe32(current) * XXHASH32_PRIME3), 17) * XXHASH32_PRIME4;
+        current += 4;
+    }
+
+    while (current < end)
+    {
+        hash = RotateLeft32(hash + (*current * XXHASH32_PRIME5), 11) * XXHASH32_PRIME1;
+        current++;
+    }
+
+    hash ^= (hash >> 15);
+    hash *= XXHASH32_PRIME2;
+    hash ^= (hash >> 13);
+    hash *= XXHASH32_PRIME3;
+    hash ^= (hash >> 16);
+
+    return hash;
+}
+
+/**
+*
+* @brief        Returns the most bytes a block of the given size can compress to.
+* @param[in]    Length - The uncompressed size.
+* @return       The worst-case compressed size.
+*
+*/
+size_t
+Lz4CompressBound (
+    _In_ size_t Length
+    )
+{
+    return (Length + (Length / 255) + 16);
+}
+
+/**
+*
+* @brief        Writes the extra bytes of a literal or match length.
+* @param[out]   Destination - Where the bytes go.
+* @param[in]    Length - The length, less the 15 already in the token.
+* @return       The end of what was written.
+*
+*/
+static
+uint8_t*
+WriteLz4ExtraLength (
+    _Out_ uint8_t* Destination,
+    _In_ size_t Length
+    )
+{
+    while (Length >= 255)
+    {
+        *Destination++ = 255;
+        Length -= 255;
+    }
+
+    *Destination++ = static_cast<uint8_t>(Length);
+
+    return Destination;
+}
+
+/**
+*
+* @brief        Writes the literals of a sequence along with its token.
+* @param[out]   Destination - Where the sequence goes.
+* @param[in]    Literals - The literal bytes.
+* @param[in]    LiteralLength - The number of literal bytes.
+* @param[out]   Token - Receives where the token was written.
+* @return       The end of what was written.
+*
+*/
+static
+uint8_t*
+WriteLz4Literals (
+    _Out_ uint8_t* Destination,
+    _In_ const uint8_t* Literals,
+    _In_ size_t LiteralLength,
+    _Out_ uint8_t** Token
+    )
+{
+    *Token = Destination++;
+
+    if (LiteralLength >= LZ4_TOKEN_MAX_LENGTH)
+    {
+        **Token = (LZ4_TOKEN_MAX_LENGTH << 4);
+        Destination = WriteLz4ExtraLength(Destination, (LiteralLength - LZ4_TOKEN_MAX_LENGTH));
+    }
+    else
+    {
+        **Token = static_cast<uint8_t>(LiteralLength << 4);
+    }
+
+    memcpy(Destination, Literals, LiteralLength);
+
+    return (Destination + LiteralLength);
+}
+
+/**
+*
+* @brief        Hashes the four bytes at a position.
+* @param[in]    Sequence - The four bytes.
+* @return       The hash table index.
+*
+*/
+static
+inline
+uint32_t
+HashLz4Sequence (
+    _In_ uint32_t Sequence
+    )
+{
+    return ((Sequence * XXHASH32_PRIME1) >> (32 - LZ4_HASH_LOG));
+}
+
+/**
+*
+* @brief        Compresses one independent LZ4 block (greedy, single hash probe).
+* @param[in]    State - Scratch state, reused across blocks.
+* @param[in]    Source - The data.
+* @param[in]    Length - The number of bytes.
+* @param[out]   Destination - Receives the block. Must have room for
+*                             Lz4CompressBound(Length) bytes.
+* @return       The compressed size.
+*
+*/
+size_t
+Lz4CompressBlock (
+    _Inout_ PLZ4_STATE State,
+    _In_ const uint8_t* Source,
+    _In_ size_t Length,
+    _Out_ uint8_t* Destination
+    )
+{
+    const uint8_t* current;
+    const uint8_t* anchor;
+    const uint8_t* end;
+    uint8_t* output;
+    uint8_t* token;
+
+    current = Source;
+    anchor = Source;
+    end = Source + Length;
+    output = Destination;
+
+    //
+    // Blocks too small to hold a match (the format wants the last 12 bytes
+    // free of match starts) are all literals.
+    //
+    if (Length > LZ4_MATCH_FIND_LIMIT)
+    {
+        const uint8_t* matchFindLimit;
+        const uint8_t* matchLimit;
+
+        matchFindLimit = end - LZ4_MATCH_FIND_LIMIT;
+        matchLimit = end - LZ4_LAST_LITERALS;
+
+        memset(State->HashTable, 0, sizeof(State->HashTable));
+
+        while (current < matchFindLimit)
+        {
+            const uint8_t* match;
+            const uint8_t* matchEnd;
+            const uint8_t* reference;
+            uint32_t sequence;
+            uint32_t hash;
+            size_t matchLength;
+            size_t offset;
+
+            sequence = LoadUint32(current);
+            hash = HashLz4Sequence(sequence);
+
+            match = Source + State->HashTable[hash];
+            State->HashTable[hash] = static_cast<uint32_t>(current - Source);
+
+            if ((match >= current) ||
+                ((current - match) > LZ4_MAX_DISTANCE) ||
+                (LoadUint32(match) != sequence))
+            {
+                //
+                // Step further the longer we go without a match, so
+                // incompressible data is skipped quickly.
+                //
+                current += (1 + ((current - anchor) >> 6));
+                continue;
+            }
+
+            //
+            // Grow the match backwards into the pending literals...
+            //
+            while ((current > anchor) &&
+                   (match > Source) &&
+                   (current[-1] == match[-1]))
+            {
+                current--;
+                match--;
+            }
+
+            //
+            // ...and forwards, eight bytes at a time, stopping short of the
+            // final literals.
+            //
+            matchEnd = current + LZ4_MIN_MATCH;
+            reference = match + LZ4_MIN_MATCH;
+
+            while (((matchEnd + sizeof(uint64_t)) <= matchLimit) &&
+                   (LoadUint64(matchEnd) == LoadUint64(reference)))
+            {
+                matchEnd += sizeof(uint64_t);
+                reference += sizeof(uint64_t);
+            }
+
+            while ((matchEnd < matchLimit) &&
+                   (*matchEnd == *reference))
+            {
+                matchEnd++;
+                reference++;
+            }
+
+            output = WriteLz4Literals(output, anchor, static_cast<size_t>(current - anchor), &token);
+
+            offset = static_cast<size_t>(current - match);
+            *output++ = static_cast<uint8_t>(offset);
+            *output++ = static_cast<uint8_t>(offset >> 8);
+
+            matchLength = static_cast<size_t>(matchEnd - current) - LZ4_MIN_MATCH;
+
+            if (matchLength >= LZ4_TOKEN_MAX_LENGTH)
+            {
+                *token |= LZ4_TOKEN_MAX_LENGTH;
+                output = WriteLz4ExtraLength(output, (matchLength - LZ4_TOKEN_MAX_LENGTH));
+            }
+            else
+            {
+                *token |= static_cast<uint8_t>(matchLength);
+            }
+
+            current = matchEnd;
+            anchor = current;
+
+            //
+            // Remember a position inside the match too; repeated rows
+            // (the common case in our output) then chain back to back.
+            //
+            if (current < matchFindLimit)
+            {
+                State->HashTable[HashLz4Sequence(LoadUint32(current - 2))] = static_cast<uint32_t>((current - 2) - Source);
+            }
+        }
+    }
+
+    output = WriteLz4Literals(output, anchor, static_cast<size_t>(end - anchor), &token);
+
+    return static_cast<size_t>(output - Destination);
+}
+
+/**
+*
+* @brief        Reads the extra bytes of a literal or match length.
+* @param[in]    Current - The position, advanced past the bytes.
+* @param[in]    End - The end of the block.
+* @param[in]    Length - The length, added to.
+* @return       true if the length was complete, false if the block ended.
+*
+*/
+static
+bool
+ReadLz4ExtraLength (
+    _Inout_ const uint8_t** Current,
+    _In_ const uint8_t* End,
+    _Inout_ size_t* Length
+    )
+{
+    uint8_t value;
+
+    do
+    {
+        if (*Current >= End)
+        {
+            return false;
+        }
+
+        value = *(*Current)++;
+        *Length += value;
+    } while (value == 255);
+
+    return true;
+}
+
+/**
+*
+* @brief        Decompresses one LZ4 block, appending to the output. Matches
+*               may reach back into earlier output (linked blocks).
+* @param[in]    Source - The block.
+* @param[in]    Length - The size of the block.
+* @param[inout] Output - The output so far.
+* @return       true on success, false if the block is malformed.
+*
+*/
+bool
+Lz4DecompressBlock (
+    _In_ const uint8_t* Source,
+    _In_ size_t Length,
+    _Inout_ std::vector<uint8_t>& Output
+    )
+{
+    const uint8_t* current;
+    const uint8_t* end;
+
+    current = Source;
+    end = Source + Length;
+
+    for (;;)
+    {
+        uint8_t token;
+        size_t literalLength;
+        size_t matchLength;
+        size_t offset;
+        size_t position;
+
+        if (current >= end)
+        {
+            return false;
+        }
+
+        token = *current++;
+
+        literalLength = (token >> 4);
+
+        if ((literalLength == LZ4_TOKEN_MAX_LENGTH) &&
+            (!ReadLz4ExtraLength(&current, end, &literalLength)))
+        {
+            return false;
+        }
+
+        if (static_cast<size_t>(end - current) < literalLength)
+        {
+            return false;
+        }
+
+        Output.insert(Output.end(), current, current + literalLength);
+        current += literalLength;
+
+        //
+        // The last sequence is literals only.
+        //
+        if (current == end)
+        {
+            break;
+        }
+
+        if ((end - current) < 2)
+        {
+            return false;
+        }
+
+        offset = (current[0] | (current[1] << 8));
+        current += 2;
+
+        if ((offset == 0) ||
+            (offset > Output.size()))
+        {
+            return false;
+        }
+
+        matchLength = (token & LZ4_TOKEN_MAX_LENGTH);
+
+        if ((matchLength == LZ4_TOKEN_MAX_LENGTH) &&
+            (!ReadLz4ExtraLength(&current, end, &matchLength)))
+        {
+            return false;
+        }
+
+        matchLength += LZ4_MIN_MATCH;
+
+        //
+        // Byte by byte: a match may overlap the bytes it produces.
+        //
+        position = Output.size();
+        Output.resize(position + matchLength);
+
+        for (size_t i = 0; i < matchLength; i++)
+        {
+            Output[position + i] = Output[position + i - offset];
+        }
+    }
+
+    return true;
+}
+
+/**
+*
+* @brief        Writes an LZ4 frame header: independent 1 MB blocks with
+*               block checksums, no content size or content checksum (so
+*               the writer never has to seek back).
+* @param[out]   Destination - Receives LZ4_FRAME_HEADER_SIZE bytes.
+* @return       The number of bytes written.
+*
+*/
+size_t
+Lz4WriteFrameHeader (
+    _Out_ uint8_t* Destination
+    )
+{
+    WriteLe32(Destination, LZ4_FRAME_MAGIC);
+
+    Destination[4] = (LZ4_FRAME_FLG_VERSION | LZ4_FRAME_FLG_BLOCK_INDEPENDENCE | LZ4_FRAME_FLG_BLOCK_CHECKSUM);
+    Destination[5] = (LZ4_FRAME_BLOCK_SIZE_ID << 4);
+    Destination[6] = static_cast<uint8_t>(XxHash32(Destination + 4, 2, 0) >> 8);
+
+    return LZ4_FRAME_HEADER_SIZE;
+}
+
+/**
+*
+* @brief        Returns the most bytes a framed block can take.
+* @param[in]    Length - The uncompressed size.
+* @return       The worst-case framed size (size, data and checksum).
+*
+*/
+size_t
+Lz4FrameBlockBound (
+    _In_ size_t Length
+    )
+{
+    return (sizeof(uint32_t) + Lz4CompressBound(Length) + sizeof(uint32_t));
+}
+
+/**
+*
+* @brief        Compresses and frames one block. Blocks which do not shrink
+*               are stored as-is.
+* @param[in]    State - Scratch state, reused across blocks.
+* @param[in]    Source - The data (at most LZ4_FRAME_BLOCK_SIZE bytes).
+* @param[in]    Length - The number of bytes.
+* @param[out]   Destination - Receives the block. Must have room for
+*                             Lz4FrameBlockBound(Length) bytes.
+* @return       The number of bytes written.
+*
+*/
+size_t
+Lz4WriteFrameBlock (
+    _Inout_ PLZ4_STATE State,
+    _In_ const uint8_t* Source,
+    _In_ size_t Length,
+    _Out_ uint8_t* Destination
+    )
+{
+    uint8_t* data;
+    size_t dataLength;
+
+    data = Destination + sizeof(uint32_t);
+
+    dataLength = Lz4CompressBlock(State, Source, Length, data);
+
+    if (dataLength >= Length)
+    {
+        memcpy(data, Source, Length);
+        dataLength = Length;
+
+        WriteLe32(Destination, static_cast<uint32_t>(dataLength | LZ4_FRAME_BLOCK_UNCOMPRESSED));
+    }
+    else
+    {
+        WriteLe32(Destination, static_cast<uint32_t>(dataLength));
+    }
+
+    WriteLe32(data + dataLength, XxHash32(data, dataLength, 0));
+
+    return (sizeof(uint32_t) + dataLength + sizeof(uint32_t));
+}
+
+/**
+*
+* @brief        Writes the end mark which closes a frame.
+* @param[out]   Destination - Receives four bytes.
+* @return       The number of bytes written.
+*
+*/
+size_t
+Lz4WriteFrameEnd (
+    _Out_ uint8_t* Destination
+    )
+{
+    WriteLe32(Destination, LZ4_FRAME_END_MARK);
+
+    return sizeof(uint32_t);
+}
+
+/**
+*
+* @brief        Determines if data starts with an LZ4 frame.
+* @param[in]    Data - The data.
+* @param[in]    Length - The number of bytes.
+* @return       true if it does, false otherwise.
+*
+*/
+bool
+IsLz4Frame (
+    _In_ const uint8_t* Data,
+    _In_ size_t Length
+    )
+{
+    return ((Length >= sizeof(uint32_t)) &&
+            (ReadLe32(Data) == LZ4_FRAME_MAGIC));
+}
+
+/**
+*
+* @brief        Decompresses an LZ4 frame. A frame cut short (a capture which
+*               was still being written, or never closed) decodes up to its
+*               last complete block.
+* @param[in]    Data - The frame.
+* @param[in]    Length - The number of bytes.
+* @param[out]   Output - Receives the decompressed data.
+* @param[out]   Complete - Receives true if the frame reached its end mark.
+* @return       true on success, false if the frame is malformed or a block
+*               fails its checksum.
+*
+*/
+bool
+Lz4DecompressFrame (
+    _In_ const uint8_t* Data,
+    _In_ size_t Length,
+    _Out_ std::vector<uint8_t>& Output,
+    _Out_ bool* Complete
+    )
+{
+    const uint8_t* current;
+    const uint8_t* end;
+    uint8_t flags;
+    size_t headerLength;
+    size_t blockMaximumSize;
+    size_t blockChecksumSize;
+    int blockSizeId;
+
+    Output.clear();
+    *Complete = false;
+
+    current = Data;
+    end = Data + Length;
+
+    if ((Length < LZ4_FRAME_HEADER_SIZE) ||
+        (!IsLz4Frame(Data, Length)))
+    {
+        return false;
+    }
+
+    flags = Data[4];
+    blockSizeId = ((Data[5] >> 4) & 0x7);
+
+    if (((flags & 0xC0) != LZ4_FRAME_FLG_VERSION) ||
+        (blockSizeId < 4))
+    {
+        return false;
+    }
+
+    headerLength = (6 +
+                    ((flags & LZ4_FRAME_FLG_CONTENT_SIZE) ? sizeof(uint64_t) : 0) +
+                    ((flags & LZ4_FRAME_FLG_DICTIONARY_ID) ? sizeof(uint32_t) : 0));
+
+    if ((Length < (headerLength + 1)) ||
+        (Data[headerLength] != static_cast<uint8_t>(XxHash32(Data + 4, headerLength - 4, 0) >> 8)))
+    {
+        return false;
+    }
+
+    current += (headerLength + 1);
+
+    blockMaximumSize = (static_cast<size_t>(1) << (8 + (2 * blockSizeId)));
+    blockChecksumSize = ((flags & LZ4_FRAME_FLG_BLOCK_CHECKSUM) ? sizeof(uint32_t) : 0);
+
+    while ((end - current) >= static_cast<ptrdiff_t>(sizeof(uint32_t)))
+    {
+        uint32_t blockSize;
+        size_t dataLength;
+        const uint8_t* data;
+
+        blockSize = ReadLe32(current);
+
+        if (blockSize == LZ4_FRAME_END_MARK)
+        {
+            current += sizeof(uint32_t);
+
+            if (flags & LZ4_FRAME_FLG_CONTENT_CHECKSUM)
+            {
+                if (((end - current) < static_cast<ptrdiff_t>(sizeof(uint32_t))) ||
+                    (ReadLe32(current) != XxHash32(Output.data(), Output.size(), 0)))
+                {
+                    return false;
+                }
+            }
+
+            *Complete = true;
+            break;
+        }
+
+        dataLength = (blockSize & ~LZ4_FRAME_BLOCK_UNCOMPRESSED);
+
+        if (dataLength > blockMaximumSize)
+        {
+            return false;
+        }
+
+        //
+        // A partial block is where a cut-short file ends.
+        //
+        if (static_cast<size_t>(end - current) < (sizeof(uint32_t) + dataLength + blockChecksumSize))
+        {
+            break;
+        }
+
+        data = current + sizeof(uint32_t);
+
+        if ((blockChecksumSize != 0) &&
+            (ReadLe32(data + dataLength) != XxHash32(data, dataLength, 0)))
+        {
+            return false;
+        }
+
+        if (blockSize & LZ4_FRAME_BLOCK_UNCOMPRESSED)
+        {
+            Output.insert(Output.end(), data, data + dataLength);
+        }
+        else if (!Lz4DecompressBlock(data, dataLength, Output))
+        {
+            return false;
+        }
+
+        current = data + dataLength + blockChecksumSize;
+    }
+
+    return true;
+}
\ No newline at end of file
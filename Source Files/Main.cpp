@@ -14,8 +14,498 @@
 #include "Trace.hpp"
 #include "Symbols.hpp"
 #include "Helpers.hpp"
+#include "Replay.hpp"
+#include "Nodes.hpp"
+#include "RawCapture.hpp"
+#include "Symbolize.hpp"
+#include "SegmentedOutput.hpp"
+#include "FlightRecorder.hpp"
+#include "TopK.hpp"
+#include "Aggregate.hpp"
+#include "Diff.hpp"
+#include "Anomaly.hpp"
+#include "Rollup.hpp"
+#include "Timeline.hpp"
+#include "Sequence.hpp"
+#include "Ring.hpp"
 #include <stdio.h>
 
+/**
+*
+* @brief        Prints Vtl1Mon usage.
+*
+*/
+static
+void
+PrintUsage ()
+{
+    wprintf(L"[+] Usage: .\\Vtl1Mon.exe [options] C:\\Path\\To\\Output\\File.csv\n");
+    wprintf(L"[+] Usage: .\\Vtl1Mon.exe symbolize [options] C:\\Path\\To\\Capture.vraw C:\\Path\\To\\Output\\File.csv\n");
+    wprintf(L"[+] Usage: .\\Vtl1Mon.exe merge [-threads <n>] C:\\Path\\To\\Merged.vagg C:\\Path\\To\\Snapshot.vagg|Directory ...\n");
+    wprintf(L"[+] Usage: .\\Vtl1Mon.exe diff [options] C:\\Path\\To\\Baseline.vraw|.vagg C:\\Path\\To\\Comparison.vraw|.vagg\n");
+    wprintf(L"[+] Usage: .\\Vtl1Mon.exe ringreplay [-ringrecords <n>] [-loops <n>] [-pace] <ring name> C:\\Path\\To\\Capture.vraw\n");
+    wprintf(L"[+] Usage: .\\Vtl1Mon.exe ringtail [-print] [-wait <seconds>] <ring name>\n");
+    wprintf(L"[+] Options:\n");
+    wprintf(L"  [>] -replay C:\\Path\\To\\Trace.etl - Replay a saved kernel trace instead of tracing live.\n");
+    wprintf(L"  [>] -watermark <ms> - How long to wait for an out-of-order stack walk, 0 for not at all (default: %d).\n", DEFAULT_CORRELATION_WATERMARK_MS);
+    wprintf(L"  [>] -raw - Write raw frame addresses and the module table instead of a CSV. Resolve it later with symbolize.\n");
+    wprintf(L"  [>] -decimal - Write addresses and offsets in decimal instead of hex (also applies to symbolize).\n");
+    wprintf(L"  [>] -walltime - Write timestamps as UTC times (ISO 8601) instead of raw QPC ticks (also applies to symbolize).\n");
+    wprintf(L"  [>] -compress - Compress the output (CSV or raw capture) as an LZ4 frame on a separate thread (also applies to symbolize).\n");
+    wprintf(L"  [>] -rotatesize <MB> - Start a new output segment before the current one grows past this size (before compression).\n");
+    wprintf(L"  [>] -rotatetime <seconds> - Start a new output segment once the current one has been open this long.\n");
+    wprintf(L"  [>] -flight <MB> - Keep events in an in-memory ring of this size and only dump (and symbolize) it when a trigger fires.\n");
+    wprintf(L"  [>] -flightwindow <seconds> - Dump only the last seconds of the ring (default: all of it).\n");
+    wprintf(L"  [>] -triggerrate <calls> - Dump when there are more secure calls than this in a second.\n");
+    wprintf(L"  [>] -triggerlatency <us> - Dump when a secure call takes longer than this.\n");
+    wprintf(L"  [>] -triggerevent <name> - Dump when this named event is set (default: %s). Ctrl+Break always dumps.\n", FLIGHT_RECORDER_DEFAULT_TRIGGER_EVENT);
+    wprintf(L"  [>] -topk - Track the heaviest (secure call, stack), (process, secure call) and caller frames in fixed memory. Reported on exit.\n");
+    wprintf(L"  [>] -topcounters <n> - Counters per top-K tracker, at least 1 (default: %d). Counts are exact to within events / counters.\n", TOP_K_DEFAULT_CAPACITY);
+    wprintf(L"  [>] -topinterval <seconds> - Also report the top-K trackers this often while tracing.\n");
+    wprintf(L"  [>] -snapshot C:\\Path\\To\\Snapshot.vagg - On exit, write a mergeable snapshot of per secure call counts and latencies and the top-K trackers (implies -topk).\n");
+    wprintf(L"  [>] -sequences - Count each thread's sequences of 2 to 4 secure calls in fixed memory (-topcounters per length). The most common are reported on exit, with example stacks.\n");
+    wprintf(L"  [>] -sequencegap <ms> - Longest gap between the calls of a sequence (default: %d).\n", SEQUENCE_DEFAULT_GAP_MS);
+    wprintf(L"  [>] -anomaly - Alert when a process's rate of a secure call jumps well above its learned baseline, with the stacks responsible.\n");
+    wprintf(L"  [>] -anomalyinterval <ms> - Interval rates are counted over (default: %d).\n", ANOMALY_DEFAULT_INTERVAL_MS);
+    wprintf(L"  [>] -anomalyscore <n> - Standard deviations above the baseline which alert (default: %.1f).\n", ANOMALY_DEFAULT_SCORE);
+    wprintf(L"  [>] -anomalylog C:\\Path\\To\\Alerts.log - Also append alerts to this file.\n");
+    wprintf(L"  [>] -rollup C:\\Path\\To\\Rollup.vts - Write per secure call counts and latency percentiles in 1, 10 and 60 second buckets.\n");
+    wprintf(L"  [>] -rollupprom C:\\Path\\To\\vtl1mon.prom - Keep a Prometheus textfile collector file up to date (every 10 seconds).\n");
+    wprintf(L"  [>] -rollupprocess - Keep rollup series per process as well as per secure call.\n");
+    wprintf(L"  [>] -ring <name> - Also publish every event to a shared memory ring which other tools on the host can follow (see RingClient.hpp, ringtail).\n");
+    wprintf(L"  [>] -ringrecords <n> - Records the ring holds (default: %d). A consumer further behind than this loses events.\n", RING_DEFAULT_RECORDS);
+    wprintf(L"  [>] -timeline C:\\Path\\To\\Timeline.pftrace - Write a Perfetto trace (ui.perfetto.dev) of every secure call as a slice on its thread, with its stack.\n");
+    wprintf(L"[+] Symbolize options:\n");
+    wprintf(L"  [>] -symbols C:\\Path\\To\\Store - Symbol store to search for images and PDBs (default: %s).\n", SYMBOL_STORE_DIRECTORY);
+    wprintf(L"  [>] -threads <n> - Number of worker threads (default: one per processor, also applies to merge and diff).\n");
+    wprintf(L"[+] Ring options:\n");
+    wprintf(L"  [>] -loops <n> - Replay the capture this many times (default: 1).\n");
+    wprintf(L"  [>] -pace - Replay at the pace the events were captured instead of as fast as possible.\n");
+    wprintf(L"  [>] -print - Print every record read, as a CSV row (otherwise only statistics).\n");
+    wprintf(L"  [>] -wait <seconds> - How long ringtail waits for the ring to be created (default: %d).\n", RING_TAIL_DEFAULT_WAIT_SECONDS);
+    wprintf(L"[+] Diff options (-symbols and -threads also apply):\n");
+    wprintf(L"  [>] -score <n> - Only report changes at least this many standard deviations beyond noise and sketch error (default: %.1f).\n", DIFF_DEFAULT_SCORE);
+    wprintf(L"  [>] -minchange <percent> - Only report rates which moved by at least this much (default: %.1f).\n", DIFF_DEFAULT_MIN_CHANGE_PERCENT);
+    wprintf(L"  [>] -folded C:\\Path\\To\\Diff.folded - Write the stacks as differential folded stacks (baseline and comparison counts) for a flame graph.\n");
+}
+
+/**
+*
+* @brief        Runs the "symbolize" command.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array (argv[1] is "symbolize").
+* @return       ERROR_SUCCESS on success, otherwise appropriate error code.
+*
+*/
+static
+ULONG
+SymbolizeCommand (
+    _In_ int argc,
+    _In_ wchar_t** argv
+    )
+{
+    ULONG error;
+    const wchar_t* capturePath;
+    const wchar_t* outputPath;
+    const wchar_t* symbolStore;
+    ULONG threadCount;
+    bool dbgHelpAvailable;
+    int i;
+
+    error = ERROR_SUCCESS;
+    capturePath = NULL;
+    outputPath = NULL;
+    symbolStore = SYMBOL_STORE_DIRECTORY;
+    threadCount = 0;
+    dbgHelpAvailable = false;
+
+    for (i = 2; i < argc; i++)
+    {
+        if ((_wcsicmp(argv[i], L"-symbols") == 0) &&
+            ((i + 1) < argc))
+        {
+            symbolStore = argv[++i];
+        }
+        else if ((_wcsicmp(argv[i], L"-threads") == 0) &&
+                 ((i + 1) < argc))
+        {
+            threadCount = wcstoul(argv[++i], NULL, 10);
+        }
+        else if (_wcsicmp(argv[i], L"-decimal") == 0)
+        {
+            SetFormatDecimalAddresses(true);
+        }
+        else if (_wcsicmp(argv[i], L"-walltime") == 0)
+        {
+            SetFormatWallClockTimes(true);
+        }
+        else if (_wcsicmp(argv[i], L"-compress") == 0)
+        {
+            SetOutputCompression(true);
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (capturePath == NULL))
+        {
+            capturePath = argv[i];
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (outputPath == NULL))
+        {
+            outputPath = argv[i];
+        }
+        else
+        {
+            outputPath = NULL;
+            break;
+        }
+    }
+
+    if ((capturePath == NULL) ||
+        (outputPath == NULL))
+    {
+        PrintUsage();
+        error = ERROR_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    wprintf(L"[+] Symbolizing %s to %s\n", capturePath, outputPath);
+
+    //
+    // dbghelp is only the fallback here - carry on without it.
+    //
+    dbgHelpAvailable = InitializeSymbols();
+
+    if (!SymbolizeRawCapture(capturePath,
+                             outputPath,
+                             symbolStore,
+                             threadCount,
+                             dbgHelpAvailable))
+    {
+        error = ERROR_GEN_FAILURE;
+    }
+
+    if (dbgHelpAvailable)
+    {
+        SymbolCleanup();
+    }
+
+Exit:
+    return error;
+}
+
+/**
+*
+* @brief        Runs the "merge" command.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array (argv[1] is "merge").
+* @return       ERROR_SUCCESS on success, otherwise appropriate error code.
+*
+*/
+static
+ULONG
+MergeCommand (
+    _In_ int argc,
+    _In_ wchar_t** argv
+    )
+{
+    ULONG error;
+    const wchar_t* outputPath;
+    std::vector<std::wstring> inputPaths;
+    ULONG threadCount;
+    int i;
+
+    error = ERROR_SUCCESS;
+    outputPath = NULL;
+    threadCount = 0;
+
+    for (i = 2; i < argc; i++)
+    {
+        if ((_wcsicmp(argv[i], L"-threads") == 0) &&
+            ((i + 1) < argc))
+        {
+            threadCount = wcstoul(argv[++i], NULL, 10);
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (outputPath == NULL))
+        {
+            outputPath = argv[i];
+        }
+        else if (argv[i][0] != L'-')
+        {
+            inputPaths.push_back(argv[i]);
+        }
+        else
+        {
+            outputPath = NULL;
+            break;
+        }
+    }
+
+    if ((outputPath == NULL) ||
+        (inputPaths.empty()))
+    {
+        PrintUsage();
+        error = ERROR_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    wprintf(L"[+] Merging %zu input(s) to %s\n", inputPaths.size(), outputPath);
+
+    if (!MergeAggregateSnapshots(outputPath,
+                                 inputPaths,
+                                 threadCount))
+    {
+        error = ERROR_GEN_FAILURE;
+    }
+
+Exit:
+    return error;
+}
+
+/**
+*
+* @brief        Runs the "diff" command.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array (argv[1] is "diff").
+* @return       ERROR_SUCCESS on success, otherwise appropriate error code.
+*
+*/
+static
+ULONG
+DiffCommand (
+    _In_ int argc,
+    _In_ wchar_t** argv
+    )
+{
+    ULONG error;
+    const wchar_t* baselinePath;
+    const wchar_t* comparisonPath;
+    DIFF_OPTIONS options;
+    int i;
+
+    error = ERROR_SUCCESS;
+    baselinePath = NULL;
+    comparisonPath = NULL;
+
+    options.SymbolStore = SYMBOL_STORE_DIRECTORY;
+    options.ThreadCount = 0;
+    options.Score = DIFF_DEFAULT_SCORE;
+    options.MinChangePercent = DIFF_DEFAULT_MIN_CHANGE_PERCENT;
+    options.FoldedPath = NULL;
+
+    for (i = 2; i < argc; i++)
+    {
+        if ((_wcsicmp(argv[i], L"-symbols") == 0) &&
+            ((i + 1) < argc))
+        {
+            options.SymbolStore = argv[++i];
+        }
+        else if ((_wcsicmp(argv[i], L"-threads") == 0) &&
+                 ((i + 1) < argc))
+        {
+            options.ThreadCount = wcstoul(argv[++i], NULL, 10);
+        }
+        else if ((_wcsicmp(argv[i], L"-score") == 0) &&
+                 ((i + 1) < argc))
+        {
+            options.Score = wcstod(argv[++i], NULL);
+        }
+        else if ((_wcsicmp(argv[i], L"-minchange") == 0) &&
+                 ((i + 1) < argc))
+        {
+            options.MinChangePercent = wcstod(argv[++i], NULL);
+        }
+        else if ((_wcsicmp(argv[i], L"-folded") == 0) &&
+                 ((i + 1) < argc))
+        {
+            options.FoldedPath = argv[++i];
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (baselinePath == NULL))
+        {
+            baselinePath = argv[i];
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (comparisonPath == NULL))
+        {
+            comparisonPath = argv[i];
+        }
+        else
+        {
+            comparisonPath = NULL;
+            break;
+        }
+    }
+
+    if ((baselinePath == NULL) ||
+        (comparisonPath == NULL))
+    {
+        PrintUsage();
+        error = ERROR_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    if (!DiffCaptures(baselinePath,
+                      comparisonPath,
+                      &options))
+    {
+        error = ERROR_GEN_FAILURE;
+    }
+
+Exit:
+    return error;
+}
+
+/**
+*
+* @brief        Runs the "ringreplay" command.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array (argv[1] is "ringreplay").
+* @return       ERROR_SUCCESS on success, otherwise appropriate error code.
+*
+*/
+static
+ULONG
+RingReplayCommand (
+    _In_ int argc,
+    _In_ wchar_t** argv
+    )
+{
+    ULONG error;
+    const wchar_t* ringName;
+    const wchar_t* capturePath;
+    ULONG ringRecords;
+    ULONG loops;
+    bool paced;
+    int i;
+
+    error = ERROR_SUCCESS;
+    ringName = NULL;
+    capturePath = NULL;
+    ringRecords = RING_DEFAULT_RECORDS;
+    loops = 1;
+    paced = false;
+
+    for (i = 2; i < argc; i++)
+    {
+        if ((_wcsicmp(argv[i], L"-ringrecords") == 0) &&
+            ((i + 1) < argc))
+        {
+            ringRecords = wcstoul(argv[++i], NULL, 10);
+        }
+        else if ((_wcsicmp(argv[i], L"-loops") == 0) &&
+                 ((i + 1) < argc))
+        {
+            loops = wcstoul(argv[++i], NULL, 10);
+        }
+        else if (_wcsicmp(argv[i], L"-pace") == 0)
+        {
+            paced = true;
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (ringName == NULL))
+        {
+            ringName = argv[i];
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (capturePath == NULL))
+        {
+            capturePath = argv[i];
+        }
+        else
+        {
+            capturePath = NULL;
+            break;
+        }
+    }
+
+    if ((ringName == NULL) ||
+        (capturePath == NULL) ||
+        (loops == 0))
+    {
+        PrintUsage();
+        error = ERROR_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    if (!ReplayRawCaptureToRing(capturePath,
+                                ringName,
+                                ringRecords,
+                                loops,
+                                paced))
+    {
+        error = ERROR_GEN_FAILURE;
+    }
+
+Exit:
+    return error;
+}
+
+/**
+*
+* @brief        Runs the "ringtail" command.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array (argv[1] is "ringtail").
+* @return       ERROR_SUCCESS on success, otherwise appropriate error code.
+*
+*/
+static
+ULONG
+RingTailCommand (
+    _In_ int argc,
+    _In_ wchar_t** argv
+    )
+{
+    ULONG error;
+    const wchar_t* ringName;
+    bool print;
+    ULONG waitSeconds;
+    int i;
+
+    error = ERROR_SUCCESS;
+    ringName = NULL;
+    print = false;
+    waitSeconds = RING_TAIL_DEFAULT_WAIT_SECONDS;
+
+    for (i = 2; i < argc; i++)
+    {
+        if (_wcsicmp(argv[i], L"-print") == 0)
+        {
+            print = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-wait") == 0) &&
+                 ((i + 1) < argc))
+        {
+            waitSeconds = wcstoul(argv[++i], NULL, 10);
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (ringName == NULL))
+        {
+            ringName = argv[i];
+        }
+        else
+        {
+            ringName = NULL;
+            break;
+        }
+    }
+
+    if (ringName == NULL)
+    {
+        PrintUsage();
+        error = ERROR_INVALID_PARAMETER;
+        goto Exit;
+    }
+
+    if (!TailRing(ringName, print, waitSeconds))
+    {
+        error = ERROR_GEN_FAILURE;
+    }
+
+Exit:
+    return error;
+}
+
 /**
 *
 * @brief        Vtl1Mon entry point.
@@ -31,22 +521,363 @@ wmain (
     )
 {
     ULONG error;
+    const wchar_t* replayPath;
+    const wchar_t* outputPath;
+    bool rawCapture;
+    ULONGLONG rotateBytes;
+    ULONG rotateSeconds;
+    ULONGLONG flightBytes;
+    ULONG flightSeconds;
+    ULONG triggerRate;
+    ULONG triggerLatency;
+    const wchar_t* triggerEvent;
+    bool flightRecorder;
+    bool topK;
+    ULONG topCounters;
+    ULONG topInterval;
+    bool anomaly;
+    ULONG anomalyInterval;
+    double anomalyScore;
+    const wchar_t* anomalyLog;
+    const wchar_t* rollupPath;
+    const wchar_t* rollupPrometheus;
+    bool rollupProcess;
+    const wchar_t* timelinePath;
+    bool sequences;
+    ULONG sequenceGap;
+    const wchar_t* ringName;
+    ULONG ringRecords;
+    int i;
 
     error = ERROR_SUCCESS;
+    replayPath = NULL;
+    outputPath = NULL;
+    rawCapture = false;
+    rotateBytes = 0;
+    rotateSeconds = 0;
+    flightBytes = 0;
+    flightSeconds = 0;
+    triggerRate = 0;
+    triggerLatency = 0;
+    triggerEvent = NULL;
+    flightRecorder = false;
+    topK = false;
+    topCounters = TOP_K_DEFAULT_CAPACITY;
+    topInterval = 0;
+    anomaly = false;
+    anomalyInterval = ANOMALY_DEFAULT_INTERVAL_MS;
+    anomalyScore = ANOMALY_DEFAULT_SCORE;
+    anomalyLog = NULL;
+    rollupPath = NULL;
+    rollupPrometheus = NULL;
+    rollupProcess = false;
+    timelinePath = NULL;
+    sequences = false;
+    sequenceGap = SEQUENCE_DEFAULT_GAP_MS;
+    ringName = NULL;
+    ringRecords = RING_DEFAULT_RECORDS;
+
+    if ((argc > 1) &&
+        (_wcsicmp(argv[1], L"symbolize") == 0))
+    {
+        error = SymbolizeCommand(argc, argv);
+        goto Exit;
+    }
 
-    if (argc != 2)
+    if ((argc > 1) &&
+        (_wcsicmp(argv[1], L"merge") == 0))
     {
-        wprintf(L"[+] Usage: .\\Vtl1Mon.exe C:\\Path\\To\\Output\\File.csv\n");
+        error = MergeCommand(argc, argv);
         goto Exit;
     }
 
-    if (!CreateOutputFile(argv[1]))
+    if ((argc > 1) &&
+        (_wcsicmp(argv[1], L"diff") == 0))
+    {
+        error = DiffCommand(argc, argv);
+        goto Exit;
+    }
+
+    if ((argc > 1) &&
+        (_wcsicmp(argv[1], L"ringreplay") == 0))
+    {
+        error = RingReplayCommand(argc, argv);
+        goto Exit;
+    }
+
+    if ((argc > 1) &&
+        (_wcsicmp(argv[1], L"ringtail") == 0))
+    {
+        error = RingTailCommand(argc, argv);
+        goto Exit;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((_wcsicmp(argv[i], L"-replay") == 0) &&
+            ((i + 1) < argc))
+        {
+            replayPath = argv[++i];
+        }
+        else if ((_wcsicmp(argv[i], L"-watermark") == 0) &&
+                 ((i + 1) < argc))
+        {
+            SetCorrelationWatermark(wcstoul(argv[++i], NULL, 10));
+        }
+        else if ((_wcsicmp(argv[i], L"-rotatesize") == 0) &&
+                 ((i + 1) < argc))
+        {
+            rotateBytes = (static_cast<ULONGLONG>(wcstoul(argv[++i], NULL, 10)) * 1024 * 1024);
+        }
+        else if ((_wcsicmp(argv[i], L"-rotatetime") == 0) &&
+                 ((i + 1) < argc))
+        {
+            rotateSeconds = wcstoul(argv[++i], NULL, 10);
+        }
+        else if ((_wcsicmp(argv[i], L"-flight") == 0) &&
+                 ((i + 1) < argc))
+        {
+            flightBytes = (static_cast<ULONGLONG>(wcstoul(argv[++i], NULL, 10)) * 1024 * 1024);
+            flightRecorder = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-flightwindow") == 0) &&
+                 ((i + 1) < argc))
+        {
+            flightSeconds = wcstoul(argv[++i], NULL, 10);
+            flightRecorder = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-triggerrate") == 0) &&
+                 ((i + 1) < argc))
+        {
+            triggerRate = wcstoul(argv[++i], NULL, 10);
+        }
+        else if ((_wcsicmp(argv[i], L"-triggerlatency") == 0) &&
+                 ((i + 1) < argc))
+        {
+            triggerLatency = wcstoul(argv[++i], NULL, 10);
+        }
+        else if ((_wcsicmp(argv[i], L"-triggerevent") == 0) &&
+                 ((i + 1) < argc))
+        {
+            triggerEvent = argv[++i];
+        }
+        else if ((_wcsicmp(argv[i], L"-topcounters") == 0) &&
+                 ((i + 1) < argc))
+        {
+            topCounters = wcstoul(argv[++i], NULL, 10);
+
+            //
+            // The top-K trackers and the sequence miner both need a counter.
+            //
+            if (topCounters == 0)
+            {
+                outputPath = NULL;
+                break;
+            }
+        }
+        else if ((_wcsicmp(argv[i], L"-topinterval") == 0) &&
+                 ((i + 1) < argc))
+        {
+            topInterval = wcstoul(argv[++i], NULL, 10);
+        }
+        else if (_wcsicmp(argv[i], L"-topk") == 0)
+        {
+            topK = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-snapshot") == 0) &&
+                 ((i + 1) < argc))
+        {
+            SetAggregateSnapshot(argv[++i]);
+            topK = true;
+        }
+        else if (_wcsicmp(argv[i], L"-sequences") == 0)
+        {
+            sequences = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-sequencegap") == 0) &&
+                 ((i + 1) < argc))
+        {
+            sequenceGap = wcstoul(argv[++i], NULL, 10);
+            sequences = true;
+        }
+        else if (_wcsicmp(argv[i], L"-anomaly") == 0)
+        {
+            anomaly = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-anomalyinterval") == 0) &&
+                 ((i + 1) < argc))
+        {
+            anomalyInterval = wcstoul(argv[++i], NULL, 10);
+            anomaly = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-anomalyscore") == 0) &&
+                 ((i + 1) < argc))
+        {
+            anomalyScore = wcstod(argv[++i], NULL);
+            anomaly = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-anomalylog") == 0) &&
+                 ((i + 1) < argc))
+        {
+            anomalyLog = argv[++i];
+            anomaly = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-rollup") == 0) &&
+                 ((i + 1) < argc))
+        {
+            rollupPath = argv[++i];
+        }
+        else if ((_wcsicmp(argv[i], L"-rollupprom") == 0) &&
+                 ((i + 1) < argc))
+        {
+            rollupPrometheus = argv[++i];
+        }
+        else if (_wcsicmp(argv[i], L"-rollupprocess") == 0)
+        {
+            rollupProcess = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-timeline") == 0) &&
+                 ((i + 1) < argc))
+        {
+            timelinePath = argv[++i];
+        }
+        else if ((_wcsicmp(argv[i], L"-ring") == 0) &&
+                 ((i + 1) < argc))
+        {
+            ringName = argv[++i];
+        }
+        else if ((_wcsicmp(argv[i], L"-ringrecords") == 0) &&
+                 ((i + 1) < argc))
+        {
+            ringRecords = wcstoul(argv[++i], NULL, 10);
+        }
+        else if (_wcsicmp(argv[i], L"-raw") == 0)
+        {
+            rawCapture = true;
+        }
+        else if (_wcsicmp(argv[i], L"-decimal") == 0)
+        {
+            SetFormatDecimalAddresses(true);
+        }
+        else if (_wcsicmp(argv[i], L"-walltime") == 0)
+        {
+            SetFormatWallClockTimes(true);
+        }
+        else if (_wcsicmp(argv[i], L"-compress") == 0)
+        {
+            SetOutputCompression(true);
+        }
+        else if ((argv[i][0] != L'-') &&
+                 (outputPath == NULL))
+        {
+            outputPath = argv[i];
+        }
+        else
+        {
+            outputPath = NULL;
+            break;
+        }
+    }
+
+    if (outputPath == NULL)
+    {
+        PrintUsage();
+        goto Exit;
+    }
+
+    SetOutputRotation(rotateBytes, rotateSeconds);
+
+    if (topK)
+    {
+        SetTopKTracking(topCounters, topInterval);
+    }
+
+    if (sequences)
+    {
+        SetSequenceMining(topCounters, sequenceGap);
+    }
+
+    if ((anomaly) &&
+        (!SetAnomalyDetection(anomalyInterval, anomalyScore, anomalyLog)))
     {
         error = ERROR_GEN_FAILURE;
         goto Exit;
     }
 
-    wprintf(L"[+] Target output file: %s\n", argv[1]);
+    if (((rollupPath != NULL) ||
+         (rollupPrometheus != NULL)) &&
+        (!SetRollups(rollupPath, rollupPrometheus, rollupProcess)))
+    {
+        error = ERROR_GEN_FAILURE;
+        goto Exit;
+    }
+
+    if ((timelinePath != NULL) &&
+        (!SetTimeline(timelinePath)))
+    {
+        error = ERROR_GEN_FAILURE;
+        goto Exit;
+    }
+
+    if ((ringName != NULL) &&
+        (!SetExportRing(ringName, ringRecords)))
+    {
+        error = ERROR_GEN_FAILURE;
+        goto Exit;
+    }
+
+    //
+    // The flight recorder keeps events in memory until a trigger fires.
+    // Deferred symbolization writes a raw capture instead of the CSV.
+    //
+    if (flightRecorder)
+    {
+        SetFlightRecorder(flightBytes, flightSeconds);
+        SetFlightRecorderTriggers(triggerRate, triggerLatency, triggerEvent);
+
+        if (!StartFlightRecorder(outputPath))
+        {
+            error = ERROR_GEN_FAILURE;
+            goto Exit;
+        }
+    }
+    else if (rawCapture)
+    {
+        if (!CreateRawCaptureFile(outputPath))
+        {
+            error = ERROR_GEN_FAILURE;
+            goto Exit;
+        }
+    }
+    else if (!CreateOutputFile(outputPath))
+    {
+        error = ERROR_GEN_FAILURE;
+        goto Exit;
+    }
+
+    //
+    // Replay a saved kernel trace instead of tracing live.
+    //
+    if (replayPath != NULL)
+    {
+        wprintf(L"[+] Replaying %s to %s\n", replayPath, outputPath);
+
+        if (!InitializeSymbols())
+        {
+            error = ERROR_GEN_FAILURE;
+            goto Exit;
+        }
+
+        if (!ReplayTraceFile(replayPath))
+        {
+            error = ERROR_GEN_FAILURE;
+        }
+
+        CleanupVtl1MonResources();
+        goto Exit;
+    }
+
+    wprintf(L"[+] Target output file: %s\n", outputPath);
     wprintf(L"[+] Configuring the trace! Please wait!\n");
 
     if (!InitializeSymbols())
@@ -60,8 +891,22 @@ wmain (
     //
     CreateAndConfigureVtlEnterExitTrace();
 
+    //
+    // Keeps the rollups (and the Prometheus textfile) moving while no
+    // secure calls arrive.
+    //
+    StartRollupTimer();
+
     wprintf(L"[+] Press ENTER to terminate the trace!\n");
-    getchar();
+
+    //
+    // Ctrl+Break (a flight recorder trigger) aborts the console read.
+    //
+    while ((getchar() == EOF) &&
+           (GetLastError() == ERROR_OPERATION_ABORTED))
+    {
+        clearerr(stdin);
+    }
 
     CleanupVtl1MonResources();
 
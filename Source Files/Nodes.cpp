@@ -14,6 +14,8 @@
 #include "Nodes.hpp"
 #include "Helpers.hpp"
 #include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Unicode.hpp"
 
 /**
 *
@@ -28,17 +30,19 @@ bool
 InsertImage (
     _In_ ULONG_PTR ImageBase,
     _In_ ULONG ImageSize,
-    _In_ wchar_t* ImageName
+    _In_ const wchar_t* ImageName
     )
 {
     bool doNotIgnore;
-    wchar_t* imageNameCopy;
+    char* imageNameCopy;
     SIZE_T imageNameLength;
+    SIZE_T convertedLength;
     IMAGE_NODE imageNode;
 
     doNotIgnore = true;
     imageNameCopy = nullptr;
     imageNameLength = 0;
+    convertedLength = 0;
 
     RtlZeroMemory(&imageNode, sizeof(imageNode));
 
@@ -52,16 +56,18 @@ InsertImage (
         goto Exit;
     }
 
-    imageNameLength = (wcslen(ImageName) * sizeof(wchar_t) + sizeof(UNICODE_NULL));
-    imageNameCopy = static_cast<wchar_t*>(malloc(imageNameLength));
+    imageNameLength = wcslen(ImageName);
+    imageNameCopy = static_cast<char*>(malloc(imageNameLength * UTF8_MAX_BYTES_PER_WCHAR + 1));
     if (imageNameCopy == NULL)
     {
         goto Exit;
     }
 
-    RtlCopyMemory(imageNameCopy,
-                  ImageName,
-                  imageNameLength);
+    convertedLength = TranscodeUtf16ToUtf8(ImageName,
+                                           imageNameLength,
+                                           imageNameCopy);
+
+    imageNameCopy[convertedLength] = '\0';
 
     //
     // Fill out the structure to insert.
@@ -128,9 +134,95 @@ GetImageDataFromAddress (
     return result;
 }
 
+//
+// Reorder stage state. Event time only moves forward through
+// k_HighestTimeStamp; anything older than the watermark is expired.
+//
+static ULONG k_CorrelationWatermarkMs = DEFAULT_CORRELATION_WATERMARK_MS;
+static ULONGLONG k_CorrelationWatermark = 0;
+static ULONGLONG k_HighestTimeStamp = 0;
+static CORRELATION_STATISTICS k_CorrelationStatistics = { 0 };
+
+/**
+*
+* @brief        Sets how long unmatched enters and stacks are held in the reorder stage.
+* @param[in]    WatermarkMs - The watermark, in milliseconds of event time. 0 holds nothing.
+*
+*/
+void
+SetCorrelationWatermark (
+    _In_ ULONG WatermarkMs
+    )
+{
+    k_CorrelationWatermarkMs = WatermarkMs;
+}
+
 /**
 *
-* @brief        Inserts the "primal" VTL 1 enter event into the VTL 1 event map.
+* @brief        Converts the watermark to ticks of the event timestamps.
+* @param[in]    QpcFrequency - The session clock's QPC frequency.
+*
+*/
+void
+SetCorrelationQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    )
+{
+    k_CorrelationWatermark = ((QpcFrequency * k_CorrelationWatermarkMs) / 1000);
+}
+
+/**
+*
+* @brief        Advances event time and expires everything older than the watermark.
+* @param[in]    TimeStamp - Timestamp of the event being processed.
+*
+*/
+static
+void
+AdvanceReorderWatermark (
+    _In_ ULONGLONG TimeStamp
+    )
+{
+    ULONGLONG cutoff;
+
+    if (TimeStamp > k_HighestTimeStamp)
+    {
+        k_HighestTimeStamp = TimeStamp;
+    }
+
+    if (k_HighestTimeStamp <= k_CorrelationWatermark)
+    {
+        return;
+    }
+
+    cutoff = (k_HighestTimeStamp - k_CorrelationWatermark);
+
+    //
+    // Enters whose stack walk never showed up (e.g. the walk failed).
+    //
+    while ((!k_VtlEnterMap.empty()) &&
+           (k_VtlEnterMap.begin()->first < cutoff))
+    {
+        k_VtlEnterMap.erase(k_VtlEnterMap.begin());
+        k_CorrelationStatistics.EntersExpired++;
+    }
+
+    //
+    // Stacks whose enter never showed up (e.g. the enter was dropped).
+    //
+    while ((!k_PendingStackMap.empty()) &&
+           (k_PendingStackMap.begin()->first < cutoff))
+    {
+        free(k_PendingStackMap.begin()->second.CallStack);
+        k_PendingStackMap.erase(k_PendingStackMap.begin());
+        k_CorrelationStatistics.StacksExpired++;
+    }
+}
+
+/**
+*
+* @brief        Inserts the "primal" VTL 1 enter event into the VTL 1 event map,
+*               or publishes it immediately if its stack walk already arrived.
 * @param[in]    TimeStamp - The event timestamp.
 * @param[in]    ProcessId - The target process ID.
 * @param[in]    ThreadId - The target thread ID.
@@ -153,13 +245,40 @@ InsertVtl1EnterEventData (
     vtl1Node.ProcessId = ProcessId;
     vtl1Node.ThreadId = ThreadId;
     vtl1Node.SecureCallNumber = SecureCallNumber;
+    vtl1Node.ProcessNameId = GetProcessNameId(ProcessId, TimeStamp);
+    vtl1Node.ThreadNameId = GetThreadNameId(ThreadId);
+
+    k_CorrelationStatistics.EntersSeen++;
+
+    //
+    // Did the stack walk beat us here?
+    //
+    auto it = k_PendingStackMap.find(TimeStamp);
+    if (it != k_PendingStackMap.end())
+    {
+        ConstructCallStackStringAndPublishData(&vtl1Node,
+                                               it->second.CallStack,
+                                               it->second.NumberOfFrames);
+
+        free(it->second.CallStack);
+        k_PendingStackMap.erase(it);
+
+        k_CorrelationStatistics.Correlated++;
+        k_CorrelationStatistics.CorrelatedStackFirst++;
+        goto Exit;
+    }
 
     k_VtlEnterMap.insert({ TimeStamp , vtl1Node });
+
+Exit:
+    AdvanceReorderWatermark(TimeStamp);
 }
 
 /**
 *
-* @brief        Correlates a given stack walk event with a VTL 1 enter node.
+* @brief        Correlates a given stack walk event with a VTL 1 enter node. If the
+*               enter has not arrived yet, the stack is held until it does (or until
+*               it falls behind the watermark).
 * @param[in]    TimeStamp - The  stack walk event timestamp.
 * @param[in]    CallStack - The call stack.
 * @param[in]    NumberOfFrames - The number of frames in the call stack.
@@ -168,13 +287,41 @@ InsertVtl1EnterEventData (
 void
 CorrelateVtl1EnterCallStack (
     _In_ ULONGLONG TimeStamp,
-    _In_ ULONG_PTR* CallStack,
+    _In_ const ULONG_PTR* CallStack,
     _In_ ULONG NumberOfFrames
     )
 {
+    PENDING_STACK_NODE pendingStack;
+
+    RtlZeroMemory(&pendingStack, sizeof(pendingStack));
+
+    k_CorrelationStatistics.StacksSeen++;
+
     auto it = k_VtlEnterMap.find(TimeStamp);
     if (it == k_VtlEnterMap.end())
     {
+        //
+        // Out of order. Hold on to a copy of the stack - the event
+        // buffer it lives in is gone once we return.
+        //
+        if (k_PendingStackMap.find(TimeStamp) != k_PendingStackMap.end())
+        {
+            goto Exit;
+        }
+
+        pendingStack.CallStack = static_cast<ULONG_PTR*>(malloc(NumberOfFrames * sizeof(ULONG_PTR)));
+        if (pendingStack.CallStack == NULL)
+        {
+            goto Exit;
+        }
+
+        RtlCopyMemory(pendingStack.CallStack,
+                      CallStack,
+                      NumberOfFrames * sizeof(ULONG_PTR));
+
+        pendingStack.NumberOfFrames = NumberOfFrames;
+
+        k_PendingStackMap.insert({ TimeStamp, pendingStack });
         goto Exit;
     }
 
@@ -193,6 +340,50 @@ CorrelateVtl1EnterCallStack (
     //
     k_VtlEnterMap.erase(it);
 
+    k_CorrelationStatistics.Correlated++;
+
 Exit:
-    return;
+    AdvanceReorderWatermark(TimeStamp);
+}
+
+/**
+*
+* @brief        Drops everything still held in the reorder stage and reports how
+*               well enters and stacks were correlated. Called on Vtl1Mon exit,
+*               after the trace has stopped delivering events.
+*
+*/
+void
+FlushAndReportCorrelation ()
+{
+    double correlatedPercent;
+
+    correlatedPercent = 0;
+
+    //
+    // Anything still held never found its partner.
+    //
+    k_CorrelationStatistics.EntersExpired += k_VtlEnterMap.size();
+    k_VtlEnterMap.clear();
+
+    for (auto& i : k_PendingStackMap)
+    {
+        free(i.second.CallStack);
+        k_CorrelationStatistics.StacksExpired++;
+    }
+
+    k_PendingStackMap.clear();
+
+    if (k_CorrelationStatistics.EntersSeen != 0)
+    {
+        correlatedPercent = ((100.0 * k_CorrelationStatistics.Correlated) / k_CorrelationStatistics.EntersSeen);
+    }
+
+    wprintf(L"[+] Correlation statistics:\n");
+    wprintf(L"  [>] VTL 1 enters seen: %llu\n", k_CorrelationStatistics.EntersSeen);
+    wprintf(L"  [>] Stack walks seen: %llu\n", k_CorrelationStatistics.StacksSeen);
+    wprintf(L"  [>] Correlated: %llu (%.2f%%)\n", k_CorrelationStatistics.Correlated, correlatedPercent);
+    wprintf(L"  [>] Correlated after reordering (stack first): %llu\n", k_CorrelationStatistics.CorrelatedStackFirst);
+    wprintf(L"  [>] Enters without a stack: %llu\n", k_CorrelationStatistics.EntersExpired);
+    wprintf(L"  [>] Stacks without an enter: %llu\n", k_CorrelationStatistics.StacksExpired);
 }
\ No newline at end of file
@@ -0,0 +1,1003 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Pdb.cpp
+*
+* @summary:   Native PDB reader. Walks the MSF 7.0 container, the DBI stream
+*             (section headers, section contributions, OMAP) and the public
+*             symbol stream, and produces an immutable RVA-sorted table of
+*             public symbols. No dbghelp/DIA - builds on Windows and Linux.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Pdb.hpp"
+#include <algorithm>
+
+//
+// MSF 7.0 superblock
+//
+static const char k_MsfMagic[] = "Microsoft C/C++ MSF 7.00\r\n\x1a" "DS\0\0";
+
+#define MSF_MAGIC_SIZE 32
+#define MSF_SUPERBLOCK_SIZE 56
+#define MSF_NIL_STREAM_SIZE 0xFFFFFFFF
+
+//
+// Fixed stream indices
+//
+#define PDB_INFO_STREAM 1
+#define PDB_DBI_STREAM 3
+
+//
+// DBI stream layout
+//
+#define DBI_HEADER_SIZE 64
+#define DBI_SECTION_CONTRIBUTION_V60 (0xEFFE0000 + 19970605)
+#define DBI_SECTION_CONTRIBUTION_V2 (0xEFFE0000 + 20140516)
+#define DBI_SECTION_CONTRIBUTION_V60_SIZE 28
+#define DBI_SECTION_CONTRIBUTION_V2_SIZE 32
+
+//
+// Optional debug header (DBI) stream slots
+//
+#define DBI_DEBUG_OMAP_FROM_SOURCE 4
+#define DBI_DEBUG_SECTION_HEADER 5
+#define DBI_DEBUG_SECTION_HEADER_ORIGINAL 10
+
+//
+// Public symbol stream header, and the S_PUB32 record which it indexes.
+//
+#define PUBLICS_HEADER_SIZE 28
+#define SYMBOL_KIND_PUB32 0x110E
+#define PUBLIC_SYMBOL_FLAG_CODE 0x1
+#define PUBLIC_SYMBOL_FLAG_FUNCTION 0x2
+#define PUB32_NAME_OFFSET 14
+
+#define IMAGE_SECTION_HEADER_SIZE 40
+#define IMAGE_SECTION_CODE 0x00000020
+
+//
+// Names an MSVC decorated name can refer back to (by digit).
+//
+#define DECORATED_NAME_BACK_REFERENCES 10
+
+//
+// Special names, by operator code: "??<code>" and "??_<code>". NULL where
+// there is no such code, or the name needs more than the qualified name
+// (conversion operators are named after their type) or is not a function
+// (RTTI descriptors). Those are left decorated.
+//
+static const char* const k_DecoratedOperators[36] =
+{
+    NULL, NULL, "operator new", "operator delete", "operator=", "operator>>", "operator<<", "operator!", "operator==", "operator!=",
+    "operator[]", NULL, "operator->", "operator*", "operator++", "operator--", "operator-", "operator+", "operator&", "operator->*",
+    "operator/", "operator%", "operator<", "operator<=", "operator>", "operator>=", "operator,", "operator()", "operator~", "operator^",
+    "operator|", "operator&&", "operator||", "operator*=", "operator+=", "operator-="
+};
+
+static const char* const k_DecoratedUnderscoreOperators[36] =
+{
+    "operator/=", "operator%=", "operator>>=", "operator<<=", "operator&=", "operator|=", "operator^=", "`vftable'", "`vbtable'", "`vcall'",
+    "`typeof'", "`local static guard'", NULL, "`vbase destructor'", "`vector deleting destructor'", "`default constructor closure'",
+    "`scalar deleting destructor'", "`vector constructor iterator'", "`vector destructor iterator'", "`vector vbase constructor iterator'",
+    "`virtual displacement map'", "`eh vector constructor iterator'", "`eh vector destructor iterator'", "`eh vector vbase constructor iterator'",
+    "`copy constructor closure'", NULL, NULL, NULL, "`local vftable'", "`local vftable constructor closure'",
+    "operator new[]", "operator delete[]", NULL, "`placement delete closure'", "`placement delete[] closure'", NULL
+};
+
+//
+// The MSF container: a set of streams, each a list of blocks.
+//
+typedef struct _MSF_FILE
+{
+    const uint8_t* Data;
+    size_t Length;
+    uint32_t BlockSize;
+    uint32_t BlockCount;
+    std::vector<uint32_t> StreamSizes;
+    std::vector<std::vector<uint32_t>> StreamBlocks;
+} MSF_FILE, *PMSF_FILE;
+
+//
+// An OMAP (from source) entry. Images rewritten after linking (e.g. by
+// BBT) carry one so that PDB addresses can be moved to the final layout.
+//
+typedef struct _PDB_OMAP_ENTRY
+{
+    uint32_t From;
+    uint32_t To;
+} PDB_OMAP_ENTRY, *PPDB_OMAP_ENTRY;
+
+/**
+*
+* @brief        Validates the MSF superblock and loads the stream directory.
+* @param[in]    Data - The PDB file contents.
+* @param[in]    Length - The length of the PDB file.
+* @param[out]   Msf - The parsed container.
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+OpenMsf (
+    _In_ const uint8_t* Data,
+    _In_ size_t Length,
+    _Out_ PMSF_FILE Msf
+    )
+{
+    bool result;
+    uint32_t directoryBytes;
+    uint32_t directoryBlockCount;
+    uint32_t blockMapBlock;
+    uint32_t streamCount;
+    uint32_t cursor;
+    std::vector<uint8_t> directory;
+
+    result = false;
+
+    Msf->Data = Data;
+    Msf->Length = Length;
+    Msf->BlockSize = 0;
+    Msf->BlockCount = 0;
+    Msf->StreamSizes.clear();
+    Msf->StreamBlocks.clear();
+
+    if ((Length < MSF_SUPERBLOCK_SIZE) ||
+        (memcmp(Data, k_MsfMagic, MSF_MAGIC_SIZE) != 0))
+    {
+        goto Exit;
+    }
+
+    Msf->BlockSize = ReadLe32(Data + 32);
+    Msf->BlockCount = ReadLe32(Data + 40);
+    directoryBytes = ReadLe32(Data + 44);
+    blockMapBlock = ReadLe32(Data + 52);
+
+    if ((Msf->BlockSize < 512) ||
+        (Msf->BlockSize > 0x8000) ||
+        ((Msf->BlockSize & (Msf->BlockSize - 1)) != 0) ||
+        ((static_cast<uint64_t>(Msf->BlockCount) * Msf->BlockSize) > Length) ||
+        (blockMapBlock >= Msf->BlockCount) ||
+        (directoryBytes < sizeof(uint32_t)))
+    {
+        goto Exit;
+    }
+
+    //
+    // The block map block lists the blocks holding the stream directory.
+    //
+    directoryBlockCount = ((directoryBytes + Msf->BlockSize - 1) / Msf->BlockSize);
+    if ((static_cast<uint64_t>(directoryBlockCount) * sizeof(uint32_t)) > Msf->BlockSize)
+    {
+        goto Exit;
+    }
+
+    directory.reserve(static_cast<size_t>(directoryBlockCount) * Msf->BlockSize);
+
+    for (uint32_t i = 0; i < directoryBlockCount; i++)
+    {
+        uint32_t block;
+
+        block = ReadLe32(Data + (static_cast<size_t>(blockMapBlock) * Msf->BlockSize) + (i * sizeof(uint32_t)));
+        if (block >= Msf->BlockCount)
+        {
+            goto Exit;
+        }
+
+        directory.insert(directory.end(),
+                         Data + (static_cast<size_t>(block) * Msf->BlockSize),
+                         Data + ((static_cast<size_t>(block) + 1) * Msf->BlockSize));
+    }
+
+    //
+    // Directory: stream count, every stream's size, then every stream's blocks.
+    //
+    streamCount = ReadLe32(directory.data());
+    if ((static_cast<uint64_t>(streamCount) + 1) * sizeof(uint32_t) > directoryBytes)
+    {
+        goto Exit;
+    }
+
+    cursor = sizeof(uint32_t);
+
+    Msf->StreamSizes.resize(streamCount);
+    Msf->StreamBlocks.resize(streamCount);
+
+    for (uint32_t i = 0; i < streamCount; i++, cursor += sizeof(uint32_t))
+    {
+        Msf->StreamSizes[i] = ReadLe32(directory.data() + cursor);
+
+        if (Msf->StreamSizes[i] == MSF_NIL_STREAM_SIZE)
+        {
+            Msf->StreamSizes[i] = 0;
+        }
+    }
+
+    for (uint32_t i = 0; i < streamCount; i++)
+    {
+        uint32_t streamBlockCount;
+
+        streamBlockCount = ((Msf->StreamSizes[i] + Msf->BlockSize - 1) / Msf->BlockSize);
+
+        if ((static_cast<uint64_t>(cursor) + (static_cast<uint64_t>(streamBlockCount) * sizeof(uint32_t))) > directoryBytes)
+        {
+            goto Exit;
+        }
+
+        Msf->StreamBlocks[i].resize(streamBlockCount);
+
+        for (uint32_t j = 0; j < streamBlockCount; j++, cursor += sizeof(uint32_t))
+        {
+            Msf->StreamBlocks[i][j] = ReadLe32(directory.data() + cursor);
+
+            if (Msf->StreamBlocks[i][j] >= Msf->BlockCount)
+            {
+                goto Exit;
+            }
+        }
+    }
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Reads a whole MSF stream into contiguous memory.
+* @param[in]    Msf - The parsed container.
+* @param[in]    StreamIndex - The stream to read.
+* @param[out]   Stream - The stream contents.
+* @return       true on success, otherwise false (including a missing stream).
+*
+*/
+static
+bool
+ReadMsfStream (
+    _In_ const MSF_FILE* Msf,
+    _In_ uint32_t StreamIndex,
+    _Out_ std::vector<uint8_t>& Stream
+    )
+{
+    uint32_t remaining;
+    uint32_t chunk;
+
+    Stream.clear();
+
+    if ((StreamIndex >= Msf->StreamSizes.size()) ||
+        (Msf->StreamSizes[StreamIndex] == 0))
+    {
+        return false;
+    }
+
+    remaining = Msf->StreamSizes[StreamIndex];
+
+    Stream.reserve(remaining);
+
+    for (uint32_t block : Msf->StreamBlocks[StreamIndex])
+    {
+        chunk = (std::min)(remaining, Msf->BlockSize);
+
+        Stream.insert(Stream.end(),
+                      Msf->Data + (static_cast<size_t>(block) * Msf->BlockSize),
+                      Msf->Data + (static_cast<size_t>(block) * Msf->BlockSize) + chunk);
+
+        remaining -= chunk;
+    }
+
+    return true;
+}
+
+/**
+*
+* @brief        Moves an RVA from the PDB's (original) layout to the image's layout.
+* @param[in]    Omap - The OMAP (from source) table, sorted. Empty if the image was not rewritten.
+* @param[in]    Rva - The original RVA.
+* @return       The final RVA, or 0 if the code was dropped.
+*
+*/
+static
+uint32_t
+TranslateOmap (
+    _In_ const std::vector<PDB_OMAP_ENTRY>& Omap,
+    _In_ uint32_t Rva
+    )
+{
+    if (Omap.empty())
+    {
+        return Rva;
+    }
+
+    auto it = std::upper_bound(Omap.begin(),
+                               Omap.end(),
+                               Rva,
+                               [](uint32_t Value, const PDB_OMAP_ENTRY& Entry)
+                               {
+                                   return Value < Entry.From;
+                               });
+    if (it == Omap.begin())
+    {
+        return 0;
+    }
+
+    --it;
+
+    if (it->To == 0)
+    {
+        return 0;
+    }
+
+    return (it->To + (Rva - it->From));
+}
+
+/**
+*
+* @brief        Parses a PDB: info stream (GUID, age), DBI stream (section headers,
+*               contributions, OMAP) and public symbols.
+* @param[in]    Data - The PDB file contents.
+* @param[in]    Length - The length of the PDB file.
+* @param[out]   Table - The module's public symbols, sorted by RVA.
+* @return       true if the PDB has at least one public code symbol, otherwise false.
+*
+*/
+bool
+ParsePdb (
+    _In_ const uint8_t* Data,
+    _In_ size_t Length,
+    _Out_ PPDB_SYMBOL_TABLE Table
+    )
+{
+    bool result;
+    MSF_FILE msf;
+    std::vector<uint8_t> infoStream;
+    std::vector<uint8_t> dbiStream;
+    std::vector<uint8_t> sectionStream;
+    std::vector<uint8_t> omapStream;
+    std::vector<uint8_t> publicsStream;
+    std::vector<uint8_t> symbolStream;
+    std::vector<uint32_t> sectionAddresses;
+    std::vector<uint32_t> sectionAddressesOriginal;
+    std::vector<PDB_OMAP_ENTRY> omap;
+    uint32_t publicsStreamIndex;
+    uint32_t symbolStreamIndex;
+    uint32_t modInfoSize;
+    uint32_t contributionSize;
+    uint32_t sectionMapSize;
+    uint32_t sourceInfoSize;
+    uint32_t typeServerMapSize;
+    uint32_t ecSize;
+    uint32_t debugHeaderSize;
+    uint32_t debugHeaderOffset;
+    uint32_t hashSize;
+    uint32_t addressMapSize;
+
+    result = false;
+
+    memset(Table->Guid, 0, sizeof(Table->Guid));
+    Table->Age = 0;
+    Table->Symbols.clear();
+    Table->Contributions.clear();
+    Table->Names.clear();
+
+    if (!OpenMsf(Data, Length, &msf))
+    {
+        goto Exit;
+    }
+
+    //
+    // Info stream: version, signature, age, GUID.
+    //
+    if ((!ReadMsfStream(&msf, PDB_INFO_STREAM, infoStream)) ||
+        (infoStream.size() < 28))
+    {
+        goto Exit;
+    }
+
+    Table->Age = ReadLe32(infoStream.data() + 8);
+    memcpy(Table->Guid, infoStream.data() + 12, sizeof(Table->Guid));
+
+    if ((!ReadMsfStream(&msf, PDB_DBI_STREAM, dbiStream)) ||
+        (dbiStream.size() < DBI_HEADER_SIZE) ||
+        (ReadLe32(dbiStream.data()) != 0xFFFFFFFF))
+    {
+        goto Exit;
+    }
+
+    publicsStreamIndex = ReadLe16(dbiStream.data() + 16);
+    symbolStreamIndex = ReadLe16(dbiStream.data() + 20);
+    modInfoSize = ReadLe32(dbiStream.data() + 24);
+    contributionSize = ReadLe32(dbiStream.data() + 28);
+    sectionMapSize = ReadLe32(dbiStream.data() + 32);
+    sourceInfoSize = ReadLe32(dbiStream.data() + 36);
+    typeServerMapSize = ReadLe32(dbiStream.data() + 40);
+    debugHeaderSize = ReadLe32(dbiStream.data() + 48);
+    ecSize = ReadLe32(dbiStream.data() + 52);
+
+    //
+    // Substreams, in order: module info, section contributions, section map,
+    // source info, type server map, EC, optional debug header.
+    //
+    debugHeaderOffset = DBI_HEADER_SIZE;
+
+    for (uint32_t size : { modInfoSize, contributionSize, sectionMapSize, sourceInfoSize, typeServerMapSize, ecSize })
+    {
+        if ((static_cast<uint64_t>(debugHeaderOffset) + size) > dbiStream.size())
+        {
+            goto Exit;
+        }
+
+        debugHeaderOffset += size;
+    }
+
+    if ((static_cast<uint64_t>(debugHeaderOffset) + debugHeaderSize) > dbiStream.size())
+    {
+        goto Exit;
+    }
+
+    //
+    // Section headers turn (segment, offset) into an RVA. With OMAP, symbols
+    // are in the original layout: use the original headers, then OMAP.
+    //
+    for (uint32_t slot : { static_cast<uint32_t>(DBI_DEBUG_SECTION_HEADER),
+                           static_cast<uint32_t>(DBI_DEBUG_SECTION_HEADER_ORIGINAL),
+                           static_cast<uint32_t>(DBI_DEBUG_OMAP_FROM_SOURCE) })
+    {
+        uint16_t streamIndex;
+
+        if (((slot + 1) * sizeof(uint16_t)) > debugHeaderSize)
+        {
+            continue;
+        }
+
+        streamIndex = ReadLe16(dbiStream.data() + debugHeaderOffset + (slot * sizeof(uint16_t)));
+        if (streamIndex == 0xFFFF)
+        {
+            continue;
+        }
+
+        if (slot == DBI_DEBUG_OMAP_FROM_SOURCE)
+        {
+            if (ReadMsfStream(&msf, streamIndex, omapStream))
+            {
+                for (size_t i = 0; (i + sizeof(PDB_OMAP_ENTRY)) <= omapStream.size(); i += sizeof(PDB_OMAP_ENTRY))
+                {
+                    PDB_OMAP_ENTRY entry;
+
+                    entry.From = ReadLe32(omapStream.data() + i);
+                    entry.To = ReadLe32(omapStream.data() + i + 4);
+
+                    omap.push_back(entry);
+                }
+            }
+
+            continue;
+        }
+
+        if (!ReadMsfStream(&msf, streamIndex, sectionStream))
+        {
+            continue;
+        }
+
+        for (size_t i = 0; (i + IMAGE_SECTION_HEADER_SIZE) <= sectionStream.size(); i += IMAGE_SECTION_HEADER_SIZE)
+        {
+            if (slot == DBI_DEBUG_SECTION_HEADER)
+            {
+                sectionAddresses.push_back(ReadLe32(sectionStream.data() + i + 12));
+            }
+            else
+            {
+                sectionAddressesOriginal.push_back(ReadLe32(sectionStream.data() + i + 12));
+            }
+        }
+    }
+
+    if (!omap.empty())
+    {
+        if (sectionAddressesOriginal.empty())
+        {
+            goto Exit;
+        }
+
+        std::sort(omap.begin(),
+                  omap.end(),
+                  [](const PDB_OMAP_ENTRY& Left, const PDB_OMAP_ENTRY& Right)
+                  {
+                      return Left.From < Right.From;
+                  });
+
+        sectionAddresses = sectionAddressesOriginal;
+    }
+
+    if (sectionAddresses.empty())
+    {
+        goto Exit;
+    }
+
+    //
+    // Code section contributions. Not meaningful after OMAP reordering.
+    //
+    if ((omap.empty()) &&
+        (contributionSize >= sizeof(uint32_t)))
+    {
+        const uint8_t* contributions;
+        uint32_t version;
+        uint32_t entrySize;
+
+        contributions = (dbiStream.data() + DBI_HEADER_SIZE + modInfoSize);
+        version = ReadLe32(contributions);
+
+        entrySize = ((version == DBI_SECTION_CONTRIBUTION_V2) ? DBI_SECTION_CONTRIBUTION_V2_SIZE :
+                     (version == DBI_SECTION_CONTRIBUTION_V60) ? DBI_SECTION_CONTRIBUTION_V60_SIZE : 0);
+
+        for (uint32_t i = sizeof(uint32_t); (entrySize != 0) && ((i + entrySize) <= contributionSize); i += entrySize)
+        {
+            PDB_CONTRIBUTION contribution;
+            uint16_t section;
+
+            section = ReadLe16(contributions + i);
+
+            if ((section == 0) ||
+                (section > sectionAddresses.size()) ||
+                ((ReadLe32(contributions + i + 12) & IMAGE_SECTION_CODE) == 0))
+            {
+                continue;
+            }
+
+            contribution.Rva = (sectionAddresses[section - 1] + ReadLe32(contributions + i + 4));
+            contribution.Size = ReadLe32(contributions + i + 8);
+
+            Table->Contributions.push_back(contribution);
+        }
+
+        std::sort(Table->Contributions.begin(),
+                  Table->Contributions.end(),
+                  [](const PDB_CONTRIBUTION& Left, const PDB_CONTRIBUTION& Right)
+                  {
+                      return Left.Rva < Right.Rva;
+                  });
+    }
+
+    //
+    // Public symbol stream: header, GSI hash, then the address map - offsets
+    // of every S_PUB32 record in the symbol record stream.
+    //
+    if ((!ReadMsfStream(&msf, publicsStreamIndex, publicsStream)) ||
+        (publicsStream.size() < PUBLICS_HEADER_SIZE) ||
+        (!ReadMsfStream(&msf, symbolStreamIndex, symbolStream)))
+    {
+        goto Exit;
+    }
+
+    hashSize = ReadLe32(publicsStream.data());
+    addressMapSize = ReadLe32(publicsStream.data() + 4);
+
+    if ((static_cast<uint64_t>(PUBLICS_HEADER_SIZE) + hashSize + addressMapSize) > publicsStream.size())
+    {
+        goto Exit;
+    }
+
+    for (uint32_t i = 0; (i + sizeof(uint32_t)) <= addressMapSize; i += sizeof(uint32_t))
+    {
+        PDB_SYMBOL symbol;
+        uint32_t recordOffset;
+        uint32_t recordLength;
+        uint32_t flags;
+        uint32_t offset;
+        uint16_t segment;
+        const uint8_t* name;
+        const uint8_t* nameEnd;
+        const uint8_t* terminator;
+
+        recordOffset = ReadLe32(publicsStream.data() + PUBLICS_HEADER_SIZE + hashSize + i);
+
+        if ((static_cast<uint64_t>(recordOffset) + 4) > symbolStream.size())
+        {
+            continue;
+        }
+
+        //
+        // The record length excludes the length field itself.
+        //
+        recordLength = (ReadLe16(symbolStream.data() + recordOffset) + sizeof(uint16_t));
+
+        if ((ReadLe16(symbolStream.data() + recordOffset + 2) != SYMBOL_KIND_PUB32) ||
+            (recordLength <= PUB32_NAME_OFFSET) ||
+            ((static_cast<uint64_t>(recordOffset) + recordLength) > symbolStream.size()))
+        {
+            continue;
+        }
+
+        flags = ReadLe32(symbolStream.data() + recordOffset + 4);
+        offset = ReadLe32(symbolStream.data() + recordOffset + 8);
+        segment = ReadLe16(symbolStream.data() + recordOffset + 12);
+
+        if (((flags & (PUBLIC_SYMBOL_FLAG_CODE | PUBLIC_SYMBOL_FLAG_FUNCTION)) == 0) ||
+            (segment == 0) ||
+            (segment > sectionAddresses.size()))
+        {
+            continue;
+        }
+
+        symbol.Rva = TranslateOmap(omap, (sectionAddresses[segment - 1] + offset));
+        if (symbol.Rva == 0)
+        {
+            continue;
+        }
+
+        name = (symbolStream.data() + recordOffset + PUB32_NAME_OFFSET);
+        nameEnd = (symbolStream.data() + recordOffset + recordLength);
+
+        terminator = static_cast<const uint8_t*>(memchr(name, '\0', static_cast<size_t>(nameEnd - name)));
+        if ((terminator == NULL) ||
+            (terminator == name))
+        {
+            continue;
+        }
+
+        symbol.NameOffset = static_cast<uint32_t>(Table->Names.size());
+
+        Table->Names.insert(Table->Names.end(), name, terminator + 1);
+        Table->Symbols.push_back(symbol);
+    }
+
+    //
+    // The address map is in (segment, offset) order, which OMAP can shuffle.
+    //
+    std::stable_sort(Table->Symbols.begin(),
+                     Table->Symbols.end(),
+                     [](const PDB_SYMBOL& Left, const PDB_SYMBOL& Right)
+                     {
+                         return Left.Rva < Right.Rva;
+                     });
+
+    Table->Symbols.erase(std::unique(Table->Symbols.begin(),
+                                     Table->Symbols.end(),
+                                     [](const PDB_SYMBOL& Left, const PDB_SYMBOL& Right)
+                                     {
+                                         return Left.Rva == Right.Rva;
+                                     }),
+                         Table->Symbols.end());
+
+    result = (!Table->Symbols.empty());
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Gets an operator code's index in the special name tables.
+* @param[in]    Code - The code ('0'-'9', 'A'-'Z').
+* @return       The index, or -1 if it is not a code.
+*
+*/
+static
+int
+GetDecoratedOperatorIndex (
+    _In_ char Code
+    )
+{
+    if ((Code >= '0') &&
+        (Code <= '9'))
+    {
+        return (Code - '0');
+    }
+
+    if ((Code >= 'A') &&
+        (Code <= 'Z'))
+    {
+        return (10 + (Code - 'A'));
+    }
+
+    return -1;
+}
+
+/**
+*
+* @brief        Undecorates a public's name the way dbghelp does for symbols
+*               with SYMOPT_UNDNAME: the qualified name only, without the
+*               parameters, return type or calling convention (e.g.
+*               "?Run@Engine@@QEAAXH@Z" is "Engine::Run"). Names which are
+*               not MSVC C++ names are left as they are, as are the forms not
+*               handled here (templates, local scopes, conversion operators,
+*               RTTI).
+* @param[in]    Name - The name, as stored in the PDB.
+* @param[out]   Undecorated - Receives the undecorated name (or Name).
+* @return       true if the name was undecorated, otherwise false.
+*
+*/
+bool
+UndecoratePdbName (
+    _In_ const char* Name,
+    _Out_ std::string& Undecorated
+    )
+{
+    bool result;
+    const char* current;
+    const char* end;
+    const char* special;
+    std::string names[DECORATED_NAME_BACK_REFERENCES];
+    std::vector<std::string> fragments;
+    size_t nameCount;
+    int index;
+    int constructor;
+
+    result = false;
+    special = NULL;
+    nameCount = 0;
+    constructor = 0;
+
+    if (Name[0] != '?')
+    {
+        goto Exit;
+    }
+
+    current = (Name + 1);
+
+    //
+    // The unqualified name: a special name ("??<code>") or a plain one.
+    //
+    if (current[0] == '?')
+    {
+        if (current[1] == '_')
+        {
+            index = GetDecoratedOperatorIndex(current[2]);
+            current += 3;
+
+            if ((index < 0) ||
+                (k_DecoratedUnderscoreOperators[index] == NULL))
+            {
+                goto Exit;
+            }
+
+            special = k_DecoratedUnderscoreOperators[index];
+        }
+        else
+        {
+            index = GetDecoratedOperatorIndex(current[1]);
+            current += 2;
+
+            //
+            // 0 and 1 are the constructor and destructor, named after
+            // their class.
+            //
+            if ((index == 0) ||
+                (index == 1))
+            {
+                constructor = (index + 1);
+            }
+            else if ((index < 0) ||
+                     (k_DecoratedOperators[index] == NULL))
+            {
+                goto Exit;
+            }
+            else
+            {
+                special = k_DecoratedOperators[index];
+            }
+        }
+    }
+    else
+    {
+        end = strchr(current, '@');
+
+        if ((end == NULL) ||
+            (end == current))
+        {
+            goto Exit;
+        }
+
+        fragments.emplace_back(current, end);
+        names[nameCount++] = fragments.back();
+        current = (end + 1);
+    }
+
+    //
+    // Its scopes, innermost first, up to the terminating '@'. A digit
+    // refers back to a name already seen.
+    //
+    while (current[0] != '@')
+    {
+        if (current[0] == '\0')
+        {
+            goto Exit;
+        }
+
+        if ((current[0] >= '0') &&
+            (current[0] <= '9'))
+        {
+            index = (current[0] - '0');
+
+            if (static_cast<size_t>(index) >= nameCount)
+            {
+                goto Exit;
+            }
+
+            fragments.push_back(names[index]);
+            current++;
+            continue;
+        }
+
+        if (current[0] == '?')
+        {
+            //
+            // Only the anonymous namespace; templates and local scopes
+            // are left decorated.
+            //
+            if (current[1] != 'A')
+            {
+                goto Exit;
+            }
+
+            end = strchr(current, '@');
+
+            if (end == NULL)
+            {
+                goto Exit;
+            }
+
+            fragments.push_back("`anonymous namespace'");
+        }
+        else
+        {
+            end = strchr(current, '@');
+
+            if ((end == NULL) ||
+                (end == current))
+            {
+                goto Exit;
+            }
+
+            fragments.emplace_back(current, end);
+        }
+
+        if (nameCount < DECORATED_NAME_BACK_REFERENCES)
+        {
+            names[nameCount++] = fragments.back();
+        }
+
+        current = (end + 1);
+    }
+
+    //
+    // Constructors and destructors are named after their class: the
+    // innermost scope.
+    //
+    if (constructor != 0)
+    {
+        if (fragments.empty())
+        {
+            goto Exit;
+        }
+
+        fragments.insert(fragments.begin(), ((constructor == 2) ? "~" : "") + fragments.front());
+    }
+    else if (special != NULL)
+    {
+        fragments.insert(fragments.begin(), special);
+    }
+
+    Undecorated.clear();
+
+    for (size_t i = fragments.size(); i != 0; i--)
+    {
+        Undecorated.append(fragments[i - 1]);
+
+        if (i != 1)
+        {
+            Undecorated.append("::");
+        }
+    }
+
+    result = true;
+
+Exit:
+    if (!result)
+    {
+        Undecorated.assign(Name);
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Maps a PDB file and parses its public symbols.
+* @param[in]    PdbPath - The PDB on disk.
+* @param[out]   Table - The module's public symbols.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+LoadPdb (
+    _In_ const PATH_CHAR* PdbPath,
+    _Out_ PPDB_SYMBOL_TABLE Table
+    )
+{
+    bool result;
+    MAPPED_FILE mappedFile;
+
+    result = false;
+
+    if (!MapFileReadOnly(PdbPath, &mappedFile))
+    {
+        goto Exit;
+    }
+
+    //
+    // The table holds copies, so the view does not need to outlive this.
+    //
+    result = ParsePdb(mappedFile.Data,
+                      mappedFile.Length,
+                      Table);
+
+    UnmapMappedFile(&mappedFile);
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Resolves an RVA to the nearest preceding public symbol. When section
+*               contributions are known, the symbol must be in the same contribution.
+* @param[in]    Table - The module's public symbols.
+* @param[in]    Rva - The RVA to resolve.
+* @param[out]   Displacement - The offset of the RVA from the symbol.
+* @return       The symbol name, or NULL if no public symbol covers the RVA.
+*
+*/
+const char*
+LookupPdbSymbol (
+    _In_ const PDB_SYMBOL_TABLE* Table,
+    _In_ uint32_t Rva,
+    _Out_ uint32_t* Displacement
+    )
+{
+    *Displacement = 0;
+
+    auto it = std::upper_bound(Table->Symbols.begin(),
+                               Table->Symbols.end(),
+                               Rva,
+                               [](uint32_t Value, const PDB_SYMBOL& Entry)
+                               {
+                                   return Value < Entry.Rva;
+                               });
+    if (it == Table->Symbols.begin())
+    {
+        return NULL;
+    }
+
+    --it;
+
+    auto contribution = std::upper_bound(Table->Contributions.begin(),
+                                         Table->Contributions.end(),
+                                         Rva,
+                                         [](uint32_t Value, const PDB_CONTRIBUTION& Entry)
+                                         {
+                                             return Value < Entry.Rva;
+                                         });
+    if (contribution != Table->Contributions.begin())
+    {
+        --contribution;
+
+        //
+        // Inside a contribution which has no public before the RVA (e.g. a
+        // static function) - the nearest public belongs to someone else.
+        //
+        if ((Rva < (static_cast<uint64_t>(contribution->Rva) + contribution->Size)) &&
+            (it->Rva < contribution->Rva))
+        {
+            return NULL;
+        }
+    }
+
+    *Displacement = (Rva - it->Rva);
+
+    return (Table->Names.data() + it->NameOffset);
+}
\ No newline at end of file
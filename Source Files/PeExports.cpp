@@ -0,0 +1,846 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/PeExports.cpp
+*
+* @summary:   Portable PE export table symbolizer. Reads a module's export
+*             directory straight out of the (on-disk) image and resolves an
+*             address to the nearest preceding export. Used when there is
+*             no PDB. Builds on Windows and Linux.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "PeExports.hpp"
+#include <algorithm>
+#include <stdio.h>
+
+//
+// PE layout constants. Only what is needed to find the export
+// directory in a file-layout (not loaded) image.
+//
+#define PE_DOS_SIGNATURE 0x5A4D
+#define PE_NT_SIGNATURE 0x00004550
+#define PE_DOS_LFANEW_OFFSET 0x3C
+#define PE_FILE_HEADER_SIZE 20
+#define PE_OPTIONAL_MAGIC_32 0x10B
+#define PE_OPTIONAL_MAGIC_64 0x20B
+#define PE_SECTION_HEADER_SIZE 40
+#define PE_EXPORT_DIRECTORY_SIZE 40
+#define PE_SECTION_MEM_EXECUTE 0x20000000
+#define PE_SECTION_CNT_CODE 0x00000020
+#define PE_DATA_DIRECTORY_SIZE 8
+#define PE_DIRECTORY_EXPORT 0
+#define PE_DIRECTORY_DEBUG 6
+#define PE_DEBUG_DIRECTORY_SIZE 28
+#define PE_DEBUG_TYPE_CODEVIEW 2
+#define PE_CODEVIEW_RSDS_SIGNATURE 0x53445352
+#define PE_CODEVIEW_RSDS_HEADER_SIZE 24
+
+//
+// Upper bound on export counts - anything larger is a corrupt image.
+//
+#define PE_MAX_EXPORTS 0x100000
+
+//
+// A section header, as needed for RVA -> file offset translation.
+//
+typedef struct _PE_SECTION
+{
+    uint32_t VirtualAddress;
+    uint32_t VirtualSize;
+    uint32_t SizeOfRawData;
+    uint32_t PointerToRawData;
+    uint32_t Characteristics;
+} PE_SECTION, *PPE_SECTION;
+
+//
+// The header fields shared by the export and CodeView parsers.
+//
+typedef struct _PE_HEADERS
+{
+    uint32_t TimeDateStamp;
+    uint32_t CheckSum;
+    uint32_t SizeOfImage;
+    const uint8_t* DataDirectory;
+    uint32_t DataDirectoryCount;
+    std::vector<PE_SECTION> Sections;
+} PE_HEADERS, *PPE_HEADERS;
+
+/**
+*
+* @brief        Translates an RVA range into a pointer into the file.
+* @param[in]    Image - The image file contents.
+* @param[in]    ImageLength - The length of the image file.
+* @param[in]    Sections - The image's sections.
+* @param[in]    Rva - The RVA to translate.
+* @param[in]    Length - The number of bytes which must be readable at the RVA.
+* @return       A pointer into the file, or NULL if the range is not backed by the file.
+*
+*/
+static
+const uint8_t*
+PeRvaToPointer (
+    _In_ const uint8_t* Image,
+    _In_ size_t ImageLength,
+    _In_ const std::vector<PE_SECTION>& Sections,
+    _In_ uint32_t Rva,
+    _In_ size_t Length
+    )
+{
+    uint64_t fileOffset;
+
+    for (const auto& section : Sections)
+    {
+        if ((Rva < section.VirtualAddress) ||
+            ((static_cast<uint64_t>(Rva) + Length) > (static_cast<uint64_t>(section.VirtualAddress) + section.SizeOfRawData)))
+        {
+            continue;
+        }
+
+        fileOffset = (static_cast<uint64_t>(section.PointerToRawData) + (Rva - section.VirtualAddress));
+
+        if ((fileOffset + Length) > ImageLength)
+        {
+            return NULL;
+        }
+
+        return (Image + fileOffset);
+    }
+
+    return NULL;
+}
+
+/**
+*
+* @brief        Locates a NULL-terminated string at an RVA, bounded by the end of
+*               the section (and file) holding it.
+* @param[in]    Image - The image file contents.
+* @param[in]    ImageLength - The length of the image file.
+* @param[in]    Sections - The image's sections.
+* @param[in]    Rva - The RVA of the string.
+* @param[out]   StringLength - The length of the string, excluding the terminator.
+* @return       The string, or NULL if it is not terminated inside its section.
+*
+*/
+static
+const char*
+PeRvaToString (
+    _In_ const uint8_t* Image,
+    _In_ size_t ImageLength,
+    _In_ const std::vector<PE_SECTION>& Sections,
+    _In_ uint32_t Rva,
+    _Out_ size_t* StringLength
+    )
+{
+    const uint8_t* string;
+    const uint8_t* terminator;
+    uint64_t available;
+
+    *StringLength = 0;
+
+    for (const auto& section : Sections)
+    {
+        if ((Rva < section.VirtualAddress) ||
+            (Rva >= (static_cast<uint64_t>(section.VirtualAddress) + section.SizeOfRawData)))
+        {
+            continue;
+        }
+
+        string = PeRvaToPointer(Image, ImageLength, Sections, Rva, 1);
+        if (string == NULL)
+        {
+            return NULL;
+        }
+
+        available = ((static_cast<uint64_t>(section.VirtualAddress) + section.SizeOfRawData) - Rva);
+        available = (std::min)(available, static_cast<uint64_t>((Image + ImageLength) - string));
+
+        terminator = static_cast<const uint8_t*>(memchr(string, '\0', static_cast<size_t>(available)));
+        if (terminator == NULL)
+        {
+            return NULL;
+        }
+
+        *StringLength = static_cast<size_t>(terminator - string);
+
+        return reinterpret_cast<const char*>(string);
+    }
+
+    return NULL;
+}
+
+/**
+*
+* @brief        Walks the DOS/NT headers of a PE file (file layout) and collects
+*               its sections.
+* @param[in]    Image - The image file contents.
+* @param[in]    ImageLength - The length of the image file.
+* @param[out]   Headers - The fields the parsers need.
+* @return       true if the image is a valid PE32/PE32+ file, otherwise false.
+*
+*/
+static
+bool
+ParsePeHeaders (
+    _In_ const uint8_t* Image,
+    _In_ size_t ImageLength,
+    _Out_ PPE_HEADERS Headers
+    )
+{
+    bool result;
+    uint32_t ntOffset;
+    uint32_t optionalOffset;
+    uint16_t sectionCount;
+    uint16_t optionalSize;
+    uint16_t optionalMagic;
+    uint32_t dataDirectoryOffset;
+    uint32_t dataDirectoryCount;
+    const uint8_t* sectionHeader;
+
+    result = false;
+
+    Headers->TimeDateStamp = 0;
+    Headers->CheckSum = 0;
+    Headers->SizeOfImage = 0;
+    Headers->DataDirectory = NULL;
+    Headers->DataDirectoryCount = 0;
+    Headers->Sections.clear();
+
+    //
+    // DOS header -> NT headers.
+    //
+    if ((ImageLength < (PE_DOS_LFANEW_OFFSET + sizeof(uint32_t))) ||
+        (ReadLe16(Image) != PE_DOS_SIGNATURE))
+    {
+        goto Exit;
+    }
+
+    ntOffset = ReadLe32(Image + PE_DOS_LFANEW_OFFSET);
+
+    if ((static_cast<uint64_t>(ntOffset) + sizeof(uint32_t) + PE_FILE_HEADER_SIZE + sizeof(uint16_t)) > ImageLength)
+    {
+        goto Exit;
+    }
+
+    if (ReadLe32(Image + ntOffset) != PE_NT_SIGNATURE)
+    {
+        goto Exit;
+    }
+
+    sectionCount = ReadLe16(Image + ntOffset + 4 + 2);
+    Headers->TimeDateStamp = ReadLe32(Image + ntOffset + 4 + 4);
+    optionalSize = ReadLe16(Image + ntOffset + 4 + 16);
+    optionalOffset = (ntOffset + sizeof(uint32_t) + PE_FILE_HEADER_SIZE);
+
+    if ((static_cast<uint64_t>(optionalOffset) + optionalSize +
+         (static_cast<uint64_t>(sectionCount) * PE_SECTION_HEADER_SIZE)) > ImageLength)
+    {
+        goto Exit;
+    }
+
+    //
+    // The data directory moves between PE32 and PE32+.
+    //
+    optionalMagic = ReadLe16(Image + optionalOffset);
+    if (optionalMagic == PE_OPTIONAL_MAGIC_64)
+    {
+        dataDirectoryCount = 108;
+        dataDirectoryOffset = 112;
+    }
+    else if (optionalMagic == PE_OPTIONAL_MAGIC_32)
+    {
+        dataDirectoryCount = 92;
+        dataDirectoryOffset = 96;
+    }
+    else
+    {
+        goto Exit;
+    }
+
+    if (optionalSize < dataDirectoryOffset)
+    {
+        goto Exit;
+    }
+
+    Headers->SizeOfImage = ReadLe32(Image + optionalOffset + 56);
+    Headers->CheckSum = ReadLe32(Image + optionalOffset + 64);
+
+    //
+    // Only trust the entries which fit in the optional header.
+    //
+    Headers->DataDirectory = (Image + optionalOffset + dataDirectoryOffset);
+    Headers->DataDirectoryCount = (std::min)(ReadLe32(Image + optionalOffset + dataDirectoryCount),
+                                             static_cast<uint32_t>((optionalSize - dataDirectoryOffset) / PE_DATA_DIRECTORY_SIZE));
+
+    sectionHeader = (Image + optionalOffset + optionalSize);
+
+    for (uint16_t i = 0; i < sectionCount; i++, sectionHeader += PE_SECTION_HEADER_SIZE)
+    {
+        PE_SECTION section;
+
+        section.VirtualSize = ReadLe32(sectionHeader + 8);
+        section.VirtualAddress = ReadLe32(sectionHeader + 12);
+        section.SizeOfRawData = ReadLe32(sectionHeader + 16);
+        section.PointerToRawData = ReadLe32(sectionHeader + 20);
+        section.Characteristics = ReadLe32(sectionHeader + 36);
+
+        Headers->Sections.push_back(section);
+    }
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Reads a data directory entry.
+* @param[in]    Headers - The parsed headers.
+* @param[in]    Index - The data directory index.
+* @param[out]   Rva - The RVA of the directory.
+* @param[out]   Size - The size of the directory.
+* @return       true if the image has the directory, otherwise false.
+*
+*/
+static
+bool
+GetPeDataDirectory (
+    _In_ const PE_HEADERS* Headers,
+    _In_ uint32_t Index,
+    _Out_ uint32_t* Rva,
+    _Out_ uint32_t* Size
+    )
+{
+    *Rva = 0;
+    *Size = 0;
+
+    if (Index >= Headers->DataDirectoryCount)
+    {
+        return false;
+    }
+
+    *Rva = ReadLe32(Headers->DataDirectory + (Index * PE_DATA_DIRECTORY_SIZE));
+    *Size = ReadLe32(Headers->DataDirectory + (Index * PE_DATA_DIRECTORY_SIZE) + 4);
+
+    return ((*Rva != 0) &&
+            (*Size != 0));
+}
+
+/**
+*
+* @brief        Parses the export directory of a PE file (file layout).
+* @param[in]    Image - The image file contents.
+* @param[in]    ImageLength - The length of the image file.
+* @param[out]   Table - The module's exports, sorted by RVA.
+* @return       true if the image has at least one exported function, otherwise false.
+*
+*/
+bool
+ParsePeExports (
+    _In_ const uint8_t* Image,
+    _In_ size_t ImageLength,
+    _Out_ PPE_EXPORT_TABLE Table
+    )
+{
+    bool result;
+    uint32_t exportRva;
+    uint32_t exportSize;
+    uint32_t ordinalBase;
+    uint32_t functionCount;
+    uint32_t nameCount;
+    const uint8_t* exportDirectory;
+    const uint8_t* functions;
+    const uint8_t* names;
+    const uint8_t* nameOrdinals;
+    PE_HEADERS headers;
+    std::vector<uint32_t> functionNames;
+    std::vector<PE_EXPORT> exports;
+    std::vector<bool> exportNamed;
+
+    result = false;
+
+    Table->TimeDateStamp = 0;
+    Table->CheckSum = 0;
+    Table->SizeOfImage = 0;
+    Table->Exports.clear();
+    Table->CodeSections.clear();
+    Table->Names.clear();
+
+    if (!ParsePeHeaders(Image, ImageLength, &headers))
+    {
+        goto Exit;
+    }
+
+    Table->TimeDateStamp = headers.TimeDateStamp;
+    Table->CheckSum = headers.CheckSum;
+    Table->SizeOfImage = headers.SizeOfImage;
+
+    for (const auto& section : headers.Sections)
+    {
+        if ((section.Characteristics & (PE_SECTION_MEM_EXECUTE | PE_SECTION_CNT_CODE)) != 0)
+        {
+            PE_CODE_SECTION codeSection;
+
+            codeSection.VirtualAddress = section.VirtualAddress;
+            codeSection.VirtualSize = (std::max)(section.VirtualSize, section.SizeOfRawData);
+
+            Table->CodeSections.push_back(codeSection);
+        }
+    }
+
+    if (!GetPeDataDirectory(&headers, PE_DIRECTORY_EXPORT, &exportRva, &exportSize))
+    {
+        goto Exit;
+    }
+
+    if ((exportRva == 0) ||
+        (exportSize < PE_EXPORT_DIRECTORY_SIZE))
+    {
+        goto Exit;
+    }
+
+    exportDirectory = PeRvaToPointer(Image, ImageLength, headers.Sections, exportRva, PE_EXPORT_DIRECTORY_SIZE);
+    if (exportDirectory == NULL)
+    {
+        goto Exit;
+    }
+
+    ordinalBase = ReadLe32(exportDirectory + 16);
+    functionCount = ReadLe32(exportDirectory + 20);
+    nameCount = ReadLe32(exportDirectory + 24);
+
+    if ((functionCount == 0) ||
+        (functionCount > PE_MAX_EXPORTS) ||
+        (nameCount > PE_MAX_EXPORTS))
+    {
+        goto Exit;
+    }
+
+    functions = PeRvaToPointer(Image, ImageLength, headers.Sections, ReadLe32(exportDirectory + 28), functionCount * sizeof(uint32_t));
+    names = PeRvaToPointer(Image, ImageLength, headers.Sections, ReadLe32(exportDirectory + 32), nameCount * sizeof(uint32_t));
+    nameOrdinals = PeRvaToPointer(Image, ImageLength, headers.Sections, ReadLe32(exportDirectory + 36), nameCount * sizeof(uint16_t));
+
+    if ((functions == NULL) ||
+        ((nameCount != 0) &&
+         ((names == NULL) ||
+          (nameOrdinals == NULL))))
+    {
+        goto Exit;
+    }
+
+    //
+    // Function index -> RVA of its (first) name. 0 means unnamed.
+    //
+    functionNames.assign(functionCount, 0);
+
+    for (uint32_t i = 0; i < nameCount; i++)
+    {
+        uint16_t functionIndex;
+
+        functionIndex = ReadLe16(nameOrdinals + (i * sizeof(uint16_t)));
+
+        if ((functionIndex < functionCount) &&
+            (functionNames[functionIndex] == 0))
+        {
+            functionNames[functionIndex] = ReadLe32(names + (i * sizeof(uint32_t)));
+        }
+    }
+
+    for (uint32_t i = 0; i < functionCount; i++)
+    {
+        PE_EXPORT exportEntry;
+        uint32_t functionRva;
+        const char* name;
+        size_t nameLength;
+        char ordinalName[32];
+
+        functionRva = ReadLe32(functions + (i * sizeof(uint32_t)));
+
+        //
+        // Skip unused slots and forwarders (which point back into the
+        // export directory at a "Dll.Function" string).
+        //
+        if ((functionRva == 0) ||
+            ((functionRva >= exportRva) &&
+             (functionRva < (exportRva + exportSize))))
+        {
+            continue;
+        }
+
+        exportEntry.Rva = functionRva;
+        exportEntry.NameOffset = static_cast<uint32_t>(Table->Names.size());
+
+        name = NULL;
+        nameLength = 0;
+
+        if (functionNames[i] != 0)
+        {
+            name = PeRvaToString(Image, ImageLength, headers.Sections, functionNames[i], &nameLength);
+        }
+
+        if ((name != NULL) &&
+            (nameLength != 0))
+        {
+            Table->Names.insert(Table->Names.end(), name, name + nameLength);
+        }
+        else
+        {
+            //
+            // Same convention as dbghelp for unnamed exports.
+            //
+            snprintf(ordinalName, sizeof(ordinalName), "Ordinal%u", (ordinalBase + i));
+
+            Table->Names.insert(Table->Names.end(), ordinalName, ordinalName + strlen(ordinalName));
+            name = NULL;
+        }
+
+        Table->Names.push_back('\0');
+
+        exports.push_back(exportEntry);
+        exportNamed.push_back(name != NULL);
+    }
+
+    //
+    // Sort by RVA. Where several exports share an address, prefer a
+    // named one over an ordinal.
+    //
+    {
+        std::vector<uint32_t> order(exports.size());
+
+        for (uint32_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+
+        std::stable_sort(order.begin(),
+                         order.end(),
+                         [&exports, &exportNamed](uint32_t Left, uint32_t Right)
+                         {
+                             if (exports[Left].Rva != exports[Right].Rva)
+                             {
+                                 return exports[Left].Rva < exports[Right].Rva;
+                             }
+
+                             return (exportNamed[Left] && !exportNamed[Right]);
+                         });
+
+        for (uint32_t i : order)
+        {
+            if ((!Table->Exports.empty()) &&
+                (Table->Exports.back().Rva == exports[i].Rva))
+            {
+                continue;
+            }
+
+            Table->Exports.push_back(exports[i]);
+        }
+    }
+
+    result = (!Table->Exports.empty());
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Maps a PE file and parses its exports.
+* @param[in]    ImagePath - The image on disk.
+* @param[out]   Table - The module's exports.
+* @return       true if the image has at least one exported function, otherwise false.
+*
+*/
+bool
+LoadPeExports (
+    _In_ const PATH_CHAR* ImagePath,
+    _Out_ PPE_EXPORT_TABLE Table
+    )
+{
+    bool result;
+    MAPPED_FILE mappedFile;
+
+    result = false;
+
+    if (!MapFileReadOnly(ImagePath, &mappedFile))
+    {
+        goto Exit;
+    }
+
+    //
+    // The table holds copies, so the view does not need to outlive this.
+    //
+    result = ParsePeExports(mappedFile.Data,
+                            mappedFile.Length,
+                            Table);
+
+    UnmapMappedFile(&mappedFile);
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Determines if an export may be used for an RVA. Never attribute an
+*               address to an export in a different section (e.g. a non-exported
+*               function in the next section over).
+* @param[in]    Table - The module's exports.
+* @param[in]    Rva - The RVA being resolved.
+* @param[in]    ExportRva - The RVA of the nearest preceding export.
+* @return       true if the export is in the RVA's section, otherwise false
+*               (including if the RVA is in no code section, e.g. headers,
+*               data or past the image - no export names code there).
+*
+*/
+static
+bool
+IsPeExportInSection (
+    _In_ const PE_EXPORT_TABLE* Table,
+    _In_ uint32_t Rva,
+    _In_ uint32_t ExportRva
+    )
+{
+    for (const auto& codeSection : Table->CodeSections)
+    {
+        if ((Rva >= codeSection.VirtualAddress) &&
+            (Rva < (codeSection.VirtualAddress + codeSection.VirtualSize)))
+        {
+            return (ExportRva >= codeSection.VirtualAddress);
+        }
+    }
+
+    return false;
+}
+
+/**
+*
+* @brief        Resolves an RVA to the nearest preceding export in the same section.
+* @param[in]    Table - The module's exports.
+* @param[in]    Rva - The RVA to resolve.
+* @param[out]   Displacement - The offset of the RVA from the export.
+* @return       The export name, or NULL if no export covers the RVA (or it is
+*               not in a code section).
+*
+*/
+const char*
+LookupPeExport (
+    _In_ const PE_EXPORT_TABLE* Table,
+    _In_ uint32_t Rva,
+    _Out_ uint32_t* Displacement
+    )
+{
+    *Displacement = 0;
+
+    auto it = std::upper_bound(Table->Exports.begin(),
+                               Table->Exports.end(),
+                               Rva,
+                               [](uint32_t Value, const PE_EXPORT& Entry)
+                               {
+                                   return Value < Entry.Rva;
+                               });
+    if (it == Table->Exports.begin())
+    {
+        return NULL;
+    }
+
+    --it;
+
+    if (!IsPeExportInSection(Table, Rva, it->Rva))
+    {
+        return NULL;
+    }
+
+    *Displacement = (Rva - it->Rva);
+
+    return (Table->Names.data() + it->NameOffset);
+}
+
+/**
+*
+* @brief        Resolves a batch of RVAs from the same module with one forward sweep
+*               over the exports. Names are returned as offsets into Table->Names.
+* @param[in]    Table - The module's exports.
+* @param[in]    Batch - The RVAs to resolve. Sorted by RVA on return.
+* @param[in]    Count - The number of entries in the batch.
+*
+*/
+void
+LookupPeExportBatch (
+    _In_ const PE_EXPORT_TABLE* Table,
+    _Inout_ PSYMBOL_BATCH_ENTRY Batch,
+    _In_ size_t Count
+    )
+{
+    const PE_EXPORT* first;
+    const PE_EXPORT* last;
+    const PE_EXPORT* cursor;
+
+    SortSymbolBatch(Batch, Count);
+
+    first = Table->Exports.data();
+    last = (first + Table->Exports.size());
+    cursor = first;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        const PE_EXPORT* entry;
+
+        Batch[i].NameOffset = SYMBOL_BATCH_UNRESOLVED;
+        Batch[i].Displacement = 0;
+
+        cursor = SweepSymbolTable(cursor, last, Batch[i].Rva);
+        if (cursor == first)
+        {
+            continue;
+        }
+
+        entry = (cursor - 1);
+
+        if (!IsPeExportInSection(Table, Batch[i].Rva, entry->Rva))
+        {
+            continue;
+        }
+
+        Batch[i].NameOffset = entry->NameOffset;
+        Batch[i].Displacement = (Batch[i].Rva - entry->Rva);
+    }
+}
+
+/**
+*
+* @brief        Reads the CodeView (RSDS) record from a PE file's debug directory.
+* @param[in]    Image - The image file contents.
+* @param[in]    ImageLength - The length of the image file.
+* @param[out]   CodeView - The PDB signature, age and path.
+* @return       true if the image has an RSDS record, otherwise false.
+*
+*/
+bool
+ParsePeCodeView (
+    _In_ const uint8_t* Image,
+    _In_ size_t ImageLength,
+    _Out_ PPE_CODEVIEW CodeView
+    )
+{
+    bool result;
+    uint32_t debugRva;
+    uint32_t debugSize;
+    const uint8_t* debugDirectory;
+    PE_HEADERS headers;
+
+    result = false;
+
+    memset(CodeView->Guid, 0, sizeof(CodeView->Guid));
+    CodeView->Age = 0;
+    CodeView->PdbPath.clear();
+
+    if (!ParsePeHeaders(Image, ImageLength, &headers))
+    {
+        goto Exit;
+    }
+
+    if (!GetPeDataDirectory(&headers, PE_DIRECTORY_DEBUG, &debugRva, &debugSize))
+    {
+        goto Exit;
+    }
+
+    debugDirectory = PeRvaToPointer(Image, ImageLength, headers.Sections, debugRva, debugSize);
+    if (debugDirectory == NULL)
+    {
+        goto Exit;
+    }
+
+    for (uint32_t i = 0; i < (debugSize / PE_DEBUG_DIRECTORY_SIZE); i++)
+    {
+        const uint8_t* entry;
+        const uint8_t* record;
+        const uint8_t* terminator;
+        uint32_t recordSize;
+        uint32_t recordOffset;
+
+        entry = (debugDirectory + (i * PE_DEBUG_DIRECTORY_SIZE));
+
+        if (ReadLe32(entry + 12) != PE_DEBUG_TYPE_CODEVIEW)
+        {
+            continue;
+        }
+
+        //
+        // PointerToRawData is a file offset, so this works whether or not
+        // the record lives in a mapped section.
+        //
+        recordSize = ReadLe32(entry + 16);
+        recordOffset = ReadLe32(entry + 24);
+
+        if ((recordSize <= PE_CODEVIEW_RSDS_HEADER_SIZE) ||
+            ((static_cast<uint64_t>(recordOffset) + recordSize) > ImageLength))
+        {
+            continue;
+        }
+
+        record = (Image + recordOffset);
+
+        if (ReadLe32(record) != PE_CODEVIEW_RSDS_SIGNATURE)
+        {
+            continue;
+        }
+
+        terminator = static_cast<const uint8_t*>(memchr(record + PE_CODEVIEW_RSDS_HEADER_SIZE,
+                                                        '\0',
+                                                        (recordSize - PE_CODEVIEW_RSDS_HEADER_SIZE)));
+        if (terminator == NULL)
+        {
+            continue;
+        }
+
+        memcpy(CodeView->Guid, record + 4, sizeof(CodeView->Guid));
+        CodeView->Age = ReadLe32(record + 20);
+        CodeView->PdbPath.assign(reinterpret_cast<const char*>(record + PE_CODEVIEW_RSDS_HEADER_SIZE),
+                                 reinterpret_cast<const char*>(terminator));
+
+        result = true;
+        break;
+    }
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Maps a PE file and reads its CodeView record.
+* @param[in]    ImagePath - The image on disk.
+* @param[out]   CodeView - The PDB signature, age and path.
+* @return       true if the image has an RSDS record, otherwise false.
+*
+*/
+bool
+LoadPeCodeView (
+    _In_ const PATH_CHAR* ImagePath,
+    _Out_ PPE_CODEVIEW CodeView
+    )
+{
+    bool result;
+    MAPPED_FILE mappedFile;
+
+    result = false;
+
+    if (!MapFileReadOnly(ImagePath, &mappedFile))
+    {
+        goto Exit;
+    }
+
+    result = ParsePeCodeView(mappedFile.Data,
+                             mappedFile.Length,
+                             CodeView);
+
+    UnmapMappedFile(&mappedFile);
+
+Exit:
+    return result;
+}
\ No newline at end of file
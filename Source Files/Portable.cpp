@@ -0,0 +1,516 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Portable.cpp
+*
+* @summary:   Minimal platform layer implementation (file and shared memory mapping).
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Portable.hpp"
+#include <stdio.h>
+#include <wchar.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#endif
+
+/**
+*
+* @brief        Maps a whole file read-only.
+* @param[in]    FilePath - The file to map.
+* @param[out]   MappedFile - The mapped view.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+MapFileReadOnly (
+    _In_ const PATH_CHAR* FilePath,
+    _Out_ PMAPPED_FILE MappedFile
+    )
+{
+    bool result;
+
+    result = false;
+
+    memset(MappedFile, 0, sizeof(*MappedFile));
+
+#ifdef _WIN32
+    HANDLE fileHandle;
+    LARGE_INTEGER fileSize;
+
+    fileHandle = CreateFileW(FilePath,
+                             GENERIC_READ,
+                             FILE_SHARE_READ,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        goto Exit;
+    }
+
+    if ((GetFileSizeEx(fileHandle, &fileSize) == FALSE) ||
+        (fileSize.QuadPart == 0))
+    {
+        CloseHandle(fileHandle);
+        goto Exit;
+    }
+
+    MappedFile->MappingHandle = CreateFileMappingW(fileHandle,
+                                                   NULL,
+                                                   PAGE_READONLY,
+                                                   0,
+                                                   0,
+                                                   NULL);
+
+    //
+    // The mapping keeps the file alive.
+    //
+    CloseHandle(fileHandle);
+
+    if (MappedFile->MappingHandle == NULL)
+    {
+        wprintf(L"[-] Error! CreateFileMappingW failed in MapFileReadOnly. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    MappedFile->Data = static_cast<const uint8_t*>(MapViewOfFile(MappedFile->MappingHandle,
+                                                                 FILE_MAP_READ,
+                                                                 0,
+                                                                 0,
+                                                                 0));
+    if (MappedFile->Data == NULL)
+    {
+        wprintf(L"[-] Error! MapViewOfFile failed in MapFileReadOnly. (GLE: %d)\n", GetLastError());
+        CloseHandle(MappedFile->MappingHandle);
+        MappedFile->MappingHandle = NULL;
+        goto Exit;
+    }
+
+    MappedFile->Length = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fileDescriptor;
+    struct stat fileStat;
+    void* view;
+
+    fileDescriptor = open(FilePath, O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+        goto Exit;
+    }
+
+    if ((fstat(fileDescriptor, &fileStat) != 0) ||
+        (fileStat.st_size == 0))
+    {
+        close(fileDescriptor);
+        goto Exit;
+    }
+
+    view = mmap(NULL,
+                static_cast<size_t>(fileStat.st_size),
+                PROT_READ,
+                MAP_PRIVATE,
+                fileDescriptor,
+                0);
+
+    close(fileDescriptor);
+
+    if (view == MAP_FAILED)
+    {
+        wprintf(L"[-] Error! mmap failed in MapFileReadOnly. (errno: %d)\n", errno);
+        goto Exit;
+    }
+
+    MappedFile->Data = static_cast<const uint8_t*>(view);
+    MappedFile->Length = static_cast<size_t>(fileStat.st_size);
+#endif
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Unmaps a file mapped with MapFileReadOnly.
+* @param[in]    MappedFile - The mapped view.
+*
+*/
+void
+UnmapMappedFile (
+    _Inout_ PMAPPED_FILE MappedFile
+    )
+{
+    if (MappedFile->Data != NULL)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(MappedFile->Data);
+        CloseHandle(MappedFile->MappingHandle);
+#else
+        munmap(const_cast<uint8_t*>(MappedFile->Data), MappedFile->Length);
+#endif
+    }
+
+    memset(MappedFile, 0, sizeof(*MappedFile));
+}
+
+/**
+*
+* @brief        Creates a named shared memory region and maps it read-write.
+*               The region starts zeroed. A region of the same name which is
+*               still open elsewhere is an error on Windows; on POSIX a stale
+*               name (left by a producer which was killed) is replaced.
+* @param[in]    Name - The region's name (no prefix, no separators).
+* @param[in]    Length - The region's size.
+* @param[out]   Mapping - The mapped region.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+CreateSharedMapping (
+    _In_ const PATH_CHAR* Name,
+    _In_ size_t Length,
+    _Out_ PSHARED_MAPPING Mapping
+    )
+{
+    bool result;
+
+    result = false;
+
+    memset(Mapping, 0, sizeof(*Mapping));
+
+#ifdef _WIN32
+    wchar_t mappingName[SHARED_MAPPING_MAX_NAME];
+
+    if (swprintf(mappingName, SHARED_MAPPING_MAX_NAME, L"Local\\%s", Name) < 0)
+    {
+        wprintf(L"[-] Error! The shared mapping name %s is too long.\n", Name);
+        goto Exit;
+    }
+
+    Mapping->MappingHandle = CreateFileMappingW(INVALID_HANDLE_VALUE,
+                                                NULL,
+                                                PAGE_READWRITE,
+                                                static_cast<DWORD>(static_cast<uint64_t>(Length) >> 32),
+                                                static_cast<DWORD>(Length),
+                                                mappingName);
+    if (Mapping->MappingHandle == NULL)
+    {
+        wprintf(L"[-] Error! CreateFileMappingW failed in CreateSharedMapping. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        wprintf(L"[-] Error! The shared mapping %s is already in use.\n", mappingName);
+        CloseHandle(Mapping->MappingHandle);
+        Mapping->MappingHandle = NULL;
+        goto Exit;
+    }
+
+    Mapping->Data = static_cast<uint8_t*>(MapViewOfFile(Mapping->MappingHandle,
+                                                        FILE_MAP_WRITE,
+                                                        0,
+                                                        0,
+                                                        Length));
+    if (Mapping->Data == NULL)
+    {
+        wprintf(L"[-] Error! MapViewOfFile failed in CreateSharedMapping. (GLE: %d)\n", GetLastError());
+        CloseHandle(Mapping->MappingHandle);
+        Mapping->MappingHandle = NULL;
+        goto Exit;
+    }
+#else
+    int fileDescriptor;
+    void* view;
+
+    if (snprintf(Mapping->Name, SHARED_MAPPING_MAX_NAME, "/%s", Name) >= SHARED_MAPPING_MAX_NAME)
+    {
+        wprintf(L"[-] Error! The shared mapping name %s is too long.\n", Name);
+        goto Exit;
+    }
+
+    shm_unlink(Mapping->Name);
+
+    fileDescriptor = shm_open(Mapping->Name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fileDescriptor < 0)
+    {
+        wprintf(L"[-] Error! shm_open failed in CreateSharedMapping. (errno: %d)\n", errno);
+        goto Exit;
+    }
+
+    if (ftruncate(fileDescriptor, static_cast<off_t>(Length)) != 0)
+    {
+        wprintf(L"[-] Error! ftruncate failed in CreateSharedMapping. (errno: %d)\n", errno);
+        close(fileDescriptor);
+        shm_unlink(Mapping->Name);
+        goto Exit;
+    }
+
+    view = mmap(NULL,
+                Length,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED,
+                fileDescriptor,
+                0);
+
+    close(fileDescriptor);
+
+    if (view == MAP_FAILED)
+    {
+        wprintf(L"[-] Error! mmap failed in CreateSharedMapping. (errno: %d)\n", errno);
+        shm_unlink(Mapping->Name);
+        goto Exit;
+    }
+
+    Mapping->Data = static_cast<uint8_t*>(view);
+#endif
+
+    Mapping->Length = Length;
+    Mapping->Owner = true;
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Maps an existing named shared memory region read-only.
+* @param[in]    Name - The region's name, as it was created.
+* @param[out]   Mapping - The mapped region.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+OpenSharedMapping (
+    _In_ const PATH_CHAR* Name,
+    _Out_ PSHARED_MAPPING Mapping
+    )
+{
+    bool result;
+
+    result = false;
+
+    memset(Mapping, 0, sizeof(*Mapping));
+
+#ifdef _WIN32
+    wchar_t mappingName[SHARED_MAPPING_MAX_NAME];
+    MEMORY_BASIC_INFORMATION region;
+
+    if (swprintf(mappingName, SHARED_MAPPING_MAX_NAME, L"Local\\%s", Name) < 0)
+    {
+        goto Exit;
+    }
+
+    Mapping->MappingHandle = OpenFileMappingW(FILE_MAP_READ,
+                                              FALSE,
+                                              mappingName);
+    if (Mapping->MappingHandle == NULL)
+    {
+        goto Exit;
+    }
+
+    Mapping->Data = static_cast<uint8_t*>(MapViewOfFile(Mapping->MappingHandle,
+                                                        FILE_MAP_READ,
+                                                        0,
+                                                        0,
+                                                        0));
+    if (Mapping->Data == NULL)
+    {
+        wprintf(L"[-] Error! MapViewOfFile failed in OpenSharedMapping. (GLE: %d)\n", GetLastError());
+        CloseHandle(Mapping->MappingHandle);
+        Mapping->MappingHandle = NULL;
+        goto Exit;
+    }
+
+    //
+    // Sections are whole pages, so the view is the creator's length
+    // rounded up.
+    //
+    if (VirtualQuery(Mapping->Data, &region, sizeof(region)) == 0)
+    {
+        wprintf(L"[-] Error! VirtualQuery failed in OpenSharedMapping. (GLE: %d)\n", GetLastError());
+        UnmapViewOfFile(Mapping->Data);
+        CloseHandle(Mapping->MappingHandle);
+        memset(Mapping, 0, sizeof(*Mapping));
+        goto Exit;
+    }
+
+    Mapping->Length = region.RegionSize;
+#else
+    int fileDescriptor;
+    struct stat fileStat;
+    void* view;
+
+    if (snprintf(Mapping->Name, SHARED_MAPPING_MAX_NAME, "/%s", Name) >= SHARED_MAPPING_MAX_NAME)
+    {
+        goto Exit;
+    }
+
+    fileDescriptor = shm_open(Mapping->Name, O_RDONLY, 0);
+    if (fileDescriptor < 0)
+    {
+        goto Exit;
+    }
+
+    if ((fstat(fileDescriptor, &fileStat) != 0) ||
+        (fileStat.st_size == 0))
+    {
+        close(fileDescriptor);
+        goto Exit;
+    }
+
+    view = mmap(NULL,
+                static_cast<size_t>(fileStat.st_size),
+                PROT_READ,
+                MAP_SHARED,
+                fileDescriptor,
+                0);
+
+    close(fileDescriptor);
+
+    if (view == MAP_FAILED)
+    {
+        wprintf(L"[-] Error! mmap failed in OpenSharedMapping. (errno: %d)\n", errno);
+        goto Exit;
+    }
+
+    Mapping->Data = static_cast<uint8_t*>(view);
+    Mapping->Length = static_cast<size_t>(fileStat.st_size);
+#endif
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Unmaps a shared memory region. The creator also removes its name.
+* @param[in]    Mapping - The mapped region.
+*
+*/
+void
+CloseSharedMapping (
+    _Inout_ PSHARED_MAPPING Mapping
+    )
+{
+    if (Mapping->Data != NULL)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(Mapping->Data);
+        CloseHandle(Mapping->MappingHandle);
+#else
+        munmap(Mapping->Data, Mapping->Length);
+
+        if (Mapping->Owner)
+        {
+            shm_unlink(Mapping->Name);
+        }
+#endif
+    }
+
+    memset(Mapping, 0, sizeof(*Mapping));
+}
+
+
+/**
+*
+* @brief        Reads a monotonic clock, for timing and pacing.
+* @return       The time in nanoseconds (from an arbitrary start).
+*
+*/
+uint64_t
+GetMonotonicNanoseconds ()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (((static_cast<uint64_t>(counter.QuadPart) / static_cast<uint64_t>(frequency.QuadPart)) * 1000000000ULL) +
+            (((static_cast<uint64_t>(counter.QuadPart) % static_cast<uint64_t>(frequency.QuadPart)) * 1000000000ULL) / static_cast<uint64_t>(frequency.QuadPart)));
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((static_cast<uint64_t>(now.tv_sec) * 1000000000ULL) + static_cast<uint64_t>(now.tv_nsec));
+#endif
+}
+
+/**
+*
+* @brief        Sleeps the calling thread.
+* @param[in]    Milliseconds - How long for.
+*
+*/
+void
+SleepMilliseconds (
+    _In_ uint32_t Milliseconds
+    )
+{
+#ifdef _WIN32
+    Sleep(Milliseconds);
+#else
+    struct timespec duration;
+
+    duration.tv_sec = (Milliseconds / 1000);
+    duration.tv_nsec = (static_cast<long>(Milliseconds % 1000) * 1000000L);
+
+    nanosleep(&duration, NULL);
+#endif
+}
+
+/**
+*
+* @brief        Determines if a process is still running.
+* @param[in]    ProcessId - The process.
+* @return       true if it is (or might be, if it cannot be queried),
+*               otherwise false.
+*
+*/
+bool
+IsProcessRunning (
+    _In_ uint32_t ProcessId
+    )
+{
+#ifdef _WIN32
+    HANDLE process;
+    bool running;
+
+    process = OpenProcess(SYNCHRONIZE, FALSE, ProcessId);
+
+    if (process == NULL)
+    {
+        return (GetLastError() == ERROR_ACCESS_DENIED);
+    }
+
+    running = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+
+    CloseHandle(process);
+
+    return running;
+#else
+    return ((kill(static_cast<pid_t>(ProcessId), 0) == 0) ||
+            (errno == EPERM));
+#endif
+}
\ No newline at end of file
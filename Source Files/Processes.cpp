@@ -0,0 +1,358 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Processes.cpp
+*
+* @summary:   Process and thread name cache implementation.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Processes.hpp"
+#include "Unicode.hpp"
+#include <unordered_map>
+#include <deque>
+#include <string>
+#include <stdio.h>
+
+//
+// Interned names, in UTF-8 (the output encoding) so they are transcoded
+// once here rather than once per row. A deque is used so that pointers
+// handed out by GetInternedName stay valid as more names are added.
+//
+static std::deque<std::string> k_NameTable;
+static std::unordered_map<std::string, ULONG> k_NameIds;
+
+//
+// Names not interned because the table was full.
+//
+static ULONGLONG k_NamesDropped = 0;
+
+//
+// PID -> (image name, start time)
+//
+static std::unordered_map<ULONG, PROCESS_NODE> k_ProcessMap;
+
+//
+// Process starts for a PID we still tracked (its exit was lost), and
+// exits which arrived after their PID's next process had started.
+//
+static ULONGLONG k_ProcessesReused = 0;
+static ULONGLONG k_StaleProcessEnds = 0;
+
+//
+// TID -> (owning PID, thread name)
+//
+static std::unordered_map<ULONG, THREAD_NODE> k_ThreadMap;
+
+/**
+*
+* @brief        Interns a name, returning a stable ID which can be stored in a record.
+*               Once NAME_TABLE_MAX_NAMES names are interned, new ones are not.
+* @param[in]    Name - The name to intern. Does not need to be NULL-terminated.
+* @param[in]    NameLength - The length, in characters, of the name.
+* @return       The ID of the interned name, or UNKNOWN_NAME_ID.
+*
+*/
+ULONG
+InternName (
+    _In_ const wchar_t* Name,
+    _In_ SIZE_T NameLength
+    )
+{
+    ULONG nameId;
+
+    //
+    // Reserve ID 0 for unknown names.
+    //
+    if (k_NameTable.empty())
+    {
+        k_NameTable.emplace_back("Unknown");
+        k_NameIds.insert({ k_NameTable.back(), UNKNOWN_NAME_ID });
+    }
+
+    if ((Name == NULL) ||
+        (NameLength == 0))
+    {
+        nameId = UNKNOWN_NAME_ID;
+        goto Exit;
+    }
+
+    {
+        std::string name(ConvertToUtf8(Name, NameLength));
+
+        auto it = k_NameIds.find(name);
+        if (it != k_NameIds.end())
+        {
+            nameId = it->second;
+            goto Exit;
+        }
+
+        if (k_NameTable.size() >= NAME_TABLE_MAX_NAMES)
+        {
+            k_NamesDropped++;
+
+            nameId = UNKNOWN_NAME_ID;
+            goto Exit;
+        }
+
+        nameId = static_cast<ULONG>(k_NameTable.size());
+
+        k_NameTable.push_back(name);
+        k_NameIds.insert({ std::move(name), nameId });
+    }
+
+Exit:
+    return nameId;
+}
+
+/**
+*
+* @brief        Retrieves an interned name.
+* @param[in]    NameId - The ID returned from InternName.
+* @return       The interned (UTF-8) name, or "Unknown" for an invalid ID.
+*
+*/
+const char*
+GetInternedName (
+    _In_ ULONG NameId
+    )
+{
+    if (NameId >= k_NameTable.size())
+    {
+        return "Unknown";
+    }
+
+    return k_NameTable[NameId].c_str();
+}
+
+/**
+*
+* @brief        Inserts (or replaces) a process in the process cache.
+* @param[in]    ProcessId - The target process ID.
+* @param[in]    StartTime - The raw start timestamp, 0 if unknown (rundown).
+* @param[in]    ImageName - The ANSI image name from the process event.
+* @param[in]    ImageNameLength - The length, in characters, of the image name.
+*
+*/
+void
+InsertProcess (
+    _In_ ULONG ProcessId,
+    _In_ ULONGLONG StartTime,
+    _In_ const char* ImageName,
+    _In_ SIZE_T ImageNameLength
+    )
+{
+    PROCESS_NODE processNode;
+    wchar_t imageName[MAX_PATH];
+    int convertedLength;
+
+    convertedLength = 0;
+
+    RtlZeroMemory(&processNode, sizeof(processNode));
+    RtlZeroMemory(&imageName, sizeof(imageName));
+
+    if ((ImageNameLength != 0) &&
+        (ImageNameLength < ARRAYSIZE(imageName)))
+    {
+        convertedLength = MultiByteToWideChar(CP_ACP,
+                                              0,
+                                              ImageName,
+                                              static_cast<int>(ImageNameLength),
+                                              imageName,
+                                              ARRAYSIZE(imageName));
+    }
+
+    processNode.StartTime = StartTime;
+    processNode.ImageNameId = InternName(imageName,
+                                         static_cast<SIZE_T>(convertedLength));
+
+    //
+    // A process start for a PID we already track means the PID was reused
+    // (and we missed the exit). The newest process always wins, and the
+    // old process's threads - whose exits we missed too - go with it.
+    //
+    auto existing = k_ProcessMap.find(ProcessId);
+    if ((existing != k_ProcessMap.end()) &&
+        (StartTime != 0) &&
+        (existing->second.StartTime != StartTime))
+    {
+        k_ProcessesReused++;
+
+        for (auto thread = k_ThreadMap.begin(); thread != k_ThreadMap.end();)
+        {
+            if (thread->second.ProcessId == ProcessId)
+            {
+                thread = k_ThreadMap.erase(thread);
+            }
+            else
+            {
+                ++thread;
+            }
+        }
+    }
+
+    k_ProcessMap[ProcessId] = processNode;
+}
+
+/**
+*
+* @brief        Removes an exited process from the process cache.
+* @param[in]    ProcessId - The target process ID.
+* @param[in]    EndTime - The raw timestamp of the process end event.
+*
+*/
+void
+RemoveProcess (
+    _In_ ULONG ProcessId,
+    _In_ ULONGLONG EndTime
+    )
+{
+    auto it = k_ProcessMap.find(ProcessId);
+    if (it == k_ProcessMap.end())
+    {
+        return;
+    }
+
+    //
+    // Events are not delivered in order across CPUs: an exit older than
+    // the tracked process's start is the previous process's, and must not
+    // drop the one which reused its PID.
+    //
+    if (EndTime < it->second.StartTime)
+    {
+        k_StaleProcessEnds++;
+        return;
+    }
+
+    k_ProcessMap.erase(it);
+}
+
+/**
+*
+* @brief        Inserts a thread into the thread cache.
+* @param[in]    ProcessId - The owning process ID.
+* @param[in]    ThreadId - The target thread ID.
+*
+*/
+void
+InsertThread (
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId
+    )
+{
+    THREAD_NODE threadNode;
+
+    RtlZeroMemory(&threadNode, sizeof(threadNode));
+
+    threadNode.ProcessId = ProcessId;
+    threadNode.ThreadNameId = UNKNOWN_NAME_ID;
+
+    k_ThreadMap[ThreadId] = threadNode;
+}
+
+/**
+*
+* @brief        Removes an exited thread from the thread cache.
+* @param[in]    ThreadId - The target thread ID.
+*
+*/
+void
+RemoveThread (
+    _In_ ULONG ThreadId
+    )
+{
+    k_ThreadMap.erase(ThreadId);
+}
+
+/**
+*
+* @brief        Associates a thread description (SetThreadDescription) with a thread.
+* @param[in]    ProcessId - The owning process ID.
+* @param[in]    ThreadId - The target thread ID.
+* @param[in]    ThreadName - The thread name. Does not need to be NULL-terminated.
+* @param[in]    ThreadNameLength - The length, in characters, of the thread name.
+*
+*/
+void
+SetThreadName (
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId,
+    _In_ const wchar_t* ThreadName,
+    _In_ SIZE_T ThreadNameLength
+    )
+{
+    THREAD_NODE& threadNode = k_ThreadMap[ThreadId];
+
+    threadNode.ProcessId = ProcessId;
+    threadNode.ThreadNameId = InternName(ThreadName,
+                                         ThreadNameLength);
+}
+
+/**
+*
+* @brief        Retrieves the interned image name ID of a running process.
+* @param[in]    ProcessId - The target process ID.
+* @param[in]    TimeStamp - The raw timestamp of the event being named.
+* @return       The image name ID, or UNKNOWN_NAME_ID - including for an
+*               event from before the tracked process started, which was
+*               raised by an earlier process with the same ID.
+*
+*/
+ULONG
+GetProcessNameId (
+    _In_ ULONG ProcessId,
+    _In_ ULONGLONG TimeStamp
+    )
+{
+    auto it = k_ProcessMap.find(ProcessId);
+    if ((it == k_ProcessMap.end()) ||
+        (TimeStamp < it->second.StartTime))
+    {
+        return UNKNOWN_NAME_ID;
+    }
+
+    return it->second.ImageNameId;
+}
+
+/**
+*
+* @brief        Retrieves the interned name ID of a running thread.
+* @param[in]    ThreadId - The target thread ID.
+* @return       The thread name ID, or UNKNOWN_NAME_ID.
+*
+*/
+ULONG
+GetThreadNameId (
+    _In_ ULONG ThreadId
+    )
+{
+    auto it = k_ThreadMap.find(ThreadId);
+    if (it == k_ThreadMap.end())
+    {
+        return UNKNOWN_NAME_ID;
+    }
+
+    return it->second.ThreadNameId;
+}
+
+/**
+*
+* @brief        Tears down the process and thread caches. Called on Vtl1Mon exit.
+*
+*/
+void
+DestroyProcessCache ()
+{
+    wprintf(L"  [>] Processes tracked: %zu\n", k_ProcessMap.size());
+    wprintf(L"  [>] Process IDs reused before their exit was seen: %llu (late exits ignored: %llu)\n", k_ProcessesReused, k_StaleProcessEnds);
+    wprintf(L"  [>] Names interned: %zu (%llu more not, the table was full)\n", k_NameTable.size(), k_NamesDropped);
+
+    k_ProcessMap.clear();
+    k_ThreadMap.clear();
+    k_NameIds.clear();
+    k_NameTable.clear();
+}
\ No newline at end of file
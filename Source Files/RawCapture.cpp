@@ -0,0 +1,504 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/RawCapture.cpp
+*
+* @summary:   Raw (unsymbolized) capture writer. Used for deferred symbolization:
+*             the live tool writes frame addresses and the module table, and the
+*             "symbolize" command resolves them later (on another machine).
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "RawCapture.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "SegmentedOutput.hpp"
+#include "Clock.hpp"
+#include <vector>
+#include <algorithm>
+
+//
+// Capture file state. Only the ETW processing thread writes.
+//
+static SEGMENTED_OUTPUT k_RawCaptureOutput;
+static std::vector<UCHAR> k_RawCaptureBuffer;
+static RAW_CAPTURE_STATISTICS k_RawCaptureStatistics = { 0 };
+
+//
+// Every module record so far. When the capture rotates, each segment
+// starts with the whole module table so it can be symbolized on its own.
+//
+static std::vector<UCHAR> k_RawCaptureModuleRecords;
+
+//
+// Names are written once, the first time an event refers to them.
+//
+static std::vector<bool> k_NamesWritten;
+static std::vector<bool> k_SecureCallNamesWritten;
+
+//
+// The session clock is written once per capture (or segment), before
+// its first event.
+//
+static bool k_RawCaptureClockWritten = false;
+
+/**
+*
+* @brief        Writes the buffered records to disk.
+*
+*/
+static
+void
+FlushRawCaptureBuffer ()
+{
+    if (k_RawCaptureBuffer.empty())
+    {
+        return;
+    }
+
+    if (!WriteSegmentedOutput(&k_RawCaptureOutput,
+                              k_RawCaptureBuffer.data(),
+                              k_RawCaptureBuffer.size()))
+    {
+        wprintf(L"[-] Error! WriteFile failed in FlushRawCaptureBuffer. (GLE: %d)\n", GetLastError());
+        k_RawCaptureStatistics.WriteFailures++;
+    }
+    else
+    {
+        k_RawCaptureStatistics.BytesWritten += k_RawCaptureBuffer.size();
+    }
+
+    k_RawCaptureBuffer.clear();
+}
+
+/**
+*
+* @brief        Reserves space for a record in the write buffer and fills in its header.
+* @param[in]    Type - The record type.
+* @param[in]    PayloadSize - The size of the record, excluding the header and padding.
+* @return       A pointer to the record's payload.
+*
+*/
+static
+UCHAR*
+AppendRawRecord (
+    _In_ RAW_RECORD_TYPE Type,
+    _In_ SIZE_T PayloadSize
+    )
+{
+    RAW_RECORD_HEADER header;
+    SIZE_T recordSize;
+    SIZE_T offset;
+
+    recordSize = (sizeof(RAW_RECORD_HEADER) + PayloadSize);
+    recordSize = ((recordSize + (RAW_RECORD_ALIGNMENT - 1)) & ~static_cast<SIZE_T>(RAW_RECORD_ALIGNMENT - 1));
+
+    if ((k_RawCaptureBuffer.size() + recordSize) > RAW_CAPTURE_BUFFER_SIZE)
+    {
+        FlushRawCaptureBuffer();
+    }
+
+    header.Type = static_cast<uint16_t>(Type);
+    header.Reserved = 0;
+    header.Size = static_cast<uint32_t>(recordSize);
+
+    offset = k_RawCaptureBuffer.size();
+
+    //
+    // Zero-filled, which also takes care of the padding.
+    //
+    k_RawCaptureBuffer.resize(offset + recordSize);
+
+    RtlCopyMemory(&k_RawCaptureBuffer[offset],
+                  &header,
+                  sizeof(header));
+
+    return (&k_RawCaptureBuffer[offset] + sizeof(RAW_RECORD_HEADER));
+}
+
+/**
+*
+* @brief        Writes a name record.
+* @param[in]    Type - RawRecordName or RawRecordSecureCallName.
+* @param[in]    Id - The name ID (or secure call number).
+* @param[in]    Name - The (UTF-8) name.
+*
+*/
+static
+void
+WriteRawCaptureName (
+    _In_ RAW_RECORD_TYPE Type,
+    _In_ ULONG Id,
+    _In_ const char* Name
+    )
+{
+    RAW_NAME_RECORD nameRecord;
+    SIZE_T nameSize;
+    UCHAR* payload;
+
+    nameSize = (strlen(Name) + 1);
+
+    nameRecord.Id = Id;
+    nameRecord.Reserved = 0;
+
+    payload = AppendRawRecord(Type, sizeof(nameRecord) + nameSize);
+
+    RtlCopyMemory(payload, &nameRecord, sizeof(nameRecord));
+    RtlCopyMemory(payload + sizeof(nameRecord), Name, nameSize);
+
+    k_RawCaptureStatistics.NamesWritten++;
+}
+
+/**
+*
+* @brief        Writes a process or thread name the first time it is referenced.
+* @param[in]    NameId - The interned name ID.
+*
+*/
+static
+void
+EnsureRawCaptureName (
+    _In_ ULONG NameId
+    )
+{
+    if (NameId >= k_NamesWritten.size())
+    {
+        k_NamesWritten.resize(NameId + 1, false);
+    }
+
+    if (k_NamesWritten[NameId])
+    {
+        return;
+    }
+
+    k_NamesWritten[NameId] = true;
+
+    WriteRawCaptureName(RawRecordName, NameId, GetInternedName(NameId));
+}
+
+/**
+*
+* @brief        Writes the session clock record.
+*
+*/
+static
+void
+WriteRawCaptureClock ()
+{
+    const SESSION_CLOCK* clock;
+    RAW_CLOCK_RECORD clockRecord;
+
+    clock = GetSessionClock();
+
+    clockRecord.QpcFrequency = clock->QpcFrequency;
+    clockRecord.AnchorTimeStamp = clock->AnchorTimeStamp;
+    clockRecord.AnchorTime = clock->AnchorTime;
+    clockRecord.Uncertainty = clock->Uncertainty;
+
+    RtlCopyMemory(AppendRawRecord(RawRecordClock, sizeof(clockRecord)), &clockRecord, sizeof(clockRecord));
+}
+
+/**
+*
+* @brief        Starts a capture file (or segment): the header, then the module
+*               table so far. Names are written again as events refer to them.
+*
+*/
+static
+void
+BeginRawCaptureSegment ()
+{
+    RAW_CAPTURE_HEADER header;
+
+    header.Magic = RAW_CAPTURE_MAGIC;
+    header.Version = RAW_CAPTURE_VERSION;
+    header.QpcFrequency = GetSessionClock()->QpcFrequency;
+
+    k_RawCaptureBuffer.insert(k_RawCaptureBuffer.end(),
+                              reinterpret_cast<const UCHAR*>(&header),
+                              reinterpret_cast<const UCHAR*>(&header) + sizeof(header));
+
+    k_RawCaptureBuffer.insert(k_RawCaptureBuffer.end(),
+                              k_RawCaptureModuleRecords.begin(),
+                              k_RawCaptureModuleRecords.end());
+
+    k_NamesWritten.assign(k_NamesWritten.size(), false);
+    k_SecureCallNamesWritten.assign(MAXUSHORT + 1, false);
+    k_RawCaptureClockWritten = false;
+}
+
+/**
+*
+* @brief        Rotates the raw capture: what is buffered goes to the current
+*               segment, and the new one starts with its own header.
+* @param[in]    Output - The output.
+*
+*/
+static
+void
+RotateRawCapture (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    FlushRawCaptureBuffer();
+
+    if (RotateSegmentedOutput(Output))
+    {
+        BeginRawCaptureSegment();
+    }
+}
+
+/**
+*
+* @brief        Creates the raw capture file and turns on deferred symbolization.
+*               The header is written once the session clock is set.
+* @param[in]    FilePath - The user-provided path.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+CreateRawCaptureFile (
+    _In_ const wchar_t* FilePath
+    )
+{
+    bool result;
+
+    result = false;
+
+    if (!OpenSegmentedOutput(&k_RawCaptureOutput, FilePath, RotateRawCapture))
+    {
+        goto Exit;
+    }
+
+    k_RawCaptureBuffer.reserve(RAW_CAPTURE_BUFFER_SIZE);
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Starts the first segment. Called once the session clock is set,
+*               so the header has the frequency of the timestamps that follow.
+*
+*/
+void
+StartRawCapture ()
+{
+    if (!IsRawCaptureEnabled())
+    {
+        return;
+    }
+
+    AcquireSegmentedOutput(&k_RawCaptureOutput);
+
+    BeginRawCaptureSegment();
+
+    ReleaseSegmentedOutput(&k_RawCaptureOutput);
+}
+
+/**
+*
+* @brief        Determines if events go to a raw capture instead of the CSV.
+* @return       true if deferred symbolization is on, otherwise false.
+*
+*/
+bool
+IsRawCaptureEnabled ()
+{
+    return IsSegmentedOutputOpen(&k_RawCaptureOutput);
+}
+
+/**
+*
+* @brief        Writes an image load to the module table.
+* @param[in]    ImageBase - The base address of the image.
+* @param[in]    ImageSize - The size of the image.
+* @param[in]    TimeDateStamp - The image's PE TimeDateStamp.
+* @param[in]    ImageChecksum - The image's PE checksum.
+* @param[in]    ProcessId - The process the image was loaded into.
+* @param[in]    ImagePath - The NT path of the image.
+*
+*/
+void
+WriteRawCaptureModule (
+    _In_ ULONG_PTR ImageBase,
+    _In_ ULONG ImageSize,
+    _In_ ULONG TimeDateStamp,
+    _In_ ULONG ImageChecksum,
+    _In_ ULONG ProcessId,
+    _In_ const wchar_t* ImagePath
+    )
+{
+    RAW_MODULE_RECORD moduleRecord;
+    SIZE_T pathSize;
+    UCHAR* payload;
+
+    if (!IsRawCaptureEnabled())
+    {
+        return;
+    }
+
+    AcquireSegmentedOutput(&k_RawCaptureOutput);
+
+    pathSize = ((wcslen(ImagePath) + 1) * sizeof(wchar_t));
+
+    moduleRecord.ImageBase = ImageBase;
+    moduleRecord.ImageSize = ImageSize;
+    moduleRecord.TimeDateStamp = TimeDateStamp;
+    moduleRecord.ImageChecksum = ImageChecksum;
+    moduleRecord.ProcessId = ProcessId;
+
+    payload = AppendRawRecord(RawRecordModule, sizeof(moduleRecord) + pathSize);
+
+    RtlCopyMemory(payload, &moduleRecord, sizeof(moduleRecord));
+    RtlCopyMemory(payload + sizeof(moduleRecord), ImagePath, pathSize);
+
+    if (IsOutputRotationEnabled())
+    {
+        const UCHAR* record;
+        RAW_RECORD_HEADER recordHeader;
+
+        record = (payload - sizeof(RAW_RECORD_HEADER));
+
+        RtlCopyMemory(&recordHeader, record, sizeof(recordHeader));
+
+        k_RawCaptureModuleRecords.insert(k_RawCaptureModuleRecords.end(),
+                                         record,
+                                         record + recordHeader.Size);
+    }
+
+    k_RawCaptureStatistics.ModulesWritten++;
+
+    ReleaseSegmentedOutput(&k_RawCaptureOutput);
+}
+
+/**
+*
+* @brief        Writes a correlated event and its raw frame addresses. This is
+*               the whole per-event cost in deferred mode - no symbols.
+* @param[in]    Vtl1Data - The "primal" VTL 1 enter event data.
+* @param[in]    CallStack - The raw list of stack frame addresses.
+* @param[in]    NumberOfFrames - The number of stack frames.
+*
+*/
+void
+WriteRawCaptureEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    RAW_EVENT_RECORD eventRecord;
+    UCHAR* payload;
+
+    //
+    // The frame count is 16 bits on disk. ETW stacks are far shorter.
+    //
+    NumberOfFrames = (std::min)(NumberOfFrames, static_cast<ULONG>(MAXUSHORT));
+
+    AcquireSegmentedOutput(&k_RawCaptureOutput);
+
+    //
+    // Rotate between events. Each segment is a complete capture.
+    //
+    if (IsSegmentRotationDue(&k_RawCaptureOutput, k_RawCaptureBuffer.size()))
+    {
+        RotateRawCapture(&k_RawCaptureOutput);
+    }
+
+    if ((!k_RawCaptureClockWritten) &&
+        (IsClockValid(GetSessionClock())))
+    {
+        k_RawCaptureClockWritten = true;
+
+        WriteRawCaptureClock();
+    }
+
+    EnsureRawCaptureName(Vtl1Data->ProcessNameId);
+    EnsureRawCaptureName(Vtl1Data->ThreadNameId);
+
+    if (!k_SecureCallNamesWritten[Vtl1Data->SecureCallNumber])
+    {
+        k_SecureCallNamesWritten[Vtl1Data->SecureCallNumber] = true;
+
+        WriteRawCaptureName(RawRecordSecureCallName,
+                            Vtl1Data->SecureCallNumber,
+                            GetSecureCallName(Vtl1Data->SecureCallNumber));
+    }
+
+    eventRecord.TimeStamp = Vtl1Data->Vtl1EnterTime;
+    eventRecord.ProcessId = Vtl1Data->ProcessId;
+    eventRecord.ThreadId = Vtl1Data->ThreadId;
+    eventRecord.ProcessNameId = Vtl1Data->ProcessNameId;
+    eventRecord.ThreadNameId = Vtl1Data->ThreadNameId;
+    eventRecord.SecureCallNumber = Vtl1Data->SecureCallNumber;
+    eventRecord.NumberOfFrames = static_cast<uint16_t>(NumberOfFrames);
+    eventRecord.Reserved = 0;
+
+    payload = AppendRawRecord(RawRecordEvent, sizeof(eventRecord) + (NumberOfFrames * sizeof(uint64_t)));
+
+    RtlCopyMemory(payload, &eventRecord, sizeof(eventRecord));
+
+    //
+    // Frames are always 64 bits on disk.
+    //
+    for (ULONG i = 0; i < NumberOfFrames; i++)
+    {
+        uint64_t frame;
+
+        frame = CallStack[i];
+
+        RtlCopyMemory(payload + sizeof(eventRecord) + (i * sizeof(uint64_t)), &frame, sizeof(frame));
+    }
+
+    NoteSegmentedOutputEvent(&k_RawCaptureOutput, Vtl1Data->Vtl1EnterTime);
+
+    k_RawCaptureStatistics.EventsWritten++;
+    k_RawCaptureStatistics.FramesWritten += NumberOfFrames;
+
+    ReleaseSegmentedOutput(&k_RawCaptureOutput);
+}
+
+/**
+*
+* @brief        Flushes and closes the raw capture file. Called on Vtl1Mon exit,
+*               after the trace has stopped delivering events.
+*
+*/
+void
+CloseRawCaptureFile ()
+{
+    if (!IsRawCaptureEnabled())
+    {
+        return;
+    }
+
+    AcquireSegmentedOutput(&k_RawCaptureOutput);
+
+    FlushRawCaptureBuffer();
+
+    ReleaseSegmentedOutput(&k_RawCaptureOutput);
+
+    CloseSegmentedOutput(&k_RawCaptureOutput);
+
+    wprintf(L"[+] Raw capture statistics:\n");
+    wprintf(L"  [>] Events written: %llu (%llu frames)\n", k_RawCaptureStatistics.EventsWritten, k_RawCaptureStatistics.FramesWritten);
+    wprintf(L"  [>] Modules written: %llu\n", k_RawCaptureStatistics.ModulesWritten);
+    wprintf(L"  [>] Names written: %llu\n", k_RawCaptureStatistics.NamesWritten);
+    wprintf(L"  [>] Bytes written: %llu\n", k_RawCaptureStatistics.BytesWritten);
+    wprintf(L"  [>] Write failures: %llu\n", k_RawCaptureStatistics.WriteFailures);
+
+    k_RawCaptureBuffer.clear();
+    k_RawCaptureBuffer.shrink_to_fit();
+    k_RawCaptureModuleRecords.clear();
+    k_RawCaptureModuleRecords.shrink_to_fit();
+    k_NamesWritten.clear();
+    k_SecureCallNamesWritten.clear();
+}
\ No newline at end of file
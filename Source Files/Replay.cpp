@@ -0,0 +1,313 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Replay.cpp
+*
+* @summary:   Offline trace (ETL) replay implementation. Replays a saved
+*             kernel trace through the same callbacks as the live session
+*             and reports how much time the callbacks take.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Replay.hpp"
+#include "Callback.hpp"
+#include "Helpers.hpp"
+#include "Clock.hpp"
+#include <vector>
+#include <stdio.h>
+
+//
+// A uniform sample of the replayed events' providers and opcodes, for the
+// dispatch benchmark, and the number of events replayed.
+//
+static std::vector<REPLAY_EVENT_KEY> k_ReplayEventKeys;
+static ULONGLONG k_ReplayEvents = 0;
+static ULONGLONG k_ReplaySampleState = 0x9E3779B97F4A7C15ULL;
+
+//
+// Time spent inside EtwEventCallback (QPC ticks).
+//
+static LONGLONG k_ReplayCallbackTicks = 0;
+
+/**
+*
+* @brief        Replay ETW callback. Samples the event key and times the live callback.
+* @param[in]    EventRecord - Associated ETW event record.
+*
+*/
+static
+_Function_class_(PEVENT_RECORD_CALLBACK)
+void
+ReplayEventCallback (
+    _In_ PEVENT_RECORD EventRecord
+    )
+{
+    REPLAY_EVENT_KEY eventKey;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    RtlZeroMemory(&eventKey, sizeof(eventKey));
+
+    eventKey.ProviderId = EventRecord->EventHeader.ProviderId;
+    eventKey.Opcode = EventRecord->EventHeader.EventDescriptor.Opcode;
+
+    k_ReplayEvents++;
+
+    if (k_ReplayEventKeys.size() < REPLAY_DISPATCH_SAMPLE_EVENTS)
+    {
+        k_ReplayEventKeys.push_back(eventKey);
+    }
+    else
+    {
+        ULONGLONG slot;
+
+        //
+        // Keeps each of the events so far with the same probability.
+        //
+        k_ReplaySampleState ^= (k_ReplaySampleState << 13);
+        k_ReplaySampleState ^= (k_ReplaySampleState >> 7);
+        k_ReplaySampleState ^= (k_ReplaySampleState << 17);
+
+        slot = (k_ReplaySampleState % k_ReplayEvents);
+
+        if (slot < REPLAY_DISPATCH_SAMPLE_EVENTS)
+        {
+            k_ReplayEventKeys[static_cast<SIZE_T>(slot)] = eventKey;
+        }
+    }
+
+    NoteSessionClockEvent(static_cast<uint64_t>(EventRecord->EventHeader.TimeStamp.QuadPart));
+
+    QueryPerformanceCounter(&start);
+    EtwEventCallback(EventRecord);
+    QueryPerformanceCounter(&end);
+
+    k_ReplayCallbackTicks += (end.QuadPart - start.QuadPart);
+}
+
+/**
+*
+* @brief        Measures the provider/opcode dispatch cost alone (no handlers run)
+*               over the sample of the events which were replayed.
+* @return       Average dispatch cost, in nanoseconds per event.
+*
+*/
+static
+double
+BenchmarkEventDispatch ()
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    SIZE_T handlersFound;
+    double elapsedNs;
+
+    handlersFound = 0;
+    elapsedNs = 0;
+
+    if (k_ReplayEventKeys.empty())
+    {
+        goto Exit;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    for (ULONG pass = 0; pass < REPLAY_DISPATCH_BENCHMARK_PASSES; pass++)
+    {
+        for (const auto& eventKey : k_ReplayEventKeys)
+        {
+            if (LookupEventHandler(eventKey.ProviderId, eventKey.Opcode) != NULL)
+            {
+                handlersFound++;
+            }
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+
+    elapsedNs = (static_cast<double>(end.QuadPart - start.QuadPart) * 1e9 / frequency.QuadPart);
+    elapsedNs /= (static_cast<double>(k_ReplayEventKeys.size()) * REPLAY_DISPATCH_BENCHMARK_PASSES);
+
+    wprintf(L"  [>] Sampled events with a handler: %zu of %zu\n",
+            (handlersFound / REPLAY_DISPATCH_BENCHMARK_PASSES),
+            k_ReplayEventKeys.size());
+
+Exit:
+    return elapsedNs;
+}
+
+/**
+*
+* @brief        Measures row formatting alone (no symbol lookups, no I/O) with
+*               a typical row: a kernel stack of symbolized frames plus a few
+*               unknown and image-only frames.
+* @return       Format throughput, in MB (of UTF-8 output) per second.
+*
+*/
+static
+double
+BenchmarkRowFormatting ()
+{
+    FORMAT_BUFFER buffer;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONGLONG bytesFormatted;
+    double elapsedSeconds;
+
+    bytesFormatted = 0;
+
+    ResetFormatBuffer(&buffer);
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    for (ULONG row = 0; row < REPLAY_FORMAT_BENCHMARK_ROWS; row++)
+    {
+        ResetFormatBuffer(&buffer);
+
+        FormatVtl1CsvFields(&buffer,
+                            (0x1D9A4C2B7E3F000ULL + row),
+                            "SecureCallCreateSecureImage",
+                            13,
+                            4,
+                            "System",
+                            (0x1F04 + row),
+                            "MemoryCompressionWorker");
+
+        for (ULONG frame = 0; frame < REPLAY_FORMAT_BENCHMARK_FRAMES; frame++)
+        {
+            if ((frame % 8) == 7)
+            {
+                FormatUnknownFrame(&buffer, (0xFFFFF80712340000ULL + (frame * 0x1234)), FORMAT_FRAME_SEPARATOR);
+            }
+            else if ((frame % 8) == 6)
+            {
+                FormatImageFrame(&buffer, "\\SystemRoot\\System32\\drivers\\storport.sys", (0x1A2B0 + frame), FORMAT_FRAME_SEPARATOR);
+            }
+            else
+            {
+                FormatSymbolFrame(&buffer, "\\SystemRoot\\system32\\ntoskrnl.exe", "VslpEnterIumSecureMode", (0x1C0 + frame), FORMAT_FRAME_SEPARATOR);
+            }
+        }
+
+        FinishVtl1CsvLine(&buffer);
+
+        bytesFormatted += buffer.Length;
+    }
+
+    QueryPerformanceCounter(&end);
+
+    elapsedSeconds = (static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart);
+
+    return ((elapsedSeconds != 0) ? ((bytesFormatted / (1024.0 * 1024.0)) / elapsedSeconds) : 0.0);
+}
+
+/**
+*
+* @brief        Replays a saved (ETL) kernel trace through EtwEventCallback.
+* @param[in]    TraceFilePath - Path to the ETL file.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+ReplayTraceFile (
+    _In_ const wchar_t* TraceFilePath
+    )
+{
+    bool result;
+    EVENT_TRACE_LOGFILEW logFile;
+    PROCESSTRACE_HANDLE traceHandle;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONG error;
+    double totalMs;
+    double callbackNs;
+
+    result = false;
+    traceHandle = INVALID_PROCESSTRACE_HANDLE;
+    totalMs = 0;
+    callbackNs = 0;
+
+    RtlZeroMemory(&logFile, sizeof(logFile));
+
+    //
+    // Same mode as the live session, minus real-time.
+    //
+    logFile.ProcessTraceMode = (PROCESS_TRACE_MODE_EVENT_RECORD |
+                                PROCESS_TRACE_MODE_RAW_TIMESTAMP);
+
+    k_ReplayEventKeys.reserve(REPLAY_DISPATCH_SAMPLE_EVENTS);
+    k_ReplayEvents = 0;
+
+    logFile.LogFileName = const_cast<LPWSTR>(TraceFilePath);
+    logFile.EventRecordCallback = ReplayEventCallback;
+
+    traceHandle = OpenTraceW(&logFile);
+    if (traceHandle == INVALID_PROCESSTRACE_HANDLE)
+    {
+        wprintf(L"[-] Error! OpenTraceW failed in ReplayTraceFile. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    //
+    // The trace's clock, not ours: it may be from another machine.
+    //
+    SetSessionClockFromTrace(static_cast<uint64_t>(logFile.LogfileHeader.PerfFreq.QuadPart),
+                             static_cast<uint64_t>(logFile.LogfileHeader.StartTime.QuadPart));
+
+    ApplySessionClock();
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    //
+    // Unlike the live session, this does not return until every
+    // event in the file has been delivered.
+    //
+    error = ProcessTrace(&traceHandle,
+                         1,
+                         NULL,
+                         NULL);
+    if (error != ERROR_SUCCESS)
+    {
+        wprintf(L"[-] Error! ProcessTrace failed in ReplayTraceFile. (GLE: %X)\n", error);
+        goto Exit;
+    }
+
+    QueryPerformanceCounter(&end);
+
+    totalMs = (static_cast<double>(end.QuadPart - start.QuadPart) * 1e3 / frequency.QuadPart);
+
+    if (k_ReplayEvents != 0)
+    {
+        callbackNs = (static_cast<double>(k_ReplayCallbackTicks) * 1e9 / frequency.QuadPart);
+        callbackNs /= static_cast<double>(k_ReplayEvents);
+    }
+
+    wprintf(L"[+] Replay statistics:\n");
+    wprintf(L"  [>] Events replayed: %llu\n", k_ReplayEvents);
+    wprintf(L"  [>] Replay time: %.2f ms\n", totalMs);
+    wprintf(L"  [>] Callback cost: %.1f ns/event\n", callbackNs);
+    wprintf(L"  [>] Dispatch cost: %.2f ns/event\n", BenchmarkEventDispatch());
+    wprintf(L"  [>] Format throughput: %.1f MB/s\n", BenchmarkRowFormatting());
+
+    result = true;
+
+Exit:
+    if (traceHandle != INVALID_PROCESSTRACE_HANDLE)
+    {
+        CloseTrace(traceHandle);
+    }
+
+    k_ReplayEventKeys.clear();
+    k_ReplayEventKeys.shrink_to_fit();
+
+    return result;
+}
\ No newline at end of file
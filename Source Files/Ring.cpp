@@ -0,0 +1,1241 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Ring.cpp
+*
+* @summary:   Shared memory export ring. Correlated events are written as
+*             fixed size records straight into a named shared memory region,
+*             where other tools on the host read them as they arrive (see
+*             RingClient.cpp). The producer never waits on a consumer.
+*
+*             The producer, the raw capture replay driver and the tail
+*             consumer build on Windows and Linux, so consumers can be tested
+*             and benchmarked without a live session. The live export is
+*             Windows-only.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Ring.hpp"
+#include "RingClient.hpp"
+#include "RawCapture.hpp"
+#include "Lz4.hpp"
+#include <stdio.h>
+#include <wchar.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+//
+// Empty polls a tail makes before it starts sleeping between polls.
+//
+#define RING_TAIL_SPIN_POLLS 100000
+
+//
+// How often a tail started before its ring looks for it.
+//
+#define RING_TAIL_OPEN_POLL_MS 20
+
+//
+// How often an idle tail checks that the producer is still running (one
+// which dies never closes its ring).
+//
+#define RING_TAIL_LIVENESS_MS 1000
+
+//
+// A paced replay only sleeps once it is this far ahead of the capture.
+//
+#define RING_REPLAY_PACE_SLACK_NS 1000000ULL
+
+//
+// A name from the capture being replayed (it stays mapped), and where it
+// was last added to the ring.
+//
+typedef struct _RING_REPLAY_NAME
+{
+    const char* Name;
+    size_t Length;
+    RING_STRING_REF Ref;
+} RING_REPLAY_NAME, *PRING_REPLAY_NAME;
+
+/**
+*
+* @brief        Creates a ring and maps it for writing.
+* @param[out]   Producer - The producer.
+* @param[in]    Name - The ring's name.
+* @param[in]    RecordCount - Records in the ring (rounded up to a power of two).
+* @param[in]    StringsSize - The string table's size.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+CreateRingProducer (
+    _Out_ PRING_PRODUCER Producer,
+    _In_ const PATH_CHAR* Name,
+    _In_ uint32_t RecordCount,
+    _In_ uint32_t StringsSize
+    )
+{
+    bool result;
+    uint64_t recordCount;
+    uint64_t length;
+    PRING_HEADER header;
+
+    result = false;
+
+    memset(Producer, 0, sizeof(*Producer));
+
+    recordCount = RING_MIN_RECORDS;
+
+    while ((recordCount < RecordCount) &&
+           (recordCount < RING_MAX_RECORDS))
+    {
+        recordCount <<= 1;
+    }
+
+    length = (RING_HEADER_REGION_SIZE + (recordCount * sizeof(RING_RECORD)) + StringsSize);
+
+    if (!CreateSharedMapping(Name, static_cast<size_t>(length), &Producer->Mapping))
+    {
+        goto Exit;
+    }
+
+    header = reinterpret_cast<PRING_HEADER>(Producer->Mapping.Data);
+
+    header->Version = RING_VERSION;
+    header->HeaderSize = sizeof(RING_HEADER);
+    header->RecordSize = sizeof(RING_RECORD);
+    header->MaxFrames = RING_MAX_FRAMES;
+#ifdef _WIN32
+    header->ProducerId = GetCurrentProcessId();
+#else
+    header->ProducerId = static_cast<uint32_t>(getpid());
+#endif
+    header->RecordCount = recordCount;
+    header->RecordsOffset = RING_HEADER_REGION_SIZE;
+    header->StringsOffset = (RING_HEADER_REGION_SIZE + (recordCount * sizeof(RING_RECORD)));
+    header->StringsSize = StringsSize;
+
+    //
+    // Offset 0 is the empty string.
+    //
+    header->StringsUsed.store(1, std::memory_order_relaxed);
+
+    //
+    // Consumers which open the ring before the header is complete see no
+    // magic and give up.
+    //
+    std::atomic_thread_fence(std::memory_order_release);
+
+    header->Magic = RING_MAGIC;
+
+    Producer->Header = header;
+    Producer->Records = (Producer->Mapping.Data + header->RecordsOffset);
+    Producer->Strings = reinterpret_cast<char*>(Producer->Mapping.Data + header->StringsOffset);
+    Producer->Mask = (recordCount - 1);
+    Producer->HalfSize = (StringsSize / 2);
+    Producer->StringsUsed = 1;
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Stores the session clock in the ring. Must be called before the
+*               first record is published, if at all.
+* @param[in]    Producer - The producer.
+* @param[in]    Clock - The clock.
+*
+*/
+void
+SetRingClock (
+    _Inout_ PRING_PRODUCER Producer,
+    _In_ const SESSION_CLOCK* Clock
+    )
+{
+    Producer->Header->QpcFrequency = Clock->QpcFrequency;
+    Producer->Header->AnchorTimeStamp = Clock->AnchorTimeStamp;
+    Producer->Header->AnchorTime = Clock->AnchorTime;
+    Producer->Header->Uncertainty = Clock->Uncertainty;
+}
+
+/**
+*
+* @brief        Appends a string to the current half of the ring's string table.
+* @param[in]    Producer - The producer.
+* @param[in]    String - The UTF-8 string (need not be terminated).
+* @param[in]    Length - The string's length in bytes.
+* @return       The string's offset, or 0 if it is empty or does not fit. If
+*               the half is full, StringsFull is set and the caller starts
+*               a new generation before trying again.
+*
+*/
+uint32_t
+AddRingString (
+    _Inout_ PRING_PRODUCER Producer,
+    _In_ const char* String,
+    _In_ size_t Length
+    )
+{
+    uint64_t offset;
+    uint64_t end;
+
+    if (Length == 0)
+    {
+        return 0;
+    }
+
+    //
+    // The half's last byte is never written, so it terminates anything a
+    // consumer reads from a corrupt or recycled offset.
+    //
+    end = ((((Producer->StringGeneration & 1) + 1) * Producer->HalfSize) - 1);
+
+    if ((Length + 2) > Producer->HalfSize)
+    {
+        Producer->StringsDropped++;
+        return 0;
+    }
+
+    if ((Producer->StringsUsed + Length + 1) > end)
+    {
+        Producer->StringsFull = true;
+        return 0;
+    }
+
+    offset = Producer->StringsUsed;
+
+    memcpy(Producer->Strings + offset, String, Length);
+
+    Producer->Strings[offset + Length] = '\0';
+    Producer->StringsUsed += (Length + 1);
+    Producer->StringBytes += (Length + 1);
+
+    Producer->Header->StringsUsed.store(Producer->StringsUsed, std::memory_order_release);
+
+    return static_cast<uint32_t>(offset);
+}
+
+/**
+*
+* @brief        Gets the offset of a string in the current generation, adding
+*               it if it was last added in an older one.
+* @param[in]    Producer - The producer.
+* @param[in]    Ref - Where the string was last added.
+* @param[in]    String - The UTF-8 string (need not be terminated).
+* @param[in]    Length - The string's length in bytes.
+* @return       The string's offset (see AddRingString).
+*
+*/
+uint32_t
+GetRingStringRef (
+    _Inout_ PRING_PRODUCER Producer,
+    _Inout_ PRING_STRING_REF Ref,
+    _In_ const char* String,
+    _In_ size_t Length
+    )
+{
+    if ((Ref->Offset == 0) ||
+        (Ref->Generation != Producer->StringGeneration))
+    {
+        Ref->Offset = AddRingString(Producer, String, Length);
+        Ref->Generation = Producer->StringGeneration;
+    }
+
+    return Ref->Offset;
+}
+
+/**
+*
+* @brief        Starts a new string generation in the other half of the table,
+*               recycling the strings of the generation before last.
+* @param[in]    Producer - The producer.
+*
+*/
+void
+StartRingStringGeneration (
+    _Inout_ PRING_PRODUCER Producer
+    )
+{
+    Producer->StringGeneration++;
+    Producer->StringGenerations++;
+    Producer->StringsFull = false;
+    Producer->StringsUsed = (((Producer->StringGeneration & 1) * Producer->HalfSize) + 1);
+
+    //
+    // Consumers see the new generation before any string it overwrites
+    // changes (the same as a record's Sequence).
+    //
+    Producer->Header->StringGeneration.store(Producer->StringGeneration, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+/**
+*
+* @brief        Claims the next record's slot. The caller fills in everything
+*               but Sequence and then commits it.
+* @param[in]    Producer - The producer.
+* @return       The slot.
+*
+*/
+PRING_RECORD
+BeginRingRecord (
+    _Inout_ PRING_PRODUCER Producer
+    )
+{
+    PRING_RECORD record;
+
+    record = reinterpret_cast<PRING_RECORD>(Producer->Records + ((Producer->Sequence & Producer->Mask) * sizeof(RING_RECORD)));
+
+    //
+    // Consumers still reading the record this one replaces see the zero
+    // before any of the new contents.
+    //
+    record->Sequence.store(0, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    return record;
+}
+
+/**
+*
+* @brief        Publishes a record claimed with BeginRingRecord.
+* @param[in]    Producer - The producer.
+* @param[in]    Record - The record.
+*
+*/
+void
+CommitRingRecord (
+    _Inout_ PRING_PRODUCER Producer,
+    _Inout_ PRING_RECORD Record
+    )
+{
+    Record->Sequence.store((Producer->Sequence + 1), std::memory_order_release);
+
+    Producer->Sequence++;
+
+    Producer->Header->WriteSequence.store(Producer->Sequence, std::memory_order_release);
+}
+
+/**
+*
+* @brief        Marks a ring closed (consumers drain it and stop) and unmaps it.
+* @param[in]    Producer - The producer.
+*
+*/
+void
+CloseRingProducer (
+    _Inout_ PRING_PRODUCER Producer
+    )
+{
+    if (Producer->Header != NULL)
+    {
+        Producer->Header->Closed.store(1, std::memory_order_release);
+    }
+
+    CloseSharedMapping(&Producer->Mapping);
+
+    memset(Producer, 0, sizeof(*Producer));
+}
+
+/**
+*
+* @brief        Gets the ring offset of a replayed capture's name.
+* @param[in]    Producer - The producer.
+* @param[in]    Names - The capture's names, by ID.
+* @param[in]    Id - The name's ID.
+* @return       The offset (0 if the capture has no such name).
+*
+*/
+static
+uint32_t
+GetReplayRingName (
+    _Inout_ PRING_PRODUCER Producer,
+    _Inout_ std::vector<RING_REPLAY_NAME>& Names,
+    _In_ uint32_t Id
+    )
+{
+    if ((Id >= Names.size()) ||
+        (Names[Id].Name == NULL))
+    {
+        return 0;
+    }
+
+    return GetRingStringRef(Producer, &Names[Id].Ref, Names[Id].Name, Names[Id].Length);
+}
+
+/**
+*
+* @brief        Replays a raw capture's events into a ring, as fast as
+*               consumers can be fed or at the pace they were captured.
+* @param[in]    CapturePath - The raw capture (optionally LZ4 compressed).
+* @param[in]    Name - The ring's name.
+* @param[in]    RecordCount - Records in the ring.
+* @param[in]    Loops - How many times to replay the capture.
+* @param[in]    Paced - Whether to keep to the capture's timing.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+ReplayRawCaptureToRing (
+    _In_ const PATH_CHAR* CapturePath,
+    _In_ const PATH_CHAR* Name,
+    _In_ uint32_t RecordCount,
+    _In_ uint32_t Loops,
+    _In_ bool Paced
+    )
+{
+    bool result;
+    MAPPED_FILE capture;
+    std::vector<uint8_t> decompressedCapture;
+    const uint8_t* data;
+    size_t length;
+    RAW_CAPTURE_HEADER captureHeader;
+    RING_PRODUCER producer;
+    std::vector<RING_REPLAY_NAME> names;
+    std::vector<RING_REPLAY_NAME> secureCallNames;
+    uint64_t events;
+    uint64_t startTime;
+    uint64_t elapsed;
+
+    result = false;
+    events = 0;
+
+    memset(&producer, 0, sizeof(producer));
+
+    if (!MapFileReadOnly(CapturePath, &capture))
+    {
+        wprintf(L"[-] Error! Unable to open %s in ReplayRawCaptureToRing.\n", CapturePath);
+        goto Exit;
+    }
+
+    data = capture.Data;
+    length = capture.Length;
+
+    if (IsLz4Frame(capture.Data, capture.Length))
+    {
+        bool complete;
+
+        if (!Lz4DecompressFrame(capture.Data,
+                                capture.Length,
+                                decompressedCapture,
+                                &complete))
+        {
+            wprintf(L"[-] Error! The compressed capture is corrupt.\n");
+            goto Exit;
+        }
+
+        data = decompressedCapture.data();
+        length = decompressedCapture.size();
+    }
+
+    if (length < sizeof(captureHeader))
+    {
+        wprintf(L"[-] Error! The capture is truncated.\n");
+        goto Exit;
+    }
+
+    memcpy(&captureHeader, data, sizeof(captureHeader));
+
+    if ((captureHeader.Magic != RAW_CAPTURE_MAGIC) ||
+        ((captureHeader.Version != RAW_CAPTURE_VERSION) &&
+         (captureHeader.Version != RAW_CAPTURE_VERSION_UTF16_NAMES)))
+    {
+        wprintf(L"[-] Error! Not a Vtl1Mon raw capture (or an unsupported version).\n");
+        goto Exit;
+    }
+
+    if (!CreateRingProducer(&producer, Name, RecordCount, RING_DEFAULT_STRINGS_SIZE))
+    {
+        goto Exit;
+    }
+
+    secureCallNames.resize(0x10000);
+
+    wprintf(L"[+] Replaying %s into ring %s (%llu records, %u time(s)%ls)\n",
+            CapturePath,
+            Name,
+            producer.Header->RecordCount,
+            Loops,
+            (Paced ? L", paced" : L""));
+
+    startTime = GetMonotonicNanoseconds();
+
+    for (uint32_t loop = 0; loop < Loops; loop++)
+    {
+        size_t offset;
+        uint64_t loopStartTime;
+        uint64_t firstTimeStamp;
+
+        offset = sizeof(captureHeader);
+        loopStartTime = GetMonotonicNanoseconds();
+        firstTimeStamp = 0;
+
+        while ((offset + sizeof(RAW_RECORD_HEADER)) <= length)
+        {
+            RAW_RECORD_HEADER recordHeader;
+            const uint8_t* payload;
+            size_t payloadSize;
+
+            memcpy(&recordHeader, data + offset, sizeof(recordHeader));
+
+            if ((recordHeader.Size < sizeof(RAW_RECORD_HEADER)) ||
+                ((recordHeader.Size % RAW_RECORD_ALIGNMENT) != 0) ||
+                (recordHeader.Size > (length - offset)))
+            {
+                if (loop == 0)
+                {
+                    wprintf(L"[-] Warning! The capture is corrupt or truncated at offset %zu.\n", offset);
+                }
+
+                break;
+            }
+
+            payload = (data + offset + sizeof(RAW_RECORD_HEADER));
+            payloadSize = (recordHeader.Size - sizeof(RAW_RECORD_HEADER));
+
+            offset += recordHeader.Size;
+
+            if (recordHeader.Type == RawRecordEvent)
+            {
+                RAW_EVENT_RECORD eventRecord;
+                PRING_RECORD record;
+                uint32_t numberOfFrames;
+                uint32_t processName;
+                uint32_t threadName;
+                uint32_t secureCallName;
+
+                if (payloadSize < sizeof(eventRecord))
+                {
+                    continue;
+                }
+
+                memcpy(&eventRecord, payload, sizeof(eventRecord));
+
+                if ((sizeof(eventRecord) + (static_cast<size_t>(eventRecord.NumberOfFrames) * sizeof(uint64_t))) > payloadSize)
+                {
+                    continue;
+                }
+
+                if ((Paced) &&
+                    (captureHeader.QpcFrequency != 0))
+                {
+                    uint64_t target;
+                    uint64_t now;
+
+                    if (firstTimeStamp == 0)
+                    {
+                        firstTimeStamp = eventRecord.TimeStamp;
+                    }
+
+                    target = (loopStartTime +
+                              static_cast<uint64_t>((static_cast<double>(eventRecord.TimeStamp - firstTimeStamp) * 1000000000.0) /
+                                                    static_cast<double>(captureHeader.QpcFrequency)));
+
+                    now = GetMonotonicNanoseconds();
+
+                    if (target > (now + RING_REPLAY_PACE_SLACK_NS))
+                    {
+                        SleepMilliseconds(static_cast<uint32_t>((target - now) / 1000000ULL));
+                    }
+                }
+
+                numberOfFrames = (eventRecord.NumberOfFrames < RING_MAX_FRAMES) ? eventRecord.NumberOfFrames : RING_MAX_FRAMES;
+
+                if (numberOfFrames < eventRecord.NumberOfFrames)
+                {
+                    producer.TruncatedStacks++;
+                }
+
+                //
+                // A record's strings all come from one generation. If the
+                // half fills part way through, start the next one and add
+                // them all again.
+                //
+                for (uint32_t attempt = 0; attempt < 2; attempt++)
+                {
+                    processName = GetReplayRingName(&producer, names, eventRecord.ProcessNameId);
+                    threadName = GetReplayRingName(&producer, names, eventRecord.ThreadNameId);
+                    secureCallName = GetReplayRingName(&producer, secureCallNames, eventRecord.SecureCallNumber);
+
+                    if (!producer.StringsFull)
+                    {
+                        break;
+                    }
+
+                    StartRingStringGeneration(&producer);
+                }
+
+                record = BeginRingRecord(&producer);
+
+                record->TimeStamp = eventRecord.TimeStamp;
+                record->ProcessId = eventRecord.ProcessId;
+                record->ThreadId = eventRecord.ThreadId;
+                record->ProcessName = processName;
+                record->ThreadName = threadName;
+                record->SecureCallName = secureCallName;
+                record->SecureCallNumber = eventRecord.SecureCallNumber;
+                record->NumberOfFrames = static_cast<uint16_t>(numberOfFrames);
+                record->TotalFrames = eventRecord.NumberOfFrames;
+                record->Reserved = 0;
+                record->StringGeneration = producer.StringGeneration;
+
+                //
+                // Raw captures are not symbolized, so frames have no names.
+                //
+                memcpy(record->Frames, payload + sizeof(eventRecord), numberOfFrames * sizeof(uint64_t));
+                memset(record->FrameNames, 0, numberOfFrames * sizeof(uint32_t));
+
+                CommitRingRecord(&producer, record);
+
+                events++;
+            }
+            else if (((recordHeader.Type == RawRecordName) ||
+                      (recordHeader.Type == RawRecordSecureCallName)) &&
+                     (captureHeader.Version == RAW_CAPTURE_VERSION) &&
+                     (payloadSize > sizeof(RAW_NAME_RECORD)))
+            {
+                RAW_NAME_RECORD nameRecord;
+                std::vector<RING_REPLAY_NAME>* offsets;
+
+                memcpy(&nameRecord, payload, sizeof(nameRecord));
+
+                offsets = ((recordHeader.Type == RawRecordName) ? &names : &secureCallNames);
+
+                if ((nameRecord.Id > RAW_CAPTURE_MAX_NAME_ID) ||
+                    ((recordHeader.Type == RawRecordSecureCallName) &&
+                     (nameRecord.Id >= secureCallNames.size())))
+                {
+                    continue;
+                }
+
+                if (nameRecord.Id >= offsets->size())
+                {
+                    offsets->resize(nameRecord.Id + 1);
+                }
+
+                //
+                // Names are added to the ring when an event first needs them
+                // (in each string generation).
+                //
+                (*offsets)[nameRecord.Id].Name = reinterpret_cast<const char*>(payload + sizeof(nameRecord));
+                (*offsets)[nameRecord.Id].Length = strnlen((*offsets)[nameRecord.Id].Name, payloadSize - sizeof(nameRecord));
+                (*offsets)[nameRecord.Id].Ref.Offset = 0;
+            }
+            else if ((recordHeader.Type == RawRecordClock) &&
+                     (producer.Sequence == 0) &&
+                     (payloadSize >= sizeof(RAW_CLOCK_RECORD)))
+            {
+                RAW_CLOCK_RECORD clockRecord;
+                SESSION_CLOCK clock;
+
+                memcpy(&clockRecord, payload, sizeof(clockRecord));
+
+                clock.QpcFrequency = clockRecord.QpcFrequency;
+                clock.AnchorTimeStamp = clockRecord.AnchorTimeStamp;
+                clock.AnchorTime = clockRecord.AnchorTime;
+                clock.Uncertainty = clockRecord.Uncertainty;
+
+                SetRingClock(&producer, &clock);
+            }
+        }
+    }
+
+    elapsed = (GetMonotonicNanoseconds() - startTime);
+
+    wprintf(L"[+] Ring replay statistics:\n");
+    wprintf(L"  [>] Records published: %llu\n", events);
+    wprintf(L"  [>] Time: %.3f s\n", (static_cast<double>(elapsed) / 1000000000.0));
+
+    if ((events != 0) &&
+        (elapsed != 0))
+    {
+        wprintf(L"  [>] Rate: %.0f records/s (%.1f ns per record)\n",
+                ((static_cast<double>(events) * 1000000000.0) / static_cast<double>(elapsed)),
+                (static_cast<double>(elapsed) / static_cast<double>(events)));
+    }
+
+    wprintf(L"  [>] String table: %llu bytes in %llu generation(s) (%llu names too long to fit)\n",
+            producer.StringBytes,
+            (producer.StringGenerations + 1),
+            producer.StringsDropped);
+    wprintf(L"  [>] Truncated stacks: %llu\n", producer.TruncatedStacks);
+
+    result = true;
+
+Exit:
+    CloseRingProducer(&producer);
+
+    UnmapMappedFile(&capture);
+
+    return result;
+}
+
+/**
+*
+* @brief        Prints one record, like a CSV row (frames are names where the
+*               producer had them, otherwise addresses).
+* @param[in]    Reader - The reader.
+* @param[in]    Record - The record.
+*
+*/
+static
+void
+PrintRingRecord (
+    _In_ const RING_READER* Reader,
+    _In_ const RING_RECORD* Record
+    )
+{
+    wprintf(L"%llu," PRINTF_NARROW_STRING L",%u,%u," PRINTF_NARROW_STRING L",%u," PRINTF_NARROW_STRING,
+            Record->TimeStamp,
+            GetRingString(Reader, Record, Record->SecureCallName),
+            Record->SecureCallNumber,
+            Record->ProcessId,
+            GetRingString(Reader, Record, Record->ProcessName),
+            Record->ThreadId,
+            GetRingString(Reader, Record, Record->ThreadName));
+
+    for (uint32_t i = 0; i < Record->NumberOfFrames; i++)
+    {
+        if (Record->FrameNames[i] != 0)
+        {
+            wprintf(L"," PRINTF_NARROW_STRING, GetRingString(Reader, Record, Record->FrameNames[i]));
+        }
+        else
+        {
+            wprintf(L",0x%llx", Record->Frames[i]);
+        }
+    }
+
+    wprintf(L"\n");
+}
+
+/**
+*
+* @brief        Follows a ring until its producer stops (or dies), and reports
+*               how fast records arrived and how many were lost.
+* @param[in]    Name - The ring's name.
+* @param[in]    Print - Whether to print every record.
+* @param[in]    WaitSeconds - How long to wait for the ring to be created, if
+*               it does not exist yet (0 to not wait).
+* @return       true on success, otherwise false (including if the ring never
+*               appeared).
+*
+*/
+bool
+TailRing (
+    _In_ const PATH_CHAR* Name,
+    _In_ bool Print,
+    _In_ uint32_t WaitSeconds
+    )
+{
+    bool result;
+    RING_READER reader;
+    RING_RECORD record;
+    RING_READ_STATUS status;
+    uint64_t firstTime;
+    uint64_t lastTime;
+    uint64_t emptyPolls;
+    uint64_t deadline;
+    uint64_t nextLivenessCheck;
+    bool waited;
+
+    result = false;
+    firstTime = 0;
+    lastTime = 0;
+    emptyPolls = 0;
+    deadline = (GetMonotonicNanoseconds() + (static_cast<uint64_t>(WaitSeconds) * 1000000000ULL));
+
+    //
+    // The tail can be started first. Wait for the producer to create the
+    // ring and finish its header - but not forever, since a ring which
+    // came and went between polls (or whose producer has already exited)
+    // is never coming back.
+    //
+    for (waited = false; ; waited = true)
+    {
+        SHARED_MAPPING probe;
+        uint32_t magic;
+
+        if (OpenSharedMapping(Name, &probe))
+        {
+            magic = reinterpret_cast<const volatile uint32_t*>(probe.Data)[0];
+
+            CloseSharedMapping(&probe);
+
+            if (magic != 0)
+            {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                break;
+            }
+        }
+
+        if (GetMonotonicNanoseconds() >= deadline)
+        {
+            wprintf(L"[-] Error! Ring %s does not exist (waited %u seconds).\n", Name, WaitSeconds);
+            goto Exit;
+        }
+
+        if (!waited)
+        {
+            wprintf(L"[+] Waiting up to %u seconds for ring %s...\n", WaitSeconds, Name);
+        }
+
+        SleepMilliseconds(RING_TAIL_OPEN_POLL_MS);
+    }
+
+    if (!OpenRingReader(&reader, Name))
+    {
+        goto Exit;
+    }
+
+    //
+    // A tail which was waiting wants the stream from its start.
+    //
+    if (waited)
+    {
+        SeekRingReaderToOldest(&reader);
+    }
+
+    wprintf(L"[+] Following ring %s (%llu records, producer %u) until the producer stops.\n",
+            Name,
+            reader.Header->RecordCount,
+            reader.Header->ProducerId);
+
+    nextLivenessCheck = 0;
+
+    for (;;)
+    {
+        status = ReadRingRecord(&reader, &record);
+
+        if (status == RingReadRecord)
+        {
+            if (firstTime == 0)
+            {
+                firstTime = GetMonotonicNanoseconds();
+            }
+
+            if (Print)
+            {
+                PrintRingRecord(&reader, &record);
+            }
+
+            emptyPolls = 0;
+            continue;
+        }
+
+        if (status == RingReadClosed)
+        {
+            break;
+        }
+
+        //
+        // Poll flat out while records are coming. Once the ring has been
+        // quiet for a while, stop burning the core.
+        //
+        if (emptyPolls == 0)
+        {
+            lastTime = GetMonotonicNanoseconds();
+        }
+
+        if (++emptyPolls > RING_TAIL_SPIN_POLLS)
+        {
+            SleepMilliseconds(1);
+
+            //
+            // Closed is never set if the producer died, so an idle ring's
+            // producer is checked now and then.
+            //
+            if (GetMonotonicNanoseconds() >= nextLivenessCheck)
+            {
+                if (!IsProcessRunning(reader.Header->ProducerId))
+                {
+                    wprintf(L"[-] Warning! The producer of ring %s (%u) exited without closing it.\n",
+                            Name,
+                            reader.Header->ProducerId);
+                    break;
+                }
+
+                nextLivenessCheck = (GetMonotonicNanoseconds() + (RING_TAIL_LIVENESS_MS * 1000000ULL));
+            }
+        }
+    }
+
+    if ((lastTime < firstTime) ||
+        (emptyPolls == 0))
+    {
+        lastTime = GetMonotonicNanoseconds();
+    }
+
+    wprintf(L"[+] Ring tail statistics:\n");
+    wprintf(L"  [>] Records read: %llu\n", reader.Read);
+    wprintf(L"  [>] Records lost (overwritten before they were read): %llu\n", reader.Lost);
+
+    if ((reader.Read != 0) &&
+        (lastTime > firstTime))
+    {
+        wprintf(L"  [>] Rate: %.0f records/s\n",
+                ((static_cast<double>(reader.Read) * 1000000000.0) / static_cast<double>(lastTime - firstTime)));
+    }
+
+    CloseRingReader(&reader);
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+#ifdef _WIN32
+#include "Helpers.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Format.hpp"
+#include <algorithm>
+
+//
+// A frame's name in the ring: user-mode frames are per process (0 for
+// kernel frames). LastUse picks the victim of a slot pair.
+//
+typedef struct _RING_FRAME_NAME
+{
+    ULONG_PTR Address;
+    ULONG ProcessId;
+    RING_STRING_REF Ref;
+    uint64_t LastUse;
+} RING_FRAME_NAME, *PRING_FRAME_NAME;
+
+//
+// The live export. Everything runs on the ETW processing thread.
+//
+static RING_PRODUCER k_ExportRing = { 0 };
+static bool k_ExportRingEnabled = false;
+static bool k_ExportRingClockSet = false;
+
+//
+// Where names were last added to the ring: by interned name ID, by secure
+// call number, and (in fixed memory) by frame.
+//
+static std::vector<RING_STRING_REF> k_ExportRingNames;
+static std::vector<RING_STRING_REF> k_ExportRingSecureCallNames;
+static std::vector<RING_FRAME_NAME> k_ExportRingFrameNames;
+static FORMAT_BUFFER k_ExportRingFrameName;
+
+//
+// Frame name lookups, those which had to symbolize the frame, and those
+// which fell back to no name.
+//
+static uint64_t k_ExportRingFrameLookups = 0;
+static uint64_t k_ExportRingFrameMisses = 0;
+static uint64_t k_ExportRingUnnamedFrames = 0;
+
+/**
+*
+* @brief        Creates the export ring. Called before tracing starts.
+* @param[in]    Name - The ring's name.
+* @param[in]    RecordCount - Records in the ring.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+SetExportRing (
+    _In_ const wchar_t* Name,
+    _In_ ULONG RecordCount
+    )
+{
+    bool result;
+
+    result = false;
+
+    if (!CreateRingProducer(&k_ExportRing,
+                            Name,
+                            RecordCount,
+                            RING_DEFAULT_STRINGS_SIZE))
+    {
+        goto Exit;
+    }
+
+    k_ExportRingSecureCallNames.resize(0x10000);
+    k_ExportRingFrameNames.resize(RING_FRAME_CACHE_SLOTS);
+
+    k_ExportRingEnabled = true;
+
+    wprintf(L"[+] Exporting events to shared memory ring %s (%llu records).\n",
+            Name,
+            k_ExportRing.Header->RecordCount);
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Determines if the export ring is enabled.
+* @return       true if it is, otherwise false.
+*
+*/
+bool
+IsExportRingEnabled ()
+{
+    return k_ExportRingEnabled;
+}
+
+/**
+*
+* @brief        Gets the string table offset of an interned name, adding it
+*               the first time in each string generation.
+* @param[in]    NameId - The interned name ID.
+* @return       The offset.
+*
+*/
+static
+uint32_t
+GetExportRingName (
+    _In_ ULONG NameId
+    )
+{
+    const char* name;
+
+    if (NameId >= k_ExportRingNames.size())
+    {
+        k_ExportRingNames.resize(NameId + 1);
+    }
+
+    name = GetInternedName(NameId);
+
+    if (name == NULL)
+    {
+        return 0;
+    }
+
+    return GetRingStringRef(&k_ExportRing, &k_ExportRingNames[NameId], name, strlen(name));
+}
+
+/**
+*
+* @brief        Gets the string table offset of a frame's symbolized name,
+*               symbolizing it and adding it if it is not cached in the current
+*               string generation.
+* @param[in]    ProcessId - The process the frame is from.
+* @param[in]    Address - The frame address.
+* @return       The offset (0 if it did not fit).
+*
+*/
+static
+uint32_t
+GetExportRingFrameName (
+    _In_ ULONG ProcessId,
+    _In_ ULONG_PTR Address
+    )
+{
+    PRING_FRAME_NAME pair;
+    PRING_FRAME_NAME entry;
+    uint64_t hash;
+
+    k_ExportRingFrameLookups++;
+
+    //
+    // Kernel addresses name the same code in every process.
+    //
+    if (static_cast<uint64_t>(Address) >= RING_USER_ADDRESS_LIMIT)
+    {
+        ProcessId = 0;
+    }
+
+    hash = ((static_cast<uint64_t>(Address) ^ (static_cast<uint64_t>(ProcessId) << 32)) * 0x9E3779B97F4A7C15ULL);
+
+    pair = &k_ExportRingFrameNames[(hash >> 32) & (RING_FRAME_CACHE_SLOTS - 2)];
+
+    for (ULONG i = 0; i < 2; i++)
+    {
+        if ((pair[i].Address == Address) &&
+            (pair[i].ProcessId == ProcessId) &&
+            (pair[i].Ref.Offset != 0) &&
+            (pair[i].Ref.Generation == k_ExportRing.StringGeneration))
+        {
+            pair[i].LastUse = k_ExportRingFrameLookups;
+
+            return pair[i].Ref.Offset;
+        }
+    }
+
+    k_ExportRingFrameMisses++;
+
+    //
+    // Reuse this frame's slot if it has one from an older generation,
+    // otherwise take over the one used least recently.
+    //
+    if ((pair[0].Address == Address) &&
+        (pair[0].ProcessId == ProcessId))
+    {
+        entry = &pair[0];
+    }
+    else if ((pair[1].Address == Address) &&
+             (pair[1].ProcessId == ProcessId))
+    {
+        entry = &pair[1];
+    }
+    else
+    {
+        entry = ((pair[0].LastUse <= pair[1].LastUse) ? &pair[0] : &pair[1]);
+    }
+
+    //
+    // Named the way the CSV names it.
+    //
+    ResetFormatBuffer(&k_ExportRingFrameName);
+
+    FormatVtl1Frame(&k_ExportRingFrameName, Address, FORMAT_NO_SEPARATOR);
+
+    entry->Address = Address;
+    entry->ProcessId = ProcessId;
+    entry->LastUse = k_ExportRingFrameLookups;
+    entry->Ref.Offset = 0;
+
+    return GetRingStringRef(&k_ExportRing,
+                            &entry->Ref,
+                            k_ExportRingFrameName.Data.data(),
+                            k_ExportRingFrameName.Length);
+}
+
+/**
+*
+* @brief        Publishes a correlated VTL 1 enter to the export ring.
+* @param[in]    Vtl1Data - The VTL 1 enter data.
+* @param[in]    CallStack - The call stack (innermost frame first).
+* @param[in]    NumberOfFrames - The number of frames.
+*
+*/
+void
+PublishExportRingEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    PRING_RECORD record;
+    ULONG numberOfFrames;
+    const char* secureCallName;
+    uint32_t processName;
+    uint32_t threadName;
+    uint32_t secureCallNameOffset;
+    uint32_t frameNames[RING_MAX_FRAMES];
+
+    if ((!k_ExportRingClockSet) &&
+        (IsClockValid(GetSessionClock())))
+    {
+        k_ExportRingClockSet = true;
+
+        SetRingClock(&k_ExportRing, GetSessionClock());
+    }
+
+    numberOfFrames = (std::min)(NumberOfFrames, static_cast<ULONG>(RING_MAX_FRAMES));
+
+    if (numberOfFrames < NumberOfFrames)
+    {
+        k_ExportRing.TruncatedStacks++;
+    }
+
+    secureCallName = GetSecureCallName(Vtl1Data->SecureCallNumber);
+
+    //
+    // A record's strings all come from one generation. If the half fills
+    // part way through, start the next one and add them all again.
+    //
+    for (ULONG attempt = 0; attempt < 2; attempt++)
+    {
+        processName = GetExportRingName(Vtl1Data->ProcessNameId);
+        threadName = GetExportRingName(Vtl1Data->ThreadNameId);
+        secureCallNameOffset = GetRingStringRef(&k_ExportRing,
+                                                &k_ExportRingSecureCallNames[Vtl1Data->SecureCallNumber],
+                                                secureCallName,
+                                                strlen(secureCallName));
+
+        for (ULONG i = 0; i < numberOfFrames; i++)
+        {
+            frameNames[i] = GetExportRingFrameName(Vtl1Data->ProcessId, CallStack[i]);
+        }
+
+        if (!k_ExportRing.StringsFull)
+        {
+            break;
+        }
+
+        StartRingStringGeneration(&k_ExportRing);
+    }
+
+    record = BeginRingRecord(&k_ExportRing);
+
+    record->TimeStamp = Vtl1Data->Vtl1EnterTime;
+    record->ProcessId = Vtl1Data->ProcessId;
+    record->ThreadId = Vtl1Data->ThreadId;
+    record->ProcessName = processName;
+    record->ThreadName = threadName;
+    record->SecureCallName = secureCallNameOffset;
+    record->SecureCallNumber = static_cast<uint16_t>(Vtl1Data->SecureCallNumber);
+    record->NumberOfFrames = static_cast<uint16_t>(numberOfFrames);
+    record->TotalFrames = static_cast<uint16_t>((std::min)(NumberOfFrames, static_cast<ULONG>(MAXUSHORT)));
+    record->Reserved = 0;
+    record->StringGeneration = k_ExportRing.StringGeneration;
+
+    for (ULONG i = 0; i < numberOfFrames; i++)
+    {
+        record->Frames[i] = CallStack[i];
+        record->FrameNames[i] = frameNames[i];
+
+        if (frameNames[i] == 0)
+        {
+            k_ExportRingUnnamedFrames++;
+        }
+    }
+
+    CommitRingRecord(&k_ExportRing, record);
+}
+
+/**
+*
+* @brief        Closes the export ring (its consumers drain it and stop) and
+*               prints its statistics.
+*
+*/
+void
+StopExportRing ()
+{
+    if (!k_ExportRingEnabled)
+    {
+        return;
+    }
+
+    k_ExportRingEnabled = false;
+
+    wprintf(L"[+] Export ring statistics:\n");
+    wprintf(L"  [>] Records published: %llu\n", k_ExportRing.Sequence);
+    wprintf(L"  [>] String table: %llu bytes in %llu generation(s) (%llu names too long to fit)\n",
+            k_ExportRing.StringBytes,
+            (k_ExportRing.StringGenerations + 1),
+            k_ExportRing.StringsDropped);
+    wprintf(L"  [>] Frame names: %llu lookups, %llu symbolized, %llu published without a name\n",
+            k_ExportRingFrameLookups,
+            k_ExportRingFrameMisses,
+            k_ExportRingUnnamedFrames);
+    wprintf(L"  [>] Truncated stacks: %llu\n", k_ExportRing.TruncatedStacks);
+
+    CloseRingProducer(&k_ExportRing);
+
+    k_ExportRingNames.clear();
+    k_ExportRingSecureCallNames.clear();
+    k_ExportRingFrameNames.clear();
+    k_ExportRingFrameNames.shrink_to_fit();
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,304 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/RingClient.cpp
+*
+* @summary:   Shared memory export ring client library. Consumers map the ring
+*             read-only and poll it with plain loads - no system calls, no
+*             locks, and nothing the producer ever waits on. A consumer which
+*             falls more than a ring behind loses the records it missed, and
+*             is told how many.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "RingClient.hpp"
+#include <stdio.h>
+#include <wchar.h>
+
+/**
+*
+* @brief        Opens a ring for reading. The reader starts at the next record
+*               published (see SeekRingReaderToOldest).
+* @param[out]   Reader - The reader.
+* @param[in]    Name - The ring's name, as the producer was given it.
+* @return       true on success, otherwise false (no such ring, or one this
+*               client does not understand).
+*
+*/
+bool
+OpenRingReader (
+    _Out_ PRING_READER Reader,
+    _In_ const PATH_CHAR* Name
+    )
+{
+    bool result;
+    const RING_HEADER* header;
+
+    result = false;
+
+    memset(Reader, 0, sizeof(*Reader));
+
+    if (!OpenSharedMapping(Name, &Reader->Mapping))
+    {
+        goto Exit;
+    }
+
+    header = reinterpret_cast<const RING_HEADER*>(Reader->Mapping.Data);
+
+    if ((Reader->Mapping.Length < RING_HEADER_REGION_SIZE) ||
+        (header->Magic != RING_MAGIC) ||
+        (header->Version != RING_VERSION) ||
+        (header->HeaderSize != sizeof(RING_HEADER)) ||
+        (header->RecordSize != sizeof(RING_RECORD)) ||
+        (header->MaxFrames != RING_MAX_FRAMES) ||
+        (header->RecordCount == 0) ||
+        ((header->RecordCount & (header->RecordCount - 1)) != 0) ||
+        (header->RecordCount > RING_MAX_RECORDS) ||
+        (header->RecordsOffset < RING_HEADER_REGION_SIZE) ||
+        ((header->RecordsOffset + (header->RecordCount * sizeof(RING_RECORD))) > header->StringsOffset) ||
+        (header->StringsSize == 0) ||
+        (header->StringsOffset > Reader->Mapping.Length) ||
+        (header->StringsSize > (Reader->Mapping.Length - header->StringsOffset)))
+    {
+        wprintf(L"[-] Error! %s is not a Vtl1Mon ring (or an unsupported version).\n", Name);
+        CloseSharedMapping(&Reader->Mapping);
+        goto Exit;
+    }
+
+    Reader->Header = header;
+    Reader->Records = (Reader->Mapping.Data + header->RecordsOffset);
+    Reader->Strings = reinterpret_cast<const char*>(Reader->Mapping.Data + header->StringsOffset);
+    Reader->StringsSize = header->StringsSize;
+    Reader->Mask = (header->RecordCount - 1);
+    Reader->Next = header->WriteSequence.load(std::memory_order_acquire);
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Moves a reader back to the oldest record still in the ring.
+* @param[in]    Reader - The reader.
+*
+*/
+void
+SeekRingReaderToOldest (
+    _Inout_ PRING_READER Reader
+    )
+{
+    uint64_t writeSequence;
+
+    writeSequence = Reader->Header->WriteSequence.load(std::memory_order_acquire);
+
+    Reader->Next = ((writeSequence > Reader->Header->RecordCount) ?
+                    (writeSequence - Reader->Header->RecordCount) :
+                    0);
+}
+
+/**
+*
+* @brief        Reads the next record, if there is one. Never blocks.
+* @param[in]    Reader - The reader.
+* @param[out]   Record - Receives the record (its first NumberOfFrames frames).
+* @return       RingReadRecord if a record was read, RingReadEmpty if there
+*               is none yet, or RingReadClosed if there is none and the
+*               producer has stopped.
+*
+*/
+RING_READ_STATUS
+ReadRingRecord (
+    _Inout_ PRING_READER Reader,
+    _Out_ PRING_RECORD Record
+    )
+{
+    const RING_RECORD* slot;
+    uint64_t writeSequence;
+    uint64_t stamp;
+    uint32_t numberOfFrames;
+
+    for (;;)
+    {
+        writeSequence = Reader->Header->WriteSequence.load(std::memory_order_acquire);
+
+        if (Reader->Next == writeSequence)
+        {
+            //
+            // Closed is set after the last record is published, so a
+            // reader which sees it has nothing left to read.
+            //
+            if ((Reader->Header->Closed.load(std::memory_order_acquire) != 0) &&
+                (Reader->Header->WriteSequence.load(std::memory_order_acquire) == Reader->Next))
+            {
+                return RingReadClosed;
+            }
+
+            return RingReadEmpty;
+        }
+
+        //
+        // Lapped: everything older than a ring behind is gone.
+        //
+        if ((writeSequence - Reader->Next) > Reader->Header->RecordCount)
+        {
+            Reader->Lost += ((writeSequence - Reader->Header->RecordCount) - Reader->Next);
+            Reader->Next = (writeSequence - Reader->Header->RecordCount);
+        }
+
+        slot = reinterpret_cast<const RING_RECORD*>(Reader->Records + ((Reader->Next & Reader->Mask) * sizeof(RING_RECORD)));
+
+        stamp = slot->Sequence.load(std::memory_order_acquire);
+
+        if (stamp == (Reader->Next + 1))
+        {
+            memcpy(reinterpret_cast<uint8_t*>(Record) + sizeof(uint64_t),
+                   reinterpret_cast<const uint8_t*>(slot) + sizeof(uint64_t),
+                   (offsetof(RING_RECORD, Frames) - sizeof(uint64_t)));
+
+            //
+            // Only the frames in use are copied. The count may be torn, so
+            // it is bounded before use and checked with the rest below.
+            //
+            numberOfFrames = (Record->NumberOfFrames < RING_MAX_FRAMES) ? Record->NumberOfFrames : RING_MAX_FRAMES;
+
+            memcpy(Record->Frames, slot->Frames, numberOfFrames * sizeof(uint64_t));
+            memcpy(Record->FrameNames, slot->FrameNames, numberOfFrames * sizeof(uint32_t));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slot->Sequence.load(std::memory_order_relaxed) == stamp)
+            {
+                Record->Sequence.store(stamp, std::memory_order_relaxed);
+                Record->NumberOfFrames = static_cast<uint16_t>(numberOfFrames);
+
+                Reader->Next++;
+                Reader->Read++;
+
+                return RingReadRecord;
+            }
+        }
+
+        //
+        // The producer is rewriting (or has rewritten) the slot, so this
+        // record is gone. Try the next one.
+        //
+        Reader->Lost++;
+        Reader->Next++;
+    }
+}
+
+/**
+*
+* @brief        Gets one of a record's strings from the ring's string table.
+*               Zero-copy: the pointer is into the ring, and the string stays
+*               intact until the producer has moved two string generations
+*               past the record's. Check IsRingRecordStringsValid after using
+*               (or copying) it.
+* @param[in]    Reader - The reader.
+* @param[in]    Record - The record.
+* @param[in]    Offset - The string's offset (from the record).
+* @return       The string ("" if the offset is 0 or out of bounds, or the
+*               record's strings have already been recycled).
+*
+*/
+const char*
+GetRingString (
+    _In_ const RING_READER* Reader,
+    _In_ const RING_RECORD* Record,
+    _In_ uint32_t Offset
+    )
+{
+    //
+    // The producer never writes the last byte of either half, so every
+    // string in bounds is terminated, even one being overwritten.
+    //
+    if ((Offset >= Reader->StringsSize) ||
+        (!IsRingRecordStringsValid(Reader, Record)))
+    {
+        return Reader->Strings;
+    }
+
+    return (Reader->Strings + Offset);
+}
+
+/**
+*
+* @brief        Determines if a record's strings are still intact.
+* @param[in]    Reader - The reader.
+* @param[in]    Record - The record.
+* @return       true if the producer has not started recycling them, otherwise
+*               false (strings read from it since may be garbage).
+*
+*/
+bool
+IsRingRecordStringsValid (
+    _In_ const RING_READER* Reader,
+    _In_ const RING_RECORD* Record
+    )
+{
+    uint32_t generation;
+
+    //
+    // Ordered after the caller's reads of the strings.
+    //
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    generation = Reader->Header->StringGeneration.load(std::memory_order_relaxed);
+
+    return ((generation - Record->StringGeneration) <= 1);
+}
+
+/**
+*
+* @brief        Gets the producer's session clock, which converts record
+*               timestamps to UTC times (see GetClockTime).
+* @param[in]    Reader - The reader.
+* @param[out]   Clock - Receives the clock.
+* @return       true if the producer has a clock, otherwise false.
+*
+*/
+bool
+GetRingClock (
+    _In_ const RING_READER* Reader,
+    _Out_ PSESSION_CLOCK Clock
+    )
+{
+    memset(Clock, 0, sizeof(*Clock));
+
+    //
+    // The clock is set before the first record is published.
+    //
+    if (Reader->Header->WriteSequence.load(std::memory_order_acquire) == 0)
+    {
+        return false;
+    }
+
+    Clock->QpcFrequency = Reader->Header->QpcFrequency;
+    Clock->AnchorTimeStamp = Reader->Header->AnchorTimeStamp;
+    Clock->AnchorTime = Reader->Header->AnchorTime;
+    Clock->Uncertainty = Reader->Header->Uncertainty;
+
+    return IsClockValid(Clock);
+}
+
+/**
+*
+* @brief        Closes a reader.
+* @param[in]    Reader - The reader.
+*
+*/
+void
+CloseRingReader (
+    _Inout_ PRING_READER Reader
+    )
+{
+    CloseSharedMapping(&Reader->Mapping);
+
+    memset(Reader, 0, sizeof(*Reader));
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/RingDriver.cpp
+*
+* @summary:   Standalone export ring driver for hosts other than Windows, where
+*             there is no live session or ETW replay. It replays raw captures
+*             into a ring and follows rings, the same as the ringreplay and
+*             ringtail commands, so consumers can be tested and benchmarked
+*             locally. Built as vtl1ring by CMakeLists.txt (with Portable.cpp,
+*             Clock.cpp, Lz4.cpp, Ring.cpp and RingClient.cpp).
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#ifndef _WIN32
+#include "Ring.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <strings.h>
+
+/**
+*
+* @brief        Prints the driver's usage.
+*
+*/
+static
+void
+PrintRingDriverUsage ()
+{
+    wprintf(L"[+] Usage: ./vtl1ring ringreplay [-ringrecords <n>] [-loops <n>] [-pace] <ring name> /path/to/capture.vraw\n");
+    wprintf(L"[+] Usage: ./vtl1ring ringtail [-print] [-wait <seconds>] <ring name>\n");
+    wprintf(L"[+] Options:\n");
+    wprintf(L"  [>] -ringrecords <n> - Records the ring holds (default: %d).\n", RING_DEFAULT_RECORDS);
+    wprintf(L"  [>] -loops <n> - Replay the capture this many times (default: 1).\n");
+    wprintf(L"  [>] -pace - Replay at the pace the events were captured instead of as fast as possible.\n");
+    wprintf(L"  [>] -print - Print every record read, as a CSV row (otherwise only statistics).\n");
+    wprintf(L"  [>] -wait <seconds> - How long ringtail waits for the ring to be created (default: %d).\n", RING_TAIL_DEFAULT_WAIT_SECONDS);
+}
+
+/**
+*
+* @brief        Driver entry point.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array.
+* @return       0 on success, otherwise 1.
+*
+*/
+int
+main (
+    _In_ int argc,
+    _In_ char** argv
+    )
+{
+    int error;
+    bool replay;
+    const char* ringName;
+    const char* capturePath;
+    uint32_t ringRecords;
+    uint32_t loops;
+    bool paced;
+    bool print;
+    uint32_t waitSeconds;
+    int i;
+
+    error = 1;
+    ringName = NULL;
+    capturePath = NULL;
+    ringRecords = RING_DEFAULT_RECORDS;
+    loops = 1;
+    paced = false;
+    print = false;
+    waitSeconds = RING_TAIL_DEFAULT_WAIT_SECONDS;
+
+    if ((argc < 2) ||
+        ((strcasecmp(argv[1], "ringreplay") != 0) &&
+         (strcasecmp(argv[1], "ringtail") != 0)))
+    {
+        PrintRingDriverUsage();
+        goto Exit;
+    }
+
+    replay = (strcasecmp(argv[1], "ringreplay") == 0);
+
+    for (i = 2; i < argc; i++)
+    {
+        if ((replay) &&
+            (strcasecmp(argv[i], "-ringrecords") == 0) &&
+            ((i + 1) < argc))
+        {
+            ringRecords = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+        }
+        else if ((replay) &&
+                 (strcasecmp(argv[i], "-loops") == 0) &&
+                 ((i + 1) < argc))
+        {
+            loops = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+        }
+        else if ((replay) &&
+                 (strcasecmp(argv[i], "-pace") == 0))
+        {
+            paced = true;
+        }
+        else if ((!replay) &&
+                 (strcasecmp(argv[i], "-print") == 0))
+        {
+            print = true;
+        }
+        else if ((!replay) &&
+                 (strcasecmp(argv[i], "-wait") == 0) &&
+                 ((i + 1) < argc))
+        {
+            waitSeconds = static_cast<uint32_t>(strtoul(argv[++i], NULL, 10));
+        }
+        else if ((argv[i][0] != '-') &&
+                 (ringName == NULL))
+        {
+            ringName = argv[i];
+        }
+        else if ((replay) &&
+                 (argv[i][0] != '-') &&
+                 (capturePath == NULL))
+        {
+            capturePath = argv[i];
+        }
+        else
+        {
+            ringName = NULL;
+            break;
+        }
+    }
+
+    if ((ringName == NULL) ||
+        ((replay) &&
+         ((capturePath == NULL) ||
+          (loops == 0))))
+    {
+        PrintRingDriverUsage();
+        goto Exit;
+    }
+
+    if (replay)
+    {
+        if (ReplayRawCaptureToRing(capturePath,
+                                   ringName,
+                                   ringRecords,
+                                   loops,
+                                   paced))
+        {
+            error = 0;
+        }
+    }
+    else if (TailRing(ringName, print, waitSeconds))
+    {
+        error = 0;
+    }
+
+Exit:
+    return error;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,952 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Rollup.cpp
+*
+* @summary:   Time-series rollups. Secure call counts and latency histograms
+*             are kept per 1 second bucket (per secure call, optionally per
+*             process) and folded into 10 and 60 second buckets as they close.
+*             Closed buckets are appended to a compact time-series file, and a
+*             Prometheus textfile collector file is rewritten every 10 seconds.
+*             While live, a timer closes buckets when secure calls stop coming,
+*             so the file keeps up (with zero rates) through quiet periods.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Rollup.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Format.hpp"
+#include "Clock.hpp"
+#include <stdio.h>
+#include <algorithm>
+#include <unordered_set>
+
+//
+// Rollup state. The ETW processing thread and the timer thread touch it,
+// under k_RollupLock.
+//
+static SRWLOCK k_RollupLock = SRWLOCK_INIT;
+static bool k_RollupEnabled = false;
+static bool k_RollupStarted = false;
+static bool k_RollupPerProcess = false;
+static HANDLE k_RollupFileHandle = INVALID_HANDLE_VALUE;
+static std::wstring k_RollupPrometheusPath;
+
+//
+// The timer thread, and the event which stops it.
+//
+static HANDLE k_RollupTimerThreadHandle = NULL;
+static HANDLE k_RollupTimerStopEvent = NULL;
+
+//
+// The QPC time the open 1 second bucket ends. The only check most
+// events make.
+//
+static ULONGLONG k_RollupNextSecond = 0;
+
+static ROLLUP_SERIES k_RollupSeries[ROLLUP_RESOLUTIONS];
+
+//
+// Counts and latency sums since start, for the Prometheus counters.
+//
+static std::unordered_map<uint64_t, AGGREGATE_SECURE_CALL> k_RollupTotals;
+
+//
+// Copies of the process names series use, so the timer thread never reads
+// the name table the processing thread is adding to.
+//
+static std::unordered_map<ULONG, std::string> k_RollupNames;
+
+//
+// Names already written to the time-series file.
+//
+static std::unordered_set<ULONG> k_RollupProcessNames;
+static std::unordered_set<ULONG> k_RollupSecureCallNames;
+
+static std::vector<uint8_t> k_RollupRecords;
+static FORMAT_BUFFER k_RollupPrometheus;
+
+static ULONGLONG k_RollupOverflow = 0;
+static ULONGLONG k_RollupBytesWritten = 0;
+static ULONGLONG k_RollupPrometheusUpdates = 0;
+static ULONGLONG k_RollupTimerAdvances = 0;
+
+/**
+*
+* @brief        Gets a series' process name.
+* @param[in]    ProcessNameId - The process name ID.
+* @return       The name.
+*
+*/
+static
+const char*
+GetRollupProcessName (
+    _In_ ULONG ProcessNameId
+    )
+{
+    std::unordered_map<ULONG, std::string>::const_iterator name;
+
+    if (ProcessNameId == ROLLUP_OTHER_PROCESSES)
+    {
+        return "other";
+    }
+
+    name = k_RollupNames.find(ProcessNameId);
+    if (name == k_RollupNames.end())
+    {
+        return "Unknown";
+    }
+
+    return name->second.c_str();
+}
+
+/**
+*
+* @brief        Gets a cell of a bucket, or the secure call's "other" cell if
+*               the bucket is full.
+* @param[in]    Cells - The bucket's cells.
+* @param[in]    ProcessNameId - The process name ID (or ROLLUP_ALL_PROCESSES).
+* @param[in]    SecureCallNumber - The secure call number.
+* @return       The cell.
+*
+*/
+static
+PAGGREGATE_SECURE_CALL
+GetRollupCell (
+    _Inout_ std::unordered_map<uint64_t, AGGREGATE_SECURE_CALL>& Cells,
+    _In_ ULONG ProcessNameId,
+    _In_ ULONG SecureCallNumber
+    )
+{
+    std::unordered_map<uint64_t, AGGREGATE_SECURE_CALL>::iterator cell;
+    PAGGREGATE_SECURE_CALL secureCall;
+    uint64_t key;
+
+    key = ((static_cast<uint64_t>(ProcessNameId) << 32) | SecureCallNumber);
+
+    cell = Cells.find(key);
+    if (cell != Cells.end())
+    {
+        return &cell->second;
+    }
+
+    if (Cells.size() >= ROLLUP_MAX_SERIES)
+    {
+        ProcessNameId = ROLLUP_OTHER_PROCESSES;
+        key = ((static_cast<uint64_t>(ProcessNameId) << 32) | SecureCallNumber);
+    }
+
+    secureCall = &Cells[key];
+    secureCall->NameId = ProcessNameId;
+    secureCall->Number = SecureCallNumber;
+
+    if ((ProcessNameId != ROLLUP_ALL_PROCESSES) &&
+        (ProcessNameId != ROLLUP_OTHER_PROCESSES) &&
+        (k_RollupNames.find(ProcessNameId) == k_RollupNames.end()))
+    {
+        k_RollupNames.emplace(ProcessNameId, GetInternedName(ProcessNameId));
+    }
+
+    return secureCall;
+}
+
+/**
+*
+* @brief        Adds a cell into another bucket (or the totals).
+* @param[in]    Cells - The bucket's cells.
+* @param[in]    Source - The cell.
+* @param[in]    Histogram - Whether to add the latency histogram as well.
+*
+*/
+static
+void
+FoldRollupCell (
+    _Inout_ std::unordered_map<uint64_t, AGGREGATE_SECURE_CALL>& Cells,
+    _In_ const AGGREGATE_SECURE_CALL* Source,
+    _In_ bool Histogram
+    )
+{
+    PAGGREGATE_SECURE_CALL target;
+
+    target = GetRollupCell(Cells, Source->NameId, Source->Number);
+
+    target->Count += Source->Count;
+    target->Latencies += Source->Latencies;
+    target->LatencySum += Source->LatencySum;
+    target->LatencyMax = (std::max)(target->LatencyMax, Source->LatencyMax);
+
+    if ((!Histogram) ||
+        (Source->Buckets.empty()))
+    {
+        return;
+    }
+
+    if (target->Buckets.empty())
+    {
+        target->Buckets.assign(AGGREGATE_LATENCY_BUCKETS, 0);
+    }
+
+    for (size_t i = 0; i < Source->Buckets.size(); i++)
+    {
+        target->Buckets[i] += Source->Buckets[i];
+    }
+}
+
+/**
+*
+* @brief        Appends a record to the pending time-series file output.
+* @param[in]    Type - The record type.
+* @param[in]    Data - The first part of the payload.
+* @param[in]    Length - Its length.
+* @param[in]    Extra - The rest of the payload. Optional.
+* @param[in]    ExtraLength - Its length.
+*
+*/
+static
+void
+AppendRollupRecord (
+    _In_ ROLLUP_RECORD_TYPE Type,
+    _In_ const void* Data,
+    _In_ size_t Length,
+    _In_opt_ const void* Extra,
+    _In_ size_t ExtraLength
+    )
+{
+    ROLLUP_RECORD_HEADER header;
+    size_t offset;
+
+    header.Type = Type;
+    header.Length = static_cast<uint32_t>(Length + ExtraLength);
+
+    offset = k_RollupRecords.size();
+
+    k_RollupRecords.resize(offset + sizeof(header) + Length + ExtraLength);
+
+    RtlCopyMemory(k_RollupRecords.data() + offset, &header, sizeof(header));
+    RtlCopyMemory(k_RollupRecords.data() + offset + sizeof(header), Data, Length);
+
+    if (ExtraLength != 0)
+    {
+        RtlCopyMemory(k_RollupRecords.data() + offset + sizeof(header) + Length, Extra, ExtraLength);
+    }
+}
+
+/**
+*
+* @brief        Appends a closed bucket (and any names it uses for the first
+*               time) to the time-series file.
+* @param[in]    Resolution - The bucket's resolution.
+*
+*/
+static
+void
+WriteRollupBucket (
+    _In_ ULONG Resolution
+    )
+{
+    PROLLUP_SERIES series;
+    ROLLUP_BUCKET_RECORD bucket;
+    std::vector<ROLLUP_ROW_RECORD> rows;
+    DWORD bytesWritten;
+
+    series = &k_RollupSeries[Resolution];
+
+    k_RollupRecords.clear();
+
+    rows.reserve(series->Cells.size());
+
+    for (const auto& cell : series->Cells)
+    {
+        ROLLUP_ROW_RECORD row;
+        const char* name;
+
+        if ((cell.second.NameId != ROLLUP_ALL_PROCESSES) &&
+            (cell.second.NameId != ROLLUP_OTHER_PROCESSES) &&
+            (k_RollupProcessNames.insert(cell.second.NameId).second))
+        {
+            name = GetRollupProcessName(cell.second.NameId);
+
+            AppendRollupRecord(RollupRecordProcessName, &cell.second.NameId, sizeof(cell.second.NameId), name, strlen(name));
+        }
+
+        if (k_RollupSecureCallNames.insert(cell.second.Number).second)
+        {
+            name = GetSecureCallName(cell.second.Number);
+
+            AppendRollupRecord(RollupRecordSecureCallName, &cell.second.Number, sizeof(cell.second.Number), name, strlen(name));
+        }
+
+        row.SecureCallNumber = cell.second.Number;
+        row.ProcessNameId = cell.second.NameId;
+        row.Count = cell.second.Count;
+        row.Latencies = cell.second.Latencies;
+        row.LatencySum = cell.second.LatencySum;
+        row.LatencyMax = cell.second.LatencyMax;
+        row.LatencyP50 = GetAggregateLatencyPercentile(&cell.second, 50.0);
+        row.LatencyP99 = GetAggregateLatencyPercentile(&cell.second, 99.0);
+
+        rows.push_back(row);
+    }
+
+    bucket.StartTime = (series->Index * k_RollupResolutions[Resolution] * CLOCK_FILETIME_SECOND);
+    bucket.Seconds = k_RollupResolutions[Resolution];
+    bucket.RowCount = static_cast<uint32_t>(rows.size());
+
+    AppendRollupRecord(RollupRecordBucket, &bucket, sizeof(bucket), rows.data(), (rows.size() * sizeof(ROLLUP_ROW_RECORD)));
+
+    series->Buckets++;
+    series->Rows += rows.size();
+
+    if ((WriteFile(k_RollupFileHandle,
+                   k_RollupRecords.data(),
+                   static_cast<DWORD>(k_RollupRecords.size()),
+                   &bytesWritten,
+                   NULL) == FALSE) ||
+        (bytesWritten != k_RollupRecords.size()))
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteRollupBucket. (GLE: %d)\n", GetLastError());
+        return;
+    }
+
+    k_RollupBytesWritten += bytesWritten;
+}
+
+/**
+*
+* @brief        Appends a Prometheus label value, escaped.
+* @param[in]    Value - The value.
+*
+*/
+static
+void
+FormatRollupLabelValue (
+    _In_ const char* Value
+    )
+{
+    for (; *Value != '\0'; Value++)
+    {
+        switch (*Value)
+        {
+            case '\\':
+                FormatAppend(&k_RollupPrometheus, "\\\\", 2);
+                break;
+
+            case '"':
+                FormatAppend(&k_RollupPrometheus, "\\\"", 2);
+                break;
+
+            case '\n':
+                FormatAppend(&k_RollupPrometheus, "\\n", 2);
+                break;
+
+            default:
+                FormatAppendChar(&k_RollupPrometheus, *Value);
+                break;
+        }
+    }
+}
+
+/**
+*
+* @brief        Appends a series' metric name and labels.
+* @param[in]    Metric - The metric name.
+* @param[in]    Cell - The series.
+* @param[in]    Quantile - The quantile label value. Optional.
+*
+*/
+static
+void
+FormatRollupSeries (
+    _In_ const char* Metric,
+    _In_ const AGGREGATE_SECURE_CALL* Cell,
+    _In_opt_ const char* Quantile
+    )
+{
+    FormatAppendString(&k_RollupPrometheus, Metric);
+    FormatAppendString(&k_RollupPrometheus, "{secure_call=\"");
+    FormatRollupLabelValue(GetSecureCallName(Cell->Number));
+    FormatAppendString(&k_RollupPrometheus, "\",number=\"");
+    FormatAppendDecimal(&k_RollupPrometheus, Cell->Number);
+    FormatAppendChar(&k_RollupPrometheus, '"');
+
+    if (Cell->NameId != ROLLUP_ALL_PROCESSES)
+    {
+        FormatAppendString(&k_RollupPrometheus, ",process=\"");
+        FormatRollupLabelValue(GetRollupProcessName(Cell->NameId));
+        FormatAppendChar(&k_RollupPrometheus, '"');
+    }
+
+    if (Quantile != NULL)
+    {
+        FormatAppendString(&k_RollupPrometheus, ",quantile=\"");
+        FormatAppendString(&k_RollupPrometheus, Quantile);
+        FormatAppendChar(&k_RollupPrometheus, '"');
+    }
+
+    FormatAppendString(&k_RollupPrometheus, "} ");
+}
+
+/**
+*
+* @brief        Rewrites the Prometheus textfile: counters since start, and the
+*               rate and latency quantiles of the bucket which just closed.
+*               Every series seen since start gets a rate, zero if it had no
+*               secure calls in the bucket. The file is replaced, never
+*               rewritten in place, so the collector never reads half of it.
+* @param[in]    Resolution - The resolution of the closed bucket.
+*
+*/
+static
+void
+WriteRollupPrometheus (
+    _In_ ULONG Resolution
+    )
+{
+    PROLLUP_SERIES series;
+    std::wstring temporaryPath;
+    HANDLE fileHandle;
+    DWORD bytesWritten;
+    BOOL written;
+
+    series = &k_RollupSeries[Resolution];
+
+    ResetFormatBuffer(&k_RollupPrometheus);
+
+    FormatAppendString(&k_RollupPrometheus, "# HELP vtl1mon_secure_calls_total Secure calls (VTL 1 entries) since Vtl1Mon started.\n");
+    FormatAppendString(&k_RollupPrometheus, "# TYPE vtl1mon_secure_calls_total counter\n");
+
+    for (const auto& total : k_RollupTotals)
+    {
+        FormatRollupSeries("vtl1mon_secure_calls_total", &total.second, NULL);
+        FormatAppendDecimal(&k_RollupPrometheus, total.second.Count);
+        FormatAppendChar(&k_RollupPrometheus, '\n');
+    }
+
+    FormatAppendPrintf(&k_RollupPrometheus, "# HELP vtl1mon_secure_calls_per_second Secure call rate over the last %lu seconds.\n", k_RollupResolutions[Resolution]);
+    FormatAppendString(&k_RollupPrometheus, "# TYPE vtl1mon_secure_calls_per_second gauge\n");
+
+    for (const auto& total : k_RollupTotals)
+    {
+        std::unordered_map<uint64_t, AGGREGATE_SECURE_CALL>::const_iterator cell;
+        ULONGLONG count;
+
+        cell = series->Cells.find(total.first);
+        count = ((cell != series->Cells.end()) ? cell->second.Count : 0);
+
+        FormatRollupSeries("vtl1mon_secure_calls_per_second", &total.second, NULL);
+        FormatAppendPrintf(&k_RollupPrometheus, "%.9g\n", (static_cast<double>(count) / k_RollupResolutions[Resolution]));
+    }
+
+    //
+    // A series the totals counted as "other" (they were full) still has
+    // its own cell here.
+    //
+    for (const auto& cell : series->Cells)
+    {
+        if (k_RollupTotals.find(cell.first) != k_RollupTotals.end())
+        {
+            continue;
+        }
+
+        FormatRollupSeries("vtl1mon_secure_calls_per_second", &cell.second, NULL);
+        FormatAppendPrintf(&k_RollupPrometheus, "%.9g\n", (static_cast<double>(cell.second.Count) / k_RollupResolutions[Resolution]));
+    }
+
+    FormatAppendPrintf(&k_RollupPrometheus, "# HELP vtl1mon_secure_call_latency_seconds Secure call latency (VTL 1 enter to exit). Quantiles are over the last %lu seconds.\n", k_RollupResolutions[Resolution]);
+    FormatAppendString(&k_RollupPrometheus, "# TYPE vtl1mon_secure_call_latency_seconds summary\n");
+
+    for (const auto& cell : series->Cells)
+    {
+        if (cell.second.Latencies == 0)
+        {
+            continue;
+        }
+
+        FormatRollupSeries("vtl1mon_secure_call_latency_seconds", &cell.second, "0.5");
+        FormatAppendPrintf(&k_RollupPrometheus, "%.9g\n", (GetAggregateLatencyPercentile(&cell.second, 50.0) / 1e9));
+
+        FormatRollupSeries("vtl1mon_secure_call_latency_seconds", &cell.second, "0.99");
+        FormatAppendPrintf(&k_RollupPrometheus, "%.9g\n", (GetAggregateLatencyPercentile(&cell.second, 99.0) / 1e9));
+    }
+
+    for (const auto& total : k_RollupTotals)
+    {
+        if (total.second.Latencies == 0)
+        {
+            continue;
+        }
+
+        FormatRollupSeries("vtl1mon_secure_call_latency_seconds_sum", &total.second, NULL);
+        FormatAppendPrintf(&k_RollupPrometheus, "%.9g\n", (total.second.LatencySum / 1e9));
+
+        FormatRollupSeries("vtl1mon_secure_call_latency_seconds_count", &total.second, NULL);
+        FormatAppendDecimal(&k_RollupPrometheus, total.second.Latencies);
+        FormatAppendChar(&k_RollupPrometheus, '\n');
+    }
+
+    temporaryPath = (k_RollupPrometheusPath + L".tmp");
+
+    fileHandle = CreateFileW(temporaryPath.c_str(),
+                             GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             0,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in WriteRollupPrometheus. (GLE: %d)\n", GetLastError());
+        return;
+    }
+
+    written = WriteFile(fileHandle,
+                        k_RollupPrometheus.Data.data(),
+                        static_cast<DWORD>(k_RollupPrometheus.Length),
+                        &bytesWritten,
+                        NULL);
+
+    CloseHandle(fileHandle);
+
+    if ((written == FALSE) ||
+        (bytesWritten != k_RollupPrometheus.Length))
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteRollupPrometheus. (GLE: %d)\n", GetLastError());
+        return;
+    }
+
+    if (MoveFileExW(temporaryPath.c_str(),
+                    k_RollupPrometheusPath.c_str(),
+                    MOVEFILE_REPLACE_EXISTING) == FALSE)
+    {
+        wprintf(L"[-] Error! MoveFileExW failed in WriteRollupPrometheus. (GLE: %d)\n", GetLastError());
+        return;
+    }
+
+    k_RollupPrometheusUpdates++;
+}
+
+/**
+*
+* @brief        Closes a resolution's bucket: writes it, then folds it into the
+*               next resolution (and, for 1 second buckets, the totals). An
+*               empty bucket is not written to the time-series file, but still
+*               rewrites the Prometheus textfile, with zero rates.
+* @param[in]    Resolution - The resolution.
+*
+*/
+static
+void
+CloseRollupBucket (
+    _In_ ULONG Resolution
+    )
+{
+    PROLLUP_SERIES series;
+
+    series = &k_RollupSeries[Resolution];
+
+    if ((k_RollupFileHandle != INVALID_HANDLE_VALUE) &&
+        (!series->Cells.empty()))
+    {
+        WriteRollupBucket(Resolution);
+    }
+
+    for (const auto& cell : series->Cells)
+    {
+        if (Resolution == 0)
+        {
+            FoldRollupCell(k_RollupTotals, &cell.second, false);
+        }
+
+        if ((Resolution + 1) < ROLLUP_RESOLUTIONS)
+        {
+            FoldRollupCell(k_RollupSeries[Resolution + 1].Cells, &cell.second, true);
+        }
+    }
+
+    if ((Resolution == ROLLUP_PROMETHEUS_RESOLUTION) &&
+        (!k_RollupPrometheusPath.empty()))
+    {
+        WriteRollupPrometheus(Resolution);
+    }
+
+    series->Cells.clear();
+}
+
+/**
+*
+* @brief        Moves to the 1 second bucket an event (or the timer) falls in,
+*               closing every bucket it leaves behind.
+* @param[in]    TimeStamp - The event's raw (QPC) timestamp.
+*
+*/
+static
+void
+AdvanceRollups (
+    _In_ ULONGLONG TimeStamp
+    )
+{
+    ULONGLONG second;
+
+    second = (GetClockTime(GetSessionClock(), TimeStamp) / CLOCK_FILETIME_SECOND);
+
+    for (ULONG i = 0; i < ROLLUP_RESOLUTIONS; i++)
+    {
+        ULONGLONG index;
+
+        index = (second / k_RollupResolutions[i]);
+
+        //
+        // Resolutions nest, so if this one is still open the rest are too.
+        //
+        if ((k_RollupStarted) &&
+            (index == k_RollupSeries[i].Index))
+        {
+            break;
+        }
+
+        CloseRollupBucket(i);
+
+        k_RollupSeries[i].Index = index;
+    }
+
+    k_RollupStarted = true;
+    k_RollupNextSecond = GetClockTimeStamp(GetSessionClock(), ((second + 1) * CLOCK_FILETIME_SECOND));
+}
+
+/**
+*
+* @brief        Closes the buckets events stopped arriving for, once a second.
+*               Buckets are only closed ROLLUP_TIMER_LAG_SECONDS after they end,
+*               so events ETW delivers late still land in theirs.
+* @param[in]    Parameter - Unused.
+* @return       0.
+*
+*/
+static
+DWORD
+WINAPI
+RollupTimerThreadProc (
+    _In_ LPVOID Parameter
+    )
+{
+    LARGE_INTEGER now;
+    ULONGLONG lag;
+
+    UNREFERENCED_PARAMETER(Parameter);
+
+    while (WaitForSingleObject(k_RollupTimerStopEvent, ROLLUP_TIMER_MS) == WAIT_TIMEOUT)
+    {
+        QueryPerformanceCounter(&now);
+
+        lag = (GetSessionClock()->QpcFrequency * ROLLUP_TIMER_LAG_SECONDS);
+
+        AcquireSRWLockExclusive(&k_RollupLock);
+
+        if ((k_RollupEnabled) &&
+            (k_RollupStarted) &&
+            ((static_cast<ULONGLONG>(now.QuadPart) - lag) >= k_RollupNextSecond))
+        {
+            AdvanceRollups(static_cast<ULONGLONG>(now.QuadPart) - lag);
+
+            k_RollupTimerAdvances++;
+        }
+
+        ReleaseSRWLockExclusive(&k_RollupLock);
+    }
+
+    return 0;
+}
+
+/**
+*
+* @brief        Turns on time-series rollups.
+* @param[in]    FilePath - The time-series file to write. Optional.
+* @param[in]    PrometheusPath - The Prometheus textfile to keep up to date. Optional.
+* @param[in]    PerProcess - Whether to keep series per process as well as per secure call.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+SetRollups (
+    _In_opt_ const wchar_t* FilePath,
+    _In_opt_ const wchar_t* PrometheusPath,
+    _In_ bool PerProcess
+    )
+{
+    ROLLUP_FILE_HEADER header;
+    DWORD bytesWritten;
+
+    if (FilePath != NULL)
+    {
+        k_RollupFileHandle = CreateFileW(FilePath,
+                                         GENERIC_WRITE,
+                                         FILE_SHARE_READ,
+                                         NULL,
+                                         CREATE_ALWAYS,
+                                         0,
+                                         NULL);
+        if (k_RollupFileHandle == INVALID_HANDLE_VALUE)
+        {
+            wprintf(L"[-] Error! CreateFileW failed in SetRollups. (GLE: %d)\n", GetLastError());
+            return false;
+        }
+
+        header.Magic = ROLLUP_MAGIC;
+        header.Version = ROLLUP_VERSION;
+        header.PerProcess = (PerProcess ? 1 : 0);
+
+        for (ULONG i = 0; i < ROLLUP_RESOLUTIONS; i++)
+        {
+            header.Resolutions[i] = k_RollupResolutions[i];
+        }
+
+        if ((WriteFile(k_RollupFileHandle,
+                       &header,
+                       sizeof(header),
+                       &bytesWritten,
+                       NULL) == FALSE) ||
+            (bytesWritten != sizeof(header)))
+        {
+            wprintf(L"[-] Error! WriteFile failed in SetRollups. (GLE: %d)\n", GetLastError());
+
+            CloseHandle(k_RollupFileHandle);
+            k_RollupFileHandle = INVALID_HANDLE_VALUE;
+
+            return false;
+        }
+
+        k_RollupBytesWritten = sizeof(header);
+    }
+
+    if (PrometheusPath != NULL)
+    {
+        k_RollupPrometheusPath = PrometheusPath;
+    }
+
+    k_RollupPerProcess = PerProcess;
+    k_RollupEnabled = true;
+
+    return true;
+}
+
+/**
+*
+* @brief        Starts the timer which closes buckets while no secure calls
+*               arrive. Only for a live session: a replayed trace's clock is
+*               not ours. Rollups carry on without it if it cannot start.
+*
+*/
+void
+StartRollupTimer ()
+{
+    if (!k_RollupEnabled)
+    {
+        return;
+    }
+
+    k_RollupTimerStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (k_RollupTimerStopEvent == NULL)
+    {
+        wprintf(L"[-] Warning! CreateEventW failed in StartRollupTimer. Rollups only advance as secure calls arrive. (GLE: %d)\n", GetLastError());
+        return;
+    }
+
+    k_RollupTimerThreadHandle = CreateThread(NULL,
+                                             0,
+                                             RollupTimerThreadProc,
+                                             NULL,
+                                             0,
+                                             NULL);
+    if (k_RollupTimerThreadHandle == NULL)
+    {
+        wprintf(L"[-] Warning! CreateThread failed in StartRollupTimer. Rollups only advance as secure calls arrive. (GLE: %d)\n", GetLastError());
+
+        CloseHandle(k_RollupTimerStopEvent);
+        k_RollupTimerStopEvent = NULL;
+    }
+}
+
+/**
+*
+* @brief        Determines if rollups are on.
+* @return       true if they are, otherwise false.
+*
+*/
+bool
+IsRollupEnabled ()
+{
+    return k_RollupEnabled;
+}
+
+/**
+*
+* @brief        Counts a secure call. Called for every VTL 1 enter.
+* @param[in]    TimeStamp - The event's raw (QPC) timestamp.
+* @param[in]    ProcessId - The calling process.
+* @param[in]    SecureCallNumber - The secure call number.
+*
+*/
+void
+RecordRollupSecureCall (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG ProcessId,
+    _In_ ULONG SecureCallNumber
+    )
+{
+    PAGGREGATE_SECURE_CALL cell;
+
+    if (!k_RollupEnabled)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&k_RollupLock);
+
+    if (TimeStamp >= k_RollupNextSecond)
+    {
+        AdvanceRollups(TimeStamp);
+    }
+
+    cell = GetRollupCell(k_RollupSeries[0].Cells,
+                         (k_RollupPerProcess ? GetProcessNameId(ProcessId, TimeStamp) : ROLLUP_ALL_PROCESSES),
+                         SecureCallNumber);
+
+    if (cell->NameId == ROLLUP_OTHER_PROCESSES)
+    {
+        k_RollupOverflow++;
+    }
+
+    cell->Count++;
+
+    ReleaseSRWLockExclusive(&k_RollupLock);
+}
+
+/**
+*
+* @brief        Adds a timed secure call to its bucket's latency histogram.
+*               Called for every VTL 1 exit which was timed.
+* @param[in]    TimeStamp - The exit event's raw (QPC) timestamp.
+* @param[in]    ProcessId - The calling process.
+* @param[in]    SecureCallNumber - The secure call number.
+* @param[in]    Latency - The secure call's latency, in QPC ticks.
+*
+*/
+void
+RecordRollupLatency (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG ProcessId,
+    _In_ ULONG SecureCallNumber,
+    _In_ ULONGLONG Latency
+    )
+{
+    PAGGREGATE_SECURE_CALL cell;
+    uint64_t qpcFrequency;
+    uint64_t nanoseconds;
+
+    if (!k_RollupEnabled)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&k_RollupLock);
+
+    if (TimeStamp >= k_RollupNextSecond)
+    {
+        AdvanceRollups(TimeStamp);
+    }
+
+    qpcFrequency = GetSessionClock()->QpcFrequency;
+
+    nanoseconds = (((Latency / qpcFrequency) * 1000000000ULL) +
+                   (((Latency % qpcFrequency) * 1000000000ULL) / qpcFrequency));
+
+    cell = GetRollupCell(k_RollupSeries[0].Cells,
+                         (k_RollupPerProcess ? GetProcessNameId(ProcessId, TimeStamp) : ROLLUP_ALL_PROCESSES),
+                         SecureCallNumber);
+
+    if (cell->Buckets.empty())
+    {
+        cell->Buckets.assign(AGGREGATE_LATENCY_BUCKETS, 0);
+    }
+
+    cell->Latencies++;
+    cell->LatencySum += nanoseconds;
+    cell->LatencyMax = (std::max)(cell->LatencyMax, nanoseconds);
+    cell->Buckets[GetAggregateLatencyBucket(nanoseconds)]++;
+
+    ReleaseSRWLockExclusive(&k_RollupLock);
+}
+
+/**
+*
+* @brief        Closes the open buckets, prints the rollup statistics and closes
+*               the time-series file. Called on Vtl1Mon exit.
+*
+*/
+void
+StopRollups ()
+{
+    if (!k_RollupEnabled)
+    {
+        return;
+    }
+
+    if (k_RollupTimerThreadHandle != NULL)
+    {
+        SetEvent(k_RollupTimerStopEvent);
+        WaitForSingleObject(k_RollupTimerThreadHandle, INFINITE);
+
+        CloseHandle(k_RollupTimerThreadHandle);
+        CloseHandle(k_RollupTimerStopEvent);
+
+        k_RollupTimerThreadHandle = NULL;
+        k_RollupTimerStopEvent = NULL;
+    }
+
+    //
+    // Partial buckets are written too - they are the end of the trace.
+    //
+    for (ULONG i = 0; i < ROLLUP_RESOLUTIONS; i++)
+    {
+        CloseRollupBucket(i);
+    }
+
+    k_RollupEnabled = false;
+
+    wprintf(L"[+] Rollup statistics:\n");
+
+    for (ULONG i = 0; i < ROLLUP_RESOLUTIONS; i++)
+    {
+        wprintf(L"  [>] %lu second buckets: %llu (%llu rows)\n",
+                k_RollupResolutions[i],
+                k_RollupSeries[i].Buckets,
+                k_RollupSeries[i].Rows);
+    }
+
+    wprintf(L"  [>] Series: %zu (%llu secure calls counted as \"other\" processes)\n",
+            k_RollupTotals.size(),
+            k_RollupOverflow);
+
+    if (k_RollupFileHandle != INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"  [>] Time-series file: %llu KB\n", (k_RollupBytesWritten / 1024));
+
+        CloseHandle(k_RollupFileHandle);
+        k_RollupFileHandle = INVALID_HANDLE_VALUE;
+    }
+
+    if (!k_RollupPrometheusPath.empty())
+    {
+        wprintf(L"  [>] Prometheus textfile updates: %llu\n", k_RollupPrometheusUpdates);
+    }
+
+    wprintf(L"  [>] Timer advances (no secure calls for a second or more): %llu\n", k_RollupTimerAdvances);
+
+    k_RollupTotals.clear();
+    k_RollupNames.clear();
+}
\ No newline at end of file
@@ -0,0 +1,806 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/SegmentedOutput.cpp
+*
+* @summary:   Output files. Optionally compressed (-compress) and rotated by
+*             size or time (-rotatesize, -rotatetime) into segments, which
+*             are renamed into place once complete and listed in an index,
+*             so finished segments can be collected while tracing continues.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "SegmentedOutput.hpp"
+#include "Format.hpp"
+#include "Unicode.hpp"
+#include <stdio.h>
+
+//
+// Rotation limits. Zero is no limit; both zero is no rotation. Set once,
+// before any output file is created.
+//
+static ULONGLONG k_MaximumSegmentBytes = 0;
+static ULONG k_MaximumSegmentSeconds = 0;
+
+/**
+*
+* @brief        Sets when output files rotate to a new segment.
+* @param[in]    MaximumSegmentBytes - Rotate before a segment grows past this
+*                                     many (uncompressed) bytes. 0 for no limit.
+* @param[in]    MaximumSegmentSeconds - Rotate once a segment has been open this
+*                                       long. 0 for no limit.
+*
+*/
+void
+SetOutputRotation (
+    _In_ ULONGLONG MaximumSegmentBytes,
+    _In_ ULONG MaximumSegmentSeconds
+    )
+{
+    k_MaximumSegmentBytes = MaximumSegmentBytes;
+    k_MaximumSegmentSeconds = MaximumSegmentSeconds;
+}
+
+/**
+*
+* @brief        Determines if output files rotate.
+* @return       true if they do, otherwise false.
+*
+*/
+bool
+IsOutputRotationEnabled ()
+{
+    return ((k_MaximumSegmentBytes != 0) ||
+            (k_MaximumSegmentSeconds != 0));
+}
+
+/**
+*
+* @brief        Appends a FILETIME as an ISO 8601 UTC time.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Time - The time.
+*
+*/
+static
+void
+FormatIndexTime (
+    _Inout_ PFORMAT_BUFFER Buffer,
+    _In_ const FILETIME* Time
+    )
+{
+    SYSTEMTIME systemTime;
+    char timeString[32];
+    int length;
+
+    if (FileTimeToSystemTime(Time, &systemTime) == FALSE)
+    {
+        return;
+    }
+
+    length = snprintf(timeString,
+                      sizeof(timeString),
+                      "%04u-%02u-%02uT%02u:%02u:%02u.%03uZ",
+                      systemTime.wYear,
+                      systemTime.wMonth,
+                      systemTime.wDay,
+                      systemTime.wHour,
+                      systemTime.wMinute,
+                      systemTime.wSecond,
+                      systemTime.wMilliseconds);
+
+    if ((length > 0) &&
+        (length < static_cast<int>(sizeof(timeString))))
+    {
+        FormatAppend(Buffer, timeString, static_cast<size_t>(length));
+    }
+}
+
+/**
+*
+* @brief        Rewrites the segment index (UTF-8 CSV, one line per finished
+*               segment). Written aside and renamed over the old one, so a
+*               reader never sees half an index.
+* @param[in]    Output - The output.
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+WriteSegmentIndex (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    bool result;
+    FORMAT_BUFFER index;
+    std::wstring indexPath;
+    std::wstring partialPath;
+    HANDLE fileHandle;
+    const char indexHeadings[] = "SEGMENT,FIRST TIMESTAMP,LAST TIMESTAMP,EVENTS,BYTES,OPENED,CLOSED\n";
+
+    result = false;
+    fileHandle = INVALID_HANDLE_VALUE;
+
+    indexPath = Output->Stem + SEGMENT_INDEX_SUFFIX;
+    partialPath = indexPath + SEGMENT_PARTIAL_SUFFIX;
+
+    ResetFormatBuffer(&index);
+
+    FormatAppend(&index, indexHeadings, (sizeof(indexHeadings) - sizeof(char)));
+
+    for (const auto& entry : Output->Index)
+    {
+        std::string fileName;
+
+        fileName = ConvertToUtf8(entry.FileName.c_str(), entry.FileName.length());
+
+        FormatAppend(&index, fileName.data(), fileName.length());
+        FormatAppendChar(&index, ',');
+        FormatAppendDecimal(&index, entry.FirstTimeStamp);
+        FormatAppendChar(&index, ',');
+        FormatAppendDecimal(&index, entry.LastTimeStamp);
+        FormatAppendChar(&index, ',');
+        FormatAppendDecimal(&index, entry.Events);
+        FormatAppendChar(&index, ',');
+        FormatAppendDecimal(&index, entry.Bytes);
+        FormatAppendChar(&index, ',');
+        FormatIndexTime(&index, &entry.OpenTime);
+        FormatAppendChar(&index, ',');
+        FormatIndexTime(&index, &entry.CloseTime);
+        FormatAppendChar(&index, '\n');
+    }
+
+    fileHandle = CreateFileW(partialPath.c_str(),
+                             GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             0,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in WriteSegmentIndex. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    if (WriteFile(fileHandle,
+                  index.Data.data(),
+                  static_cast<DWORD>(index.Length),
+                  NULL,
+                  NULL) == FALSE)
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteSegmentIndex. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    CloseHandle(fileHandle);
+    fileHandle = INVALID_HANDLE_VALUE;
+
+    if (MoveFileExW(partialPath.c_str(),
+                    indexPath.c_str(),
+                    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == FALSE)
+    {
+        wprintf(L"[-] Error! MoveFileExW failed in WriteSegmentIndex. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    result = true;
+
+Exit:
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Opens the next segment (or, without rotation, the output file).
+* @param[in]    Output - The output.
+* @param[out]   Segment - Receives the segment.
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+OpenOutputSegment (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _Out_ std::unique_ptr<OUTPUT_SEGMENT>& Segment
+    )
+{
+    bool result;
+    wchar_t sequence[16];
+
+    result = false;
+
+    Segment.reset(new OUTPUT_SEGMENT());
+
+    Segment->FileHandle = INVALID_HANDLE_VALUE;
+    Segment->Sequence = Output->NextSequence++;
+
+    if (Output->Rotating)
+    {
+        swprintf(sequence, ARRAYSIZE(sequence), SEGMENT_SEQUENCE_FORMAT, Segment->Sequence);
+
+        Segment->FinalPath = Output->Stem + sequence + Output->Extension;
+        Segment->PartialPath = Segment->FinalPath + SEGMENT_PARTIAL_SUFFIX;
+    }
+    else
+    {
+        Segment->FinalPath = Output->Path;
+        Segment->PartialPath = Output->Path;
+    }
+
+    Segment->FileHandle = CreateFileW(Segment->PartialPath.c_str(),
+                                      GENERIC_READ | GENERIC_WRITE,
+                                      0,
+                                      NULL,
+                                      CREATE_ALWAYS,
+                                      0,
+                                      NULL);
+    if (Segment->FileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in OpenOutputSegment. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    //
+    // Each segment is a whole LZ4 frame of its own.
+    //
+    if (IsOutputCompressionEnabled())
+    {
+        Segment->Compressed.reset(new COMPRESSED_OUTPUT());
+
+        if (!StartCompressedOutput(Segment->Compressed.get(), Segment->FileHandle))
+        {
+            goto Exit;
+        }
+    }
+
+    Segment->OpenTickCount = GetTickCount64();
+    GetSystemTimeAsFileTime(&Segment->OpenTime);
+
+    result = true;
+
+Exit:
+    if (!result)
+    {
+        if (Segment->FileHandle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(Segment->FileHandle);
+        }
+
+        Segment.reset();
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Finishes a segment: drains its compressor, closes it, renames
+*               it into place and lists it in the index.
+* @param[in]    Output - The output.
+* @param[in]    Segment - The segment.
+*
+*/
+static
+void
+FinishOutputSegment (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _Inout_ POUTPUT_SEGMENT Segment
+    )
+{
+    OUTPUT_SEGMENT_INDEX_ENTRY entry;
+    const wchar_t* fileName;
+
+    if (Segment->Compressed)
+    {
+        StopCompressedOutput(Segment->Compressed.get());
+
+        AddCompressedOutputStatistics(&Output->Statistics.Compression, &Segment->Compressed->Statistics);
+
+        Segment->Compressed.reset();
+    }
+
+    CloseHandle(Segment->FileHandle);
+    Segment->FileHandle = INVALID_HANDLE_VALUE;
+
+    GetSystemTimeAsFileTime(&Segment->CloseTime);
+
+    Output->Statistics.Segments++;
+
+    if (!Output->Rotating)
+    {
+        return;
+    }
+
+    if (MoveFileExW(Segment->PartialPath.c_str(),
+                    Segment->FinalPath.c_str(),
+                    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == FALSE)
+    {
+        wprintf(L"[-] Error! MoveFileExW failed in FinishOutputSegment. (GLE: %d)\n", GetLastError());
+        Output->Statistics.RenameFailures++;
+        return;
+    }
+
+    fileName = wcsrchr(Segment->FinalPath.c_str(), L'\\');
+    fileName = ((fileName != NULL) ? (fileName + 1) : Segment->FinalPath.c_str());
+
+    entry.FileName = fileName;
+    entry.Bytes = Segment->Bytes;
+    entry.Events = Segment->Events;
+    entry.FirstTimeStamp = Segment->FirstTimeStamp;
+    entry.LastTimeStamp = Segment->LastTimeStamp;
+    entry.OpenTime = Segment->OpenTime;
+    entry.CloseTime = Segment->CloseTime;
+
+    Output->Index.push_back(std::move(entry));
+
+    if (!WriteSegmentIndex(Output))
+    {
+        Output->Statistics.IndexFailures++;
+    }
+}
+
+/**
+*
+* @brief        Rotates the current segment if it has gone past its time
+*               limit while nothing was written to it.
+* @param[in]    Output - The output.
+*
+*/
+static
+void
+RotateIdleSegment (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    AcquireSRWLockExclusive(&Output->WriterLock);
+
+    if ((Output->Segment != nullptr) &&
+        (IsSegmentRotationDue(Output, 0)))
+    {
+        Output->Statistics.IdleRotations++;
+
+        Output->RotateRoutine(Output);
+    }
+
+    ReleaseSRWLockExclusive(&Output->WriterLock);
+}
+
+/**
+*
+* @brief        Segment closer thread. Finishes segments, in order, until the
+*               output is closed and none are left. With a time limit, it also
+*               wakes up now and then to rotate a segment the writer has left
+*               idle past it.
+* @param[in]    Parameter - The output.
+* @return       ERROR_SUCCESS.
+*
+*/
+static
+DWORD
+WINAPI
+SegmentCloserThreadProc (
+    _In_ LPVOID Parameter
+    )
+{
+    PSEGMENTED_OUTPUT output;
+    std::unique_ptr<OUTPUT_SEGMENT> segment;
+    DWORD timeout;
+    bool stopping;
+
+    output = static_cast<PSEGMENTED_OUTPUT>(Parameter);
+
+    timeout = ((k_MaximumSegmentSeconds != 0) ? SEGMENT_IDLE_CHECK_INTERVAL_MS : INFINITE);
+
+    for (;;)
+    {
+        AcquireSRWLockExclusive(&output->Lock);
+
+        while ((output->ClosingSegments.empty()) &&
+               (!output->Stopping))
+        {
+            if (SleepConditionVariableSRW(&output->SegmentQueued, &output->Lock, timeout, 0) == FALSE)
+            {
+                //
+                // Timed out.
+                //
+                break;
+            }
+        }
+
+        if (output->ClosingSegments.empty())
+        {
+            stopping = output->Stopping;
+
+            ReleaseSRWLockExclusive(&output->Lock);
+
+            if (stopping)
+            {
+                break;
+            }
+
+            //
+            // The writer's lock comes before ours.
+            //
+            RotateIdleSegment(output);
+            continue;
+        }
+
+        segment = std::move(output->ClosingSegments.front());
+        output->ClosingSegments.pop_front();
+
+        ReleaseSRWLockExclusive(&output->Lock);
+
+        FinishOutputSegment(output, segment.get());
+
+        segment.reset();
+    }
+
+    return ERROR_SUCCESS;
+}
+
+/**
+*
+* @brief        Opens an output file: the file itself, or with rotation
+*               on, its first segment.
+* @param[in]    Output - The output.
+* @param[in]    FilePath - The user-provided path.
+* @param[in]    RotateRoutine - The owner's rotation routine.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+OpenSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _In_ const wchar_t* FilePath,
+    _In_ PSEGMENT_ROTATE_ROUTINE RotateRoutine
+    )
+{
+    bool result;
+    const wchar_t* fileName;
+    const wchar_t* extension;
+
+    result = false;
+
+    Output->Path = FilePath;
+    Output->Rotating = IsOutputRotationEnabled();
+    Output->NextSequence = 1;
+    Output->RotateRoutine = RotateRoutine;
+    Output->CloserThreadHandle = NULL;
+    Output->Stopping = false;
+    Output->Index.clear();
+
+    RtlZeroMemory(&Output->Statistics, sizeof(Output->Statistics));
+
+    //
+    // "C:\Out\Trace.csv" rotates to "C:\Out\Trace.000001.csv" and so on.
+    //
+    fileName = wcsrchr(FilePath, L'\\');
+    fileName = ((fileName != NULL) ? (fileName + 1) : FilePath);
+
+    extension = wcsrchr(fileName, L'.');
+    extension = ((extension != NULL) ? extension : (fileName + wcslen(fileName)));
+
+    Output->Stem.assign(FilePath, extension);
+    Output->Extension = extension;
+
+    if (!OpenOutputSegment(Output, Output->Segment))
+    {
+        goto Exit;
+    }
+
+    if (Output->Rotating)
+    {
+        InitializeSRWLock(&Output->WriterLock);
+        InitializeSRWLock(&Output->Lock);
+        InitializeConditionVariable(&Output->SegmentQueued);
+
+        Output->CloserThreadHandle = CreateThread(NULL,
+                                                  0,
+                                                  SegmentCloserThreadProc,
+                                                  Output,
+                                                  0,
+                                                  NULL);
+        if (Output->CloserThreadHandle == NULL)
+        {
+            wprintf(L"[-] Error! CreateThread failed in OpenSegmentedOutput. (GLE: %d)\n", GetLastError());
+
+            FinishOutputSegment(Output, Output->Segment.get());
+            Output->Segment.reset();
+            goto Exit;
+        }
+    }
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Determines if an output file is open.
+* @param[in]    Output - The output.
+* @return       true if it is, otherwise false.
+*
+*/
+bool
+IsSegmentedOutputOpen (
+    _In_ const SEGMENTED_OUTPUT* Output
+    )
+{
+    return (Output->Segment != nullptr);
+}
+
+/**
+*
+* @brief        Takes the output for a record (and any rotation before it), so
+*               the closer thread does not rotate underneath the writer.
+*               Nothing to take without rotation.
+* @param[in]    Output - The output.
+*
+*/
+void
+AcquireSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    if (Output->Rotating)
+    {
+        AcquireSRWLockExclusive(&Output->WriterLock);
+    }
+}
+
+/**
+*
+* @brief        Gives back the output taken by AcquireSegmentedOutput.
+* @param[in]    Output - The output.
+*
+*/
+void
+ReleaseSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    if (Output->Rotating)
+    {
+        ReleaseSRWLockExclusive(&Output->WriterLock);
+    }
+}
+
+/**
+*
+* @brief        Writes to the current segment.
+* @param[in]    Output - The output.
+* @param[in]    Data - The data.
+* @param[in]    Length - The number of bytes.
+* @return       true on success, otherwise false (see GetLastError).
+*
+*/
+bool
+WriteSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _In_ const void* Data,
+    _In_ SIZE_T Length
+    )
+{
+    POUTPUT_SEGMENT segment;
+
+    segment = Output->Segment.get();
+
+    if (segment->Compressed)
+    {
+        WriteCompressedOutput(segment->Compressed.get(), Data, Length);
+    }
+    else if (WriteFile(segment->FileHandle,
+                       Data,
+                       static_cast<DWORD>(Length),
+                       NULL,
+                       NULL) == FALSE)
+    {
+        return false;
+    }
+
+    segment->Bytes += Length;
+
+    return true;
+}
+
+/**
+*
+* @brief        Counts a correlated event in the current segment's time range.
+* @param[in]    Output - The output.
+* @param[in]    TimeStamp - The event's (QPC) timestamp.
+*
+*/
+void
+NoteSegmentedOutputEvent (
+    _Inout_ PSEGMENTED_OUTPUT Output,
+    _In_ ULONGLONG TimeStamp
+    )
+{
+    POUTPUT_SEGMENT segment;
+
+    segment = Output->Segment.get();
+
+    if (segment->Events == 0)
+    {
+        segment->FirstTimeStamp = TimeStamp;
+    }
+
+    segment->LastTimeStamp = TimeStamp;
+    segment->Events++;
+}
+
+/**
+*
+* @brief        Determines if the current segment should be rotated before
+*               writing more. Checked at record boundaries only, so records
+*               are never split. Time-based rotation happens at the first
+*               record after the interval or, if none comes, on the closer
+*               thread's next idle check.
+* @param[in]    Output - The output.
+* @param[in]    PendingBytes - Bytes about to be written.
+* @return       true if it is time to rotate, otherwise false.
+*
+*/
+bool
+IsSegmentRotationDue (
+    _In_ const SEGMENTED_OUTPUT* Output,
+    _In_ SIZE_T PendingBytes
+    )
+{
+    const OUTPUT_SEGMENT* segment;
+
+    if (!Output->Rotating)
+    {
+        return false;
+    }
+
+    segment = Output->Segment.get();
+
+    //
+    // A segment always gets at least one event, however large.
+    //
+    if (segment->Events == 0)
+    {
+        return false;
+    }
+
+    if ((k_MaximumSegmentBytes != 0) &&
+        ((segment->Bytes + PendingBytes) > k_MaximumSegmentBytes))
+    {
+        return true;
+    }
+
+    if ((k_MaximumSegmentSeconds != 0) &&
+        ((GetTickCount64() - segment->OpenTickCount) >= (static_cast<ULONGLONG>(k_MaximumSegmentSeconds) * 1000)))
+    {
+        return true;
+    }
+
+    return false;
+}
+
+/**
+*
+* @brief        Starts a new segment and hands the current one to the closer
+*               thread. The writer only pays for opening the next file. The
+*               caller writes the new segment's headings (if any).
+* @param[in]    Output - The output.
+* @return       true if a new segment was started, otherwise false (the
+*               current segment carries on).
+*
+*/
+bool
+RotateSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    bool result;
+    std::unique_ptr<OUTPUT_SEGMENT> segment;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    result = false;
+
+    QueryPerformanceCounter(&start);
+
+    if (!OpenOutputSegment(Output, segment))
+    {
+        Output->Statistics.OpenFailures++;
+        goto Exit;
+    }
+
+    Output->Segment.swap(segment);
+
+    AcquireSRWLockExclusive(&Output->Lock);
+    Output->ClosingSegments.push_back(std::move(segment));
+    ReleaseSRWLockExclusive(&Output->Lock);
+
+    WakeConditionVariable(&Output->SegmentQueued);
+
+    result = true;
+
+Exit:
+    QueryPerformanceCounter(&end);
+
+    Output->Statistics.RotateTicks += (end.QuadPart - start.QuadPart);
+
+    return result;
+}
+
+/**
+*
+* @brief        Closes an output file: finishes the current segment, waits for
+*               the closer thread and prints statistics.
+* @param[in]    Output - The output.
+*
+*/
+void
+CloseSegmentedOutput (
+    _Inout_ PSEGMENTED_OUTPUT Output
+    )
+{
+    LARGE_INTEGER frequency;
+    bool compressed;
+
+    if (!IsSegmentedOutputOpen(Output))
+    {
+        return;
+    }
+
+    compressed = (Output->Segment->Compressed != nullptr);
+
+    if (Output->Rotating)
+    {
+        AcquireSRWLockExclusive(&Output->WriterLock);
+        AcquireSRWLockExclusive(&Output->Lock);
+        Output->ClosingSegments.push_back(std::move(Output->Segment));
+        Output->Stopping = true;
+        ReleaseSRWLockExclusive(&Output->Lock);
+        ReleaseSRWLockExclusive(&Output->WriterLock);
+
+        WakeConditionVariable(&Output->SegmentQueued);
+
+        WaitForSingleObject(Output->CloserThreadHandle, INFINITE);
+
+        CloseHandle(Output->CloserThreadHandle);
+        Output->CloserThreadHandle = NULL;
+    }
+    else
+    {
+        FinishOutputSegment(Output, Output->Segment.get());
+    }
+
+    Output->Segment.reset();
+
+    if (compressed)
+    {
+        PrintCompressedOutputStatistics(&Output->Statistics.Compression);
+    }
+
+    if (Output->Rotating)
+    {
+        QueryPerformanceFrequency(&frequency);
+
+        wprintf(L"[+] Output rotation statistics:\n");
+        wprintf(L"  [>] Segments: %llu\n", Output->Statistics.Segments);
+        wprintf(L"  [>] Rotation time (writer): %.2f ms\n", (static_cast<double>(Output->Statistics.RotateTicks) * 1e3 / frequency.QuadPart));
+        wprintf(L"  [>] Idle rotations: %llu\n", Output->Statistics.IdleRotations);
+        wprintf(L"  [>] Open failures: %llu\n", Output->Statistics.OpenFailures);
+        wprintf(L"  [>] Rename failures: %llu\n", Output->Statistics.RenameFailures);
+        wprintf(L"  [>] Index failures: %llu\n", Output->Statistics.IndexFailures);
+        wprintf(L"  [>] Index: %s%s\n", Output->Stem.c_str(), SEGMENT_INDEX_SUFFIX);
+    }
+
+    Output->Index.clear();
+}
\ No newline at end of file
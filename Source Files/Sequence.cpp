@@ -0,0 +1,521 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Sequence.cpp
+*
+* @summary:   Secure call sequence mining. Every thread's secure calls are
+*             strung into sequences of 2 to 4 (a gap longer than the limit
+*             starts over) and the most common sequences of each length are
+*             counted with Space-Saving, in fixed memory. Each keeps an example
+*             stack of the call which ended it, to show what the sequence is.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Sequence.hpp"
+#include <algorithm>
+
+#ifdef _WIN32
+#include "Helpers.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Format.hpp"
+#include <stdio.h>
+#endif
+
+/**
+*
+* @brief        Sets a miner up. All of its memory is allocated here.
+* @param[in]    Miner - The miner.
+* @param[in]    Capacity - Counters per sequence length.
+* @param[in]    GapTicks - The longest gap between calls of a sequence, in timestamp ticks.
+*
+*/
+void
+InitializeSequenceMiner (
+    _Inout_ PSEQUENCE_MINER Miner,
+    _In_ uint32_t Capacity,
+    _In_ uint64_t GapTicks
+    )
+{
+    SEQUENCE_THREAD thread;
+
+    memset(&thread, 0, sizeof(thread));
+
+    Miner->Threads.assign(SEQUENCE_THREAD_SLOTS, thread);
+
+    for (uint32_t i = 0; i < SEQUENCE_LENGTHS; i++)
+    {
+        InitializeTopKTracker(&Miner->Trackers[i], Capacity);
+    }
+
+    Miner->GapTicks = GapTicks;
+    Miner->Calls = 0;
+    Miner->Gaps = 0;
+    Miner->Evictions = 0;
+}
+
+/**
+*
+* @brief        Gets a thread's slot. A thread can be in either slot of a pair;
+*               a thread in neither gets the one used least recently.
+* @param[in]    Miner - The miner.
+* @param[in]    ThreadId - The thread ID.
+* @return       The slot (which may hold another thread).
+*
+*/
+static
+PSEQUENCE_THREAD
+GetSequenceThread (
+    _In_ PSEQUENCE_MINER Miner,
+    _In_ uint32_t ThreadId
+    )
+{
+    PSEQUENCE_THREAD pair;
+
+    pair = &Miner->Threads[HashTopKKey(0, ThreadId) & (SEQUENCE_THREAD_SLOTS - 2)];
+
+    if (pair[0].ThreadId == ThreadId)
+    {
+        return &pair[0];
+    }
+
+    if (pair[1].ThreadId == ThreadId)
+    {
+        return &pair[1];
+    }
+
+    return ((pair[0].LastTimeStamp <= pair[1].LastTimeStamp) ? &pair[0] : &pair[1]);
+}
+
+/**
+*
+* @brief        Counts a secure call: every sequence it ends on its thread (one per
+*               length the thread's history allows) is offered to that length's
+*               tracker.
+* @param[in]    Miner - The miner.
+* @param[in]    ThreadId - The calling thread.
+* @param[in]    TimeStamp - The VTL 1 enter timestamp.
+* @param[in]    SecureCallNumber - The secure call number.
+*
+*/
+void
+CountSequenceCall (
+    _Inout_ PSEQUENCE_MINER Miner,
+    _In_ uint32_t ThreadId,
+    _In_ uint64_t TimeStamp,
+    _In_ uint16_t SecureCallNumber
+    )
+{
+    PSEQUENCE_THREAD thread;
+    PTOP_K_ENTRY entry;
+    uint64_t key;
+    uint32_t length;
+    bool claimed;
+
+    Miner->Calls++;
+
+    thread = GetSequenceThread(Miner, ThreadId);
+
+    if (thread->ThreadId != ThreadId)
+    {
+        if (thread->LastTimeStamp != 0)
+        {
+            Miner->Evictions++;
+        }
+
+        thread->ThreadId = ThreadId;
+        thread->Length = 0;
+    }
+    else if ((thread->Length != 0) &&
+             (TimeStamp > thread->LastTimeStamp) &&
+             ((TimeStamp - thread->LastTimeStamp) > Miner->GapTicks))
+    {
+        Miner->Gaps++;
+
+        thread->Length = 0;
+    }
+
+    thread->LastTimeStamp = TimeStamp;
+    thread->PendingTimeStamp = TimeStamp;
+
+    //
+    // Newest call last in the key, so walking back through the history
+    // extends the sequence one call further into the past each time.
+    //
+    key = SecureCallNumber;
+
+    for (uint32_t i = 0; i < SEQUENCE_LENGTHS; i++)
+    {
+        thread->PendingEntries[i] = NULL;
+
+        length = (i + SEQUENCE_MIN_LENGTH);
+
+        if (thread->Length < (length - 1))
+        {
+            continue;
+        }
+
+        key |= (static_cast<uint64_t>(thread->Calls[thread->Length - (length - 1)]) << (16 * (length - 1)));
+
+        entry = OfferTopKKey(&Miner->Trackers[i], key, 1, &claimed);
+
+        //
+        // A counter new to the sequence wants an example.
+        //
+        if (claimed)
+        {
+            entry->Sample.NumberOfFrames = 0;
+        }
+
+        if (entry->Sample.NumberOfFrames == 0)
+        {
+            thread->PendingEntries[i] = entry;
+            thread->PendingKeys[i] = key;
+        }
+    }
+
+    //
+    // Remember the call, dropping the oldest if the history is full.
+    //
+    if (thread->Length == (SEQUENCE_MAX_LENGTH - 1))
+    {
+        for (uint32_t i = 1; i < (SEQUENCE_MAX_LENGTH - 1); i++)
+        {
+            thread->Calls[i - 1] = thread->Calls[i];
+        }
+
+        thread->Length--;
+    }
+
+    thread->Calls[thread->Length++] = SecureCallNumber;
+}
+
+/**
+*
+* @brief        Gets the sequences a call ended which still want an example stack,
+*               once its stack is correlated. Each is only handed out once.
+* @param[in]    Miner - The miner.
+* @param[in]    ThreadId - The calling thread.
+* @param[in]    TimeStamp - The call's VTL 1 enter timestamp.
+* @param[out]   Entries - Receives the entries (up to SEQUENCE_LENGTHS).
+* @return       The number of entries.
+*
+*/
+uint32_t
+TakeSequencePending (
+    _Inout_ PSEQUENCE_MINER Miner,
+    _In_ uint32_t ThreadId,
+    _In_ uint64_t TimeStamp,
+    _Out_ PTOP_K_ENTRY* Entries
+    )
+{
+    PSEQUENCE_THREAD thread;
+    uint32_t count;
+
+    count = 0;
+
+    thread = GetSequenceThread(Miner, ThreadId);
+
+    //
+    // The thread has moved on (or lost its slot) if this is not its last call.
+    //
+    if ((thread->ThreadId != ThreadId) ||
+        (thread->PendingTimeStamp != TimeStamp))
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < SEQUENCE_LENGTHS; i++)
+    {
+        //
+        // The counter may have been taken over by another sequence since.
+        //
+        if ((thread->PendingEntries[i] != NULL) &&
+            (thread->PendingEntries[i]->Key == thread->PendingKeys[i]))
+        {
+            Entries[count++] = thread->PendingEntries[i];
+        }
+
+        thread->PendingEntries[i] = NULL;
+    }
+
+    return count;
+}
+
+/**
+*
+* @brief        Gets one secure call of a sequence.
+* @param[in]    Key - The sequence's key.
+* @param[in]    Length - The sequence's length.
+* @param[in]    Index - Which call (0 is the first).
+* @return       The secure call number.
+*
+*/
+uint16_t
+GetSequenceCall (
+    _In_ uint64_t Key,
+    _In_ uint32_t Length,
+    _In_ uint32_t Index
+    )
+{
+    return static_cast<uint16_t>(Key >> (16 * (Length - 1 - Index)));
+}
+
+#ifdef _WIN32
+//
+// The live miner. Only the ETW processing thread touches it.
+//
+static SEQUENCE_MINER k_SequenceMiner;
+static bool k_SequenceMiningEnabled = false;
+static uint32_t k_SequenceCapacity = 0;
+static ULONG k_SequenceGapMs = 0;
+static ULONGLONG k_SequenceExamples = 0;
+static FORMAT_BUFFER k_SequenceBuffer;
+
+/**
+*
+* @brief        Turns on sequence mining.
+* @param[in]    Capacity - Counters per sequence length. 0 turns mining off.
+* @param[in]    GapMs - The longest gap between calls of a sequence, in milliseconds.
+*
+*/
+void
+SetSequenceMining (
+    _In_ uint32_t Capacity,
+    _In_ ULONG GapMs
+    )
+{
+    k_SequenceCapacity = Capacity;
+    k_SequenceMiningEnabled = (Capacity != 0);
+
+    if (!k_SequenceMiningEnabled)
+    {
+        return;
+    }
+
+    InitializeSequenceMiner(&k_SequenceMiner,
+                            Capacity,
+                            0);
+
+    k_SequenceGapMs = GapMs;
+}
+
+/**
+*
+* @brief        Converts the gap to ticks of the event timestamps.
+* @param[in]    QpcFrequency - The session clock's QPC frequency.
+*
+*/
+void
+SetSequenceQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    )
+{
+    k_SequenceMiner.GapTicks = ((QpcFrequency * k_SequenceGapMs) / 1000);
+}
+
+/**
+*
+* @brief        Determines if sequence mining is on.
+* @return       true if it is, otherwise false.
+*
+*/
+bool
+IsSequenceMiningEnabled ()
+{
+    return k_SequenceMiningEnabled;
+}
+
+/**
+*
+* @brief        Counts a secure call. Called for every VTL 1 enter, before it is
+*               correlated, so sequences do not depend on stack walks.
+* @param[in]    TimeStamp - The event's raw (QPC) timestamp.
+* @param[in]    ThreadId - The calling thread.
+* @param[in]    SecureCallNumber - The secure call number.
+*
+*/
+void
+RecordSequenceSecureCall (
+    _In_ ULONGLONG TimeStamp,
+    _In_ ULONG ThreadId,
+    _In_ ULONG SecureCallNumber
+    )
+{
+    if (!k_SequenceMiningEnabled)
+    {
+        return;
+    }
+
+    CountSequenceCall(&k_SequenceMiner,
+                      ThreadId,
+                      TimeStamp,
+                      static_cast<uint16_t>(SecureCallNumber));
+}
+
+/**
+*
+* @brief        Gives the sequences a correlated event ended its stack, if they
+*               do not have an example yet.
+* @param[in]    Vtl1Data - The "primal" VTL 1 enter event data.
+* @param[in]    CallStack - The raw list of stack frame addresses.
+* @param[in]    NumberOfFrames - The number of stack frames.
+*
+*/
+void
+TrackSequenceEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    PTOP_K_ENTRY entries[SEQUENCE_LENGTHS];
+    uint32_t count;
+
+    if (NumberOfFrames == 0)
+    {
+        return;
+    }
+
+    count = TakeSequencePending(&k_SequenceMiner,
+                                Vtl1Data->ThreadId,
+                                static_cast<uint64_t>(Vtl1Data->Vtl1EnterTime),
+                                entries);
+
+    NumberOfFrames = (std::min)(NumberOfFrames, static_cast<ULONG>(TOP_K_MAX_SAMPLE_FRAMES));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        entries[i]->Sample.ProcessId = Vtl1Data->ProcessId;
+        entries[i]->Sample.ProcessNameId = Vtl1Data->ProcessNameId;
+        entries[i]->Sample.SecureCallNumber = Vtl1Data->SecureCallNumber;
+        entries[i]->Sample.NumberOfFrames = static_cast<uint16_t>(NumberOfFrames);
+
+        for (ULONG j = 0; j < NumberOfFrames; j++)
+        {
+            entries[i]->Sample.Frames[j] = CallStack[j];
+        }
+
+        k_SequenceExamples++;
+    }
+}
+
+/**
+*
+* @brief        Prints the most common sequences of every length, each with the
+*               example stack of the call which ended it.
+*
+*/
+static
+void
+ReportSequences ()
+{
+    std::vector<const TOP_K_ENTRY*> entries;
+
+    for (uint32_t i = 0; i < SEQUENCE_LENGTHS; i++)
+    {
+        const TOP_K_TRACKER* tracker;
+        uint32_t length;
+
+        tracker = &k_SequenceMiner.Trackers[i];
+        length = (i + SEQUENCE_MIN_LENGTH);
+
+        GetTopKEntries(tracker, TOP_K_REPORT_ENTRIES, entries);
+
+        wprintf(L"[+] Top sequences of %lu secure calls (%llu sequences, %lu counters, %llu replaced, error <= %llu):\n",
+                length,
+                tracker->Total,
+                tracker->Capacity,
+                tracker->Replacements,
+                (tracker->Total / tracker->Capacity));
+
+        for (const TOP_K_ENTRY* entry : entries)
+        {
+            ResetFormatBuffer(&k_SequenceBuffer);
+
+            FormatAppendPrintf(&k_SequenceBuffer, "  [>] %llu (+/- %llu) ", entry->Count, entry->Error);
+
+            for (uint32_t j = 0; j < length; j++)
+            {
+                uint16_t secureCallNumber;
+
+                secureCallNumber = GetSequenceCall(entry->Key, length, j);
+
+                FormatAppendPrintf(&k_SequenceBuffer,
+                                   "%s%s (%u)",
+                                   ((j != 0) ? " -> " : ""),
+                                   GetSecureCallName(secureCallNumber),
+                                   secureCallNumber);
+            }
+
+            if (entry->Sample.NumberOfFrames != 0)
+            {
+                FormatAppendPrintf(&k_SequenceBuffer, ", e.g. in %s:", GetInternedName(entry->Sample.ProcessNameId));
+            }
+
+            FormatAppendChar(&k_SequenceBuffer, '\n');
+
+            for (uint32_t j = 0; j < entry->Sample.NumberOfFrames; j++)
+            {
+                FormatAppend(&k_SequenceBuffer, "        ", 8);
+
+                FormatVtl1Frame(&k_SequenceBuffer, static_cast<ULONG_PTR>(entry->Sample.Frames[j]), '\n');
+            }
+
+            FormatAppendChar(&k_SequenceBuffer, '\0');
+
+            wprintf(L"%hs", k_SequenceBuffer.Data.data());
+        }
+    }
+}
+
+/**
+*
+* @brief        Prints the final report and frees the miner. Called on Vtl1Mon
+*               exit, while symbols and the name caches are still around.
+*
+*/
+void
+StopSequenceMining ()
+{
+    if (!k_SequenceMiningEnabled)
+    {
+        return;
+    }
+
+    ReportSequences();
+
+    wprintf(L"[+] Sequence statistics:\n");
+    wprintf(L"  [>] Secure calls: %llu (%llu sequences broken by a gap over %lu ms, %llu thread histories evicted)\n",
+            k_SequenceMiner.Calls,
+            k_SequenceMiner.Gaps,
+            k_SequenceGapMs,
+            k_SequenceMiner.Evictions);
+    wprintf(L"  [>] Example stacks taken: %llu\n", k_SequenceExamples);
+    wprintf(L"  [>] Memory: %llu KB (%lu counters per length, %d thread slots)\n",
+            (((SEQUENCE_LENGTHS * ((k_SequenceCapacity * (sizeof(TOP_K_ENTRY) + sizeof(uint32_t))) +
+                                   (k_SequenceMiner.Trackers[0].Slots.size() * sizeof(uint32_t)))) +
+              (SEQUENCE_THREAD_SLOTS * sizeof(SEQUENCE_THREAD))) / 1024),
+            k_SequenceCapacity,
+            SEQUENCE_THREAD_SLOTS);
+
+    k_SequenceMiningEnabled = false;
+
+    for (auto& tracker : k_SequenceMiner.Trackers)
+    {
+        tracker.Entries.clear();
+        tracker.Entries.shrink_to_fit();
+        tracker.Heap.clear();
+        tracker.Heap.shrink_to_fit();
+        tracker.Slots.clear();
+        tracker.Slots.shrink_to_fit();
+    }
+
+    k_SequenceMiner.Threads.clear();
+    k_SequenceMiner.Threads.shrink_to_fit();
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,470 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/SymbolCache.cpp
+*
+* @summary:   On-disk symbol table cache. Each module's symbols are extracted
+*             once into a sorted RVA -> name table, which later runs map and
+*             binary search instead of going back to the PDB.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "SymbolCache.hpp"
+#include <algorithm>
+#include <stdio.h>
+
+/**
+*
+* @brief        Builds the cache file path for a module.
+* @param[in]    Key - The module identity.
+* @return       The full path of the module's table.
+*
+*/
+static
+std::wstring
+GetSymbolTablePath (
+    _In_ const SYMBOL_TABLE_KEY* Key
+    )
+{
+    std::wstring tablePath;
+    wchar_t identity[32];
+
+    RtlZeroMemory(&identity, sizeof(identity));
+
+    //
+    // Same shape as the symbol server's image key: timestamp, then
+    // checksum, then size.
+    //
+    swprintf(identity,
+             ARRAYSIZE(identity),
+             L"-%08X%08X%X.vsym",
+             Key->TimeDateStamp,
+             Key->ImageChecksum,
+             Key->ImageSize);
+
+    tablePath.append(SYMBOL_CACHE_DIRECTORY);
+    tablePath.append(L"\\");
+    tablePath.append(Key->ImageName);
+    tablePath.append(identity);
+
+    return tablePath;
+}
+
+/**
+*
+* @brief        Maps a module's cached symbol table, if one exists.
+* @param[in]    Key - The module identity.
+* @param[out]   Table - The mapped table.
+* @return       true if a valid table was mapped, otherwise false.
+*
+*/
+bool
+OpenSymbolTable (
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Out_ PSYMBOL_TABLE Table
+    )
+{
+    bool result;
+    HANDLE fileHandle;
+    LARGE_INTEGER fileSize;
+    const UCHAR* view;
+    const SYMBOL_TABLE_HEADER* header;
+    ULONGLONG expectedSize;
+
+    result = false;
+    fileHandle = INVALID_HANDLE_VALUE;
+    view = NULL;
+    header = NULL;
+    expectedSize = 0;
+
+    RtlZeroMemory(Table, sizeof(*Table));
+    RtlZeroMemory(&fileSize, sizeof(fileSize));
+
+    fileHandle = CreateFileW(GetSymbolTablePath(Key).c_str(),
+                             GENERIC_READ,
+                             FILE_SHARE_READ,
+                             NULL,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        //
+        // Cold - not an error.
+        //
+        goto Exit;
+    }
+
+    if ((GetFileSizeEx(fileHandle, &fileSize) == FALSE) ||
+        (fileSize.QuadPart < static_cast<LONGLONG>(sizeof(SYMBOL_TABLE_HEADER))))
+    {
+        goto Exit;
+    }
+
+    Table->MappingHandle = CreateFileMappingW(fileHandle,
+                                              NULL,
+                                              PAGE_READONLY,
+                                              0,
+                                              0,
+                                              NULL);
+    if (Table->MappingHandle == NULL)
+    {
+        wprintf(L"[-] Error! CreateFileMappingW failed in OpenSymbolTable. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    view = static_cast<const UCHAR*>(MapViewOfFile(Table->MappingHandle,
+                                                   FILE_MAP_READ,
+                                                   0,
+                                                   0,
+                                                   0));
+    if (view == NULL)
+    {
+        wprintf(L"[-] Error! MapViewOfFile failed in OpenSymbolTable. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    header = reinterpret_cast<const SYMBOL_TABLE_HEADER*>(view);
+
+    //
+    // Never trust the file - a stale, truncated or foreign table is
+    // treated exactly like a missing one.
+    //
+    if ((header->Magic != SYMBOL_TABLE_MAGIC) ||
+        (header->Version != SYMBOL_TABLE_VERSION) ||
+        (header->TimeDateStamp != Key->TimeDateStamp) ||
+        (header->ImageChecksum != Key->ImageChecksum) ||
+        (header->ImageSize != Key->ImageSize))
+    {
+        goto Exit;
+    }
+
+    expectedSize = (sizeof(SYMBOL_TABLE_HEADER) +
+                    (static_cast<ULONGLONG>(header->SymbolCount) * sizeof(SYMBOL_TABLE_ENTRY)) +
+                    header->StringTableSize);
+
+    if ((expectedSize != static_cast<ULONGLONG>(fileSize.QuadPart)) ||
+        (header->StringTableSize == 0))
+    {
+        goto Exit;
+    }
+
+    Table->Header = header;
+    Table->Entries = reinterpret_cast<const SYMBOL_TABLE_ENTRY*>(view + sizeof(SYMBOL_TABLE_HEADER));
+    Table->Strings = reinterpret_cast<const char*>(Table->Entries + header->SymbolCount);
+    Table->StringCount = header->StringTableSize;
+
+    //
+    // The last name must be terminated inside the table.
+    //
+    if (Table->Strings[Table->StringCount - 1] != '\0')
+    {
+        goto Exit;
+    }
+
+    result = true;
+
+Exit:
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        //
+        // The mapping keeps the file alive.
+        //
+        CloseHandle(fileHandle);
+    }
+
+    if (!result)
+    {
+        if (view != NULL)
+        {
+            UnmapViewOfFile(view);
+        }
+
+        if (Table->MappingHandle != NULL)
+        {
+            CloseHandle(Table->MappingHandle);
+        }
+
+        RtlZeroMemory(Table, sizeof(*Table));
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Writes a module's symbols out as a sorted table. The table is written
+*               to a temporary file first and renamed into place, so a reader never
+*               maps a partially written table.
+* @param[in]    Key - The module identity.
+* @param[in]    Records - The module's symbols. Sorted (by RVA) in place.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+WriteSymbolTable (
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Inout_ std::vector<SYMBOL_TABLE_RECORD>& Records
+    )
+{
+    bool result;
+    HANDLE fileHandle;
+    SYMBOL_TABLE_HEADER header;
+    std::vector<SYMBOL_TABLE_ENTRY> entries;
+    std::vector<char> strings;
+    std::wstring tablePath;
+    std::wstring temporaryPath;
+    DWORD bytesWritten;
+
+    result = false;
+    fileHandle = INVALID_HANDLE_VALUE;
+    bytesWritten = 0;
+
+    RtlZeroMemory(&header, sizeof(header));
+
+    if (Records.empty())
+    {
+        goto Exit;
+    }
+
+    //
+    // Sort by RVA. Where several names share an address (e.g. a function
+    // and its public), the first one reported wins.
+    //
+    std::stable_sort(Records.begin(),
+                     Records.end(),
+                     [](const SYMBOL_TABLE_RECORD& Left, const SYMBOL_TABLE_RECORD& Right)
+                     {
+                         return Left.Rva < Right.Rva;
+                     });
+
+    entries.reserve(Records.size());
+
+    for (const auto& record : Records)
+    {
+        SYMBOL_TABLE_ENTRY entry;
+
+        if ((!entries.empty()) &&
+            (entries.back().Rva == record.Rva))
+        {
+            continue;
+        }
+
+        entry.Rva = record.Rva;
+        entry.NameOffset = static_cast<ULONG>(strings.size());
+
+        strings.insert(strings.end(), record.Name.begin(), record.Name.end());
+        strings.push_back('\0');
+
+        entries.push_back(entry);
+    }
+
+    header.Magic = SYMBOL_TABLE_MAGIC;
+    header.Version = SYMBOL_TABLE_VERSION;
+    header.TimeDateStamp = Key->TimeDateStamp;
+    header.ImageChecksum = Key->ImageChecksum;
+    header.ImageSize = Key->ImageSize;
+    header.SymbolCount = static_cast<ULONG>(entries.size());
+    header.StringTableSize = static_cast<ULONG>(strings.size());
+
+    //
+    // Both may already exist.
+    //
+    CreateDirectoryW(L"C:\\Symbols", NULL);
+    CreateDirectoryW(SYMBOL_CACHE_DIRECTORY, NULL);
+
+    tablePath = GetSymbolTablePath(Key);
+    temporaryPath = (tablePath + L".tmp");
+
+    fileHandle = CreateFileW(temporaryPath.c_str(),
+                             GENERIC_WRITE,
+                             0,
+                             NULL,
+                             CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL,
+                             NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in WriteSymbolTable. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    if ((WriteFile(fileHandle,
+                   &header,
+                   sizeof(header),
+                   &bytesWritten,
+                   NULL) == FALSE) ||
+        (WriteFile(fileHandle,
+                   entries.data(),
+                   static_cast<DWORD>(entries.size() * sizeof(SYMBOL_TABLE_ENTRY)),
+                   &bytesWritten,
+                   NULL) == FALSE) ||
+        (WriteFile(fileHandle,
+                   strings.data(),
+                   header.StringTableSize,
+                   &bytesWritten,
+                   NULL) == FALSE))
+    {
+        wprintf(L"[-] Error! WriteFile failed in WriteSymbolTable. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    CloseHandle(fileHandle);
+    fileHandle = INVALID_HANDLE_VALUE;
+
+    if (MoveFileExW(temporaryPath.c_str(),
+                    tablePath.c_str(),
+                    MOVEFILE_REPLACE_EXISTING) == FALSE)
+    {
+        wprintf(L"[-] Error! MoveFileExW failed in WriteSymbolTable. (GLE: %d)\n", GetLastError());
+        goto Exit;
+    }
+
+    result = true;
+
+Exit:
+    if (fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(fileHandle);
+    }
+
+    if ((!result) &&
+        (!temporaryPath.empty()))
+    {
+        DeleteFileW(temporaryPath.c_str());
+    }
+
+    return result;
+}
+
+/**
+*
+* @brief        Finds the symbol containing an RVA.
+* @param[in]    Table - The mapped table.
+* @param[in]    Rva - The RVA to resolve.
+* @param[out]   Displacement - The offset of the RVA from the symbol.
+* @return       The (UTF-8) symbol name, or NULL if the RVA precedes every symbol.
+*
+*/
+const char*
+LookupSymbolTable (
+    _In_ const SYMBOL_TABLE* Table,
+    _In_ ULONG Rva,
+    _Out_ ULONG* Displacement
+    )
+{
+    const SYMBOL_TABLE_ENTRY* first;
+    const SYMBOL_TABLE_ENTRY* last;
+    const SYMBOL_TABLE_ENTRY* entry;
+
+    *Displacement = 0;
+
+    first = Table->Entries;
+    last = (Table->Entries + Table->Header->SymbolCount);
+
+    //
+    // The last symbol at or below the RVA.
+    //
+    entry = std::upper_bound(first,
+                             last,
+                             Rva,
+                             [](ULONG Value, const SYMBOL_TABLE_ENTRY& Entry)
+                             {
+                                 return Value < Entry.Rva;
+                             });
+    if (entry == first)
+    {
+        return NULL;
+    }
+
+    --entry;
+
+    if (entry->NameOffset >= Table->StringCount)
+    {
+        return NULL;
+    }
+
+    *Displacement = (Rva - entry->Rva);
+
+    return (Table->Strings + entry->NameOffset);
+}
+
+/**
+*
+* @brief        Resolves a batch of RVAs from the same module with one forward sweep
+*               over the table, instead of a full binary search per address. Names
+*               are returned as offsets into Table->Strings.
+* @param[in]    Table - The mapped table.
+* @param[in]    Batch - The RVAs to resolve. Sorted by RVA on return.
+* @param[in]    Count - The number of entries in the batch.
+*
+*/
+void
+LookupSymbolTableBatch (
+    _In_ const SYMBOL_TABLE* Table,
+    _Inout_ PSYMBOL_BATCH_ENTRY Batch,
+    _In_ SIZE_T Count
+    )
+{
+    const SYMBOL_TABLE_ENTRY* first;
+    const SYMBOL_TABLE_ENTRY* last;
+    const SYMBOL_TABLE_ENTRY* cursor;
+
+    SortSymbolBatch(Batch, Count);
+
+    first = Table->Entries;
+    last = (Table->Entries + Table->Header->SymbolCount);
+    cursor = first;
+
+    for (SIZE_T i = 0; i < Count; i++)
+    {
+        const SYMBOL_TABLE_ENTRY* entry;
+
+        Batch[i].NameOffset = SYMBOL_BATCH_UNRESOLVED;
+        Batch[i].Displacement = 0;
+
+        cursor = SweepSymbolTable(cursor, last, Batch[i].Rva);
+        if (cursor == first)
+        {
+            continue;
+        }
+
+        entry = (cursor - 1);
+
+        if (entry->NameOffset >= Table->StringCount)
+        {
+            continue;
+        }
+
+        Batch[i].NameOffset = entry->NameOffset;
+        Batch[i].Displacement = (Batch[i].Rva - entry->Rva);
+    }
+}
+
+/**
+*
+* @brief        Unmaps a symbol table.
+* @param[in]    Table - The mapped table.
+*
+*/
+void
+CloseSymbolTable (
+    _Inout_ PSYMBOL_TABLE Table
+    )
+{
+    if (Table->Header != NULL)
+    {
+        UnmapViewOfFile(Table->Header);
+    }
+
+    if (Table->MappingHandle != NULL)
+    {
+        CloseHandle(Table->MappingHandle);
+    }
+
+    RtlZeroMemory(Table, sizeof(*Table));
+}
\ No newline at end of file
@@ -0,0 +1,1530 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Symbolize.cpp
+*
+* @summary:   Offline symbolization ("symbolize" command). Resolves a raw capture
+*             written with -raw into the same CSV the live tool writes. Images are
+*             loaded once each and events are resolved in parallel batches.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Symbolize.hpp"
+#include "Symbols.hpp"
+#include "Helpers.hpp"
+#include "Lz4.hpp"
+#include <tuple>
+#include <algorithm>
+
+/**
+*
+* @brief        Reads a NULL-terminated UTF-16 string from a record payload.
+* @param[in]    Data - The string.
+* @param[in]    Length - The number of bytes left in the record.
+* @param[out]   String - The string.
+* @return       true if the string is terminated inside the record, otherwise false.
+*
+*/
+static
+bool
+ReadRawCaptureString (
+    _In_ const uint8_t* Data,
+    _In_ SIZE_T Length,
+    _Out_ std::wstring& String
+    )
+{
+    const wchar_t* string;
+    SIZE_T maxLength;
+    SIZE_T stringLength;
+
+    String.clear();
+
+    //
+    // Records are 8-byte aligned and every fixed part is a multiple of
+    // 8 bytes, so the string is suitably aligned.
+    //
+    string = reinterpret_cast<const wchar_t*>(Data);
+    maxLength = (Length / sizeof(wchar_t));
+
+    stringLength = wcsnlen(string, maxLength);
+    if (stringLength == maxLength)
+    {
+        return false;
+    }
+
+    String.assign(string, stringLength);
+
+    return true;
+}
+
+/**
+*
+* @brief        Reads a NULL-terminated UTF-8 string from a record payload.
+* @param[in]    Data - The string.
+* @param[in]    Length - The number of bytes left in the record.
+* @param[out]   String - The string.
+* @return       true if the string is terminated inside the record, otherwise false.
+*
+*/
+static
+bool
+ReadRawCaptureUtf8String (
+    _In_ const uint8_t* Data,
+    _In_ SIZE_T Length,
+    _Out_ std::string& String
+    )
+{
+    const char* string;
+    SIZE_T stringLength;
+
+    String.clear();
+
+    string = reinterpret_cast<const char*>(Data);
+
+    stringLength = strnlen(string, Length);
+    if (stringLength == Length)
+    {
+        return false;
+    }
+
+    String.assign(string, stringLength);
+
+    return true;
+}
+
+/**
+*
+* @brief        Walks a raw capture and builds the image, module and name tables.
+* @param[in]    Context - The symbolize context, with the capture mapped.
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+ParseRawCapture (
+    _Inout_ PSYMBOLIZE_CONTEXT Context
+    )
+{
+    bool result;
+    const uint8_t* data;
+    SIZE_T length;
+    SIZE_T offset;
+    RAW_CAPTURE_HEADER captureHeader;
+    std::map<std::tuple<std::wstring, ULONG, ULONG, ULONG>, ULONG> imageIds;
+
+    result = false;
+
+    data = Context->CaptureData;
+    length = Context->CaptureLength;
+
+    RtlZeroMemory(&Context->Clock, sizeof(Context->Clock));
+
+    if (length < sizeof(captureHeader))
+    {
+        wprintf(L"[-] Error! The capture is truncated.\n");
+        goto Exit;
+    }
+
+    RtlCopyMemory(&captureHeader, data, sizeof(captureHeader));
+
+    if ((captureHeader.Magic != RAW_CAPTURE_MAGIC) ||
+        ((captureHeader.Version != RAW_CAPTURE_VERSION) &&
+         (captureHeader.Version != RAW_CAPTURE_VERSION_UTF16_NAMES)))
+    {
+        wprintf(L"[-] Error! Not a Vtl1Mon raw capture (or an unsupported version).\n");
+        goto Exit;
+    }
+
+    offset = sizeof(captureHeader);
+
+    while ((offset + sizeof(RAW_RECORD_HEADER)) <= length)
+    {
+        RAW_RECORD_HEADER recordHeader;
+        const uint8_t* payload;
+        SIZE_T payloadSize;
+
+        RtlCopyMemory(&recordHeader, data + offset, sizeof(recordHeader));
+
+        if ((recordHeader.Size < sizeof(RAW_RECORD_HEADER)) ||
+            ((recordHeader.Size % RAW_RECORD_ALIGNMENT) != 0) ||
+            (recordHeader.Size > (length - offset)))
+        {
+            //
+            // A capture cut short (e.g. the tool was killed) still has
+            // everything up to here.
+            //
+            wprintf(L"[-] Warning! The capture is corrupt or truncated at offset %zu.\n", offset);
+            break;
+        }
+
+        payload = (data + offset + sizeof(RAW_RECORD_HEADER));
+        payloadSize = (recordHeader.Size - sizeof(RAW_RECORD_HEADER));
+
+        offset += recordHeader.Size;
+
+        if (recordHeader.Type == RawRecordModule)
+        {
+            RAW_MODULE_RECORD moduleRecord;
+            SYMBOLIZE_MODULE symbolizeModule;
+            std::wstring imagePath;
+            const wchar_t* imageName;
+
+            if ((payloadSize < sizeof(moduleRecord)) ||
+                (!ReadRawCaptureString(payload + sizeof(moduleRecord), payloadSize - sizeof(moduleRecord), imagePath)))
+            {
+                continue;
+            }
+
+            RtlCopyMemory(&moduleRecord, payload, sizeof(moduleRecord));
+
+            //
+            // One image per identity, however many processes loaded it.
+            //
+            imageName = wcsrchr(imagePath.c_str(), L'\\');
+            imageName = ((imageName != NULL) ? (imageName + 1) : imagePath.c_str());
+
+            auto key = std::make_tuple(std::wstring(imageName),
+                                       static_cast<ULONG>(moduleRecord.TimeDateStamp),
+                                       static_cast<ULONG>(moduleRecord.ImageChecksum),
+                                       static_cast<ULONG>(moduleRecord.ImageSize));
+
+            auto it = imageIds.find(key);
+            if (it == imageIds.end())
+            {
+                SYMBOLIZE_IMAGE image;
+
+                image.ImageName = imageName;
+                image.ImagePathUtf8 = ConvertToUtf8(imagePath.c_str(), imagePath.length());
+                image.ImagePath = std::move(imagePath);
+                image.ImageSize = moduleRecord.ImageSize;
+                image.TimeDateStamp = moduleRecord.TimeDateStamp;
+                image.ImageChecksum = moduleRecord.ImageChecksum;
+                image.Referenced = false;
+                image.Source = SymbolizeSourceNone;
+
+                RtlZeroMemory(&image.Table, sizeof(image.Table));
+
+                it = imageIds.insert({ key, static_cast<ULONG>(Context->Images.size()) }).first;
+
+                Context->Images.push_back(std::move(image));
+            }
+
+            symbolizeModule.ImageBase = moduleRecord.ImageBase;
+            symbolizeModule.ImageSize = moduleRecord.ImageSize;
+            symbolizeModule.ImageIndex = it->second;
+
+            //
+            // First load at a base wins, as in the live image map.
+            //
+            Context->ProcessModules[moduleRecord.ProcessId].insert({ symbolizeModule.ImageBase, symbolizeModule });
+            Context->AllModules.insert({ symbolizeModule.ImageBase, symbolizeModule });
+        }
+        else if ((recordHeader.Type == RawRecordName) ||
+                 (recordHeader.Type == RawRecordSecureCallName))
+        {
+            RAW_NAME_RECORD nameRecord;
+            std::string name;
+            std::wstring wideName;
+            std::vector<std::string>* names;
+
+            if (payloadSize < sizeof(nameRecord))
+            {
+                continue;
+            }
+
+            //
+            // Older captures have UTF-16 names.
+            //
+            if (captureHeader.Version == RAW_CAPTURE_VERSION_UTF16_NAMES)
+            {
+                if (!ReadRawCaptureString(payload + sizeof(nameRecord), payloadSize - sizeof(nameRecord), wideName))
+                {
+                    continue;
+                }
+
+                name = ConvertToUtf8(wideName.c_str(), wideName.length());
+            }
+            else if (!ReadRawCaptureUtf8String(payload + sizeof(nameRecord), payloadSize - sizeof(nameRecord), name))
+            {
+                continue;
+            }
+
+            RtlCopyMemory(&nameRecord, payload, sizeof(nameRecord));
+
+            names = ((recordHeader.Type == RawRecordName) ? &Context->Names : &Context->SecureCallNames);
+
+            if (nameRecord.Id > RAW_CAPTURE_MAX_NAME_ID)
+            {
+                continue;
+            }
+
+            if (nameRecord.Id >= names->size())
+            {
+                names->resize(nameRecord.Id + 1);
+            }
+
+            (*names)[nameRecord.Id] = std::move(name);
+        }
+        else if (recordHeader.Type == RawRecordEvent)
+        {
+            RAW_EVENT_RECORD eventRecord;
+
+            if (payloadSize < sizeof(eventRecord))
+            {
+                continue;
+            }
+
+            RtlCopyMemory(&eventRecord, payload, sizeof(eventRecord));
+
+            if ((sizeof(eventRecord) + (static_cast<SIZE_T>(eventRecord.NumberOfFrames) * sizeof(uint64_t))) > payloadSize)
+            {
+                continue;
+            }
+
+            Context->Events.push_back(payload);
+        }
+        else if (recordHeader.Type == RawRecordClock)
+        {
+            RAW_CLOCK_RECORD clockRecord;
+
+            if (payloadSize < sizeof(clockRecord))
+            {
+                continue;
+            }
+
+            RtlCopyMemory(&clockRecord, payload, sizeof(clockRecord));
+
+            Context->Clock.QpcFrequency = clockRecord.QpcFrequency;
+            Context->Clock.AnchorTimeStamp = clockRecord.AnchorTimeStamp;
+            Context->Clock.AnchorTime = clockRecord.AnchorTime;
+            Context->Clock.Uncertainty = clockRecord.Uncertainty;
+        }
+    }
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Finds the module housing an address in a process.
+* @param[in]    Context - The symbolize context.
+* @param[in]    ProcessId - The process the address is from.
+* @param[in]    TargetAddress - The target address.
+* @return       The module, or NULL if no image covers the address.
+*
+*/
+static
+const SYMBOLIZE_MODULE*
+FindSymbolizeModule (
+    _In_ const SYMBOLIZE_CONTEXT* Context,
+    _In_ ULONG ProcessId,
+    _In_ ULONGLONG TargetAddress
+    )
+{
+    const SYMBOLIZE_MODULE_MAP* maps[3];
+
+    //
+    // The process' own images, then the kernel's (loaded "into" PID 0),
+    // then anything at all.
+    //
+    maps[0] = NULL;
+    maps[1] = NULL;
+    maps[2] = &Context->AllModules;
+
+    auto processIt = Context->ProcessModules.find(ProcessId);
+    if (processIt != Context->ProcessModules.end())
+    {
+        maps[0] = &processIt->second;
+    }
+
+    auto kernelIt = Context->ProcessModules.find(0);
+    if (kernelIt != Context->ProcessModules.end())
+    {
+        maps[1] = &kernelIt->second;
+    }
+
+    for (const SYMBOLIZE_MODULE_MAP* map : maps)
+    {
+        if (map == NULL)
+        {
+            continue;
+        }
+
+        auto it = map->upper_bound(TargetAddress);
+        if (it == map->begin())
+        {
+            continue;
+        }
+
+        --it;
+
+        if (TargetAddress < (it->first + it->second.ImageSize))
+        {
+            return &it->second;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+*
+* @brief        Loads an image's symbols from anything which needs no dbghelp: the
+*               table cache, then the image's PDB in the symbol store. Also finds
+*               the image itself for the later (serial) tiers.
+* @param[in]    Context - The symbolize context.
+* @param[in]    Image - The image to load.
+*
+*/
+static
+void
+LoadSymbolizeImage (
+    _In_ const SYMBOLIZE_CONTEXT* Context,
+    _Inout_ PSYMBOLIZE_IMAGE Image
+    )
+{
+    SYMBOL_TABLE_KEY tableKey;
+    wchar_t identity[32];
+    std::wstring candidate;
+
+    tableKey.ImageName = Image->ImageName.c_str();
+    tableKey.TimeDateStamp = Image->TimeDateStamp;
+    tableKey.ImageChecksum = Image->ImageChecksum;
+    tableKey.ImageSize = Image->ImageSize;
+
+    if (OpenSymbolTable(&tableKey, &Image->Table))
+    {
+        Image->Source = SymbolizeSourceCache;
+        goto Exit;
+    }
+
+    //
+    // Symbol store image key: <store>\<name>\<TimeDateStamp><SizeOfImage>\<name>.
+    // Failing that, the capture was taken on this machine.
+    //
+    swprintf(identity,
+             ARRAYSIZE(identity),
+             L"%08X%X",
+             Image->TimeDateStamp,
+             Image->ImageSize);
+
+    candidate = (std::wstring(Context->SymbolStore) + L"\\" + Image->ImageName + L"\\" + identity + L"\\" + Image->ImageName);
+
+    if (GetFileAttributesW(candidate.c_str()) == INVALID_FILE_ATTRIBUTES)
+    {
+        candidate = GetSymbolImagePath(Image->ImagePath.c_str());
+
+        if (GetFileAttributesW(candidate.c_str()) == INVALID_FILE_ATTRIBUTES)
+        {
+            goto Exit;
+        }
+    }
+
+    Image->LocalPath = std::move(candidate);
+
+    if (BuildSymbolTableFromLocalPdb(Image->LocalPath.c_str(),
+                                     Context->SymbolStore,
+                                     &tableKey,
+                                     &Image->Table))
+    {
+        Image->Source = SymbolizeSourcePdb;
+    }
+
+Exit:
+    return;
+}
+
+/**
+*
+* @brief        Image load worker. Claims referenced images until none are left.
+* @param[in]    Parameter - The SYMBOLIZE_LOAD_WORKER.
+* @return       0.
+*
+*/
+static
+DWORD
+WINAPI
+SymbolizeLoadWorker (
+    _In_ PVOID Parameter
+    )
+{
+    PSYMBOLIZE_LOAD_WORKER worker;
+    LONG index;
+
+    worker = static_cast<PSYMBOLIZE_LOAD_WORKER>(Parameter);
+
+    for (;;)
+    {
+        index = (_InterlockedIncrement(worker->NextImage) - 1);
+        if (static_cast<SIZE_T>(index) >= worker->Context->Images.size())
+        {
+            break;
+        }
+
+        if (!worker->Context->Images[index].Referenced)
+        {
+            continue;
+        }
+
+        LoadSymbolizeImage(worker->Context, &worker->Context->Images[index]);
+    }
+
+    return 0;
+}
+
+/**
+*
+* @brief        Resolves every frame in a resolve worker's slice. Frames are grouped
+*               by image and each image's frames are resolved with one sweep over its
+*               (sorted) table, instead of a lookup per frame in stack order.
+* @param[in]    Worker - The resolve worker.
+*
+*/
+static
+void
+ResolveSymbolizeFrames (
+    _Inout_ PSYMBOLIZE_RESOLVE_WORKER Worker
+    )
+{
+    const SYMBOLIZE_CONTEXT* context;
+
+    context = Worker->Context;
+
+    Worker->SliceFrames.clear();
+    Worker->BatchedImages.clear();
+
+    if (Worker->ImageBatches.size() != context->Images.size())
+    {
+        Worker->ImageBatches.resize(context->Images.size());
+    }
+
+    //
+    // Find each frame's image, and queue it on that image's batch.
+    //
+    for (SIZE_T i = Worker->FirstEvent; i < (Worker->FirstEvent + Worker->EventCount); i++)
+    {
+        RAW_EVENT_RECORD eventRecord;
+        const uint8_t* frames;
+
+        RtlCopyMemory(&eventRecord, context->Events[i], sizeof(eventRecord));
+
+        frames = (context->Events[i] + sizeof(eventRecord));
+
+        for (ULONG j = 0; j < eventRecord.NumberOfFrames; j++)
+        {
+            SYMBOLIZE_FRAME frame;
+            SYMBOL_BATCH_ENTRY batchEntry;
+            const SYMBOLIZE_MODULE* symbolizeModule;
+
+            RtlZeroMemory(&frame, sizeof(frame));
+
+            RtlCopyMemory(&frame.Address, frames + (j * sizeof(uint64_t)), sizeof(frame.Address));
+
+            symbolizeModule = FindSymbolizeModule(context, eventRecord.ProcessId, frame.Address);
+            if (symbolizeModule != NULL)
+            {
+                frame.Image = &context->Images[symbolizeModule->ImageIndex];
+                frame.Rva = static_cast<ULONG>(frame.Address - symbolizeModule->ImageBase);
+
+                if (frame.Image->Source != SymbolizeSourceNone)
+                {
+                    auto& imageBatch = Worker->ImageBatches[symbolizeModule->ImageIndex];
+
+                    if (imageBatch.empty())
+                    {
+                        Worker->BatchedImages.push_back(symbolizeModule->ImageIndex);
+                    }
+
+                    batchEntry.Rva = frame.Rva;
+                    batchEntry.Slot = static_cast<uint32_t>(Worker->SliceFrames.size());
+                    batchEntry.NameOffset = SYMBOL_BATCH_UNRESOLVED;
+                    batchEntry.Displacement = 0;
+
+                    imageBatch.push_back(batchEntry);
+                }
+            }
+
+            Worker->SliceFrames.push_back(frame);
+        }
+    }
+
+    //
+    // One sweep per image, then scatter the names back to the frames.
+    //
+    for (ULONG imageIndex : Worker->BatchedImages)
+    {
+        const SYMBOLIZE_IMAGE* image;
+        auto& imageBatch = Worker->ImageBatches[imageIndex];
+
+        image = &context->Images[imageIndex];
+
+        if (image->Source == SymbolizeSourceExports)
+        {
+            LookupPeExportBatch(&image->Exports, imageBatch.data(), imageBatch.size());
+        }
+        else
+        {
+            LookupSymbolTableBatch(&image->Table, imageBatch.data(), imageBatch.size());
+        }
+
+        for (const auto& batchEntry : imageBatch)
+        {
+            PSYMBOLIZE_FRAME frame;
+
+            if (batchEntry.NameOffset == SYMBOL_BATCH_UNRESOLVED)
+            {
+                continue;
+            }
+
+            frame = &Worker->SliceFrames[batchEntry.Slot];
+            frame->Displacement = batchEntry.Displacement;
+
+            if (image->Source == SymbolizeSourceExports)
+            {
+                frame->SymbolName = (image->Exports.Names.data() + batchEntry.NameOffset);
+            }
+            else
+            {
+                frame->SymbolName = (image->Table.Strings + batchEntry.NameOffset);
+            }
+        }
+
+        imageBatch.clear();
+    }
+}
+
+/**
+*
+* @brief        Resolve worker. Resolves and formats a contiguous slice of events.
+*               Only reads the context, so any number of workers can run at once.
+* @param[in]    Parameter - The SYMBOLIZE_RESOLVE_WORKER.
+* @return       0.
+*
+*/
+static
+DWORD
+WINAPI
+SymbolizeResolveWorker (
+    _In_ PVOID Parameter
+    )
+{
+    PSYMBOLIZE_RESOLVE_WORKER worker;
+    const SYMBOLIZE_CONTEXT* context;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    SIZE_T slot;
+    bool wallClockTimes;
+
+    worker = static_cast<PSYMBOLIZE_RESOLVE_WORKER>(Parameter);
+    context = worker->Context;
+    slot = 0;
+    wallClockTimes = (IsFormatWallClockTimes() && IsClockValid(&context->Clock));
+
+    QueryPerformanceCounter(&start);
+
+    ResolveSymbolizeFrames(worker);
+
+    QueryPerformanceCounter(&end);
+
+    worker->LookupTicks += (end.QuadPart - start.QuadPart);
+
+    start = end;
+
+    ResetFormatBuffer(&worker->Output);
+
+    if (wallClockTimes)
+    {
+        worker->Times.resize(worker->EventCount);
+
+        for (SIZE_T i = 0; i < worker->EventCount; i++)
+        {
+            RtlCopyMemory(&worker->Times[i],
+                          context->Events[worker->FirstEvent + i] + FIELD_OFFSET(RAW_EVENT_RECORD, TimeStamp),
+                          sizeof(uint64_t));
+        }
+
+        ConvertClockTimeStamps(&context->Clock,
+                               worker->Times.data(),
+                               worker->Times.data(),
+                               worker->EventCount);
+    }
+
+    for (SIZE_T i = worker->FirstEvent; i < (worker->FirstEvent + worker->EventCount); i++)
+    {
+        RAW_EVENT_RECORD eventRecord;
+        const char* secureCallName;
+        const char* processName;
+        const char* threadName;
+
+        RtlCopyMemory(&eventRecord, context->Events[i], sizeof(eventRecord));
+
+        secureCallName = "Unknown";
+        processName = "Unknown";
+        threadName = "Unknown";
+
+        if ((eventRecord.SecureCallNumber < context->SecureCallNames.size()) &&
+            (!context->SecureCallNames[eventRecord.SecureCallNumber].empty()))
+        {
+            secureCallName = context->SecureCallNames[eventRecord.SecureCallNumber].c_str();
+        }
+
+        if (eventRecord.ProcessNameId < context->Names.size())
+        {
+            processName = context->Names[eventRecord.ProcessNameId].c_str();
+        }
+
+        if (eventRecord.ThreadNameId < context->Names.size())
+        {
+            threadName = context->Names[eventRecord.ThreadNameId].c_str();
+        }
+
+        FormatVtl1CsvFields(&worker->Output,
+                            (wallClockTimes ? worker->Times[i - worker->FirstEvent] : eventRecord.TimeStamp),
+                            secureCallName,
+                            eventRecord.SecureCallNumber,
+                            eventRecord.ProcessId,
+                            processName,
+                            eventRecord.ThreadId,
+                            threadName);
+
+        for (ULONG j = 0; j < eventRecord.NumberOfFrames; j++)
+        {
+            const SYMBOLIZE_FRAME* frame;
+
+            frame = &worker->SliceFrames[slot++];
+
+            worker->Frames++;
+
+            if (frame->Image == NULL)
+            {
+                //
+                // Unknown
+                //
+                FormatUnknownFrame(&worker->Output, frame->Address, FORMAT_FRAME_SEPARATOR);
+                continue;
+            }
+
+            if (frame->SymbolName == NULL)
+            {
+                //
+                // We do not have symbols, but we _do_ have image data!
+                //
+                FormatImageFrame(&worker->Output,
+                                 frame->Image->ImagePathUtf8.c_str(),
+                                 frame->Rva,
+                                 FORMAT_FRAME_SEPARATOR);
+                continue;
+            }
+
+            FormatSymbolFrame(&worker->Output,
+                              frame->Image->ImagePathUtf8.c_str(),
+                              frame->SymbolName,
+                              frame->Displacement,
+                              FORMAT_FRAME_SEPARATOR);
+
+            worker->FramesResolved++;
+        }
+
+        FinishVtl1CsvLine(&worker->Output);
+    }
+
+    QueryPerformanceCounter(&end);
+
+    worker->FormatTicks += (end.QuadPart - start.QuadPart);
+    worker->FormatBytes += worker->Output.Length;
+
+    return 0;
+}
+
+/**
+*
+* @brief        Gets the aggregate string ID of a resolved frame.
+* @param[in]    Worker - The aggregate worker.
+* @param[in]    Frame - The frame.
+* @return       The string ID.
+*
+*/
+static
+uint32_t
+GetSymbolizeFrameId (
+    _Inout_ PSYMBOLIZE_AGGREGATE_WORKER Worker,
+    _In_ const SYMBOLIZE_FRAME* Frame
+    )
+{
+    std::unordered_map<uint64_t, uint32_t>* frameIds;
+    uint64_t key;
+    uint32_t frameId;
+
+    if (Frame->Image == NULL)
+    {
+        frameIds = &Worker->UnknownFrameIds;
+        key = Frame->Address;
+    }
+    else
+    {
+        frameIds = &Worker->FrameIds;
+        key = ((static_cast<uint64_t>(Frame->Image - Worker->Resolve.Context->Images.data()) << 32) | Frame->Rva);
+    }
+
+    auto existing = frameIds->find(key);
+    if (existing != frameIds->end())
+    {
+        return existing->second;
+    }
+
+    //
+    // Formatted exactly as in the CSV (and a live snapshot).
+    //
+    ResetFormatBuffer(&Worker->Frame);
+
+    if (Frame->Image == NULL)
+    {
+        FormatUnknownFrame(&Worker->Frame, Frame->Address, FORMAT_NO_SEPARATOR);
+    }
+    else if (Frame->SymbolName == NULL)
+    {
+        FormatImageFrame(&Worker->Frame, Frame->Image->ImagePathUtf8.c_str(), Frame->Rva, FORMAT_NO_SEPARATOR);
+    }
+    else
+    {
+        FormatSymbolFrame(&Worker->Frame, Frame->Image->ImagePathUtf8.c_str(), Frame->SymbolName, Frame->Displacement, FORMAT_NO_SEPARATOR);
+    }
+
+    frameId = InternAggregateString(&Worker->Aggregate, std::string(Worker->Frame.Data.data(), Worker->Frame.Length));
+
+    frameIds->emplace(key, frameId);
+
+    return frameId;
+}
+
+/**
+*
+* @brief        Aggregate worker. Resolves a contiguous slice of events and counts
+*               them (secure calls, stacks, processes and callers) into its aggregate.
+* @param[in]    Parameter - The SYMBOLIZE_AGGREGATE_WORKER.
+* @return       0.
+*
+*/
+static
+DWORD
+WINAPI
+SymbolizeAggregateWorker (
+    _In_ PVOID Parameter
+    )
+{
+    PSYMBOLIZE_AGGREGATE_WORKER worker;
+    const SYMBOLIZE_CONTEXT* context;
+    SIZE_T slot;
+
+    worker = static_cast<PSYMBOLIZE_AGGREGATE_WORKER>(Parameter);
+    context = worker->Resolve.Context;
+    slot = 0;
+
+    ResolveSymbolizeFrames(&worker->Resolve);
+
+    for (SIZE_T i = worker->Resolve.FirstEvent; i < (worker->Resolve.FirstEvent + worker->Resolve.EventCount); i++)
+    {
+        RAW_EVENT_RECORD eventRecord;
+        const SYMBOLIZE_FRAME* frames;
+        const SYMBOLIZE_FRAME* caller;
+        PAGGREGATE_SECURE_CALL secureCall;
+        uint32_t secureCallId;
+        uint32_t processNameId;
+        ULONG stackFrames;
+
+        RtlCopyMemory(&eventRecord, context->Events[i], sizeof(eventRecord));
+
+        frames = &worker->Resolve.SliceFrames[slot];
+        slot += eventRecord.NumberOfFrames;
+
+        if ((worker->FirstTimeStamp == 0) ||
+            (eventRecord.TimeStamp < worker->FirstTimeStamp))
+        {
+            worker->FirstTimeStamp = eventRecord.TimeStamp;
+        }
+
+        worker->LastTimeStamp = (std::max)(worker->LastTimeStamp, eventRecord.TimeStamp);
+
+        //
+        // Secure call
+        //
+        if (worker->SecureCallIds[eventRecord.SecureCallNumber] == MAXULONG)
+        {
+            const char* secureCallName;
+
+            secureCallName = NULL;
+
+            if (eventRecord.SecureCallNumber < context->SecureCallNames.size())
+            {
+                secureCallName = context->SecureCallNames[eventRecord.SecureCallNumber].c_str();
+            }
+
+            worker->SecureCallIds[eventRecord.SecureCallNumber] = InternAggregateSecureCallName(&worker->Aggregate,
+                                                                                                secureCallName,
+                                                                                                eventRecord.SecureCallNumber);
+        }
+
+        secureCallId = worker->SecureCallIds[eventRecord.SecureCallNumber];
+
+        secureCall = &worker->Aggregate.SecureCalls[secureCallId];
+        secureCall->NameId = secureCallId;
+        secureCall->Number = eventRecord.SecureCallNumber;
+        secureCall->Count++;
+
+        if (eventRecord.NumberOfFrames == 0)
+        {
+            continue;
+        }
+
+        worker->Aggregate.Events++;
+
+        //
+        // (secure call, stack) - the same frames a live snapshot keeps.
+        //
+        stackFrames = (std::min)(static_cast<ULONG>(eventRecord.NumberOfFrames), static_cast<ULONG>(TOP_K_MAX_SAMPLE_FRAMES));
+
+        worker->Identity.clear();
+        worker->Identity.push_back(secureCallId);
+
+        for (ULONG j = 0; j < stackFrames; j++)
+        {
+            worker->Identity.push_back(GetSymbolizeFrameId(worker, &frames[j]));
+        }
+
+        CountAggregateIdentity(&worker->Aggregate, TopKStacks, worker->Identity, 1);
+
+        //
+        // (process, secure call)
+        //
+        if (eventRecord.ProcessNameId < worker->NameIds.size())
+        {
+            if (worker->NameIds[eventRecord.ProcessNameId] == MAXULONG)
+            {
+                worker->NameIds[eventRecord.ProcessNameId] = InternAggregateString(&worker->Aggregate,
+                                                                                   context->Names[eventRecord.ProcessNameId]);
+            }
+
+            processNameId = worker->NameIds[eventRecord.ProcessNameId];
+        }
+        else
+        {
+            processNameId = InternAggregateString(&worker->Aggregate, "Unknown");
+        }
+
+        worker->Identity.clear();
+        worker->Identity.push_back(processNameId);
+        worker->Identity.push_back(secureCallId);
+
+        CountAggregateIdentity(&worker->Aggregate, TopKProcesses, worker->Identity, 1);
+
+        //
+        // Caller frame: the first outside the innermost frame's image, as live.
+        //
+        caller = &frames[0];
+
+        if (frames[0].Image != NULL)
+        {
+            caller = &frames[eventRecord.NumberOfFrames - 1];
+
+            for (ULONG j = 1; j < eventRecord.NumberOfFrames; j++)
+            {
+                if (frames[j].Image != frames[0].Image)
+                {
+                    caller = &frames[j];
+                    break;
+                }
+            }
+        }
+
+        worker->Identity.clear();
+        worker->Identity.push_back(GetSymbolizeFrameId(worker, caller));
+
+        CountAggregateIdentity(&worker->Aggregate, TopKCallers, worker->Identity, 1);
+    }
+
+    return 0;
+}
+
+/**
+*
+* @brief        Gets the number of worker threads to use.
+* @param[in]    ThreadCount - The requested number. 0 for one per processor.
+* @return       The number of worker threads.
+*
+*/
+static
+ULONG
+GetSymbolizeThreadCount (
+    _In_ ULONG ThreadCount
+    )
+{
+    SYSTEM_INFO systemInfo;
+
+    if (ThreadCount == 0)
+    {
+        GetSystemInfo(&systemInfo);
+        ThreadCount = systemInfo.dwNumberOfProcessors;
+    }
+
+    return (std::max)(static_cast<ULONG>(1), (std::min)(ThreadCount, static_cast<ULONG>(MAXIMUM_WAIT_OBJECTS)));
+}
+
+/**
+*
+* @brief        Opens a raw capture and loads the symbols of every image a frame
+*               lands in: tables and PDBs in parallel, then dbghelp and exports.
+* @param[out]   Context - The symbolize context (SymbolStore already set).
+* @param[in]    RawCapturePath - The capture written with -raw.
+* @param[in]    ThreadCount - The number of worker threads.
+* @param[in]    UseDbgHelp - Whether dbghelp (symbol server) is available as a fallback.
+* @param[inout] Statistics - Receives the event count, image counts and load time.
+* @return       true on success, otherwise false. Close the context either way.
+*
+*/
+static
+bool
+OpenSymbolizeContext (
+    _Inout_ PSYMBOLIZE_CONTEXT Context,
+    _In_ const wchar_t* RawCapturePath,
+    _In_ ULONG ThreadCount,
+    _In_ bool UseDbgHelp,
+    _Inout_ PSYMBOLIZE_STATISTICS Statistics
+    )
+{
+    bool result;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    volatile LONG nextImage;
+    ULONGLONG dbgHelpBase;
+    std::vector<SYMBOLIZE_LOAD_WORKER> loadWorkers;
+    std::vector<PVOID> parameters;
+
+    result = false;
+    nextImage = 0;
+    dbgHelpBase = SYMBOLIZE_DBGHELP_BASE;
+
+    if (!MapFileReadOnly(RawCapturePath, &Context->Capture))
+    {
+        wprintf(L"[-] Error! Unable to open %s in OpenSymbolizeContext. (GLE: %d)\n", RawCapturePath, GetLastError());
+        goto Exit;
+    }
+
+    Context->CaptureData = Context->Capture.Data;
+    Context->CaptureLength = Context->Capture.Length;
+
+    if (IsLz4Frame(Context->Capture.Data, Context->Capture.Length))
+    {
+        bool complete;
+
+        if (!Lz4DecompressFrame(Context->Capture.Data,
+                                Context->Capture.Length,
+                                Context->DecompressedCapture,
+                                &complete))
+        {
+            wprintf(L"[-] Error! The compressed capture is corrupt.\n");
+            goto Exit;
+        }
+
+        //
+        // A capture which was never closed still has its complete blocks.
+        //
+        if (!complete)
+        {
+            wprintf(L"[-] Warning! The compressed capture was not closed. Using its first %zu bytes.\n",
+                    Context->DecompressedCapture.size());
+        }
+
+        Context->CaptureData = Context->DecompressedCapture.data();
+        Context->CaptureLength = Context->DecompressedCapture.size();
+    }
+
+    if (!ParseRawCapture(Context))
+    {
+        goto Exit;
+    }
+
+    Statistics->Events = Context->Events.size();
+
+    //
+    // Only load images a frame actually lands in.
+    //
+    for (const uint8_t* eventData : Context->Events)
+    {
+        RAW_EVENT_RECORD eventRecord;
+
+        RtlCopyMemory(&eventRecord, eventData, sizeof(eventRecord));
+
+        for (ULONG j = 0; j < eventRecord.NumberOfFrames; j++)
+        {
+            uint64_t frame;
+            const SYMBOLIZE_MODULE* symbolizeModule;
+
+            RtlCopyMemory(&frame, eventData + sizeof(eventRecord) + (j * sizeof(uint64_t)), sizeof(frame));
+
+            symbolizeModule = FindSymbolizeModule(Context, eventRecord.ProcessId, frame);
+            if (symbolizeModule != NULL)
+            {
+                Context->Images[symbolizeModule->ImageIndex].Referenced = true;
+            }
+        }
+    }
+
+    QueryPerformanceCounter(&start);
+
+    //
+    // Tables and PDBs, in parallel.
+    //
+    loadWorkers.resize(ThreadCount);
+
+    for (auto& worker : loadWorkers)
+    {
+        worker.Context = Context;
+        worker.NextImage = &nextImage;
+
+        parameters.push_back(&worker);
+    }
+
+    if (!RunWorkerThreads(SymbolizeLoadWorker, parameters))
+    {
+        goto Exit;
+    }
+
+    //
+    // dbghelp (not thread-safe), then exports, for whatever is left.
+    //
+    for (auto& image : Context->Images)
+    {
+        if ((!image.Referenced) ||
+            (image.Source != SymbolizeSourceNone))
+        {
+            continue;
+        }
+
+        if (UseDbgHelp)
+        {
+            SYMBOL_TABLE_KEY tableKey;
+            std::wstring imagePath;
+
+            tableKey.ImageName = image.ImageName.c_str();
+            tableKey.TimeDateStamp = image.TimeDateStamp;
+            tableKey.ImageChecksum = image.ImageChecksum;
+            tableKey.ImageSize = image.ImageSize;
+
+            //
+            // dbghelp can fetch the image from the symbol server itself.
+            //
+            imagePath = (image.LocalPath.empty() ? GetSymbolImagePath(image.ImagePath.c_str()) : image.LocalPath);
+
+            if (BuildSymbolTableWithDbgHelp(imagePath.c_str(),
+                                            static_cast<ULONG_PTR>(dbgHelpBase),
+                                            &tableKey,
+                                            &image.Table))
+            {
+                image.Source = SymbolizeSourceDbgHelp;
+            }
+
+            dbgHelpBase += ((image.ImageSize + SYMBOLIZE_DBGHELP_ALIGNMENT - 1) & ~(SYMBOLIZE_DBGHELP_ALIGNMENT - 1));
+
+            if (image.Source != SymbolizeSourceNone)
+            {
+                continue;
+            }
+        }
+
+        if ((!image.LocalPath.empty()) &&
+            (LoadPeExports(image.LocalPath.c_str(), &image.Exports)))
+        {
+            image.Source = SymbolizeSourceExports;
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+
+    Statistics->LoadTicks = (end.QuadPart - start.QuadPart);
+
+    for (const auto& image : Context->Images)
+    {
+        if (image.Referenced)
+        {
+            Statistics->ImagesReferenced++;
+            Statistics->ImagesBySource[image.Source]++;
+        }
+    }
+
+    result = true;
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Releases everything a symbolize context holds.
+* @param[in]    Context - The symbolize context.
+*
+*/
+static
+void
+CloseSymbolizeContext (
+    _Inout_ PSYMBOLIZE_CONTEXT Context
+    )
+{
+    for (auto& image : Context->Images)
+    {
+        CloseSymbolTable(&image.Table);
+    }
+
+    UnmapMappedFile(&Context->Capture);
+}
+
+/**
+*
+* @brief        Resolves a raw capture into the CSV the live tool would have written.
+* @param[in]    RawCapturePath - The capture written with -raw.
+* @param[in]    OutputPath - The CSV to write.
+* @param[in]    SymbolStore - The symbol store to search for images and PDBs.
+* @param[in]    ThreadCount - The number of worker threads. 0 for one per processor.
+* @param[in]    UseDbgHelp - Whether dbghelp (symbol server) is available as a fallback.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+SymbolizeRawCapture (
+    _In_ const wchar_t* RawCapturePath,
+    _In_ const wchar_t* OutputPath,
+    _In_ const wchar_t* SymbolStore,
+    _In_ ULONG ThreadCount,
+    _In_ bool UseDbgHelp
+    )
+{
+    bool result;
+    bool outputCreated;
+    SYMBOLIZE_CONTEXT context;
+    SYMBOLIZE_STATISTICS statistics;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    std::vector<SYMBOLIZE_RESOLVE_WORKER> resolveWorkers;
+    std::vector<PVOID> parameters;
+    double resolveMs;
+    double lookupMs;
+    double formatMs;
+
+    result = false;
+    outputCreated = false;
+    resolveMs = 0;
+    lookupMs = 0;
+    formatMs = 0;
+
+    RtlZeroMemory(&statistics, sizeof(statistics));
+
+    context.SymbolStore = SymbolStore;
+
+    QueryPerformanceFrequency(&frequency);
+
+    ThreadCount = GetSymbolizeThreadCount(ThreadCount);
+
+    statistics.Threads = ThreadCount;
+
+    if (!OpenSymbolizeContext(&context,
+                              RawCapturePath,
+                              ThreadCount,
+                              UseDbgHelp,
+                              &statistics))
+    {
+        goto Exit;
+    }
+
+    if ((IsFormatWallClockTimes()) &&
+        (!IsClockValid(&context.Clock)))
+    {
+        wprintf(L"[-] Warning! The capture has no clock record. Timestamps will be raw QPC ticks.\n");
+    }
+
+    if (!CreateOutputFile(OutputPath))
+    {
+        goto Exit;
+    }
+
+    outputCreated = true;
+
+    QueryPerformanceCounter(&start);
+
+    //
+    // Resolve a batch in parallel, then write it in order.
+    //
+    resolveWorkers.resize(ThreadCount);
+
+    for (auto& worker : resolveWorkers)
+    {
+        worker.Frames = 0;
+        worker.FramesResolved = 0;
+        worker.LookupTicks = 0;
+        worker.FormatTicks = 0;
+        worker.FormatBytes = 0;
+    }
+
+    for (SIZE_T batchStart = 0; batchStart < context.Events.size(); batchStart += SYMBOLIZE_BATCH_EVENTS)
+    {
+        SIZE_T batchCount;
+        SIZE_T sliceSize;
+        SIZE_T next;
+
+        batchCount = (std::min)(static_cast<SIZE_T>(SYMBOLIZE_BATCH_EVENTS), (context.Events.size() - batchStart));
+        sliceSize = ((batchCount + ThreadCount - 1) / ThreadCount);
+        next = batchStart;
+
+        parameters.clear();
+
+        for (auto& worker : resolveWorkers)
+        {
+            worker.Context = &context;
+            worker.FirstEvent = next;
+            worker.EventCount = (std::min)(sliceSize, (batchStart + batchCount) - next);
+            worker.Output.Length = 0;
+
+            next += worker.EventCount;
+
+            if (worker.EventCount != 0)
+            {
+                parameters.push_back(&worker);
+            }
+        }
+
+        if (!RunWorkerThreads(SymbolizeResolveWorker, parameters))
+        {
+            goto Exit;
+        }
+
+        for (auto& worker : resolveWorkers)
+        {
+            if ((worker.EventCount == 0) ||
+                (worker.Output.Length == 0))
+            {
+                continue;
+            }
+
+            if (!WriteOutputBuffer(worker.Output.Data.data(),
+                                   static_cast<ULONG>(worker.Output.Length)))
+            {
+                goto Exit;
+            }
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+
+    statistics.ResolveTicks = (end.QuadPart - start.QuadPart);
+
+    for (const auto& worker : resolveWorkers)
+    {
+        statistics.Frames += worker.Frames;
+        statistics.FramesResolved += worker.FramesResolved;
+        statistics.LookupTicks += worker.LookupTicks;
+        statistics.FormatTicks += worker.FormatTicks;
+        statistics.FormatBytes += worker.FormatBytes;
+    }
+
+    result = true;
+
+Exit:
+    if (outputCreated)
+    {
+        CloseOutputFile();
+    }
+
+    if (result)
+    {
+        resolveMs = (static_cast<double>(statistics.ResolveTicks) * 1e3 / frequency.QuadPart);
+        lookupMs = (static_cast<double>(statistics.LookupTicks) * 1e3 / frequency.QuadPart);
+        formatMs = (static_cast<double>(statistics.FormatTicks) * 1e3 / frequency.QuadPart);
+
+        wprintf(L"[+] Symbolization statistics:\n");
+        wprintf(L"  [>] Events: %llu (%llu frames)\n", statistics.Events, statistics.Frames);
+        wprintf(L"  [>] Frames resolved to a symbol: %llu (%.2f%%)\n",
+                statistics.FramesResolved,
+                ((statistics.Frames != 0) ? ((100.0 * statistics.FramesResolved) / statistics.Frames) : 0.0));
+        wprintf(L"  [>] Images referenced: %llu (cache: %llu, PDB: %llu, dbghelp: %llu, exports: %llu, none: %llu)\n",
+                statistics.ImagesReferenced,
+                statistics.ImagesBySource[SymbolizeSourceCache],
+                statistics.ImagesBySource[SymbolizeSourcePdb],
+                statistics.ImagesBySource[SymbolizeSourceDbgHelp],
+                statistics.ImagesBySource[SymbolizeSourceExports],
+                statistics.ImagesBySource[SymbolizeSourceNone]);
+        wprintf(L"  [>] Worker threads: %lu\n", statistics.Threads);
+        wprintf(L"  [>] Image load time: %.2f ms\n", (static_cast<double>(statistics.LoadTicks) * 1e3 / frequency.QuadPart));
+        wprintf(L"  [>] Resolve and write time: %.2f ms (%.0f events/s)\n",
+                resolveMs,
+                ((resolveMs != 0) ? (statistics.Events * 1e3 / resolveMs) : 0.0));
+
+        //
+        // Summed over the workers, so this is per-core throughput.
+        //
+        wprintf(L"  [>] Frame lookup time (all threads): %.2f ms (%.0f frames/s per thread)\n",
+                lookupMs,
+                ((lookupMs != 0) ? (statistics.Frames * 1e3 / lookupMs) : 0.0));
+        wprintf(L"  [>] Format time (all threads): %.2f ms (%.1f MB/s per thread)\n",
+                formatMs,
+                ((formatMs != 0) ? ((statistics.FormatBytes / (1024.0 * 1024.0)) * 1e3 / formatMs) : 0.0));
+    }
+
+    CloseSymbolizeContext(&context);
+
+    return result;
+}
+
+/**
+*
+* @brief        Counts a raw capture into an aggregate: exact per secure call and
+*               per (symbolized) stack counts, with no sketch error. Frames are
+*               resolved from the table cache, PDBs and exports only.
+* @param[in]    RawCapturePath - The capture written with -raw.
+* @param[in]    SymbolStore - The symbol store to search for images and PDBs.
+* @param[in]    ThreadCount - The number of worker threads. 0 for one per processor.
+* @param[out]   Aggregate - Receives the aggregate.
+* @param[out]   Seconds - Receives the time from the first event to the last.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+AggregateRawCapture (
+    _In_ const wchar_t* RawCapturePath,
+    _In_ const wchar_t* SymbolStore,
+    _In_ ULONG ThreadCount,
+    _Out_ PAGGREGATE Aggregate,
+    _Out_ double* Seconds
+    )
+{
+    bool result;
+    SYMBOLIZE_CONTEXT context;
+    SYMBOLIZE_STATISTICS statistics;
+    RAW_CAPTURE_HEADER captureHeader;
+    std::vector<SYMBOLIZE_AGGREGATE_WORKER> workers;
+    std::vector<PVOID> parameters;
+    uint64_t firstTimeStamp;
+    uint64_t lastTimeStamp;
+
+    result = false;
+    firstTimeStamp = 0;
+    lastTimeStamp = 0;
+    *Seconds = 0;
+
+    RtlZeroMemory(&statistics, sizeof(statistics));
+
+    InitializeAggregate(Aggregate);
+
+    context.SymbolStore = SymbolStore;
+
+    ThreadCount = GetSymbolizeThreadCount(ThreadCount);
+
+    if (!OpenSymbolizeContext(&context,
+                              RawCapturePath,
+                              ThreadCount,
+                              false,
+                              &statistics))
+    {
+        goto Exit;
+    }
+
+    RtlCopyMemory(&captureHeader, context.CaptureData, sizeof(captureHeader));
+
+    //
+    // Nothing is ever dropped, so no sketch may truncate while merging.
+    //
+    workers.resize(ThreadCount);
+
+    for (auto& worker : workers)
+    {
+        InitializeAggregate(&worker.Aggregate);
+
+        for (auto& topK : worker.Aggregate.TopK)
+        {
+            topK.Capacity = MAXULONG;
+        }
+
+        worker.SecureCallIds.assign(MAXUSHORT + 1, MAXULONG);
+        worker.NameIds.assign(context.Names.size(), MAXULONG);
+        worker.FirstTimeStamp = 0;
+        worker.LastTimeStamp = 0;
+    }
+
+    for (SIZE_T batchStart = 0; batchStart < context.Events.size(); batchStart += SYMBOLIZE_BATCH_EVENTS)
+    {
+        SIZE_T batchCount;
+        SIZE_T sliceSize;
+        SIZE_T next;
+
+        batchCount = (std::min)(static_cast<SIZE_T>(SYMBOLIZE_BATCH_EVENTS), (context.Events.size() - batchStart));
+        sliceSize = ((batchCount + ThreadCount - 1) / ThreadCount);
+        next = batchStart;
+
+        parameters.clear();
+
+        for (auto& worker : workers)
+        {
+            worker.Resolve.Context = &context;
+            worker.Resolve.FirstEvent = next;
+            worker.Resolve.EventCount = (std::min)(sliceSize, (batchStart + batchCount) - next);
+
+            next += worker.Resolve.EventCount;
+
+            if (worker.Resolve.EventCount != 0)
+            {
+                parameters.push_back(&worker);
+            }
+        }
+
+        if (!RunWorkerThreads(SymbolizeAggregateWorker, parameters))
+        {
+            goto Exit;
+        }
+    }
+
+    for (auto& worker : workers)
+    {
+        if (worker.FirstTimeStamp != 0)
+        {
+            firstTimeStamp = ((firstTimeStamp == 0) ? worker.FirstTimeStamp : (std::min)(firstTimeStamp, worker.FirstTimeStamp));
+        }
+
+        lastTimeStamp = (std::max)(lastTimeStamp, worker.LastTimeStamp);
+
+        MergeAggregate(Aggregate, &worker.Aggregate);
+    }
+
+    for (auto& topK : Aggregate->TopK)
+    {
+        topK.Capacity = static_cast<uint32_t>(topK.Entries.size());
+    }
+
+    Aggregate->Snapshots = 1;
+
+    if ((captureHeader.QpcFrequency != 0) &&
+        (lastTimeStamp > firstTimeStamp))
+    {
+        *Seconds = (static_cast<double>(lastTimeStamp - firstTimeStamp) / captureHeader.QpcFrequency);
+    }
+
+    Aggregate->ExposureSeconds = *Seconds;
+
+    if ((IsClockValid(&context.Clock)) &&
+        (firstTimeStamp != 0))
+    {
+        Aggregate->FirstTime = GetClockTime(&context.Clock, firstTimeStamp);
+        Aggregate->LastTime = GetClockTime(&context.Clock, lastTimeStamp);
+    }
+
+    result = true;
+
+Exit:
+    CloseSymbolizeContext(&context);
+
+    return result;
+}
\ No newline at end of file
@@ -13,7 +13,8 @@
 --*/
 #include "Symbols.hpp"
 #include "Helpers.hpp"
-#include <unordered_map>
+#include <map>
+#include <vector>
 #include <Shlwapi.h>
 #include <string>
 
@@ -24,9 +25,16 @@ static bool k_NtFound = false;
 static ULONG_PTR k_NtBase = 0;
 
 //
-// A mapping of all valid secure call numbers -> names (strings)
+// Secure call number -> nt!_SKSERVICE name, indexed directly by the call
+// number. An empty name is a number the enum does not define.
 //
-static std::unordered_map<ULONG, wchar_t*> k_SecureCallValues;
+static std::vector<std::string> k_SecureCallNames;
+
+//
+// Modules registered for symbols, keyed by base address.
+//
+static std::map<ULONG_PTR, SYMBOL_MODULE> k_SymbolModules;
+static SYMBOL_LOAD_STATISTICS k_SymbolLoadStatistics = { 0 };
 
 //
 // Functionality for symbols
@@ -40,6 +48,7 @@ SymLoadModuleExW_T SymLoadModuleExW_I = NULL;
 SymFromAddrW_T SymFromAddrW_I = NULL;
 SymGetTypeFromNameW_T SymGetTypeFromNameW_I = NULL;
 SymGetTypeInfo_T SymGetTypeInfo_I = NULL;
+SymEnumSymbolsW_T SymEnumSymbolsW_I = NULL;
 
 /**
 *
@@ -116,6 +125,7 @@ InitializeSymbols ()
     SymFromAddrW_I = reinterpret_cast<SymFromAddrW_T>(GetProcAddress(dbgHelp, "SymFromAddrW"));
     SymGetTypeFromNameW_I = reinterpret_cast<SymGetTypeFromNameW_T>(GetProcAddress(dbgHelp, "SymGetTypeFromNameW"));
     SymGetTypeInfo_I = reinterpret_cast<SymGetTypeInfo_T>(GetProcAddress(dbgHelp, "SymGetTypeInfo"));
+    SymEnumSymbolsW_I = reinterpret_cast<SymEnumSymbolsW_T>(GetProcAddress(dbgHelp, "SymEnumSymbolsW"));
 
     if ((SymGetOptions_I == NULL) ||
         (SymInitializeW_I == NULL) ||
@@ -125,7 +135,8 @@ InitializeSymbols ()
         (SymLoadModuleExW_I == NULL) ||
         (SymFromAddrW_I == NULL) ||
         (SymGetTypeFromNameW_I == NULL) ||
-        (SymGetTypeInfo_I == NULL))
+        (SymGetTypeInfo_I == NULL) ||
+        (SymEnumSymbolsW_I == NULL))
     {
         wprintf(L"[-] Error! GetProcAddress failed in InitializeSymbols. (GLE: %d)\n", GetLastError());
         goto Exit;
@@ -168,28 +179,471 @@ Exit:
 
 /**
 *
-* @brief        Captures each loaded image (notified from ETW) for symbol processing.
-* @param[in]    BaseAddress - The base address of the target module being loaded.
-* @param[in]    ImagePath - The NT path of the loaded image.
-* @param[in]    Size - The size of the loaded image.
-* @return       true on success, otherwise false.
+* @brief        SymEnumSymbolsW callback. Collects a module's functions and publics.
+* @param[in]    SymbolInfo - The enumerated symbol.
+* @param[in]    SymbolSize - The size of the symbol.
+* @param[in]    UserContext - The record vector being filled.
+* @return       TRUE to keep enumerating.
+*
+*/
+static
+BOOL
+CALLBACK
+CollectSymbolTableRecord (
+    _In_ PSYMBOL_INFOW SymbolInfo,
+    _In_ ULONG SymbolSize,
+    _In_opt_ PVOID UserContext
+    )
+{
+    std::vector<SYMBOL_TABLE_RECORD>* records;
+    SYMBOL_TABLE_RECORD record;
+
+    UNREFERENCED_PARAMETER(SymbolSize);
+
+    records = static_cast<std::vector<SYMBOL_TABLE_RECORD>*>(UserContext);
+
+    //
+    // Stack frames only ever land in code.
+    //
+    if ((SymbolInfo->Tag != SymTagFunction) &&
+        (SymbolInfo->Tag != SymTagPublicSymbol))
+    {
+        goto Exit;
+    }
+
+    //
+    // dbghelp falls back to exports when there is no PDB. Those are not
+    // worth caching (a PDB may show up later) - the export tier handles them.
+    //
+    if ((SymbolInfo->Flags & SYMFLAG_EXPORT) != 0)
+    {
+        goto Exit;
+    }
+
+    if (SymbolInfo->Address < SymbolInfo->ModBase)
+    {
+        goto Exit;
+    }
+
+    record.Rva = static_cast<ULONG>(SymbolInfo->Address - SymbolInfo->ModBase);
+    record.Name = ConvertToUtf8(SymbolInfo->Name, SymbolInfo->NameLen);
+
+    records->push_back(std::move(record));
+
+Exit:
+    return TRUE;
+}
+
+/**
+*
+* @brief        Extracts a module's symbols (already loaded in dbghelp) into the
+*               on-disk table cache and maps the result.
+* @param[in]    BaseAddress - The base address the module is loaded at in dbghelp.
+* @param[in]    Key - The module identity.
+* @param[out]   Table - The mapped table.
+* @return       true if the module now has a mapped table, otherwise false.
 *
 */
+static
 bool
-CaptureModuleForSymbols (
+BuildSymbolTableForModule (
     _In_ ULONG_PTR BaseAddress,
-    _In_ wchar_t* ImagePath,
-    _In_ ULONG Size
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Out_ PSYMBOL_TABLE Table
     )
 {
     bool result;
+    std::vector<SYMBOL_TABLE_RECORD> records;
+
+    result = false;
+
+    if (SymEnumSymbolsW_I(GetCurrentProcess(),
+                          static_cast<ULONG64>(BaseAddress),
+                          L"*",
+                          CollectSymbolTableRecord,
+                          &records) == FALSE)
+    {
+        goto Exit;
+    }
+
+    //
+    // No symbols (e.g. no PDB on the symbol path) - nothing worth caching.
+    //
+    if (!WriteSymbolTable(Key, records))
+    {
+        goto Exit;
+    }
+
+    k_SymbolLoadStatistics.TablesBuilt++;
+
+    result = OpenSymbolTable(Key, Table);
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Builds a module's cached table straight from its PDB, if the PDB is
+*               already on disk (symbol store, build output or next to the image).
+*               No dbghelp involved, so this is safe to call from several threads
+*               for different images.
+* @param[in]    ImagePath - The image on disk.
+* @param[in]    SymbolStore - The symbol store to search.
+* @param[in]    Key - The module identity.
+* @param[out]   Table - The mapped table.
+* @return       true if the module now has a mapped table, otherwise false.
+*
+*/
+bool
+BuildSymbolTableFromLocalPdb (
+    _In_ const wchar_t* ImagePath,
+    _In_ const wchar_t* SymbolStore,
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Out_ PSYMBOL_TABLE Table
+    )
+{
+    bool result;
+    PE_CODEVIEW codeView;
+    PDB_SYMBOL_TABLE pdbTable;
+    std::wstring recordedPath;
+    std::wstring pdbName;
+    std::wstring imagePath(ImagePath);
+    std::wstring candidates[3];
+    wchar_t signature[48];
+    size_t separator;
+    std::vector<SYMBOL_TABLE_RECORD> records;
+
+    result = false;
+
+    if (!LoadPeCodeView(ImagePath, &codeView))
+    {
+        goto Exit;
+    }
+
+    //
+    // PDB paths written by the linker are ASCII in practice.
+    //
+    recordedPath.assign(codeView.PdbPath.begin(), codeView.PdbPath.end());
+
+    separator = recordedPath.find_last_of(L"\\/");
+    pdbName = ((separator != std::wstring::npos) ? recordedPath.substr(separator + 1) : recordedPath);
+
+    if (pdbName.empty())
+    {
+        goto Exit;
+    }
+
+    //
+    // Symbol store layout: <store>\<pdb>\<GUID><age>\<pdb>. The GUID's
+    // first three fields are little-endian.
+    //
+    swprintf(signature,
+             ARRAYSIZE(signature),
+             L"%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X",
+             ReadLe32(codeView.Guid),
+             ReadLe16(codeView.Guid + 4),
+             ReadLe16(codeView.Guid + 6),
+             codeView.Guid[8], codeView.Guid[9], codeView.Guid[10], codeView.Guid[11],
+             codeView.Guid[12], codeView.Guid[13], codeView.Guid[14], codeView.Guid[15],
+             codeView.Age);
+
+    candidates[0] = (std::wstring(SymbolStore) + L"\\" + pdbName + L"\\" + signature + L"\\" + pdbName);
+    candidates[1] = recordedPath;
+
+    separator = imagePath.find_last_of(L'\\');
+    if (separator != std::wstring::npos)
+    {
+        candidates[2] = (imagePath.substr(0, separator + 1) + pdbName);
+    }
+
+    for (const auto& candidate : candidates)
+    {
+        if (candidate.empty())
+        {
+            continue;
+        }
+
+        if (!LoadPdb(candidate.c_str(), &pdbTable))
+        {
+            continue;
+        }
+
+        //
+        // A PDB from another build would give confidently wrong names.
+        //
+        if ((memcmp(pdbTable.Guid, codeView.Guid, sizeof(codeView.Guid)) != 0) ||
+            (pdbTable.Age != codeView.Age))
+        {
+            continue;
+        }
+
+        records.reserve(pdbTable.Symbols.size());
+
+        //
+        // Named the same as the dbghelp path (SYMOPT_UNDNAME), so a table
+        // does not change with where it was built from.
+        //
+        for (const auto& pdbSymbol : pdbTable.Symbols)
+        {
+            SYMBOL_TABLE_RECORD record;
+
+            record.Rva = pdbSymbol.Rva;
+
+            UndecoratePdbName((pdbTable.Names.data() + pdbSymbol.NameOffset), record.Name);
+
+            records.push_back(std::move(record));
+        }
+
+        if (!WriteSymbolTable(Key, records))
+        {
+            goto Exit;
+        }
+
+        result = OpenSymbolTable(Key, Table);
+        break;
+    }
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Builds a table for an image through dbghelp (symbol server included)
+*               without registering it for live lookups. Not thread-safe.
+* @param[in]    ImagePath - The image path. Need not exist locally.
+* @param[in]    BaseAddress - Where to load the image in dbghelp. Any free range will do,
+*                             the table is RVA-based.
+* @param[in]    Key - The module identity.
+* @param[out]   Table - The mapped table.
+* @return       true if the module now has a mapped table, otherwise false.
+*
+*/
+bool
+BuildSymbolTableWithDbgHelp (
+    _In_ const wchar_t* ImagePath,
+    _In_ ULONG_PTR BaseAddress,
+    _In_ const SYMBOL_TABLE_KEY* Key,
+    _Out_ PSYMBOL_TABLE Table
+    )
+{
+    bool result;
+
+    result = false;
+
+    if (SymLoadModuleExW_I(GetCurrentProcess(),
+                           NULL,
+                           ImagePath,
+                           NULL,
+                           static_cast<ULONG64>(BaseAddress),
+                           Key->ImageSize,
+                           NULL,
+                           0) == 0)
+    {
+        goto Exit;
+    }
+
+    result = BuildSymbolTableForModule(BaseAddress, Key, Table);
+
+Exit:
+    return result;
+}
+
+/**
+*
+* @brief        Loads symbols for a registered module. A cached table for the exact
+*               image is mapped if there is one; otherwise the table is built from a
+*               local PDB, or the module goes through dbghelp once, and the table
+*               is written for the next run.
+* @param[in]    BaseAddress - The base address of the module.
+* @param[in]    Module - The registered module.
+* @param[in]    RequireDbgHelp - Load the module into dbghelp even on a cache hit
+*                                (needed for type queries).
+* @return       true on success, otherwise false.
+*
+*/
+static
+bool
+LoadSymbolModule (
+    _In_ ULONG_PTR BaseAddress,
+    _Inout_ PSYMBOL_MODULE Module,
+    _In_ bool RequireDbgHelp
+    )
+{
     ULONG_PTR baseAddr;
+    SYMBOL_TABLE_KEY tableKey;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    Module->LoadAttempted = true;
+
+    //
+    // Tables are keyed on the file name, not the full path.
+    //
+    tableKey.ImageName = wcsrchr(Module->ImagePath.c_str(), L'\\');
+    tableKey.ImageName = ((tableKey.ImageName != NULL) ? (tableKey.ImageName + 1) : Module->ImagePath.c_str());
+    tableKey.TimeDateStamp = Module->TimeDateStamp;
+    tableKey.ImageChecksum = Module->ImageChecksum;
+    tableKey.ImageSize = Module->Size;
+
+    QueryPerformanceCounter(&start);
+
+    //
+    // Warm: no PDB parsing at all.
+    //
+    Module->TableMapped = OpenSymbolTable(&tableKey, &Module->Table);
+    if (Module->TableMapped)
+    {
+        k_SymbolLoadStatistics.TableCacheHits++;
+    }
+    else
+    {
+        //
+        // Cold, but the PDB may already be on disk. Reading it directly
+        // is far cheaper than going through dbghelp.
+        //
+        Module->TableMapped = BuildSymbolTableFromLocalPdb(Module->ImagePath.c_str(),
+                                                           SYMBOL_STORE_DIRECTORY,
+                                                           &tableKey,
+                                                           &Module->Table);
+        if (Module->TableMapped)
+        {
+            k_SymbolLoadStatistics.PdbTablesBuilt++;
+        }
+    }
+
+    if (Module->TableMapped)
+    {
+        Module->Loaded = true;
+
+        if (!RequireDbgHelp)
+        {
+            goto Exit;
+        }
+    }
+
+    baseAddr = SymLoadModuleExW_I(GetCurrentProcess(),
+                                  NULL,
+                                  Module->ImagePath.c_str(),
+                                  NULL,
+                                  static_cast<ULONG64>(BaseAddress),
+                                  Module->Size,
+                                  NULL,
+                                  0);
+    if (baseAddr == 0)
+    {
+        goto Exit;
+    }
+
+    Module->Loaded = true;
+
+    //
+    // Cold: build the table so the next run is warm.
+    //
+    if (!Module->TableMapped)
+    {
+        Module->TableMapped = BuildSymbolTableForModule(BaseAddress,
+                                                        &tableKey,
+                                                        &Module->Table);
+    }
+
+Exit:
+    //
+    // No PDB (or dbghelp could not load the module at all). The image's
+    // own export directory is better than a bare offset.
+    //
+    if (!Module->TableMapped)
+    {
+        Module->ExportsLoaded = LoadPeExports(Module->ImagePath.c_str(),
+                                              &Module->Exports);
+        if (Module->ExportsLoaded)
+        {
+            Module->Loaded = true;
+
+            k_SymbolLoadStatistics.ExportTablesLoaded++;
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+
+    k_SymbolLoadStatistics.LoadTicks += (end.QuadPart - start.QuadPart);
+
+    if (Module->Loaded)
+    {
+        k_SymbolLoadStatistics.ModulesLoaded++;
+    }
+    else
+    {
+        k_SymbolLoadStatistics.ModuleLoadFailures++;
+    }
+
+    return Module->Loaded;
+}
+
+/**
+*
+* @brief        Makes sure symbols are loaded for the module containing an address.
+*               The first frame to land in a module pays for its load.
+* @param[in]    TargetAddress - The target address.
+* @param[out]   ModuleBase - The base address of the containing module.
+* @return       The containing module if it has symbols loaded, otherwise NULL.
+*
+*/
+static
+PSYMBOL_MODULE
+EnsureSymbolsForAddress (
+    _In_ ULONG_PTR TargetAddress,
+    _Out_ ULONG_PTR* ModuleBase
+    )
+{
+    *ModuleBase = 0;
+
+    auto it = k_SymbolModules.upper_bound(TargetAddress);
+    if (it == k_SymbolModules.begin())
+    {
+        return NULL;
+    }
+
+    --it;
+
+    if (TargetAddress >= (it->first + it->second.Size))
+    {
+        return NULL;
+    }
+
+    if (!it->second.LoadAttempted)
+    {
+        LoadSymbolModule(it->first, &it->second, false);
+    }
+
+    if (!it->second.Loaded)
+    {
+        return NULL;
+    }
+
+    *ModuleBase = it->first;
+
+    return &it->second;
+}
+
+/**
+*
+* @brief        Converts the NT path from an image load event into a path the
+*               symbol code can open.
+* @param[in]    ImagePath - The NT path of the image.
+* @return       The converted path.
+*
+*/
+std::wstring
+GetSymbolImagePath (
+    _In_ const wchar_t* ImagePath
+    )
+{
     std::wstring finalPath(ImagePath);
     std::wstring kernelPrefix(L"\\SystemRoot");
     std::wstring userPrefix(L"\\Device\\HarddiskVolume3");
 
-    result = false;
-
     //
     // Handle drivers
     //
@@ -210,34 +664,77 @@ CaptureModuleForSymbols (
         }
     }
 
+    return finalPath;
+}
+
+/**
+*
+* @brief        Captures each loaded image (notified from ETW) for symbol processing.
+*               The module is only registered here - symbols are loaded on first use.
+* @param[in]    BaseAddress - The base address of the target module being loaded.
+* @param[in]    ImagePath - The NT path of the loaded image.
+* @param[in]    Size - The size of the loaded image.
+* @param[in]    TimeDateStamp - The image's PE TimeDateStamp.
+* @param[in]    ImageChecksum - The image's PE checksum.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+CaptureModuleForSymbols (
+    _In_ ULONG_PTR BaseAddress,
+    _In_ const wchar_t* ImagePath,
+    _In_ ULONG Size,
+    _In_ ULONG TimeDateStamp,
+    _In_ ULONG ImageChecksum
+    )
+{
+    bool result;
+    SYMBOL_MODULE symbolModule;
+
+    result = false;
+
+    symbolModule.ImagePath = GetSymbolImagePath(ImagePath);
+    symbolModule.Size = Size;
+    symbolModule.TimeDateStamp = TimeDateStamp;
+    symbolModule.ImageChecksum = ImageChecksum;
+    symbolModule.LoadAttempted = false;
+    symbolModule.Loaded = false;
+    symbolModule.TableMapped = false;
+    symbolModule.ExportsLoaded = false;
+
+    RtlZeroMemory(&symbolModule.Table, sizeof(symbolModule.Table));
+
+    //
+    // Track the module! A module loaded over an old one's range
+    // replaces it.
+    //
+    auto it = k_SymbolModules.find(BaseAddress);
+    if (it != k_SymbolModules.end())
+    {
+        CloseSymbolTable(&it->second.Table);
+    }
+
+    k_SymbolModules[BaseAddress] = std::move(symbolModule);
+
+    it = k_SymbolModules.find(BaseAddress);
+
+    k_SymbolLoadStatistics.ModulesRegistered++;
+
     //
     // We need to preserve NT's base address for the secure call number
-    // to nt!_SKSERVICE enum.
+    // to nt!_SKSERVICE enum. The name table is built as soon as NT is
+    // seen (during the rundown), never on the record-writing path.
     //
     if (!k_NtFound)
     {
         if (wcscmp(L"C:\\Windows\\system32\\ntoskrnl.exe",
-                   finalPath.c_str()) == 0)
+                   it->second.ImagePath.c_str()) == 0)
         {
             k_NtBase = BaseAddress;
             k_NtFound = true;
-        }
-    }
 
-    //
-    // Track the module!
-    //
-    baseAddr = SymLoadModuleExW_I(GetCurrentProcess(),
-                                  NULL,
-                                  finalPath.c_str(),
-                                  NULL,
-                                  static_cast<ULONG64>(BaseAddress),
-                                  Size,
-                                  NULL,
-                                  0);
-    if (baseAddr == 0)
-    {
-        goto Exit;
+            CreateListOfValidSecureCalls();
+        }
     }
 
     result = true;
@@ -248,83 +745,131 @@ Exit:
 
 /**
 *
-* @brief        Processes a stack frame address into the appropriate (symbol or image) 
-*               name and offset.
+* @brief        Processes a stack frame address into the appropriate symbol name
+*               and offset, appended to the row being formatted.
+* @param[in]    Buffer - The row being formatted.
 * @param[in]    TargetAddress - The target address.
-* @param[in]    ImageName - The name of the image where this address is found.
-*                           This is in case we cannot find an appropriate symbol.
-* @return       The "string-ified" name.
+* @param[in]    ImageName - The (UTF-8) name of the image where this address is found.
+* @param[in]    Separator - Appended after the frame, or FORMAT_NO_SEPARATOR.
+* @return       true if a symbol was found (and the frame appended), otherwise
+*               false (nothing appended - the caller falls back to the image).
 *
 */
-wchar_t*
-ConvertAddressToFrameStringWithSymbol (
+bool
+FormatFrameWithSymbol (
+    _Inout_ PFORMAT_BUFFER Buffer,
     _In_ ULONG_PTR TargetAddress,
-    _In_ wchar_t* ImageName
+    _In_ const char* ImageName,
+    _In_ char Separator
     )
 {
+    bool result;
     PSYMBOL_INFOW symbol;
     ULONGLONG offset;
-    char buffer[sizeof(SYMBOL_INFOW) + MAX_SYM_NAME * sizeof(wchar_t)] = { 0 };
-    std::wstring fullFrameString;
-    SIZE_T returnStringLength;
-    wchar_t* returnString;
-    
+    char buffer[sizeof(SYMBOL_INFOW) + MAX_SYM_NAME * sizeof(wchar_t)];
+    char symbolNameUtf8[MAX_SYM_NAME * UTF8_MAX_BYTES_PER_WCHAR + 1];
+    PSYMBOL_MODULE symbolModule;
+    ULONG_PTR moduleBase;
+    const char* symbolName;
+    ULONG displacement;
+    uint32_t exportDisplacement;
+
+    result = false;
     symbol = reinterpret_cast<PSYMBOL_INFOW>(buffer);
     offset = 0;
-    returnStringLength = 0;
-    returnString = NULL;
-
-    RtlZeroMemory(&buffer, sizeof(buffer));
+    symbolName = NULL;
+    displacement = 0;
+    exportDisplacement = 0;
 
-    symbol->SizeOfStruct = sizeof(SYMBOL_INFOW);
-    symbol->MaxNameLen = MAX_SYM_NAME;
-
-    if (SymFromAddrW_I(GetCurrentProcess(),
-                       (ULONG64)TargetAddress,
-                       &offset,
-                       symbol) == FALSE)
+    symbolModule = EnsureSymbolsForAddress(TargetAddress, &moduleBase);
+    if (symbolModule == NULL)
     {
         goto Exit;
     }
 
-    //
-    // Construct the frame as a symbol string.
-    //
-    fullFrameString.append(ImageName);
-    fullFrameString.append(L"!");
-    fullFrameString.append(symbol->Name);
-    fullFrameString.append(L" + ");
-    fullFrameString.append(std::to_wstring(offset));
-    fullFrameString.append(L"|");
+    if (symbolModule->TableMapped)
+    {
+        //
+        // Binary search of the mapped table.
+        //
+        symbolName = LookupSymbolTable(&symbolModule->Table,
+                                       static_cast<ULONG>(TargetAddress - moduleBase),
+                                       &displacement);
+        if (symbolName == NULL)
+        {
+            goto Exit;
+        }
 
-    //
-    // Calculate the string
-    //
-    returnStringLength = (fullFrameString.length() * sizeof(wchar_t) + sizeof(UNICODE_NULL));
+        offset = displacement;
+    }
+    else if (symbolModule->ExportsLoaded)
+    {
+        //
+        // Binary search of the module's exports.
+        //
+        symbolName = LookupPeExport(&symbolModule->Exports,
+                                    static_cast<uint32_t>(TargetAddress - moduleBase),
+                                    &exportDisplacement);
+        if (symbolName == NULL)
+        {
+            goto Exit;
+        }
 
-    returnString = static_cast<wchar_t*>(malloc(returnStringLength));
-    if (returnString == NULL)
+        offset = exportDisplacement;
+    }
+    else
     {
-        wprintf(L"[-] Error! malloc failed in GetSymbolNameFromAddress. (GLE: %d)\n", GetLastError());
-        goto Exit;
+        //
+        // Only the (rare) dbghelp fallback needs the 4 KB symbol buffer cleared.
+        //
+        RtlZeroMemory(buffer, sizeof(SYMBOL_INFOW));
+
+        symbol->SizeOfStruct = sizeof(SYMBOL_INFOW);
+        symbol->MaxNameLen = MAX_SYM_NAME;
+
+        if (SymFromAddrW_I(GetCurrentProcess(),
+                           (ULONG64)TargetAddress,
+                           &offset,
+                           symbol) == FALSE)
+        {
+            goto Exit;
+        }
+
+        //
+        // The one name which is not already UTF-8.
+        //
+        symbolNameUtf8[TranscodeUtf16ToUtf8(symbol->Name,
+                                            (std::min)(static_cast<ULONG>(symbol->NameLen), static_cast<ULONG>(MAX_SYM_NAME)),
+                                            symbolNameUtf8)] = '\0';
+
+        symbolName = symbolNameUtf8;
     }
 
-    RtlCopyMemory(returnString,
-                  fullFrameString.data(),
-                  returnStringLength);
+    //
+    // Construct the frame as a symbol string.
+    //
+    FormatSymbolFrame(Buffer, ImageName, symbolName, offset, Separator);
+
+    result = true;
 
 Exit:
-    return returnString;
+    return result;
 }
 
 /**
 *
-* @brief        Creates a mapping of secure call numbers to their nt!_SKSERVICE enum value.
+* @brief        Enumerates the nt!_SKSERVICE enum through dbghelp.
+* @param[in]    Records - Receives a (value, name) record per enumerator.
+* @return       true on success, otherwise false.
 *
 */
-void
-CreateListOfValidSecureCalls ()
+static
+bool
+QuerySecureCallEnum (
+    _Inout_ std::vector<SYMBOL_TABLE_RECORD>& Records
+    )
 {
+    bool result;
     SYMBOL_INFOW symbol;
     ULONG childrenCount;
     TI_FINDCHILDREN_PARAMS* childrenSyms;
@@ -332,7 +877,9 @@ CreateListOfValidSecureCalls ()
     wchar_t* childSymName;
     ULONG index;
     VARIANT secureCallValue;
+    SYMBOL_TABLE_RECORD record;
 
+    result = false;
     childrenCount = 0;
     childrenSyms = NULL;
     childrenSymSize = 0;
@@ -350,7 +897,7 @@ CreateListOfValidSecureCalls ()
                               L"_SKSERVICE",
                               &symbol) == FALSE)
     {
-        wprintf(L"[-] Error! SymGetTypeFromNameW failed in GetSecureCallSymbolName. (GLE: %d)\n", GetLastError());
+        wprintf(L"[-] Error! SymGetTypeFromNameW failed in QuerySecureCallEnum. (GLE: %d)\n", GetLastError());
         goto Exit;
     }
 
@@ -365,7 +912,7 @@ CreateListOfValidSecureCalls ()
                          TI_GET_CHILDRENCOUNT,
                          &childrenCount) == FALSE)
     {
-        wprintf(L"[-] Error! SymGetTypeInfo_I failed in GetSecureCallSymbolName. (GLE: %d)\n", GetLastError());
+        wprintf(L"[-] Error! SymGetTypeInfo_I failed in QuerySecureCallEnum. (GLE: %d)\n", GetLastError());
         goto Exit;
     }
 
@@ -373,7 +920,7 @@ CreateListOfValidSecureCalls ()
     childrenSyms = static_cast<TI_FINDCHILDREN_PARAMS*>(malloc(childrenSymSize));
     if (childrenSyms == NULL)
     {
-        wprintf(L"[-] Error! malloc failed in GetSecureCallSymbolName. (GLE: %d)\n", GetLastError());
+        wprintf(L"[-] Error! malloc failed in QuerySecureCallEnum. (GLE: %d)\n", GetLastError());
         goto Exit;
     }
 
@@ -388,7 +935,7 @@ CreateListOfValidSecureCalls ()
                          TI_FINDCHILDREN,
                          childrenSyms) == FALSE)
     {
-        wprintf(L"[-] Error! SymGetTypeInfo_I failed in GetSecureCallSymbolName. (GLE: %d)\n", GetLastError());
+        wprintf(L"[-] Error! SymGetTypeInfo_I failed in QuerySecureCallEnum. (GLE: %d)\n", GetLastError());
         goto Exit;
     }
 
@@ -400,7 +947,7 @@ CreateListOfValidSecureCalls ()
                              TI_GET_SYMNAME,
                              &childSymName) == FALSE)
         {
-            wprintf(L"[-] Error! SymGetTypeInfo_I failed in GetSecureCallSymbolName. (GLE: %d)\n", GetLastError());
+            wprintf(L"[-] Error! SymGetTypeInfo_I failed in QuerySecureCallEnum. (GLE: %d)\n", GetLastError());
             goto Exit;
         }
 
@@ -410,21 +957,134 @@ CreateListOfValidSecureCalls ()
                              TI_GET_VALUE,
                              &secureCallValue) == FALSE)
         {
-            wprintf(L"[-] Error! SymGetTypeInfo_I failed in GetSecureCallSymbolName. (GLE: %d)\n", GetLastError());
+            wprintf(L"[-] Error! SymGetTypeInfo_I failed in QuerySecureCallEnum. (GLE: %d)\n", GetLastError());
             goto Exit;
         }
 
-        k_SecureCallValues.insert({secureCallValue.ulVal, childSymName});
+        record.Rva = secureCallValue.ulVal;
+        record.Name = ConvertToUtf8(childSymName);
+
+        Records.push_back(record);
 
+        //
+        // dbghelp allocates the name with LocalAlloc.
+        //
+        LocalFree(childSymName);
         childSymName = NULL;
     }
 
+    result = true;
+
 Exit:
+    if (childSymName != NULL)
+    {
+        LocalFree(childSymName);
+    }
+
     if (childrenSyms != NULL)
     {
         free(childrenSyms);
     }
 
+    return result;
+}
+
+/**
+*
+* @brief        Creates the dense secure call number -> nt!_SKSERVICE name table.
+*               The table is cached on disk keyed by the ntoskrnl build, so a warm
+*               start needs no symbol type query (and does not load NT's PDB).
+*
+*/
+void
+CreateListOfValidSecureCalls ()
+{
+    SYMBOL_TABLE_KEY tableKey;
+    SYMBOL_TABLE table;
+    std::vector<SYMBOL_TABLE_RECORD> records;
+    PSYMBOL_MODULE ntModule;
+    ULONG highestValue;
+
+    highestValue = 0;
+
+    RtlZeroMemory(&table, sizeof(table));
+
+    auto it = k_SymbolModules.find(k_NtBase);
+    if (it == k_SymbolModules.end())
+    {
+        goto Exit;
+    }
+
+    ntModule = &it->second;
+
+    //
+    // Same identity as NT's own symbol table, under a different name.
+    //
+    tableKey.ImageName = L"ntoskrnl.exe!_SKSERVICE";
+    tableKey.TimeDateStamp = ntModule->TimeDateStamp;
+    tableKey.ImageChecksum = ntModule->ImageChecksum;
+    tableKey.ImageSize = ntModule->Size;
+
+    if (OpenSymbolTable(&tableKey, &table))
+    {
+        for (ULONG i = 0; i < table.Header->SymbolCount; i++)
+        {
+            SYMBOL_TABLE_RECORD record;
+
+            if (table.Entries[i].NameOffset >= table.StringCount)
+            {
+                continue;
+            }
+
+            record.Rva = table.Entries[i].Rva;
+            record.Name.assign(table.Strings + table.Entries[i].NameOffset);
+
+            records.push_back(std::move(record));
+        }
+
+        CloseSymbolTable(&table);
+    }
+    else
+    {
+        //
+        // Cold. The type query needs NT in dbghelp.
+        //
+        if (!ntModule->LoadAttempted)
+        {
+            LoadSymbolModule(k_NtBase, ntModule, true);
+        }
+
+        if (!QuerySecureCallEnum(records))
+        {
+            goto Exit;
+        }
+
+        WriteSymbolTable(&tableKey, records);
+    }
+
+    //
+    // Secure call numbers are 16 bits - anything larger is bogus.
+    //
+    for (const auto& record : records)
+    {
+        if ((record.Rva <= MAXUSHORT) &&
+            (record.Rva > highestValue))
+        {
+            highestValue = record.Rva;
+        }
+    }
+
+    k_SecureCallNames.assign(highestValue + 1, std::string());
+
+    for (auto& record : records)
+    {
+        if (record.Rva <= MAXUSHORT)
+        {
+            k_SecureCallNames[record.Rva] = std::move(record.Name);
+        }
+    }
+
+Exit:
     return;
 }
 
@@ -432,30 +1092,32 @@ Exit:
 *
 * @brief        Retrieves the literal name for a secure call value.
 * @param[in]    SecureCallValue - The target secure call value.
-* @return       The associated nt!_SKSERVICE enum value.
+* @return       The associated nt!_SKSERVICE enum value (UTF-8), or "Unknown".
 *
 */
-wchar_t*
+const char*
 GetSecureCallName (
     _In_ ULONG SecureCallValue
     )
 {
-    auto it = k_SecureCallValues.find(SecureCallValue);
-    return it->second;
+    if ((SecureCallValue >= k_SecureCallNames.size()) ||
+        (k_SecureCallNames[SecureCallValue].empty()))
+    {
+        return "Unknown";
+    }
+
+    return k_SecureCallNames[SecureCallValue].c_str();
 }
 
 /**
 *
-* @brief        Tears down the secure call mapping strings. Called on Vtl1Mon exit.
+* @brief        Tears down the secure call name table. Called on Vtl1Mon exit.
 *
 */
 void
 DestroySecureCallNameVector ()
 {
-    for (auto &i : k_SecureCallValues)
-    {
-        free(i.second);
-    }
+    k_SecureCallNames.clear();
 }
 
 /**
@@ -466,5 +1128,49 @@ DestroySecureCallNameVector ()
 void
 SymbolCleanup ()
 {
+    LARGE_INTEGER frequency;
+    ULONGLONG attempted;
+    ULONGLONG untouched;
+    double loadMs;
+    double averageMs;
+
+    loadMs = 0;
+    averageMs = 0;
+
+    QueryPerformanceFrequency(&frequency);
+
+    loadMs = (static_cast<double>(k_SymbolLoadStatistics.LoadTicks) * 1e3 / frequency.QuadPart);
+
+    //
+    // Every module we never touched is a load we did not do at startup.
+    // This is not measured: it is estimated at the average cost of the
+    // loads we did do, and printed with its inputs so it reads as such.
+    //
+    attempted = (k_SymbolLoadStatistics.ModulesLoaded + k_SymbolLoadStatistics.ModuleLoadFailures);
+    untouched = (k_SymbolLoadStatistics.ModulesRegistered - attempted);
+
+    if (attempted != 0)
+    {
+        averageMs = (loadMs / attempted);
+    }
+
+    wprintf(L"[+] Symbol statistics:\n");
+    wprintf(L"  [>] Modules registered: %llu\n", k_SymbolLoadStatistics.ModulesRegistered);
+    wprintf(L"  [>] Modules loaded: %llu (%llu failed)\n", k_SymbolLoadStatistics.ModulesLoaded, k_SymbolLoadStatistics.ModuleLoadFailures);
+    wprintf(L"  [>] Symbol tables from cache: %llu (%llu built, %llu from local PDBs)\n", k_SymbolLoadStatistics.TableCacheHits, k_SymbolLoadStatistics.TablesBuilt, k_SymbolLoadStatistics.PdbTablesBuilt);
+    wprintf(L"  [>] Modules resolved from exports: %llu\n", k_SymbolLoadStatistics.ExportTablesLoaded);
+    wprintf(L"  [>] Module load time: %.2f ms\n", loadMs);
+    wprintf(L"  [>] Startup time saved (estimate, not measured): %llu modules never loaded x %.2f ms average load = %.2f ms\n",
+            untouched,
+            averageMs,
+            (untouched * averageMs));
+
+    for (auto& i : k_SymbolModules)
+    {
+        CloseSymbolTable(&i.second.Table);
+    }
+
+    k_SymbolModules.clear();
+
     SymCleanup_I(GetCurrentProcess());
 }
\ No newline at end of file
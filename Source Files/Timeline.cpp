@@ -0,0 +1,818 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Timeline.cpp
+*
+* @summary:   Timeline export. Writes a Perfetto protobuf trace as events
+*             stream in: a slice per secure call (VTL 1 enter to exit) on its
+*             thread's track, and the call stack as a sample on the same thread
+*             at the enter. Names, frames and stacks are interned, so a slice
+*             costs a couple of dozen bytes however deep its stack is.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Timeline.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include "Helpers.hpp"
+#include "Format.hpp"
+#include "Clock.hpp"
+#include "TopK.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+//
+// Perfetto protobuf field numbers (perfetto/trace/trace_packet.proto and
+// friends). Only what is written here.
+//
+#define PERFETTO_TRACE_PACKET 1
+
+#define PERFETTO_PACKET_CLOCK_SNAPSHOT 6
+#define PERFETTO_PACKET_TIMESTAMP 8
+#define PERFETTO_PACKET_SEQUENCE_ID 10
+#define PERFETTO_PACKET_TRACK_EVENT 11
+#define PERFETTO_PACKET_INTERNED_DATA 12
+#define PERFETTO_PACKET_SEQUENCE_FLAGS 13
+#define PERFETTO_PACKET_TRACK_DESCRIPTOR 60
+#define PERFETTO_PACKET_PERF_SAMPLE 66
+
+#define PERFETTO_SEQUENCE_INCREMENTAL_STATE_CLEARED 1
+#define PERFETTO_SEQUENCE_NEEDS_INCREMENTAL_STATE 2
+
+#define PERFETTO_CLOCK_SNAPSHOT_CLOCKS 1
+#define PERFETTO_CLOCK_ID 1
+#define PERFETTO_CLOCK_TIMESTAMP 2
+#define PERFETTO_CLOCK_REALTIME 1
+#define PERFETTO_CLOCK_BOOTTIME 6
+
+#define PERFETTO_TRACK_UUID 1
+#define PERFETTO_TRACK_PROCESS 3
+#define PERFETTO_TRACK_THREAD 4
+#define PERFETTO_PROCESS_PID 1
+#define PERFETTO_PROCESS_NAME 6
+#define PERFETTO_THREAD_PID 1
+#define PERFETTO_THREAD_TID 2
+#define PERFETTO_THREAD_NAME 5
+
+#define PERFETTO_EVENT_NAME_IID 10
+#define PERFETTO_EVENT_TYPE 9
+#define PERFETTO_EVENT_TRACK_UUID 11
+#define PERFETTO_EVENT_SLICE_BEGIN 1
+#define PERFETTO_EVENT_SLICE_END 2
+
+#define PERFETTO_INTERNED_EVENT_NAMES 2
+#define PERFETTO_INTERNED_FUNCTION_NAMES 5
+#define PERFETTO_INTERNED_FRAMES 6
+#define PERFETTO_INTERNED_CALLSTACKS 7
+#define PERFETTO_INTERNED_MAPPING_PATHS 17
+#define PERFETTO_INTERNED_MAPPINGS 19
+#define PERFETTO_INTERNED_IID 1
+#define PERFETTO_INTERNED_STRING 2
+#define PERFETTO_FRAME_FUNCTION_NAME_ID 2
+#define PERFETTO_FRAME_MAPPING_ID 3
+#define PERFETTO_FRAME_REL_PC 4
+#define PERFETTO_CALLSTACK_FRAME_IDS 2
+#define PERFETTO_MAPPING_PATH_STRING_IDS 7
+
+#define PERFETTO_PERF_SAMPLE_PID 2
+#define PERFETTO_PERF_SAMPLE_TID 3
+#define PERFETTO_PERF_SAMPLE_CALLSTACK_IID 4
+
+//
+// Every packet is on one sequence. Frames all live in one mapping.
+//
+#define TIMELINE_SEQUENCE_ID 1
+#define TIMELINE_MAPPING_IID 1
+
+//
+// FILETIME of the Unix epoch
+//
+#define TIMELINE_UNIX_EPOCH 116444736000000000ULL
+
+//
+// Timeline state. Only the ETW processing thread touches it.
+//
+static bool k_TimelineEnabled = false;
+static bool k_TimelineSequenceStarted = false;
+static bool k_TimelineClockWritten = false;
+static HANDLE k_TimelineFileHandle = INVALID_HANDLE_VALUE;
+
+//
+// Track UUIDs are handed out in order, so they stay one or two byte varints.
+//
+static uint64_t k_TimelineNextUuid = 1;
+static std::unordered_map<ULONG, TIMELINE_TRACK> k_TimelineProcesses;
+static std::unordered_map<uint64_t, TIMELINE_TRACK> k_TimelineThreads;
+
+//
+// Interned frames (by address) and stacks (by hash of their frames).
+// Secure call names are interned by secure call number (plus one, as
+// zero is not an interning ID).
+//
+static std::unordered_map<uint64_t, uint64_t> k_TimelineFrames;
+static std::unordered_map<uint64_t, uint64_t> k_TimelineCallstacks;
+static std::vector<bool> k_TimelineEventNames;
+
+//
+// The packet being built (its payload and any new interned entries),
+// scratch space for nested messages, and packets waiting to be written.
+//
+static std::vector<uint8_t> k_TimelinePacket;
+static std::vector<uint8_t> k_TimelineInterned;
+static std::vector<uint8_t> k_TimelineMessage;
+static std::vector<uint8_t> k_TimelineEntry;
+static std::vector<uint8_t> k_TimelineHeader;
+static std::vector<uint8_t> k_TimelineRecords;
+static FORMAT_BUFFER k_TimelineFrameName;
+
+static ULONGLONG k_TimelineSlices = 0;
+static ULONGLONG k_TimelineStacks = 0;
+static ULONGLONG k_TimelineBytesWritten = 0;
+
+/**
+*
+* @brief        Appends a base 128 varint.
+* @param[in]    Buffer - Receives the varint (appended).
+* @param[in]    Value - The value.
+*
+*/
+static
+void
+AppendTimelineVarint (
+    _Inout_ std::vector<uint8_t>& Buffer,
+    _In_ uint64_t Value
+    )
+{
+    while (Value >= 0x80)
+    {
+        Buffer.push_back(static_cast<uint8_t>(Value | 0x80));
+        Value >>= 7;
+    }
+
+    Buffer.push_back(static_cast<uint8_t>(Value));
+}
+
+/**
+*
+* @brief        Appends a varint field.
+* @param[in]    Buffer - Receives the field (appended).
+* @param[in]    Field - The field number.
+* @param[in]    Value - The value.
+*
+*/
+static
+void
+AppendTimelineField (
+    _Inout_ std::vector<uint8_t>& Buffer,
+    _In_ uint32_t Field,
+    _In_ uint64_t Value
+    )
+{
+    AppendTimelineVarint(Buffer, (static_cast<uint64_t>(Field) << 3));
+    AppendTimelineVarint(Buffer, Value);
+}
+
+/**
+*
+* @brief        Appends a length-delimited field (a string or a message).
+* @param[in]    Buffer - Receives the field (appended).
+* @param[in]    Field - The field number.
+* @param[in]    Data - The field's bytes.
+* @param[in]    Length - The number of bytes.
+*
+*/
+static
+void
+AppendTimelineBytes (
+    _Inout_ std::vector<uint8_t>& Buffer,
+    _In_ uint32_t Field,
+    _In_ const void* Data,
+    _In_ size_t Length
+    )
+{
+    AppendTimelineVarint(Buffer, ((static_cast<uint64_t>(Field) << 3) | 2));
+    AppendTimelineVarint(Buffer, Length);
+
+    Buffer.insert(Buffer.end(),
+                  static_cast<const uint8_t*>(Data),
+                  static_cast<const uint8_t*>(Data) + Length);
+}
+
+/**
+*
+* @brief        Appends an embedded message field.
+* @param[in]    Buffer - Receives the field (appended).
+* @param[in]    Field - The field number.
+* @param[in]    Message - The encoded message.
+*
+*/
+static
+void
+AppendTimelineMessage (
+    _Inout_ std::vector<uint8_t>& Buffer,
+    _In_ uint32_t Field,
+    _In_ const std::vector<uint8_t>& Message
+    )
+{
+    AppendTimelineBytes(Buffer, Field, Message.data(), Message.size());
+}
+
+/**
+*
+* @brief        Appends an interned string (InternedString or EventName, which
+*               share a layout) to the packet's interned data.
+* @param[in]    Field - The InternedData field.
+* @param[in]    Iid - The interning ID.
+* @param[in]    String - The string.
+* @param[in]    Length - The string's length.
+*
+*/
+static
+void
+InternTimelineString (
+    _In_ uint32_t Field,
+    _In_ uint64_t Iid,
+    _In_ const char* String,
+    _In_ size_t Length
+    )
+{
+    k_TimelineEntry.clear();
+
+    AppendTimelineField(k_TimelineEntry, PERFETTO_INTERNED_IID, Iid);
+    AppendTimelineBytes(k_TimelineEntry, PERFETTO_INTERNED_STRING, String, Length);
+
+    AppendTimelineMessage(k_TimelineInterned, Field, k_TimelineEntry);
+}
+
+/**
+*
+* @brief        Writes out the packets buffered so far.
+*
+*/
+static
+void
+FlushTimeline ()
+{
+    DWORD bytesWritten;
+
+    if (k_TimelineRecords.empty())
+    {
+        return;
+    }
+
+    if ((WriteFile(k_TimelineFileHandle,
+                   k_TimelineRecords.data(),
+                   static_cast<DWORD>(k_TimelineRecords.size()),
+                   &bytesWritten,
+                   NULL) == FALSE) ||
+        (bytesWritten != k_TimelineRecords.size()))
+    {
+        wprintf(L"[-] Error! WriteFile failed in FlushTimeline. (GLE: %d)\n", GetLastError());
+    }
+    else
+    {
+        k_TimelineBytesWritten += bytesWritten;
+    }
+
+    k_TimelineRecords.clear();
+}
+
+/**
+*
+* @brief        Wraps the packet built so far (k_TimelinePacket and any interned
+*               entries) in a TracePacket and buffers it.
+* @param[in]    TimeStamp - The packet's timestamp (ns), or 0 for none.
+*
+*/
+static
+void
+WriteTimelinePacket (
+    _In_ uint64_t TimeStamp
+    )
+{
+    k_TimelineHeader.clear();
+
+    if (TimeStamp != 0)
+    {
+        AppendTimelineField(k_TimelineHeader, PERFETTO_PACKET_TIMESTAMP, TimeStamp);
+    }
+
+    AppendTimelineField(k_TimelineHeader, PERFETTO_PACKET_SEQUENCE_ID, TIMELINE_SEQUENCE_ID);
+
+    //
+    // The first packet starts the sequence's interning state.
+    //
+    AppendTimelineField(k_TimelineHeader,
+                        PERFETTO_PACKET_SEQUENCE_FLAGS,
+                        (k_TimelineSequenceStarted ?
+                         PERFETTO_SEQUENCE_NEEDS_INCREMENTAL_STATE :
+                         (PERFETTO_SEQUENCE_INCREMENTAL_STATE_CLEARED | PERFETTO_SEQUENCE_NEEDS_INCREMENTAL_STATE)));
+
+    k_TimelineSequenceStarted = true;
+
+    if (!k_TimelineInterned.empty())
+    {
+        AppendTimelineMessage(k_TimelineHeader, PERFETTO_PACKET_INTERNED_DATA, k_TimelineInterned);
+    }
+
+    AppendTimelineVarint(k_TimelineRecords, ((PERFETTO_TRACE_PACKET << 3) | 2));
+    AppendTimelineVarint(k_TimelineRecords, (k_TimelineHeader.size() + k_TimelinePacket.size()));
+
+    k_TimelineRecords.insert(k_TimelineRecords.end(), k_TimelineHeader.begin(), k_TimelineHeader.end());
+    k_TimelineRecords.insert(k_TimelineRecords.end(), k_TimelinePacket.begin(), k_TimelinePacket.end());
+
+    k_TimelinePacket.clear();
+    k_TimelineInterned.clear();
+
+    if (k_TimelineRecords.size() >= TIMELINE_FLUSH_BYTES)
+    {
+        FlushTimeline();
+    }
+}
+
+/**
+*
+* @brief        Converts a raw (QPC) timestamp to nanoseconds since the session
+*               clock's anchor (the trace's BOOTTIME clock).
+* @param[in]    TimeStamp - The timestamp.
+* @return       The time, in nanoseconds.
+*
+*/
+static
+uint64_t
+GetTimelineTime (
+    _In_ ULONGLONG TimeStamp
+    )
+{
+    const SESSION_CLOCK* clock;
+    uint64_t delta;
+
+    clock = GetSessionClock();
+
+    if (TimeStamp <= clock->AnchorTimeStamp)
+    {
+        return 1;
+    }
+
+    delta = (TimeStamp - clock->AnchorTimeStamp);
+
+    return ((((delta / clock->QpcFrequency) * 1000000000ULL) +
+             (((delta % clock->QpcFrequency) * 1000000000ULL) / clock->QpcFrequency)) + 1);
+}
+
+/**
+*
+* @brief        Anchors the trace's realtime clock to its BOOTTIME clock (which
+*               timestamps are in), so the UI can show wall-clock times. Written
+*               before the first timestamped packet, once the session clock is.
+*
+*/
+static
+void
+WriteTimelineClock ()
+{
+    if (k_TimelineClockWritten)
+    {
+        return;
+    }
+
+    k_TimelineClockWritten = true;
+
+    //
+    // ClockSnapshot { clocks { BOOTTIME, 1 }, clocks { REALTIME, anchor } }
+    //
+    k_TimelineEntry.clear();
+    k_TimelineMessage.clear();
+
+    AppendTimelineField(k_TimelineEntry, PERFETTO_CLOCK_ID, PERFETTO_CLOCK_BOOTTIME);
+    AppendTimelineField(k_TimelineEntry, PERFETTO_CLOCK_TIMESTAMP, 1);
+    AppendTimelineMessage(k_TimelineMessage, PERFETTO_CLOCK_SNAPSHOT_CLOCKS, k_TimelineEntry);
+
+    k_TimelineEntry.clear();
+
+    AppendTimelineField(k_TimelineEntry, PERFETTO_CLOCK_ID, PERFETTO_CLOCK_REALTIME);
+    AppendTimelineField(k_TimelineEntry,
+                        PERFETTO_CLOCK_TIMESTAMP,
+                        ((GetSessionClock()->AnchorTime - TIMELINE_UNIX_EPOCH) * 100));
+    AppendTimelineMessage(k_TimelineMessage, PERFETTO_CLOCK_SNAPSHOT_CLOCKS, k_TimelineEntry);
+
+    AppendTimelineMessage(k_TimelinePacket, PERFETTO_PACKET_CLOCK_SNAPSHOT, k_TimelineMessage);
+
+    WriteTimelinePacket(0);
+}
+
+/**
+*
+* @brief        Gets a thread's track, describing it (and its process) first if
+*               it is new or has been renamed.
+* @param[in]    ProcessId - The process ID.
+* @param[in]    ThreadId - The thread ID.
+* @param[in]    ProcessNameId - The process name.
+* @param[in]    ThreadNameId - The thread name.
+* @return       The thread track's UUID.
+*
+*/
+static
+uint64_t
+GetTimelineThreadTrack (
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId,
+    _In_ ULONG ProcessNameId,
+    _In_ ULONG ThreadNameId
+    )
+{
+    PTIMELINE_TRACK process;
+    PTIMELINE_TRACK thread;
+    const char* name;
+
+    process = &k_TimelineProcesses[ProcessId];
+
+    if ((process->Uuid == 0) ||
+        (process->NameId != ProcessNameId))
+    {
+        if (process->Uuid == 0)
+        {
+            process->Uuid = k_TimelineNextUuid++;
+        }
+
+        process->NameId = ProcessNameId;
+
+        name = GetInternedName(ProcessNameId);
+
+        k_TimelineMessage.clear();
+        k_TimelineEntry.clear();
+
+        //
+        // TrackDescriptor { uuid, process { pid, process_name } }
+        //
+        AppendTimelineField(k_TimelineMessage, PERFETTO_PROCESS_PID, ProcessId);
+        AppendTimelineBytes(k_TimelineMessage, PERFETTO_PROCESS_NAME, name, strlen(name));
+
+        AppendTimelineField(k_TimelineEntry, PERFETTO_TRACK_UUID, process->Uuid);
+        AppendTimelineMessage(k_TimelineEntry, PERFETTO_TRACK_PROCESS, k_TimelineMessage);
+        AppendTimelineMessage(k_TimelinePacket, PERFETTO_PACKET_TRACK_DESCRIPTOR, k_TimelineEntry);
+
+        WriteTimelinePacket(0);
+    }
+
+    thread = &k_TimelineThreads[((static_cast<uint64_t>(ProcessId) << 32) | ThreadId)];
+
+    if ((thread->Uuid == 0) ||
+        (thread->NameId != ThreadNameId))
+    {
+        if (thread->Uuid == 0)
+        {
+            thread->Uuid = k_TimelineNextUuid++;
+        }
+
+        thread->NameId = ThreadNameId;
+
+        name = GetInternedName(ThreadNameId);
+
+        k_TimelineMessage.clear();
+        k_TimelineEntry.clear();
+
+        //
+        // TrackDescriptor { uuid, thread { pid, tid, thread_name } }
+        //
+        AppendTimelineField(k_TimelineMessage, PERFETTO_THREAD_PID, ProcessId);
+        AppendTimelineField(k_TimelineMessage, PERFETTO_THREAD_TID, ThreadId);
+        AppendTimelineBytes(k_TimelineMessage, PERFETTO_THREAD_NAME, name, strlen(name));
+
+        AppendTimelineField(k_TimelineEntry, PERFETTO_TRACK_UUID, thread->Uuid);
+        AppendTimelineMessage(k_TimelineEntry, PERFETTO_TRACK_THREAD, k_TimelineMessage);
+        AppendTimelineMessage(k_TimelinePacket, PERFETTO_PACKET_TRACK_DESCRIPTOR, k_TimelineEntry);
+
+        WriteTimelinePacket(0);
+    }
+
+    return thread->Uuid;
+}
+
+/**
+*
+* @brief        Gets a frame's interning ID, interning it (and its name) into
+*               the packet being built if it is new.
+* @param[in]    Address - The frame's address.
+* @return       The frame's interning ID.
+*
+*/
+static
+uint64_t
+GetTimelineFrame (
+    _In_ ULONG_PTR Address
+    )
+{
+    uint64_t iid;
+
+    auto existing = k_TimelineFrames.find(Address);
+    if (existing != k_TimelineFrames.end())
+    {
+        return existing->second;
+    }
+
+    iid = (k_TimelineFrames.size() + 1);
+
+    k_TimelineFrames.insert({ Address, iid });
+
+    //
+    // Named the way the CSV names it.
+    //
+    ResetFormatBuffer(&k_TimelineFrameName);
+
+    FormatVtl1Frame(&k_TimelineFrameName, Address, FORMAT_NO_SEPARATOR);
+
+    InternTimelineString(PERFETTO_INTERNED_FUNCTION_NAMES,
+                         iid,
+                         k_TimelineFrameName.Data.data(),
+                         k_TimelineFrameName.Length);
+
+    k_TimelineEntry.clear();
+
+    AppendTimelineField(k_TimelineEntry, PERFETTO_INTERNED_IID, iid);
+    AppendTimelineField(k_TimelineEntry, PERFETTO_FRAME_FUNCTION_NAME_ID, iid);
+    AppendTimelineField(k_TimelineEntry, PERFETTO_FRAME_MAPPING_ID, TIMELINE_MAPPING_IID);
+    AppendTimelineField(k_TimelineEntry, PERFETTO_FRAME_REL_PC, Address);
+
+    AppendTimelineMessage(k_TimelineInterned, PERFETTO_INTERNED_FRAMES, k_TimelineEntry);
+
+    return iid;
+}
+
+/**
+*
+* @brief        Turns on the timeline export.
+* @param[in]    FilePath - The Perfetto trace to write.
+* @return       true on success, otherwise false.
+*
+*/
+bool
+SetTimeline (
+    _In_ const wchar_t* FilePath
+    )
+{
+    static const char mappingPath[] = "Vtl1Mon";
+
+    k_TimelineFileHandle = CreateFileW(FilePath,
+                                       GENERIC_WRITE,
+                                       FILE_SHARE_READ,
+                                       NULL,
+                                       CREATE_ALWAYS,
+                                       0,
+                                       NULL);
+    if (k_TimelineFileHandle == INVALID_HANDLE_VALUE)
+    {
+        wprintf(L"[-] Error! CreateFileW failed in SetTimeline. (GLE: %d)\n", GetLastError());
+        return false;
+    }
+
+    k_TimelineRecords.reserve(TIMELINE_FLUSH_BYTES + 4096);
+
+    //
+    // The one mapping every frame is in (they are named by symbol, not
+    // by mapping and offset).
+    //
+    InternTimelineString(PERFETTO_INTERNED_MAPPING_PATHS,
+                         TIMELINE_MAPPING_IID,
+                         mappingPath,
+                         (sizeof(mappingPath) - 1));
+
+    k_TimelineEntry.clear();
+
+    AppendTimelineField(k_TimelineEntry, PERFETTO_INTERNED_IID, TIMELINE_MAPPING_IID);
+    AppendTimelineField(k_TimelineEntry, PERFETTO_MAPPING_PATH_STRING_IDS, TIMELINE_MAPPING_IID);
+
+    AppendTimelineMessage(k_TimelineInterned, PERFETTO_INTERNED_MAPPINGS, k_TimelineEntry);
+
+    WriteTimelinePacket(0);
+
+    k_TimelineEnabled = true;
+
+    return true;
+}
+
+/**
+*
+* @brief        Determines if the timeline export is on.
+* @return       true if it is, otherwise false.
+*
+*/
+bool
+IsTimelineEnabled ()
+{
+    return k_TimelineEnabled;
+}
+
+/**
+*
+* @brief        Writes a secure call's slice. Called on VTL 1 exit.
+* @param[in]    EnterTime - The VTL 1 enter raw (QPC) timestamp.
+* @param[in]    ExitTime - The VTL 1 exit raw (QPC) timestamp.
+* @param[in]    ProcessId - The calling process.
+* @param[in]    ThreadId - The calling thread.
+* @param[in]    SecureCallNumber - The secure call number.
+*
+*/
+void
+RecordTimelineSlice (
+    _In_ ULONGLONG EnterTime,
+    _In_ ULONGLONG ExitTime,
+    _In_ ULONG ProcessId,
+    _In_ ULONG ThreadId,
+    _In_ ULONG SecureCallNumber
+    )
+{
+    uint64_t uuid;
+    FORMAT_BUFFER* name;
+
+    if (!k_TimelineEnabled)
+    {
+        return;
+    }
+
+    WriteTimelineClock();
+
+    uuid = GetTimelineThreadTrack(ProcessId,
+                                  ThreadId,
+                                  GetProcessNameId(ProcessId, EnterTime),
+                                  GetThreadNameId(ThreadId));
+
+    if (SecureCallNumber >= k_TimelineEventNames.size())
+    {
+        k_TimelineEventNames.resize(SecureCallNumber + 1, false);
+    }
+
+    if (!k_TimelineEventNames[SecureCallNumber])
+    {
+        k_TimelineEventNames[SecureCallNumber] = true;
+
+        name = &k_TimelineFrameName;
+
+        ResetFormatBuffer(name);
+        FormatAppendPrintf(name, "%s (%lu)", GetSecureCallName(SecureCallNumber), SecureCallNumber);
+
+        InternTimelineString(PERFETTO_INTERNED_EVENT_NAMES,
+                             (static_cast<uint64_t>(SecureCallNumber) + 1),
+                             name->Data.data(),
+                             name->Length);
+    }
+
+    //
+    // TrackEvent { type: SLICE_BEGIN, track_uuid, name_iid }, then
+    // TrackEvent { type: SLICE_END, track_uuid }
+    //
+    k_TimelineMessage.clear();
+
+    AppendTimelineField(k_TimelineMessage, PERFETTO_EVENT_TYPE, PERFETTO_EVENT_SLICE_BEGIN);
+    AppendTimelineField(k_TimelineMessage, PERFETTO_EVENT_NAME_IID, (static_cast<uint64_t>(SecureCallNumber) + 1));
+    AppendTimelineField(k_TimelineMessage, PERFETTO_EVENT_TRACK_UUID, uuid);
+    AppendTimelineMessage(k_TimelinePacket, PERFETTO_PACKET_TRACK_EVENT, k_TimelineMessage);
+
+    WriteTimelinePacket(GetTimelineTime(EnterTime));
+
+    k_TimelineMessage.clear();
+
+    AppendTimelineField(k_TimelineMessage, PERFETTO_EVENT_TYPE, PERFETTO_EVENT_SLICE_END);
+    AppendTimelineField(k_TimelineMessage, PERFETTO_EVENT_TRACK_UUID, uuid);
+    AppendTimelineMessage(k_TimelinePacket, PERFETTO_PACKET_TRACK_EVENT, k_TimelineMessage);
+
+    WriteTimelinePacket(GetTimelineTime((std::max)(ExitTime, EnterTime)));
+
+    k_TimelineSlices++;
+}
+
+/**
+*
+* @brief        Writes a correlated event's call stack, as a sample on its thread
+*               at the VTL 1 enter (the start of its slice).
+* @param[in]    Vtl1Data - The "primal" VTL 1 enter event data.
+* @param[in]    CallStack - The raw list of stack frame addresses.
+* @param[in]    NumberOfFrames - The number of stack frames.
+*
+*/
+void
+RecordTimelineStack (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    uint64_t stackKey;
+    uint64_t callstackIid;
+    std::vector<uint64_t> frameIds;
+
+    if ((!k_TimelineEnabled) ||
+        (NumberOfFrames == 0))
+    {
+        return;
+    }
+
+    WriteTimelineClock();
+
+    //
+    // Describe the thread now, so the sample's packet is the only one
+    // being built below.
+    //
+    GetTimelineThreadTrack(Vtl1Data->ProcessId,
+                           Vtl1Data->ThreadId,
+                           Vtl1Data->ProcessNameId,
+                           Vtl1Data->ThreadNameId);
+
+    stackKey = 0;
+
+    for (ULONG i = 0; i < NumberOfFrames; i++)
+    {
+        stackKey = HashTopKKey(stackKey, CallStack[i]);
+    }
+
+    auto existing = k_TimelineCallstacks.find(stackKey);
+    if (existing != k_TimelineCallstacks.end())
+    {
+        callstackIid = existing->second;
+    }
+    else
+    {
+        callstackIid = (k_TimelineCallstacks.size() + 1);
+
+        k_TimelineCallstacks.insert({ stackKey, callstackIid });
+
+        //
+        // Outermost frame first.
+        //
+        frameIds.resize(NumberOfFrames);
+
+        for (ULONG i = 0; i < NumberOfFrames; i++)
+        {
+            frameIds[i] = GetTimelineFrame(CallStack[NumberOfFrames - 1 - i]);
+        }
+
+        k_TimelineMessage.clear();
+
+        AppendTimelineField(k_TimelineMessage, PERFETTO_INTERNED_IID, callstackIid);
+
+        for (ULONG i = 0; i < NumberOfFrames; i++)
+        {
+            AppendTimelineField(k_TimelineMessage, PERFETTO_CALLSTACK_FRAME_IDS, frameIds[i]);
+        }
+
+        AppendTimelineMessage(k_TimelineInterned, PERFETTO_INTERNED_CALLSTACKS, k_TimelineMessage);
+    }
+
+    //
+    // PerfSample { pid, tid, callstack_iid }
+    //
+    k_TimelineMessage.clear();
+
+    AppendTimelineField(k_TimelineMessage, PERFETTO_PERF_SAMPLE_PID, Vtl1Data->ProcessId);
+    AppendTimelineField(k_TimelineMessage, PERFETTO_PERF_SAMPLE_TID, Vtl1Data->ThreadId);
+    AppendTimelineField(k_TimelineMessage, PERFETTO_PERF_SAMPLE_CALLSTACK_IID, callstackIid);
+    AppendTimelineMessage(k_TimelinePacket, PERFETTO_PACKET_PERF_SAMPLE, k_TimelineMessage);
+
+    WriteTimelinePacket(GetTimelineTime(static_cast<ULONGLONG>(Vtl1Data->Vtl1EnterTime)));
+
+    k_TimelineStacks++;
+}
+
+/**
+*
+* @brief        Writes what is left of the timeline and closes it.
+*
+*/
+void
+StopTimeline ()
+{
+    if (!k_TimelineEnabled)
+    {
+        return;
+    }
+
+    FlushTimeline();
+
+    k_TimelineEnabled = false;
+
+    CloseHandle(k_TimelineFileHandle);
+    k_TimelineFileHandle = INVALID_HANDLE_VALUE;
+
+    wprintf(L"[+] Timeline statistics:\n");
+    wprintf(L"  [>] Slices: %llu\n", k_TimelineSlices);
+    wprintf(L"  [>] Stacks: %llu (%zu unique, %zu unique frames)\n",
+            k_TimelineStacks,
+            k_TimelineCallstacks.size(),
+            k_TimelineFrames.size());
+    wprintf(L"  [>] Threads: %zu (%zu processes)\n",
+            k_TimelineThreads.size(),
+            k_TimelineProcesses.size());
+    wprintf(L"  [>] Trace: %llu KB (%.1f bytes per slice)\n",
+            (k_TimelineBytesWritten / 1024),
+            ((k_TimelineSlices != 0) ? (static_cast<double>(k_TimelineBytesWritten) / k_TimelineSlices) : 0.0));
+
+    k_TimelineFrames.clear();
+    k_TimelineCallstacks.clear();
+    k_TimelineThreads.clear();
+    k_TimelineProcesses.clear();
+}
\ No newline at end of file
@@ -0,0 +1,799 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/TopK.cpp
+*
+* @summary:   Streaming top-K (heavy hitter) trackers. Space-Saving counters for
+*             (secure call, stack), (process, secure call) and caller frames, in
+*             fixed memory - stack cardinality (JIT code, per-process bases) can
+*             explode without the tool growing.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "TopK.hpp"
+#include <algorithm>
+
+#ifdef _WIN32
+#include "Helpers.hpp"
+#include "Symbols.hpp"
+#include "Processes.hpp"
+#include <stdio.h>
+#endif
+
+static const wchar_t* k_TopKTrackerNames[TopKTrackerCount] =
+{
+    L"(secure call, stack)",
+    L"(process, secure call)",
+    L"caller frame"
+};
+
+/**
+*
+* @brief        Mixes a value into a key hash.
+* @param[in]    Hash - The hash so far (0 to start).
+* @param[in]    Value - The value.
+* @return       The new hash.
+*
+*/
+uint64_t
+HashTopKKey (
+    _In_ uint64_t Hash,
+    _In_ uint64_t Value
+    )
+{
+    Hash ^= Value;
+    Hash *= 0x9E3779B97F4A7C15ULL;
+    Hash ^= (Hash >> 29);
+
+    return Hash;
+}
+
+/**
+*
+* @brief        Gets the index slot a key starts probing from.
+* @param[in]    Tracker - The tracker.
+* @param[in]    Key - The key.
+* @return       The slot.
+*
+*/
+static
+size_t
+GetTopKHomeSlot (
+    _In_ const TOP_K_TRACKER* Tracker,
+    _In_ uint64_t Key
+    )
+{
+    return static_cast<size_t>(HashTopKKey(0, Key) & (Tracker->Slots.size() - 1));
+}
+
+/**
+*
+* @brief        Finds the index slot holding a key.
+* @param[in]    Tracker - The tracker.
+* @param[in]    Key - The key.
+* @return       The slot, or the empty slot where the key would go.
+*
+*/
+static
+size_t
+FindTopKSlot (
+    _In_ const TOP_K_TRACKER* Tracker,
+    _In_ uint64_t Key
+    )
+{
+    size_t slot;
+    size_t mask;
+
+    mask = (Tracker->Slots.size() - 1);
+    slot = GetTopKHomeSlot(Tracker, Key);
+
+    //
+    // The index is at most half full, so there is always an empty slot.
+    //
+    while ((Tracker->Slots[slot] != 0) &&
+           (Tracker->Entries[Tracker->Slots[slot] - 1].Key != Key))
+    {
+        slot = ((slot + 1) & mask);
+    }
+
+    return slot;
+}
+
+/**
+*
+* @brief        Removes a key from the index, shifting back the keys which
+*               probed past it (no tombstones).
+* @param[in]    Tracker - The tracker.
+* @param[in]    Key - The key.
+*
+*/
+static
+void
+RemoveTopKSlot (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ uint64_t Key
+    )
+{
+    size_t hole;
+    size_t next;
+    size_t home;
+    size_t mask;
+
+    mask = (Tracker->Slots.size() - 1);
+    hole = FindTopKSlot(Tracker, Key);
+    next = hole;
+
+    for (;;)
+    {
+        next = ((next + 1) & mask);
+
+        if (Tracker->Slots[next] == 0)
+        {
+            break;
+        }
+
+        home = GetTopKHomeSlot(Tracker, Tracker->Entries[Tracker->Slots[next] - 1].Key);
+
+        //
+        // Move it into the hole unless its home lies (cyclically)
+        // after the hole - then it is already as close as it can be.
+        //
+        if (((next > hole) && ((home <= hole) || (home > next))) ||
+            ((next < hole) && ((home <= hole) && (home > next))))
+        {
+            Tracker->Slots[hole] = Tracker->Slots[next];
+            hole = next;
+        }
+    }
+
+    Tracker->Slots[hole] = 0;
+}
+
+/**
+*
+* @brief        Swaps two heap positions.
+* @param[in]    Tracker - The tracker.
+* @param[in]    First - A heap position.
+* @param[in]    Second - A heap position.
+*
+*/
+static
+void
+SwapTopKHeap (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ size_t First,
+    _In_ size_t Second
+    )
+{
+    std::swap(Tracker->Heap[First], Tracker->Heap[Second]);
+
+    Tracker->Entries[Tracker->Heap[First]].HeapIndex = static_cast<uint32_t>(First);
+    Tracker->Entries[Tracker->Heap[Second]].HeapIndex = static_cast<uint32_t>(Second);
+}
+
+/**
+*
+* @brief        Restores the heap after an entry's count grew.
+* @param[in]    Tracker - The tracker.
+* @param[in]    Position - The entry's heap position.
+*
+*/
+static
+void
+SiftTopKHeapDown (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ size_t Position
+    )
+{
+    size_t smallest;
+    size_t child;
+
+    for (;;)
+    {
+        smallest = Position;
+
+        for (child = ((2 * Position) + 1); child <= ((2 * Position) + 2); child++)
+        {
+            if ((child < Tracker->Heap.size()) &&
+                (Tracker->Entries[Tracker->Heap[child]].Count < Tracker->Entries[Tracker->Heap[smallest]].Count))
+            {
+                smallest = child;
+            }
+        }
+
+        if (smallest == Position)
+        {
+            break;
+        }
+
+        SwapTopKHeap(Tracker, Position, smallest);
+
+        Position = smallest;
+    }
+}
+
+/**
+*
+* @brief        Restores the heap after an entry was added at the bottom.
+* @param[in]    Tracker - The tracker.
+* @param[in]    Position - The entry's heap position.
+*
+*/
+static
+void
+SiftTopKHeapUp (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ size_t Position
+    )
+{
+    size_t parent;
+
+    while (Position != 0)
+    {
+        parent = ((Position - 1) / 2);
+
+        if (Tracker->Entries[Tracker->Heap[parent]].Count <= Tracker->Entries[Tracker->Heap[Position]].Count)
+        {
+            break;
+        }
+
+        SwapTopKHeap(Tracker, Position, parent);
+
+        Position = parent;
+    }
+}
+
+/**
+*
+* @brief        Sets a tracker up. All of its memory is allocated here.
+* @param[in]    Tracker - The tracker.
+* @param[in]    Capacity - The number of counters.
+*
+*/
+void
+InitializeTopKTracker (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ uint32_t Capacity
+    )
+{
+    size_t slots;
+
+    Capacity = (std::max)(Capacity, static_cast<uint32_t>(1));
+
+    //
+    // Keep the index at most half full.
+    //
+    slots = 1;
+
+    while (slots < (static_cast<size_t>(Capacity) * 2))
+    {
+        slots <<= 1;
+    }
+
+    Tracker->Entries.clear();
+    Tracker->Entries.reserve(Capacity);
+    Tracker->Heap.clear();
+    Tracker->Heap.reserve(Capacity);
+    Tracker->Slots.assign(slots, 0);
+    Tracker->Capacity = Capacity;
+    Tracker->Total = 0;
+    Tracker->Replacements = 0;
+}
+
+/**
+*
+* @brief        Counts a key. A key without a counter gets one - a free one, or
+*               else the smallest, whose count it inherits as error.
+* @param[in]    Tracker - The tracker.
+* @param[in]    Key - The key.
+* @param[in]    Count - How many times the key was seen.
+* @param[out]   Claimed - Set if the entry is new to this key (its sample is stale).
+* @return       The key's entry.
+*
+*/
+PTOP_K_ENTRY
+OfferTopKKey (
+    _Inout_ PTOP_K_TRACKER Tracker,
+    _In_ uint64_t Key,
+    _In_ uint64_t Count,
+    _Out_ bool* Claimed
+    )
+{
+    PTOP_K_ENTRY entry;
+    size_t slot;
+
+    Tracker->Total += Count;
+
+    slot = FindTopKSlot(Tracker, Key);
+
+    if (Tracker->Slots[slot] != 0)
+    {
+        entry = &Tracker->Entries[Tracker->Slots[slot] - 1];
+        entry->Count += Count;
+
+        SiftTopKHeapDown(Tracker, entry->HeapIndex);
+
+        *Claimed = false;
+        goto Exit;
+    }
+
+    *Claimed = true;
+
+    if (Tracker->Entries.size() < Tracker->Capacity)
+    {
+        Tracker->Entries.emplace_back();
+
+        entry = &Tracker->Entries.back();
+        entry->Key = Key;
+        entry->Count = Count;
+        entry->Error = 0;
+        entry->HeapIndex = static_cast<uint32_t>(Tracker->Heap.size());
+
+        Tracker->Heap.push_back(static_cast<uint32_t>(Tracker->Entries.size() - 1));
+        Tracker->Slots[slot] = static_cast<uint32_t>(Tracker->Entries.size());
+
+        SiftTopKHeapUp(Tracker, entry->HeapIndex);
+        goto Exit;
+    }
+
+    //
+    // Take over the smallest counter.
+    //
+    entry = &Tracker->Entries[Tracker->Heap[0]];
+
+    RemoveTopKSlot(Tracker, entry->Key);
+
+    entry->Key = Key;
+    entry->Error = entry->Count;
+    entry->Count += Count;
+
+    Tracker->Slots[FindTopKSlot(Tracker, Key)] = (Tracker->Heap[0] + 1);
+    Tracker->Replacements++;
+
+    SiftTopKHeapDown(Tracker, 0);
+
+Exit:
+    return entry;
+}
+
+/**
+*
+* @brief        Gets the largest entries, largest first.
+* @param[in]    Tracker - The tracker.
+* @param[in]    Count - The most entries to return.
+* @param[out]   Entries - Receives the entries.
+*
+*/
+void
+GetTopKEntries (
+    _In_ const TOP_K_TRACKER* Tracker,
+    _In_ size_t Count,
+    _Out_ std::vector<const TOP_K_ENTRY*>& Entries
+    )
+{
+    Entries.clear();
+
+    for (const auto& entry : Tracker->Entries)
+    {
+        Entries.push_back(&entry);
+    }
+
+    Count = (std::min)(Count, Entries.size());
+
+    std::partial_sort(Entries.begin(),
+                      Entries.begin() + Count,
+                      Entries.end(),
+                      [](const TOP_K_ENTRY* Left, const TOP_K_ENTRY* Right)
+                      {
+                          return (Left->Count > Right->Count);
+                      });
+
+    Entries.resize(Count);
+}
+
+/**
+*
+* @brief        Gets the most a key without a counter can have been seen.
+* @param[in]    Tracker - The tracker.
+* @return       The smallest count if every counter is in use, otherwise 0.
+*
+*/
+uint64_t
+GetTopKMinimumCount (
+    _In_ const TOP_K_TRACKER* Tracker
+    )
+{
+    if ((Tracker->Entries.empty()) ||
+        (Tracker->Entries.size() < Tracker->Capacity))
+    {
+        return 0;
+    }
+
+    return Tracker->Entries[Tracker->Heap[0]].Count;
+}
+
+/**
+*
+* @brief        Gets the display name of a tracker.
+* @param[in]    Type - The tracker.
+* @return       The name.
+*
+*/
+const wchar_t*
+GetTopKTrackerName (
+    _In_ TOP_K_TRACKER_TYPE Type
+    )
+{
+    return k_TopKTrackerNames[Type];
+}
+
+#ifdef _WIN32
+//
+// The live trackers. Only the ETW processing thread touches them.
+//
+static TOP_K_TRACKER k_TopKTrackers[TopKTrackerCount];
+static bool k_TopKTrackingEnabled = false;
+static uint32_t k_TopKCapacity = 0;
+static ULONG k_TopKReportSeconds = 0;
+static ULONGLONG k_TopKReportTicks = 0;
+static ULONGLONG k_TopKLastReport = 0;
+static FORMAT_BUFFER k_TopKFrameBuffer;
+
+/**
+*
+* @brief        Turns on the top-K trackers.
+* @param[in]    Capacity - Counters per tracker. 0 turns tracking off.
+* @param[in]    ReportSeconds - How often to print the trackers while tracing. 0 for only on exit.
+*
+*/
+void
+SetTopKTracking (
+    _In_ uint32_t Capacity,
+    _In_ ULONG ReportSeconds
+    )
+{
+    k_TopKCapacity = Capacity;
+    k_TopKTrackingEnabled = (Capacity != 0);
+
+    if (!k_TopKTrackingEnabled)
+    {
+        return;
+    }
+
+    k_TopKReportSeconds = ReportSeconds;
+    k_TopKReportTicks = 0;
+    k_TopKLastReport = 0;
+
+    for (auto& tracker : k_TopKTrackers)
+    {
+        InitializeTopKTracker(&tracker, Capacity);
+    }
+}
+
+/**
+*
+* @brief        Converts the report interval to ticks of the event timestamps.
+* @param[in]    QpcFrequency - The session clock's QPC frequency.
+*
+*/
+void
+SetTopKQpcFrequency (
+    _In_ ULONGLONG QpcFrequency
+    )
+{
+    k_TopKReportTicks = (static_cast<ULONGLONG>(k_TopKReportSeconds) * QpcFrequency);
+}
+
+/**
+*
+* @brief        Determines if the top-K trackers are on.
+* @return       true if they are, otherwise false.
+*
+*/
+bool
+IsTopKTrackingEnabled ()
+{
+    return k_TopKTrackingEnabled;
+}
+
+/**
+*
+* @brief        Finds the frame which made the secure call: the first one outside
+*               the image of the innermost frame (the kernel's VTL 1 plumbing). For
+*               a system call that is the user-mode stub, for a driver the driver.
+* @param[in]    CallStack - The raw list of stack frame addresses.
+* @param[in]    NumberOfFrames - The number of stack frames.
+* @return       The caller's frame address.
+*
+*/
+static
+ULONG_PTR
+GetTopKCallerFrame (
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    IMAGE_NODE imageNode;
+
+    if (!GetImageDataFromAddress(CallStack[0], &imageNode))
+    {
+        return CallStack[0];
+    }
+
+    for (ULONG i = 1; i < NumberOfFrames; i++)
+    {
+        if ((CallStack[i] < imageNode.ImageBase) ||
+            (CallStack[i] >= (imageNode.ImageBase + imageNode.ImageSize)))
+        {
+            return CallStack[i];
+        }
+    }
+
+    //
+    // Entirely inside one image (a system thread) - use the outermost.
+    //
+    return CallStack[NumberOfFrames - 1];
+}
+
+/**
+*
+* @brief        Fills in an entry's sample from the event which claimed it.
+* @param[in]    Entry - The entry.
+* @param[in]    Vtl1Data - The "primal" VTL 1 enter event data.
+* @param[in]    CallStack - The frames to keep.
+* @param[in]    NumberOfFrames - The number of frames to keep.
+*
+*/
+static
+void
+SetTopKSample (
+    _Inout_ PTOP_K_ENTRY Entry,
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    NumberOfFrames = (std::min)(NumberOfFrames, static_cast<ULONG>(TOP_K_MAX_SAMPLE_FRAMES));
+
+    Entry->Sample.ProcessId = Vtl1Data->ProcessId;
+    Entry->Sample.ProcessNameId = Vtl1Data->ProcessNameId;
+    Entry->Sample.SecureCallNumber = Vtl1Data->SecureCallNumber;
+    Entry->Sample.NumberOfFrames = static_cast<uint16_t>(NumberOfFrames);
+
+    for (ULONG i = 0; i < NumberOfFrames; i++)
+    {
+        Entry->Sample.Frames[i] = CallStack[i];
+    }
+}
+
+/**
+*
+* @brief        Prints a frame, symbolized the same way as the CSV.
+* @param[in]    Prefix - Printed before the frame.
+* @param[in]    Address - The frame address.
+*
+*/
+static
+void
+PrintTopKFrame (
+    _In_ const wchar_t* Prefix,
+    _In_ ULONG_PTR Address
+    )
+{
+    ResetFormatBuffer(&k_TopKFrameBuffer);
+
+    FormatVtl1Frame(&k_TopKFrameBuffer, Address, FORMAT_NO_SEPARATOR);
+    FormatAppendChar(&k_TopKFrameBuffer, '\0');
+
+    wprintf(L"%s%hs\n", Prefix, k_TopKFrameBuffer.Data.data());
+}
+
+/**
+*
+* @brief        Prints the largest entries of every tracker.
+* @param[in]    Final - Whether this is the report on exit.
+*
+*/
+static
+void
+ReportTopK (
+    _In_ bool Final
+    )
+{
+    std::vector<const TOP_K_ENTRY*> entries;
+
+    for (ULONG type = 0; type < TopKTrackerCount; type++)
+    {
+        const TOP_K_TRACKER* tracker;
+
+        tracker = &k_TopKTrackers[type];
+
+        GetTopKEntries(tracker, TOP_K_REPORT_ENTRIES, entries);
+
+        //
+        // Space-Saving's bound: no count is over by more than Total / Capacity.
+        //
+        wprintf(L"[+] %s top %s (%llu events, %lu counters, %llu replaced, error <= %llu):\n",
+                (Final ? L"Final" : L"Live"),
+                GetTopKTrackerName(static_cast<TOP_K_TRACKER_TYPE>(type)),
+                tracker->Total,
+                tracker->Capacity,
+                tracker->Replacements,
+                (tracker->Total / tracker->Capacity));
+
+        for (const TOP_K_ENTRY* entry : entries)
+        {
+            const TOP_K_SAMPLE* sample;
+
+            sample = &entry->Sample;
+
+            switch (type)
+            {
+                case TopKStacks:
+                    wprintf(L"  [>] %llu (+/- %llu) %hs (%u) in %hs\n",
+                            entry->Count,
+                            entry->Error,
+                            GetSecureCallName(sample->SecureCallNumber),
+                            sample->SecureCallNumber,
+                            GetInternedName(sample->ProcessNameId));
+
+                    for (ULONG i = 0; i < sample->NumberOfFrames; i++)
+                    {
+                        PrintTopKFrame(L"        ", static_cast<ULONG_PTR>(sample->Frames[i]));
+                    }
+                    break;
+
+                case TopKProcesses:
+                    wprintf(L"  [>] %llu (+/- %llu) %hs - %hs (%u)\n",
+                            entry->Count,
+                            entry->Error,
+                            GetInternedName(sample->ProcessNameId),
+                            GetSecureCallName(sample->SecureCallNumber),
+                            sample->SecureCallNumber);
+                    break;
+
+                default:
+                    wprintf(L"  [>] %llu (+/- %llu) ", entry->Count, entry->Error);
+
+                    PrintTopKFrame(L"", static_cast<ULONG_PTR>(sample->Frames[0]));
+                    break;
+            }
+        }
+    }
+}
+
+/**
+*
+* @brief        Counts a correlated event in every tracker. Prints the trackers
+*               when a live report is due.
+* @param[in]    Vtl1Data - The "primal" VTL 1 enter event data.
+* @param[in]    CallStack - The raw list of stack frame addresses.
+* @param[in]    NumberOfFrames - The number of stack frames.
+*
+*/
+void
+TrackTopKEvent (
+    _In_ PVTL1_ENTER_NODE Vtl1Data,
+    _In_ const ULONG_PTR* CallStack,
+    _In_ ULONG NumberOfFrames
+    )
+{
+    PTOP_K_ENTRY entry;
+    uint64_t key;
+    ULONG_PTR caller;
+    bool claimed;
+
+    if (NumberOfFrames == 0)
+    {
+        return;
+    }
+
+    //
+    // (secure call, stack)
+    //
+    key = HashTopKKey(0, Vtl1Data->SecureCallNumber);
+
+    for (ULONG i = 0; i < NumberOfFrames; i++)
+    {
+        key = HashTopKKey(key, CallStack[i]);
+    }
+
+    entry = OfferTopKKey(&k_TopKTrackers[TopKStacks], key, 1, &claimed);
+    if (claimed)
+    {
+        SetTopKSample(entry, Vtl1Data, CallStack, NumberOfFrames);
+    }
+
+    //
+    // (process, secure call) - by name, so PID reuse does not split it.
+    //
+    key = ((static_cast<uint64_t>(Vtl1Data->ProcessNameId) << 16) | Vtl1Data->SecureCallNumber);
+
+    entry = OfferTopKKey(&k_TopKTrackers[TopKProcesses], key, 1, &claimed);
+    if (claimed)
+    {
+        SetTopKSample(entry, Vtl1Data, NULL, 0);
+    }
+
+    //
+    // Caller frame
+    //
+    caller = GetTopKCallerFrame(CallStack, NumberOfFrames);
+
+    entry = OfferTopKKey(&k_TopKTrackers[TopKCallers], caller, 1, &claimed);
+    if (claimed)
+    {
+        SetTopKSample(entry, Vtl1Data, &caller, 1);
+    }
+
+    if (k_TopKReportTicks == 0)
+    {
+        return;
+    }
+
+    if (k_TopKLastReport == 0)
+    {
+        k_TopKLastReport = Vtl1Data->Vtl1EnterTime;
+    }
+    else if ((Vtl1Data->Vtl1EnterTime - k_TopKLastReport) >= k_TopKReportTicks)
+    {
+        k_TopKLastReport = Vtl1Data->Vtl1EnterTime;
+
+        ReportTopK(false);
+    }
+}
+
+/**
+*
+* @brief        Gets a live tracker. ETW processing thread (or after the trace stopped) only.
+* @param[in]    Type - The tracker.
+* @return       The tracker.
+*
+*/
+const TOP_K_TRACKER*
+GetTopKTracker (
+    _In_ TOP_K_TRACKER_TYPE Type
+    )
+{
+    return &k_TopKTrackers[Type];
+}
+
+/**
+*
+* @brief        Prints the final report and frees the trackers. Called on Vtl1Mon
+*               exit, while symbols and the name caches are still around.
+*
+*/
+void
+StopTopKTracking ()
+{
+    if (!k_TopKTrackingEnabled)
+    {
+        return;
+    }
+
+    ReportTopK(true);
+
+    wprintf(L"[+] Top-K statistics:\n");
+    wprintf(L"  [>] Counters: %lu per tracker (%llu KB in all)\n",
+            k_TopKCapacity,
+            ((TopKTrackerCount * ((k_TopKCapacity * (sizeof(TOP_K_ENTRY) + sizeof(uint32_t))) +
+                                  (k_TopKTrackers[0].Slots.size() * sizeof(uint32_t)))) / 1024));
+
+    k_TopKTrackingEnabled = false;
+
+    for (auto& tracker : k_TopKTrackers)
+    {
+        tracker.Entries.clear();
+        tracker.Entries.shrink_to_fit();
+        tracker.Heap.clear();
+        tracker.Heap.shrink_to_fit();
+        tracker.Slots.clear();
+        tracker.Slots.shrink_to_fit();
+    }
+}
+#endif
\ No newline at end of file
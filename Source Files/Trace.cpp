@@ -15,6 +15,7 @@
 #include "Helpers.hpp"
 #include "Callback.hpp"
 #include "Symbols.hpp"
+#include "Clock.hpp"
 #include <stdio.h>
 
 //
@@ -279,7 +280,9 @@ CreateAndConfigureVtlEnterExitTrace ()
     traceProps->LogFileNameOffset = 0;
     traceProps->FlushTimer = 1;
     traceProps->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
-    traceProps->EnableFlags = EVENT_TRACE_FLAG_IMAGE_LOAD;
+    traceProps->EnableFlags = (EVENT_TRACE_FLAG_IMAGE_LOAD |
+                               EVENT_TRACE_FLAG_PROCESS |
+                               EVENT_TRACE_FLAG_THREAD);
 
     //
     // Enable
@@ -293,6 +296,14 @@ CreateAndConfigureVtlEnterExitTrace ()
         goto Exit;
     }
 
+    //
+    // Events carry raw QPC timestamps (ClientContext). Pin them to the
+    // wall clock now, before any are delivered.
+    //
+    CalibrateSessionClock();
+
+    ApplySessionClock();
+
     //
     // Enable stack traces. We don't enable VTL 1 events until
     // we receive all image load rundown events.
@@ -354,6 +365,14 @@ StopAndCleanupVtl1EnterExitTrace ()
     //
     _InterlockedExchange(&g_ContinueTracing, FALSE);
 
+    //
+    // Nothing to stop if we never started a live session (replay).
+    //
+    if (k_Vtl1EnterExitProperties == NULL)
+    {
+        goto Exit;
+    }
+
     //
     // Stop the trace.
     //
@@ -367,6 +386,12 @@ StopAndCleanupVtl1EnterExitTrace ()
         goto Exit;
     }
 
+    //
+    // Let ProcessTrace drain and return so nothing is still being
+    // delivered while the correlation state is flushed.
+    //
+    WaitForSingleObject(k_Vtl1EnterExitTracingThreadHandle, INFINITE);
+
     //
     // Close the handles
     //
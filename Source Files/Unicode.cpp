@@ -0,0 +1,211 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Unicode.cpp
+*
+* @summary:   UTF-16 to UTF-8 transcoding. Nearly everything Vtl1Mon writes
+*             (paths, symbol names, process names) is ASCII, so runs of ASCII
+*             are narrowed 16 characters at a time with SSE2.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Unicode.hpp"
+#include <wchar.h>
+
+//
+// The vector path needs 16-bit wchar_t (always true on Windows).
+//
+#if (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)) && (WCHAR_MAX == 0xFFFF)
+#include <emmintrin.h>
+#define UNICODE_SSE2_ASCII_PATH
+#endif
+
+#define UNICODE_REPLACEMENT_CHARACTER 0xFFFD
+
+/**
+*
+* @brief        Narrows the leading run of ASCII characters.
+* @param[in]    Source - The UTF-16 characters.
+* @param[in]    Length - The number of characters.
+* @param[out]   Destination - Receives one byte per ASCII character.
+* @return       The number of (leading) characters which were ASCII.
+*
+*/
+static
+size_t
+TranscodeAsciiRun (
+    _In_ const wchar_t* Source,
+    _In_ size_t Length,
+    _Out_ char* Destination
+    )
+{
+    size_t position;
+
+    position = 0;
+
+#ifdef UNICODE_SSE2_ASCII_PATH
+    {
+        const __m128i nonAsciiMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+        const __m128i zero = _mm_setzero_si128();
+
+        while ((Length - position) >= 16)
+        {
+            __m128i low;
+            __m128i high;
+
+            low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Source + position));
+            high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Source + position + 8));
+
+            //
+            // Any bit above 0x7F in any of the 16 characters ends the run.
+            //
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(low, high), nonAsciiMask), zero)) != 0xFFFF)
+            {
+                break;
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(Destination + position),
+                             _mm_packus_epi16(low, high));
+
+            position += 16;
+        }
+    }
+#endif
+
+    while ((position < Length) &&
+           (static_cast<uint32_t>(Source[position]) < 0x80))
+    {
+        Destination[position] = static_cast<char>(Source[position]);
+        position++;
+    }
+
+    return position;
+}
+
+/**
+*
+* @brief        Transcodes UTF-16 to UTF-8. Unpaired surrogates become U+FFFD.
+* @param[in]    Source - The UTF-16 characters.
+* @param[in]    Length - The number of characters.
+* @param[out]   Destination - Receives the UTF-8. Must have room for
+*                             Length * UTF8_MAX_BYTES_PER_WCHAR bytes.
+* @return       The number of bytes written.
+*
+*/
+size_t
+TranscodeUtf16ToUtf8 (
+    _In_ const wchar_t* Source,
+    _In_ size_t Length,
+    _Out_ char* Destination
+    )
+{
+    size_t sourcePosition;
+    size_t destinationPosition;
+
+    sourcePosition = 0;
+    destinationPosition = 0;
+
+    while (sourcePosition < Length)
+    {
+        uint32_t codePoint;
+        size_t asciiLength;
+
+        asciiLength = TranscodeAsciiRun(Source + sourcePosition,
+                                        (Length - sourcePosition),
+                                        Destination + destinationPosition);
+
+        sourcePosition += asciiLength;
+        destinationPosition += asciiLength;
+
+        if (sourcePosition == Length)
+        {
+            break;
+        }
+
+        codePoint = static_cast<uint32_t>(Source[sourcePosition++]);
+
+        if ((codePoint >= 0xD800) &&
+            (codePoint <= 0xDBFF))
+        {
+            if ((sourcePosition < Length) &&
+                (static_cast<uint32_t>(Source[sourcePosition]) >= 0xDC00) &&
+                (static_cast<uint32_t>(Source[sourcePosition]) <= 0xDFFF))
+            {
+                codePoint = (0x10000 + ((codePoint - 0xD800) << 10) + (static_cast<uint32_t>(Source[sourcePosition]) - 0xDC00));
+                sourcePosition++;
+            }
+            else
+            {
+                codePoint = UNICODE_REPLACEMENT_CHARACTER;
+            }
+        }
+        else if (((codePoint >= 0xDC00) && (codePoint <= 0xDFFF)) ||
+                 (codePoint > 0x10FFFF))
+        {
+            codePoint = UNICODE_REPLACEMENT_CHARACTER;
+        }
+
+        if (codePoint < 0x800)
+        {
+            Destination[destinationPosition++] = static_cast<char>(0xC0 | (codePoint >> 6));
+            Destination[destinationPosition++] = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000)
+        {
+            Destination[destinationPosition++] = static_cast<char>(0xE0 | (codePoint >> 12));
+            Destination[destinationPosition++] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            Destination[destinationPosition++] = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+        else
+        {
+            Destination[destinationPosition++] = static_cast<char>(0xF0 | (codePoint >> 18));
+            Destination[destinationPosition++] = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            Destination[destinationPosition++] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            Destination[destinationPosition++] = static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    return destinationPosition;
+}
+
+/**
+*
+* @brief        Transcodes UTF-16 to a UTF-8 string.
+* @param[in]    Source - The UTF-16 characters.
+* @param[in]    Length - The number of characters.
+* @return       The UTF-8 string.
+*
+*/
+std::string
+ConvertToUtf8 (
+    _In_ const wchar_t* Source,
+    _In_ size_t Length
+    )
+{
+    std::string result;
+
+    result.resize(Length * UTF8_MAX_BYTES_PER_WCHAR);
+
+    result.resize(TranscodeUtf16ToUtf8(Source, Length, &result[0]));
+
+    return result;
+}
+
+/**
+*
+* @brief        Transcodes a NULL-terminated UTF-16 string to a UTF-8 string.
+* @param[in]    Source - The UTF-16 string.
+* @return       The UTF-8 string.
+*
+*/
+std::string
+ConvertToUtf8 (
+    _In_ const wchar_t* Source
+    )
+{
+    return ConvertToUtf8(Source, wcslen(Source));
+}
\ No newline at end of file
@@ -0,0 +1,307 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/AnomalyTests.cpp
+*
+* @summary:   Anomaly detector tests: a burst among many steady Poisson pairs
+*             alerts once and nothing else does, and idle stretches decay the
+*             baselines interval by interval.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "Anomaly.hpp"
+#include <math.h>
+#include <vector>
+
+//
+// (process, secure call) pairs, their mean calls per interval, and the
+// intervals run.
+//
+#define ANOMALY_TEST_PAIRS 1000
+#define ANOMALY_TEST_MEAN 20.0
+#define ANOMALY_TEST_INTERVALS 300
+
+//
+// The pair which bursts, when, and by how many extra calls.
+//
+#define ANOMALY_TEST_BURST_PAIR 417
+#define ANOMALY_TEST_BURST_INTERVAL 200
+#define ANOMALY_TEST_BURST_CALLS 400
+
+/**
+*
+* @brief        Gets the next value of a xorshift64 generator, as a fraction in [0, 1).
+* @param[in]    Seed - The generator state.
+* @return       The fraction.
+*
+*/
+static
+double
+NextTestFraction (
+    _Inout_ uint64_t* Seed
+    )
+{
+    *Seed ^= (*Seed << 13);
+    *Seed ^= (*Seed >> 7);
+    *Seed ^= (*Seed << 17);
+
+    return ((*Seed >> 11) * (1.0 / 9007199254740992.0));
+}
+
+/**
+*
+* @brief        Draws from a Poisson distribution (Knuth's method, fine for small means).
+* @param[in]    Seed - The generator state.
+* @param[in]    Mean - The distribution's mean.
+* @return       The draw.
+*
+*/
+static
+uint32_t
+NextTestPoisson (
+    _Inout_ uint64_t* Seed,
+    _In_ double Mean
+    )
+{
+    double limit;
+    double product;
+    uint32_t count;
+
+    limit = exp(-Mean);
+    product = NextTestFraction(Seed);
+    count = 0;
+
+    while (product > limit)
+    {
+        product *= NextTestFraction(Seed);
+        count++;
+    }
+
+    return count;
+}
+
+/**
+*
+* @brief        Counts calls for a pair, spread over a few stacks.
+* @param[in]    Detector - The detector.
+* @param[in]    Pair - The pair.
+* @param[in]    Calls - The number of calls.
+*
+*/
+static
+void
+CountTestCalls (
+    _Inout_ PANOMALY_DETECTOR Detector,
+    _In_ uint64_t Pair,
+    _In_ uint32_t Calls
+    )
+{
+    for (uint32_t i = 0; i < Calls; i++)
+    {
+        uint64_t frame;
+
+        frame = (0x7FF800001000ULL + (Pair * 0x100) + (i % ANOMALY_STACKS));
+
+        CountAnomalyEvent(Detector,
+                          Pair,
+                          static_cast<uint32_t>(Pair + 4),
+                          frame,
+                          &frame,
+                          1);
+    }
+}
+
+/**
+*
+* @brief        Finds a pair's baseline.
+* @param[in]    Detector - The detector.
+* @param[in]    Pair - The pair.
+* @return       The baseline, or NULL if there is none.
+*
+*/
+static
+const ANOMALY_ENTRY*
+FindTestEntry (
+    _In_ const ANOMALY_DETECTOR* Detector,
+    _In_ uint64_t Pair
+    )
+{
+    for (const auto& entry : Detector->Slots)
+    {
+        if ((entry.InUse) &&
+            (entry.Key == Pair))
+        {
+            return &entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+*
+* @brief        Runs 1000 Poisson(20) pairs for 300 intervals with one burst
+*               injected, and checks that it is the only alert.
+*
+*/
+static
+void
+TestBurstAmongPoissonPairs ()
+{
+    ANOMALY_DETECTOR detector;
+    std::vector<ANOMALY_ALERT> alerts;
+    uint64_t seed;
+    uint64_t burstAlerts;
+    uint64_t otherAlerts;
+
+    InitializeAnomalyDetector(&detector, ANOMALY_DEFAULT_CAPACITY, ANOMALY_DEFAULT_SCORE);
+
+    seed = 0x9E3779B97F4A7C15ULL;
+    burstAlerts = 0;
+    otherAlerts = 0;
+
+    for (uint32_t interval = 0; interval < ANOMALY_TEST_INTERVALS; interval++)
+    {
+        for (uint64_t pair = 0; pair < ANOMALY_TEST_PAIRS; pair++)
+        {
+            CountTestCalls(&detector, pair, NextTestPoisson(&seed, ANOMALY_TEST_MEAN));
+        }
+
+        if (interval == ANOMALY_TEST_BURST_INTERVAL)
+        {
+            CountTestCalls(&detector, ANOMALY_TEST_BURST_PAIR, ANOMALY_TEST_BURST_CALLS);
+        }
+
+        EvaluateAnomalyDetector(&detector, alerts);
+
+        for (const auto& alert : alerts)
+        {
+            if ((interval == ANOMALY_TEST_BURST_INTERVAL) &&
+                (alert.Key == ANOMALY_TEST_BURST_PAIR))
+            {
+                burstAlerts++;
+
+                TEST_CHECK(alert.ProcessId == (ANOMALY_TEST_BURST_PAIR + 4));
+                TEST_CHECK(alert.Count >= ANOMALY_TEST_BURST_CALLS);
+                TEST_CHECK(alert.Score >= ANOMALY_DEFAULT_SCORE);
+
+                //
+                // The burst's calls are spread over as many stacks as
+                // a pair keeps counters for, so none is evicted.
+                //
+                for (const auto& stack : alert.Stacks)
+                {
+                    TEST_CHECK(stack.Error == 0);
+                }
+            }
+            else
+            {
+                otherAlerts++;
+            }
+        }
+    }
+
+    TEST_CHECK(burstAlerts == 1);
+    TEST_CHECK(otherAlerts == 0);
+    TEST_CHECK(detector.Used == ANOMALY_TEST_PAIRS);
+    TEST_CHECK(detector.Untracked == 0);
+    TEST_CHECK(detector.Alerts == 1);
+}
+
+/**
+*
+* @brief        Checks that skipped intervals decay a baseline as empty
+*               intervals would, and that a long idle stretch is capped and
+*               drops it.
+*
+*/
+static
+void
+TestIdleIntervalsDecayBaselines ()
+{
+    ANOMALY_DETECTOR detector;
+    ANOMALY_DETECTOR stepped;
+    std::vector<ANOMALY_ALERT> alerts;
+    const ANOMALY_ENTRY* entry;
+    const ANOMALY_ENTRY* steppedEntry;
+    uint64_t interval;
+
+    InitializeAnomalyDetector(&detector, 16, ANOMALY_DEFAULT_SCORE);
+
+    for (uint32_t i = 0; i < 50; i++)
+    {
+        CountTestCalls(&detector, 1, 20);
+
+        EvaluateAnomalyDetector(&detector, alerts);
+    }
+
+    entry = FindTestEntry(&detector, 1);
+
+    if (!TEST_CHECK(entry != NULL))
+    {
+        return;
+    }
+
+    TEST_CHECK(fabs(entry->Mean - 20.0) < 1e-6);
+
+    //
+    // Skipping is the same as evaluating that many empty intervals.
+    //
+    stepped = detector;
+
+    SkipAnomalyIntervals(&detector, 5);
+
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        EvaluateAnomalyDetector(&stepped, alerts);
+
+        TEST_CHECK(alerts.empty());
+    }
+
+    entry = FindTestEntry(&detector, 1);
+    steppedEntry = FindTestEntry(&stepped, 1);
+
+    if ((!TEST_CHECK(entry != NULL)) ||
+        (!TEST_CHECK(steppedEntry != NULL)))
+    {
+        return;
+    }
+
+    TEST_CHECK(detector.Interval == 55);
+    TEST_CHECK(entry->Mean == steppedEntry->Mean);
+    TEST_CHECK(entry->Variance == steppedEntry->Variance);
+    TEST_CHECK(fabs(entry->Mean - (20.0 * pow(0.9, 5))) < 1e-6);
+
+    //
+    // A very long stretch is capped, and the baseline has long gone idle
+    // by the end of it.
+    //
+    interval = detector.Interval;
+
+    SkipAnomalyIntervals(&detector, 1000000000ULL);
+
+    TEST_CHECK((detector.Interval - interval) <= ANOMALY_MAX_IDLE_INTERVALS);
+    TEST_CHECK(detector.Used == 0);
+    TEST_CHECK(detector.Dropped == 1);
+    TEST_CHECK(FindTestEntry(&detector, 1) == NULL);
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("A burst among Poisson pairs alerts once", TestBurstAmongPoissonPairs);
+    RunTest("Idle intervals decay baselines", TestIdleIntervalsDecayBaselines);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
@@ -0,0 +1,353 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Benchmark.cpp
+*
+* @summary:   Micro-benchmarks for the portable subset's hot paths: export
+*             lookups (one at a time and batched), LZ4 compression and the
+*             export ring. Each is run a few times and the best run reported,
+*             so run it on a quiet machine.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "PeExports.hpp"
+#include "Lz4.hpp"
+#include "RingClient.hpp"
+#include <stdio.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <vector>
+
+//
+// Runs of each benchmark. The best is reported.
+//
+#define BENCH_RUNS 5
+
+//
+// RVAs looked up per run, and bytes compressed per run.
+//
+#define BENCH_LOOKUPS (1024 * 1024)
+#define BENCH_COMPRESS_BYTES (16 * 1024 * 1024)
+
+//
+// RVAs per batch - about a module's share of a few dozen stacks, which is
+// how symbolization batches them.
+//
+#define BENCH_BATCH 64
+
+//
+// Records published per run.
+//
+#define BENCH_RECORDS (4 * 1024 * 1024)
+
+//
+// Keeps the optimizer from discarding results.
+//
+static volatile uint64_t k_BenchSink;
+
+/**
+*
+* @brief        Benchmarks export lookups over random RVAs around the exports,
+*               one at a time and in batches (each sorted and swept).
+* @param[in]    Table - The exports.
+*
+*/
+static
+void
+BenchmarkPeExports (
+    _In_ const PE_EXPORT_TABLE* Table
+    )
+{
+    std::vector<uint32_t> rvas;
+    std::vector<SYMBOL_BATCH_ENTRY> batch;
+    uint64_t bestSingle;
+    uint64_t bestBatch;
+    uint32_t low;
+    uint32_t high;
+    uint32_t seed;
+
+    low = Table->Exports.front().Rva;
+    high = (Table->Exports.back().Rva + 0x1000);
+    seed = 1;
+
+    for (uint32_t i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        seed = ((seed * 1103515245) + 12345);
+        rvas.push_back(low + ((seed >> 4) % (high - low)));
+    }
+
+    bestSingle = UINT64_MAX;
+    bestBatch = UINT64_MAX;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        uint64_t start;
+        uint64_t sum;
+
+        sum = 0;
+        start = GetMonotonicNanoseconds();
+
+        for (uint32_t rva : rvas)
+        {
+            uint32_t displacement;
+
+            sum += reinterpret_cast<uintptr_t>(LookupPeExport(Table, rva, &displacement)) + displacement;
+        }
+
+        bestSingle = (std::min)(bestSingle, (GetMonotonicNanoseconds() - start));
+
+        batch.resize(rvas.size());
+
+        for (size_t i = 0; i < rvas.size(); i++)
+        {
+            batch[i].Rva = rvas[i];
+            batch[i].Slot = static_cast<uint32_t>(i);
+        }
+
+        start = GetMonotonicNanoseconds();
+
+        for (size_t i = 0; i < batch.size(); i += BENCH_BATCH)
+        {
+            LookupPeExportBatch(Table, (batch.data() + i), (std::min)(static_cast<size_t>(BENCH_BATCH), (batch.size() - i)));
+        }
+
+        bestBatch = (std::min)(bestBatch, (GetMonotonicNanoseconds() - start));
+
+        sum += batch.back().NameOffset;
+        k_BenchSink += sum;
+    }
+
+    wprintf(L"[+] PE exports (%zu exports, %u RVAs):\n", Table->Exports.size(), BENCH_LOOKUPS);
+    wprintf(L"  [>] One at a time: %.1f ns per RVA\n", (static_cast<double>(bestSingle) / BENCH_LOOKUPS));
+    wprintf(L"  [>] In batches of %d (including the sort): %.1f ns per RVA\n", BENCH_BATCH, (static_cast<double>(bestBatch) / BENCH_LOOKUPS));
+}
+
+/**
+*
+* @brief        Benchmarks LZ4 frame compression and decompression of CSV-like
+*               output.
+*
+*/
+static
+void
+BenchmarkLz4 ()
+{
+    static LZ4_STATE state;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> frame;
+    std::vector<uint8_t> output;
+    uint64_t bestCompress;
+    uint64_t bestDecompress;
+    size_t frameLength;
+    uint32_t seed;
+    bool complete;
+    char line[128];
+
+    seed = 1;
+
+    while (input.size() < BENCH_COMPRESS_BYTES)
+    {
+        int length;
+
+        seed = ((seed * 1103515245) + 12345);
+
+        length = snprintf(line,
+                          sizeof(line),
+                          "%u,lsass.exe,%u,SecureCall%u,0x%x,ntdll.dll!NtCall+0x%x\n",
+                          seed,
+                          (seed >> 20),
+                          ((seed >> 8) & 31),
+                          seed,
+                          ((seed >> 4) & 0xFFF));
+
+        input.insert(input.end(), line, (line + length));
+    }
+
+    frame.resize(LZ4_FRAME_HEADER_SIZE + (((input.size() / LZ4_FRAME_BLOCK_SIZE) + 1) * Lz4FrameBlockBound(LZ4_FRAME_BLOCK_SIZE)) + 8);
+
+    bestCompress = UINT64_MAX;
+    bestDecompress = UINT64_MAX;
+    frameLength = 0;
+
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        uint64_t start;
+
+        start = GetMonotonicNanoseconds();
+
+        frameLength = Lz4WriteFrameHeader(frame.data());
+
+        for (size_t i = 0; i < input.size(); i += LZ4_FRAME_BLOCK_SIZE)
+        {
+            frameLength += Lz4WriteFrameBlock(&state,
+                                              (input.data() + i),
+                                              (std::min)(static_cast<size_t>(LZ4_FRAME_BLOCK_SIZE), (input.size() - i)),
+                                              (frame.data() + frameLength));
+        }
+
+        frameLength += Lz4WriteFrameEnd(frame.data() + frameLength);
+
+        bestCompress = (std::min)(bestCompress, (GetMonotonicNanoseconds() - start));
+
+        start = GetMonotonicNanoseconds();
+
+        Lz4DecompressFrame(frame.data(), frameLength, output, &complete);
+
+        bestDecompress = (std::min)(bestDecompress, (GetMonotonicNanoseconds() - start));
+
+        k_BenchSink += output.size();
+    }
+
+    wprintf(L"[+] LZ4 (%zu bytes of CSV-like output):\n", input.size());
+    wprintf(L"  [>] Ratio: %.2f\n", (static_cast<double>(input.size()) / frameLength));
+    wprintf(L"  [>] Compress: %.0f MB/s\n", ((static_cast<double>(input.size()) * 1000.0) / bestCompress));
+    wprintf(L"  [>] Decompress: %.0f MB/s\n", ((static_cast<double>(input.size()) * 1000.0) / bestDecompress));
+}
+
+/**
+*
+* @brief        Benchmarks publishing to and reading from an export ring, for
+*               a shallow and a full stack.
+*
+*/
+static
+void
+BenchmarkRing ()
+{
+    RING_PRODUCER producer;
+    RING_READER reader;
+    RING_RECORD record;
+    char name[64];
+
+    snprintf(name, sizeof(name), "vtl1mon-bench-%d", static_cast<int>(getpid()));
+
+    if (!CreateRingProducer(&producer, name, RING_DEFAULT_RECORDS, RING_DEFAULT_STRINGS_SIZE))
+    {
+        return;
+    }
+
+    if (!OpenRingReader(&reader, name))
+    {
+        CloseRingProducer(&producer);
+        return;
+    }
+
+    wprintf(L"[+] Export ring (%llu records):\n", producer.Header->RecordCount);
+
+    for (uint16_t frames : { 12, RING_MAX_FRAMES })
+    {
+        uint64_t bestPublish;
+        uint64_t bestRead;
+        uint64_t bestPoll;
+        uint64_t read;
+
+        bestPublish = UINT64_MAX;
+        bestRead = UINT64_MAX;
+        bestPoll = UINT64_MAX;
+
+        for (int run = 0; run < BENCH_RUNS; run++)
+        {
+            uint64_t start;
+
+            start = GetMonotonicNanoseconds();
+
+            for (uint32_t n = 0; n < BENCH_RECORDS; n++)
+            {
+                PRING_RECORD slot;
+
+                slot = BeginRingRecord(&producer);
+
+                slot->TimeStamp = n;
+                slot->ProcessId = 4;
+                slot->ThreadId = n;
+                slot->ProcessName = 0;
+                slot->ThreadName = 0;
+                slot->SecureCallName = 0;
+                slot->SecureCallNumber = static_cast<uint16_t>(n & 0xFF);
+                slot->NumberOfFrames = frames;
+                slot->TotalFrames = frames;
+                slot->Reserved = 0;
+                slot->StringGeneration = producer.StringGeneration;
+
+                for (uint16_t i = 0; i < frames; i++)
+                {
+                    slot->Frames[i] = (n + i);
+                    slot->FrameNames[i] = 0;
+                }
+
+                CommitRingRecord(&producer, slot);
+            }
+
+            bestPublish = (std::min)(bestPublish, (GetMonotonicNanoseconds() - start));
+
+            //
+            // Reads the whole ring (everything older was overwritten).
+            //
+            SeekRingReaderToOldest(&reader);
+
+            read = 0;
+            start = GetMonotonicNanoseconds();
+
+            while (ReadRingRecord(&reader, &record) == RingReadRecord)
+            {
+                k_BenchSink += record.Frames[record.NumberOfFrames - 1];
+                read++;
+            }
+
+            bestRead = (std::min)(bestRead, ((GetMonotonicNanoseconds() - start) / ((read != 0) ? read : 1)));
+
+            start = GetMonotonicNanoseconds();
+
+            for (uint32_t n = 0; n < BENCH_RECORDS; n++)
+            {
+                k_BenchSink += ReadRingRecord(&reader, &record);
+            }
+
+            bestPoll = (std::min)(bestPoll, (GetMonotonicNanoseconds() - start));
+        }
+
+        wprintf(L"  [>] %u frames: publish %.1f ns, read %llu ns, empty poll %.1f ns (per record)\n",
+                frames,
+                (static_cast<double>(bestPublish) / BENCH_RECORDS),
+                bestRead,
+                (static_cast<double>(bestPoll) / BENCH_RECORDS));
+    }
+
+    CloseRingReader(&reader);
+    CloseRingProducer(&producer);
+}
+
+/**
+*
+* @brief        Benchmark entry point.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array (argv[1] is the image to look up exports in).
+* @return       0 on success, otherwise 1.
+*
+*/
+int
+main (
+    _In_ int argc,
+    _In_ char** argv
+    )
+{
+    PE_EXPORT_TABLE table;
+
+    if ((argc < 2) ||
+        (!LoadPeExports(argv[1], &table)) ||
+        (table.Exports.empty()))
+    {
+        wprintf(L"[+] Usage: ./Vtl1MonBench /path/to/SymbolDlls/dbghelp.dll\n");
+        return 1;
+    }
+
+    BenchmarkPeExports(&table);
+    BenchmarkLz4();
+    BenchmarkRing();
+
+    return 0;
+}
\ No newline at end of file
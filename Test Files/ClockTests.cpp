@@ -0,0 +1,179 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/ClockTests.cpp
+*
+* @summary:   Session clock tests: batch conversion matches the scalar
+*             conversion to the 100ns at the QPC frequencies Windows uses,
+*             and timestamps round trip through FILETIMEs.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "Clock.hpp"
+#include <vector>
+
+//
+// Timestamps converted per frequency.
+//
+#define CLOCK_TEST_TIMESTAMPS (2 * 1000 * 1000)
+
+//
+// The ACPI PM timer, the HPET, the 10MHz QPC of current Windows, and TSC
+// based frequencies.
+//
+static const uint64_t k_TestFrequencies[] = { 3579545, 14318180, 10000000, 2148437, 2992965000ULL };
+
+//
+// 2026-10-19, as a FILETIME.
+//
+#define CLOCK_TEST_ANCHOR_TIME 134368416000000000ULL
+
+/**
+*
+* @brief        Makes a clock anchored a few days into its QPC.
+* @param[in]    Frequency - The QPC frequency.
+* @return       The clock.
+*
+*/
+static
+SESSION_CLOCK
+MakeTestClock (
+    _In_ uint64_t Frequency
+    )
+{
+    SESSION_CLOCK clock;
+
+    clock.QpcFrequency = Frequency;
+    clock.AnchorTimeStamp = (Frequency * 300000) + 12345;
+    clock.AnchorTime = CLOCK_TEST_ANCHOR_TIME;
+    clock.Uncertainty = 0;
+
+    return clock;
+}
+
+/**
+*
+* @brief        Checks that batches convert every timestamp exactly as
+*               GetClockTime does, either side of the anchor.
+*
+*/
+static
+void
+TestBatchMatchesScalar ()
+{
+    std::vector<uint64_t> timeStamps;
+    std::vector<uint64_t> times;
+    uint64_t seed;
+
+    timeStamps.resize(CLOCK_TEST_TIMESTAMPS);
+    times.resize(CLOCK_TEST_TIMESTAMPS);
+
+    seed = 0x2545F4914F6CDD1DULL;
+
+    for (uint64_t frequency : k_TestFrequencies)
+    {
+        SESSION_CLOCK clock;
+        size_t mismatches;
+
+        clock = MakeTestClock(frequency);
+
+        for (size_t i = 0; i < timeStamps.size(); i++)
+        {
+            seed ^= (seed << 13);
+            seed ^= (seed >> 7);
+            seed ^= (seed << 17);
+
+            //
+            // Within about a day either side of the anchor, plus the anchor
+            // itself and its neighbours.
+            //
+            if (i < 3)
+            {
+                timeStamps[i] = (clock.AnchorTimeStamp + i - 1);
+            }
+            else
+            {
+                timeStamps[i] = ((clock.AnchorTimeStamp - (frequency * 86400)) + (seed % (frequency * 172800)));
+            }
+        }
+
+        ConvertClockTimeStamps(&clock, timeStamps.data(), times.data(), times.size());
+
+        mismatches = 0;
+
+        for (size_t i = 0; i < timeStamps.size(); i++)
+        {
+            if (times[i] != GetClockTime(&clock, timeStamps[i]))
+            {
+                mismatches++;
+            }
+        }
+
+        TEST_CHECK(mismatches == 0);
+
+        //
+        // In place, as the symbolize command does it.
+        //
+        ConvertClockTimeStamps(&clock, timeStamps.data(), timeStamps.data(), timeStamps.size());
+
+        TEST_CHECK(timeStamps == times);
+    }
+}
+
+/**
+*
+* @brief        Checks that GetClockTimeStamp finds the first timestamp at or
+*               after a time.
+*
+*/
+static
+void
+TestTimeStampRoundTrip ()
+{
+    for (uint64_t frequency : k_TestFrequencies)
+    {
+        SESSION_CLOCK clock;
+        size_t mismatches;
+
+        clock = MakeTestClock(frequency);
+        mismatches = 0;
+
+        for (uint64_t time = (CLOCK_TEST_ANCHOR_TIME - CLOCK_FILETIME_SECOND);
+             time < (CLOCK_TEST_ANCHOR_TIME + CLOCK_FILETIME_SECOND);
+             time += 997)
+        {
+            uint64_t timeStamp;
+
+            timeStamp = GetClockTimeStamp(&clock, time);
+
+            if ((GetClockTime(&clock, timeStamp) < time) ||
+                ((time >= CLOCK_TEST_ANCHOR_TIME) &&
+                 (GetClockTime(&clock, (timeStamp - 1)) >= time)))
+            {
+                mismatches++;
+            }
+        }
+
+        TEST_CHECK(mismatches == 0);
+    }
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("Batch conversion matches the scalar conversion", TestBatchMatchesScalar);
+    RunTest("Timestamps round trip through times", TestTimeStampRoundTrip);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
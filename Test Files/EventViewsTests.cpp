@@ -0,0 +1,438 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/EventViewsTests.cpp
+*
+* @summary:   Event view tests: every payload layout rejects truncated
+*             payloads and unterminated names, takes or rejects trailing
+*             bytes as its schema says, and points into the payload.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "EventViews.hpp"
+#include <vector>
+
+/**
+*
+* @brief        Appends raw bytes to a payload.
+* @param[out]   Payload - The payload.
+* @param[in]    Data - The bytes.
+* @param[in]    Length - The number of bytes.
+*
+*/
+static
+void
+AppendTestBytes (
+    _Inout_ std::vector<uint8_t>& Payload,
+    _In_ const void* Data,
+    _In_ size_t Length
+    )
+{
+    size_t offset;
+
+    offset = Payload.size();
+
+    Payload.resize(offset + Length);
+
+    if (Length != 0)
+    {
+        memcpy(&Payload[offset], Data, Length);
+    }
+}
+
+/**
+*
+* @brief        Checks that a view rejects every strict prefix of a payload
+*               it accepts whole.
+* @param[in]    Payload - The whole payload.
+* @return       true if only the whole payload parses, otherwise false.
+*
+*/
+template <typename VIEW>
+static
+bool
+RejectsTruncatedPayloads (
+    _In_ const std::vector<uint8_t>& Payload
+    )
+{
+    VIEW view;
+
+    if (!view.Parse(Payload.data(), Payload.size()))
+    {
+        return false;
+    }
+
+    for (size_t length = 0; length < Payload.size(); length++)
+    {
+        //
+        // A copy of just the prefix, so that reading past it is caught by
+        // sanitizers rather than landing in the rest of the payload.
+        //
+        std::vector<uint8_t> prefix(Payload.begin(), (Payload.begin() + length));
+
+        if (view.Parse(prefix.data(), prefix.size()))
+        {
+            return false;
+        }
+
+        if ((view.operator->() != NULL) ||
+            (view.Name() != NULL) ||
+            (view.Elements() != NULL))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+*
+* @brief        Checks the fixed-size layouts: the VTL 1 enter/exit payload
+*               must be exact, thread payloads may carry newer fields, and
+*               neither parses from NULL.
+*
+*/
+static
+void
+TestFixedPayloads ()
+{
+    SECURE_CALL_EVENT_DATA secureCall;
+    THREAD_EVENT_DATA thread;
+    PROCESS_EVENT_DATA processEnd;
+    std::vector<uint8_t> payload;
+    SECURE_CALL_EVENT_VIEW secureCallView;
+    THREAD_EVENT_VIEW threadView;
+    PROCESS_END_EVENT_VIEW processEndView;
+
+    secureCall.Operation = 1;
+    secureCall.SecureCallNumber = 0x1234;
+
+    AppendTestBytes(payload, &secureCall, sizeof(secureCall));
+
+    TEST_CHECK(RejectsTruncatedPayloads<SECURE_CALL_EVENT_VIEW>(payload));
+
+    if (TEST_CHECK(secureCallView.Parse(payload.data(), payload.size())))
+    {
+        TEST_CHECK(secureCallView->SecureCallNumber == 0x1234);
+        TEST_CHECK(reinterpret_cast<const uint8_t*>(secureCallView.operator->()) == payload.data());
+    }
+
+    //
+    // One byte too many is a different event.
+    //
+    payload.push_back(0);
+
+    TEST_CHECK(!secureCallView.Parse(payload.data(), payload.size()));
+    TEST_CHECK(!secureCallView.Parse(NULL, 0));
+
+    thread.ProcessId = 4;
+    thread.ThreadId = 8;
+
+    payload.clear();
+    AppendTestBytes(payload, &thread, sizeof(thread));
+
+    TEST_CHECK(RejectsTruncatedPayloads<THREAD_EVENT_VIEW>(payload));
+
+    payload.resize(payload.size() + 64, 0xAB);
+
+    if (TEST_CHECK(threadView.Parse(payload.data(), payload.size())))
+    {
+        TEST_CHECK((threadView->ProcessId == 4) && (threadView->ThreadId == 8));
+    }
+
+    //
+    // A process end only needs the process ID.
+    //
+    memset(&processEnd, 0, sizeof(processEnd));
+    processEnd.ProcessId = 1234;
+
+    payload.clear();
+    AppendTestBytes(payload, &processEnd, offsetof(PROCESS_EVENT_DATA, ParentId));
+
+    TEST_CHECK(RejectsTruncatedPayloads<PROCESS_END_EVENT_VIEW>(payload));
+
+    payload.resize(payload.size() + 300, 0xCD);
+
+    if (TEST_CHECK(processEndView.Parse(payload.data(), payload.size())))
+    {
+        TEST_CHECK(processEndView->ProcessId == 1234);
+    }
+}
+
+/**
+*
+* @brief        Checks that a stack walk needs at least one whole frame and
+*               counts the frames it carries.
+*
+*/
+static
+void
+TestStackWalkPayloads ()
+{
+    STACK_WALK_EVENT_DATA stackWalk;
+    std::vector<uint8_t> payload;
+    STACK_WALK_EVENT_VIEW view;
+
+    memset(&stackWalk, 0, sizeof(stackWalk));
+    stackWalk.EventTimeStamp = 0x1122334455667788ULL;
+    stackWalk.StackProcess = 4;
+    stackWalk.StackThread = 8;
+
+    AppendTestBytes(payload, &stackWalk, offsetof(STACK_WALK_EVENT_DATA, Stack));
+
+    //
+    // Anything short of one frame.
+    //
+    {
+        std::vector<uint8_t> oneFrame(payload);
+
+        oneFrame.resize(oneFrame.size() + sizeof(EVENT_POINTER), 0);
+
+        TEST_CHECK(RejectsTruncatedPayloads<STACK_WALK_EVENT_VIEW>(oneFrame));
+    }
+
+    for (EVENT_POINTER frame = 1; frame <= 32; frame++)
+    {
+        EVENT_POINTER address;
+
+        address = (0x7FF800001000ULL + frame);
+
+        AppendTestBytes(payload, &address, sizeof(address));
+    }
+
+    if (TEST_CHECK(view.Parse(payload.data(), payload.size())))
+    {
+        TEST_CHECK(view.ElementCount() == 32);
+        TEST_CHECK(view->EventTimeStamp == 0x1122334455667788ULL);
+        TEST_CHECK(view.Elements()[0] == (0x7FF800001000ULL + 1));
+        TEST_CHECK(view.Elements()[31] == (0x7FF800001000ULL + 32));
+        TEST_CHECK(reinterpret_cast<const uint8_t*>(view.Elements()) == (payload.data() + offsetof(STACK_WALK_EVENT_DATA, Stack)));
+    }
+
+    //
+    // Part of a frame past the last whole one.
+    //
+    for (size_t extra = 1; extra < sizeof(EVENT_POINTER); extra++)
+    {
+        std::vector<uint8_t> ragged(payload);
+
+        ragged.resize(ragged.size() + extra, 0);
+
+        TEST_CHECK(!view.Parse(ragged.data(), ragged.size()));
+    }
+}
+
+/**
+*
+* @brief        Checks the UTF-16 names of image load and thread name events:
+*               found when terminated inside the payload, rejected when not,
+*               and anything after the terminator ignored.
+*
+*/
+static
+void
+TestNamePayloads ()
+{
+    static const EVENT_WCHAR name[] = { u'n', u't', u'd', u'l', u'l', u'.', u'd', u'l', u'l', 0 };
+    IMAGE_LOAD_EVENT_DATA imageLoad;
+    THREAD_SET_NAME_EVENT_DATA setName;
+    std::vector<uint8_t> payload;
+    IMAGE_LOAD_EVENT_VIEW imageLoadView;
+    THREAD_SET_NAME_EVENT_VIEW setNameView;
+
+    memset(&imageLoad, 0, sizeof(imageLoad));
+    imageLoad.ImageBase = 0x7FF800000000ULL;
+    imageLoad.ImageSize = 0x200000;
+    imageLoad.ProcessId = 1234;
+
+    AppendTestBytes(payload, &imageLoad, offsetof(IMAGE_LOAD_EVENT_DATA, FileName));
+    AppendTestBytes(payload, name, sizeof(name));
+
+    TEST_CHECK(RejectsTruncatedPayloads<IMAGE_LOAD_EVENT_VIEW>(payload));
+
+    if (TEST_CHECK(imageLoadView.Parse(payload.data(), payload.size())))
+    {
+        TEST_CHECK(imageLoadView.NameLength() == 9);
+        TEST_CHECK(memcmp(imageLoadView.Name(), name, sizeof(name)) == 0);
+        TEST_CHECK(imageLoadView->ImageSize == 0x200000);
+    }
+
+    //
+    // Newer fields after the name, and an odd byte at the end.
+    //
+    payload.resize(payload.size() + 33, 0xEE);
+
+    if (TEST_CHECK(imageLoadView.Parse(payload.data(), payload.size())))
+    {
+        TEST_CHECK(imageLoadView.NameLength() == 9);
+    }
+
+    //
+    // Unterminated: the name runs to the end of the payload.
+    //
+    payload.clear();
+    AppendTestBytes(payload, &imageLoad, offsetof(IMAGE_LOAD_EVENT_DATA, FileName));
+    AppendTestBytes(payload, name, (sizeof(name) - sizeof(EVENT_WCHAR)));
+
+    TEST_CHECK(!imageLoadView.Parse(payload.data(), payload.size()));
+
+    //
+    // Half a terminator.
+    //
+    payload.push_back(0);
+
+    TEST_CHECK(!imageLoadView.Parse(payload.data(), payload.size()));
+
+    setName.ProcessId = 4;
+    setName.ThreadId = 8;
+
+    payload.clear();
+    AppendTestBytes(payload, &setName, offsetof(THREAD_SET_NAME_EVENT_DATA, ThreadName));
+    AppendTestBytes(payload, name, sizeof(name));
+
+    TEST_CHECK(RejectsTruncatedPayloads<THREAD_SET_NAME_EVENT_VIEW>(payload));
+
+    //
+    // An empty name is still a name.
+    //
+    payload.resize(offsetof(THREAD_SET_NAME_EVENT_DATA, ThreadName));
+    payload.resize(payload.size() + sizeof(EVENT_WCHAR), 0);
+
+    if (TEST_CHECK(setNameView.Parse(payload.data(), payload.size())))
+    {
+        TEST_CHECK(setNameView.NameLength() == 0);
+        TEST_CHECK(setNameView->ThreadId == 8);
+    }
+}
+
+/**
+*
+* @brief        Builds a process start payload.
+* @param[in]    SubAuthorities - The SID's sub-authority count, or -1 for no SID.
+* @param[in]    ImageName - The image name, terminator included.
+* @param[in]    ImageNameLength - The size, in bytes, of ImageName.
+* @param[out]   Payload - Receives the payload.
+*
+*/
+static
+void
+MakeTestProcessPayload (
+    _In_ int SubAuthorities,
+    _In_ const char* ImageName,
+    _In_ size_t ImageNameLength,
+    _Out_ std::vector<uint8_t>& Payload
+    )
+{
+    PROCESS_EVENT_DATA process;
+
+    memset(&process, 0, sizeof(process));
+    process.ProcessId = 1234;
+    process.ParentId = 4;
+
+    Payload.clear();
+
+    AppendTestBytes(Payload, &process, offsetof(PROCESS_EVENT_DATA, UserSid));
+
+    if (SubAuthorities < 0)
+    {
+        Payload.resize(Payload.size() + sizeof(uint32_t), 0);
+    }
+    else
+    {
+        size_t sid;
+
+        //
+        // TOKEN_USER (a pointer to the SID, and attributes), then the SID.
+        //
+        Payload.resize(Payload.size() + (2 * sizeof(EVENT_POINTER)), 0x11);
+
+        sid = Payload.size();
+
+        Payload.resize(sid + 8 + (SubAuthorities * sizeof(uint32_t)), 0);
+        Payload[sid] = 1;
+        Payload[sid + 1] = static_cast<uint8_t>(SubAuthorities);
+    }
+
+    AppendTestBytes(Payload, ImageName, ImageNameLength);
+}
+
+/**
+*
+* @brief        Checks the process start layout: the SID is walked by its
+*               sub-authority count, and a SID or name which runs past the
+*               payload is rejected.
+*
+*/
+static
+void
+TestProcessPayloads ()
+{
+    static const char imageName[] = "lsass.exe";
+    std::vector<uint8_t> payload;
+    PROCESS_EVENT_VIEW view;
+
+    for (int subAuthorities : { -1, 0, 1, 5, 15 })
+    {
+        MakeTestProcessPayload(subAuthorities, imageName, sizeof(imageName), payload);
+
+        TEST_CHECK(RejectsTruncatedPayloads<PROCESS_EVENT_VIEW>(payload));
+
+        //
+        // The command line and the rest follow the name.
+        //
+        AppendTestBytes(payload, "x\0y\0", 4);
+
+        if (TEST_CHECK(view.Parse(payload.data(), payload.size())))
+        {
+            TEST_CHECK(view.NameLength() == (sizeof(imageName) - 1));
+            TEST_CHECK(memcmp(view.Name(), imageName, sizeof(imageName)) == 0);
+            TEST_CHECK(view->ProcessId == 1234);
+        }
+    }
+
+    //
+    // No name at all.
+    //
+    MakeTestProcessPayload(-1, NULL, 0, payload);
+
+    TEST_CHECK(!view.Parse(payload.data(), payload.size()));
+
+    //
+    // A sub-authority count which puts the SID past the end of the payload.
+    //
+    MakeTestProcessPayload(1, imageName, sizeof(imageName), payload);
+
+    payload[offsetof(PROCESS_EVENT_DATA, UserSid) + (2 * sizeof(EVENT_POINTER)) + 1] = 0xFF;
+
+    TEST_CHECK(!view.Parse(payload.data(), payload.size()));
+
+    //
+    // An unterminated name.
+    //
+    MakeTestProcessPayload(5, imageName, (sizeof(imageName) - 1), payload);
+
+    TEST_CHECK(!view.Parse(payload.data(), payload.size()));
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("Fixed-size payloads", TestFixedPayloads);
+    RunTest("Stack walks need whole frames", TestStackWalkPayloads);
+    RunTest("Names must be terminated inside the payload", TestNamePayloads);
+    RunTest("Process SIDs and image names are bounded", TestProcessPayloads);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
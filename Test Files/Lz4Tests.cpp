@@ -0,0 +1,228 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Lz4Tests.cpp
+*
+* @summary:   LZ4 block and frame tests: round trips, a frame written by the
+*             reference lz4 tool, and cut-short frames.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "Lz4.hpp"
+#include <vector>
+#include <string>
+
+//
+// "Vtl1Mon,SecureCall,SecureCall,SecureCall,SecureCall,SecureCall,0x1000\n",
+// as written by "lz4 -B6" (content checksum, no block checksums).
+//
+static const char k_ReferenceText[] = "Vtl1Mon,SecureCall,SecureCall,SecureCall,SecureCall,SecureCall,0x1000\n";
+
+static const uint8_t k_ReferenceFrame[] =
+{
+    0x04, 0x22, 0x4d, 0x18, 0x64, 0x40, 0xa7, 0x1f, 0x00, 0x00, 0x00, 0xff,
+    0x03, 0x56, 0x74, 0x6c, 0x31, 0x4d, 0x6f, 0x6e, 0x2c, 0x53, 0x65, 0x63,
+    0x75, 0x72, 0x65, 0x43, 0x61, 0x6c, 0x6c, 0x0b, 0x00, 0x1a, 0x70, 0x30,
+    0x78, 0x31, 0x30, 0x30, 0x30, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x46, 0x22,
+    0x5c, 0x10
+};
+
+/**
+*
+* @brief        Builds CSV-like test input: repetitive, like real output.
+* @param[in]    Length - How much to build.
+* @return       The input.
+*
+*/
+static
+std::vector<uint8_t>
+BuildTestInput (
+    _In_ size_t Length
+    )
+{
+    std::vector<uint8_t> input;
+    uint32_t seed;
+    char line[128];
+
+    seed = 1;
+
+    while (input.size() < Length)
+    {
+        int length;
+
+        seed = ((seed * 1103515245) + 12345);
+
+        length = snprintf(line,
+                          sizeof(line),
+                          "%u,lsass.exe,%u,SecureCall%u,0x%x,ntdll.dll!NtCall+0x%x\n",
+                          seed,
+                          (seed >> 20),
+                          ((seed >> 8) & 31),
+                          seed,
+                          ((seed >> 4) & 0xFFF));
+
+        input.insert(input.end(), line, (line + length));
+    }
+
+    input.resize(Length);
+
+    return input;
+}
+
+/**
+*
+* @brief        Checks the xxHash32 reference values.
+*
+*/
+static
+void
+TestXxHash32 ()
+{
+    TEST_CHECK(XxHash32("", 0, 0) == 0x02CC5D05);
+    TEST_CHECK(XxHash32("abc", 3, 0) == 0x32D153FF);
+}
+
+/**
+*
+* @brief        Checks that blocks round trip, including empty and tiny ones.
+*
+*/
+static
+void
+TestBlockRoundTrip ()
+{
+    static LZ4_STATE state;
+    std::vector<uint8_t> compressed;
+    std::vector<uint8_t> output;
+
+    for (size_t length : { 0, 1, 5, 12, 13, 100, 4096, 65536, 300000 })
+    {
+        std::vector<uint8_t> input;
+        size_t compressedLength;
+
+        input = BuildTestInput(length);
+
+        compressed.resize(Lz4CompressBound(length));
+        compressedLength = Lz4CompressBlock(&state, input.data(), length, compressed.data());
+
+        TEST_CHECK(compressedLength <= compressed.size());
+
+        output.clear();
+
+        if (TEST_CHECK(Lz4DecompressBlock(compressed.data(), compressedLength, output)))
+        {
+            TEST_CHECK(output == input);
+        }
+
+        if (length >= 4096)
+        {
+            TEST_CHECK(compressedLength < (length / 2));
+        }
+    }
+}
+
+/**
+*
+* @brief        Checks that frames round trip, and that a frame cut short
+*               still gives back its complete blocks.
+*
+*/
+static
+void
+TestFrameRoundTrip ()
+{
+    static LZ4_STATE state;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> frame;
+    std::vector<uint8_t> output;
+    size_t offset;
+    size_t blockLength;
+    size_t firstBlockEnd;
+    bool complete;
+
+    input = BuildTestInput((LZ4_FRAME_BLOCK_SIZE * 2) + 1000);
+
+    frame.resize(LZ4_FRAME_HEADER_SIZE);
+    offset = Lz4WriteFrameHeader(frame.data());
+    firstBlockEnd = 0;
+
+    for (size_t i = 0; i < input.size(); i += LZ4_FRAME_BLOCK_SIZE)
+    {
+        blockLength = (std::min)(static_cast<size_t>(LZ4_FRAME_BLOCK_SIZE), (input.size() - i));
+
+        frame.resize(offset + Lz4FrameBlockBound(blockLength));
+        offset += Lz4WriteFrameBlock(&state, (input.data() + i), blockLength, (frame.data() + offset));
+
+        if (firstBlockEnd == 0)
+        {
+            firstBlockEnd = offset;
+        }
+    }
+
+    frame.resize(offset + 8);
+    offset += Lz4WriteFrameEnd(frame.data() + offset);
+    frame.resize(offset);
+
+    TEST_CHECK(IsLz4Frame(frame.data(), frame.size()));
+
+    if (TEST_CHECK(Lz4DecompressFrame(frame.data(), frame.size(), output, &complete)))
+    {
+        TEST_CHECK(complete);
+        TEST_CHECK(output == input);
+    }
+
+    //
+    // Cut inside the second block: only the first block comes back.
+    //
+    output.clear();
+
+    if (TEST_CHECK(Lz4DecompressFrame(frame.data(), (firstBlockEnd + 100), output, &complete)))
+    {
+        TEST_CHECK(!complete);
+        TEST_CHECK(output.size() == LZ4_FRAME_BLOCK_SIZE);
+        TEST_CHECK(memcmp(output.data(), input.data(), output.size()) == 0);
+    }
+}
+
+/**
+*
+* @brief        Checks that a frame written by the reference lz4 tool decodes.
+*
+*/
+static
+void
+TestReferenceFrame ()
+{
+    std::vector<uint8_t> output;
+    bool complete;
+
+    TEST_CHECK(IsLz4Frame(k_ReferenceFrame, sizeof(k_ReferenceFrame)));
+
+    if (TEST_CHECK(Lz4DecompressFrame(k_ReferenceFrame, sizeof(k_ReferenceFrame), output, &complete)))
+    {
+        TEST_CHECK(complete);
+        TEST_CHECK(std::string(output.begin(), output.end()) == k_ReferenceText);
+    }
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("xxHash32 reference values", TestXxHash32);
+    RunTest("Block round trip", TestBlockRoundTrip);
+    RunTest("Frame round trip and cut-short frames", TestFrameRoundTrip);
+    RunTest("Decode a reference lz4 frame", TestReferenceFrame);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
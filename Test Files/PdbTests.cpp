@@ -0,0 +1,743 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/PdbTests.cpp
+*
+* @summary:   PDB reader tests, against small PDBs built here: an MSF 7.0
+*             container with the info, DBI, section header, OMAP, public
+*             symbol and symbol record streams the reader uses.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "Pdb.hpp"
+#include <unistd.h>
+#include <vector>
+#include <string>
+
+//
+// Stream indices in the test PDBs (1 and 3 are fixed by the format).
+//
+#define TEST_PDB_INFO_STREAM 1
+#define TEST_PDB_DBI_STREAM 3
+#define TEST_PDB_PUBLICS_STREAM 4
+#define TEST_PDB_SYMBOLS_STREAM 5
+#define TEST_PDB_SECTIONS_STREAM 6
+#define TEST_PDB_OMAP_STREAM 7
+#define TEST_PDB_ORIGINAL_SECTIONS_STREAM 8
+#define TEST_PDB_STREAMS 9
+
+//
+// .text is the first section (segment 1), .data the second.
+//
+#define TEST_PDB_TEXT_RVA 0x1000
+#define TEST_PDB_DATA_RVA 0x8000
+#define TEST_PDB_AGE 3
+
+//
+// Filler publics, so the symbol stream spans many blocks.
+//
+#define TEST_PDB_FILLER_PUBLICS 200
+#define TEST_PDB_FILLER_OFFSET 0x4000
+
+static const uint8_t k_TestPdbGuid[16] =
+{
+    0x10, 0x32, 0x54, 0x76, 0x98, 0xBA, 0xDC, 0xFE,
+    0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF
+};
+
+//
+// A public in a test PDB: segment and offset, as stored.
+//
+typedef struct _TEST_PDB_PUBLIC
+{
+    uint16_t Segment;
+    uint32_t Offset;
+    uint32_t Flags;
+    const char* Name;
+} TEST_PDB_PUBLIC, *PTEST_PDB_PUBLIC;
+
+//
+// Code publics (flags: code | function), one static function (no public)
+// in a contribution of its own, and a data public which is skipped.
+//
+static const TEST_PDB_PUBLIC k_TestPdbPublics[] =
+{
+    { 1, 0x0000, 0x3, "?Initialize@@YAHXZ" },
+    { 1, 0x0100, 0x2, "?Run@Engine@@QEAAXH@Z" },
+    { 1, 0x0300, 0x3, "main" },
+    { 2, 0x0010, 0x0, "?g_Counter@@3HA" },
+};
+
+/**
+*
+* @brief        Appends a little-endian 16-bit value.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Value - The value.
+*
+*/
+static
+void
+AppendLe16 (
+    _Inout_ std::vector<uint8_t>& Buffer,
+    _In_ uint16_t Value
+    )
+{
+    Buffer.push_back(static_cast<uint8_t>(Value));
+    Buffer.push_back(static_cast<uint8_t>(Value >> 8));
+}
+
+/**
+*
+* @brief        Appends a little-endian 32-bit value.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Value - The value.
+*
+*/
+static
+void
+AppendLe32 (
+    _Inout_ std::vector<uint8_t>& Buffer,
+    _In_ uint32_t Value
+    )
+{
+    AppendLe16(Buffer, static_cast<uint16_t>(Value));
+    AppendLe16(Buffer, static_cast<uint16_t>(Value >> 16));
+}
+
+/**
+*
+* @brief        Writes a little-endian 32-bit value in place.
+* @param[in]    Buffer - The buffer.
+* @param[in]    Offset - Where.
+* @param[in]    Value - The value.
+*
+*/
+static
+void
+WriteLe32 (
+    _Inout_ std::vector<uint8_t>& Buffer,
+    _In_ size_t Offset,
+    _In_ uint32_t Value
+    )
+{
+    for (size_t i = 0; i < sizeof(uint32_t); i++)
+    {
+        Buffer[Offset + i] = static_cast<uint8_t>(Value >> (i * 8));
+    }
+}
+
+/**
+*
+* @brief        Appends section headers (only VirtualAddress and
+*               Characteristics matter to the reader).
+* @param[in]    Stream - The section header stream.
+* @param[in]    TextRva - .text's RVA.
+* @param[in]    DataRva - .data's RVA.
+*
+*/
+static
+void
+AppendSectionHeaders (
+    _Inout_ std::vector<uint8_t>& Stream,
+    _In_ uint32_t TextRva,
+    _In_ uint32_t DataRva
+    )
+{
+    for (uint32_t rva : { TextRva, DataRva })
+    {
+        size_t header;
+
+        header = Stream.size();
+        Stream.resize(header + 40, 0);
+
+        memcpy(&Stream[header], (rva == TextRva) ? ".text" : ".data", 5);
+        WriteLe32(Stream, (header + 8), 0x1000);
+        WriteLe32(Stream, (header + 12), rva);
+        WriteLe32(Stream, (header + 36), (rva == TextRva) ? 0x60000020 : 0xC0000040);
+    }
+}
+
+/**
+*
+* @brief        Packs streams into an MSF 7.0 container.
+* @param[in]    Streams - The streams (empty ones are left out).
+* @param[in]    BlockSize - The block size.
+* @param[in]    Scatter - Lay each stream's blocks out backwards, so nothing
+*               is contiguous.
+* @return       The container.
+*
+*/
+static
+std::vector<uint8_t>
+BuildMsf (
+    _In_ const std::vector<std::vector<uint8_t>>& Streams,
+    _In_ uint32_t BlockSize,
+    _In_ bool Scatter
+    )
+{
+    static const char magic[] = "Microsoft C/C++ MSF 7.00\r\n\x1a" "DS\0\0";
+    std::vector<uint8_t> file;
+    std::vector<uint8_t> directory;
+    std::vector<std::vector<uint32_t>> streamBlocks;
+    uint32_t dataBlocks;
+    uint32_t nextBlock;
+    uint32_t directoryBlocks;
+    uint32_t blockMapBlock;
+    uint32_t blockCount;
+
+    //
+    // Block 0 is the superblock and 1 and 2 the free block maps.
+    //
+    dataBlocks = 0;
+
+    for (const auto& stream : Streams)
+    {
+        dataBlocks += static_cast<uint32_t>((stream.size() + BlockSize - 1) / BlockSize);
+    }
+
+    nextBlock = 3;
+    streamBlocks.resize(Streams.size());
+
+    for (size_t i = 0; i < Streams.size(); i++)
+    {
+        for (size_t offset = 0; offset < Streams[i].size(); offset += BlockSize)
+        {
+            streamBlocks[i].push_back(Scatter ? ((3 + dataBlocks - 1) - (nextBlock - 3)) : nextBlock);
+            nextBlock++;
+        }
+    }
+
+    AppendLe32(directory, static_cast<uint32_t>(Streams.size()));
+
+    for (const auto& stream : Streams)
+    {
+        AppendLe32(directory, static_cast<uint32_t>(stream.size()));
+    }
+
+    for (const auto& blocks : streamBlocks)
+    {
+        for (uint32_t block : blocks)
+        {
+            AppendLe32(directory, block);
+        }
+    }
+
+    directoryBlocks = static_cast<uint32_t>((directory.size() + BlockSize - 1) / BlockSize);
+    blockMapBlock = (nextBlock + directoryBlocks);
+    blockCount = (blockMapBlock + 1);
+
+    file.resize(static_cast<size_t>(blockCount) * BlockSize, 0);
+
+    memcpy(file.data(), magic, 32);
+    WriteLe32(file, 32, BlockSize);
+    WriteLe32(file, 36, 1);
+    WriteLe32(file, 40, blockCount);
+    WriteLe32(file, 44, static_cast<uint32_t>(directory.size()));
+    WriteLe32(file, 52, blockMapBlock);
+
+    for (size_t i = 0; i < Streams.size(); i++)
+    {
+        for (size_t j = 0; j < streamBlocks[i].size(); j++)
+        {
+            size_t length;
+
+            length = (std::min)(static_cast<size_t>(BlockSize), (Streams[i].size() - (j * BlockSize)));
+
+            memcpy(&file[static_cast<size_t>(streamBlocks[i][j]) * BlockSize], &Streams[i][j * BlockSize], length);
+        }
+    }
+
+    memcpy(&file[static_cast<size_t>(nextBlock) * BlockSize], directory.data(), directory.size());
+
+    for (uint32_t i = 0; i < directoryBlocks; i++)
+    {
+        WriteLe32(file, ((static_cast<size_t>(blockMapBlock) * BlockSize) + (i * sizeof(uint32_t))), (nextBlock + i));
+    }
+
+    return file;
+}
+
+/**
+*
+* @brief        Builds a test PDB.
+* @param[in]    BlockSize - The MSF block size.
+* @param[in]    Scatter - Lay the streams' blocks out backwards.
+* @param[in]    Omap - Pretend the image was rewritten after linking: the
+*               PDB's layout has .text at 0x2000, and OMAP moves it back to
+*               TEST_PDB_TEXT_RVA - except main, which was dropped.
+* @return       The PDB file.
+*
+*/
+static
+std::vector<uint8_t>
+BuildTestPdb (
+    _In_ uint32_t BlockSize,
+    _In_ bool Scatter,
+    _In_ bool Omap
+    )
+{
+    std::vector<std::vector<uint8_t>> streams;
+    std::vector<uint8_t> addressMap;
+    std::vector<uint8_t> debugHeader;
+    std::vector<uint8_t> contributions;
+    std::vector<TEST_PDB_PUBLIC> publics;
+    std::vector<std::string> fillerNames;
+    uint32_t originalTextRva;
+
+    streams.resize(TEST_PDB_STREAMS);
+    originalTextRva = (Omap ? 0x2000 : TEST_PDB_TEXT_RVA);
+
+    //
+    // Info stream: version, signature, age, GUID.
+    //
+    auto& info = streams[TEST_PDB_INFO_STREAM];
+    AppendLe32(info, 20000404);
+    AppendLe32(info, 0x5F000000);
+    AppendLe32(info, TEST_PDB_AGE);
+    info.insert(info.end(), k_TestPdbGuid, (k_TestPdbGuid + sizeof(k_TestPdbGuid)));
+
+    //
+    // Symbol records, and the publics stream's address map of them.
+    //
+    publics.assign(k_TestPdbPublics, (k_TestPdbPublics + (sizeof(k_TestPdbPublics) / sizeof(k_TestPdbPublics[0]))));
+
+    for (uint32_t i = 0; i < TEST_PDB_FILLER_PUBLICS; i++)
+    {
+        fillerNames.push_back("?Filler" + std::to_string(i) + "@@YAXXZ");
+    }
+
+    for (uint32_t i = 0; i < TEST_PDB_FILLER_PUBLICS; i++)
+    {
+        publics.push_back({ 1, (TEST_PDB_FILLER_OFFSET + (i * 0x10)), 0x2, fillerNames[i].c_str() });
+    }
+
+    auto& symbols = streams[TEST_PDB_SYMBOLS_STREAM];
+
+    for (const auto& symbol : publics)
+    {
+        size_t record;
+        size_t nameLength;
+
+        record = symbols.size();
+        nameLength = (strlen(symbol.Name) + 1);
+
+        AppendLe16(symbols, 0);
+        AppendLe16(symbols, 0x110E);
+        AppendLe32(symbols, symbol.Flags);
+        AppendLe32(symbols, symbol.Offset);
+        AppendLe16(symbols, symbol.Segment);
+        symbols.insert(symbols.end(), symbol.Name, (symbol.Name + nameLength));
+
+        while ((symbols.size() % 4) != 0)
+        {
+            symbols.push_back(0);
+        }
+
+        symbols[record] = static_cast<uint8_t>((symbols.size() - record) - 2);
+        symbols[record + 1] = static_cast<uint8_t>(((symbols.size() - record) - 2) >> 8);
+
+        AppendLe32(addressMap, static_cast<uint32_t>(record));
+    }
+
+    auto& publicsStream = streams[TEST_PDB_PUBLICS_STREAM];
+    AppendLe32(publicsStream, 0);
+    AppendLe32(publicsStream, static_cast<uint32_t>(addressMap.size()));
+    publicsStream.resize(28, 0);
+    publicsStream.insert(publicsStream.end(), addressMap.begin(), addressMap.end());
+
+    //
+    // Section headers (the image's, and with OMAP, the original layout's).
+    //
+    AppendSectionHeaders(streams[TEST_PDB_SECTIONS_STREAM], TEST_PDB_TEXT_RVA, TEST_PDB_DATA_RVA);
+
+    if (Omap)
+    {
+        auto& omap = streams[TEST_PDB_OMAP_STREAM];
+
+        AppendSectionHeaders(streams[TEST_PDB_ORIGINAL_SECTIONS_STREAM], originalTextRva, TEST_PDB_DATA_RVA);
+
+        //
+        // (From, To) pairs, sorted by From: .text moves down by 0x1000,
+        // main's range is dropped, .data stays.
+        //
+        for (const auto& entry : { std::make_pair(0x2000u, static_cast<uint32_t>(TEST_PDB_TEXT_RVA)),
+                                   std::make_pair(0x2300u, 0u),
+                                   std::make_pair(0x2400u, static_cast<uint32_t>(TEST_PDB_TEXT_RVA + 0x400)),
+                                   std::make_pair(static_cast<uint32_t>(TEST_PDB_DATA_RVA), static_cast<uint32_t>(TEST_PDB_DATA_RVA)) })
+        {
+            AppendLe32(omap, entry.first);
+            AppendLe32(omap, entry.second);
+        }
+    }
+
+    //
+    // Section contributions (V60): each public's function is its own
+    // contribution, and 0x200 is a static function with none.
+    //
+    AppendLe32(contributions, (0xEFFE0000 + 19970605));
+
+    for (const auto& range : { std::make_pair(0x0000u, 0x100u),
+                               std::make_pair(0x0100u, 0x100u),
+                               std::make_pair(0x0200u, 0x80u),
+                               std::make_pair(0x0300u, 0x100u) })
+    {
+        AppendLe16(contributions, 1);
+        AppendLe16(contributions, 0);
+        AppendLe32(contributions, range.first);
+        AppendLe32(contributions, range.second);
+        AppendLe32(contributions, 0x60000020);
+        AppendLe16(contributions, 0);
+        AppendLe16(contributions, 0);
+        AppendLe32(contributions, 0);
+        AppendLe32(contributions, 0);
+    }
+
+    //
+    // Optional debug header: OMAP from source (4), section headers (5),
+    // original section headers (10).
+    //
+    for (uint16_t slot = 0; slot < 11; slot++)
+    {
+        AppendLe16(debugHeader,
+                   (slot == 5) ? TEST_PDB_SECTIONS_STREAM :
+                   ((slot == 4) && Omap) ? TEST_PDB_OMAP_STREAM :
+                   ((slot == 10) && Omap) ? TEST_PDB_ORIGINAL_SECTIONS_STREAM :
+                   0xFFFF);
+    }
+
+    auto& dbi = streams[TEST_PDB_DBI_STREAM];
+    AppendLe32(dbi, 0xFFFFFFFF);
+    AppendLe32(dbi, 19990903);
+    AppendLe32(dbi, TEST_PDB_AGE);
+    AppendLe16(dbi, 0xFFFF);
+    AppendLe16(dbi, 0);
+    AppendLe16(dbi, TEST_PDB_PUBLICS_STREAM);
+    AppendLe16(dbi, 0);
+    AppendLe16(dbi, TEST_PDB_SYMBOLS_STREAM);
+    AppendLe16(dbi, 0);
+    AppendLe32(dbi, 0);
+    AppendLe32(dbi, static_cast<uint32_t>(contributions.size()));
+    AppendLe32(dbi, 0);
+    AppendLe32(dbi, 0);
+    AppendLe32(dbi, 0);
+    AppendLe32(dbi, 0);
+    AppendLe32(dbi, static_cast<uint32_t>(debugHeader.size()));
+    AppendLe32(dbi, 0);
+    AppendLe16(dbi, 0);
+    AppendLe16(dbi, 0x8664);
+    AppendLe32(dbi, 0);
+    dbi.insert(dbi.end(), contributions.begin(), contributions.end());
+    dbi.insert(dbi.end(), debugHeader.begin(), debugHeader.end());
+
+    return BuildMsf(streams, BlockSize, Scatter);
+}
+
+/**
+*
+* @brief        Checks the symbols of a test PDB without OMAP.
+* @param[in]    Table - The parsed PDB.
+*
+*/
+static
+void
+CheckTestPdbSymbols (
+    _In_ const PDB_SYMBOL_TABLE* Table
+    )
+{
+    const char* name;
+    uint32_t displacement;
+
+    TEST_CHECK(memcmp(Table->Guid, k_TestPdbGuid, sizeof(k_TestPdbGuid)) == 0);
+    TEST_CHECK(Table->Age == TEST_PDB_AGE);
+
+    //
+    // Three code publics and the fillers. The data public is skipped.
+    //
+    TEST_CHECK(Table->Symbols.size() == (3 + TEST_PDB_FILLER_PUBLICS));
+    TEST_CHECK(Table->Contributions.size() == 4);
+
+    for (size_t i = 1; i < Table->Symbols.size(); i++)
+    {
+        TEST_CHECK(Table->Symbols[i - 1].Rva < Table->Symbols[i].Rva);
+    }
+
+    name = LookupPdbSymbol(Table, TEST_PDB_TEXT_RVA, &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "?Initialize@@YAHXZ") == 0) && (displacement == 0));
+
+    name = LookupPdbSymbol(Table, (TEST_PDB_TEXT_RVA + 0x142), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "?Run@Engine@@QEAAXH@Z") == 0) && (displacement == 0x42));
+
+    name = LookupPdbSymbol(Table, (TEST_PDB_TEXT_RVA + 0x310), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "main") == 0) && (displacement == 0x10));
+
+    name = LookupPdbSymbol(Table, (TEST_PDB_TEXT_RVA + TEST_PDB_FILLER_OFFSET + (199 * 0x10) + 4), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "?Filler199@@YAXXZ") == 0) && (displacement == 4));
+
+    //
+    // The static function's contribution has no public before it, so the
+    // preceding public (Run) must not claim it.
+    //
+    TEST_CHECK(LookupPdbSymbol(Table, (TEST_PDB_TEXT_RVA + 0x210), &displacement) == NULL);
+
+    TEST_CHECK(LookupPdbSymbol(Table, (TEST_PDB_TEXT_RVA - 1), &displacement) == NULL);
+}
+
+/**
+*
+* @brief        Checks a PDB parses, at the smallest and the usual block size,
+*               with streams laid out in order and scattered.
+*
+*/
+static
+void
+TestParsePdb ()
+{
+    for (uint32_t blockSize : { 512u, 4096u })
+    {
+        for (bool scatter : { false, true })
+        {
+            std::vector<uint8_t> pdb;
+            PDB_SYMBOL_TABLE table;
+
+            pdb = BuildTestPdb(blockSize, scatter, false);
+
+            if (TEST_CHECK(ParsePdb(pdb.data(), pdb.size(), &table)))
+            {
+                CheckTestPdbSymbols(&table);
+            }
+        }
+    }
+}
+
+/**
+*
+* @brief        Checks that OMAP moves symbols to the image's layout and drops
+*               the ones whose code was removed.
+*
+*/
+static
+void
+TestParsePdbOmap ()
+{
+    std::vector<uint8_t> pdb;
+    PDB_SYMBOL_TABLE table;
+    const char* name;
+    uint32_t displacement;
+
+    pdb = BuildTestPdb(512, false, true);
+
+    if (!TEST_CHECK(ParsePdb(pdb.data(), pdb.size(), &table)))
+    {
+        return;
+    }
+
+    //
+    // main (original 0x2300) was dropped, and contributions are not used
+    // with OMAP.
+    //
+    TEST_CHECK(table.Symbols.size() == (2 + TEST_PDB_FILLER_PUBLICS));
+    TEST_CHECK(table.Contributions.empty());
+
+    name = LookupPdbSymbol(&table, (TEST_PDB_TEXT_RVA + 0x8), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "?Initialize@@YAHXZ") == 0) && (displacement == 8));
+
+    name = LookupPdbSymbol(&table, (TEST_PDB_TEXT_RVA + 0x100), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "?Run@Engine@@QEAAXH@Z") == 0) && (displacement == 0));
+
+    name = LookupPdbSymbol(&table, (TEST_PDB_TEXT_RVA + TEST_PDB_FILLER_OFFSET), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "?Filler0@@YAXXZ") == 0) && (displacement == 0));
+}
+
+/**
+*
+* @brief        Checks that damaged PDBs are rejected without reading past
+*               their end (run under a sanitizer to be sure).
+*
+*/
+static
+void
+TestRejectDamagedPdbs ()
+{
+    std::vector<uint8_t> pdb;
+    std::vector<uint8_t> damaged;
+    PDB_SYMBOL_TABLE table;
+
+    pdb = BuildTestPdb(512, true, false);
+
+    //
+    // Cut short: the superblock's block count no longer fits.
+    //
+    for (size_t length = 0; length < pdb.size(); length += 97)
+    {
+        damaged.assign(pdb.begin(), (pdb.begin() + length));
+
+        TEST_CHECK(!ParsePdb(damaged.data(), damaged.size(), &table));
+    }
+
+    damaged = pdb;
+    damaged[0] ^= 0xFF;
+    TEST_CHECK(!ParsePdb(damaged.data(), damaged.size(), &table));
+
+    //
+    // A block size which is not a power of two, and a block map past the end.
+    //
+    damaged = pdb;
+    WriteLe32(damaged, 32, 1000);
+    TEST_CHECK(!ParsePdb(damaged.data(), damaged.size(), &table));
+
+    damaged = pdb;
+    WriteLe32(damaged, 52, 0xFFFFFF);
+    TEST_CHECK(!ParsePdb(damaged.data(), damaged.size(), &table));
+
+    //
+    // Garbage in every data block: never crashes (and never finds symbols
+    // which point outside the streams).
+    //
+    for (uint32_t seed = 1; seed < 64; seed++)
+    {
+        uint32_t state;
+
+        damaged = pdb;
+        state = seed;
+
+        for (size_t i = 512; i < damaged.size(); i += 7)
+        {
+            state = ((state * 1103515245) + 12345);
+
+            if (((state >> 16) & 15) == 0)
+            {
+                damaged[i] = static_cast<uint8_t>(state >> 24);
+            }
+        }
+
+        if (ParsePdb(damaged.data(), damaged.size(), &table))
+        {
+            for (const auto& symbol : table.Symbols)
+            {
+                TEST_CHECK(symbol.NameOffset < table.Names.size());
+            }
+        }
+    }
+}
+
+/**
+*
+* @brief        Checks that names are undecorated to the qualified name only,
+*               the same as dbghelp with SYMOPT_UNDNAME, and that names which
+*               cannot be are left as they are.
+*
+*/
+static
+void
+TestUndecorateNames ()
+{
+    static const char* const undecorated[][2] =
+    {
+        { "?Initialize@@YAHXZ", "Initialize" },
+        { "?Run@Engine@@QEAAXH@Z", "Engine::Run" },
+        { "?Get@Inner@Outer@Ns@@SAHXZ", "Ns::Outer::Inner::Get" },
+        { "?f@N@1@YAXXZ", "N::N::f" },
+        { "?Helper@?A0x1b2c3d4e@@YAXXZ", "`anonymous namespace'::Helper" },
+        { "??0Engine@@QEAA@XZ", "Engine::Engine" },
+        { "??1Engine@Ns@@QEAA@XZ", "Ns::Engine::~Engine" },
+        { "??4Engine@@QEAAAEAV0@AEBV0@@Z", "Engine::operator=" },
+        { "??_GEngine@@UEAAPEAXI@Z", "Engine::`scalar deleting destructor'" },
+        { "??_7Engine@@6B@", "Engine::`vftable'" },
+        { "??2@YAPEAX_K@Z", "operator new" },
+        { "??_U@YAPEAX_K@Z", "operator new[]" },
+    };
+
+    static const char* const unchanged[] =
+    {
+        "main",
+        "NtCreateFile",
+        "??$max@H@std@@YAAEBHAEBH0@Z",
+        "??BEngine@@QEBAHXZ",
+        "??_R0?AVEngine@@@8",
+        "?",
+        "??",
+        "??_",
+        "?Run",
+        "?Run@Engine",
+        "?f@N@5@YAXXZ",
+        "??0@QEAA@XZ",
+    };
+
+    std::string name;
+
+    for (const auto& pair : undecorated)
+    {
+        TEST_CHECK(UndecoratePdbName(pair[0], name));
+        TEST_CHECK(name == pair[1]);
+    }
+
+    for (const char* decorated : unchanged)
+    {
+        TEST_CHECK(!UndecoratePdbName(decorated, name));
+        TEST_CHECK(name == decorated);
+    }
+}
+
+/**
+*
+* @brief        Checks that a PDB loads from disk.
+*
+*/
+static
+void
+TestLoadPdb ()
+{
+    std::vector<uint8_t> pdb;
+    PDB_SYMBOL_TABLE table;
+    char path[] = "/tmp/vtl1mon-test-XXXXXX";
+    FILE* file;
+    int descriptor;
+
+    pdb = BuildTestPdb(4096, false, false);
+
+    descriptor = mkstemp(path);
+    if (!TEST_CHECK(descriptor != -1))
+    {
+        return;
+    }
+
+    file = fdopen(descriptor, "wb");
+
+    if (TEST_CHECK(file != NULL))
+    {
+        TEST_CHECK(fwrite(pdb.data(), 1, pdb.size(), file) == pdb.size());
+        fclose(file);
+
+        if (TEST_CHECK(LoadPdb(path, &table)))
+        {
+            CheckTestPdbSymbols(&table);
+        }
+    }
+
+    unlink(path);
+
+    TEST_CHECK(!LoadPdb("/nonexistent/vtl1mon.pdb", &table));
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("Parse a PDB", TestParsePdb);
+    RunTest("Parse a PDB with OMAP", TestParsePdbOmap);
+    RunTest("Reject damaged PDBs", TestRejectDamagedPdbs);
+    RunTest("Undecorate public names", TestUndecorateNames);
+    RunTest("Load a PDB from disk", TestLoadPdb);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
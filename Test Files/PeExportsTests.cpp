@@ -0,0 +1,293 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/PeExportsTests.cpp
+*
+* @summary:   PE export table and CodeView tests, against the dbghelp.dll
+*             checked in under SymbolDlls.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "PeExports.hpp"
+#include <vector>
+
+//
+// What is known about SymbolDlls/dbghelp.dll.
+//
+#define DBGHELP_EXPORTS 238
+#define DBGHELP_SIZE_OF_IMAGE 0x240000
+#define DBGHELP_TIME_DATE_STAMP 0x5F8B1735
+#define DBGHELP_TEXT_RVA 0x1000
+#define DBGHELP_FIRST_EXPORT_RVA 0x11A530
+#define DBGHELP_SYM_INITIALIZE_RVA 0x142730
+#define DBGHELP_SYM_FROM_ADDR_RVA 0x140410
+#define DBGHELP_SECOND_CODE_SECTION_RVA 0x199000
+
+static const uint8_t k_DbghelpPdbGuid[16] =
+{
+    0xDB, 0xCB, 0x19, 0x86, 0xF4, 0x0B, 0x24, 0x24,
+    0xED, 0xDE, 0x5B, 0x9B, 0x85, 0x1E, 0x78, 0xD6
+};
+
+//
+// The image, and its exports.
+//
+static MAPPED_FILE k_Image;
+static PE_EXPORT_TABLE k_Table;
+
+/**
+*
+* @brief        Checks the export table's shape.
+*
+*/
+static
+void
+TestParseExports ()
+{
+    TEST_CHECK(k_Table.Exports.size() == DBGHELP_EXPORTS);
+    TEST_CHECK(k_Table.SizeOfImage == DBGHELP_SIZE_OF_IMAGE);
+    TEST_CHECK(k_Table.TimeDateStamp == DBGHELP_TIME_DATE_STAMP);
+    TEST_CHECK(k_Table.CodeSections.size() == 2);
+
+    if (!k_Table.CodeSections.empty())
+    {
+        TEST_CHECK(k_Table.CodeSections[0].VirtualAddress == DBGHELP_TEXT_RVA);
+    }
+
+    if (!k_Table.Exports.empty())
+    {
+        TEST_CHECK(k_Table.Exports[0].Rva == DBGHELP_FIRST_EXPORT_RVA);
+    }
+
+    for (size_t i = 0; i < k_Table.Exports.size(); i++)
+    {
+        TEST_CHECK(k_Table.Exports[i].NameOffset < k_Table.Names.size());
+
+        if (i != 0)
+        {
+            TEST_CHECK(k_Table.Exports[i - 1].Rva <= k_Table.Exports[i].Rva);
+        }
+    }
+}
+
+/**
+*
+* @brief        Checks lookups at and inside exported functions.
+*
+*/
+static
+void
+TestLookupExports ()
+{
+    const char* name;
+    uint32_t displacement;
+
+    name = LookupPeExport(&k_Table, DBGHELP_SYM_INITIALIZE_RVA, &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "SymInitialize") == 0));
+    TEST_CHECK(displacement == 0);
+
+    name = LookupPeExport(&k_Table, (DBGHELP_SYM_INITIALIZE_RVA + 0x10), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "SymInitialize") == 0));
+    TEST_CHECK(displacement == 0x10);
+
+    name = LookupPeExport(&k_Table, (DBGHELP_SYM_FROM_ADDR_RVA + 1), &displacement);
+    TEST_CHECK((name != NULL) && (strcmp(name, "SymFromAddr") == 0));
+    TEST_CHECK(displacement == 1);
+}
+
+/**
+*
+* @brief        Checks that RVAs no export covers stay unresolved: before the
+*               first export, in another section than the nearest export, and
+*               outside every code section.
+*
+*/
+static
+void
+TestLookupUncovered ()
+{
+    uint32_t displacement;
+
+    TEST_CHECK(LookupPeExport(&k_Table, DBGHELP_TEXT_RVA, &displacement) == NULL);
+    TEST_CHECK(LookupPeExport(&k_Table, (DBGHELP_FIRST_EXPORT_RVA - 1), &displacement) == NULL);
+    TEST_CHECK(LookupPeExport(&k_Table, (DBGHELP_SECOND_CODE_SECTION_RVA + 0x10), &displacement) == NULL);
+    TEST_CHECK(LookupPeExport(&k_Table, 0, &displacement) == NULL);
+    TEST_CHECK(LookupPeExport(&k_Table, 0x200, &displacement) == NULL);
+    TEST_CHECK(LookupPeExport(&k_Table, (DBGHELP_SIZE_OF_IMAGE + 0x1000), &displacement) == NULL);
+    TEST_CHECK(LookupPeExport(&k_Table, 0xFFFFFFFF, &displacement) == NULL);
+}
+
+/**
+*
+* @brief        Checks that a batch resolves every RVA the same as one lookup
+*               at a time.
+*
+*/
+static
+void
+TestLookupBatch ()
+{
+    std::vector<SYMBOL_BATCH_ENTRY> batch;
+    uint32_t seed;
+    size_t mismatches;
+
+    seed = 0x12345678;
+
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        SYMBOL_BATCH_ENTRY entry;
+
+        seed = ((seed * 1103515245) + 12345);
+
+        //
+        // Mostly around the exports, some anywhere in (or past) the image.
+        //
+        if ((i & 3) != 0)
+        {
+            entry.Rva = (DBGHELP_FIRST_EXPORT_RVA - 0x1000) + ((seed >> 8) % 0x40000);
+        }
+        else
+        {
+            entry.Rva = ((seed >> 4) % (DBGHELP_SIZE_OF_IMAGE + 0x10000));
+        }
+
+        entry.Slot = i;
+        entry.NameOffset = 0;
+        entry.Displacement = 0;
+
+        batch.push_back(entry);
+    }
+
+    LookupPeExportBatch(&k_Table, batch.data(), batch.size());
+
+    mismatches = 0;
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        const char* name;
+        uint32_t displacement;
+
+        if ((i != 0) &&
+            (batch[i - 1].Rva > batch[i].Rva))
+        {
+            mismatches++;
+        }
+
+        name = LookupPeExport(&k_Table, batch[i].Rva, &displacement);
+
+        if (name == NULL)
+        {
+            if (batch[i].NameOffset != SYMBOL_BATCH_UNRESOLVED)
+            {
+                mismatches++;
+            }
+        }
+        else if ((batch[i].NameOffset == SYMBOL_BATCH_UNRESOLVED) ||
+                 (name != &k_Table.Names[batch[i].NameOffset]) ||
+                 (displacement != batch[i].Displacement))
+        {
+            mismatches++;
+        }
+    }
+
+    TEST_CHECK(mismatches == 0);
+}
+
+/**
+*
+* @brief        Checks the CodeView record, which picks the matching PDB.
+*
+*/
+static
+void
+TestCodeView ()
+{
+    PE_CODEVIEW codeView;
+
+    if (!TEST_CHECK(ParsePeCodeView(k_Image.Data, k_Image.Length, &codeView)))
+    {
+        return;
+    }
+
+    TEST_CHECK(codeView.PdbPath == "dbghelp.pdb");
+    TEST_CHECK(codeView.Age == 1);
+    TEST_CHECK(memcmp(codeView.Guid, k_DbghelpPdbGuid, sizeof(k_DbghelpPdbGuid)) == 0);
+}
+
+/**
+*
+* @brief        Checks that truncated images are rejected (or parsed without
+*               reading past their end - run under a sanitizer to be sure).
+*
+*/
+static
+void
+TestTruncatedImages ()
+{
+    PE_EXPORT_TABLE table;
+    PE_CODEVIEW codeView;
+    std::vector<uint8_t> prefix;
+
+    TEST_CHECK(!ParsePeExports(k_Image.Data, 0, &table));
+    TEST_CHECK(!ParsePeExports(k_Image.Data, 64, &table));
+    TEST_CHECK(!ParsePeCodeView(k_Image.Data, 64, &codeView));
+
+    for (size_t length = 256; length < k_Image.Length; length += (length / 3))
+    {
+        //
+        // A copy of exactly the prefix, so overreads leave the buffer.
+        //
+        prefix.assign(k_Image.Data, (k_Image.Data + length));
+
+        if (ParsePeExports(prefix.data(), prefix.size(), &table))
+        {
+            TEST_CHECK(table.Exports.size() <= DBGHELP_EXPORTS);
+        }
+
+        ParsePeCodeView(prefix.data(), prefix.size(), &codeView);
+    }
+}
+
+/**
+*
+* @brief        Test entry point.
+* @param[in]    argc - Number of arguments.
+* @param[in]    argv - Argument array (argv[1] is the path to dbghelp.dll).
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main (
+    _In_ int argc,
+    _In_ char** argv
+    )
+{
+    if (argc < 2)
+    {
+        wprintf(L"[+] Usage: ./PeExportsTests /path/to/SymbolDlls/dbghelp.dll\n");
+        return 1;
+    }
+
+    if ((!MapFileReadOnly(argv[1], &k_Image)) ||
+        (!ParsePeExports(k_Image.Data, k_Image.Length, &k_Table)))
+    {
+        wprintf(L"[-] Error! Unable to parse " PRINTF_NARROW_STRING L".\n", argv[1]);
+        return 1;
+    }
+
+    RunTest("Parse dbghelp.dll exports", TestParseExports);
+    RunTest("Look up exports", TestLookupExports);
+    RunTest("Leave uncovered RVAs unresolved", TestLookupUncovered);
+    RunTest("Batch lookups match single lookups", TestLookupBatch);
+    RunTest("Parse the CodeView record", TestCodeView);
+    RunTest("Reject truncated images", TestTruncatedImages);
+
+    UnmapMappedFile(&k_Image);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
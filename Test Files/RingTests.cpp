@@ -0,0 +1,347 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/RingTests.cpp
+*
+* @summary:   Shared memory export ring tests: records round trip, lapped
+*             readers count what they lost, and recycled strings are never
+*             handed out as a newer record's.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "RingClient.hpp"
+#include <unistd.h>
+
+//
+// Names recycled by the string generation test, and its (tiny) table.
+//
+#define RING_TEST_NAMES 50
+#define RING_TEST_STRINGS_SIZE 256
+
+/**
+*
+* @brief        Makes a ring name no other test run is using.
+* @param[out]   Name - Receives the name.
+* @param[in]    Test - Which test it is for.
+*
+*/
+static
+void
+GetTestRingName (
+    _Out_ char (&Name)[64],
+    _In_ const char* Test
+    )
+{
+    snprintf(Name, sizeof(Name), "vtl1mon-test-%s-%d", Test, static_cast<int>(getpid()));
+}
+
+/**
+*
+* @brief        Publishes a record whose frames are derived from its number.
+* @param[in]    Producer - The producer.
+* @param[in]    Number - The record's number.
+* @param[in]    ProcessName - The record's process name.
+*
+*/
+static
+void
+PublishTestRecord (
+    _Inout_ PRING_PRODUCER Producer,
+    _In_ uint32_t Number,
+    _In_ uint32_t ProcessName
+    )
+{
+    PRING_RECORD record;
+
+    record = BeginRingRecord(Producer);
+
+    record->TimeStamp = Number;
+    record->ProcessId = Number;
+    record->ThreadId = (Number * 3);
+    record->ProcessName = ProcessName;
+    record->ThreadName = 0;
+    record->SecureCallName = 0;
+    record->SecureCallNumber = static_cast<uint16_t>(Number & 0xFF);
+    record->NumberOfFrames = static_cast<uint16_t>(Number % (RING_MAX_FRAMES + 1));
+    record->TotalFrames = record->NumberOfFrames;
+    record->Reserved = 0;
+    record->StringGeneration = Producer->StringGeneration;
+
+    for (uint32_t i = 0; i < record->NumberOfFrames; i++)
+    {
+        record->Frames[i] = (Number + i);
+        record->FrameNames[i] = 0;
+    }
+
+    CommitRingRecord(Producer, record);
+}
+
+/**
+*
+* @brief        Checks a record published by PublishTestRecord.
+* @param[in]    Record - The record.
+* @param[in]    Number - The record's number.
+* @return       true if it is intact, otherwise false.
+*
+*/
+static
+bool
+IsTestRecordIntact (
+    _In_ const RING_RECORD* Record,
+    _In_ uint32_t Number
+    )
+{
+    if ((Record->TimeStamp != Number) ||
+        (Record->ThreadId != (Number * 3)) ||
+        (Record->NumberOfFrames != (Number % (RING_MAX_FRAMES + 1))))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < Record->NumberOfFrames; i++)
+    {
+        if (Record->Frames[i] != (Number + i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+*
+* @brief        Checks that records and their strings round trip, and that a
+*               reader sees the ring close once it has read everything.
+*
+*/
+static
+void
+TestRoundTrip ()
+{
+    char name[64];
+    RING_PRODUCER producer;
+    RING_READER reader;
+    RING_RECORD record;
+    uint32_t processName;
+    uint32_t number;
+
+    GetTestRingName(name, "roundtrip");
+
+    if (!TEST_CHECK(CreateRingProducer(&producer, name, RING_MIN_RECORDS, RING_DEFAULT_STRINGS_SIZE)))
+    {
+        return;
+    }
+
+    if (!TEST_CHECK(OpenRingReader(&reader, name)))
+    {
+        CloseRingProducer(&producer);
+        return;
+    }
+
+    TEST_CHECK(ReadRingRecord(&reader, &record) == RingReadEmpty);
+
+    processName = AddRingString(&producer, "lsass.exe", 9);
+    TEST_CHECK(processName != 0);
+
+    for (number = 0; number < 500; number++)
+    {
+        PublishTestRecord(&producer, number, processName);
+    }
+
+    for (number = 0; ReadRingRecord(&reader, &record) == RingReadRecord; number++)
+    {
+        TEST_CHECK(IsTestRecordIntact(&record, number));
+        TEST_CHECK(strcmp(GetRingString(&reader, &record, record.ProcessName), "lsass.exe") == 0);
+        TEST_CHECK(GetRingString(&reader, &record, 0)[0] == '\0');
+    }
+
+    TEST_CHECK(number == 500);
+    TEST_CHECK(reader.Lost == 0);
+
+    CloseRingProducer(&producer);
+
+    TEST_CHECK(ReadRingRecord(&reader, &record) == RingReadClosed);
+
+    CloseRingReader(&reader);
+}
+
+/**
+*
+* @brief        Checks that a reader which falls more than a ring behind loses
+*               exactly the records it missed, and reads the rest intact.
+*
+*/
+static
+void
+TestLappedReader ()
+{
+    char name[64];
+    RING_PRODUCER producer;
+    RING_READER reader;
+    RING_RECORD record;
+    uint32_t number;
+    uint32_t read;
+
+    GetTestRingName(name, "lapped");
+
+    if (!TEST_CHECK(CreateRingProducer(&producer, name, RING_MIN_RECORDS, RING_DEFAULT_STRINGS_SIZE)))
+    {
+        return;
+    }
+
+    if (!TEST_CHECK(OpenRingReader(&reader, name)))
+    {
+        CloseRingProducer(&producer);
+        return;
+    }
+
+    for (number = 0; number < ((RING_MIN_RECORDS * 3) + 17); number++)
+    {
+        PublishTestRecord(&producer, number, 0);
+    }
+
+    for (read = 0; ReadRingRecord(&reader, &record) == RingReadRecord; read++)
+    {
+        TEST_CHECK(IsTestRecordIntact(&record, static_cast<uint32_t>(record.Sequence.load() - 1)));
+    }
+
+    TEST_CHECK(read == RING_MIN_RECORDS);
+    TEST_CHECK(reader.Lost == ((RING_MIN_RECORDS * 2) + 17));
+
+    CloseRingReader(&reader);
+    CloseRingProducer(&producer);
+}
+
+/**
+*
+* @brief        Checks that a tiny string table is recycled in generations, and
+*               that a record's strings are either its own or reported gone.
+*
+*/
+static
+void
+TestStringGenerations ()
+{
+    char name[64];
+    char text[32];
+    char expected[32];
+    RING_PRODUCER producer;
+    RING_READER reader;
+    RING_RECORD record;
+    RING_STRING_REF refs[RING_TEST_NAMES];
+    uint32_t offset;
+    uint32_t wrong;
+    uint32_t stale;
+    int length;
+
+    GetTestRingName(name, "strings");
+
+    memset(refs, 0, sizeof(refs));
+    wrong = 0;
+    stale = 0;
+
+    if (!TEST_CHECK(CreateRingProducer(&producer, name, RING_MIN_RECORDS, RING_TEST_STRINGS_SIZE)))
+    {
+        return;
+    }
+
+    if (!TEST_CHECK(OpenRingReader(&reader, name)))
+    {
+        CloseRingProducer(&producer);
+        return;
+    }
+
+    for (uint32_t number = 0; number < 2000; number++)
+    {
+        uint32_t id;
+
+        id = (number % RING_TEST_NAMES);
+        length = snprintf(text, sizeof(text), "process-%u", id);
+
+        //
+        // The same as the live export: a name which does not fit starts a
+        // new generation, and is added again there.
+        //
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            offset = GetRingStringRef(&producer, &refs[id], text, length);
+
+            if (!producer.StringsFull)
+            {
+                break;
+            }
+
+            StartRingStringGeneration(&producer);
+        }
+
+        PublishTestRecord(&producer, id, offset);
+
+        //
+        // A reader keeping up always gets its record's own strings.
+        //
+        if (ReadRingRecord(&reader, &record) == RingReadRecord)
+        {
+            snprintf(expected, sizeof(expected), "process-%u", record.ProcessId);
+
+            if (strcmp(GetRingString(&reader, &record, record.ProcessName), expected) != 0)
+            {
+                wrong++;
+            }
+        }
+    }
+
+    TEST_CHECK(producer.StringGenerations > 10);
+    TEST_CHECK(producer.StringsDropped == 0);
+
+    //
+    // A reader going back over old records finds most strings recycled -
+    // and is told so, instead of being handed a newer record's.
+    //
+    SeekRingReaderToOldest(&reader);
+
+    while (ReadRingRecord(&reader, &record) == RingReadRecord)
+    {
+        const char* string;
+
+        string = GetRingString(&reader, &record, record.ProcessName);
+        snprintf(expected, sizeof(expected), "process-%u", record.ProcessId);
+
+        if (!IsRingRecordStringsValid(&reader, &record))
+        {
+            stale++;
+            TEST_CHECK(string[0] == '\0');
+        }
+        else if (strcmp(string, expected) != 0)
+        {
+            wrong++;
+        }
+    }
+
+    TEST_CHECK(wrong == 0);
+    TEST_CHECK(stale != 0);
+
+    CloseRingReader(&reader);
+    CloseRingProducer(&producer);
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("Records and strings round trip", TestRoundTrip);
+    RunTest("A lapped reader counts its losses", TestLappedReader);
+    RunTest("Strings are recycled in generations", TestStringGenerations);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
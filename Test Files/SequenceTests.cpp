@@ -0,0 +1,360 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/SequenceTests.cpp
+*
+* @summary:   Sequence miner tests: n-gram keys are built from a thread's
+*             history and broken by gaps, thread slots are taken over when
+*             both of a pair are in use, and example stacks are only asked
+*             for while the counter still holds the sequence.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "Sequence.hpp"
+#include <vector>
+
+//
+// The gap the tests mine with, in timestamp ticks.
+//
+#define SEQUENCE_TEST_GAP 100
+
+/**
+*
+* @brief        Builds the key of a sequence, as the miner packs it.
+* @param[in]    Calls - The secure calls, first call first.
+* @param[in]    Length - The number of calls.
+* @return       The key.
+*
+*/
+static
+uint64_t
+MakeTestSequenceKey (
+    _In_ const uint16_t* Calls,
+    _In_ uint32_t Length
+    )
+{
+    uint64_t key;
+
+    key = 0;
+
+    for (uint32_t i = 0; i < Length; i++)
+    {
+        key = ((key << 16) | Calls[i]);
+    }
+
+    return key;
+}
+
+/**
+*
+* @brief        Gets the count of a sequence.
+* @param[in]    Miner - The miner.
+* @param[in]    Calls - The secure calls, first call first.
+* @param[in]    Length - The number of calls.
+* @return       The count, or 0 if the sequence has no counter.
+*
+*/
+static
+uint64_t
+GetTestSequenceCount (
+    _In_ const SEQUENCE_MINER* Miner,
+    _In_ const uint16_t* Calls,
+    _In_ uint32_t Length
+    )
+{
+    uint64_t key;
+
+    key = MakeTestSequenceKey(Calls, Length);
+
+    for (const auto& entry : Miner->Trackers[Length - SEQUENCE_MIN_LENGTH].Entries)
+    {
+        if (entry.Key == key)
+        {
+            return entry.Count;
+        }
+    }
+
+    return 0;
+}
+
+/**
+*
+* @brief        Finds thread IDs which share a pair of thread slots.
+* @param[in]    Count - The number of thread IDs.
+* @param[out]   ThreadIds - Receives the thread IDs.
+*
+*/
+static
+void
+FindTestThreadIds (
+    _In_ size_t Count,
+    _Out_ std::vector<uint32_t>& ThreadIds
+    )
+{
+    uint64_t pair;
+
+    ThreadIds.clear();
+
+    pair = (HashTopKKey(0, 4) & (SEQUENCE_THREAD_SLOTS - 2));
+
+    for (uint32_t threadId = 4; ThreadIds.size() < Count; threadId += 4)
+    {
+        if ((HashTopKKey(0, threadId) & (SEQUENCE_THREAD_SLOTS - 2)) == pair)
+        {
+            ThreadIds.push_back(threadId);
+        }
+    }
+}
+
+/**
+*
+* @brief        Checks that a thread's calls are counted as every sequence of
+*               2 to 4 calls they contain, in order, and that the key packs the
+*               first call highest.
+*
+*/
+static
+void
+TestSequenceKeys ()
+{
+    SEQUENCE_MINER miner;
+    static const uint16_t calls[] = { 0x11, 0x22, 0x33, 0x44, 0xFFFF };
+    uint64_t total;
+
+    InitializeSequenceMiner(&miner, 64, SEQUENCE_TEST_GAP);
+
+    for (uint32_t i = 0; i < 5; i++)
+    {
+        CountSequenceCall(&miner, 8, (1000 + (i * 10)), calls[i]);
+    }
+
+    TEST_CHECK(miner.Calls == 5);
+    TEST_CHECK(miner.Gaps == 0);
+
+    //
+    // Five calls hold four pairs, three triples and two quadruples, each once.
+    //
+    total = 0;
+
+    for (uint32_t length = SEQUENCE_MIN_LENGTH; length <= SEQUENCE_MAX_LENGTH; length++)
+    {
+        TEST_CHECK(miner.Trackers[length - SEQUENCE_MIN_LENGTH].Total == (5 - length + 1));
+
+        for (uint32_t first = 0; (first + length) <= 5; first++)
+        {
+            TEST_CHECK(GetTestSequenceCount(&miner, &calls[first], length) == 1);
+        }
+
+        total += miner.Trackers[length - SEQUENCE_MIN_LENGTH].Total;
+    }
+
+    TEST_CHECK(total == 9);
+
+    //
+    // Not the same sequence backwards.
+    //
+    {
+        static const uint16_t reversed[] = { 0x22, 0x11 };
+
+        TEST_CHECK(GetTestSequenceCount(&miner, reversed, 2) == 0);
+    }
+
+    TEST_CHECK(MakeTestSequenceKey(&calls[1], 4) == 0x002200330044FFFFULL);
+    TEST_CHECK(GetSequenceCall(0x002200330044FFFFULL, 4, 0) == 0x22);
+    TEST_CHECK(GetSequenceCall(0x002200330044FFFFULL, 4, 3) == 0xFFFF);
+    TEST_CHECK(GetSequenceCall(0x00110022ULL, 2, 0) == 0x11);
+    TEST_CHECK(GetSequenceCall(0x00110022ULL, 2, 1) == 0x22);
+}
+
+/**
+*
+* @brief        Checks that a gap longer than the miner's breaks a thread's
+*               history, and that other threads' histories are their own.
+*
+*/
+static
+void
+TestSequenceGapsAndThreads ()
+{
+    SEQUENCE_MINER miner;
+    static const uint16_t pair[] = { 1, 2 };
+    static const uint16_t spanning[] = { 2, 3 };
+    static const uint16_t interleaved[] = { 1, 3 };
+
+    InitializeSequenceMiner(&miner, 64, SEQUENCE_TEST_GAP);
+
+    CountSequenceCall(&miner, 8, 1000, 1);
+    CountSequenceCall(&miner, 8, (1000 + SEQUENCE_TEST_GAP), 2);
+
+    //
+    // Just over the gap: a new history.
+    //
+    CountSequenceCall(&miner, 8, (1000 + (2 * SEQUENCE_TEST_GAP) + 1), 3);
+
+    TEST_CHECK(miner.Gaps == 1);
+    TEST_CHECK(GetTestSequenceCount(&miner, pair, 2) == 1);
+    TEST_CHECK(GetTestSequenceCount(&miner, spanning, 2) == 0);
+    TEST_CHECK(miner.Trackers[0].Total == 1);
+    TEST_CHECK(miner.Trackers[1].Total == 0);
+
+    //
+    // Calls of two threads interleaved never form a sequence together.
+    //
+    InitializeSequenceMiner(&miner, 64, SEQUENCE_TEST_GAP);
+
+    CountSequenceCall(&miner, 8, 1000, 1);
+    CountSequenceCall(&miner, 12, 1001, 3);
+    CountSequenceCall(&miner, 8, 1002, 2);
+    CountSequenceCall(&miner, 12, 1003, 4);
+
+    TEST_CHECK(GetTestSequenceCount(&miner, pair, 2) == 1);
+    TEST_CHECK(GetTestSequenceCount(&miner, interleaved, 2) == 0);
+    TEST_CHECK(miner.Trackers[0].Total == 2);
+}
+
+/**
+*
+* @brief        Checks that a third thread in a pair of slots takes over the
+*               one used least recently, and that the thread it evicted starts
+*               again with no history.
+*
+*/
+static
+void
+TestSequenceThreadEviction ()
+{
+    SEQUENCE_MINER miner;
+    std::vector<uint32_t> threadIds;
+    static const uint16_t first[] = { 1, 2 };
+    static const uint16_t second[] = { 5, 6 };
+    static const uint16_t continued[] = { 2, 3 };
+
+    FindTestThreadIds(3, threadIds);
+
+    InitializeSequenceMiner(&miner, 64, SEQUENCE_TEST_GAP);
+
+    CountSequenceCall(&miner, threadIds[0], 1000, 1);
+    CountSequenceCall(&miner, threadIds[1], 1001, 5);
+    CountSequenceCall(&miner, threadIds[0], 1002, 2);
+
+    TEST_CHECK(miner.Evictions == 0);
+
+    //
+    // The second thread was used least recently.
+    //
+    CountSequenceCall(&miner, threadIds[2], 1003, 9);
+
+    TEST_CHECK(miner.Evictions == 1);
+
+    CountSequenceCall(&miner, threadIds[0], 1004, 3);
+    CountSequenceCall(&miner, threadIds[1], 1005, 6);
+
+    TEST_CHECK(GetTestSequenceCount(&miner, first, 2) == 1);
+    TEST_CHECK(GetTestSequenceCount(&miner, continued, 2) == 1);
+    TEST_CHECK(GetTestSequenceCount(&miner, second, 2) == 0);
+
+    //
+    // And it took the third thread's slot in turn.
+    //
+    TEST_CHECK(miner.Evictions == 2);
+}
+
+/**
+*
+* @brief        Checks that the sequences a call ended are handed out for an
+*               example stack once, only for that call, and not once their
+*               counter has been taken over by another sequence.
+*
+*/
+static
+void
+TestSequencePendingExamples ()
+{
+    SEQUENCE_MINER miner;
+    PTOP_K_ENTRY entries[SEQUENCE_LENGTHS];
+    uint32_t count;
+
+    InitializeSequenceMiner(&miner, 64, SEQUENCE_TEST_GAP);
+
+    CountSequenceCall(&miner, 8, 1000, 1);
+    CountSequenceCall(&miner, 8, 1001, 2);
+    CountSequenceCall(&miner, 8, 1002, 3);
+
+    //
+    // Not the thread's last call.
+    //
+    TEST_CHECK(TakeSequencePending(&miner, 8, 1001, entries) == 0);
+
+    count = TakeSequencePending(&miner, 8, 1002, entries);
+
+    if (TEST_CHECK(count == 2))
+    {
+        static const uint16_t calls[] = { 1, 2, 3 };
+
+        TEST_CHECK(entries[0]->Key == MakeTestSequenceKey(&calls[1], 2));
+        TEST_CHECK(entries[1]->Key == MakeTestSequenceKey(calls, 3));
+
+        //
+        // Given an example, the sequences are not asked for one again.
+        //
+        entries[0]->Sample.NumberOfFrames = 1;
+        entries[1]->Sample.NumberOfFrames = 1;
+    }
+
+    TEST_CHECK(TakeSequencePending(&miner, 8, 1002, entries) == 0);
+
+    CountSequenceCall(&miner, 8, 1003, 2);
+    CountSequenceCall(&miner, 8, 1004, 3);
+
+    count = TakeSequencePending(&miner, 8, 1004, entries);
+
+    //
+    // (2, 3) has an example already; (3, 2, 3) and (2, 3, 2, 3) are new.
+    //
+    TEST_CHECK(count == 2);
+
+    //
+    // One counter per length: the next thread's sequence takes it over
+    // before the first thread's stack is correlated.
+    //
+    InitializeSequenceMiner(&miner, 1, SEQUENCE_TEST_GAP);
+
+    CountSequenceCall(&miner, 8, 1000, 1);
+    CountSequenceCall(&miner, 8, 1001, 2);
+    CountSequenceCall(&miner, 12, 1002, 7);
+    CountSequenceCall(&miner, 12, 1003, 8);
+
+    TEST_CHECK(miner.Trackers[0].Replacements == 1);
+    TEST_CHECK(TakeSequencePending(&miner, 8, 1001, entries) == 0);
+
+    count = TakeSequencePending(&miner, 12, 1003, entries);
+
+    if (TEST_CHECK(count == 1))
+    {
+        TEST_CHECK(entries[0]->Key == 0x00070008ULL);
+        TEST_CHECK(entries[0]->Count == 2);
+        TEST_CHECK(entries[0]->Error == 1);
+    }
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("Sequences of 2 to 4 calls are keyed first call highest", TestSequenceKeys);
+    RunTest("Gaps and other threads break sequences", TestSequenceGapsAndThreads);
+    RunTest("A third thread takes over the least recently used slot", TestSequenceThreadEviction);
+    RunTest("Example stacks are asked for once per counter", TestSequencePendingExamples);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
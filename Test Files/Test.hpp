@@ -0,0 +1,99 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/Test.hpp
+*
+* @summary:   Minimal test harness for the portable subset's tests. Each test
+*             file is its own executable, run by CTest; it exits non-zero if
+*             any check failed.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#pragma once
+#include "Portable.hpp"
+#include <stdio.h>
+#include <wchar.h>
+
+//
+// Checks which have failed so far.
+//
+static int k_TestFailures = 0;
+
+//
+// Records (and reports) a failed check, and carries on.
+//
+#define TEST_CHECK(Condition) CheckTestCondition((Condition), #Condition, __FILE__, __LINE__)
+
+/**
+*
+* @brief        Checks a test condition.
+* @param[in]    Condition - The condition.
+* @param[in]    Text - The condition's source text.
+* @param[in]    File - The file it is in.
+* @param[in]    Line - The line it is on.
+* @return       The condition.
+*
+*/
+inline
+bool
+CheckTestCondition (
+    _In_ bool Condition,
+    _In_ const char* Text,
+    _In_ const char* File,
+    _In_ int Line
+    )
+{
+    if (!Condition)
+    {
+        wprintf(L"  [>] Check failed: " PRINTF_NARROW_STRING L" (" PRINTF_NARROW_STRING L":%d)\n", Text, File, Line);
+        k_TestFailures++;
+    }
+
+    return Condition;
+}
+
+/**
+*
+* @brief        Runs a test and reports whether it passed.
+* @param[in]    Name - The test's name.
+* @param[in]    Test - The test.
+*
+*/
+inline
+void
+RunTest (
+    _In_ const char* Name,
+    _In_ void (*Test)()
+    )
+{
+    int failures;
+
+    failures = k_TestFailures;
+
+    Test();
+
+    wprintf(L"[%c] " PRINTF_NARROW_STRING L"\n", (k_TestFailures == failures) ? L'+' : L'-', Name);
+}
+
+/**
+*
+* @brief        Gets a test executable's exit code.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+inline
+int
+GetTestExitCode ()
+{
+    if (k_TestFailures != 0)
+    {
+        wprintf(L"[-] %d check(s) failed.\n", k_TestFailures);
+        return 1;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,373 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/TopKTests.cpp
+*
+* @summary:   Top-K tracker tests: Space-Saving's count and error bounds hold
+*             against exact counts, and the heap and the open-addressed index
+*             stay consistent while counters are taken over.
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "TopK.hpp"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+*
+* @brief        Gets the next value of a xorshift64 generator.
+* @param[in]    Seed - The generator state.
+* @return       The value.
+*
+*/
+static
+uint64_t
+NextTestRandom (
+    _Inout_ uint64_t* Seed
+    )
+{
+    *Seed ^= (*Seed << 13);
+    *Seed ^= (*Seed >> 7);
+    *Seed ^= (*Seed << 17);
+
+    return *Seed;
+}
+
+/**
+*
+* @brief        Draws a key, skewed so a few are heavy and most are rare: key
+*               n is drawn about twice as often as key 2n.
+* @param[in]    Seed - The generator state.
+* @param[in]    Keys - The number of keys.
+* @return       The key.
+*
+*/
+static
+uint64_t
+NextTestKey (
+    _Inout_ uint64_t* Seed,
+    _In_ uint64_t Keys
+    )
+{
+    uint64_t limit;
+
+    limit = ((NextTestRandom(Seed) % Keys) + 1);
+
+    return (NextTestRandom(Seed) % limit);
+}
+
+/**
+*
+* @brief        Checks a tracker's heap and index against its entries.
+* @param[in]    Tracker - The tracker.
+* @return       true if they are consistent, otherwise false.
+*
+*/
+static
+bool
+IsTopKTrackerConsistent (
+    _In_ const TOP_K_TRACKER* Tracker
+    )
+{
+    std::unordered_set<uint64_t> keys;
+    std::vector<bool> inHeap;
+    size_t mask;
+    size_t used;
+
+    if ((Tracker->Entries.size() > Tracker->Capacity) ||
+        (Tracker->Heap.size() != Tracker->Entries.size()))
+    {
+        return false;
+    }
+
+    //
+    // The heap is a permutation of the entries, each entry knows its
+    // position, and no child is smaller than its parent.
+    //
+    inHeap.assign(Tracker->Entries.size(), false);
+
+    for (size_t position = 0; position < Tracker->Heap.size(); position++)
+    {
+        uint32_t index;
+
+        index = Tracker->Heap[position];
+
+        if ((index >= Tracker->Entries.size()) ||
+            (inHeap[index]) ||
+            (Tracker->Entries[index].HeapIndex != position))
+        {
+            return false;
+        }
+
+        inHeap[index] = true;
+
+        if ((position != 0) &&
+            (Tracker->Entries[Tracker->Heap[(position - 1) / 2]].Count > Tracker->Entries[index].Count))
+        {
+            return false;
+        }
+    }
+
+    //
+    // Every entry is in the index exactly once, reachable by probing from
+    // its home slot without crossing an empty one.
+    //
+    mask = (Tracker->Slots.size() - 1);
+    used = 0;
+
+    for (size_t slot = 0; slot < Tracker->Slots.size(); slot++)
+    {
+        const TOP_K_ENTRY* entry;
+        size_t probe;
+
+        if (Tracker->Slots[slot] == 0)
+        {
+            continue;
+        }
+
+        used++;
+
+        if (Tracker->Slots[slot] > Tracker->Entries.size())
+        {
+            return false;
+        }
+
+        entry = &Tracker->Entries[Tracker->Slots[slot] - 1];
+
+        if (!keys.insert(entry->Key).second)
+        {
+            return false;
+        }
+
+        for (probe = (HashTopKKey(0, entry->Key) & mask); probe != slot; probe = ((probe + 1) & mask))
+        {
+            if (Tracker->Slots[probe] == 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    return (used == Tracker->Entries.size());
+}
+
+/**
+*
+* @brief        Checks Space-Saving's guarantees against exact counts: every
+*               counter is within its error of the truth, the counters add up
+*               to the total, and every key seen more than Total / Capacity
+*               times has a counter.
+*
+*/
+static
+void
+TestCountAndErrorBounds ()
+{
+    TOP_K_TRACKER tracker;
+    std::unordered_map<uint64_t, uint64_t> exact;
+    uint64_t seed;
+    uint64_t sum;
+    uint64_t minimum;
+    size_t underCounted;
+    size_t overErrored;
+    size_t missing;
+
+    InitializeTopKTracker(&tracker, 256);
+
+    seed = 0x243F6A8885A308D3ULL;
+
+    for (uint32_t i = 0; i < 500000; i++)
+    {
+        uint64_t key;
+        uint64_t count;
+        bool claimed;
+
+        key = NextTestKey(&seed, 20000);
+        count = (((i % 7) == 0) ? 3 : 1);
+
+        exact[key] += count;
+
+        OfferTopKKey(&tracker, key, count, &claimed);
+    }
+
+    TEST_CHECK(tracker.Total == 500000 + (((500000 + 6) / 7) * 2));
+    TEST_CHECK(tracker.Entries.size() == tracker.Capacity);
+    TEST_CHECK(tracker.Replacements != 0);
+
+    sum = 0;
+    underCounted = 0;
+    overErrored = 0;
+
+    for (const auto& entry : tracker.Entries)
+    {
+        uint64_t truth;
+
+        truth = exact[entry.Key];
+        sum += entry.Count;
+
+        if (entry.Count < truth)
+        {
+            underCounted++;
+        }
+
+        if ((entry.Count - entry.Error) > truth)
+        {
+            overErrored++;
+        }
+    }
+
+    TEST_CHECK(sum == tracker.Total);
+    TEST_CHECK(underCounted == 0);
+    TEST_CHECK(overErrored == 0);
+
+    //
+    // A key without a counter was seen at most the smallest count.
+    //
+    minimum = GetTopKMinimumCount(&tracker);
+    missing = 0;
+
+    TEST_CHECK(minimum <= (tracker.Total / tracker.Capacity));
+
+    for (const auto& key : exact)
+    {
+        bool tracked;
+
+        tracked = false;
+
+        for (const auto& entry : tracker.Entries)
+        {
+            if (entry.Key == key.first)
+            {
+                tracked = true;
+                break;
+            }
+        }
+
+        if ((!tracked) &&
+            ((key.second > minimum) ||
+             (key.second > (tracker.Total / tracker.Capacity))))
+        {
+            missing++;
+        }
+    }
+
+    TEST_CHECK(missing == 0);
+}
+
+/**
+*
+* @brief        Checks that GetTopKEntries returns the largest counters, largest first.
+*
+*/
+static
+void
+TestLargestEntries ()
+{
+    TOP_K_TRACKER tracker;
+    std::vector<const TOP_K_ENTRY*> entries;
+    bool claimed;
+
+    InitializeTopKTracker(&tracker, 8);
+
+    TEST_CHECK(GetTopKMinimumCount(&tracker) == 0);
+
+    for (uint64_t key = 1; key <= 6; key++)
+    {
+        OfferTopKKey(&tracker, key, (key * 10), &claimed);
+
+        TEST_CHECK(claimed);
+    }
+
+    OfferTopKKey(&tracker, 2, 100, &claimed);
+
+    TEST_CHECK(!claimed);
+
+    //
+    // Not every counter is in use, so nothing is missing yet.
+    //
+    TEST_CHECK(GetTopKMinimumCount(&tracker) == 0);
+
+    GetTopKEntries(&tracker, 3, entries);
+
+    if (TEST_CHECK(entries.size() == 3))
+    {
+        TEST_CHECK((entries[0]->Key == 2) && (entries[0]->Count == 120));
+        TEST_CHECK((entries[1]->Key == 6) && (entries[1]->Count == 60));
+        TEST_CHECK((entries[2]->Key == 5) && (entries[2]->Count == 50));
+    }
+
+    GetTopKEntries(&tracker, 100, entries);
+
+    TEST_CHECK(entries.size() == 6);
+}
+
+/**
+*
+* @brief        Takes counters over again and again - mostly new keys, which
+*               evict, and some repeats, which sift down - and checks the heap
+*               and the index (including backshift deletion) after every offer.
+*
+*/
+static
+void
+TestHeapAndIndexUnderChurn ()
+{
+    TOP_K_TRACKER tracker;
+    uint64_t seed;
+    size_t inconsistent;
+    bool claimed;
+
+    seed = 0x13198A2E03707344ULL;
+    inconsistent = 0;
+
+    //
+    // A small index, so probe chains are long and wrap around.
+    //
+    for (uint32_t capacity : { 1u, 2u, 7u, 32u })
+    {
+        InitializeTopKTracker(&tracker, capacity);
+
+        for (uint32_t i = 0; i < 20000; i++)
+        {
+            uint64_t key;
+            PTOP_K_ENTRY entry;
+
+            key = (((NextTestRandom(&seed) % 4) == 0) ? (NextTestRandom(&seed) % 8) : NextTestRandom(&seed));
+
+            entry = OfferTopKKey(&tracker, key, ((NextTestRandom(&seed) % 3) + 1), &claimed);
+
+            if ((entry->Key != key) ||
+                (!IsTopKTrackerConsistent(&tracker)))
+            {
+                inconsistent++;
+            }
+        }
+
+        TEST_CHECK(tracker.Replacements != 0);
+        TEST_CHECK(tracker.Entries.size() == capacity);
+    }
+
+    TEST_CHECK(inconsistent == 0);
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("Counts are within their error of the truth", TestCountAndErrorBounds);
+    RunTest("The largest entries come first", TestLargestEntries);
+    RunTest("The heap and index stay consistent under churn", TestHeapAndIndexUnderChurn);
+
+    return GetTestExitCode();
+}
\ No newline at end of file
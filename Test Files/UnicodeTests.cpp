@@ -0,0 +1,272 @@
+/*++
+* Copyright (c) Connor McGarr. All rights reserved.
+*
+* @file:      Vtl1Mon/UnicodeTests.cpp
+*
+* @summary:   UTF-16 to UTF-8 tests: short all-ASCII strings, unpaired
+*             surrogates, and surrogate pairs on either side of the vector
+*             path's 8 and 16 character boundaries. (The vector path is only
+*             built where wchar_t is 16 bits; elsewhere these cover the
+*             scalar path.)
+*
+* @author:    Connor McGarr (@33y0re)
+*
+* @copyright  Use of this source code is governed by a MIT-style license that
+*             can be found in the LICENSE file.
+*
+--*/
+#include "Test.hpp"
+#include "Unicode.hpp"
+#include <vector>
+#include <string>
+
+//
+// Written past the end of the output, to catch overruns.
+//
+#define UNICODE_TEST_CANARY 0x5A
+
+/**
+*
+* @brief        Appends a code point as UTF-8 - the slow, obvious way.
+* @param[in]    CodePoint - The code point.
+* @param[out]   Utf8 - Receives the bytes.
+*
+*/
+static
+void
+AppendTestUtf8 (
+    _In_ uint32_t CodePoint,
+    _Inout_ std::string& Utf8
+    )
+{
+    if (CodePoint < 0x80)
+    {
+        Utf8 += static_cast<char>(CodePoint);
+    }
+    else if (CodePoint < 0x800)
+    {
+        Utf8 += static_cast<char>(0xC0 | (CodePoint >> 6));
+        Utf8 += static_cast<char>(0x80 | (CodePoint & 0x3F));
+    }
+    else if (CodePoint < 0x10000)
+    {
+        Utf8 += static_cast<char>(0xE0 | (CodePoint >> 12));
+        Utf8 += static_cast<char>(0x80 | ((CodePoint >> 6) & 0x3F));
+        Utf8 += static_cast<char>(0x80 | (CodePoint & 0x3F));
+    }
+    else
+    {
+        Utf8 += static_cast<char>(0xF0 | (CodePoint >> 18));
+        Utf8 += static_cast<char>(0x80 | ((CodePoint >> 12) & 0x3F));
+        Utf8 += static_cast<char>(0x80 | ((CodePoint >> 6) & 0x3F));
+        Utf8 += static_cast<char>(0x80 | (CodePoint & 0x3F));
+    }
+}
+
+/**
+*
+* @brief        Transcodes into a buffer of exactly the documented size, and
+*               checks that nothing past the returned length was written.
+* @param[in]    Source - The UTF-16 characters.
+* @param[out]   Utf8 - Receives the UTF-8.
+* @return       true if the output stayed in bounds, otherwise false.
+*
+*/
+static
+bool
+TranscodeTestString (
+    _In_ const std::vector<wchar_t>& Source,
+    _Out_ std::string& Utf8
+    )
+{
+    std::vector<char> destination;
+    size_t length;
+
+    destination.assign((Source.size() * UTF8_MAX_BYTES_PER_WCHAR) + 16, static_cast<char>(UNICODE_TEST_CANARY));
+
+    length = TranscodeUtf16ToUtf8(Source.data(), Source.size(), destination.data());
+
+    Utf8.assign(destination.data(), length);
+
+    for (size_t i = length; i < destination.size(); i++)
+    {
+        if (destination[i] != static_cast<char>(UNICODE_TEST_CANARY))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+*
+* @brief        Checks all-ASCII strings of 0 to 17 characters - empty, shorter
+*               than one vector, exactly one, and one more.
+*
+*/
+static
+void
+TestAsciiLengths ()
+{
+    for (size_t length = 0; length <= 17; length++)
+    {
+        std::vector<wchar_t> source;
+        std::string expected;
+        std::string utf8;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            source.push_back(static_cast<wchar_t>(L'!' + ((i * 7) % 94)));
+            expected += static_cast<char>('!' + ((i * 7) % 94));
+        }
+
+        TEST_CHECK(TranscodeTestString(source, utf8));
+        TEST_CHECK(utf8 == expected);
+    }
+
+    //
+    // 0x7F is the last ASCII character, 0x80 the first which is not.
+    //
+    {
+        std::vector<wchar_t> source(17, static_cast<wchar_t>(0x7F));
+        std::string utf8;
+
+        TEST_CHECK(TranscodeTestString(source, utf8));
+        TEST_CHECK(utf8 == std::string(17, '\x7F'));
+
+        source[16] = static_cast<wchar_t>(0x80);
+
+        TEST_CHECK(TranscodeTestString(source, utf8));
+        TEST_CHECK(utf8 == (std::string(16, '\x7F') + "\xC2\x80"));
+    }
+}
+
+/**
+*
+* @brief        Checks that every kind of unpaired surrogate becomes U+FFFD, and
+*               that whatever follows it is still transcoded.
+*
+*/
+static
+void
+TestUnpairedSurrogates ()
+{
+    static const struct
+    {
+        std::vector<wchar_t> Source;
+        const char* Expected;
+    } cases[] =
+    {
+        { { 0xD83D }, "\xEF\xBF\xBD" },
+        { { 0xDE00 }, "\xEF\xBF\xBD" },
+        { { 0xD83D, L'a' }, "\xEF\xBF\xBD" "a" },
+        { { 0xD83D, 0xD83D, 0xDE00 }, "\xEF\xBF\xBD" "\xF0\x9F\x98\x80" },
+        { { 0xDE00, 0xD83D }, "\xEF\xBF\xBD" "\xEF\xBF\xBD" },
+        { { 0xD83D, 0x00E9 }, "\xEF\xBF\xBD" "\xC3\xA9" },
+        { { L'a', 0xDBFF }, "a" "\xEF\xBF\xBD" },
+        { { 0xDBFF, 0xDFFF }, "\xF4\x8F\xBF\xBF" },
+        { { 0xD800, 0xDC00 }, "\xF0\x90\x80\x80" },
+        { { 0xD7FF, 0xE000 }, "\xED\x9F\xBF" "\xEE\x80\x80" },
+    };
+
+    for (const auto& test : cases)
+    {
+        std::string utf8;
+
+        TEST_CHECK(TranscodeTestString(test.Source, utf8));
+        TEST_CHECK(utf8 == test.Expected);
+    }
+}
+
+/**
+*
+* @brief        Puts a surrogate pair (and, separately, a lone high surrogate)
+*               after every ASCII prefix of up to 40 characters, so that it
+*               straddles the 8 and 16 character vector boundaries, and checks
+*               against the reference.
+*
+*/
+static
+void
+TestSurrogatesAcrossVectorBoundaries ()
+{
+    for (size_t prefix = 0; prefix <= 40; prefix++)
+    {
+        for (size_t suffix = 0; suffix <= 17; suffix += 17)
+        {
+            std::vector<wchar_t> paired;
+            std::vector<wchar_t> unpaired;
+            std::string expectedPaired;
+            std::string expectedUnpaired;
+            std::string utf8;
+
+            for (size_t i = 0; i < prefix; i++)
+            {
+                paired.push_back(static_cast<wchar_t>(L'A' + (i % 26)));
+                AppendTestUtf8(static_cast<uint32_t>(L'A' + (i % 26)), expectedPaired);
+            }
+
+            unpaired = paired;
+            expectedUnpaired = expectedPaired;
+
+            //
+            // U+1F600, and its high surrogate on its own.
+            //
+            paired.push_back(static_cast<wchar_t>(0xD83D));
+            paired.push_back(static_cast<wchar_t>(0xDE00));
+            AppendTestUtf8(0x1F600, expectedPaired);
+
+            unpaired.push_back(static_cast<wchar_t>(0xD83D));
+            AppendTestUtf8(0xFFFD, expectedUnpaired);
+
+            for (size_t i = 0; i < suffix; i++)
+            {
+                paired.push_back(static_cast<wchar_t>(L'a' + (i % 26)));
+                AppendTestUtf8(static_cast<uint32_t>(L'a' + (i % 26)), expectedPaired);
+
+                unpaired.push_back(static_cast<wchar_t>(L'a' + (i % 26)));
+                AppendTestUtf8(static_cast<uint32_t>(L'a' + (i % 26)), expectedUnpaired);
+            }
+
+            TEST_CHECK(TranscodeTestString(paired, utf8));
+            TEST_CHECK(utf8 == expectedPaired);
+
+            TEST_CHECK(TranscodeTestString(unpaired, utf8));
+            TEST_CHECK(utf8 == expectedUnpaired);
+        }
+    }
+}
+
+/**
+*
+* @brief        Checks ConvertToUtf8 against the transcoder.
+*
+*/
+static
+void
+TestConvertToUtf8 ()
+{
+    static const wchar_t text[] = { L'l', L's', L'a', L's', L's', 0x00E9, 0x4E2D, 0xD83D, 0xDE00, L'.', L'e', L'x', L'e', 0 };
+
+    TEST_CHECK(ConvertToUtf8(text) == "lsass" "\xC3\xA9" "\xE4\xB8\xAD" "\xF0\x9F\x98\x80" ".exe");
+    TEST_CHECK(ConvertToUtf8(text, 0).empty());
+    TEST_CHECK(ConvertToUtf8(text, 5) == "lsass");
+}
+
+/**
+*
+* @brief        Test entry point.
+* @return       0 if every check passed, otherwise 1.
+*
+*/
+int
+main ()
+{
+    RunTest("All-ASCII strings of 0 to 17 characters", TestAsciiLengths);
+    RunTest("Unpaired surrogates become U+FFFD", TestUnpairedSurrogates);
+    RunTest("Surrogates across vector boundaries", TestSurrogatesAcrossVectorBoundaries);
+    RunTest("ConvertToUtf8 matches the transcoder", TestConvertToUtf8);
+
+    return GetTestExitCode();
+}
\ No newline at end of file